@@ -579,7 +579,7 @@ SVNRepos::verify(File &path, Revision &revisionStart, Revision &revisionEnd,
       (SVN_ERR_INCORRECT_PARAMS, NULL,
        _("Start revision cannot be higher than end revision")), );
 
-  SVN_JNI_ERR(svn_repos_verify_fs2(repos, lower, upper,
+  SVN_JNI_ERR(svn_repos_verify_fs3(repos, lower, upper, 1,
                                    notifyCallback != NULL
                                     ? ReposNotifyCallback::notify
                                     : NULL,
@@ -281,6 +281,82 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
                                   svn_boolean_t thread_safe,
                                   apr_pool_t *result_pool);
 
+/**
+ * Creates a new membuffer cache object in @a *cache just like
+ * svn_cache__membuffer_cache_create() but places it in anonymous shared
+ * memory.  All processes forked from the current one after this call
+ * will operate on the same cache content.  Access is serialized across
+ * threads as well as processes.
+ *
+ * Child processes must call svn_cache__membuffer_cache_child_init()
+ * before accessing the cache.
+ *
+ * The shared memory and the locks will be released when @a result_pool
+ * gets cleaned up.  If the platform does not support anonymous shared
+ * memory, an error will be returned.
+ */
+svn_error_t *
+svn_cache__membuffer_cache_create_shared(svn_membuffer_t **cache,
+                                         apr_size_t total_size,
+                                         apr_size_t directory_size,
+                                         apr_pool_t *result_pool);
+
+/**
+ * Prepare the inherited shared membuffer @a cache for use in a newly
+ * forked child process.  This is a no-op for process-local caches.
+ * Allocations will be made in @a pool.
+ */
+svn_error_t *
+svn_cache__membuffer_cache_child_init(svn_membuffer_t *cache,
+                                      apr_pool_t *pool);
+
+/**
+ * A function type for checking whether the content of a cache snapshot
+ * may still be used.  @a validation is the data that has been passed to
+ * svn_cache__membuffer_cache_save() when the snapshot was written.  Set
+ * @a *valid to @c FALSE if the snapshot must be discarded.  @a baton
+ * is the caller-provided context.  Use @a scratch_pool for temporary
+ * allocations.
+ */
+typedef svn_error_t *(*svn_cache__validate_func_t)(
+  svn_boolean_t *valid,
+  void *baton,
+  const svn_string_t *validation,
+  apr_pool_t *scratch_pool);
+
+/**
+ * Write the content of the membuffer @a cache to the file at @a path,
+ * replacing it atomically if it already exists.  The caller-defined
+ * @a validation data will be stored with it and may be @c NULL.
+ * Segments will be locked one at a time while being written.
+ * Use @a scratch_pool for temporary allocations.
+ */
+svn_error_t *
+svn_cache__membuffer_cache_save(svn_membuffer_t *cache,
+                                const char *path,
+                                const svn_string_t *validation,
+                                apr_pool_t *scratch_pool);
+
+/**
+ * Replace the content of the membuffer @a cache with the snapshot
+ * previously written to @a path by svn_cache__membuffer_cache_save().
+ * Snapshots written by a different Subversion version or for a cache of
+ * different size will be ignored as will be missing files.  Otherwise,
+ * @a validate_func will be called with @a validate_baton and the stored
+ * validation data to decide whether to use the snapshot.  It may be
+ * @c NULL.  Corrupted segments will be left empty.
+ *
+ * Set @a *loaded to @c TRUE, if the full snapshot has been loaded.
+ * Use @a scratch_pool for temporary allocations.
+ */
+svn_error_t *
+svn_cache__membuffer_cache_load(svn_boolean_t *loaded,
+                                svn_membuffer_t *cache,
+                                const char *path,
+                                svn_cache__validate_func_t validate_func,
+                                void *validate_baton,
+                                apr_pool_t *scratch_pool);
+
 /**
  * Creates a new cache in @a *cache_p, storing the data in a potentially
  * shared @a membuffer object.  The elements in the cache will be indexed
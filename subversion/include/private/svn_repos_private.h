@@ -81,6 +81,122 @@ const char *
 svn_repos__post_commit_error_str(svn_error_t *err,
                                  apr_pool_t *pool);
 
+/**
+ * Like svn_repos_authz_read(), but share the compiled rules with all
+ * other callers in this process that read the same @a file, for as long
+ * as its modification time and size don't change.  The shared rules are
+ * released when @a pool is cleaned up.
+ *
+ * Files that can't be stat'ed are read without caching them.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_repos__authz_read_cached(svn_authz_t **authz_p,
+                             const char *file,
+                             svn_boolean_t must_exist,
+                             apr_pool_t *pool);
+
+/**
+ * Counters describing how much work lookups in an authz have caused.
+ *
+ * @since New in 1.8.
+ */
+typedef struct svn_repos__authz_stats_t
+{
+  /** Number of paths checked by svn_repos_authz_check_access() and
+   * svn_repos__authz_check_access_many(). */
+  apr_uint32_t lookups;
+
+  /** Number of those lookups that had to check a whole subtree because
+   * @c svn_authz_recursive access was requested. */
+  apr_uint32_t recursive_lookups;
+
+  /** Number of those lookups for access to any path in a repository. */
+  apr_uint32_t repos_lookups;
+
+  /** Number of those lookups done by svn_repos__authz_check_access_many(). */
+  apr_uint32_t batched_lookups;
+
+  /** Number of rule sections evaluated by all lookups together. */
+  apr_uint32_t sections_checked;
+
+  /** Number of times svn_repos__authz_read_cached() returned these rules
+   * without reading the file again. */
+  apr_uint32_t cache_hits;
+} svn_repos__authz_stats_t;
+
+/**
+ * Set @a *stats to the current lookup counters of @a authz.  The counters
+ * are updated atomically and may wrap around.
+ *
+ * @since New in 1.8.
+ */
+void
+svn_repos__authz_get_stats(svn_repos__authz_stats_t *stats,
+                           svn_authz_t *authz);
+
+/**
+ * Like svn_repos_authz_check_access(), but check the @a required_access
+ * for each of the @a paths (<tt>const char *</tt> fspaths, never @c NULL)
+ * and set the corresponding element of the @a access_granted array.
+ *
+ * All paths are answered in one pass over the rules: a path reuses the
+ * rule lookups done for the leading segments it shares with the path
+ * before it.  Sorting @a paths, e.g. with svn_sort_compare_paths(), thus
+ * makes this cheapest.
+ *
+ * Use @a pool for temporary allocations.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_repos__authz_check_access_many(svn_boolean_t *access_granted,
+                                   svn_authz_t *authz,
+                                   const char *repos_name,
+                                   const apr_array_header_t *paths,
+                                   const char *user,
+                                   svn_repos_authz_access_t required_access,
+                                   apr_pool_t *pool);
+
+/**
+ * Baton for svn_repos__authz_read_func().
+ *
+ * @since New in 1.8.
+ */
+typedef struct svn_repos__authz_read_baton_t
+{
+  /** The rules to check. */
+  svn_authz_t *authz;
+
+  /** The repository name to look up repository-specific rules for,
+   * may be @c NULL. */
+  const char *repos_name;
+
+  /** The authenticated user, @c NULL for anonymous access. */
+  const char *user;
+} svn_repos__authz_read_baton_t;
+
+/**
+ * Set @a *allowed to whether @a path is readable according to the
+ * svn_repos__authz_read_baton_t @a baton.  @a path may be relative
+ * or empty, in which case it is taken relative to the repository root.
+ * @a root is not used.  Implements #svn_repos_authz_func_t.
+ *
+ * svn_repos_get_logs4(), svn_repos_check_revision_access() and the
+ * update reporter recognize this function.  They then check all changed
+ * paths of a revision with svn_repos__authz_check_access_many(), or
+ * whole readable subtrees at once, instead of calling it for each path.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_repos__authz_read_func(svn_boolean_t *allowed,
+                           svn_fs_root_t *root,
+                           const char *path,
+                           void *baton,
+                           apr_pool_t *pool);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
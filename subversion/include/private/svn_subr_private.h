@@ -202,6 +202,40 @@ svn_stream__from_spillbuf(apr_size_t blocksize,
 /** @} */
 
 
+/** LZ4 Compression
+ *
+ * A self-contained implementation of the LZ4 block format.  It trades
+ * compression ratio for speed: decompression is several times faster
+ * than zlib's.
+ *
+ * @defgroup svn_lz4 LZ4 Compression
+ * @{
+ */
+
+/* Return the maximum number of bytes that svn__lz4_compress() may
+   produce for LEN bytes of input. */
+apr_size_t
+svn__lz4_compress_bound(apr_size_t len);
+
+/* Compress the LEN bytes at DATA into a single LZ4 block and append it
+   to OUT.  LEN must not exceed APR_UINT32_MAX. */
+void
+svn__lz4_compress(svn_stringbuf_t *out,
+                  const char *data,
+                  apr_size_t len);
+
+/* Decompress the LZ4 block of LEN bytes at DATA, which must expand to
+   exactly ORIGINAL_LEN bytes, and set OUT to the result.  Return
+   SVN_ERR_LZ4_DECOMPRESSION_FAILED if the block is malformed. */
+svn_error_t *
+svn__lz4_decompress(svn_stringbuf_t *out,
+                    const char *data,
+                    apr_size_t len,
+                    apr_size_t original_len);
+
+/** @} */
+
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
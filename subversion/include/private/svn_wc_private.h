@@ -1623,6 +1623,73 @@ svn_wc__get_diff_editor(const svn_delta_editor_t **editor,
                         apr_pool_t *scratch_pool);
 
 
+/**
+ * The state of a file merge between svn_wc__merge_prepare() and
+ * svn_wc__merge_complete().
+ *
+ * @since New in 1.8.
+ */
+typedef struct svn_wc__text_merge_t svn_wc__text_merge_t;
+
+/**
+ * Perform the first part of svn_wc_merge4(): check the merge target and
+ * prepare merging the arguments into it.  Set @a *merge to the prepared
+ * merge, allocated with copies of all arguments in @a result_pool, which
+ * must live until the merge has been completed.
+ *
+ * The three parts of a merge let callers run the expensive part, the
+ * 3-way comparison of the files, on a different thread:
+ * svn_wc__merge_prepare() and svn_wc__merge_complete() access the
+ * working copy and must be called from the thread that owns @a wc_ctx.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_wc__merge_prepare(svn_wc__text_merge_t **merge,
+                      svn_wc_context_t *wc_ctx,
+                      const char *left_abspath,
+                      const char *right_abspath,
+                      const char *target_abspath,
+                      const char *left_label,
+                      const char *right_label,
+                      const char *target_label,
+                      const svn_wc_conflict_version_t *left_version,
+                      const svn_wc_conflict_version_t *right_version,
+                      svn_boolean_t dry_run,
+                      const char *diff3_cmd,
+                      const apr_array_header_t *merge_options,
+                      const apr_array_header_t *prop_diff,
+                      svn_cancel_func_t cancel_func,
+                      void *cancel_baton,
+                      apr_pool_t *result_pool,
+                      apr_pool_t *scratch_pool);
+
+/**
+ * Run the 3-way text merge of @a merge, if it needs one.  This does not
+ * access the working copy, nor allocate from anything but @a scratch_pool,
+ * so it may be called from any thread.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_wc__merge_run(svn_wc__text_merge_t *merge,
+                  apr_pool_t *scratch_pool);
+
+/**
+ * Complete the prepared and run @a merge like svn_wc_merge4() does:
+ * resolve or flag conflicts, install the result and set @a *merge_outcome.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_wc__merge_complete(enum svn_wc_merge_outcome_t *merge_outcome,
+                       svn_wc__text_merge_t *merge,
+                       svn_wc_conflict_resolver_func2_t conflict_func,
+                       void *conflict_baton,
+                       svn_cancel_func_t cancel_func,
+                       void *cancel_baton,
+                       apr_pool_t *scratch_pool);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
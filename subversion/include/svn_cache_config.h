@@ -56,6 +56,14 @@ typedef struct svn_cache_config_t
 
   /** is this application guaranteed to be single-threaded? */
   svn_boolean_t single_threaded;
+
+  /** shall the cache be placed in shared memory such that all processes
+     forked after its creation use the same cache content?  Only
+     effective if the cache gets allocated before forking, see
+     svn_cache_config_allocate().
+
+     @since New in 1.8. */
+  svn_boolean_t shared;
 } svn_cache_config_t;
 
 /** Get the current cache configuration. If it has not been set,
@@ -78,6 +86,33 @@ svn_cache_config_get(void);
 void
 svn_cache_config_set(const svn_cache_config_t *settings);
 
+/** Allocate the process-wide cache using the current configuration
+   right now instead of upon first use.  Pre-forking servers that set
+   the @c shared option must call this in the parent process, i.e. before
+   forking their workers, to make them share one cache.
+
+   If the shared cache cannot be created, a process-local one will be
+   used instead.  Errors are silently ignored and will simply result
+   in caching being disabled.
+
+   This function is not thread-safe. Therefore, it should be called
+   from the processes' initialization code only.
+
+   @since New in 1.8.
+ */
+void
+svn_cache_config_allocate(void);
+
+/** Prepare the process-wide cache inherited from the parent process
+   for use in a newly forked worker process.  Call this once in every
+   child process that has been forked after svn_cache_config_allocate().
+   Allocations will be made in @a pool.
+
+   @since New in 1.8.
+ */
+svn_error_t *
+svn_cache_config_child_init(apr_pool_t *pool);
+
 /** @} */
 
 /** @} */
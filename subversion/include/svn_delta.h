@@ -70,6 +70,13 @@ extern "C" {
  */
 #define SVN_DELTA_COMPRESSION_LEVEL_DEFAULT 5
 
+/** This is the maximum number of worker threads an svndiff encoder
+ * will use to compress delta windows.  Larger requests get clamped.
+ *
+ * @since New in 1.8.
+ */
+#define SVN_DELTA_MAX_THREADS 16
+
 /**
  * Get libsvn_delta version information.
  *
@@ -362,6 +369,23 @@ svn_txdelta_next_window(svn_txdelta_window_t **window,
 const unsigned char *
 svn_txdelta_md5_digest(svn_txdelta_stream_t *stream);
 
+/** The source and target view length of the svndiff windows that this
+ * library produces by default.  Readers before 1.8 reject any window
+ * larger than this.
+ *
+ * @since New in 1.8.
+ */
+#define SVN_DELTA_DEFAULT_WINDOW_SIZE 102400
+
+/** The largest source and target view length of an svndiff window that
+ * this library will produce or accept.  Parsers only accept windows
+ * larger than #SVN_DELTA_DEFAULT_WINDOW_SIZE if explicitly told to, see
+ * svn_txdelta_read_svndiff_window2().
+ *
+ * @since New in 1.8.
+ */
+#define SVN_DELTA_MAX_WINDOW_SIZE (16 * 1024 * 1024)
+
 /** Set @a *stream to a pointer to a delta stream that will turn the byte
  * string from @a source into the byte stream from @a target.
  *
@@ -369,7 +393,25 @@ svn_txdelta_md5_digest(svn_txdelta_stream_t *stream);
  * svn_txdelta_next_window() on @a *stream, it will read from @a source and
  * @a target to gather as much data as it needs.
  *
+ * Each window will cover at most @a window_size bytes of source and of
+ * target data.  Larger windows find matches that are farther apart and
+ * reduce the per-window overhead but need more memory.  0 selects the
+ * default size; values above #SVN_DELTA_MAX_WINDOW_SIZE will be reduced
+ * to that limit.  Only use non-default sizes if all consumers of the
+ * resulting delta are known to accept them.
+ *
  * Do any necessary allocation in a sub-pool of @a pool.
+ *
+ * @since New in 1.8.
+ */
+void
+svn_txdelta2(svn_txdelta_stream_t **stream,
+             svn_stream_t *source,
+             svn_stream_t *target,
+             apr_size_t window_size,
+             apr_pool_t *pool);
+
+/** Similar to svn_txdelta2() but always using the default window size.
  */
 void
 svn_txdelta(svn_txdelta_stream_t **stream,
@@ -386,6 +428,22 @@ svn_txdelta(svn_txdelta_stream_t **stream,
  * The stream handler functions will read data from @a source as
  * necessary.
  *
+ * @a window_size limits the size of the windows as described for
+ * svn_txdelta2().
+ *
+ * @since New in 1.8.
+ */
+svn_stream_t *
+svn_txdelta_target_push2(svn_txdelta_window_handler_t handler,
+                         void *handler_baton,
+                         svn_stream_t *source,
+                         apr_size_t window_size,
+                         apr_pool_t *pool);
+
+/**
+ * Similar to svn_txdelta_target_push2() but always using the default
+ * window size.
+ *
  * @since New in 1.1.
  */
 svn_stream_t *
@@ -477,6 +535,34 @@ svn_txdelta_apply(svn_stream_t *source,
  * version is @a svndiff_version. @a compression_level is the zlib
  * compression level from 0 (no compression) and 9 (maximum compression).
  *
+ * Version 1 uses zlib, version 2 (new in 1.8) uses the much faster LZ4
+ * for compression.  LZ4 supports no levels; any @a compression_level
+ * other than 0 enables compression.  Readers before 1.8 cannot parse
+ * version 2.
+ *
+ * The windows will be compressed on up to @a thread_count worker threads
+ * while the caller produces the following windows.  They are still
+ * written to @a output in order and only from the thread calling
+ * @a *handler; the result is identical to that of the single-threaded
+ * encoder.  At most two windows per thread will be buffered.  Values of
+ * @a thread_count below 2, uncompressed output as well as platforms
+ * without thread support select the single-threaded encoder.
+ * @a thread_count is limited to #SVN_DELTA_MAX_THREADS.
+ *
+ * @since New in 1.8.
+ */
+void
+svn_txdelta_to_svndiff4(svn_txdelta_window_handler_t *handler,
+                        void **handler_baton,
+                        svn_stream_t *output,
+                        int svndiff_version,
+                        int compression_level,
+                        int thread_count,
+                        apr_pool_t *pool);
+
+/** Similar to svn_txdelta_to_svndiff4(), but always using a single
+ * thread.
+ *
  * @since New in 1.7.
  */
 void
@@ -518,7 +604,8 @@ svn_txdelta_to_svndiff(svn_stream_t *output,
  * whenever a new window is ready.  If @a error_on_early_close is @c
  * TRUE, attempting to close this stream before it has handled the entire
  * svndiff data set will result in #SVN_ERR_SVNDIFF_UNEXPECTED_END,
- * else this error condition will be ignored.
+ * else this error condition will be ignored.  Windows larger than
+ * #SVN_DELTA_DEFAULT_WINDOW_SIZE will be rejected.
  */
 svn_stream_t *
 svn_txdelta_parse_svndiff(svn_txdelta_window_handler_t handler,
@@ -535,6 +622,26 @@ svn_txdelta_parse_svndiff(svn_txdelta_window_handler_t handler,
  * provide the version number (the value of the fourth byte) to each
  * invocation of this routine with the @a svndiff_version argument.
  *
+ * Windows larger than @a max_window_size will be rejected with
+ * #SVN_ERR_SVNDIFF_CORRUPT_WINDOW.  0 selects
+ * #SVN_DELTA_DEFAULT_WINDOW_SIZE; values above #SVN_DELTA_MAX_WINDOW_SIZE
+ * will be reduced to that limit.  Since the memory needed to decode a
+ * window grows with its size, only accept large windows from trusted
+ * sources.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_txdelta_read_svndiff_window2(svn_txdelta_window_t **window,
+                                 svn_stream_t *stream,
+                                 int svndiff_version,
+                                 apr_size_t max_window_size,
+                                 apr_pool_t *pool);
+
+/**
+ * Similar to svn_txdelta_read_svndiff_window2() but only accepting
+ * windows up to the default size.
+ *
  * @since New in 1.1.
  */
 svn_error_t *
@@ -552,6 +659,21 @@ svn_txdelta_read_svndiff_window(svn_txdelta_window_t **window,
  * number (the value of the fourth byte) to each invocation of this
  * routine with the @a svndiff_version argument.
  *
+ * @a max_window_size limits the size of the window as described for
+ * svn_txdelta_read_svndiff_window2().
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_txdelta_skip_svndiff_window2(apr_file_t *file,
+                                 int svndiff_version,
+                                 apr_size_t max_window_size,
+                                 apr_pool_t *pool);
+
+/**
+ * Similar to svn_txdelta_skip_svndiff_window2() but only accepting
+ * windows up to the default size.
+ *
  * @since New in 1.1.
  */
 svn_error_t *
@@ -431,6 +431,24 @@ typedef enum svn_diff_file_ignore_space_t
   svn_diff_file_ignore_space_all
 } svn_diff_file_ignore_space_t;
 
+/** How the file diff routines match up the lines of their inputs.
+ *
+ * @since New in 1.8.
+ */
+typedef enum svn_diff_algorithm_t
+{
+  /** Find a longest common subsequence (Myers' O(NP) algorithm).  This
+   * gives the smallest diff, but can take a long time on large inputs
+   * with many scattered differences. */
+  svn_diff_algorithm_myers = 0,
+
+  /** Anchor the diff on lines that occur rarely in the original, like
+   * git's histogram diff.  This tends to line up code structure better
+   * and its running time is bounded; if a pathological input exhausts
+   * that bound, the remaining lines are reported as changed. */
+  svn_diff_algorithm_histogram
+} svn_diff_algorithm_t;
+
 /** Options to control the behaviour of the file diff routines.
  *
  * @since New in 1.4.
@@ -456,6 +474,24 @@ typedef struct svn_diff_file_options_t
     * @c FALSE.
     */
   svn_boolean_t show_c_function;
+  /** How to match up lines.  Only two- and three-way diffs honour this;
+   * four-way diffs always use @c svn_diff_algorithm_myers.  The default
+   * is @c svn_diff_algorithm_myers.
+   *
+   * @since New in 1.8. */
+  svn_diff_algorithm_t algorithm;
+  /** If non-zero, svn_diff_file_diff_2() looks at the lines between the
+   * identical prefix and suffix of the files through a sliding window,
+   * sized so that its bookkeeping takes roughly this many bytes, instead
+   * of reading all lines of both files up front.  This bounds the memory
+   * needed to diff arbitrarily large files, at the price of a diff that
+   * is not necessarily minimal when a single change spans more than half
+   * a window.  The resulting hunks still need memory in proportion to
+   * the number of changes.  Other diff functions ignore this.  The
+   * default is 0.
+   *
+   * @since New in 1.8. */
+  apr_size_t memory_limit;
 } svn_diff_file_options_t;
 
 /** Allocate a @c svn_diff_file_options_t structure in @a pool, initializing
@@ -478,6 +514,9 @@ svn_diff_file_options_create(apr_pool_t *pool);
  * - --ignore-all-space, -w
  * - --ignore-eol-style
  * - --show-c-function, -p @since New in 1.5.
+ * - --histogram @since New in 1.8.
+ * - --memory-limit ARG, setting @a options->memory_limit to ARG
+ *   megabytes @since New in 1.8.
  * - --unified, -u (for compatibility, does nothing).
  */
 svn_error_t *
@@ -113,6 +113,13 @@ typedef struct svn_fs_t svn_fs_t;
  * @since New in 1.6.
  */
 #define SVN_FS_CONFIG_PRE_1_6_COMPATIBLE        "pre-1.6-compatible"
+
+/** Create repository format compatible with Subversion versions
+ * earlier than 1.8.
+ *
+ * @since New in 1.8.
+ */
+#define SVN_FS_CONFIG_PRE_1_8_COMPATIBLE        "pre-1.8-compatible"
 /** @} */
 
 
@@ -2309,6 +2316,78 @@ svn_fs_pack(const char *db_path,
             void *cancel_baton,
             apr_pool_t *pool);
 
+/**
+ * Write the contents of the process-wide membuffer cache to the file
+ * at @a path, together with what is needed to validate them against the
+ * repositories opened by this process.  Do nothing if there is no such
+ * cache or if this process did not open any repository that still
+ * exists.  Use @a pool for temporary allocations.
+ *
+ * Servers call this before shutting down so that they may start with
+ * warm caches again using svn_fs_load_cache().  It must be called in
+ * the process that opened the repositories, not e.g. in the parent of
+ * forked worker processes, even if those share the cache with it.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_fs_save_cache(const char *path,
+                  apr_pool_t *pool);
+
+/**
+ * Initialize the process-wide membuffer cache from the file at @a path
+ * that has been written by svn_fs_save_cache().  Set @a *loaded to
+ * indicate whether the cache contents have been restored.  The file will
+ * be ignored if it does not exist, was written by a different version or
+ * cache configuration, does not name any repository, or if any of the
+ * repositories whose data it contains got replaced or its youngest
+ * revision went backwards since.
+ * Use @a pool for temporary allocations.
+ *
+ * This should be called after svn_cache_config_set() but before any
+ * repository is being opened.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_fs_load_cache(svn_boolean_t *loaded,
+                  const char *path,
+                  apr_pool_t *pool);
+
+/**
+ * Statistics on the delta chains that a filesystem had to walk in order
+ * to reconstruct representations.  The average chain length per read is
+ * @a total_length / @a read_count.
+ *
+ * @since New in 1.8.
+ */
+typedef struct svn_fs_delta_chain_stats_t
+{
+  /** Number of representations read. */
+  apr_uint64_t read_count;
+
+  /** Sum of the number of representations (deltas plus the base) that
+   * had to be combined for these reads. */
+  apr_uint64_t total_length;
+
+  /** Longest chain encountered. */
+  int max_length;
+} svn_fs_delta_chain_stats_t;
+
+/**
+ * Set @a *stats to the delta chain statistics gathered by @a fs since it
+ * has been opened.  Use @a pool for temporary allocations.
+ *
+ * Return #SVN_ERR_UNSUPPORTED_FEATURE if the back-end of @a fs does not
+ * gather such statistics.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_fs_get_delta_chain_stats(svn_fs_delta_chain_stats_t *stats,
+                             svn_fs_t *fs,
+                             apr_pool_t *pool);
+
 
 /** @} */
 
@@ -49,6 +49,10 @@ extern "C" {
 /** Currently-defined capabilities. */
 #define SVN_RA_SVN_CAP_EDIT_PIPELINE "edit-pipeline"
 #define SVN_RA_SVN_CAP_SVNDIFF1 "svndiff1"
+/** @since New in 1.8. */
+#define SVN_RA_SVN_CAP_SVNDIFF2 "svndiff2"
+/** @since New in 1.8. */
+#define SVN_RA_SVN_CAP_STREAM_COMPRESSION "stream-compression"
 #define SVN_RA_SVN_CAP_ABSENT_ENTRIES "absent-entries"
 /* maps to SVN_RA_CAPABILITY_COMMIT_REVPROPS: */
 #define SVN_RA_SVN_CAP_COMMIT_REVPROPS "commit-revprops"
@@ -166,6 +170,30 @@ svn_error_t *
 svn_ra_svn__set_shim_callbacks(svn_ra_svn_conn_t *conn,
                                svn_delta_shim_callbacks_t *shim_callbacks);
 
+/**
+ * Flush the data written to @a conn so far and compress all data sent
+ * and received on @a conn from now on, as negotiated through the
+ * #SVN_RA_SVN_CAP_STREAM_COMPRESSION capability.  Both sides must
+ * switch at the same point in the protocol.  Use @a pool for temporary
+ * allocations.
+ *
+ * @note This is a private API, external consumers should not use it.
+ */
+svn_error_t *
+svn_ra_svn__enable_stream_compression(svn_ra_svn_conn_t *conn,
+                                      apr_pool_t *pool);
+
+/**
+ * Return the svndiff version to use for deltas sent over @a conn.  That
+ * is 0, i.e. no compression, if compression is disabled or the whole
+ * connection gets compressed already.  Otherwise, it is the highest
+ * version supported by the other side.
+ *
+ * @note This is a private API, external consumers should not use it.
+ */
+int
+svn_ra_svn__svndiff_version(svn_ra_svn_conn_t *conn);
+
 /** Initialize a connection structure for the given socket or
  * input/output files.
  *
@@ -219,6 +247,24 @@ svn_ra_svn_has_capability(svn_ra_svn_conn_t *conn,
 int
 svn_ra_svn_compression_level(svn_ra_svn_conn_t *conn);
 
+/** Let up to @a thread_count threads compress the svndiff data sent
+ * over @a conn.  The default is 1.
+ *
+ * @see svn_txdelta_to_svndiff4()
+ * @since New in 1.8.
+ */
+void
+svn_ra_svn_set_compression_threads(svn_ra_svn_conn_t *conn,
+                                   int thread_count);
+
+/** Return the number of threads that may compress the svndiff data
+ * sent over @a conn.
+ *
+ * @since New in 1.8.
+ */
+int
+svn_ra_svn_compression_threads(svn_ra_svn_conn_t *conn);
+
 /** Returns the remote address of the connection as a string, if known,
  *  or NULL if inapplicable. */
 const char *
@@ -446,6 +492,25 @@ svn_ra_svn_handle_commands(svn_ra_svn_conn_t *conn,
                            const svn_ra_svn_cmd_entry_t *commands,
                            void *baton);
 
+/** Like svn_ra_svn_handle_commands2(), but return as soon as handling
+ * the next command would have to wait for the other side, flushing any
+ * responses before that.  This allows a server to park an idle
+ * connection and pick it up again once more input arrives.
+ *
+ * Set @a *terminated to @c FALSE if we merely ran out of input and to
+ * @c TRUE if a terminating command has been handled or, unless @a
+ * error_on_disconnect is set, the connection has been closed.
+ *
+ * @note This is a private API, external consumers should not use it.
+ */
+svn_error_t *
+svn_ra_svn__handle_pending_commands(svn_boolean_t *terminated,
+                                    svn_ra_svn_conn_t *conn,
+                                    apr_pool_t *pool,
+                                    const svn_ra_svn_cmd_entry_t *commands,
+                                    void *baton,
+                                    svn_boolean_t error_on_disconnect);
+
 /** Write a command over the network, using the same format string notation
  * as svn_ra_svn_write_tuple().
  */
@@ -2439,9 +2439,6 @@ svn_repos_node_from_baton(void *edit_baton);
 /**
  * Verify the contents of the file system in @a repos.
  *
- * If @a feedback_stream is not @c NULL, write feedback to it (lines of
- * the form "* Verified revision %ld\n").
- *
  * If @a start_rev is #SVN_INVALID_REVNUM, then start verifying at
  * revision 0.  If @a end_rev is #SVN_INVALID_REVNUM, then verify
  * through the @c HEAD revision.
@@ -2454,8 +2451,36 @@ svn_repos_node_from_baton(void *edit_baton);
  * cancel_baton as argument to see if the caller wishes to cancel the
  * verification.
  *
+ * If @a thread_count is larger than 1, verify up to that many ranges of
+ * revisions concurrently, each in a separate thread using a separate
+ * filesystem object.  The notifications remain the same as for the
+ * sequential verification and are sent in the same order.  Both
+ * @a notify_func and @a cancel_func are only ever called from the
+ * calling thread.  The caller must make sure that the caches are
+ * thread-safe, see #svn_cache_config_t.  @a thread_count is ignored if
+ * APR has been built without thread support.
+ *
+ * @since New in 1.8.
+ */
+svn_error_t *
+svn_repos_verify_fs3(svn_repos_t *repos,
+                     svn_revnum_t start_rev,
+                     svn_revnum_t end_rev,
+                     int thread_count,
+                     svn_repos_notify_func_t notify_func,
+                     void *notify_baton,
+                     svn_cancel_func_t cancel,
+                     void *cancel_baton,
+                     apr_pool_t *scratch_pool);
+
+/**
+ * Similar to svn_repos_verify_fs3(), but always verifies sequentially,
+ * i.e. with a @a thread_count of 1.
+ *
  * @since New in 1.7.
+ * @deprecated Provided for backward compatibility with the 1.7 API.
  */
+SVN_DEPRECATED
 svn_error_t *
 svn_repos_verify_fs2(svn_repos_t *repos,
                      svn_revnum_t start_rev,
@@ -2468,7 +2493,10 @@ svn_repos_verify_fs2(svn_repos_t *repos,
 
 /**
  * Similar to svn_repos_verify_fs2(), but with a feedback_stream instead of
- * handling feedback via the notify_func handler
+ * handling feedback via the notify_func handler.
+ *
+ * If @a feedback_stream is not @c NULL, write feedback to it (lines of
+ * the form "* Verified revision %ld\n").
  *
  * @since New in 1.5.
  * @deprecated Provided for backward compatibility with the 1.6 API.
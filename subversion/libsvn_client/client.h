@@ -319,6 +319,18 @@ svn_client__default_walker_error_handler(const char *path,
                                          void *walk_baton,
                                          apr_pool_t *pool);
 
+/* Return a new root pool that may be used from a thread other than the
+   creating one, e.g. by a worker thread of 'svn diff' or 'svn merge'. */
+apr_pool_t *
+svn_client__create_thread_pool(void);
+
+/* Set *MAX_THREADS to the number of threads that the diff-threads option
+   in CONFIG, the configuration hash of a client context, asks for
+   comparing files.  Set it to 1 if the option is not set. */
+svn_error_t *
+svn_client__get_diff_threads(int *max_threads,
+                             apr_hash_t *config);
+
 
 /* ---------------------------------------------------------------- */
 
@@ -30,6 +30,13 @@
 #include <apr_strings.h>
 #include <apr_pools.h>
 #include <apr_hash.h>
+
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#endif
+
 #include "svn_types.h"
 #include "svn_hash.h"
 #include "svn_wc.h"
@@ -802,9 +809,655 @@ struct diff_cmd_baton {
    * ### This is needed for us to know if we need to print a diff header for
    * ### a path that has property changes. */
   apr_hash_t *visited_paths;
+
+  /* If non-null, text diffs are computed by worker threads and OUTSTREAM
+   * is a stream that puts everything written to it back into the order
+   * of the callbacks.  See diff_queue_open(). */
+  struct diff_queue_t *queue;
 };
 
 
+/*-----------------------------------------------------------------*/
+
+/*** Computing text diffs in worker threads. ***/
+
+/* A text diff to be written by write_text_diff(). */
+typedef struct text_diff_t
+{
+  /* The path for the "Index:" line and the files to compare. */
+  const char *path;
+  const char *tmpfile1;
+  const char *tmpfile2;
+
+  /* The labels of the unified diff. */
+  const char *label1;
+  const char *label2;
+
+  /* If not NULL, print a git diff header for OPERATION, using these
+     paths relative to the repository root. */
+  const char *git_path1;
+  const char *git_path2;
+  svn_diff_operation_kind_t operation;
+  svn_revnum_t rev1;
+  svn_revnum_t rev2;
+  const char *copyfrom_path;
+  svn_revnum_t copyfrom_rev;
+
+  const char *header_encoding;
+  const char *relative_to_dir;
+  const svn_diff_file_options_t *options;
+
+  /* Write the headers even if the files are the same. */
+  svn_boolean_t force_empty;
+} text_diff_t;
+
+/* Write the diff described by TD to OUTSTREAM: the "Index:" line, the git
+   diff header if requested and the unified diff, as far as there is
+   anything to show.  Set *PRINTED to whether anything has been written.
+   Use SCRATCH_POOL for temporary allocations.
+
+   This may be called from a worker thread and uses nothing but TD. */
+static svn_error_t *
+write_text_diff(svn_boolean_t *printed,
+                svn_stream_t *outstream,
+                const text_diff_t *td,
+                apr_pool_t *scratch_pool)
+{
+  svn_diff_t *diff;
+  const char *label1 = td->label1;
+  const char *label2 = td->label2;
+
+  SVN_ERR(svn_diff_file_diff_2(&diff, td->tmpfile1, td->tmpfile2,
+                               td->options, scratch_pool));
+
+  *printed = (svn_diff_contains_diffs(diff) || td->force_empty
+              || td->git_path1 != NULL);
+  if (! *printed)
+    return SVN_NO_ERROR;
+
+  /* Print out the diff header. */
+  SVN_ERR(svn_stream_printf_from_utf8(outstream,
+           td->header_encoding, scratch_pool,
+           "Index: %s" APR_EOL_STR "%s" APR_EOL_STR,
+           td->path, equal_string));
+
+  if (td->git_path1)
+    SVN_ERR(print_git_diff_header(outstream, &label1, &label2,
+                                  td->operation,
+                                  td->git_path1, td->git_path2,
+                                  td->rev1, td->rev2,
+                                  td->copyfrom_path,
+                                  td->copyfrom_rev,
+                                  td->header_encoding,
+                                  scratch_pool));
+
+  /* Output the actual diff */
+  if (svn_diff_contains_diffs(diff) || td->force_empty)
+    SVN_ERR(svn_diff_file_output_unified3(outstream, diff,
+             td->tmpfile1, td->tmpfile2, label1, label2,
+             td->header_encoding, td->relative_to_dir,
+             td->options->show_c_function,
+             scratch_pool));
+
+  return SVN_NO_ERROR;
+}
+
+#if APR_HAS_THREADS
+/* The number of queued items per thread beyond which the callbacks wait
+   for the output to be written, so that the memory used by the queue
+   doesn't grow with the size of the diff. */
+#define DIFF_ITEMS_PER_THREAD 4
+
+/* Called in a worker thread to write the output of a queued item with
+   BATON to OUTPUT.  It must not use anything but BATON, which lives in
+   the item's own pool, and SCRATCH_POOL. */
+typedef svn_error_t *(*diff_work_func_t)(svn_stream_t *output,
+                                         void *baton,
+                                         apr_pool_t *scratch_pool);
+
+/* Called in the calling thread right after the output of a queued item
+   with BATON has been written. */
+typedef svn_error_t *(*diff_finish_func_t)(void *baton,
+                                           apr_pool_t *scratch_pool);
+
+/* A piece of the output in a diff_queue_t. */
+typedef struct diff_queue_item_t
+{
+  /* The pool the item and its BATON live in.  If there is a WORK_FUNC,
+     this is a root pool of its own, as a worker thread is going to use
+     it. */
+  apr_pool_t *pool;
+
+  /* Either of them may be NULL. */
+  diff_work_func_t work_func;
+  diff_finish_func_t finish_func;
+  void *baton;
+
+  /* What WORK_FUNC wrote, allocated in POOL. */
+  svn_stringbuf_t *output;
+
+  /* What has been written to the ordered stream while this was the last
+     item in the queue, or NULL.  Allocated in TRAILER_POOL, which only
+     the calling thread uses. */
+  svn_stringbuf_t *trailer;
+  apr_pool_t *trailer_pool;
+
+  /* Set once WORK_FUNC has returned ERR.  Both are protected by the
+     mutex of the queue. */
+  svn_boolean_t done;
+  svn_error_t *err;
+
+  struct diff_queue_item_t *next;
+} diff_queue_item_t;
+
+/* The output of 'svn diff' waiting to be written in order, and the
+   threads producing it. */
+typedef struct diff_queue_t
+{
+  /* The stream the output finally goes to. */
+  svn_stream_t *outstream;
+
+  /* The threads running the work functions.  They get started as work
+     arrives, up to MAX_THREADS of them. */
+  apr_thread_t **threads;
+  int thread_count;
+  int max_threads;
+
+  /* The queued items in output order, their number and the first one
+     with a work function that no thread has picked up yet.  The links
+     between the items, NEXT_WORK and SHUTDOWN are protected by MUTEX. */
+  diff_queue_item_t *first;
+  diff_queue_item_t *last;
+  diff_queue_item_t *next_work;
+  int pending;
+
+  /* Set while the output of an item gets written, so that the output of
+     its FINISH_FUNC goes straight to OUTSTREAM. */
+  svn_boolean_t writing;
+
+  /* Set when the threads shall exit as soon as there is no more work. */
+  svn_boolean_t shutdown;
+
+  /* WORK_AVAILABLE gets signalled when NEXT_WORK or SHUTDOWN changes and
+     WORK_DONE whenever an item is done. */
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *work_available;
+  apr_thread_cond_t *work_done;
+
+  svn_cancel_func_t cancel_func;
+  void *cancel_baton;
+
+  /* Used by the calling thread only. */
+  apr_pool_t *pool;
+} diff_queue_t;
+
+/* Run the work function of ITEM, collecting its output in ITEM->output. */
+static svn_error_t *
+run_work_func(diff_queue_item_t *item)
+{
+  apr_pool_t *scratch_pool = svn_pool_create(item->pool);
+  svn_error_t *err;
+
+  item->output = svn_stringbuf_create_empty(item->pool);
+  err = item->work_func(svn_stream_from_stringbuf(item->output,
+                                                  scratch_pool),
+                        item->baton, scratch_pool);
+
+  svn_pool_destroy(scratch_pool);
+  return err;
+}
+
+/* Thread function running the work functions of the items in the
+   diff_queue_t DATA until the queue gets shut down. */
+static void * APR_THREAD_FUNC
+diff_worker_thread(apr_thread_t *tid, void *data)
+{
+  diff_queue_t *queue = data;
+
+  apr_thread_mutex_lock(queue->mutex);
+  while (TRUE)
+    {
+      diff_queue_item_t *item = queue->next_work;
+      svn_error_t *err;
+
+      if (item == NULL)
+        {
+          if (queue->shutdown)
+            break;
+
+          apr_thread_cond_wait(queue->work_available, queue->mutex);
+          continue;
+        }
+
+      /* Items without a work function are done already. */
+      queue->next_work = item->next;
+      while (queue->next_work && !queue->next_work->work_func)
+        queue->next_work = queue->next_work->next;
+      apr_thread_mutex_unlock(queue->mutex);
+
+      err = run_work_func(item);
+
+      apr_thread_mutex_lock(queue->mutex);
+      item->err = err;
+      item->done = TRUE;
+      apr_thread_cond_broadcast(queue->work_done);
+    }
+  apr_thread_mutex_unlock(queue->mutex);
+
+  return NULL;
+}
+
+/* Write the output of ITEM, which is done and no longer in QUEUE, to the
+   output stream of QUEUE and destroy ITEM. */
+static svn_error_t *
+write_queue_item(diff_queue_t *queue,
+                 diff_queue_item_t *item)
+{
+  svn_error_t *err = item->err;
+  apr_size_t len;
+
+  queue->writing = TRUE;
+
+  if (!err && item->output)
+    {
+      len = item->output->len;
+      err = svn_stream_write(queue->outstream, item->output->data, &len);
+    }
+  if (!err && item->finish_func)
+    err = item->finish_func(item->baton, item->pool);
+  if (!err && item->trailer)
+    {
+      len = item->trailer->len;
+      err = svn_stream_write(queue->outstream, item->trailer->data, &len);
+    }
+
+  queue->writing = FALSE;
+
+  if (item->trailer_pool)
+    svn_pool_destroy(item->trailer_pool);
+  svn_pool_destroy(item->pool);
+
+  return svn_error_trace(err);
+}
+
+/* Write the output of the items at the head of QUEUE that are done, in
+   order.  While more than LIMIT items are pending, wait for the first
+   one to get done. */
+static svn_error_t *
+flush_queue(diff_queue_t *queue,
+            int limit)
+{
+  while (queue->first)
+    {
+      diff_queue_item_t *item = queue->first;
+      svn_boolean_t done;
+      svn_error_t *err = SVN_NO_ERROR;
+
+      apr_thread_mutex_lock(queue->mutex);
+      while (!item->done && !err && queue->pending > limit)
+        {
+          apr_thread_cond_timedwait(queue->work_done, queue->mutex,
+                                    apr_time_from_sec(1) / 10);
+          if (queue->cancel_func)
+            err = queue->cancel_func(queue->cancel_baton);
+        }
+
+      done = item->done;
+      if (done)
+        {
+          queue->first = item->next;
+          if (queue->first == NULL)
+            queue->last = NULL;
+          queue->pending--;
+        }
+      apr_thread_mutex_unlock(queue->mutex);
+
+      SVN_ERR(err);
+      if (!done)
+        break;
+
+      SVN_ERR(write_queue_item(queue, item));
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Append an item with WORK_FUNC, FINISH_FUNC and BATON to QUEUE and write
+   the output that is ready.  BATON has been allocated in POOL, which the
+   queue takes over.  If WORK_FUNC is not NULL, POOL must have been
+   created by svn_client__create_thread_pool(). */
+static svn_error_t *
+queue_item(diff_queue_t *queue,
+           apr_pool_t *pool,
+           diff_work_func_t work_func,
+           diff_finish_func_t finish_func,
+           void *baton)
+{
+  diff_queue_item_t *item = apr_pcalloc(pool, sizeof(*item));
+
+  item->pool = pool;
+  item->work_func = work_func;
+  item->finish_func = finish_func;
+  item->baton = baton;
+  item->done = (work_func == NULL);
+
+  apr_thread_mutex_lock(queue->mutex);
+  if (queue->last)
+    queue->last->next = item;
+  else
+    queue->first = item;
+  queue->last = item;
+  queue->pending++;
+
+  if (work_func && queue->next_work == NULL)
+    {
+      queue->next_work = item;
+      apr_thread_cond_signal(queue->work_available);
+    }
+  apr_thread_mutex_unlock(queue->mutex);
+
+  if (work_func && queue->thread_count < queue->max_threads)
+    {
+      apr_status_t status;
+
+      status = apr_thread_create(&queue->threads[queue->thread_count], NULL,
+                                 diff_worker_thread, queue, queue->pool);
+      if (status == APR_SUCCESS)
+        queue->thread_count++;
+      else if (queue->thread_count == 0)
+        return svn_error_wrap_apr(status, _("Can't create thread"));
+    }
+
+  return svn_error_trace(flush_queue(queue,
+                                     queue->max_threads
+                                     * DIFF_ITEMS_PER_THREAD));
+}
+
+/* Implements svn_write_fn_t for the stream that diff_queue_open() puts
+   in front of the real output stream.  BATON is the diff_queue_t. */
+static svn_error_t *
+ordered_write(void *baton,
+              const char *data,
+              apr_size_t *len)
+{
+  diff_queue_t *queue = baton;
+  diff_queue_item_t *item = queue->last;
+
+  if (item == NULL || queue->writing)
+    return svn_error_trace(svn_stream_write(queue->outstream, data, len));
+
+  /* This belongs behind the output that is still being computed. */
+  if (item->trailer == NULL)
+    {
+      item->trailer_pool = svn_pool_create(queue->pool);
+      item->trailer = svn_stringbuf_create_empty(item->trailer_pool);
+    }
+  svn_stringbuf_appendbytes(item->trailer, data, *len);
+
+  return SVN_NO_ERROR;
+}
+
+/* A text diff queued by queue_text_diff(). */
+typedef struct queued_text_diff_t
+{
+  text_diff_t td;
+
+  /* Set by the worker if something has been written. */
+  svn_boolean_t printed;
+
+  struct diff_cmd_baton *diff_cmd_baton;
+} queued_text_diff_t;
+
+/* Implements diff_work_func_t for a queued_text_diff_t. */
+static svn_error_t *
+text_diff_work(svn_stream_t *output,
+               void *baton,
+               apr_pool_t *scratch_pool)
+{
+  queued_text_diff_t *qtd = baton;
+
+  return svn_error_trace(write_text_diff(&qtd->printed, output, &qtd->td,
+                                         scratch_pool));
+}
+
+/* Implements diff_finish_func_t for a queued_text_diff_t. */
+static svn_error_t *
+text_diff_finish(void *baton,
+                 apr_pool_t *scratch_pool)
+{
+  queued_text_diff_t *qtd = baton;
+  struct diff_cmd_baton *diff_cmd_baton = qtd->diff_cmd_baton;
+
+  /* We have a printed a diff for this path, mark it as visited. */
+  if (qtd->printed)
+    {
+      const char *path = apr_pstrdup(diff_cmd_baton->pool, qtd->td.path);
+
+      apr_hash_set(diff_cmd_baton->visited_paths, path,
+                   APR_HASH_KEY_STRING, path);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Queue TD for a worker thread of DIFF_CMD_BATON->queue.  Copy everything
+   it refers to, including the files to compare, as the caller is going to
+   delete them as soon as we return.  Use SCRATCH_POOL for temporary
+   allocations. */
+static svn_error_t *
+queue_text_diff(struct diff_cmd_baton *diff_cmd_baton,
+                const text_diff_t *td,
+                apr_pool_t *scratch_pool)
+{
+  apr_pool_t *pool = svn_client__create_thread_pool();
+  queued_text_diff_t *qtd = apr_pcalloc(pool, sizeof(*qtd));
+  svn_error_t *err;
+
+  qtd->td = *td;
+  qtd->td.path = apr_pstrdup(pool, td->path);
+  qtd->td.label1 = apr_pstrdup(pool, td->label1);
+  qtd->td.label2 = apr_pstrdup(pool, td->label2);
+  qtd->td.git_path1 = apr_pstrdup(pool, td->git_path1);
+  qtd->td.git_path2 = apr_pstrdup(pool, td->git_path2);
+  qtd->td.copyfrom_path = apr_pstrdup(pool, td->copyfrom_path);
+  qtd->diff_cmd_baton = diff_cmd_baton;
+
+  err = svn_io_open_unique_file3(NULL, &qtd->td.tmpfile1, NULL,
+                                 svn_io_file_del_on_pool_cleanup,
+                                 pool, scratch_pool);
+  if (!err)
+    err = svn_io_copy_file(td->tmpfile1, qtd->td.tmpfile1, FALSE,
+                           scratch_pool);
+  if (!err)
+    err = svn_io_open_unique_file3(NULL, &qtd->td.tmpfile2, NULL,
+                                   svn_io_file_del_on_pool_cleanup,
+                                   pool, scratch_pool);
+  if (!err)
+    err = svn_io_copy_file(td->tmpfile2, qtd->td.tmpfile2, FALSE,
+                           scratch_pool);
+  if (err)
+    {
+      svn_pool_destroy(pool);
+      return svn_error_trace(err);
+    }
+
+  return svn_error_trace(queue_item(diff_cmd_baton->queue, pool,
+                                    text_diff_work, text_diff_finish, qtd));
+}
+#endif
+
+/* Start computing the text diffs of DIFF_CMD_BATON in as many threads as
+   the diff-threads option in CTX->config asks for, unless that is fewer
+   than two or an external diff command is in use.  The output stays the
+   same as without threads.  Allocate the queue in POOL.
+
+   Every call has to be matched by a call to diff_queue_close(). */
+static svn_error_t *
+diff_queue_open(struct diff_cmd_baton *diff_cmd_baton,
+                svn_client_ctx_t *ctx,
+                apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+  int max_threads;
+  diff_queue_t *queue;
+  apr_status_t status;
+
+  SVN_ERR(svn_client__get_diff_threads(&max_threads, ctx->config));
+  if (max_threads < 2 || diff_cmd_baton->diff_cmd)
+    return SVN_NO_ERROR;
+
+  queue = apr_pcalloc(pool, sizeof(*queue));
+  queue->threads = apr_pcalloc(pool, max_threads * sizeof(*queue->threads));
+  queue->max_threads = max_threads;
+  queue->cancel_func = ctx->cancel_func;
+  queue->cancel_baton = ctx->cancel_baton;
+  queue->pool = pool;
+
+  status = apr_thread_mutex_create(&queue->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                   pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create mutex"));
+  status = apr_thread_cond_create(&queue->work_available, pool);
+  if (!status)
+    status = apr_thread_cond_create(&queue->work_done, pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create condition variable"));
+
+  queue->outstream = diff_cmd_baton->outstream;
+  diff_cmd_baton->outstream = svn_stream_create(queue, pool);
+  svn_stream_set_write(diff_cmd_baton->outstream, ordered_write);
+  diff_cmd_baton->queue = queue;
+#endif
+
+  return SVN_NO_ERROR;
+}
+
+/* Stop the threads started by diff_queue_open() for DIFF_CMD_BATON.  If
+   ERR is SVN_NO_ERROR, write all the output that is still queued first,
+   else discard it.  Return ERR, or the error writing the output. */
+static svn_error_t *
+diff_queue_close(struct diff_cmd_baton *diff_cmd_baton,
+                 svn_error_t *err)
+{
+#if APR_HAS_THREADS
+  diff_queue_t *queue = diff_cmd_baton->queue;
+  int i;
+
+  if (queue == NULL)
+    return svn_error_trace(err);
+
+  if (!err)
+    err = flush_queue(queue, 0);
+
+  /* Stop all threads, letting them finish the item at hand. */
+  apr_thread_mutex_lock(queue->mutex);
+  queue->shutdown = TRUE;
+  queue->next_work = NULL;
+  apr_thread_cond_broadcast(queue->work_available);
+  apr_thread_mutex_unlock(queue->mutex);
+
+  for (i = 0; i < queue->thread_count; ++i)
+    {
+      apr_status_t thread_status;
+      apr_thread_join(&thread_status, queue->threads[i]);
+    }
+
+  /* Discard the output that has not been written. */
+  while (queue->first)
+    {
+      diff_queue_item_t *item = queue->first;
+
+      queue->first = item->next;
+      svn_error_clear(item->err);
+      if (item->trailer_pool)
+        svn_pool_destroy(item->trailer_pool);
+      svn_pool_destroy(item->pool);
+    }
+  queue->last = NULL;
+  queue->pending = 0;
+
+  apr_thread_cond_destroy(queue->work_done);
+  apr_thread_cond_destroy(queue->work_available);
+  apr_thread_mutex_destroy(queue->mutex);
+
+  diff_cmd_baton->outstream = queue->outstream;
+  diff_cmd_baton->queue = NULL;
+#endif
+
+  return svn_error_trace(err);
+}
+
+
+/* Show the regular property changes PROPS of PATH, a helper for
+   diff_props_changed(). */
+static svn_error_t *
+show_prop_changes(const char *path,
+                  const apr_array_header_t *props,
+                  apr_hash_t *original_props,
+                  struct diff_cmd_baton *diff_cmd_baton,
+                  apr_pool_t *scratch_pool)
+{
+  svn_boolean_t show_diff_header;
+
+  if (apr_hash_get(diff_cmd_baton->visited_paths, path, APR_HASH_KEY_STRING))
+    show_diff_header = FALSE;
+  else
+    show_diff_header = TRUE;
+
+  /* We're using the revnums from the diff_cmd_baton since there's
+   * no revision argument to the svn_wc_diff_callback_t
+   * dir_props_changed(). */
+  SVN_ERR(display_prop_diffs(props, original_props, path,
+                             diff_cmd_baton->orig_path_1,
+                             diff_cmd_baton->orig_path_2,
+                             diff_cmd_baton->revnum1,
+                             diff_cmd_baton->revnum2,
+                             diff_cmd_baton->header_encoding,
+                             diff_cmd_baton->outstream,
+                             diff_cmd_baton->relative_to_dir,
+                             show_diff_header,
+                             diff_cmd_baton->use_git_diff_format,
+                             diff_cmd_baton->ra_session,
+                             diff_cmd_baton->wc_ctx,
+                             diff_cmd_baton->wc_root_abspath,
+                             scratch_pool));
+
+  /* We've printed the diff header so now we can mark the path as
+   * visited. */
+  if (show_diff_header)
+    {
+      path = apr_pstrdup(diff_cmd_baton->pool, path);
+      apr_hash_set(diff_cmd_baton->visited_paths, path,
+                   APR_HASH_KEY_STRING, path);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+#if APR_HAS_THREADS
+/* Property changes waiting for the text diffs queued before them. */
+typedef struct queued_prop_changes_t
+{
+  const char *path;
+  apr_array_header_t *props;
+  apr_hash_t *original_props;
+  struct diff_cmd_baton *diff_cmd_baton;
+} queued_prop_changes_t;
+
+/* Implements diff_finish_func_t for a queued_prop_changes_t. */
+static svn_error_t *
+prop_changes_finish(void *baton,
+                    apr_pool_t *scratch_pool)
+{
+  queued_prop_changes_t *qpc = baton;
+
+  return svn_error_trace(show_prop_changes(qpc->path, qpc->props,
+                                           qpc->original_props,
+                                           qpc->diff_cmd_baton,
+                                           scratch_pool));
+}
+#endif
+
 /* An helper for diff_dir_props_changed, diff_file_changed and diff_file_added
  */
 static svn_error_t *
@@ -818,7 +1471,6 @@ diff_props_changed(svn_wc_notify_state_t *state,
                    apr_pool_t *scratch_pool)
 {
   apr_array_header_t *props;
-  svn_boolean_t show_diff_header;
 
   /* If property differences are ignored, there's nothing to do. */
   if (diff_cmd_baton->ignore_prop_diff)
@@ -827,36 +1479,30 @@ diff_props_changed(svn_wc_notify_state_t *state,
   SVN_ERR(svn_categorize_props(propchanges, NULL, NULL, &props,
                                scratch_pool));
 
-  if (apr_hash_get(diff_cmd_baton->visited_paths, path, APR_HASH_KEY_STRING))
-    show_diff_header = FALSE;
-  else
-    show_diff_header = TRUE;
-
   if (props->nelts > 0)
     {
-      /* We're using the revnums from the diff_cmd_baton since there's
-       * no revision argument to the svn_wc_diff_callback_t
-       * dir_props_changed(). */
-      SVN_ERR(display_prop_diffs(props, original_props, path,
-                                 diff_cmd_baton->orig_path_1,
-                                 diff_cmd_baton->orig_path_2,
-                                 diff_cmd_baton->revnum1,
-                                 diff_cmd_baton->revnum2,
-                                 diff_cmd_baton->header_encoding,
-                                 diff_cmd_baton->outstream,
-                                 diff_cmd_baton->relative_to_dir,
-                                 show_diff_header,
-                                 diff_cmd_baton->use_git_diff_format,
-                                 diff_cmd_baton->ra_session,
-                                 diff_cmd_baton->wc_ctx,
-                                 diff_cmd_baton->wc_root_abspath,
-                                 scratch_pool));
-
-      /* We've printed the diff header so now we can mark the path as
-       * visited. */
-      if (show_diff_header)
-        apr_hash_set(diff_cmd_baton->visited_paths, path,
-                     APR_HASH_KEY_STRING, path);
+#if APR_HAS_THREADS
+      diff_queue_t *queue = diff_cmd_baton->queue;
+
+      /* Whether to show the diff header depends on the text diffs
+       * still in the queue, so wait for them. */
+      if (queue && queue->last)
+        {
+          apr_pool_t *pool = svn_pool_create(queue->pool);
+          queued_prop_changes_t *qpc = apr_palloc(pool, sizeof(*qpc));
+
+          qpc->path = apr_pstrdup(pool, path);
+          qpc->props = svn_prop_array_dup(props, pool);
+          qpc->original_props = original_props
+                                  ? svn_prop_hash_dup(original_props, pool)
+                                  : NULL;
+          qpc->diff_cmd_baton = diff_cmd_baton;
+          SVN_ERR(queue_item(queue, pool, NULL, prop_changes_finish, qpc));
+        }
+      else
+#endif
+        SVN_ERR(show_prop_changes(path, props, original_props,
+                                  diff_cmd_baton, scratch_pool));
     }
 
   if (state)
@@ -1028,54 +1674,51 @@ diff_content_changed(const char *path,
     }
   else   /* use libsvn_diff to generate the diff  */
     {
-      svn_diff_t *diff;
-
-      SVN_ERR(svn_diff_file_diff_2(&diff, tmpfile1, tmpfile2,
-                                   diff_cmd_baton->options.for_internal,
-                                   subpool));
-
-      if (svn_diff_contains_diffs(diff) || diff_cmd_baton->force_empty ||
-          diff_cmd_baton->use_git_diff_format)
+      text_diff_t td = { 0 };
+      svn_boolean_t printed;
+
+      td.path = path;
+      td.tmpfile1 = tmpfile1;
+      td.tmpfile2 = tmpfile2;
+      td.label1 = label1;
+      td.label2 = label2;
+      td.operation = operation;
+      td.rev1 = rev1;
+      td.rev2 = rev2;
+      td.copyfrom_path = copyfrom_path;
+      td.copyfrom_rev = copyfrom_rev;
+      td.header_encoding = diff_cmd_baton->header_encoding;
+      td.relative_to_dir = rel_to_dir;
+      td.options = diff_cmd_baton->options.for_internal;
+      td.force_empty = diff_cmd_baton->force_empty;
+
+      if (diff_cmd_baton->use_git_diff_format)
         {
-          /* Print out the diff header. */
-          SVN_ERR(svn_stream_printf_from_utf8(outstream,
-                   diff_cmd_baton->header_encoding, subpool,
-                   "Index: %s" APR_EOL_STR "%s" APR_EOL_STR,
-                   path, equal_string));
-
-          if (diff_cmd_baton->use_git_diff_format)
-            {
-              const char *tmp_path1, *tmp_path2;
-              SVN_ERR(adjust_relative_to_repos_root(
-                         &tmp_path1, path, diff_cmd_baton->orig_path_1,
-                         diff_cmd_baton->ra_session, diff_cmd_baton->wc_ctx,
-                         diff_cmd_baton->wc_root_abspath, subpool));
-              SVN_ERR(adjust_relative_to_repos_root(
-                         &tmp_path2, path, diff_cmd_baton->orig_path_2,
-                         diff_cmd_baton->ra_session, diff_cmd_baton->wc_ctx,
-                         diff_cmd_baton->wc_root_abspath, subpool));
-              SVN_ERR(print_git_diff_header(outstream, &label1, &label2,
-                                            operation,
-                                            tmp_path1, tmp_path2, rev1, rev2,
-                                            copyfrom_path,
-                                            copyfrom_rev,
-                                            diff_cmd_baton->header_encoding,
-                                            subpool));
-            }
+          SVN_ERR(adjust_relative_to_repos_root(
+                     &td.git_path1, path, diff_cmd_baton->orig_path_1,
+                     diff_cmd_baton->ra_session, diff_cmd_baton->wc_ctx,
+                     diff_cmd_baton->wc_root_abspath, subpool));
+          SVN_ERR(adjust_relative_to_repos_root(
+                     &td.git_path2, path, diff_cmd_baton->orig_path_2,
+                     diff_cmd_baton->ra_session, diff_cmd_baton->wc_ctx,
+                     diff_cmd_baton->wc_root_abspath, subpool));
+        }
 
-          /* Output the actual diff */
-          if (svn_diff_contains_diffs(diff) || diff_cmd_baton->force_empty)
-            SVN_ERR(svn_diff_file_output_unified3(outstream, diff,
-                     tmpfile1, tmpfile2, label1, label2,
-                     diff_cmd_baton->header_encoding, rel_to_dir,
-                     diff_cmd_baton->options.for_internal->show_c_function,
-                     subpool));
+#if APR_HAS_THREADS
+      if (diff_cmd_baton->queue)
+        {
+          SVN_ERR(queue_text_diff(diff_cmd_baton, &td, subpool));
+          svn_pool_destroy(subpool);
+          return SVN_NO_ERROR;
+        }
+#endif
 
-          /* We have a printed a diff for this path, mark it as visited. */
-          apr_hash_set(diff_cmd_baton->visited_paths, path,
-                       APR_HASH_KEY_STRING, path);
+      SVN_ERR(write_text_diff(&printed, outstream, &td, subpool));
 
-        }
+      /* We have a printed a diff for this path, mark it as visited. */
+      if (printed)
+        apr_hash_set(diff_cmd_baton->visited_paths, path,
+                     APR_HASH_KEY_STRING, path);
     }
 
   /* ### todo: someday we'll need to worry about whether we're going
@@ -2518,51 +3161,55 @@ do_diff(const svn_wc_diff_callbacks4_t *callbacks,
 {
   svn_boolean_t is_repos1;
   svn_boolean_t is_repos2;
+  svn_error_t *err;
 
   /* Check if paths/revisions are urls/local. */
   SVN_ERR(check_paths(&is_repos1, &is_repos2, path_or_url1, path_or_url2,
                       revision1, revision2, peg_revision));
 
+  SVN_ERR(diff_queue_open(callback_baton, ctx, pool));
+
   if (is_repos1)
     {
       if (is_repos2)
         {
           /* ### Ignores 'show_copies_as_adds'. */
-          SVN_ERR(diff_repos_repos(callbacks, callback_baton, ctx,
-                                   path_or_url1, path_or_url2,
-                                   revision1, revision2,
-                                   peg_revision, depth, ignore_ancestry,
-                                   pool));
+          err = diff_repos_repos(callbacks, callback_baton, ctx,
+                                 path_or_url1, path_or_url2,
+                                 revision1, revision2,
+                                 peg_revision, depth, ignore_ancestry,
+                                 pool);
         }
       else /* path_or_url2 is a working copy path */
         {
-          SVN_ERR(diff_repos_wc(path_or_url1, revision1, peg_revision,
-                                path_or_url2, revision2, FALSE, depth,
-                                ignore_ancestry, show_copies_as_adds,
-                                use_git_diff_format, changelists,
-                                callbacks, callback_baton, ctx, pool));
+          err = diff_repos_wc(path_or_url1, revision1, peg_revision,
+                              path_or_url2, revision2, FALSE, depth,
+                              ignore_ancestry, show_copies_as_adds,
+                              use_git_diff_format, changelists,
+                              callbacks, callback_baton, ctx, pool);
         }
     }
   else /* path_or_url1 is a working copy path */
     {
       if (is_repos2)
         {
-          SVN_ERR(diff_repos_wc(path_or_url2, revision2, peg_revision,
-                                path_or_url1, revision1, TRUE, depth,
-                                ignore_ancestry, show_copies_as_adds,
-                                use_git_diff_format, changelists,
-                                callbacks, callback_baton, ctx, pool));
+          err = diff_repos_wc(path_or_url2, revision2, peg_revision,
+                              path_or_url1, revision1, TRUE, depth,
+                              ignore_ancestry, show_copies_as_adds,
+                              use_git_diff_format, changelists,
+                              callbacks, callback_baton, ctx, pool);
         }
       else /* path_or_url2 is a working copy path */
         {
-          SVN_ERR(diff_wc_wc(path_or_url1, revision1, path_or_url2, revision2,
-                             depth, ignore_ancestry, show_copies_as_adds,
-                             use_git_diff_format, changelists,
-                             callbacks, callback_baton, ctx, pool));
+          err = diff_wc_wc(path_or_url1, revision1, path_or_url2, revision2,
+                           depth, ignore_ancestry, show_copies_as_adds,
+                           use_git_diff_format, changelists,
+                           callbacks, callback_baton, ctx, pool);
         }
     }
 
-  return SVN_NO_ERROR;
+  /* Write the output still waiting for text diffs. */
+  return svn_error_trace(diff_queue_close(callback_baton, err));
 }
 
 /* Perform a summary diff between two working-copy paths.
@@ -30,6 +30,13 @@
 #include <apr_strings.h>
 #include <apr_tables.h>
 #include <apr_hash.h>
+
+#if APR_HAS_THREADS
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+#endif
+
 #include "svn_types.h"
 #include "svn_hash.h"
 #include "svn_wc.h"
@@ -281,6 +288,10 @@ typedef struct merge_cmd_baton_t {
      afterwards to ensure timestamp integrity, or unchanged if not. */
   svn_boolean_t *use_sleep;
 
+  /* The text merges of the current editor drive that run in other
+     threads, or NULL if they run right away.  See merge_queue_open(). */
+  struct merge_queue_t *queue;
+
   /* Pool which has a lifetime limited to one iteration over a given
      merge source, i.e. it is cleared on every call to do_directory_merge()
      or do_file_merge() in do_merge(). */
@@ -1379,6 +1390,483 @@ conflict_resolver(svn_wc_conflict_result_t **result,
   return svn_error_trace(err);
 }
 
+/* Return the content state to notify for a file merge with
+   MERGE_OUTCOME into a target that had local modifications if
+   HAS_LOCAL_MODS is TRUE. */
+static svn_wc_notify_state_t
+merge_content_state(enum svn_wc_merge_outcome_t merge_outcome,
+                    svn_boolean_t has_local_mods)
+{
+  if (merge_outcome == svn_wc_merge_conflict)
+    return svn_wc_notify_state_conflicted;
+  else if (has_local_mods
+           && merge_outcome != svn_wc_merge_unchanged)
+    return svn_wc_notify_state_merged;
+  else if (merge_outcome == svn_wc_merge_merged)
+    return svn_wc_notify_state_changed;
+  else if (merge_outcome == svn_wc_merge_no_merge)
+    return svn_wc_notify_state_missing;
+  else /* merge_outcome == svn_wc_merge_unchanged */
+    return svn_wc_notify_state_unchanged;
+}
+
+#if APR_HAS_THREADS
+/* The number of queued text merges per thread beyond which the merge
+   waits for the first of them to complete, so that the temporary files
+   of the queue don't grow with the size of the merge. */
+#define MERGE_JOBS_PER_THREAD 4
+
+/* A text merge waiting in a merge_queue_t. */
+typedef struct merge_job_t
+{
+  /* The root pool of the job, which the worker thread uses while it
+     runs the merge.  Everything but the notifications lives in here. */
+  apr_pool_t *pool;
+
+  /* The prepared merge into TARGET_ABSPATH and what we need to complete
+     it and to notify about it. */
+  svn_wc__text_merge_t *merge;
+  const char *target_abspath;
+  const char *relpath;
+  svn_boolean_t has_local_mods;
+  conflict_resolver_baton_t conflict_baton;
+
+  /* The notification about this merge and the notifications received
+     while this was the last job in the queue, held back until the merge
+     has been completed.  Allocated in NOTIFY_POOL, which only the
+     calling thread uses.  TRAILERS may be NULL. */
+  svn_wc_notify_t *notify;
+  apr_array_header_t *trailers;
+  apr_pool_t *notify_pool;
+
+  /* Set once the merge has been run with the result ERR.  Both are
+     protected by the mutex of the queue. */
+  svn_boolean_t done;
+  svn_error_t *err;
+
+  struct merge_job_t *next;
+} merge_job_t;
+
+/* The text merges of a merge editor drive in the order in which they
+   have to be completed, and the threads running them. */
+typedef struct merge_queue_t
+{
+  /* The threads running the merges.  They get started as merges get
+     queued, up to MAX_THREADS of them. */
+  apr_thread_t **threads;
+  int thread_count;
+  int max_threads;
+
+  /* The queued jobs, their number and the first one that no thread has
+     picked up yet.  The links between the jobs, NEXT_WORK and SHUTDOWN
+     are protected by MUTEX. */
+  merge_job_t *first;
+  merge_job_t *last;
+  merge_job_t *next_work;
+  int pending;
+
+  /* Set while the notifications of a completed job get passed on, so
+     that they are not held back again. */
+  svn_boolean_t releasing;
+
+  /* Set when the threads shall exit as soon as there is no more work. */
+  svn_boolean_t shutdown;
+
+  /* WORK_AVAILABLE gets signalled when NEXT_WORK or SHUTDOWN changes and
+     WORK_DONE whenever a job is done. */
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *work_available;
+  apr_thread_cond_t *work_done;
+
+  /* Where the held notifications finally go. */
+  svn_wc_notify_func2_t notify_func;
+  void *notify_baton;
+
+  svn_cancel_func_t cancel_func;
+  void *cancel_baton;
+
+  /* Used by the calling thread only. */
+  apr_pool_t *pool;
+} merge_queue_t;
+
+/* Thread function running the merges of the jobs in the merge_queue_t
+   DATA until the queue gets shut down. */
+static void * APR_THREAD_FUNC
+merge_worker_thread(apr_thread_t *tid, void *data)
+{
+  merge_queue_t *queue = data;
+
+  apr_thread_mutex_lock(queue->mutex);
+  while (TRUE)
+    {
+      merge_job_t *job = queue->next_work;
+      apr_pool_t *scratch_pool;
+      svn_error_t *err;
+
+      if (job == NULL)
+        {
+          if (queue->shutdown)
+            break;
+
+          apr_thread_cond_wait(queue->work_available, queue->mutex);
+          continue;
+        }
+
+      queue->next_work = job->next;
+      apr_thread_mutex_unlock(queue->mutex);
+
+      scratch_pool = svn_pool_create(job->pool);
+      err = svn_wc__merge_run(job->merge, scratch_pool);
+      svn_pool_destroy(scratch_pool);
+
+      apr_thread_mutex_lock(queue->mutex);
+      job->err = err;
+      job->done = TRUE;
+      apr_thread_cond_broadcast(queue->work_done);
+    }
+  apr_thread_mutex_unlock(queue->mutex);
+
+  return NULL;
+}
+
+/* Destroy JOB, which is no longer in a queue, and discard its
+   notifications. */
+static void
+destroy_merge_job(merge_job_t *job)
+{
+  svn_error_clear(job->err);
+  if (job->notify_pool)
+    svn_pool_destroy(job->notify_pool);
+  svn_pool_destroy(job->pool);
+}
+
+/* Complete the merge of JOB, which is done and no longer in QUEUE, pass
+   its notifications on and destroy JOB. */
+static svn_error_t *
+complete_merge_job(merge_queue_t *queue,
+                   merge_job_t *job)
+{
+  enum svn_wc_merge_outcome_t merge_outcome;
+  svn_error_t *err = job->err;
+  int i;
+
+  job->err = SVN_NO_ERROR;
+  if (!err)
+    err = svn_wc__merge_complete(&merge_outcome, job->merge,
+                                 conflict_resolver, &job->conflict_baton,
+                                 queue->cancel_func, queue->cancel_baton,
+                                 job->pool);
+  if (err)
+    {
+      destroy_merge_job(job);
+      return svn_error_trace(err);
+    }
+
+  queue->releasing = TRUE;
+
+  if (job->notify)
+    {
+      job->notify->content_state = merge_content_state(merge_outcome,
+                                                       job->has_local_mods);
+
+      /* As the merge editor would have done, had it known this. */
+      if (job->notify->content_state == svn_wc_notify_state_missing)
+        job->notify->action = svn_wc_notify_skip;
+
+      queue->notify_func(queue->notify_baton, job->notify, job->notify_pool);
+    }
+
+  for (i = 0; job->trailers && i < job->trailers->nelts; i++)
+    queue->notify_func(queue->notify_baton,
+                       APR_ARRAY_IDX(job->trailers, i, svn_wc_notify_t *),
+                       job->notify_pool);
+
+  queue->releasing = FALSE;
+
+  destroy_merge_job(job);
+
+  return SVN_NO_ERROR;
+}
+
+/* Complete the jobs at the head of QUEUE that are done, in order.  While
+   more than LIMIT jobs are pending, wait for the first one to get
+   done. */
+static svn_error_t *
+flush_merge_queue(merge_queue_t *queue,
+                  int limit)
+{
+  while (queue->first)
+    {
+      merge_job_t *job = queue->first;
+      svn_boolean_t done;
+      svn_error_t *err = SVN_NO_ERROR;
+
+      apr_thread_mutex_lock(queue->mutex);
+      while (!job->done && !err && queue->pending > limit)
+        {
+          apr_thread_cond_timedwait(queue->work_done, queue->mutex,
+                                    apr_time_from_sec(1) / 10);
+          if (queue->cancel_func)
+            err = queue->cancel_func(queue->cancel_baton);
+        }
+
+      done = job->done;
+      if (done)
+        {
+          queue->first = job->next;
+          if (queue->first == NULL)
+            queue->last = NULL;
+          queue->pending--;
+        }
+      apr_thread_mutex_unlock(queue->mutex);
+
+      SVN_ERR(err);
+      if (!done)
+        break;
+
+      SVN_ERR(complete_merge_job(queue, job));
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Prepare the merge of the file at OLDER_ABSPATH and YOURS_ABSPATH into
+   MINE_ABSPATH, the target of the merge at MINE_RELPATH, and queue it for
+   the threads of MERGE_B->queue.  HAS_LOCAL_MODS, CONFLICT_BATON and the
+   other arguments are those that merge_file_changed() would pass to
+   svn_wc_merge4().  Copy the files to merge, as the caller is going to
+   delete them as soon as we return.  Use SCRATCH_POOL for temporary
+   allocations. */
+static svn_error_t *
+queue_text_merge(merge_cmd_baton_t *merge_b,
+                 const char *mine_relpath,
+                 const char *mine_abspath,
+                 const char *older_abspath,
+                 const char *yours_abspath,
+                 const char *left_label,
+                 const char *right_label,
+                 const char *target_label,
+                 const svn_wc_conflict_version_t *left,
+                 const svn_wc_conflict_version_t *right,
+                 const apr_array_header_t *prop_changes,
+                 svn_boolean_t has_local_mods,
+                 const conflict_resolver_baton_t *conflict_baton,
+                 apr_pool_t *scratch_pool)
+{
+  merge_queue_t *queue = merge_b->queue;
+  apr_pool_t *pool;
+  merge_job_t *job;
+  const char *older_copy, *yours_copy;
+  svn_error_t *err;
+  apr_status_t status;
+
+  /* Merges into the same file must not overtake each other. */
+  for (job = queue->first; job; job = job->next)
+    if (strcmp(job->target_abspath, mine_abspath) == 0)
+      {
+        SVN_ERR(flush_merge_queue(queue, 0));
+        break;
+      }
+
+  pool = svn_client__create_thread_pool();
+  job = apr_pcalloc(pool, sizeof(*job));
+  job->pool = pool;
+  job->target_abspath = apr_pstrdup(pool, mine_abspath);
+  job->relpath = apr_pstrdup(pool, mine_relpath);
+  job->has_local_mods = has_local_mods;
+  job->conflict_baton = *conflict_baton;
+
+  err = svn_io_open_unique_file3(NULL, &older_copy, NULL,
+                                 svn_io_file_del_on_pool_cleanup,
+                                 pool, scratch_pool);
+  if (!err)
+    err = svn_io_copy_file(older_abspath, older_copy, FALSE, scratch_pool);
+  if (!err)
+    err = svn_io_open_unique_file3(NULL, &yours_copy, NULL,
+                                   svn_io_file_del_on_pool_cleanup,
+                                   pool, scratch_pool);
+  if (!err)
+    err = svn_io_copy_file(yours_abspath, yours_copy, FALSE, scratch_pool);
+  if (!err)
+    err = svn_wc__merge_prepare(&job->merge, merge_b->ctx->wc_ctx,
+                                older_copy, yours_copy, mine_abspath,
+                                left_label, right_label, target_label,
+                                left, right,
+                                merge_b->dry_run, merge_b->diff3_cmd,
+                                merge_b->merge_options, prop_changes,
+                                merge_b->ctx->cancel_func,
+                                merge_b->ctx->cancel_baton,
+                                pool, scratch_pool);
+  if (err)
+    {
+      svn_pool_destroy(pool);
+      return svn_error_trace(err);
+    }
+
+  apr_thread_mutex_lock(queue->mutex);
+  if (queue->last)
+    queue->last->next = job;
+  else
+    queue->first = job;
+  queue->last = job;
+  queue->pending++;
+
+  if (queue->next_work == NULL)
+    {
+      queue->next_work = job;
+      apr_thread_cond_signal(queue->work_available);
+    }
+  apr_thread_mutex_unlock(queue->mutex);
+
+  if (queue->thread_count < queue->max_threads)
+    {
+      status = apr_thread_create(&queue->threads[queue->thread_count], NULL,
+                                 merge_worker_thread, queue, queue->pool);
+      if (status == APR_SUCCESS)
+        queue->thread_count++;
+      else if (queue->thread_count == 0)
+        return svn_error_wrap_apr(status, _("Can't create thread"));
+    }
+
+  return svn_error_trace(flush_merge_queue(queue,
+                                           queue->max_threads
+                                           * MERGE_JOBS_PER_THREAD));
+}
+
+/* Hold NOTIFY back if it has to wait for text merges in QUEUE to
+   complete, and return TRUE if so. */
+static svn_boolean_t
+hold_notification(merge_queue_t *queue,
+                  const svn_wc_notify_t *notify)
+{
+  merge_job_t *job = queue->last;
+
+  if (job == NULL || queue->releasing)
+    return FALSE;
+
+  if (job->notify_pool == NULL)
+    job->notify_pool = svn_pool_create(queue->pool);
+
+  /* The merge editor notifies about the merge right after queueing it. */
+  if (job->notify == NULL
+      && notify->action == svn_wc_notify_update_update
+      && notify->kind == svn_node_file
+      && strcmp(notify->path, job->relpath) == 0)
+    {
+      job->notify = svn_wc_dup_notify(notify, job->notify_pool);
+      return TRUE;
+    }
+
+  if (job->trailers == NULL)
+    job->trailers = apr_array_make(job->notify_pool, 1,
+                                   sizeof(svn_wc_notify_t *));
+  APR_ARRAY_PUSH(job->trailers, svn_wc_notify_t *)
+    = svn_wc_dup_notify(notify, job->notify_pool);
+
+  return TRUE;
+}
+#endif
+
+/* Start running the text merges of the editor drive of MERGE_B in as
+   many threads as the diff-threads option asks for, unless that is fewer
+   than two or an external diff3 command is in use.  Notifications for
+   NOTIFY_FUNC and NOTIFY_BATON are held back and the merges completed so
+   that both happen in the same order as without threads.  Allocate the
+   queue in POOL.
+
+   Every call has to be matched by a call to merge_queue_close(). */
+static svn_error_t *
+merge_queue_open(merge_cmd_baton_t *merge_b,
+                 svn_wc_notify_func2_t notify_func,
+                 void *notify_baton,
+                 apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+  int max_threads;
+  merge_queue_t *queue;
+  apr_status_t status;
+
+  SVN_ERR(svn_client__get_diff_threads(&max_threads,
+                                       merge_b->ctx->config));
+  if (max_threads < 2 || merge_b->diff3_cmd)
+    return SVN_NO_ERROR;
+
+  queue = apr_pcalloc(pool, sizeof(*queue));
+  queue->threads = apr_pcalloc(pool, max_threads * sizeof(*queue->threads));
+  queue->max_threads = max_threads;
+  queue->notify_func = notify_func;
+  queue->notify_baton = notify_baton;
+  queue->cancel_func = merge_b->ctx->cancel_func;
+  queue->cancel_baton = merge_b->ctx->cancel_baton;
+  queue->pool = pool;
+
+  status = apr_thread_mutex_create(&queue->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                   pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create mutex"));
+  status = apr_thread_cond_create(&queue->work_available, pool);
+  if (!status)
+    status = apr_thread_cond_create(&queue->work_done, pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create condition variable"));
+
+  merge_b->queue = queue;
+#endif
+
+  return SVN_NO_ERROR;
+}
+
+/* Stop the threads started by merge_queue_open() for MERGE_B.  If ERR is
+   SVN_NO_ERROR, complete all the merges that are still queued first,
+   else discard them.  Return ERR, or the error completing the merges. */
+static svn_error_t *
+merge_queue_close(merge_cmd_baton_t *merge_b,
+                  svn_error_t *err)
+{
+#if APR_HAS_THREADS
+  merge_queue_t *queue = merge_b->queue;
+  int i;
+
+  if (queue == NULL)
+    return svn_error_trace(err);
+
+  if (!err)
+    err = flush_merge_queue(queue, 0);
+
+  /* Stop all threads, letting them finish the merge at hand. */
+  apr_thread_mutex_lock(queue->mutex);
+  queue->shutdown = TRUE;
+  queue->next_work = NULL;
+  apr_thread_cond_broadcast(queue->work_available);
+  apr_thread_mutex_unlock(queue->mutex);
+
+  for (i = 0; i < queue->thread_count; ++i)
+    {
+      apr_status_t thread_status;
+      apr_thread_join(&thread_status, queue->threads[i]);
+    }
+
+  /* Discard the merges that have not been completed. */
+  while (queue->first)
+    {
+      merge_job_t *job = queue->first;
+
+      queue->first = job->next;
+      destroy_merge_job(job);
+    }
+  queue->last = NULL;
+  queue->pending = 0;
+
+  apr_thread_cond_destroy(queue->work_done);
+  apr_thread_cond_destroy(queue->work_available);
+  apr_thread_mutex_destroy(queue->mutex);
+
+  merge_b->queue = NULL;
+#endif
+
+  return svn_error_trace(err);
+}
+
 /* An svn_wc_diff_callbacks4_t function. */
 static svn_error_t *
 merge_file_opened(svn_boolean_t *tree_conflicted,
@@ -1654,6 +2142,24 @@ merge_file_changed(svn_wc_notify_state_t *content_state,
 
       SVN_ERR(make_conflict_versions(&left, &right, mine_abspath,
                                      svn_node_file, merge_b));
+
+#if APR_HAS_THREADS
+      /* Complete the merge later, unless merge_file_added() wants to
+         know its outcome right away. */
+      if (merge_b->queue && !merge_b->add_necessitated_merge)
+        {
+          SVN_ERR(queue_text_merge(merge_b, mine_relpath, mine_abspath,
+                                   older_abspath, yours_abspath,
+                                   left_label, right_label, target_label,
+                                   left, right, prop_changes,
+                                   has_local_mods, &conflict_baton,
+                                   scratch_pool));
+          if (content_state)
+            *content_state = svn_wc_notify_state_unknown;
+          return SVN_NO_ERROR;
+        }
+#endif
+
       SVN_ERR(svn_wc_merge4(&merge_outcome, merge_b->ctx->wc_ctx,
                             older_abspath, yours_abspath, mine_abspath,
                             left_label, right_label, target_label,
@@ -1666,19 +2172,7 @@ merge_file_changed(svn_wc_notify_state_t *content_state,
                             scratch_pool));
 
       if (content_state)
-        {
-          if (merge_outcome == svn_wc_merge_conflict)
-            *content_state = svn_wc_notify_state_conflicted;
-          else if (has_local_mods
-                   && merge_outcome != svn_wc_merge_unchanged)
-            *content_state = svn_wc_notify_state_merged;
-          else if (merge_outcome == svn_wc_merge_merged)
-            *content_state = svn_wc_notify_state_changed;
-          else if (merge_outcome == svn_wc_merge_no_merge)
-            *content_state = svn_wc_notify_state_missing;
-          else /* merge_outcome == svn_wc_merge_unchanged */
-            *content_state = svn_wc_notify_state_unchanged;
-        }
+        *content_state = merge_content_state(merge_outcome, has_local_mods);
     }
 
   return SVN_NO_ERROR;
@@ -2846,6 +3340,13 @@ notification_receiver(void *baton, const svn_wc_notify_t *notify,
   svn_boolean_t is_operative_notification = IS_OPERATIVE_NOTIFICATION(notify);
   const char *notify_abspath;
 
+#if APR_HAS_THREADS
+  /* Keep the order of the merges that are still running elsewhere. */
+  if (notify_b->merge_b->queue
+      && hold_notification(notify_b->merge_b->queue, notify))
+    return;
+#endif
+
   /* Skip notifications if this is a --record-only merge that is adding
      or deleting NOTIFY->PATH, allow only mergeinfo changes and headers.
      We will already have skipped the actual addition or deletion, but will
@@ -5070,7 +5571,11 @@ drive_merge_report_editor(const char *target_abspath,
         }
       svn_pool_destroy(iterpool);
     }
-  SVN_ERR(reporter->finish_report(report_baton, scratch_pool));
+  SVN_ERR(merge_queue_open(merge_b, notification_receiver, notify_b,
+                           scratch_pool));
+  SVN_ERR(merge_queue_close(merge_b,
+                            reporter->finish_report(report_baton,
+                                                    scratch_pool)));
 
   /* Point the merge baton's RA sessions back where they were. */
   SVN_ERR(svn_ra_reparent(merge_b->ra_session1, old_sess1_url, scratch_pool));
@@ -8900,6 +9405,7 @@ do_merge(apr_hash_t **modified_subtrees,
   merge_cmd_baton.merge_options = merge_options;
   merge_cmd_baton.diff3_cmd = diff3_cmd;
   merge_cmd_baton.use_sleep = use_sleep;
+  merge_cmd_baton.queue = NULL;
 
   /* Build the notification receiver baton. */
   notify_baton.wrapped_func = ctx->notify_func2;
@@ -25,6 +25,8 @@
 #include <apr_strings.h>
 
 #include "svn_pools.h"
+#include "svn_config.h"
+#include "svn_string.h"
 #include "svn_error.h"
 #include "svn_types.h"
 #include "svn_opt.h"
@@ -321,6 +323,49 @@ svn_client__default_walker_error_handler(const char *path,
 }
 
 
+apr_pool_t *
+svn_client__create_thread_pool(void)
+{
+  apr_allocator_t *allocator;
+  apr_pool_t *pool;
+
+  /* Pools sharing an allocator must not be used from different threads,
+     hence the allocator of its own.  The global allocator is thread-safe,
+     so fall back to that. */
+  if (apr_allocator_create(&allocator))
+    return svn_pool_create(NULL);
+
+  apr_allocator_max_free_set(allocator, SVN_ALLOCATOR_RECOMMENDED_MAX_FREE);
+  pool = svn_pool_create_ex(NULL, allocator);
+  apr_allocator_owner_set(allocator, pool);
+
+  return pool;
+}
+
+
+svn_error_t *
+svn_client__get_diff_threads(int *max_threads,
+                             apr_hash_t *config)
+{
+  svn_config_t *cfg = NULL;
+  const char *max_threads_str;
+
+  *max_threads = 1;
+
+  if (config)
+    cfg = apr_hash_get(config, SVN_CONFIG_CATEGORY_CONFIG,
+                       APR_HASH_KEY_STRING);
+  svn_config_get(cfg, &max_threads_str, SVN_CONFIG_SECTION_MISCELLANY,
+                 SVN_CONFIG_OPTION_DIFF_THREADS, NULL);
+  if (max_threads_str)
+    SVN_ERR(svn_error_quick_wrap(svn_cstring_atoi(max_threads,
+                                                  max_threads_str),
+                                 _("diff-threads invalid")));
+
+  return SVN_NO_ERROR;
+}
+
+
 const svn_opt_revision_t *
 svn_cl__rev_default_to_head_or_base(const svn_opt_revision_t *revision,
                                     const char *path_or_url)
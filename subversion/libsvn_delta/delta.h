@@ -42,7 +42,7 @@ extern "C" {
 
 /* The standard size of one svndiff window. */
 
-#define SVN_DELTA_WINDOW_SIZE 102400
+#define SVN_DELTA_WINDOW_SIZE SVN_DELTA_DEFAULT_WINDOW_SIZE
 
 
 /* Context/baton for building an operation sequence. */
@@ -88,6 +88,31 @@ void svn_txdelta__xdelta(svn_txdelta__ops_baton_t *build_baton,
                          apr_size_t target_len,
                          apr_pool_t *pool);
 
+/* Implementations of the xdelta inner loops.  All of them produce the
+   same delta windows; they differ in speed only. */
+typedef enum svn_txdelta__xdelta_kernel_t
+{
+  /* The fastest kernel supported by this build and the current CPU.
+     This is the default. */
+  svn_txdelta__xdelta_kernel_auto,
+
+  /* Portable C code. */
+  svn_txdelta__xdelta_kernel_scalar,
+
+  /* SSE2 instructions. */
+  svn_txdelta__xdelta_kernel_sse2,
+
+  /* AVX2 instructions. */
+  svn_txdelta__xdelta_kernel_avx2
+} svn_txdelta__xdelta_kernel_t;
+
+/* Make svn_txdelta__xdelta() use KERNEL from now on and return TRUE.
+   If KERNEL is not supported by this build or the current CPU, return
+   FALSE and leave the selection unchanged.  This is meant for tests and
+   benchmarks and must not be called while deltas are being computed. */
+svn_boolean_t
+svn_txdelta__xdelta_use_kernel(svn_txdelta__xdelta_kernel_t kernel);
+
 
 #ifdef __cplusplus
 }
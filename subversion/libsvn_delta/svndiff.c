@@ -24,14 +24,19 @@
 
 #include <assert.h>
 #include <string.h>
+#include <apr_thread_cond.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
 #include "svn_delta.h"
 #include "svn_io.h"
 #include "delta.h"
 #include "svn_pools.h"
+#include "svn_sorts.h"
 #include "svn_private_config.h"
 #include <zlib.h>
 
 #include "private/svn_error_private.h"
+#include "private/svn_subr_private.h"
 
 /* The zlib compressBound function was not exported until 1.2.0. */
 #if ZLIB_VERNUM >= 0x1200
@@ -40,8 +45,9 @@
 #define svnCompressBound(LEN) ((LEN) + ((LEN) >> 12) + ((LEN) >> 14) + 11)
 #endif
 
-/* For svndiff1, address/instruction/new data under this size will not
-   be compressed using zlib as a secondary compressor.  */
+/* For svndiff1 and svndiff2, address/instruction/new data under this
+   size will not be compressed using zlib resp. LZ4 as a secondary
+   compressor.  */
 #define MIN_COMPRESS_SIZE 512
 
 /* ----- Text delta to svndiff ----- */
@@ -65,10 +71,6 @@ struct encoder_baton {
 #define MAX_ENCODED_INT_LEN 10
 /* This is at least as big as the largest size for a single instruction. */
 #define MAX_INSTRUCTION_LEN (2*MAX_ENCODED_INT_LEN+1)
-/* This is at least as big as the largest possible instructions
-   section: in theory, the instructions could be SVN_DELTA_WINDOW_SIZE
-   1-byte copy-from-source instructions (though this is very unlikely). */
-#define MAX_INSTRUCTION_SECTION_LEN (SVN_DELTA_WINDOW_SIZE*MAX_INSTRUCTION_LEN)
 
 /* Encode VAL into the buffer P using the variable-length svndiff
    integer format.  Return the incremented value of P after the
@@ -182,29 +184,185 @@ zlib_encode(const char *data,
   return SVN_NO_ERROR;
 }
 
+/* Like zlib_encode() but using LZ4 as the compressor.  LZ4 has no
+   compression levels, so any level other than "none" gives the same
+   result. */
+static void
+lz4_encode(const char *data,
+           apr_size_t len,
+           svn_stringbuf_t *out,
+           int compression_level)
+{
+  apr_size_t intlen;
+
+  append_encoded_int(out, len);
+  intlen = out->len;
+
+  if (   (len < MIN_COMPRESS_SIZE)
+      || (compression_level == SVN_DELTA_COMPRESSION_LEVEL_NONE))
+    {
+      svn_stringbuf_appendbytes(out, data, len);
+      return;
+    }
+
+  svn__lz4_compress(out, data, len);
+
+  /* Compression didn't help, just append the original text. */
+  if (out->len - intlen >= len)
+    {
+      out->len = intlen;
+      svn_stringbuf_appendbytes(out, data, len);
+    }
+}
+
+/* Compress the LEN bytes at DATA into OUT as required for svndiff
+   VERSION using COMPRESSION_LEVEL. */
 static svn_error_t *
-window_handler(svn_txdelta_window_t *window, void *baton)
+encode_section(const char *data,
+               apr_size_t len,
+               svn_stringbuf_t *out,
+               int version,
+               int compression_level)
+{
+  if (version == 2)
+    lz4_encode(data, len, out, compression_level);
+  else
+    SVN_ERR(zlib_encode(data, len, out, compression_level));
+
+  return SVN_NO_ERROR;
+}
+
+/* Append the svndiff encoding of the instructions in WINDOW to OUT. */
+static void
+encode_instructions(svn_stringbuf_t *out,
+                    const svn_txdelta_window_t *window)
 {
-  struct encoder_baton *eb = baton;
-  apr_pool_t *pool = svn_pool_create(eb->pool);
-  svn_stringbuf_t *instructions = svn_stringbuf_create_empty(pool);
-  svn_stringbuf_t *i1 = svn_stringbuf_create_empty(pool);
-  svn_stringbuf_t *header = svn_stringbuf_create_empty(pool);
-  const svn_string_t *newdata;
   unsigned char ibuf[MAX_INSTRUCTION_LEN], *ip;
   const svn_txdelta_op_t *op;
+
+  for (op = window->ops; op < window->ops + window->num_ops; op++)
+    {
+      /* Encode the action code and length.  */
+      ip = ibuf;
+      switch (op->action_code)
+        {
+        case svn_txdelta_source: *ip = 0; break;
+        case svn_txdelta_target: *ip = (0x1 << 6); break;
+        case svn_txdelta_new:    *ip = (0x2 << 6); break;
+        }
+      if (op->length >> 6 == 0)
+        *ip++ |= op->length;
+      else
+        ip = encode_int(ip + 1, op->length);
+      if (op->action_code != svn_txdelta_new)
+        ip = encode_int(ip, op->offset);
+      svn_stringbuf_appendbytes(out, (const char *)ibuf, ip - ibuf);
+    }
+}
+
+/* Compress the encoded INSTRUCTIONS and the NEW_DATA of a window with
+   the given source view and target view parameters as required for
+   svndiff VERSION and COMPRESSION_LEVEL.  Set *HEADER, *INSTRUCTIONS_OUT
+   and *NEW_DATA_OUT to the three parts of the svndiff window.  The
+   results are allocated in POOL or refer to the input data. */
+static svn_error_t *
+encode_window(svn_stringbuf_t **header,
+              svn_stringbuf_t **instructions_out,
+              const svn_string_t **new_data_out,
+              svn_filesize_t sview_offset,
+              apr_size_t sview_len,
+              apr_size_t tview_len,
+              svn_stringbuf_t *instructions,
+              const svn_string_t *new_data,
+              int version,
+              int compression_level,
+              apr_pool_t *pool)
+{
+  *header = svn_stringbuf_create_empty(pool);
+  append_encoded_int(*header, sview_offset);
+  append_encoded_int(*header, sview_len);
+  append_encoded_int(*header, tview_len);
+  if (version > 0)
+    {
+      svn_stringbuf_t *i1 = svn_stringbuf_create_empty(pool);
+      SVN_ERR(encode_section(instructions->data, instructions->len,
+                             i1, version, compression_level));
+      instructions = i1;
+    }
+  append_encoded_int(*header, instructions->len);
+  if (version > 0)
+    {
+      svn_stringbuf_t *temp = svn_stringbuf_create_empty(pool);
+      svn_string_t *tempstr = svn_string_create_empty(pool);
+      SVN_ERR(encode_section(new_data->data, new_data->len,
+                             temp, version, compression_level));
+      tempstr->data = temp->data;
+      tempstr->len = temp->len;
+      new_data = tempstr;
+    }
+
+  append_encoded_int(*header, new_data->len);
+
+  *instructions_out = instructions;
+  *new_data_out = new_data;
+
+  return SVN_NO_ERROR;
+}
+
+/* Write the HEADER, INSTRUCTIONS and NEW_DATA of an svndiff window to
+   OUTPUT. */
+static svn_error_t *
+write_window(svn_stream_t *output,
+             const svn_stringbuf_t *header,
+             const svn_stringbuf_t *instructions,
+             const svn_string_t *new_data)
+{
   apr_size_t len;
 
-  /* Make sure we write the header.  */
+  len = header->len;
+  SVN_ERR(svn_stream_write(output, header->data, &len));
+  if (instructions->len > 0)
+    {
+      len = instructions->len;
+      SVN_ERR(svn_stream_write(output, instructions->data, &len));
+    }
+  if (new_data->len > 0)
+    {
+      len = new_data->len;
+      SVN_ERR(svn_stream_write(output, new_data->data, &len));
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Make sure the svndiff header has been written to the output of EB. */
+static svn_error_t *
+write_svndiff_header(struct encoder_baton *eb)
+{
   if (eb->header_done == FALSE)
     {
       char svnver[4] = {'S','V','N','\0'};
-      len = 4;
+      apr_size_t len = 4;
       svnver[3] = (char)eb->version;
       SVN_ERR(svn_stream_write(eb->output, svnver, &len));
       eb->header_done = TRUE;
     }
 
+  return SVN_NO_ERROR;
+}
+
+static svn_error_t *
+window_handler(svn_txdelta_window_t *window, void *baton)
+{
+  struct encoder_baton *eb = baton;
+  apr_pool_t *pool;
+  svn_stringbuf_t *instructions;
+  svn_stringbuf_t *header;
+  const svn_string_t *newdata;
+
+  /* Make sure we write the header.  */
+  SVN_ERR(write_svndiff_header(eb));
+
   if (window == NULL)
     {
       svn_stream_t *output = eb->output;
@@ -226,76 +384,376 @@ window_handler(svn_txdelta_window_t *window, void *baton)
       return svn_stream_close(output);
     }
 
-  /* Encode the instructions.  */
-  for (op = window->ops; op < window->ops + window->num_ops; op++)
+  /* Encode the instructions and the header and write out the window.  */
+  pool = svn_pool_create(eb->pool);
+  instructions = svn_stringbuf_create_empty(pool);
+  encode_instructions(instructions, window);
+  SVN_ERR(encode_window(&header, &instructions, &newdata,
+                        window->sview_offset, window->sview_len,
+                        window->tview_len, instructions, window->new_data,
+                        eb->version, eb->compression_level, pool));
+  SVN_ERR(write_window(eb->output, header, instructions, newdata));
+
+  svn_pool_destroy(pool);
+  return SVN_NO_ERROR;
+}
+
+#if APR_HAS_THREADS
+
+/* Number of windows that may be queued for or be in compression per
+   worker thread.  This bounds the memory use of the encoder. */
+#define WINDOWS_PER_THREAD 2
+
+/* Processing states of a window_slot_t. */
+typedef enum slot_state_t
+{
+  slot_empty,
+  slot_queued,
+  slot_busy,
+  slot_done
+} slot_state_t;
+
+/* One window on its way through the concurrent encoder. */
+typedef struct window_slot_t
+{
+  /* Protected by the encoder's mutex. */
+  slot_state_t state;
+
+  /* Copies of the window's parameters and its data, filled in by the
+     calling thread. */
+  svn_filesize_t sview_offset;
+  apr_size_t sview_len;
+  apr_size_t tview_len;
+  svn_stringbuf_t *instructions;
+  svn_string_t *new_data;
+
+  /* The encoded window, filled in by a worker thread. */
+  svn_stringbuf_t *header;
+  svn_stringbuf_t *instructions_out;
+  const svn_string_t *new_data_out;
+  svn_error_t *err;
+
+  /* Used by one thread at a time only.  It comes with an allocator of
+     its own because pools sharing an allocator must not be used from
+     different threads. */
+  apr_pool_t *pool;
+} window_slot_t;
+
+/* Baton of the concurrent encoder. */
+typedef struct concurrent_encoder_baton_t
+{
+  /* The underlying synchronous encoder and its settings. */
+  struct encoder_baton *eb;
+
+  /* Ring buffer of windows.  FIRST_SLOT is the oldest one that has not
+     been written yet, NEXT_JOB the oldest one no worker has picked up
+     yet.  SLOT_COUNT is the number of slots in use. */
+  window_slot_t *slots;
+  int slot_capacity;
+  int first_slot;
+  int slot_count;
+  int next_job;
+
+  /* The worker threads, allocated in THREAD_POOL.  That is a root pool
+     because the children of the encoder's pool get destroyed before
+     its cleanups run, i.e. before we had a chance to join them.
+     Up to MAX_THREADS of them get started once the second window
+     arrives.  Most deltas consist of a single window and won't need
+     them.  Until then, THREAD_COUNT is 0 and the windows get encoded
+     synchronously. */
+  apr_thread_t **threads;
+  int thread_count;
+  int max_threads;
+  apr_pool_t *thread_pool;
+
+  /* Set once we received the first window. */
+  svn_boolean_t had_window;
+
+  /* Set if the worker threads could not be started.  All windows will
+     then be encoded synchronously. */
+  svn_boolean_t synchronous;
+
+  /* Protects the slot states and the indexes above.  WORK_AVAILABLE
+     gets signalled when a window has been queued or SHUTDOWN has been
+     set, WINDOW_DONE whenever a worker finished a window. */
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *work_available;
+  apr_thread_cond_t *window_done;
+  svn_boolean_t shutdown;
+} concurrent_encoder_baton_t;
+
+/* Thread function encoding windows queued in the
+   concurrent_encoder_baton_t DATA until the encoder shuts down. */
+static void * APR_THREAD_FUNC
+encoder_thread(apr_thread_t *tid, void *data)
+{
+  concurrent_encoder_baton_t *ceb = data;
+
+  apr_thread_mutex_lock(ceb->mutex);
+  while (TRUE)
     {
-      /* Encode the action code and length.  */
-      ip = ibuf;
-      switch (op->action_code)
+      window_slot_t *slot = &ceb->slots[ceb->next_job];
+
+      if (slot->state != slot_queued)
         {
-        case svn_txdelta_source: *ip = 0; break;
-        case svn_txdelta_target: *ip = (0x1 << 6); break;
-        case svn_txdelta_new:    *ip = (0x2 << 6); break;
+          if (ceb->shutdown)
+            break;
+
+          apr_thread_cond_wait(ceb->work_available, ceb->mutex);
+          continue;
         }
-      if (op->length >> 6 == 0)
-        *ip++ |= op->length;
-      else
-        ip = encode_int(ip + 1, op->length);
-      if (op->action_code != svn_txdelta_new)
-        ip = encode_int(ip, op->offset);
-      svn_stringbuf_appendbytes(instructions, (const char *)ibuf, ip - ibuf);
+
+      slot->state = slot_busy;
+      ceb->next_job = (ceb->next_job + 1) % ceb->slot_capacity;
+      apr_thread_mutex_unlock(ceb->mutex);
+
+      slot->err = encode_window(&slot->header, &slot->instructions_out,
+                                &slot->new_data_out, slot->sview_offset,
+                                slot->sview_len, slot->tview_len,
+                                slot->instructions, slot->new_data,
+                                ceb->eb->version,
+                                ceb->eb->compression_level, slot->pool);
+
+      apr_thread_mutex_lock(ceb->mutex);
+      slot->state = slot_done;
+      apr_thread_cond_broadcast(ceb->window_done);
     }
+  apr_thread_mutex_unlock(ceb->mutex);
+
+  return NULL;
+}
 
-  /* Encode the header.  */
-  append_encoded_int(header, window->sview_offset);
-  append_encoded_int(header, window->sview_len);
-  append_encoded_int(header, window->tview_len);
-  if (eb->version == 1)
+/* Wait for the oldest window in CEB to be encoded, write it to the
+   output and release its slot. */
+static svn_error_t *
+write_first_window(concurrent_encoder_baton_t *ceb)
+{
+  window_slot_t *slot = &ceb->slots[ceb->first_slot];
+  svn_error_t *err;
+
+  apr_thread_mutex_lock(ceb->mutex);
+  while (slot->state != slot_done)
+    apr_thread_cond_wait(ceb->window_done, ceb->mutex);
+  apr_thread_mutex_unlock(ceb->mutex);
+
+  err = slot->err;
+  slot->err = SVN_NO_ERROR;
+  if (!err)
+    err = write_window(ceb->eb->output, slot->header, slot->instructions_out,
+                       slot->new_data_out);
+
+  svn_pool_clear(slot->pool);
+  ceb->first_slot = (ceb->first_slot + 1) % ceb->slot_capacity;
+  ceb->slot_count--;
+
+  apr_thread_mutex_lock(ceb->mutex);
+  slot->state = slot_empty;
+  apr_thread_mutex_unlock(ceb->mutex);
+
+  return svn_error_trace(err);
+}
+
+/* Pool cleanup function stopping and joining the worker threads of the
+   concurrent_encoder_baton_t DATA and releasing the window slots. */
+static apr_status_t
+shutdown_encoder(void *data)
+{
+  concurrent_encoder_baton_t *ceb = data;
+  int i;
+
+  apr_thread_mutex_lock(ceb->mutex);
+  ceb->shutdown = TRUE;
+  apr_thread_cond_broadcast(ceb->work_available);
+  apr_thread_mutex_unlock(ceb->mutex);
+
+  for (i = 0; i < ceb->thread_count; ++i)
     {
-      SVN_ERR(zlib_encode(instructions->data, instructions->len,
-                          i1, eb->compression_level));
-      instructions = i1;
+      apr_status_t thread_status;
+      apr_thread_join(&thread_status, ceb->threads[i]);
     }
-  append_encoded_int(header, instructions->len);
-  if (eb->version == 1)
+  svn_pool_destroy(ceb->thread_pool);
+
+  for (i = 0; i < ceb->slot_capacity; ++i)
     {
-      svn_stringbuf_t *temp = svn_stringbuf_create_empty(pool);
-      svn_string_t *tempstr = svn_string_create_empty(pool);
-      SVN_ERR(zlib_encode(window->new_data->data, window->new_data->len,
-                          temp, eb->compression_level));
-      tempstr->data = temp->data;
-      tempstr->len = temp->len;
-      newdata = tempstr;
+      svn_error_clear(ceb->slots[i].err);
+      if (ceb->slots[i].pool)
+        svn_pool_destroy(ceb->slots[i].pool);
     }
-  else
-    newdata = window->new_data;
 
-  append_encoded_int(header, newdata->len);
+  return APR_SUCCESS;
+}
 
-  /* Write out the window.  */
-  len = header->len;
-  SVN_ERR(svn_stream_write(eb->output, header->data, &len));
-  if (instructions->len > 0)
+/* Return a new root pool that may be used from a thread other than the
+   creating one. */
+static apr_pool_t *
+create_thread_pool(void)
+{
+  apr_allocator_t *allocator;
+  apr_pool_t *pool;
+
+  /* The global allocator is thread-safe, so fall back to that. */
+  if (apr_allocator_create(&allocator))
+    return svn_pool_create(NULL);
+
+  apr_allocator_max_free_set(allocator, SVN_ALLOCATOR_RECOMMENDED_MAX_FREE);
+  pool = svn_pool_create_ex(NULL, allocator);
+  apr_allocator_owner_set(allocator, pool);
+
+  return pool;
+}
+
+/* Start the worker threads of CEB and allocate everything they need.
+   On failure, release all of that again and return an error. */
+static svn_error_t *
+start_workers(concurrent_encoder_baton_t *ceb)
+{
+  struct encoder_baton *eb = ceb->eb;
+  apr_status_t status;
+  int i;
+
+  ceb->slot_capacity = ceb->max_threads * WINDOWS_PER_THREAD;
+  ceb->slots = apr_pcalloc(eb->pool,
+                           ceb->slot_capacity * sizeof(*ceb->slots));
+  ceb->threads = apr_pcalloc(eb->pool,
+                             ceb->max_threads * sizeof(*ceb->threads));
+
+  status = apr_thread_mutex_create(&ceb->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                   eb->pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create mutex"));
+  status = apr_thread_cond_create(&ceb->work_available, eb->pool);
+  if (!status)
+    status = apr_thread_cond_create(&ceb->window_done, eb->pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create condition variable"));
+
+  for (i = 0; i < ceb->slot_capacity; ++i)
+    ceb->slots[i].pool = create_thread_pool();
+  ceb->thread_pool = create_thread_pool();
+
+  /* From here on, the threads and slots get released with EB->POOL. */
+  apr_pool_cleanup_register(eb->pool, ceb, shutdown_encoder,
+                            apr_pool_cleanup_null);
+
+  for (i = 0; i < ceb->max_threads; ++i)
     {
-      len = instructions->len;
-      SVN_ERR(svn_stream_write(eb->output, instructions->data, &len));
+      status = apr_thread_create(&ceb->threads[ceb->thread_count], NULL,
+                                 encoder_thread, ceb, ceb->thread_pool);
+      if (status)
+        break;
+
+      ceb->thread_count++;
     }
-  if (newdata->len > 0)
+
+  /* Without any worker, the windows would never get encoded. */
+  if (ceb->thread_count == 0)
     {
-      len = newdata->len;
-      SVN_ERR(svn_stream_write(eb->output, newdata->data, &len));
+      apr_pool_cleanup_run(eb->pool, ceb, shutdown_encoder);
+      return svn_error_wrap_apr(status, _("Can't create thread"));
     }
 
-  svn_pool_destroy(pool);
   return SVN_NO_ERROR;
 }
 
+/* Implements svn_txdelta_window_handler_t for the concurrent encoder.
+   The windows are compressed by worker threads while the caller
+   produces the next ones.  They get written in order by this function,
+   i.e. always from the calling thread. */
+static svn_error_t *
+concurrent_window_handler(svn_txdelta_window_t *window, void *baton)
+{
+  concurrent_encoder_baton_t *ceb = baton;
+  window_slot_t *slot;
+  int slot_index;
+
+  /* Don't start any threads before we know there is more than one
+     window to encode. */
+  if (ceb->thread_count == 0)
+    {
+      if (window && ceb->had_window && !ceb->synchronous)
+        {
+          svn_error_t *err = start_workers(ceb);
+
+          /* If we can't start any threads, simply carry on without. */
+          ceb->synchronous = err != SVN_NO_ERROR;
+          svn_error_clear(err);
+        }
+
+      ceb->had_window = TRUE;
+      if (ceb->thread_count == 0)
+        return svn_error_trace(window_handler(window, ceb->eb));
+    }
+
+  SVN_ERR(write_svndiff_header(ceb->eb));
+
+  if (window == NULL)
+    {
+      svn_error_t *err = SVN_NO_ERROR;
+
+      while (ceb->slot_count && !err)
+        err = write_first_window(ceb);
+
+      /* Destroying the pool also stops the worker threads. */
+      if (err)
+        {
+          svn_pool_destroy(ceb->eb->pool);
+          return svn_error_trace(err);
+        }
+
+      return window_handler(NULL, ceb->eb);
+    }
+
+  /* Make room for the new window. */
+  if (ceb->slot_count == ceb->slot_capacity)
+    SVN_ERR(write_first_window(ceb));
+
+  /* Copy the window data to the next free slot. */
+  slot_index = (ceb->first_slot + ceb->slot_count) % ceb->slot_capacity;
+  slot = &ceb->slots[slot_index];
+  slot->sview_offset = window->sview_offset;
+  slot->sview_len = window->sview_len;
+  slot->tview_len = window->tview_len;
+  slot->instructions = svn_stringbuf_create_empty(slot->pool);
+  encode_instructions(slot->instructions, window);
+  slot->new_data = svn_string_ncreate(window->new_data->data,
+                                      window->new_data->len, slot->pool);
+  ceb->slot_count++;
+
+  /* Hand it over to the workers. */
+  apr_thread_mutex_lock(ceb->mutex);
+  slot->state = slot_queued;
+  apr_thread_cond_signal(ceb->work_available);
+  apr_thread_mutex_unlock(ceb->mutex);
+
+  return SVN_NO_ERROR;
+}
+
+/* Set *HANDLER and *HANDLER_BATON to a concurrent encoder on top of the
+   synchronous one in EB, using up to MAX_THREADS worker threads. */
+static void
+create_concurrent_encoder(svn_txdelta_window_handler_t *handler,
+                          void **handler_baton,
+                          struct encoder_baton *eb,
+                          int max_threads)
+{
+  concurrent_encoder_baton_t *ceb = apr_pcalloc(eb->pool, sizeof(*ceb));
+
+  ceb->eb = eb;
+  ceb->max_threads = max_threads;
+
+  *handler = concurrent_window_handler;
+  *handler_baton = ceb;
+}
+
+#endif /* APR_HAS_THREADS */
+
 void
-svn_txdelta_to_svndiff3(svn_txdelta_window_handler_t *handler,
+svn_txdelta_to_svndiff4(svn_txdelta_window_handler_t *handler,
                         void **handler_baton,
                         svn_stream_t *output,
                         int svndiff_version,
                         int compression_level,
+                        int thread_count,
                         apr_pool_t *pool)
 {
   apr_pool_t *subpool = svn_pool_create(pool);
@@ -310,6 +768,27 @@ svn_txdelta_to_svndiff3(svn_txdelta_window_handler_t *handler,
 
   *handler = window_handler;
   *handler_baton = eb;
+
+#if APR_HAS_THREADS
+  /* There is nothing to parallelize without compression. */
+  if (   thread_count > 1
+      && svndiff_version > 0
+      && compression_level != SVN_DELTA_COMPRESSION_LEVEL_NONE)
+    create_concurrent_encoder(handler, handler_baton, eb,
+                              MIN(thread_count, SVN_DELTA_MAX_THREADS));
+#endif
+}
+
+void
+svn_txdelta_to_svndiff3(svn_txdelta_window_handler_t *handler,
+                        void **handler_baton,
+                        svn_stream_t *output,
+                        int svndiff_version,
+                        int compression_level,
+                        apr_pool_t *pool)
+{
+  svn_txdelta_to_svndiff4(handler, handler_baton, output, svndiff_version,
+                          compression_level, 1, pool);
 }
 
 void
@@ -344,14 +823,13 @@ struct decode_baton
   svn_txdelta_window_handler_t consumer_func;
   void *consumer_baton;
 
-  /* Pool to create subpools from; each developing window will be a
-     subpool.  */
+  /* Pool for the data that lives as long as the parser.  */
   apr_pool_t *pool;
 
-  /* The current subpool which contains our current window-buffer.  */
+  /* Scratch pool for decoding a window, cleared after each window.  */
   apr_pool_t *subpool;
 
-  /* The actual svndiff data buffer, living within subpool.  */
+  /* The svndiff data of an incomplete window, living within pool.  */
   svn_stringbuf_t *buffer;
 
   /* The offset and size of the last source view, so that we can check
@@ -498,6 +976,44 @@ zlib_decode(const unsigned char *in, apr_size_t inLen, svn_stringbuf_t *out,
   return SVN_NO_ERROR;
 }
 
+/* Like zlib_decode() but for LZ4 compressed data as found in svndiff2. */
+static svn_error_t *
+lz4_decode(const unsigned char *in, apr_size_t inLen, svn_stringbuf_t *out,
+           apr_size_t limit)
+{
+  apr_size_t len;
+  const unsigned char *oldplace = in;
+  svn_error_t *err;
+
+  /* First thing in the string is the original length.  */
+  in = decode_size(&len, in, in + inLen);
+  if (in == NULL)
+    return svn_error_create(SVN_ERR_SVNDIFF_INVALID_COMPRESSED_DATA, NULL,
+                            _("Decompression of svndiff data failed: no size"));
+  if (len > limit)
+    return svn_error_create(SVN_ERR_SVNDIFF_INVALID_COMPRESSED_DATA, NULL,
+                            _("Decompression of svndiff data failed: "
+                              "size too large"));
+
+  inLen -= (in - oldplace);
+  if (inLen == len)
+    {
+      /* Uncompressed data; see zlib_decode(). */
+      out->data = (char *)in;
+      out->len = len;
+      out->blocksize = len; /* sic! */
+
+      return SVN_NO_ERROR;
+    }
+
+  err = svn__lz4_decompress(out, (const char *)in, inLen, len);
+  if (err)
+    return svn_error_create(SVN_ERR_SVNDIFF_INVALID_COMPRESSED_DATA, err,
+                            _("Decompression of svndiff data failed"));
+
+  return SVN_NO_ERROR;
+}
+
 /* Decode an instruction into OP, returning a pointer to the text
    after the instruction.  Note that if the action code is
    svn_txdelta_new, the offset field of *OP will not be set.  */
@@ -616,16 +1132,43 @@ count_and_verify_instructions(int *ninst,
   return SVN_NO_ERROR;
 }
 
+/* Return an error if a window header with the given SVIEW_LEN,
+   TVIEW_LEN, INSLEN and NEWLEN describes a window larger than
+   MAX_WINDOW_SIZE bytes.  MAX_WINDOW_SIZE must not exceed
+   SVN_DELTA_MAX_WINDOW_SIZE.
+
+   In theory, the instructions section of such a window could consist
+   of MAX_WINDOW_SIZE 1-byte copy-from-source instructions (though this
+   is very unlikely), each of them up to MAX_INSTRUCTION_LEN long. */
+static svn_error_t *
+check_window_size(apr_size_t sview_len,
+                  apr_size_t tview_len,
+                  apr_size_t inslen,
+                  apr_size_t newlen,
+                  apr_size_t max_window_size)
+{
+  if (tview_len > max_window_size ||
+      sview_len > max_window_size ||
+      /* for svndiff1/2, newlen includes the original length */
+      newlen > max_window_size + MAX_ENCODED_INT_LEN ||
+      inslen > max_window_size * MAX_INSTRUCTION_LEN)
+    return svn_error_create(SVN_ERR_SVNDIFF_CORRUPT_WINDOW, NULL,
+                            _("Svndiff contains a too-large window"));
+
+  return SVN_NO_ERROR;
+}
+
 /* Given the five integer fields of a window header and a pointer to
    the remainder of the window contents, fill in a delta window
-   structure *WINDOW.  New allocations will be performed in POOL;
+   structure *WINDOW.  The window must not be larger than
+   MAX_WINDOW_SIZE bytes.  New allocations will be performed in POOL;
    the new_data field of *WINDOW will refer directly to memory pointed
    to by DATA. */
 static svn_error_t *
 decode_window(svn_txdelta_window_t *window, svn_filesize_t sview_offset,
               apr_size_t sview_len, apr_size_t tview_len, apr_size_t inslen,
               apr_size_t newlen, const unsigned char *data, apr_pool_t *pool,
-              unsigned int version)
+              unsigned int version, apr_size_t max_window_size)
 {
   const unsigned char *insend;
   int ninst;
@@ -639,17 +1182,25 @@ decode_window(svn_txdelta_window_t *window, svn_filesize_t sview_offset,
 
   insend = data + inslen;
 
-  if (version == 1)
+  if (version == 1 || version == 2)
     {
       svn_stringbuf_t *instout = svn_stringbuf_create_empty(pool);
       svn_stringbuf_t *ndout = svn_stringbuf_create_empty(pool);
 
       /* these may in fact simply return references to insend */
 
-      SVN_ERR(zlib_decode(insend, newlen, ndout,
-                          SVN_DELTA_WINDOW_SIZE));
-      SVN_ERR(zlib_decode(data, insend - data, instout,
-                          MAX_INSTRUCTION_SECTION_LEN));
+      if (version == 1)
+        {
+          SVN_ERR(zlib_decode(insend, newlen, ndout, max_window_size));
+          SVN_ERR(zlib_decode(data, insend - data, instout,
+                              max_window_size * MAX_INSTRUCTION_LEN));
+        }
+      else
+        {
+          SVN_ERR(lz4_decode(insend, newlen, ndout, max_window_size));
+          SVN_ERR(lz4_decode(data, insend - data, instout,
+                             max_window_size * MAX_INSTRUCTION_LEN));
+        }
 
       newlen = ndout->len;
       data = (unsigned char *)instout->data;
@@ -713,6 +1264,8 @@ write_handler(void *baton,
         db->version = 0;
       else if (memcmp(buffer, "SVN\1" + db->header_bytes, nheader) == 0)
         db->version = 1;
+      else if (memcmp(buffer, "SVN\2" + db->header_bytes, nheader) == 0)
+        db->version = 2;
       else
         return svn_error_create(SVN_ERR_SVNDIFF_INVALID_HEADER, NULL,
                                 _("Svndiff has invalid header"));
@@ -721,10 +1274,22 @@ write_handler(void *baton,
       db->header_bytes += nheader;
     }
 
-  /* Concatenate the old with the new.  */
-  svn_stringbuf_appendbytes(db->buffer, buffer, buflen);
+  /* Parse the new data in place, unless we have to complete a window
+     left over from a previous call.  This way, windows arriving in one
+     piece go straight to the consumer without being copied.  */
+  if (db->buffer->len == 0)
+    {
+      p = (const unsigned char *) buffer;
+      end = p + buflen;
+    }
+  else
+    {
+      svn_stringbuf_appendbytes(db->buffer, buffer, buflen);
+      p = (const unsigned char *) db->buffer->data;
+      end = p + db->buffer->len;
+    }
 
-  /* We have a buffer of svndiff data that might be good for:
+  /* We have a chunk of svndiff data that might be good for:
 
      a) an integral number of windows' worth of data - this is a
         trivial case.  Make windows from our data and ship them off.
@@ -732,46 +1297,35 @@ write_handler(void *baton,
      b) a non-integral number of windows' worth of data - we shall
         consume the integral portion of the window data, and then
         somewhere in the following loop the decoding of the svndiff
-        data will run out of stuff to decode, and will simply return
-        SVN_NO_ERROR, anxiously awaiting more data.
+        data will run out of stuff to decode.  We keep the remainder
+        and wait for more data.
   */
 
   while (1)
     {
-      apr_pool_t *newpool;
       svn_txdelta_window_t window;
+      const unsigned char *window_start = p;
 
       /* Read the header, if we have enough bytes for that.  */
-      p = (const unsigned char *) db->buffer->data;
-      end = (const unsigned char *) db->buffer->data + db->buffer->len;
-
       p = decode_file_offset(&sview_offset, p, end);
+      if (p != NULL)
+        p = decode_size(&sview_len, p, end);
+      if (p != NULL)
+        p = decode_size(&tview_len, p, end);
+      if (p != NULL)
+        p = decode_size(&inslen, p, end);
+      if (p != NULL)
+        p = decode_size(&newlen, p, end);
       if (p == NULL)
-        return SVN_NO_ERROR;
-
-      p = decode_size(&sview_len, p, end);
-      if (p == NULL)
-        return SVN_NO_ERROR;
-
-      p = decode_size(&tview_len, p, end);
-      if (p == NULL)
-        return SVN_NO_ERROR;
-
-      p = decode_size(&inslen, p, end);
-      if (p == NULL)
-        return SVN_NO_ERROR;
-
-      p = decode_size(&newlen, p, end);
-      if (p == NULL)
-        return SVN_NO_ERROR;
+        {
+          p = window_start;
+          break;
+        }
 
-      if (tview_len > SVN_DELTA_WINDOW_SIZE ||
-          sview_len > SVN_DELTA_WINDOW_SIZE ||
-          /* for svndiff1, newlen includes the original length */
-          newlen > SVN_DELTA_WINDOW_SIZE + MAX_ENCODED_INT_LEN ||
-          inslen > MAX_INSTRUCTION_SECTION_LEN)
-        return svn_error_create(SVN_ERR_SVNDIFF_CORRUPT_WINDOW, NULL,
-                                _("Svndiff contains a too-large window"));
+      /* This parser is used for data received from the network.  Don't
+         let anybody make us allocate more than default windows need. */
+      SVN_ERR(check_window_size(sview_len, tview_len, inslen, newlen,
+                                SVN_DELTA_WINDOW_SIZE));
 
       /* Check for integer overflow.  */
       if (sview_offset < 0 || inslen + newlen < inslen
@@ -792,36 +1346,38 @@ write_handler(void *baton,
       /* Wait for more data if we don't have enough bytes for the
          whole window.  */
       if ((apr_size_t) (end - p) < inslen + newlen)
-        return SVN_NO_ERROR;
+        {
+          p = window_start;
+          break;
+        }
 
       /* Decode the window and send it off. */
       SVN_ERR(decode_window(&window, sview_offset, sview_len, tview_len,
                             inslen, newlen, p, db->subpool,
-                            db->version));
+                            db->version, SVN_DELTA_WINDOW_SIZE));
       SVN_ERR(db->consumer_func(&window, db->consumer_baton));
 
-      /* Make a new subpool and buffer, saving aside the remaining
-         data in the old buffer.  */
-      newpool = svn_pool_create(db->pool);
       p += inslen + newlen;
-      remaining = db->buffer->data + db->buffer->len - (const char *) p;
-      db->buffer =
-        svn_stringbuf_ncreate((const char *) p, remaining, newpool);
 
       /* Remember the offset and length of the source view for next time.  */
       db->last_sview_offset = sview_offset;
       db->last_sview_len = sview_len;
 
-      /* We've copied stuff out of the old pool. Toss that pool and use
-         our new pool.
-         ### might be nice to avoid the copy and just use svn_pool_clear
-         ### to get rid of whatever the "other stuff" is. future project...
-      */
-      svn_pool_destroy(db->subpool);
-      db->subpool = newpool;
+      svn_pool_clear(db->subpool);
+    }
+
+  /* Keep the incomplete window for the next call.  */
+  remaining = end - p;
+  if (db->buffer->len == 0)
+    svn_stringbuf_appendbytes(db->buffer, (const char *) p, remaining);
+  else if (remaining < db->buffer->len)
+    {
+      memmove(db->buffer->data, p, remaining);
+      db->buffer->len = remaining;
+      db->buffer->data[remaining] = '\0';
     }
 
-  /* NOTREACHED */
+  return SVN_NO_ERROR;
 }
 
 
@@ -859,7 +1415,7 @@ svn_txdelta_parse_svndiff(svn_txdelta_window_handler_t handler,
   db->consumer_baton = handler_baton;
   db->pool = subpool;
   db->subpool = svn_pool_create(subpool);
-  db->buffer = svn_stringbuf_create_empty(db->subpool);
+  db->buffer = svn_stringbuf_create_empty(subpool);
   db->last_sview_offset = 0;
   db->last_sview_len = 0;
   db->header_bytes = 0;
@@ -905,11 +1461,13 @@ read_one_size(apr_size_t *size, svn_stream_t *stream)
   return SVN_NO_ERROR;
 }
 
-/* Read a window header from STREAM and check it for integer overflow. */
+/* Read a window header from STREAM and check it for integer overflow
+   and windows larger than MAX_WINDOW_SIZE. */
 static svn_error_t *
 read_window_header(svn_stream_t *stream, svn_filesize_t *sview_offset,
                    apr_size_t *sview_len, apr_size_t *tview_len,
-                   apr_size_t *inslen, apr_size_t *newlen)
+                   apr_size_t *inslen, apr_size_t *newlen,
+                   apr_size_t max_window_size)
 {
   unsigned char c;
 
@@ -929,13 +1487,8 @@ read_window_header(svn_stream_t *stream, svn_filesize_t *sview_offset,
   SVN_ERR(read_one_size(inslen, stream));
   SVN_ERR(read_one_size(newlen, stream));
 
-  if (*tview_len > SVN_DELTA_WINDOW_SIZE ||
-      *sview_len > SVN_DELTA_WINDOW_SIZE ||
-      /* for svndiff1, newlen includes the original length */
-      *newlen > SVN_DELTA_WINDOW_SIZE + MAX_ENCODED_INT_LEN ||
-      *inslen > MAX_INSTRUCTION_SECTION_LEN)
-    return svn_error_create(SVN_ERR_SVNDIFF_CORRUPT_WINDOW, NULL,
-                            _("Svndiff contains a too-large window"));
+  SVN_ERR(check_window_size(*sview_len, *tview_len, *inslen, *newlen,
+                            max_window_size));
 
   /* Check for integer overflow.  */
   if (*sview_offset < 0 || *inslen + *newlen < *inslen
@@ -947,18 +1500,31 @@ read_window_header(svn_stream_t *stream, svn_filesize_t *sview_offset,
   return SVN_NO_ERROR;
 }
 
+/* Return MAX_WINDOW_SIZE as passed to our API functions, with 0 mapped
+   to the default and oversized values clipped. */
+static apr_size_t
+effective_max_window_size(apr_size_t max_window_size)
+{
+  if (max_window_size == 0)
+    return SVN_DELTA_WINDOW_SIZE;
+
+  return MIN(max_window_size, SVN_DELTA_MAX_WINDOW_SIZE);
+}
+
 svn_error_t *
-svn_txdelta_read_svndiff_window(svn_txdelta_window_t **window,
-                                svn_stream_t *stream,
-                                int svndiff_version,
-                                apr_pool_t *pool)
+svn_txdelta_read_svndiff_window2(svn_txdelta_window_t **window,
+                                 svn_stream_t *stream,
+                                 int svndiff_version,
+                                 apr_size_t max_window_size,
+                                 apr_pool_t *pool)
 {
   svn_filesize_t sview_offset;
   apr_size_t sview_len, tview_len, inslen, newlen, len;
   unsigned char *buf;
 
+  max_window_size = effective_max_window_size(max_window_size);
   SVN_ERR(read_window_header(stream, &sview_offset, &sview_len, &tview_len,
-                             &inslen, &newlen));
+                             &inslen, &newlen, max_window_size));
   len = inslen + newlen;
   buf = apr_palloc(pool, len);
   SVN_ERR(svn_stream_read(stream, (char*)buf, &len));
@@ -967,14 +1533,26 @@ svn_txdelta_read_svndiff_window(svn_txdelta_window_t **window,
                             _("Unexpected end of svndiff input"));
   *window = apr_palloc(pool, sizeof(**window));
   return decode_window(*window, sview_offset, sview_len, tview_len, inslen,
-                       newlen, buf, pool, svndiff_version);
+                       newlen, buf, pool, svndiff_version, max_window_size);
 }
 
-
 svn_error_t *
-svn_txdelta_skip_svndiff_window(apr_file_t *file,
+svn_txdelta_read_svndiff_window(svn_txdelta_window_t **window,
+                                svn_stream_t *stream,
                                 int svndiff_version,
                                 apr_pool_t *pool)
+{
+  return svn_error_trace(svn_txdelta_read_svndiff_window2(window, stream,
+                                                          svndiff_version,
+                                                          0, pool));
+}
+
+
+svn_error_t *
+svn_txdelta_skip_svndiff_window2(apr_file_t *file,
+                                 int svndiff_version,
+                                 apr_size_t max_window_size,
+                                 apr_pool_t *pool)
 {
   svn_stream_t *stream = svn_stream_from_aprfile2(file, TRUE, pool);
   svn_filesize_t sview_offset;
@@ -982,8 +1560,19 @@ svn_txdelta_skip_svndiff_window(apr_file_t *file,
   apr_off_t offset;
 
   SVN_ERR(read_window_header(stream, &sview_offset, &sview_len, &tview_len,
-                             &inslen, &newlen));
+                             &inslen, &newlen,
+                             effective_max_window_size(max_window_size)));
 
   offset = inslen + newlen;
   return svn_io_file_seek(file, APR_CUR, &offset, pool);
 }
+
+svn_error_t *
+svn_txdelta_skip_svndiff_window(apr_file_t *file,
+                                int svndiff_version,
+                                apr_pool_t *pool)
+{
+  return svn_error_trace(svn_txdelta_skip_svndiff_window2(file,
+                                                          svndiff_version,
+                                                          0, pool));
+}
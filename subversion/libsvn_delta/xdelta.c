@@ -31,6 +31,36 @@
 #include "delta.h"
 
 #include "private/svn_adler32.h"
+
+/* SSE2 is part of every x64 CPU and commonly enabled for x86 builds.
+ * Its kernels below are therefore selected at compile time.
+ */
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define SVN_XDELTA_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define SVN_XDELTA_SSE2 0
+#endif
+
+/* AVX2 is not.  With GCC and Clang, we can compile AVX2 kernels into
+ * this file regardless of the target architecture options and select
+ * them at runtime if the CPU supports them.
+ */
+#if SVN_XDELTA_SSE2 && (defined(__x86_64__) || defined(__i386__)) \
+    && ((defined(__clang__) && __clang_major__ >= 4) \
+        || (!defined(__clang__) && defined(__GNUC__) \
+            && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#  define SVN_XDELTA_AVX2 1
+#  include <immintrin.h>
+#  define SVN_XDELTA_AVX2_FUNC __attribute__((target("avx2")))
+#else
+#  define SVN_XDELTA_AVX2 0
+#endif
+
+#if SVN_XDELTA_SSE2 && defined(_MSC_VER)
+#  include <intrin.h>
+#endif
 
 /* This is pseudo-adler32. It is adler32 without the prime modulus.
    The idea is borrowed from monotone, and is a translation of the C++
@@ -94,6 +124,17 @@ init_adler32(const char *data)
   return s2 * 0x10000 + s1;
 }
 
+/* The set of functions that compute_delta() spends most of its time in.
+ */
+typedef struct xdelta_kernels_t
+{
+  apr_size_t (*match_length)(const char *a, const char *b,
+                             apr_size_t max_len);
+  apr_size_t (*reverse_match_length)(const char *a, const char *b,
+                                     apr_size_t max_len);
+  apr_uint32_t (*init_adler32)(const char *data);
+} xdelta_kernels_t;
+
 /* Information for a block of the delta source.  The length of the
    block is the smaller of MATCH_BLOCKSIZE and the difference between
    the size of the source data and the position of this block. */
@@ -171,9 +212,11 @@ find_block(const struct blocks *blocks,
 
 /* Initialize the matches table from DATA of size DATALEN.  This goes
    through every block of MATCH_BLOCKSIZE bytes in the source and
-   checksums it, inserting the result into the BLOCKS table.  */
+   checksums it using KERNELS, inserting the result into the BLOCKS
+   table.  */
 static void
-init_blocks_table(const char *data,
+init_blocks_table(const xdelta_kernels_t *kernels,
+                  const char *data,
                   apr_size_t datalen,
                   struct blocks *blocks,
                   apr_pool_t *pool)
@@ -203,7 +246,7 @@ init_blocks_table(const char *data,
      not use that shorter block for deltification (only indirectly
      as an extension of some previous block). */
   for (i = 0; i + MATCH_BLOCKSIZE <= datalen; i += MATCH_BLOCKSIZE)
-    add_block(blocks, init_adler32(data + i), i);
+    add_block(blocks, kernels->init_adler32(data + i), i);
 }
 
 /* Return the lowest position at which A and B differ. If no difference
@@ -271,18 +314,280 @@ reverse_match_length(const char *a, const char *b, apr_size_t max_len)
   return max_len;
 }
 
+#if SVN_XDELTA_SSE2
+
+/* Return the index of the lowest set bit in the non-zero MASK. */
+static APR_INLINE unsigned
+lowest_bit(apr_uint32_t mask)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctz(mask);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (unsigned)index;
+#else
+  unsigned index = 0;
+  for (; (mask & 1) == 0; mask >>= 1)
+    ++index;
+  return index;
+#endif
+}
+
+/* Return the index of the highest set bit in the non-zero MASK. */
+static APR_INLINE unsigned
+highest_bit(apr_uint32_t mask)
+{
+#if defined(__GNUC__)
+  return 31 - (unsigned)__builtin_clz(mask);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse(&index, mask);
+  return (unsigned)index;
+#else
+  unsigned index = 0;
+  for (; mask > 1; mask >>= 1)
+    ++index;
+  return index;
+#endif
+}
+
+/* Like match_length() but compare 16 bytes at a time. */
+static apr_size_t
+match_length_sse2(const char *a, const char *b, apr_size_t max_len)
+{
+  apr_size_t pos = 0;
+
+  for (; pos + sizeof(__m128i) <= max_len; pos += sizeof(__m128i))
+    {
+      __m128i lhs = _mm_loadu_si128((const __m128i *)(a + pos));
+      __m128i rhs = _mm_loadu_si128((const __m128i *)(b + pos));
+      apr_uint32_t mismatch
+        = (apr_uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lhs, rhs)) ^ 0xffff;
+
+      if (mismatch)
+        return pos + lowest_bit(mismatch);
+    }
+
+  return pos + match_length(a + pos, b + pos, max_len - pos);
+}
+
+/* Like reverse_match_length() but compare 16 bytes at a time. */
+static apr_size_t
+reverse_match_length_sse2(const char *a, const char *b, apr_size_t max_len)
+{
+  apr_size_t pos = 0;
+
+  for (; pos + sizeof(__m128i) <= max_len; pos += sizeof(__m128i))
+    {
+      __m128i lhs = _mm_loadu_si128((const __m128i *)(a - pos) - 1);
+      __m128i rhs = _mm_loadu_si128((const __m128i *)(b - pos) - 1);
+      apr_uint32_t mismatch
+        = (apr_uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(lhs, rhs)) ^ 0xffff;
+
+      /* The last byte of the chunk is the one closest to A and B. */
+      if (mismatch)
+        return pos + 15 - highest_bit(mismatch);
+    }
+
+  return pos + reverse_match_length(a - pos, b - pos, max_len - pos);
+}
+
+/* Like init_adler32() but process 16 bytes at a time.  S1 is simply the
+ * sum of all bytes and S2 the sum of every byte weighted by its distance
+ * from the end of the block.
+ */
+static apr_uint32_t
+init_adler32_sse2(const char *data)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i step = _mm_set1_epi16(16);
+  __m128i weights_lo = _mm_set_epi16(MATCH_BLOCKSIZE - 7, MATCH_BLOCKSIZE - 6,
+                                     MATCH_BLOCKSIZE - 5, MATCH_BLOCKSIZE - 4,
+                                     MATCH_BLOCKSIZE - 3, MATCH_BLOCKSIZE - 2,
+                                     MATCH_BLOCKSIZE - 1, MATCH_BLOCKSIZE);
+  __m128i weights_hi = _mm_sub_epi16(weights_lo, _mm_set1_epi16(8));
+  __m128i s1 = zero;
+  __m128i s2 = zero;
+  int i;
+
+  for (i = 0; i < MATCH_BLOCKSIZE; i += sizeof(__m128i))
+    {
+      __m128i input = _mm_loadu_si128((const __m128i *)(data + i));
+
+      s1 = _mm_add_epi64(s1, _mm_sad_epu8(input, zero));
+      s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpacklo_epi8(input, zero),
+                                            weights_lo));
+      s2 = _mm_add_epi32(s2, _mm_madd_epi16(_mm_unpackhi_epi8(input, zero),
+                                            weights_hi));
+
+      weights_lo = _mm_sub_epi16(weights_lo, step);
+      weights_hi = _mm_sub_epi16(weights_hi, step);
+    }
+
+  s1 = _mm_add_epi32(s1, _mm_srli_si128(s1, 8));
+  s2 = _mm_add_epi32(s2, _mm_srli_si128(s2, 8));
+  s2 = _mm_add_epi32(s2, _mm_srli_si128(s2, 4));
+
+  return (apr_uint32_t)_mm_cvtsi128_si32(s2) * 0x10000
+       + (apr_uint32_t)_mm_cvtsi128_si32(s1);
+}
+
+#endif /* SVN_XDELTA_SSE2 */
+
+#if SVN_XDELTA_AVX2
+
+/* Like match_length() but compare 32 bytes at a time. */
+static SVN_XDELTA_AVX2_FUNC apr_size_t
+match_length_avx2(const char *a, const char *b, apr_size_t max_len)
+{
+  apr_size_t pos = 0;
+
+  for (; pos + sizeof(__m256i) <= max_len; pos += sizeof(__m256i))
+    {
+      __m256i lhs = _mm256_loadu_si256((const __m256i *)(a + pos));
+      __m256i rhs = _mm256_loadu_si256((const __m256i *)(b + pos));
+      apr_uint32_t mismatch
+        = ~(apr_uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lhs, rhs));
+
+      if (mismatch)
+        return pos + lowest_bit(mismatch);
+    }
+
+  return pos + match_length_sse2(a + pos, b + pos, max_len - pos);
+}
+
+/* Like reverse_match_length() but compare 32 bytes at a time. */
+static SVN_XDELTA_AVX2_FUNC apr_size_t
+reverse_match_length_avx2(const char *a, const char *b, apr_size_t max_len)
+{
+  apr_size_t pos = 0;
+
+  for (; pos + sizeof(__m256i) <= max_len; pos += sizeof(__m256i))
+    {
+      __m256i lhs = _mm256_loadu_si256((const __m256i *)(a - pos) - 1);
+      __m256i rhs = _mm256_loadu_si256((const __m256i *)(b - pos) - 1);
+      apr_uint32_t mismatch
+        = ~(apr_uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(lhs, rhs));
+
+      if (mismatch)
+        return pos + 31 - highest_bit(mismatch);
+    }
+
+  return pos + reverse_match_length_sse2(a - pos, b - pos, max_len - pos);
+}
+
+/* Return TRUE if the CPU we are running on supports AVX2. */
+static svn_boolean_t
+cpu_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+}
+
+#endif /* SVN_XDELTA_AVX2 */
+
+static const xdelta_kernels_t scalar_kernels =
+  {
+    match_length,
+    reverse_match_length,
+    init_adler32
+  };
+
+#if SVN_XDELTA_SSE2
+static const xdelta_kernels_t sse2_kernels =
+  {
+    match_length_sse2,
+    reverse_match_length_sse2,
+    init_adler32_sse2
+  };
+#endif
+
+#if SVN_XDELTA_AVX2
+static const xdelta_kernels_t avx2_kernels =
+  {
+    match_length_avx2,
+    reverse_match_length_avx2,
+    init_adler32_sse2
+  };
+#endif
+
+/* The kernels to use.  NULL until the first delta gets computed.
+ * Should multiple threads initialize it at the same time, they will
+ * simply all store the same value.
+ */
+static const xdelta_kernels_t *selected_kernels = NULL;
+
+/* Return the kernels for KERNEL or NULL, if those are not available. */
+static const xdelta_kernels_t *
+find_kernels(svn_txdelta__xdelta_kernel_t kernel)
+{
+  switch (kernel)
+    {
+      case svn_txdelta__xdelta_kernel_auto:
+#if SVN_XDELTA_AVX2
+        if (cpu_has_avx2())
+          return &avx2_kernels;
+#endif
+#if SVN_XDELTA_SSE2
+        return &sse2_kernels;
+#else
+        return &scalar_kernels;
+#endif
+
+      case svn_txdelta__xdelta_kernel_scalar:
+        return &scalar_kernels;
+
+#if SVN_XDELTA_SSE2
+      case svn_txdelta__xdelta_kernel_sse2:
+        return &sse2_kernels;
+#endif
+
+#if SVN_XDELTA_AVX2
+      case svn_txdelta__xdelta_kernel_avx2:
+        return cpu_has_avx2() ? &avx2_kernels : NULL;
+#endif
+
+      default:
+        return NULL;
+    }
+}
+
+/* Return the kernels to use for computing deltas. */
+static APR_INLINE const xdelta_kernels_t *
+get_kernels(void)
+{
+  if (selected_kernels == NULL)
+    selected_kernels = find_kernels(svn_txdelta__xdelta_kernel_auto);
+
+  return selected_kernels;
+}
+
+svn_boolean_t
+svn_txdelta__xdelta_use_kernel(svn_txdelta__xdelta_kernel_t kernel)
+{
+  const xdelta_kernels_t *kernels = find_kernels(kernel);
+
+  if (kernels == NULL)
+    return FALSE;
+
+  selected_kernels = kernels;
+  return TRUE;
+}
+
 
 /* Try to find a match for the target data B in BLOCKS, and then
    extend the match as long as data in A and B at the match position
    continues to match.  We set the position in A we ended up in (in
    case we extended it backwards) in APOSP and update the correspnding
    position within B given in BPOSP. PENDING_INSERT_START sets the
-   lower limit to BPOSP.
+   lower limit to BPOSP.  KERNELS do the byte comparisons.
    Return number of matching bytes starting at ASOP.  Return 0 if
    no match has been found.
  */
 static apr_size_t
-find_match(const struct blocks *blocks,
+find_match(const xdelta_kernels_t *kernels,
+           const struct blocks *blocks,
            const apr_uint32_t rolling,
            const char *a,
            apr_size_t asize,
@@ -293,7 +598,7 @@ find_match(const struct blocks *blocks,
            apr_size_t pending_insert_start)
 {
   apr_size_t apos, bpos = *bposp;
-  apr_size_t delta, max_delta;
+  apr_size_t delta, max_delta, back;
 
   apos = find_block(blocks, rolling, b + bpos);
 
@@ -305,18 +610,19 @@ find_match(const struct blocks *blocks,
   max_delta = asize - apos - MATCH_BLOCKSIZE < bsize - bpos - MATCH_BLOCKSIZE
             ? asize - apos - MATCH_BLOCKSIZE
             : bsize - bpos - MATCH_BLOCKSIZE;
-  delta = match_length(a + apos + MATCH_BLOCKSIZE,
-                       b + bpos + MATCH_BLOCKSIZE,
-                       max_delta);
+  delta = kernels->match_length(a + apos + MATCH_BLOCKSIZE,
+                                b + bpos + MATCH_BLOCKSIZE,
+                                max_delta);
 
   /* See if we can extend backwards (max MATCH_BLOCKSIZE-1 steps because A's
      content has been sampled only every MATCH_BLOCKSIZE positions).  */
-  while (apos > 0 && bpos > pending_insert_start && a[apos-1] == b[bpos-1])
-    {
-      --apos;
-      --bpos;
-      ++delta;
-    }
+  back = kernels->reverse_match_length(a + apos, b + bpos,
+                                       apos < bpos - pending_insert_start
+                                         ? apos
+                                         : bpos - pending_insert_start);
+  apos -= back;
+  bpos -= back;
+  delta += back;
 
   *aposp = apos;
   *bposp = bpos;
@@ -328,10 +634,12 @@ find_match(const struct blocks *blocks,
  * the range of similar size before A[ASIZE]. Create corresponding copy and
  * insert operations.
  *
- * BUILD_BATON and POOL will be passed through from compute_delta().
+ * KERNELS, BUILD_BATON and POOL will be passed through from
+ * compute_delta().
  */
 static void
-store_delta_trailer(svn_txdelta__ops_baton_t *build_baton,
+store_delta_trailer(const xdelta_kernels_t *kernels,
+                    svn_txdelta__ops_baton_t *build_baton,
                     const char *a,
                     apr_size_t asize,
                     const char *b,
@@ -344,7 +652,7 @@ store_delta_trailer(svn_txdelta__ops_baton_t *build_baton,
   if (max_len == 0)
     return;
 
-  end_match = reverse_match_length(a + asize, b + bsize, max_len);
+  end_match = kernels->reverse_match_length(a + asize, b + bsize, max_len);
   if (end_match <= 4)
     end_match = 0;
 
@@ -389,6 +697,7 @@ compute_delta(svn_txdelta__ops_baton_t *build_baton,
               apr_size_t bsize,
               apr_pool_t *pool)
 {
+  const xdelta_kernels_t *kernels = get_kernels();
   struct blocks blocks;
   apr_uint32_t rolling;
   apr_size_t lo = 0, pending_insert_start = 0;
@@ -396,7 +705,7 @@ compute_delta(svn_txdelta__ops_baton_t *build_baton,
   /* Optimization: directly compare window starts. If more than 4
    * bytes match, we can immediately create a matching windows.
    * Shorter sequences result in a net data increase. */
-  lo = match_length(a, b, asize > bsize ? bsize : asize);
+  lo = kernels->match_length(a, b, asize > bsize ? bsize : asize);
   if ((lo > 4) || (lo == bsize))
     {
       svn_txdelta__insert_op(build_baton, svn_txdelta_source,
@@ -410,22 +719,22 @@ compute_delta(svn_txdelta__ops_baton_t *build_baton,
      insert the entire target.  */
   if ((bsize - lo < MATCH_BLOCKSIZE) || (asize < MATCH_BLOCKSIZE))
     {
-      store_delta_trailer(build_baton, a, asize, b, bsize, lo, pool);
+      store_delta_trailer(kernels, build_baton, a, asize, b, bsize, lo, pool);
       return;
     }
 
   /* Initialize the matches table.  */
-  init_blocks_table(a, asize, &blocks, pool);
+  init_blocks_table(kernels, a, asize, &blocks, pool);
 
   /* Initialize our rolling checksum.  */
-  rolling = init_adler32(b + lo);
+  rolling = kernels->init_adler32(b + lo);
   while (lo < bsize)
     {
       apr_size_t matchlen = 0;
       apr_size_t apos;
 
       if (lo + MATCH_BLOCKSIZE <= bsize)
-        matchlen = find_match(&blocks, rolling, a, asize, b, bsize,
+        matchlen = find_match(kernels, &blocks, rolling, a, asize, b, bsize,
                               &lo, &apos, pending_insert_start);
 
       /* If we didn't find a real match, insert the byte at the target
@@ -450,7 +759,10 @@ compute_delta(svn_txdelta__ops_baton_t *build_baton,
             {
               /* the match borders on the previous op. Maybe, we found a
                * match that is better than / overlapping the previous one. */
-              apr_size_t len = reverse_match_length(a + apos, b + lo, apos < lo ? apos : lo);
+              apr_size_t len = kernels->reverse_match_length(a + apos, b + lo,
+                                                             apos < lo
+                                                               ? apos
+                                                               : lo);
               if (len > 0)
                 {
                   len = svn_txdelta__remove_copy(build_baton, len);
@@ -471,12 +783,13 @@ compute_delta(svn_txdelta__ops_baton_t *build_baton,
            * Ignore short buffers at the end of B.
            */
           if (lo + MATCH_BLOCKSIZE <= bsize)
-            rolling = init_adler32(b + lo);
+            rolling = kernels->init_adler32(b + lo);
         }
     }
 
   /* If we still have an insert pending at the end, throw it in.  */
-  store_delta_trailer(build_baton, a, asize, b, bsize, pending_insert_start, pool);
+  store_delta_trailer(kernels, build_baton, a, asize, b, bsize,
+                      pending_insert_start, pool);
 }
 
 void
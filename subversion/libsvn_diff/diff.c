@@ -22,6 +22,8 @@
  */
 
 
+#include <string.h>
+
 #include <apr.h>
 #include <apr_pools.h>
 #include <apr_general.h>
@@ -126,10 +128,11 @@ svn_diff__diff(svn_diff__lcs_t *lcs,
 
 
 svn_error_t *
-svn_diff_diff_2(svn_diff_t **diff,
-                void *diff_baton,
-                const svn_diff_fns2_t *vtable,
-                apr_pool_t *pool)
+svn_diff__diff_2(svn_diff_t **diff,
+                 void *diff_baton,
+                 const svn_diff_fns2_t *vtable,
+                 svn_diff_algorithm_t algorithm,
+                 apr_pool_t *pool)
 {
   svn_diff__tree_t *tree;
   svn_diff__position_t *position_list[2];
@@ -187,7 +190,7 @@ svn_diff_diff_2(svn_diff_t **diff,
   /* Get the lcs */
   lcs = svn_diff__lcs(position_list[0], position_list[1], token_counts[0],
                       token_counts[1], num_tokens, prefix_lines,
-                      suffix_lines, subpool);
+                      suffix_lines, algorithm, subpool);
 
   /* Produce the diff */
   *diff = svn_diff__diff(lcs, 1, 1, TRUE, pool);
@@ -197,3 +200,316 @@ svn_diff_diff_2(svn_diff_t **diff,
 
   return SVN_NO_ERROR;
 }
+
+svn_error_t *
+svn_diff_diff_2(svn_diff_t **diff,
+                void *diff_baton,
+                const svn_diff_fns2_t *vtable,
+                apr_pool_t *pool)
+{
+  return svn_diff__diff_2(diff, diff_baton, vtable, svn_diff_algorithm_myers,
+                          pool);
+}
+
+
+/* Rough number of bytes needed per line in a diff window, besides the
+ * datasource's own token: the read-ahead buffer, the position, up to
+ * four slots of the token table and the working memory of the LCS.
+ */
+#define SVN_DIFF__WINDOW_LINE_OVERHEAD 192
+
+/* Windows never hold fewer lines than this, whatever the memory limit. */
+#define SVN_DIFF__WINDOW_MIN_LINES 1024
+
+/* The lines of one datasource that svn_diff__diff_2_windowed() currently
+ * looks at.
+ */
+typedef struct diff_window_t
+{
+  svn_diff_datasource_e datasource;
+
+  /* The tokens of the lines in the window and their hashes. */
+  void **tokens;
+  apr_uint32_t *hashes;
+
+  /* The number of lines in the window, and the most it may hold. */
+  apr_off_t count;
+  apr_off_t max_count;
+
+  /* The number of lines of the datasource before the window. */
+  apr_off_t start;
+
+  /* Whether all lines of the datasource have been read. */
+  svn_boolean_t eof;
+} diff_window_t;
+
+/* Read lines from WINDOW's datasource until WINDOW is full or the
+ * datasource is exhausted.
+ */
+static svn_error_t *
+fill_window(diff_window_t *window,
+            void *diff_baton,
+            const svn_diff_fns2_t *vtable)
+{
+  while (!window->eof && window->count < window->max_count)
+    {
+      void *token;
+      apr_uint32_t hash = 0;
+
+      SVN_ERR(vtable->datasource_get_next_token(&hash, &token, diff_baton,
+                                                window->datasource));
+      if (token == NULL)
+        {
+          window->eof = TRUE;
+          SVN_ERR(vtable->datasource_close(diff_baton, window->datasource));
+        }
+      else
+        {
+          window->tokens[window->count] = token;
+          window->hashes[window->count] = hash;
+          window->count++;
+        }
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Slide WINDOW past its first COUNT lines, discarding their tokens. */
+static void
+advance_window(diff_window_t *window,
+               apr_off_t count,
+               void *diff_baton,
+               const svn_diff_fns2_t *vtable)
+{
+  apr_off_t i;
+
+  if (vtable->token_discard != NULL)
+    for (i = 0; i < count; i++)
+      vtable->token_discard(diff_baton, window->tokens[i]);
+
+  window->count -= count;
+  window->start += count;
+  memmove(window->tokens, window->tokens + count,
+          (apr_size_t)window->count * sizeof(*window->tokens));
+  memmove(window->hashes, window->hashes + count,
+          (apr_size_t)window->count * sizeof(*window->hashes));
+}
+
+/* Append the list of HUNKS, which continues where the hunk *LAST ends, to
+ * the diff *DIFF.  Merge hunks of the same type, so that window boundaries
+ * don't show in the result.  Update *LAST to the new last hunk.
+ */
+static void
+append_hunks(svn_diff_t **diff,
+             svn_diff_t **last,
+             svn_diff_t *hunks)
+{
+  while (hunks)
+    {
+      svn_diff_t *next = hunks->next;
+
+      if (*last && (*last)->type == hunks->type)
+        {
+          (*last)->original_length += hunks->original_length;
+          (*last)->modified_length += hunks->modified_length;
+        }
+      else
+        {
+          hunks->next = NULL;
+          if (*last)
+            (*last)->next = hunks;
+          else
+            *diff = hunks;
+          *last = hunks;
+        }
+
+      hunks = next;
+    }
+}
+
+/* Return a new common hunk of LENGTH lines, following ORIGINAL_START and
+ * MODIFIED_START lines of the respective datasources.  Allocate it in
+ * POOL.
+ */
+static svn_diff_t *
+common_hunk(apr_off_t original_start,
+            apr_off_t modified_start,
+            apr_off_t length,
+            apr_pool_t *pool)
+{
+  svn_diff_t *hunk = apr_palloc(pool, sizeof(*hunk));
+
+  hunk->type = svn_diff__type_common;
+  hunk->original_start = original_start;
+  hunk->original_length = length;
+  hunk->modified_start = modified_start;
+  hunk->modified_length = length;
+  hunk->latest_start = 0;
+  hunk->latest_length = 0;
+  hunk->resolved_diff = NULL;
+  hunk->next = NULL;
+
+  return hunk;
+}
+
+svn_error_t *
+svn_diff__diff_2_windowed(svn_diff_t **diff,
+                          void *diff_baton,
+                          const svn_diff_fns2_t *vtable,
+                          svn_diff_algorithm_t algorithm,
+                          apr_size_t memory_limit,
+                          apr_size_t token_size,
+                          apr_pool_t *pool)
+{
+  diff_window_t window[2];
+  svn_diff_datasource_e datasource[] = {svn_diff_datasource_original,
+                                        svn_diff_datasource_modified};
+  svn_diff_t *last = NULL;
+  apr_pool_t *subpool;
+  apr_pool_t *windowpool;
+  apr_off_t prefix_lines = 0;
+  apr_off_t suffix_lines = 0;
+  apr_off_t max_count;
+  int i;
+
+  *diff = NULL;
+
+  max_count = memory_limit / (2 * (SVN_DIFF__WINDOW_LINE_OVERHEAD
+                                   + token_size));
+  if (max_count < SVN_DIFF__WINDOW_MIN_LINES)
+    max_count = SVN_DIFF__WINDOW_MIN_LINES;
+
+  subpool = svn_pool_create(pool);
+  windowpool = svn_pool_create(subpool);
+
+  SVN_ERR(vtable->datasources_open(diff_baton, &prefix_lines, &suffix_lines,
+                                   datasource, 2));
+
+  for (i = 0; i < 2; i++)
+    {
+      window[i].datasource = datasource[i];
+      window[i].tokens = apr_palloc(subpool, (apr_size_t)max_count
+                                             * sizeof(*window[i].tokens));
+      window[i].hashes = apr_palloc(subpool, (apr_size_t)max_count
+                                             * sizeof(*window[i].hashes));
+      window[i].count = 0;
+      window[i].max_count = max_count;
+      window[i].start = prefix_lines;
+      window[i].eof = FALSE;
+    }
+
+  if (prefix_lines)
+    append_hunks(diff, &last, common_hunk(0, 0, prefix_lines, pool));
+
+  while (1)
+    {
+      svn_diff__tree_t *tree;
+      svn_diff__position_t *position_list[2];
+      svn_diff__token_index_t num_tokens;
+      svn_diff__token_index_t *token_counts[2];
+      svn_diff__lcs_t *lcs;
+      svn_diff__lcs_t *chunk;
+      svn_diff__lcs_t *sync = NULL;
+      svn_diff__lcs_t *eof_lcs;
+      apr_off_t end[2];
+      svn_boolean_t final;
+
+      svn_pool_clear(windowpool);
+
+      SVN_ERR(fill_window(&window[0], diff_baton, vtable));
+      SVN_ERR(fill_window(&window[1], diff_baton, vtable));
+      final = window[0].eof && window[1].eof;
+
+      /* Diff the lines in the window, interning their tokens afresh so
+         the token table stays small. */
+      svn_diff__tree_create(&tree, windowpool);
+      for (i = 0; i < 2; i++)
+        SVN_ERR(svn_diff__insert_tokens(&position_list[i], tree,
+                                        diff_baton, vtable,
+                                        window[i].tokens, window[i].hashes,
+                                        window[i].count, window[i].start,
+                                        windowpool));
+
+      num_tokens = svn_diff__get_node_count(tree);
+      for (i = 0; i < 2; i++)
+        token_counts[i] = svn_diff__get_token_counts(position_list[i],
+                                                     num_tokens, windowpool);
+
+      lcs = svn_diff__lcs(position_list[0], position_list[1],
+                          token_counts[0], token_counts[1], num_tokens,
+                          0, 0, algorithm, windowpool);
+
+      /* Unless this is the last window, lines near its end may match up
+         differently once we see what follows, so only commit up to the
+         last run of common lines within the first half of the window.
+         If there is no such run, commit up to the first one; if there
+         are no common lines at all, commit the first half as changed. */
+      for (chunk = lcs; chunk->length > 0; chunk = chunk->next)
+        {
+          svn_boolean_t in_first_half = TRUE;
+
+          for (i = 0; i < 2; i++)
+            if (!window[i].eof
+                && (chunk->position[i]->offset + chunk->length - 1
+                    > window[i].start + window[i].count / 2))
+              in_first_half = FALSE;
+
+          if (final || in_first_half || sync == NULL)
+            sync = chunk;
+          if (!final && !in_first_half)
+            break;
+        }
+
+      for (i = 0; i < 2; i++)
+        {
+          if (final)
+            end[i] = window[i].start + window[i].count;
+          else if (sync)
+            end[i] = sync->position[i]->offset + sync->length - 1;
+          else
+            end[i] = window[i].start + (window[i].eof ? window[i].count
+                                                      : window[i].count / 2);
+        }
+
+      /* Terminate the LCS where we commit, and turn it into hunks. */
+      eof_lcs = apr_palloc(windowpool, sizeof(*eof_lcs));
+      for (i = 0; i < 2; i++)
+        {
+          eof_lcs->position[i] = apr_pcalloc(windowpool,
+                                             sizeof(*eof_lcs->position[i]));
+          eof_lcs->position[i]->offset = end[i] + 1;
+        }
+      eof_lcs->length = 0;
+      eof_lcs->refcount = 1;
+      eof_lcs->next = NULL;
+
+      if (sync)
+        sync->next = eof_lcs;
+      else
+        lcs = eof_lcs;
+
+      append_hunks(diff, &last,
+                   svn_diff__diff(lcs, window[0].start + 1,
+                                  window[1].start + 1, TRUE, pool));
+
+      if (final)
+        break;
+
+      for (i = 0; i < 2; i++)
+        advance_window(&window[i], end[i] - window[i].start,
+                       diff_baton, vtable);
+    }
+
+  if (suffix_lines)
+    append_hunks(diff, &last,
+                 common_hunk(window[0].start + window[0].count,
+                             window[1].start + window[1].count,
+                             suffix_lines, pool));
+
+  if (vtable->token_discard_all != NULL)
+    vtable->token_discard_all(diff_baton);
+
+  svn_pool_destroy(subpool);
+
+  return SVN_NO_ERROR;
+}
@@ -101,6 +101,10 @@ typedef enum svn_diff__normalize_state_t
  * equal and be excluded from the comparison process. Similarly, SUFFIX_LINES
  * at the end of both sequences will be skipped.
  *
+ * ALGORITHM selects how the LCS is found.  Note that the result of
+ * svn_diff_algorithm_histogram is a common subsequence, but not
+ * necessarily the longest one.
+ *
  * The resulting lcs structure will be the return value of this function.
  * Allocations will be made from POOL.
  */
@@ -112,24 +116,26 @@ svn_diff__lcs(svn_diff__position_t *position_list1, /* pointer to tail (ring) */
               svn_diff__token_index_t num_tokens, /* length of count arrays */
               apr_off_t prefix_lines,
               apr_off_t suffix_lines,
+              svn_diff_algorithm_t algorithm,
               apr_pool_t *pool);
 
 
 /*
- * Returns number of tokens in a tree
+ * Returns number of distinct tokens in a tree
  */
 svn_diff__token_index_t
 svn_diff__get_node_count(svn_diff__tree_t *tree);
 
 /*
- * Support functions to build a tree of token positions
+ * Create a table for interning tokens.  Despite the name, this is a
+ * hash table that maps each distinct token to a dense token index.
  */
 void
 svn_diff__tree_create(svn_diff__tree_t **tree, apr_pool_t *pool);
 
 
 /*
- * Get all tokens from a datasource.  Return the
+ * Get all tokens from a datasource, interning them in TREE.  Return the
  * last item in the (circular) list.
  */
 svn_error_t *
@@ -141,6 +147,24 @@ svn_diff__get_tokens(svn_diff__position_t **position_list,
                      apr_off_t prefix_lines,
                      apr_pool_t *pool);
 
+/*
+ * Intern the COUNT tokens in TOKENS, whose hashes are in HASHES, in TREE
+ * and return the last item of a (circular) list of their positions in
+ * *POSITION_LIST, or NULL if COUNT is 0.  The positions are numbered
+ * starting at OFFSET + 1.  Unlike svn_diff__get_tokens(), never discard
+ * a token; all of them remain owned by the caller.
+ */
+svn_error_t *
+svn_diff__insert_tokens(svn_diff__position_t **position_list,
+                        svn_diff__tree_t *tree,
+                        void *diff_baton,
+                        const svn_diff_fns2_t *vtable,
+                        void *const *tokens,
+                        const apr_uint32_t *hashes,
+                        apr_off_t count,
+                        apr_off_t offset,
+                        apr_pool_t *pool);
+
 /*
  * Returns an array with the counts for the tokens in
  * the looped linked list given in loop_start.
@@ -163,8 +187,50 @@ svn_diff__resolve_conflict(svn_diff_t *hunk,
                            svn_diff__position_t **position_list1,
                            svn_diff__position_t **position_list2,
                            svn_diff__token_index_t num_tokens,
+                           svn_diff_algorithm_t algorithm,
                            apr_pool_t *pool);
 
+/*
+ * Like svn_diff_diff_2(), but use ALGORITHM to compare the datasources.
+ */
+svn_error_t *
+svn_diff__diff_2(svn_diff_t **diff,
+                 void *diff_baton,
+                 const svn_diff_fns2_t *vtable,
+                 svn_diff_algorithm_t algorithm,
+                 apr_pool_t *pool);
+
+/*
+ * Like svn_diff__diff_2(), but look at no more than a window of lines of
+ * each datasource at a time, so that the memory used does not depend on
+ * the size of the datasources.  The window is sized so that the lines
+ * in it take about MEMORY_LIMIT bytes, assuming that each token of the
+ * datasources takes TOKEN_SIZE bytes.
+ *
+ * Changes are committed a window at a time, up to a run of common lines
+ * in the first half of the window.  The result is a valid diff, though
+ * not necessarily a minimal one if a change spans more than half a
+ * window.
+ */
+svn_error_t *
+svn_diff__diff_2_windowed(svn_diff_t **diff,
+                          void *diff_baton,
+                          const svn_diff_fns2_t *vtable,
+                          svn_diff_algorithm_t algorithm,
+                          apr_size_t memory_limit,
+                          apr_size_t token_size,
+                          apr_pool_t *pool);
+
+/*
+ * Like svn_diff_diff3_2(), but use ALGORITHM to compare the datasources.
+ */
+svn_error_t *
+svn_diff__diff3_2(svn_diff_t **diff,
+                  void *diff_baton,
+                  const svn_diff_fns2_t *vtable,
+                  svn_diff_algorithm_t algorithm,
+                  apr_pool_t *pool);
+
 
 /* Normalize the characters pointed to by the buffer BUF (of length *LENGTHP)
  * according to the options *OPTS, starting in the state *STATEP.
@@ -185,4 +251,33 @@ svn_diff__normalize_buffer(char **tgt,
                            const svn_diff_file_options_t *opts);
 
 
+/* Implementations of the loops that skip the identical prefix and suffix
+ * of the files compared by svn_diff_file_diff_2() and friends.  All of
+ * them find the same prefix and suffix; they differ in speed only.
+ */
+typedef enum svn_diff__scan_kernel_t
+{
+  /* The fastest kernel supported by this build and the current CPU.
+     This is the default. */
+  svn_diff__scan_kernel_auto,
+
+  /* Portable C code. */
+  svn_diff__scan_kernel_scalar,
+
+  /* SSE2 instructions. */
+  svn_diff__scan_kernel_sse2,
+
+  /* AVX2 instructions. */
+  svn_diff__scan_kernel_avx2
+} svn_diff__scan_kernel_t;
+
+/* Make the file diff functions use KERNEL from now on and return TRUE.
+ * If KERNEL is not supported by this build or the current CPU, return
+ * FALSE and leave the selection unchanged.  This is meant for tests and
+ * benchmarks and must not be called while files are being compared.
+ */
+svn_boolean_t
+svn_diff__file_use_scan_kernel(svn_diff__scan_kernel_t kernel);
+
+
 #endif /* DIFF_H */
@@ -49,6 +49,36 @@
 #include "private/svn_dep_compat.h"
 #include "private/svn_adler32.h"
 
+/* SSE2 is part of every x64 CPU and commonly enabled for x86 builds.
+ * The prefix / suffix scanners using it are selected at compile time.
+ */
+#if defined(__SSE2__) || defined(_M_X64) \
+    || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#  define SVN_DIFF_SSE2 1
+#  include <emmintrin.h>
+#else
+#  define SVN_DIFF_SSE2 0
+#endif
+
+/* AVX2 is not.  With GCC and Clang, we compile the AVX2 scanners into
+ * this file regardless of the target architecture options and select
+ * them at runtime if the CPU supports them.
+ */
+#if SVN_DIFF_SSE2 && (defined(__x86_64__) || defined(__i386__)) \
+    && ((defined(__clang__) && __clang_major__ >= 4) \
+        || (!defined(__clang__) && defined(__GNUC__) \
+            && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#  define SVN_DIFF_AVX2 1
+#  include <immintrin.h>
+#  define SVN_DIFF_AVX2_FUNC __attribute__((target("avx2")))
+#else
+#  define SVN_DIFF_AVX2 0
+#endif
+
+#if SVN_DIFF_SSE2 && defined(_MSC_VER)
+#  include <intrin.h>
+#endif
+
 /* A token, i.e. a line read from a file. */
 typedef struct svn_diff__file_token_t
 {
@@ -367,6 +397,551 @@ static svn_boolean_t contains_eol(apr_uintptr_t chunk)
 }
 #endif
 
+/* Count the eol in the identical prefix byte C the way the old byte-wise
+ * loop did: every '\r' and every '\n' not preceded by a '\r' ends a line.
+ * *HAD_CR tells whether the previous byte was a '\r' and gets updated.
+ */
+static APR_INLINE void
+count_prefix_eol(char c, apr_off_t *lines, svn_boolean_t *had_cr)
+{
+  if (c == '\r')
+    {
+      (*lines)++;
+      *had_cr = TRUE;
+    }
+  else
+    {
+      if (c == '\n' && !*had_cr)
+        (*lines)++;
+      *had_cr = FALSE;
+    }
+}
+
+/* Like count_prefix_eol() but for the suffix, which is scanned backwards:
+ * every '\n' and every '\r' not followed by a '\n' ends a line.  *HAD_NL
+ * tells whether the byte after C was a '\n' and gets updated.
+ */
+static APR_INLINE void
+count_suffix_eol(char c, apr_off_t *lines, svn_boolean_t *had_nl)
+{
+  if (c == '\n')
+    {
+      (*lines)++;
+      *had_nl = TRUE;
+    }
+  else
+    {
+      if (c == '\r' && !*had_nl)
+        (*lines)++;
+      *had_nl = FALSE;
+    }
+}
+
+/* Starting at offset POS, compare the bytes at CURP[0 .. FILE_LEN-1] up to
+ * offset MAX_LEN.  Return the offset of the first mismatch or MAX_LEN, if
+ * there is none.  Count the eols in the identical bytes into *LINES, with
+ * *HAD_CR as for count_prefix_eol().
+ */
+static apr_size_t
+scan_prefix_bytes(const char *const *curp, apr_size_t file_len,
+                  apr_size_t pos, apr_size_t max_len,
+                  apr_off_t *lines, svn_boolean_t *had_cr)
+{
+  apr_size_t i;
+
+  for (; pos < max_len; pos++)
+    {
+      for (i = 1; i < file_len; i++)
+        if (curp[i][pos] != curp[0][pos])
+          return pos;
+
+      count_prefix_eol(curp[0][pos], lines, had_cr);
+    }
+
+  return pos;
+}
+
+/* Like scan_prefix_bytes() but scan backwards, i.e. compare the bytes at
+ * CURP[i] - POS down to CURP[i] - MAX_LEN + 1.  Count the eols like
+ * count_suffix_eol() does.
+ */
+static apr_size_t
+scan_suffix_bytes(const char *const *curp, apr_size_t file_len,
+                  apr_size_t pos, apr_size_t max_len,
+                  apr_off_t *lines, svn_boolean_t *had_nl)
+{
+  apr_size_t i;
+
+  for (; pos < max_len; pos++)
+    {
+      for (i = 1; i < file_len; i++)
+        if (*(curp[i] - pos) != *(curp[0] - pos))
+          return pos;
+
+      count_suffix_eol(*(curp[0] - pos), lines, had_nl);
+    }
+
+  return pos;
+}
+
+/* Like scan_prefix_bytes() but skip machine words without eols in one go,
+ * if the platform allows for it.
+ */
+static apr_size_t
+scan_prefix(const char *const *curp, apr_size_t file_len,
+            apr_size_t pos, apr_size_t max_len,
+            apr_off_t *lines, svn_boolean_t *had_cr)
+{
+#if SVN_UNALIGNED_ACCESS_IS_OK
+  apr_size_t i;
+
+  while (pos + sizeof(apr_uintptr_t) <= max_len)
+    {
+      apr_uintptr_t chunk = *(const apr_uintptr_t *)(curp[0] + pos);
+      apr_size_t end = pos + sizeof(apr_uintptr_t);
+
+      for (i = 1; i < file_len; i++)
+        if (chunk != *(const apr_uintptr_t *)(curp[i] + pos))
+          break;
+
+      if (i < file_len || contains_eol(chunk))
+        {
+          /* Find the mismatch / count the eols within this word. */
+          pos = scan_prefix_bytes(curp, file_len, pos, end, lines, had_cr);
+          if (pos < end)
+            return pos;
+        }
+      else
+        {
+          pos = end;
+          *had_cr = FALSE;
+        }
+    }
+#endif
+
+  return scan_prefix_bytes(curp, file_len, pos, max_len, lines, had_cr);
+}
+
+/* Like scan_suffix_bytes() but skip machine words without eols in one go,
+ * if the platform allows for it.
+ */
+static apr_size_t
+scan_suffix(const char *const *curp, apr_size_t file_len,
+            apr_size_t pos, apr_size_t max_len,
+            apr_off_t *lines, svn_boolean_t *had_nl)
+{
+#if SVN_UNALIGNED_ACCESS_IS_OK
+  apr_size_t i;
+
+  while (pos + sizeof(apr_uintptr_t) <= max_len)
+    {
+      apr_size_t end = pos + sizeof(apr_uintptr_t);
+      apr_uintptr_t chunk
+        = *(const apr_uintptr_t *)(curp[0] - end + 1);
+
+      for (i = 1; i < file_len; i++)
+        if (chunk != *(const apr_uintptr_t *)(curp[i] - end + 1))
+          break;
+
+      if (i < file_len || contains_eol(chunk))
+        {
+          pos = scan_suffix_bytes(curp, file_len, pos, end, lines, had_nl);
+          if (pos < end)
+            return pos;
+        }
+      else
+        {
+          pos = end;
+          *had_nl = FALSE;
+        }
+    }
+#endif
+
+  return scan_suffix_bytes(curp, file_len, pos, max_len, lines, had_nl);
+}
+
+#if SVN_DIFF_SSE2
+
+/* Return the number of bits set in MASK. */
+static APR_INLINE unsigned
+count_bits(apr_uint32_t mask)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_popcount(mask);
+#else
+  mask = mask - ((mask >> 1) & 0x55555555);
+  mask = (mask & 0x33333333) + ((mask >> 2) & 0x33333333);
+  return (((mask + (mask >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+#endif
+}
+
+/* Return the index of the lowest set bit in the non-zero MASK. */
+static APR_INLINE unsigned
+lowest_bit(apr_uint32_t mask)
+{
+#if defined(__GNUC__)
+  return (unsigned)__builtin_ctz(mask);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanForward(&index, mask);
+  return (unsigned)index;
+#else
+  unsigned index = 0;
+  for (; (mask & 1) == 0; mask >>= 1)
+    ++index;
+  return index;
+#endif
+}
+
+/* Return the index of the highest set bit in the non-zero MASK. */
+static APR_INLINE unsigned
+highest_bit(apr_uint32_t mask)
+{
+#if defined(__GNUC__)
+  return 31 - (unsigned)__builtin_clz(mask);
+#elif defined(_MSC_VER)
+  unsigned long index;
+  _BitScanReverse(&index, mask);
+  return (unsigned)index;
+#else
+  unsigned index = 0;
+  for (; mask > 1; mask >>= 1)
+    ++index;
+  return index;
+#endif
+}
+
+/* Count the eols in the first LEN bytes of an identical prefix block.
+ * Bit N of CR and NL is set if byte N of the block is a '\r' or '\n',
+ * respectively; no bits at or above LEN may be set.  *LINES and *HAD_CR
+ * are updated as LEN calls to count_prefix_eol() would.
+ */
+static APR_INLINE void
+count_prefix_eols(apr_uint32_t cr, apr_uint32_t nl, unsigned len,
+                  apr_off_t *lines, svn_boolean_t *had_cr)
+{
+  if (len == 0)
+    return;
+
+  *lines += count_bits(cr)
+          + count_bits(nl & ~((cr << 1) | (*had_cr ? 1u : 0u)));
+  *had_cr = (cr >> (len - 1)) & 1;
+}
+
+/* Count the eols in the last LEN bytes of an identical suffix block of
+ * WIDTH bytes, which gets scanned from its last byte down.  Bit N of CR
+ * and NL is set if byte N of the block is a '\r' or '\n', respectively;
+ * no bits below WIDTH - LEN may be set.  *LINES and *HAD_NL are updated
+ * as LEN calls to count_suffix_eol() would.
+ */
+static APR_INLINE void
+count_suffix_eols(apr_uint32_t cr, apr_uint32_t nl,
+                  unsigned width, unsigned len,
+                  apr_off_t *lines, svn_boolean_t *had_nl)
+{
+  if (len == 0)
+    return;
+
+  *lines += count_bits(nl)
+          + count_bits(cr & ~((nl >> 1)
+                              | ((*had_nl ? 1u : 0u) << (width - 1))));
+  *had_nl = (nl >> (width - len)) & 1;
+}
+
+/* Like scan_prefix() but compare 16 bytes at a time. */
+static apr_size_t
+scan_prefix_sse2(const char *const *curp, apr_size_t file_len,
+                 apr_size_t pos, apr_size_t max_len,
+                 apr_off_t *lines, svn_boolean_t *had_cr)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i nl = _mm_set1_epi8('\n');
+  apr_size_t i;
+
+  for (; pos + sizeof(__m128i) <= max_len; pos += sizeof(__m128i))
+    {
+      __m128i data = _mm_loadu_si128((const __m128i *)(curp[0] + pos));
+      apr_uint32_t equal = 0xffff;
+      apr_uint32_t cr_mask, nl_mask;
+      unsigned len = sizeof(__m128i);
+
+      for (i = 1; i < file_len; i++)
+        {
+          __m128i other = _mm_loadu_si128((const __m128i *)(curp[i] + pos));
+          equal &= (apr_uint32_t)_mm_movemask_epi8(
+                     _mm_cmpeq_epi8(data, other));
+        }
+
+      cr_mask = (apr_uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(data, cr));
+      nl_mask = (apr_uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(data, nl));
+
+      if (equal != 0xffff)
+        {
+          len = lowest_bit(equal ^ 0xffff);
+          cr_mask &= (1u << len) - 1;
+          nl_mask &= (1u << len) - 1;
+        }
+
+      count_prefix_eols(cr_mask, nl_mask, len, lines, had_cr);
+      if (len < sizeof(__m128i))
+        return pos + len;
+    }
+
+  return scan_prefix_bytes(curp, file_len, pos, max_len, lines, had_cr);
+}
+
+/* Like scan_suffix() but compare 16 bytes at a time. */
+static apr_size_t
+scan_suffix_sse2(const char *const *curp, apr_size_t file_len,
+                 apr_size_t pos, apr_size_t max_len,
+                 apr_off_t *lines, svn_boolean_t *had_nl)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i nl = _mm_set1_epi8('\n');
+  apr_size_t i;
+
+  for (; pos + sizeof(__m128i) <= max_len; pos += sizeof(__m128i))
+    {
+      /* The last byte of the block is the one closest to CURP - POS. */
+      apr_size_t offset = pos + sizeof(__m128i) - 1;
+      __m128i data = _mm_loadu_si128((const __m128i *)(curp[0] - offset));
+      apr_uint32_t equal = 0xffff;
+      apr_uint32_t cr_mask, nl_mask;
+      unsigned len = sizeof(__m128i);
+
+      for (i = 1; i < file_len; i++)
+        {
+          __m128i other = _mm_loadu_si128((const __m128i *)(curp[i] - offset));
+          equal &= (apr_uint32_t)_mm_movemask_epi8(
+                     _mm_cmpeq_epi8(data, other));
+        }
+
+      cr_mask = (apr_uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(data, cr));
+      nl_mask = (apr_uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(data, nl));
+
+      if (equal != 0xffff)
+        {
+          unsigned mismatch = highest_bit(equal ^ 0xffff);
+
+          len = sizeof(__m128i) - 1 - mismatch;
+          cr_mask &= ~((2u << mismatch) - 1);
+          nl_mask &= ~((2u << mismatch) - 1);
+        }
+
+      count_suffix_eols(cr_mask, nl_mask, sizeof(__m128i), len,
+                        lines, had_nl);
+      if (len < sizeof(__m128i))
+        return pos + len;
+    }
+
+  return scan_suffix_bytes(curp, file_len, pos, max_len, lines, had_nl);
+}
+
+#endif /* SVN_DIFF_SSE2 */
+
+#if SVN_DIFF_AVX2
+
+/* Like scan_prefix() but compare 32 bytes at a time. */
+static SVN_DIFF_AVX2_FUNC apr_size_t
+scan_prefix_avx2(const char *const *curp, apr_size_t file_len,
+                 apr_size_t pos, apr_size_t max_len,
+                 apr_off_t *lines, svn_boolean_t *had_cr)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i nl = _mm256_set1_epi8('\n');
+  apr_size_t i;
+
+  for (; pos + sizeof(__m256i) <= max_len; pos += sizeof(__m256i))
+    {
+      __m256i data = _mm256_loadu_si256((const __m256i *)(curp[0] + pos));
+      apr_uint32_t equal = 0xffffffff;
+      apr_uint32_t cr_mask, nl_mask;
+      unsigned len = sizeof(__m256i);
+
+      for (i = 1; i < file_len; i++)
+        {
+          __m256i other = _mm256_loadu_si256((const __m256i *)(curp[i] + pos));
+          equal &= (apr_uint32_t)_mm256_movemask_epi8(
+                     _mm256_cmpeq_epi8(data, other));
+        }
+
+      cr_mask = (apr_uint32_t)_mm256_movemask_epi8(
+                  _mm256_cmpeq_epi8(data, cr));
+      nl_mask = (apr_uint32_t)_mm256_movemask_epi8(
+                  _mm256_cmpeq_epi8(data, nl));
+
+      if (equal != 0xffffffff)
+        {
+          len = lowest_bit(~equal);
+          cr_mask &= (1u << len) - 1;
+          nl_mask &= (1u << len) - 1;
+        }
+
+      count_prefix_eols(cr_mask, nl_mask, len, lines, had_cr);
+      if (len < sizeof(__m256i))
+        return pos + len;
+    }
+
+  return scan_prefix_sse2(curp, file_len, pos, max_len, lines, had_cr);
+}
+
+/* Like scan_suffix() but compare 32 bytes at a time. */
+static SVN_DIFF_AVX2_FUNC apr_size_t
+scan_suffix_avx2(const char *const *curp, apr_size_t file_len,
+                 apr_size_t pos, apr_size_t max_len,
+                 apr_off_t *lines, svn_boolean_t *had_nl)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i nl = _mm256_set1_epi8('\n');
+  apr_size_t i;
+
+  for (; pos + sizeof(__m256i) <= max_len; pos += sizeof(__m256i))
+    {
+      apr_size_t offset = pos + sizeof(__m256i) - 1;
+      __m256i data = _mm256_loadu_si256((const __m256i *)(curp[0] - offset));
+      apr_uint32_t equal = 0xffffffff;
+      apr_uint32_t cr_mask, nl_mask;
+      unsigned len = sizeof(__m256i);
+
+      for (i = 1; i < file_len; i++)
+        {
+          __m256i other
+            = _mm256_loadu_si256((const __m256i *)(curp[i] - offset));
+          equal &= (apr_uint32_t)_mm256_movemask_epi8(
+                     _mm256_cmpeq_epi8(data, other));
+        }
+
+      cr_mask = (apr_uint32_t)_mm256_movemask_epi8(
+                  _mm256_cmpeq_epi8(data, cr));
+      nl_mask = (apr_uint32_t)_mm256_movemask_epi8(
+                  _mm256_cmpeq_epi8(data, nl));
+
+      if (equal != 0xffffffff)
+        {
+          unsigned mismatch = highest_bit(~equal);
+
+          len = sizeof(__m256i) - 1 - mismatch;
+          cr_mask &= ~((2u << mismatch) - 1);
+          nl_mask &= ~((2u << mismatch) - 1);
+        }
+
+      count_suffix_eols(cr_mask, nl_mask, sizeof(__m256i), len,
+                        lines, had_nl);
+      if (len < sizeof(__m256i))
+        return pos + len;
+    }
+
+  return scan_suffix_sse2(curp, file_len, pos, max_len, lines, had_nl);
+}
+
+/* Return TRUE if the CPU we are running on supports AVX2. */
+static svn_boolean_t
+cpu_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") ? TRUE : FALSE;
+}
+
+#endif /* SVN_DIFF_AVX2 */
+
+/* The functions that find_identical_prefix() and find_identical_suffix()
+ * spend most of their time in.  They are shared by 2-, 3- and 4-way diffs.
+ */
+typedef struct scan_kernels_t
+{
+  apr_size_t (*scan_prefix)(const char *const *curp, apr_size_t file_len,
+                            apr_size_t pos, apr_size_t max_len,
+                            apr_off_t *lines, svn_boolean_t *had_cr);
+  apr_size_t (*scan_suffix)(const char *const *curp, apr_size_t file_len,
+                            apr_size_t pos, apr_size_t max_len,
+                            apr_off_t *lines, svn_boolean_t *had_nl);
+} scan_kernels_t;
+
+static const scan_kernels_t scalar_kernels =
+  {
+    scan_prefix,
+    scan_suffix
+  };
+
+#if SVN_DIFF_SSE2
+static const scan_kernels_t sse2_kernels =
+  {
+    scan_prefix_sse2,
+    scan_suffix_sse2
+  };
+#endif
+
+#if SVN_DIFF_AVX2
+static const scan_kernels_t avx2_kernels =
+  {
+    scan_prefix_avx2,
+    scan_suffix_avx2
+  };
+#endif
+
+/* The kernels to use.  NULL until the first files get compared.
+ * Should multiple threads initialize it at the same time, they will
+ * simply all store the same value.
+ */
+static const scan_kernels_t *selected_kernels = NULL;
+
+/* Return the kernels for KERNEL or NULL, if those are not available. */
+static const scan_kernels_t *
+find_kernels(svn_diff__scan_kernel_t kernel)
+{
+  switch (kernel)
+    {
+      case svn_diff__scan_kernel_auto:
+#if SVN_DIFF_AVX2
+        if (cpu_has_avx2())
+          return &avx2_kernels;
+#endif
+#if SVN_DIFF_SSE2
+        return &sse2_kernels;
+#else
+        return &scalar_kernels;
+#endif
+
+      case svn_diff__scan_kernel_scalar:
+        return &scalar_kernels;
+
+#if SVN_DIFF_SSE2
+      case svn_diff__scan_kernel_sse2:
+        return &sse2_kernels;
+#endif
+
+#if SVN_DIFF_AVX2
+      case svn_diff__scan_kernel_avx2:
+        return cpu_has_avx2() ? &avx2_kernels : NULL;
+#endif
+
+      default:
+        return NULL;
+    }
+}
+
+/* Return the kernels to use for scanning prefix and suffix. */
+static APR_INLINE const scan_kernels_t *
+get_kernels(void)
+{
+  if (selected_kernels == NULL)
+    selected_kernels = find_kernels(svn_diff__scan_kernel_auto);
+
+  return selected_kernels;
+}
+
+svn_boolean_t
+svn_diff__file_use_scan_kernel(svn_diff__scan_kernel_t kernel)
+{
+  const scan_kernels_t *kernels = find_kernels(kernel);
+
+  if (kernels == NULL)
+    return FALSE;
+
+  selected_kernels = kernels;
+  return TRUE;
+}
+
 /* Find the prefix which is identical between all elements of the FILE array.
  * Return the number of prefix lines in PREFIX_LINES.  REACHED_ONE_EOF will be
  * set to TRUE if one of the FILEs reached its end while scanning prefix,
@@ -391,69 +966,36 @@ find_identical_prefix(svn_boolean_t *reached_one_eof, apr_off_t *prefix_lines,
     is_match = is_match && *file[0].curp == *file[i].curp;
   while (is_match)
     {
-#if SVN_UNALIGNED_ACCESS_IS_OK
-      apr_ssize_t max_delta, delta;
-#endif /* SVN_UNALIGNED_ACCESS_IS_OK */
+      const char *curp[4];
+      apr_size_t max_len, delta;
 
       /* ### TODO: see if we can take advantage of
          diff options like ignore_eol_style or ignore_space. */
       /* check for eol, and count */
-      if (*file[0].curp == '\r')
-        {
-          lines++;
-          had_cr = TRUE;
-        }
-      else if (*file[0].curp == '\n' && !had_cr)
-        {
-          lines++;
-        }
-      else
-        {
-          had_cr = FALSE;
-        }
+      count_prefix_eol(*file[0].curp, &lines, &had_cr);
 
       INCREMENT_POINTERS(file, file_len, pool);
 
-#if SVN_UNALIGNED_ACCESS_IS_OK
-
-      /* Try to advance as far as possible with machine-word granularity.
-       * Determine how far we may advance with chunky ops without reaching
-       * endp for any of the files.
-       * Signedness is important here if curp gets close to endp.
+      /* Advance as far as possible within the current chunks.  Leave the
+       * last byte of each chunk to the code above, so that curp never
+       * reaches endp here.
        */
-      max_delta = file[0].endp - file[0].curp - sizeof(apr_uintptr_t);
-      for (i = 1; i < file_len; i++)
+      max_len = file[0].endp - file[0].curp;
+      for (i = 0; i < file_len; i++)
         {
-          delta = file[i].endp - file[i].curp - sizeof(apr_uintptr_t);
-          if (delta < max_delta)
-            max_delta = delta;
+          if (max_len > (apr_size_t)(file[i].endp - file[i].curp))
+            max_len = file[i].endp - file[i].curp;
+          curp[i] = file[i].curp;
         }
 
-      is_match = TRUE;
-      for (delta = 0; delta < max_delta && is_match; delta += sizeof(apr_uintptr_t))
+      if (max_len > 1)
         {
-          apr_uintptr_t chunk = *(const apr_size_t *)(file[0].curp + delta);
-          if (contains_eol(chunk))
-            break;
-
-          for (i = 1; i < file_len; i++)
-            if (chunk != *(const apr_size_t *)(file[i].curp + delta))
-              {
-                is_match = FALSE;
-                delta -= sizeof(apr_size_t);
-                break;
-              }
+          delta = get_kernels()->scan_prefix(curp, file_len, 0, max_len - 1,
+                                             &lines, &had_cr);
+          for (i = 0; i < file_len; i++)
+            file[i].curp += delta;
         }
 
-      /* We either found a mismatch or an EOL at or shortly behind curp+delta
-       * or we cannot proceed with chunky ops without exceeding endp.
-       * In any way, everything up to curp + delta is equal and not an EOL.
-       */
-      for (i = 0; i < file_len; i++)
-        file[i].curp += delta;
-
-#endif
-
       *reached_one_eof = is_one_at_eof(file, file_len);
       if (*reached_one_eof)
         break;
@@ -592,71 +1134,40 @@ find_identical_suffix(apr_off_t *suffix_lines, struct file_info file[],
   had_nl = FALSE;
   while (is_match)
     {
-#if SVN_UNALIGNED_ACCESS_IS_OK
-      /* Initialize the minimum pointer positions. */
-      const char *min_curp[4];
-      svn_boolean_t can_read_word;
-#endif /* SVN_UNALIGNED_ACCESS_IS_OK */
+      const char *curp[4];
+      apr_ssize_t max_len, len;
+      apr_size_t delta;
 
       /* ### TODO: see if we can take advantage of
          diff options like ignore_eol_style or ignore_space. */
       /* check for eol, and count */
-      if (*file_for_suffix[0].curp == '\n')
-        {
-          lines++;
-          had_nl = TRUE;
-        }
-      else if (*file_for_suffix[0].curp == '\r' && !had_nl)
-        {
-          lines++;
-        }
-      else
-        {
-          had_nl = FALSE;
-        }
+      count_suffix_eol(*file_for_suffix[0].curp, &lines, &had_nl);
 
       DECREMENT_POINTERS(file_for_suffix, file_len, pool);
 
-#if SVN_UNALIGNED_ACCESS_IS_OK
-
-      min_curp[0] = file_for_suffix[0].chunk == suffix_min_chunk0
-                  ? file_for_suffix[0].buffer + suffix_min_offset0 + 1
-                  : file_for_suffix[0].buffer + 1;
-      for (i = 1; i < file_len; i++)
-        min_curp[i] = file_for_suffix[i].buffer + 1;
-
-      /* Scan quickly by reading with machine-word granularity. */
-      for (i = 0, can_read_word = TRUE; i < file_len; i++)
-        can_read_word = can_read_word
-                        && (   file_for_suffix[i].curp - sizeof(apr_uintptr_t)
-                            >= min_curp[i]);
-      if (can_read_word)
+      /* Scan back as far as possible within the current chunks, but stop
+       * one byte short of their starts and of the prefix.  The code above
+       * takes care of those.
+       */
+      max_len = file_for_suffix[0].curp - file_for_suffix[0].buffer - 1;
+      if (file_for_suffix[0].chunk == suffix_min_chunk0)
+        max_len -= (apr_ssize_t)suffix_min_offset0;
+      for (i = 0; i < file_len; i++)
         {
-          do
-            {
-              apr_uintptr_t chunk;
-              for (i = 0; i < file_len; i++)
-                file_for_suffix[i].curp -= sizeof(apr_uintptr_t);
-
-              chunk = *(const apr_uintptr_t *)(file_for_suffix[0].curp + 1);
-              if (contains_eol(chunk))
-                break;
-
-              for (i = 0, can_read_word = TRUE; i < file_len; i++)
-                can_read_word = can_read_word
-                                && (   file_for_suffix[i].curp - sizeof(apr_uintptr_t)
-                                    >= min_curp[i]);
-              for (i = 1, is_match = TRUE; i < file_len; i++)
-                is_match = is_match
-                           && (   chunk
-                               == *(const apr_uintptr_t *)(file_for_suffix[i].curp + 1));
-            } while (can_read_word && is_match);
-
-            for (i = 0; i < file_len; i++)
-              file_for_suffix[i].curp += sizeof(apr_uintptr_t);
+          len = file_for_suffix[i].curp - file_for_suffix[i].buffer - 1;
+          if (len < max_len)
+            max_len = len;
+          curp[i] = file_for_suffix[i].curp;
         }
 
-#endif
+      if (max_len > 0 && !is_one_at_bof(file_for_suffix, file_len))
+        {
+          delta = get_kernels()->scan_suffix(curp, file_len, 0,
+                                             (apr_size_t)max_len,
+                                             &lines, &had_nl);
+          for (i = 0; i < file_len; i++)
+            file_for_suffix[i].curp -= delta;
+        }
 
       reached_prefix = file_for_suffix[0].chunk == suffix_min_chunk0
                        && (file_for_suffix[0].curp - file_for_suffix[0].buffer)
@@ -1110,8 +1621,10 @@ static const svn_diff_fns2_t svn_diff__file_vtable =
   token_discard_all
 };
 
-/* Id for the --ignore-eol-style option, which doesn't have a short name. */
+/* Ids for the options which don't have a short name. */
 #define SVN_DIFF__OPT_IGNORE_EOL_STYLE 256
+#define SVN_DIFF__OPT_HISTOGRAM 257
+#define SVN_DIFF__OPT_MEMORY_LIMIT 258
 
 /* Options supported by svn_diff_file_options_parse(). */
 static const apr_getopt_option_t diff_options[] =
@@ -1120,6 +1633,8 @@ static const apr_getopt_option_t diff_options[] =
   { "ignore-all-space", 'w', 0, NULL },
   { "ignore-eol-style", SVN_DIFF__OPT_IGNORE_EOL_STYLE, 0, NULL },
   { "show-c-function", 'p', 0, NULL },
+  { "histogram", SVN_DIFF__OPT_HISTOGRAM, 0, NULL },
+  { "memory-limit", SVN_DIFF__OPT_MEMORY_LIMIT, 1, NULL },
   /* ### For compatibility; we don't support the argument to -u, because
    * ### we don't have optional argument support. */
   { "unified", 'u', 0, NULL },
@@ -1215,6 +1730,27 @@ svn_diff_file_options_parse(svn_diff_file_options_t *options,
         case 'p':
           options->show_c_function = TRUE;
           break;
+        case SVN_DIFF__OPT_HISTOGRAM:
+          options->algorithm = svn_diff_algorithm_histogram;
+          break;
+        case SVN_DIFF__OPT_MEMORY_LIMIT:
+          {
+            apr_uint64_t megabytes;
+            svn_error_t *parse_err;
+
+            /* The argument is in megabytes. */
+            parse_err = svn_cstring_strtoui64(&megabytes, opt_arg, 1,
+                                              APR_SIZE_MAX / (1024 * 1024),
+                                              10);
+            if (parse_err)
+              return svn_error_createf(SVN_ERR_INVALID_DIFF_OPTION,
+                                       parse_err,
+                                       _("Invalid memory limit '%s' "
+                                         "in diff options"), opt_arg);
+
+            options->memory_limit = (apr_size_t)megabytes * 1024 * 1024;
+          }
+          break;
         default:
           break;
         }
@@ -1243,7 +1779,14 @@ svn_diff_file_diff_2(svn_diff_t **diff,
   baton.files[1].path = modified;
   baton.pool = svn_pool_create(pool);
 
-  SVN_ERR(svn_diff_diff_2(diff, &baton, &svn_diff__file_vtable, pool));
+  if (options->memory_limit)
+    SVN_ERR(svn_diff__diff_2_windowed(diff, &baton, &svn_diff__file_vtable,
+                                      options->algorithm,
+                                      options->memory_limit,
+                                      sizeof(svn_diff__file_token_t), pool));
+  else
+    SVN_ERR(svn_diff__diff_2(diff, &baton, &svn_diff__file_vtable,
+                             options->algorithm, pool));
 
   svn_pool_destroy(baton.pool);
   return SVN_NO_ERROR;
@@ -1265,7 +1808,8 @@ svn_diff_file_diff3_2(svn_diff_t **diff,
   baton.files[2].path = latest;
   baton.pool = svn_pool_create(pool);
 
-  SVN_ERR(svn_diff_diff3_2(diff, &baton, &svn_diff__file_vtable, pool));
+  SVN_ERR(svn_diff__diff3_2(diff, &baton, &svn_diff__file_vtable,
+                            options->algorithm, pool));
 
   svn_pool_destroy(baton.pool);
   return SVN_NO_ERROR;
@@ -26,6 +26,8 @@
 #include <apr_pools.h>
 #include <apr_general.h>
 
+#include "svn_pools.h"
+
 #include "diff.h"
 
 
@@ -228,6 +230,384 @@ prepend_lcs(svn_diff__lcs_t *lcs, apr_off_t lines,
 }
 
 
+/*
+ * The histogram diff, an alternative to the above.
+ *
+ * Rather than searching for a minimal edit script, the histogram diff
+ * looks for a line that occurs rarely in the original version and also
+ * appears in the modified one, extends the match around it as far as
+ * possible and handles the regions before and after it the same way.
+ * Lines that occur very often (think of blank lines or lone braces) are
+ * only used as anchors if a region has nothing better to offer.
+ *
+ * The result is not necessarily a longest common subsequence, but it
+ * tends to match what humans consider to be the structure of the
+ * change.  More importantly, its cost does not explode for large files
+ * with many scattered changes: every line is looked at a bounded number
+ * of times, and once the work budget is spent, all remaining regions
+ * are simply reported as changed.
+ */
+
+/* Lines occurring more often than this in a region of the original
+ * version count as frequent.  For each line of the modified version,
+ * at most this many occurrences are considered as anchors.
+ */
+#define SVN_DIFF__HISTOGRAM_MAX_CHAIN 64
+
+/* Regions that share only frequent lines get an exact LCS by dynamic
+ * programming if the product of their lengths doesn't exceed this.
+ * Larger ones are anchored on the best frequent line found.
+ */
+#define SVN_DIFF__HISTOGRAM_MAX_DP_CELLS 65536
+
+/* The work budget, in line comparisons per line of input. */
+#define SVN_DIFF__HISTOGRAM_WORK_PER_LINE 256
+
+/* A pair of corresponding regions of the two sequences, given as
+ * half-open ranges of indexes into the position arrays.
+ */
+typedef struct histogram_region_t
+{
+  apr_off_t lo[2];
+  apr_off_t hi[2];
+} histogram_region_t;
+
+/* State of a histogram diff. */
+typedef struct histogram_baton_t
+{
+  /* The positions of both sequences and their token indexes. */
+  svn_diff__position_t **position[2];
+  svn_diff__token_index_t *token[2];
+
+  /* For each position of the first sequence, the index of the matching
+   * position in the second sequence, or -1. */
+  apr_off_t *match;
+
+  /* Occurrences of each token within the current region of the first
+   * sequence: how many there are, the first one, and for each position,
+   * the next one of the same token.  All -1 or 0 between regions. */
+  svn_diff__token_index_t *count;
+  apr_off_t *chain_head;
+  apr_off_t *chain_next;
+
+  /* Scratch space for histogram_dp() with room for DP_SIZE cells. */
+  apr_uint16_t *dp;
+  apr_size_t dp_size;
+
+  /* Line comparisons we may still spend. */
+  apr_int64_t budget;
+
+  /* Regions still to be processed, histogram_region_t. */
+  apr_array_header_t *regions;
+
+  apr_pool_t *pool;
+} histogram_baton_t;
+
+/* Find a longest common subsequence of REGION by dynamic programming
+ * and record it in HB->match.  The product of the region's lengths
+ * must not exceed SVN_DIFF__HISTOGRAM_MAX_DP_CELLS.
+ */
+static void
+histogram_dp(histogram_baton_t *hb,
+             const histogram_region_t *region)
+{
+  const svn_diff__token_index_t *a = hb->token[0] + region->lo[0];
+  const svn_diff__token_index_t *b = hb->token[1] + region->lo[1];
+  apr_size_t n = (apr_size_t)(region->hi[0] - region->lo[0]);
+  apr_size_t m = (apr_size_t)(region->hi[1] - region->lo[1]);
+  apr_size_t width = m + 1;
+  apr_size_t i, j;
+
+  if (hb->dp_size < (n + 1) * width)
+    {
+      hb->dp_size = (n + 1) * width;
+      hb->dp = apr_palloc(hb->pool, hb->dp_size * sizeof(*hb->dp));
+    }
+
+  /* DP[i * WIDTH + j] is the LCS length of A[i..N) and B[j..M). */
+  for (j = 0; j <= m; j++)
+    hb->dp[n * width + j] = 0;
+
+  for (i = n; i-- > 0; )
+    {
+      hb->dp[i * width + m] = 0;
+      for (j = m; j-- > 0; )
+        {
+          apr_uint16_t skip_a = hb->dp[(i + 1) * width + j];
+          apr_uint16_t skip_b = hb->dp[i * width + j + 1];
+
+          if (a[i] == b[j])
+            hb->dp[i * width + j] = hb->dp[(i + 1) * width + j + 1] + 1;
+          else
+            hb->dp[i * width + j] = skip_a > skip_b ? skip_a : skip_b;
+        }
+    }
+
+  i = j = 0;
+  while (i < n && j < m)
+    {
+      if (a[i] == b[j])
+        {
+          hb->match[region->lo[0] + i] = region->lo[1] + j;
+          i++;
+          j++;
+        }
+      else if (hb->dp[(i + 1) * width + j] >= hb->dp[i * width + j + 1])
+        i++;
+      else
+        j++;
+    }
+
+  hb->budget -= (apr_int64_t)(n * m);
+}
+
+/* Match up the lines of REGION in HB, queueing any subregions that
+ * remain to be processed in HB->regions.
+ */
+static void
+histogram_diff_region(histogram_baton_t *hb,
+                      histogram_region_t region)
+{
+  const svn_diff__token_index_t *a = hb->token[0];
+  const svn_diff__token_index_t *b = hb->token[1];
+  svn_diff__token_index_t best_count = SVN_DIFF__HISTOGRAM_MAX_CHAIN + 2;
+  apr_off_t best[2] = { -1, -1 };
+  apr_off_t best_length = 0;
+  apr_off_t i, j, next_j;
+
+  /* Identical lines at either end match trivially. */
+  while (region.lo[0] < region.hi[0] && region.lo[1] < region.hi[1]
+         && a[region.lo[0]] == b[region.lo[1]])
+    hb->match[region.lo[0]++] = region.lo[1]++;
+
+  while (region.lo[0] < region.hi[0] && region.lo[1] < region.hi[1]
+         && a[region.hi[0] - 1] == b[region.hi[1] - 1])
+    hb->match[--region.hi[0]] = --region.hi[1];
+
+  if (region.lo[0] == region.hi[0] || region.lo[1] == region.hi[1])
+    return;
+
+  /* Give up on pathological inputs, leaving this region unmatched. */
+  hb->budget -= (region.hi[0] - region.lo[0]) + (region.hi[1] - region.lo[1]);
+  if (hb->budget < 0)
+    return;
+
+  /* Index the occurrences of each token in the first sequence. */
+  for (i = region.hi[0] - 1; i >= region.lo[0]; i--)
+    {
+      hb->chain_next[i] = hb->chain_head[a[i]];
+      hb->chain_head[a[i]] = i;
+      hb->count[a[i]]++;
+    }
+
+  /* Find the rarest line with a match, preferring longer matches among
+     lines that are equally rare.  All frequent lines are equally rare.
+     Lines covered by a match found for an earlier line would only give
+     the same match again, so skip them. */
+  for (j = next_j = region.lo[1]; j < region.hi[1] && hb->budget >= 0;
+       j = (next_j > j + 1) ? next_j : j + 1)
+    {
+      svn_diff__token_index_t count = hb->count[b[j]];
+      int chain_length = 0;
+
+      if (count > SVN_DIFF__HISTOGRAM_MAX_CHAIN)
+        count = SVN_DIFF__HISTOGRAM_MAX_CHAIN + 1;
+      if (count == 0 || count > best_count)
+        continue;
+
+      for (i = hb->chain_head[b[j]];
+           i >= 0 && chain_length < SVN_DIFF__HISTOGRAM_MAX_CHAIN;
+           i = hb->chain_next[i], chain_length++)
+        {
+          apr_off_t start = 0;
+          apr_off_t end = 1;
+
+          while (i - start > region.lo[0] && j - start > region.lo[1]
+                 && a[i - start - 1] == b[j - start - 1])
+            start++;
+          while (i + end < region.hi[0] && j + end < region.hi[1]
+                 && a[i + end] == b[j + end])
+            end++;
+
+          hb->budget -= start + end;
+          if (next_j < j + end)
+            next_j = j + end;
+
+          if (count < best_count || start + end > best_length)
+            {
+              best_count = count;
+              best[0] = i - start;
+              best[1] = j - start;
+              best_length = start + end;
+            }
+        }
+    }
+
+  /* Reset the index for the next region. */
+  for (i = region.lo[0]; i < region.hi[0]; i++)
+    {
+      hb->chain_head[a[i]] = -1;
+      hb->count[a[i]] = 0;
+    }
+
+  if (best_length == 0)
+    return;
+
+  if (best_count > SVN_DIFF__HISTOGRAM_MAX_CHAIN && hb->budget >= 0
+      && (region.hi[0] - region.lo[0]) * (region.hi[1] - region.lo[1])
+         <= SVN_DIFF__HISTOGRAM_MAX_DP_CELLS)
+    {
+      /* Only frequent lines are shared, and the region is small enough
+         to afford an exact answer. */
+      histogram_dp(hb, &region);
+    }
+  else
+    {
+      histogram_region_t *before = apr_array_push(hb->regions);
+      histogram_region_t *after;
+
+      before->lo[0] = region.lo[0];
+      before->lo[1] = region.lo[1];
+      before->hi[0] = best[0];
+      before->hi[1] = best[1];
+
+      after = apr_array_push(hb->regions);
+      after->lo[0] = best[0] + best_length;
+      after->lo[1] = best[1] + best_length;
+      after->hi[0] = region.hi[0];
+      after->hi[1] = region.hi[1];
+
+      for (i = 0; i < best_length; i++)
+        hb->match[best[0] + i] = best[1] + i;
+    }
+}
+
+/* Copy the LENGTH positions of the ring starting at HEAD into a new
+ * array in *POSITIONS, and their token indexes into *TOKENS.  Allocate
+ * both in POOL.
+ */
+static void
+histogram_flatten(svn_diff__position_t ***positions,
+                  svn_diff__token_index_t **tokens,
+                  svn_diff__position_t *head,
+                  apr_off_t length,
+                  apr_pool_t *pool)
+{
+  apr_off_t i;
+
+  *positions = apr_palloc(pool, (apr_size_t)length * sizeof(**positions));
+  *tokens = apr_palloc(pool, (apr_size_t)length * sizeof(**tokens));
+
+  for (i = 0; i < length; i++, head = head->next)
+    {
+      (*positions)[i] = head;
+      (*tokens)[i] = head->token_index;
+    }
+}
+
+/* Implement svn_diff__lcs() for svn_diff_algorithm_histogram.  EOF_LCS
+ * is the final, empty lcs element.  The other parameters are as for
+ * svn_diff__lcs(); both position lists are non-empty.
+ */
+static svn_diff__lcs_t *
+lcs_histogram(svn_diff__lcs_t *eof_lcs,
+              svn_diff__position_t *position_list1,
+              svn_diff__position_t *position_list2,
+              svn_diff__token_index_t num_tokens,
+              apr_off_t prefix_lines,
+              apr_off_t suffix_lines,
+              apr_pool_t *pool)
+{
+  histogram_baton_t hb;
+  histogram_region_t *region;
+  svn_diff__lcs_t *lcs = eof_lcs;
+  apr_off_t length[2];
+  apr_off_t i;
+  svn_diff__token_index_t t;
+  apr_pool_t *scratch_pool = svn_pool_create(pool);
+
+  length[0] = position_list1->offset - position_list1->next->offset + 1;
+  length[1] = position_list2->offset - position_list2->next->offset + 1;
+
+  hb.pool = scratch_pool;
+  histogram_flatten(&hb.position[0], &hb.token[0], position_list1->next,
+                    length[0], scratch_pool);
+  histogram_flatten(&hb.position[1], &hb.token[1], position_list2->next,
+                    length[1], scratch_pool);
+
+  hb.match = apr_palloc(scratch_pool,
+                        (apr_size_t)length[0] * sizeof(*hb.match));
+  hb.chain_next = apr_palloc(scratch_pool,
+                             (apr_size_t)length[0] * sizeof(*hb.chain_next));
+  for (i = 0; i < length[0]; i++)
+    hb.match[i] = -1;
+
+  hb.count = apr_pcalloc(scratch_pool,
+                         (apr_size_t)num_tokens * sizeof(*hb.count));
+  hb.chain_head = apr_palloc(scratch_pool,
+                             (apr_size_t)num_tokens * sizeof(*hb.chain_head));
+  for (t = 0; t < num_tokens; t++)
+    hb.chain_head[t] = -1;
+
+  hb.dp = NULL;
+  hb.dp_size = 0;
+  hb.budget = (apr_int64_t)SVN_DIFF__HISTOGRAM_WORK_PER_LINE
+              * (length[0] + length[1]);
+
+  /* Process regions until none are left.  The order doesn't matter, as
+     each one only records matches within its own bounds. */
+  hb.regions = apr_array_make(scratch_pool, 16, sizeof(histogram_region_t));
+  region = apr_array_push(hb.regions);
+  region->lo[0] = region->lo[1] = 0;
+  region->hi[0] = length[0];
+  region->hi[1] = length[1];
+
+  while (hb.regions->nelts)
+    {
+      histogram_region_t next = *(histogram_region_t *)apr_array_pop(
+                                                          hb.regions);
+      histogram_diff_region(&hb, next);
+    }
+
+  /* Turn runs of matching lines into the lcs list, back to front. */
+  if (suffix_lines)
+    lcs = prepend_lcs(lcs, suffix_lines,
+                      eof_lcs->position[0]->offset - suffix_lines,
+                      eof_lcs->position[1]->offset - suffix_lines,
+                      pool);
+
+  i = length[0];
+  while (i > 0)
+    {
+      apr_off_t end;
+      svn_diff__lcs_t *new_lcs;
+
+      if (hb.match[--i] < 0)
+        continue;
+
+      end = i + 1;
+      while (i > 0 && hb.match[i - 1] >= 0
+             && hb.match[i - 1] == hb.match[i] - 1)
+        i--;
+
+      new_lcs = apr_palloc(pool, sizeof(*new_lcs));
+      new_lcs->position[0] = hb.position[0][i];
+      new_lcs->position[1] = hb.position[1][hb.match[i]];
+      new_lcs->length = end - i;
+      new_lcs->refcount = 1;
+      new_lcs->next = lcs;
+      lcs = new_lcs;
+    }
+
+  svn_pool_destroy(scratch_pool);
+
+  if (prefix_lines)
+    return prepend_lcs(lcs, prefix_lines, 1, 1, pool);
+  else
+    return lcs;
+}
+
+
 svn_diff__lcs_t *
 svn_diff__lcs(svn_diff__position_t *position_list1, /* pointer to tail (ring) */
               svn_diff__position_t *position_list2, /* pointer to tail (ring) */
@@ -236,6 +616,7 @@ svn_diff__lcs(svn_diff__position_t *position_list1, /* pointer to tail (ring) */
               svn_diff__token_index_t num_tokens,
               apr_off_t prefix_lines,
               apr_off_t suffix_lines,
+              svn_diff_algorithm_t algorithm,
               apr_pool_t *pool)
 {
   apr_off_t length[2];
@@ -279,6 +660,10 @@ svn_diff__lcs(svn_diff__position_t *position_list1, /* pointer to tail (ring) */
       return lcs;
     }
 
+  if (algorithm == svn_diff_algorithm_histogram)
+    return lcs_histogram(lcs, position_list1, position_list2, num_tokens,
+                         prefix_lines, suffix_lines, pool);
+
   unique_count[1] = unique_count[0] = 0;
   for (token_index = 0; token_index < num_tokens; token_index++)
     {
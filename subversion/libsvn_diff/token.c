@@ -34,25 +34,33 @@
 
 
 /*
- * Prime number to use as the size of the hash table.  This number was
- * not selected by testing of any kind and may need tweaking.
+ * Initial number of slots in the token table; must be a power of two.
+ * The table doubles in size whenever it becomes half full.
  */
-#define SVN_DIFF__HASH_SIZE 127
+#define SVN_DIFF__TABLE_INITIAL_SIZE 1024
 
+/* A slot in the token table. */
 struct svn_diff__node_t
 {
-  svn_diff__node_t       *parent;
-  svn_diff__node_t       *left;
-  svn_diff__node_t       *right;
-
+  /* The token's hash as returned by datasource_get_next_token. */
   apr_uint32_t            hash;
+
+  /* The token's dense index: tokens are numbered in the order in which
+     they are first seen. */
   svn_diff__token_index_t index;
+
+  /* The most recently seen instance of the token, NULL for an empty
+     slot. */
   void                   *token;
 };
 
+/* The distinct tokens of all datasources, interned in an open-addressed
+   hash table with linear probing.  Keeping the table in one contiguous
+   array makes lookups cheap even for files with millions of lines. */
 struct svn_diff__tree_t
 {
-  svn_diff__node_t       *root[SVN_DIFF__HASH_SIZE];
+  svn_diff__node_t       *table;
+  apr_uint32_t            mask;  /* Number of slots in TABLE minus one. */
   apr_pool_t             *pool;
   svn_diff__token_index_t node_count;
 };
@@ -75,68 +83,108 @@ void
 svn_diff__tree_create(svn_diff__tree_t **tree, apr_pool_t *pool)
 {
   *tree = apr_pcalloc(pool, sizeof(**tree));
+  (*tree)->table = apr_pcalloc(pool, SVN_DIFF__TABLE_INITIAL_SIZE
+                                     * sizeof(*(*tree)->table));
+  (*tree)->mask = SVN_DIFF__TABLE_INITIAL_SIZE - 1;
   (*tree)->pool = pool;
   (*tree)->node_count = 0;
 }
 
 
+/* Return the slot number where probing for HASH starts.  The token
+ * hashes are not necessarily well distributed in their lower bits, so
+ * mix them up first.
+ */
+static APR_INLINE apr_uint32_t
+table_start_slot(const svn_diff__tree_t *tree, apr_uint32_t hash)
+{
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6b;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35;
+  hash ^= hash >> 16;
+
+  return hash & tree->mask;
+}
+
+
+/* Double the number of slots in TREE's table. */
+static void
+table_grow(svn_diff__tree_t *tree)
+{
+  svn_diff__node_t *old_table = tree->table;
+  apr_uint32_t old_size = tree->mask + 1;
+  apr_uint32_t i;
+
+  tree->mask = old_size * 2 - 1;
+  tree->table = apr_pcalloc(tree->pool,
+                            (apr_size_t)old_size * 2 * sizeof(*tree->table));
+
+  for (i = 0; i < old_size; i++)
+    if (old_table[i].token)
+      {
+        apr_uint32_t slot = table_start_slot(tree, old_table[i].hash);
+
+        while (tree->table[slot].token)
+          slot = (slot + 1) & tree->mask;
+
+        tree->table[slot] = old_table[i];
+      }
+}
+
+
+/* Intern TOKEN with HASH in TREE and return its index in *INDEX.  If
+ * DISCARD is TRUE, hand the superseded instance of a token already in
+ * TREE to VTABLE's token_discard function.
+ */
 static svn_error_t *
-tree_insert_token(svn_diff__node_t **node, svn_diff__tree_t *tree,
+tree_insert_token(svn_diff__token_index_t *index, svn_diff__tree_t *tree,
                   void *diff_baton,
                   const svn_diff_fns2_t *vtable,
-                  apr_uint32_t hash, void *token)
+                  apr_uint32_t hash, void *token,
+                  svn_boolean_t discard)
 {
-  svn_diff__node_t *new_node;
-  svn_diff__node_t **node_ref;
-  svn_diff__node_t *parent;
+  svn_diff__node_t *node;
+  apr_uint32_t slot;
   int rv;
 
   SVN_ERR_ASSERT(token);
 
-  parent = NULL;
-  node_ref = &tree->root[hash % SVN_DIFF__HASH_SIZE];
+  /* Keep the table at most half full, so probe sequences stay short. */
+  if ((apr_uint64_t)(tree->node_count + 1) * 2 > (apr_uint64_t)tree->mask + 1)
+    table_grow(tree);
 
-  while (*node_ref != NULL)
+  for (slot = table_start_slot(tree, hash);
+       tree->table[slot].token;
+       slot = (slot + 1) & tree->mask)
     {
-      parent = *node_ref;
-
-      rv = hash - parent->hash;
-      if (!rv)
-        SVN_ERR(vtable->token_compare(diff_baton, parent->token, token, &rv));
+      node = &tree->table[slot];
+      if (node->hash != hash)
+        continue;
 
+      SVN_ERR(vtable->token_compare(diff_baton, node->token, token, &rv));
       if (rv == 0)
         {
           /* Discard the previous token.  This helps in cases where
            * only recently read tokens are still in memory.
            */
-          if (vtable->token_discard != NULL)
-            vtable->token_discard(diff_baton, parent->token);
+          if (discard && vtable->token_discard != NULL)
+            vtable->token_discard(diff_baton, node->token);
 
-          parent->token = token;
-          *node = parent;
+          node->token = token;
+          *index = node->index;
 
           return SVN_NO_ERROR;
         }
-      else if (rv > 0)
-        {
-          node_ref = &parent->left;
-        }
-      else
-        {
-          node_ref = &parent->right;
-        }
     }
 
-  /* Create a new node */
-  new_node = apr_palloc(tree->pool, sizeof(*new_node));
-  new_node->parent = parent;
-  new_node->left = NULL;
-  new_node->right = NULL;
-  new_node->hash = hash;
-  new_node->token = token;
-  new_node->index = tree->node_count++;
+  /* Claim the empty slot for a new token */
+  node = &tree->table[slot];
+  node->hash = hash;
+  node->token = token;
+  node->index = tree->node_count++;
 
-  *node = *node_ref = new_node;
+  *index = node->index;
 
   return SVN_NO_ERROR;
 }
@@ -158,7 +206,7 @@ svn_diff__get_tokens(svn_diff__position_t **position_list,
   svn_diff__position_t *start_position;
   svn_diff__position_t *position = NULL;
   svn_diff__position_t **position_ref;
-  svn_diff__node_t *node;
+  svn_diff__token_index_t token_index;
   void *token;
   apr_off_t offset;
   apr_uint32_t hash;
@@ -176,12 +224,13 @@ svn_diff__get_tokens(svn_diff__position_t **position_list,
         break;
 
       offset++;
-      SVN_ERR(tree_insert_token(&node, tree, diff_baton, vtable, hash, token));
+      SVN_ERR(tree_insert_token(&token_index, tree, diff_baton, vtable,
+                                hash, token, TRUE));
 
       /* Create a new position */
       position = apr_palloc(pool, sizeof(*position));
       position->next = NULL;
-      position->token_index = node->index;
+      position->token_index = token_index;
       position->offset = offset;
 
       *position_ref = position;
@@ -196,3 +245,38 @@ svn_diff__get_tokens(svn_diff__position_t **position_list,
 
   return SVN_NO_ERROR;
 }
+
+
+svn_error_t *
+svn_diff__insert_tokens(svn_diff__position_t **position_list,
+                        svn_diff__tree_t *tree,
+                        void *diff_baton,
+                        const svn_diff_fns2_t *vtable,
+                        void *const *tokens,
+                        const apr_uint32_t *hashes,
+                        apr_off_t count,
+                        apr_off_t offset,
+                        apr_pool_t *pool)
+{
+  svn_diff__position_t *positions;
+  apr_off_t i;
+
+  *position_list = NULL;
+  if (count == 0)
+    return SVN_NO_ERROR;
+
+  positions = apr_palloc(pool, (apr_size_t)count * sizeof(*positions));
+  for (i = 0; i < count; i++)
+    {
+      SVN_ERR(tree_insert_token(&positions[i].token_index, tree,
+                                diff_baton, vtable, hashes[i], tokens[i],
+                                FALSE));
+      positions[i].offset = offset + i + 1;
+      positions[i].next = &positions[i + 1];
+    }
+
+  positions[count - 1].next = &positions[0];
+  *position_list = &positions[count - 1];
+
+  return SVN_NO_ERROR;
+}
@@ -404,10 +404,10 @@ svn_fs_verify(const char *path,
   SVN_ERR(fs_library_vtable(&vtable, path, pool));
   fs = fs_new(NULL, pool);
 
-  SVN_MUTEX__WITH_LOCK(common_pool_lock,
-                       vtable->verify_fs(fs, path, cancel_func, cancel_baton,
-                                         start, end, pool, common_pool));
-  return SVN_NO_ERROR;
+  return svn_error_trace(vtable->verify_fs(fs, path, cancel_func,
+                                           cancel_baton, start, end,
+                                           common_pool_lock,
+                                           pool, common_pool));
 }
 
 const char *
@@ -1208,6 +1208,19 @@ svn_fs_get_uuid(svn_fs_t *fs, const char **uuid, apr_pool_t *pool)
   return svn_error_trace(fs->vtable->get_uuid(fs, uuid, pool));
 }
 
+svn_error_t *
+svn_fs_get_delta_chain_stats(svn_fs_delta_chain_stats_t *stats,
+                             svn_fs_t *fs,
+                             apr_pool_t *pool)
+{
+  if (fs->vtable->get_delta_chain_stats == NULL)
+    return svn_error_create(SVN_ERR_UNSUPPORTED_FEATURE, NULL,
+                            _("The filesystem back-end does not gather "
+                              "delta chain statistics"));
+
+  return svn_error_trace(fs->vtable->get_delta_chain_stats(stats, fs, pool));
+}
+
 svn_error_t *
 svn_fs_set_uuid(svn_fs_t *fs, const char *uuid, apr_pool_t *pool)
 {
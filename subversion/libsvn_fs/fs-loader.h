@@ -27,6 +27,7 @@
 
 #include "svn_types.h"
 #include "svn_fs.h"
+#include "private/svn_mutex.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -87,11 +88,15 @@ typedef struct fs_library_vtable_t
                                        apr_pool_t *common_pool);
   svn_error_t *(*upgrade_fs)(svn_fs_t *fs, const char *path, apr_pool_t *pool,
                              apr_pool_t *common_pool);
+  /* verify_fs() is not serialized, so that several verifications may
+     run concurrently.  It must hold COMMON_POOL_LOCK while using
+     COMMON_POOL. */
   svn_error_t *(*verify_fs)(svn_fs_t *fs, const char *path,
                             /* ### notification? */
                             svn_cancel_func_t cancel_func, void *cancel_baton,
                             svn_revnum_t start,
                             svn_revnum_t end,
+                            svn_mutex__t *common_pool_lock,
                             apr_pool_t *pool,
                             apr_pool_t *common_pool);
   svn_error_t *(*delete_fs)(const char *path, apr_pool_t *pool);
@@ -122,6 +127,14 @@ typedef struct fs_library_vtable_t
      into the FS vtable. */
   svn_fs_id_t *(*parse_id)(const char *data, apr_size_t len,
                            apr_pool_t *pool);
+
+  /* Write the contents of the process-wide cache to the file PATH, or
+     read them back from there and set *LOADED accordingly.  Providers
+     that don't use that cache leave these NULL. */
+  svn_error_t *(*save_cache)(const char *path, apr_pool_t *pool,
+                             apr_pool_t *common_pool);
+  svn_error_t *(*load_cache)(svn_boolean_t *loaded, const char *path,
+                             apr_pool_t *pool, apr_pool_t *common_pool);
 } fs_library_vtable_t;
 
 /* This is the type of symbol an FS module defines to fetch the
@@ -205,6 +218,9 @@ typedef struct fs_vtable_t
   svn_error_t *(*bdb_set_errcall)(svn_fs_t *fs,
                                   void (*handler)(const char *errpfx,
                                                   char *msg));
+  /* NULL for providers that don't gather delta chain statistics. */
+  svn_error_t *(*get_delta_chain_stats)(svn_fs_delta_chain_stats_t *stats,
+                                        svn_fs_t *fs, apr_pool_t *pool);
 } fs_vtable_t;
 
 
@@ -503,6 +503,7 @@ static fs_vtable_t fs_vtable = {
   svn_fs_base__get_lock,
   svn_fs_base__get_locks,
   base_bdb_set_errcall,
+  NULL /* get_delta_chain_stats */
 };
 
 /* Where the format number is stored. */
@@ -885,6 +886,7 @@ base_verify(svn_fs_t *fs, const char *path,
             void *cancel_baton,
             svn_revnum_t start,
             svn_revnum_t end,
+            svn_mutex__t *common_pool_lock,
             apr_pool_t *pool,
             apr_pool_t *common_pool)
 {
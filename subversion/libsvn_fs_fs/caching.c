@@ -29,6 +29,11 @@
 
 #include "svn_config.h"
 #include "svn_cache_config.h"
+#include "svn_dirent_uri.h"
+#include "svn_io.h"
+#include "svn_pools.h"
+#include "svn_string.h"
+#include "private/svn_string_private.h"
 
 #include "svn_private_config.h"
 #include "svn_hash.h"
@@ -322,6 +327,20 @@ svn_fs_fs__initialize_caches(svn_fs_t *fs,
 
   SVN_ERR(init_callbacks(ffd->packed_offset_cache, fs, no_handler, pool));
 
+  /* Item indexes are stored in the same format as the manifests. */
+  SVN_ERR(create_cache(&(ffd->item_index_cache),
+                       NULL,
+                       membuffer,
+                       32, 1,
+                       svn_fs_fs__serialize_manifest,
+                       svn_fs_fs__deserialize_manifest,
+                       sizeof(svn_revnum_t),
+                       apr_pstrcat(pool, prefix, "PACK-ITEM-INDEX",
+                                   (char *)NULL),
+                       fs->pool));
+
+  SVN_ERR(init_callbacks(ffd->item_index_cache, fs, no_handler, pool));
+
   /* initialize fulltext cache as configured */
   ffd->fulltext_cache = NULL;
   if (cache_fulltexts)
@@ -394,6 +413,19 @@ svn_fs_fs__initialize_caches(svn_fs_t *fs,
 
   SVN_ERR(init_callbacks(ffd->node_revision_cache, fs, no_handler, pool));
 
+  /* initialize revprop cache, if caching has been enabled */
+  SVN_ERR(create_cache(&(ffd->revprop_cache),
+                       NULL,
+                       membuffer,
+                       0, 0, /* Do not use inprocess cache */
+                       svn_fs_fs__serialize_properties,
+                       svn_fs_fs__deserialize_properties,
+                       APR_HASH_KEY_STRING,
+                       apr_pstrcat(pool, prefix, "REVPROP", (char *)NULL),
+                       fs->pool));
+
+  SVN_ERR(init_callbacks(ffd->revprop_cache, fs, no_handler, pool));
+
   return SVN_NO_ERROR;
 }
 
@@ -504,3 +536,187 @@ svn_fs_fs__reset_txn_caches(svn_fs_t *fs)
   fs_fs_data_t *ffd = fs->fsap_data;
   ffd->txn_dir_cache = NULL;
 }
+
+/* Key of the COMMON_POOL userdata holding the hash of all repositories
+   (fs paths mapped to UUIDs) that have been opened in this process and
+   may, therefore, have data in the process-wide membuffer cache. */
+#define CACHED_REPOSITORIES_KEY "svn-fsfs-cached-repositories"
+
+/* Return the hash of cached repositories stored in COMMON_POOL.
+   Create it if it does not exist, yet. */
+static apr_hash_t *
+get_cached_repositories(apr_pool_t *common_pool)
+{
+  void *val = NULL;
+
+  apr_pool_userdata_get(&val, CACHED_REPOSITORIES_KEY, common_pool);
+  if (val == NULL)
+    {
+      val = apr_hash_make(common_pool);
+      apr_pool_userdata_set(val, CACHED_REPOSITORIES_KEY, NULL,
+                            common_pool);
+    }
+
+  return val;
+}
+
+void
+svn_fs_fs__register_cached_repository(svn_fs_t *fs,
+                                      apr_pool_t *common_pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  apr_hash_t *repositories;
+
+  if (svn_cache__get_global_membuffer_cache() == NULL)
+    return;
+
+  repositories = get_cached_repositories(common_pool);
+  if (apr_hash_get(repositories, fs->path, APR_HASH_KEY_STRING) == NULL)
+    apr_hash_set(repositories,
+                 apr_pstrdup(common_pool, fs->path), APR_HASH_KEY_STRING,
+                 apr_pstrdup(common_pool, ffd->uuid));
+}
+
+svn_error_t *
+svn_fs_fs__save_cache(const char *path,
+                      apr_pool_t *pool,
+                      apr_pool_t *common_pool)
+{
+  svn_membuffer_t *membuffer = svn_cache__get_global_membuffer_cache();
+  svn_stringbuf_t *validation = svn_stringbuf_create_empty(pool);
+  apr_hash_index_t *hi;
+  apr_pool_t *iterpool;
+
+  if (membuffer == NULL)
+    return SVN_NO_ERROR;
+
+  /* One line per repository: "<uuid> <youngest rev> <fs path>".
+     Repositories that have been removed since need not be validated. */
+  iterpool = svn_pool_create(pool);
+  for (hi = apr_hash_first(pool, get_cached_repositories(common_pool));
+       hi;
+       hi = apr_hash_next(hi))
+    {
+      const char *fs_path = svn__apr_hash_index_key(hi);
+      const char *uuid = svn__apr_hash_index_val(hi);
+      svn_revnum_t youngest;
+      svn_error_t *err;
+
+      svn_pool_clear(iterpool);
+      err = svn_fs_fs__read_youngest(&youngest, fs_path, iterpool);
+      if (err && APR_STATUS_IS_ENOENT(err->apr_err))
+        {
+          svn_error_clear(err);
+          continue;
+        }
+      SVN_ERR(err);
+
+      svn_stringbuf_appendcstr(validation,
+                               apr_psprintf(iterpool, "%s %ld %s\n",
+                                            uuid, youngest, fs_path));
+    }
+  svn_pool_destroy(iterpool);
+
+  /* Without any repository to validate against, nobody could tell
+     whether the cached data is still current when loading it again.
+     That is the case in processes that did not open the repositories
+     themselves, e.g. a parent of forked workers. */
+  if (validation->len == 0)
+    return SVN_NO_ERROR;
+
+  return svn_error_trace(svn_cache__membuffer_cache_save(
+                           membuffer, path,
+                           svn_stringbuf__morph_into_string(validation),
+                           pool));
+}
+
+/* Implements svn_cache__validate_func_t.  VALIDATION contains lines as
+   written by svn_fs_fs__save_cache.  Reject the snapshot if it lists no
+   repositories at all or if any of them got a different UUID or fewer
+   revisions.
+   BATON is the COMMON_POOL to register the surviving repositories in,
+   so that they will be listed again in the next snapshot. */
+static svn_error_t *
+validate_cache_snapshot(svn_boolean_t *valid,
+                        void *baton,
+                        const svn_string_t *validation,
+                        apr_pool_t *scratch_pool)
+{
+  apr_array_header_t *lines = svn_cstring_split(validation->data, "\n",
+                                                TRUE, scratch_pool);
+  apr_pool_t *iterpool = svn_pool_create(scratch_pool);
+  int i;
+
+  *valid = lines->nelts > 0;
+  for (i = 0; i < lines->nelts && *valid; ++i)
+    {
+      char *line = APR_ARRAY_IDX(lines, i, char *);
+      char *last_str;
+      const char *uuid = apr_strtok(line, " ", &last_str);
+      const char *rev_str = apr_strtok(NULL, " ", &last_str);
+      const char *fs_path = last_str;
+      apr_file_t *uuid_file;
+      char buf[APR_UUID_FORMATTED_LENGTH + 2];
+      apr_size_t limit = sizeof(buf);
+      svn_revnum_t youngest;
+      svn_error_t *err;
+
+      svn_pool_clear(iterpool);
+
+      /* Don't trust malformed data. */
+      if (uuid == NULL || rev_str == NULL || *fs_path == '\0')
+        {
+          *valid = FALSE;
+          break;
+        }
+
+      /* Cached data of repositories that no longer exist cannot be
+         accessed anymore. */
+      err = svn_io_file_open(&uuid_file,
+                             svn_dirent_join(fs_path, PATH_UUID, iterpool),
+                             APR_READ | APR_BUFFERED, APR_OS_DEFAULT,
+                             iterpool);
+      if (err && APR_STATUS_IS_ENOENT(err->apr_err))
+        {
+          svn_error_clear(err);
+          continue;
+        }
+      SVN_ERR(err);
+
+      SVN_ERR(svn_io_read_length_line(uuid_file, buf, &limit, iterpool));
+      SVN_ERR(svn_io_file_close(uuid_file, iterpool));
+      SVN_ERR(svn_fs_fs__read_youngest(&youngest, fs_path, iterpool));
+
+      *valid = strcmp(buf, uuid) == 0
+            && youngest >= SVN_STR_TO_REV(rev_str);
+      if (*valid)
+        {
+          apr_pool_t *common_pool = baton;
+          apr_hash_set(get_cached_repositories(common_pool),
+                       apr_pstrdup(common_pool, fs_path), APR_HASH_KEY_STRING,
+                       apr_pstrdup(common_pool, uuid));
+        }
+    }
+
+  svn_pool_destroy(iterpool);
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_fs_fs__load_cache(svn_boolean_t *loaded,
+                      const char *path,
+                      apr_pool_t *pool,
+                      apr_pool_t *common_pool)
+{
+  svn_membuffer_t *membuffer = svn_cache__get_global_membuffer_cache();
+
+  *loaded = FALSE;
+  if (membuffer == NULL)
+    return SVN_NO_ERROR;
+
+  SVN_ERR(svn_cache__membuffer_cache_load(loaded, membuffer, path,
+                                          validate_cache_snapshot,
+                                          common_pool, pool));
+
+  return SVN_NO_ERROR;
+}
@@ -122,6 +122,16 @@ fs_set_errcall(svn_fs_t *fs,
   return SVN_NO_ERROR;
 }
 
+/* This implements the fs_vtable_t.get_delta_chain_stats() API. */
+static svn_error_t *
+fs_get_delta_chain_stats(svn_fs_delta_chain_stats_t *stats,
+                         svn_fs_t *fs,
+                         apr_pool_t *pool)
+{
+  svn_fs_fs__get_delta_chain_stats(stats, fs);
+  return SVN_NO_ERROR;
+}
+
 
 
 /* The vtable associated with a specific open filesystem. */
@@ -143,7 +153,8 @@ static fs_vtable_t fs_vtable = {
   svn_fs_fs__unlock,
   svn_fs_fs__get_lock,
   svn_fs_fs__get_locks,
-  fs_set_errcall
+  fs_set_errcall,
+  fs_get_delta_chain_stats
 };
 
 
@@ -154,6 +165,8 @@ static svn_error_t *
 initialize_fs_struct(svn_fs_t *fs)
 {
   fs_fs_data_t *ffd = apr_pcalloc(fs->pool, sizeof(*ffd));
+  ffd->pack_mappings = apr_hash_make(fs->pool);
+  SVN_ERR(svn_mutex__init(&ffd->pack_mappings_lock, TRUE, fs->pool));
   fs->vtable = &fs_vtable;
   fs->fsap_data = ffd;
   return SVN_NO_ERROR;
@@ -194,6 +207,7 @@ fs_open(svn_fs_t *fs, const char *path, apr_pool_t *pool,
   SVN_ERR(svn_fs_fs__open(fs, path, pool));
 
   SVN_ERR(svn_fs_fs__initialize_caches(fs, pool));
+  svn_fs_fs__register_cached_repository(fs, common_pool);
   return fs_serialized_init(fs, common_pool, pool);
 }
 
@@ -245,6 +259,7 @@ fs_verify(svn_fs_t *fs, const char *path,
           void *cancel_baton,
           svn_revnum_t start,
           svn_revnum_t end,
+          svn_mutex__t *common_pool_lock,
           apr_pool_t *pool,
           apr_pool_t *common_pool)
 {
@@ -252,7 +267,12 @@ fs_verify(svn_fs_t *fs, const char *path,
   SVN_ERR(initialize_fs_struct(fs));
   SVN_ERR(svn_fs_fs__open(fs, path, pool));
   SVN_ERR(svn_fs_fs__initialize_caches(fs, pool));
-  SVN_ERR(fs_serialized_init(fs, common_pool, pool));
+
+  /* Only the shared data needs the lock.  The verification itself may
+     take long and must not block other threads verifying the same
+     repository. */
+  SVN_MUTEX__WITH_LOCK(common_pool_lock,
+                       fs_serialized_init(fs, common_pool, pool));
   return svn_fs_fs__verify(fs, cancel_func, cancel_baton, start, end, pool);
 }
 
@@ -361,7 +381,10 @@ static fs_library_vtable_t library_vtable = {
   fs_get_description,
   svn_fs_fs__recover,
   fs_pack,
-  fs_logfiles
+  fs_logfiles,
+  NULL /* parse_id */,
+  svn_fs_fs__save_cache,
+  svn_fs_fs__load_cache
 };
 
 svn_error_t *
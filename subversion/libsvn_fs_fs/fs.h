@@ -62,6 +62,12 @@ extern "C" {
                                                     has not been packed. */
 /* If you change this, look at tests/svn_test_fs.c(maybe_install_fsfs_conf) */
 #define PATH_CONFIG           "fsfs.conf"        /* Configuration */
+#define PATH_REVPROP_GENERATION "revprop-generation"
+                                                 /* Current revprop generation*/
+#define PATH_MANIFEST         "manifest"         /* Manifest of packed
+                                                    revprop shards */
+#define PATH_ITEM_INDEX       "item-index"       /* Item locations in a
+                                                    reordered pack file */
 
 /* Names of special files and file extensions for transactions */
 #define PATH_CHANGES       "changes"       /* Records changes made so far */
@@ -82,11 +88,21 @@ extern "C" {
 #define CONFIG_OPTION_FAIL_STOP          "fail-stop"
 #define CONFIG_SECTION_REP_SHARING       "rep-sharing"
 #define CONFIG_OPTION_ENABLE_REP_SHARING "enable-rep-sharing"
+#define CONFIG_SECTION_PACKED_REVPROPS   "packed-revprops"
+#define CONFIG_OPTION_REVPROP_PACK_SIZE  "revprop-pack-size"
+#define CONFIG_SECTION_PACKING           "packing"
+#define CONFIG_OPTION_PACK_THREADS       "pack-threads"
+#define CONFIG_OPTION_REORDER_ITEMS      "reorder-items"
+#define CONFIG_SECTION_DELTIFICATION     "deltification"
+#define CONFIG_OPTION_MAX_DELTA_CHAIN_LENGTH "max-delta-chain-length"
+#define CONFIG_OPTION_DELTA_WINDOW_SIZE  "delta-window-size"
+#define CONFIG_OPTION_COMPRESSION        "compression"
+#define CONFIG_OPTION_COMPRESSION_THREADS "compression-threads"
 
 /* The format number of this filesystem.
    This is independent of the repository format number, and
    independent of any other FS back ends. */
-#define SVN_FS_FS__FORMAT_NUMBER   4
+#define SVN_FS_FS__FORMAT_NUMBER   7
 
 /* The minimum format number that supports svndiff version 1.  */
 #define SVN_FS_FS__MIN_SVNDIFF1_FORMAT 2
@@ -122,8 +138,30 @@ extern "C" {
    revprops.db . */
 #define SVN_FS_FS__PACKED_REVPROP_SQLITE_DEV_FORMAT 5
 
-/* The minimum format number that supports packed revprop shards. */
-#define SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT SVN_FS_FS__PACKED_REVPROP_SQLITE_DEV_FORMAT
+/* The minimum format number that supports packed revprop shards.
+   These are stored as plain files in revprops/<shard>.pack/ together
+   with a manifest, unlike the SQLite-based dev format. */
+#define SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT 6
+
+/* The minimum format number that stores pack manifests as arrays of
+   fixed-width binary offsets instead of lines of decimal text. */
+#define SVN_FS_FS__MIN_BINARY_MANIFEST_FORMAT 7
+
+/* The minimum format number that may store the items of a pack file
+   in a different order than their revision files plus an item index
+   to locate them. */
+#define SVN_FS_FS__MIN_PACK_ITEM_INDEX_FORMAT 7
+
+/* The minimum format number that may store svndiff windows larger than
+   the 100 kB that older releases accept. */
+#define SVN_FS_FS__MIN_LARGE_DELTA_WINDOW_FORMAT 7
+
+/* The minimum format number that may store deltas in svndiff version 2,
+   i.e. compressed with LZ4 instead of zlib. */
+#define SVN_FS_FS__MIN_SVNDIFF2_FORMAT 7
+
+/* Upper limit for the number of shards packed concurrently. */
+#define SVN_FS_FS__MAX_PACK_THREADS 64
 
 /* The minimum format number that supports a configuration file (fsfs.conf) */
 #define SVN_FS_FS__MIN_CONFIG_FILE 4
@@ -243,6 +281,17 @@ typedef struct fs_fs_data_t
      respective pack file. */
   svn_cache__t *packed_offset_cache;
 
+  /* Memory mappings of pack files, keyed by shard number (apr_int64_t).
+     Filled on demand; see get_pack_mapping() in fs_fs.c.  All access to
+     it is synchronised under PACK_MAPPINGS_LOCK. */
+  apr_hash_t *pack_mappings;
+  svn_mutex__t *pack_mappings_lock;
+
+  /* Cache for item indexes of reordered pack files, keyed by shard
+     number (svn_revnum_t).  The values are apr_off_t arrays as described
+     for svn_fs_fs__get_item_offset(). */
+  svn_cache__t *item_index_cache;
+
   /* Cache for txdelta_window_t objects; the key is (revFilePath, offset) */
   svn_cache__t *txdelta_window_cache;
 
@@ -253,6 +302,10 @@ typedef struct fs_fs_data_t
   /* Cache for node_revision_t objects; the key is (revision, id offset) */
   svn_cache__t *node_revision_cache;
 
+  /* Cache for revprop hashes; the key is (revision, revprop generation).
+     NULL if revprops shall not be cached. */
+  svn_cache__t *revprop_cache;
+
   /* If set, there are or have been more than one concurrent transaction */
   svn_boolean_t concurrent_transactions;
 
@@ -269,9 +322,40 @@ typedef struct fs_fs_data_t
   /* Thread-safe boolean */
   svn_atomic_t rep_cache_db_opened;
 
-  /* The oldest revision not in a pack file. */
+  /* The oldest revision not in a pack file.  Starting with
+     SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT, this applies to the
+     revprops as well, except for those of r0. */
   svn_revnum_t min_unpacked_rev;
 
+  /* Size limit in bytes for the files that packed revprops are
+     stored in. */
+  apr_int64_t revprop_pack_size;
+
+  /* Number of shards that 'svnadmin pack' may pack concurrently. */
+  int pack_threads;
+
+  /* Whether 'svnadmin pack' shall group items by path instead of
+     concatenating the revision files. */
+  svn_boolean_t pack_reorder_items;
+
+  /* Maximum number of representations that reading a new file
+     representation may have to combine.  Longer chains will be cut by
+     storing a self-compressed fulltext.  0 means no limit. */
+  int max_delta_chain_length;
+
+  /* Maximum size of the svndiff windows written for new representations.
+     0 selects the default size. */
+  apr_size_t delta_window_size;
+
+  /* Whether to compress new deltas with LZ4 (svndiff2) instead of zlib. */
+  svn_boolean_t delta_compression_lz4;
+
+  /* Number of threads compressing the windows of new deltas. */
+  int delta_compression_threads;
+
+  /* Delta chain statistics for the reads through this svn_fs_t. */
+  svn_fs_delta_chain_stats_t delta_chain_stats;
+
   /* Whether rep-sharing is supported by the filesystem
    * and allowed by the configuration. */
   svn_boolean_t rep_sharing_allowed;
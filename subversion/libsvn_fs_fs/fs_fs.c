@@ -33,9 +33,11 @@
 #include <apr_uuid.h>
 #include <apr_lib.h>
 #include <apr_md5.h>
+#include <apr_mmap.h>
 #include <apr_sha1.h>
 #include <apr_strings.h>
 #include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
 
 #include "svn_pools.h"
 #include "svn_fs.h"
@@ -60,6 +62,7 @@
 #include "temp_serializer.h"
 
 #include "private/svn_fs_util.h"
+#include "private/svn_string_private.h"
 #include "../libsvn_fs/fs-loader.h"
 
 #include "svn_private_config.h"
@@ -164,6 +167,29 @@ update_min_unpacked_rev(svn_fs_t *fs, apr_pool_t *pool);
 static svn_error_t *
 get_youngest(svn_revnum_t *youngest_p, const char *fs_path, apr_pool_t *pool);
 
+static svn_error_t *
+pack_revprops_shard(const char *pack_file_dir,
+                    const char *shard_path,
+                    apr_int64_t shard,
+                    int max_files_per_dir,
+                    apr_int64_t max_pack_size,
+                    svn_cancel_func_t cancel_func,
+                    void *cancel_baton,
+                    apr_pool_t *pool);
+
+static svn_error_t *
+delete_revprops_shard(const char *shard_path,
+                      apr_int64_t shard,
+                      int max_files_per_dir,
+                      svn_cancel_func_t cancel_func,
+                      void *cancel_baton,
+                      apr_pool_t *pool);
+
+static svn_error_t *
+convert_manifest_to_binary(const char *path,
+                           int max_files_per_dir,
+                           apr_pool_t *pool);
+
 /* Pathname helper functions */
 
 /* Return TRUE is REV is packed in FS, FALSE otherwise. */
@@ -175,17 +201,16 @@ is_packed_rev(svn_fs_t *fs, svn_revnum_t rev)
   return (rev < ffd->min_unpacked_rev);
 }
 
-/* Return TRUE is REV is packed in FS, FALSE otherwise. */
+/* Return TRUE is REV's revprops are packed in FS, FALSE otherwise.
+   The revprops of r0 never get packed. */
 static svn_boolean_t
 is_packed_revprop(svn_fs_t *fs, svn_revnum_t rev)
 {
-#if 0
   fs_fs_data_t *ffd = fs->fsap_data;
 
-  return (rev < ffd->min_unpacked_revprop);
-#else
-  return FALSE;
-#endif
+  return (rev < ffd->min_unpacked_rev)
+      && (rev != 0)
+      && (ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT);
 }
 
 static const char *
@@ -318,6 +343,24 @@ path_revprops(svn_fs_t *fs, svn_revnum_t rev, apr_pool_t *pool)
                               apr_psprintf(pool, "%ld", rev), NULL);
 }
 
+static const char *
+path_revprops_pack_shard(svn_fs_t *fs, svn_revnum_t rev, apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+
+  assert(ffd->max_files_per_dir);
+  return svn_dirent_join_many(pool, fs->path, PATH_REVPROPS_DIR,
+                              apr_psprintf(pool, "%ld.pack",
+                                           rev / ffd->max_files_per_dir),
+                              NULL);
+}
+
+static APR_INLINE const char *
+path_revprop_generation(svn_fs_t *fs, apr_pool_t *pool)
+{
+  return svn_dirent_join(fs->path, PATH_REVPROP_GENERATION, pool);
+}
+
 static APR_INLINE const char *
 path_txn_dir(svn_fs_t *fs, const char *txn_id, apr_pool_t *pool)
 {
@@ -1082,6 +1125,104 @@ read_config(svn_fs_t *fs,
   else
     ffd->rep_sharing_allowed = FALSE;
 
+  /* Initialize ffd->revprop_pack_size. */
+  if (ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+    {
+      const char *value;
+
+      svn_config_get(ffd->config, &value, CONFIG_SECTION_PACKED_REVPROPS,
+                     CONFIG_OPTION_REVPROP_PACK_SIZE, "64");
+      SVN_ERR(svn_cstring_atoi64(&ffd->revprop_pack_size, value));
+      ffd->revprop_pack_size *= 1024;
+    }
+  else
+    ffd->revprop_pack_size = 0;
+
+  /* Initialize ffd->pack_threads. */
+  {
+    const char *value;
+
+    svn_config_get(ffd->config, &value, CONFIG_SECTION_PACKING,
+                   CONFIG_OPTION_PACK_THREADS, "1");
+    SVN_ERR(svn_cstring_atoi(&ffd->pack_threads, value));
+    if (ffd->pack_threads < 1)
+      ffd->pack_threads = 1;
+    else if (ffd->pack_threads > SVN_FS_FS__MAX_PACK_THREADS)
+      ffd->pack_threads = SVN_FS_FS__MAX_PACK_THREADS;
+  }
+
+  /* Initialize ffd->pack_reorder_items. */
+  if (ffd->format >= SVN_FS_FS__MIN_PACK_ITEM_INDEX_FORMAT)
+    SVN_ERR(svn_config_get_bool(ffd->config, &ffd->pack_reorder_items,
+                                CONFIG_SECTION_PACKING,
+                                CONFIG_OPTION_REORDER_ITEMS, FALSE));
+  else
+    ffd->pack_reorder_items = FALSE;
+
+  /* Initialize ffd->max_delta_chain_length. */
+  {
+    const char *value;
+
+    svn_config_get(ffd->config, &value, CONFIG_SECTION_DELTIFICATION,
+                   CONFIG_OPTION_MAX_DELTA_CHAIN_LENGTH, "0");
+    SVN_ERR(svn_cstring_atoi(&ffd->max_delta_chain_length, value));
+    if (ffd->max_delta_chain_length < 0)
+      ffd->max_delta_chain_length = 0;
+  }
+
+  /* Initialize ffd->delta_window_size. */
+  if (ffd->format >= SVN_FS_FS__MIN_LARGE_DELTA_WINDOW_FORMAT)
+    {
+      const char *value;
+      apr_int64_t window_size;
+
+      svn_config_get(ffd->config, &value, CONFIG_SECTION_DELTIFICATION,
+                     CONFIG_OPTION_DELTA_WINDOW_SIZE, "0");
+      SVN_ERR(svn_cstring_atoi64(&window_size, value));
+      if (window_size <= 0)
+        ffd->delta_window_size = 0;
+      else if (window_size > SVN_DELTA_MAX_WINDOW_SIZE / 1024)
+        ffd->delta_window_size = SVN_DELTA_MAX_WINDOW_SIZE;
+      else
+        ffd->delta_window_size = (apr_size_t)window_size * 1024;
+    }
+  else
+    ffd->delta_window_size = 0;
+
+  /* Initialize ffd->delta_compression_lz4. */
+  if (ffd->format >= SVN_FS_FS__MIN_SVNDIFF2_FORMAT)
+    {
+      const char *value;
+
+      svn_config_get(ffd->config, &value, CONFIG_SECTION_DELTIFICATION,
+                     CONFIG_OPTION_COMPRESSION, "zlib");
+      if (svn_cstring_casecmp(value, "lz4") == 0)
+        ffd->delta_compression_lz4 = TRUE;
+      else if (svn_cstring_casecmp(value, "zlib") == 0)
+        ffd->delta_compression_lz4 = FALSE;
+      else
+        return svn_error_createf(SVN_ERR_BAD_CONFIG_VALUE, NULL,
+                                 _("Invalid value '%s' for option '%s' in "
+                                   "section '%s'"), value,
+                                 CONFIG_OPTION_COMPRESSION,
+                                 CONFIG_SECTION_DELTIFICATION);
+    }
+  else
+    ffd->delta_compression_lz4 = FALSE;
+
+  /* Initialize ffd->delta_compression_threads. */
+  {
+    const char *value;
+
+    svn_config_get(ffd->config, &value, CONFIG_SECTION_DELTIFICATION,
+                   CONFIG_OPTION_COMPRESSION_THREADS, "1");
+    SVN_ERR(svn_cstring_atoi(&ffd->delta_compression_threads, value));
+    if (ffd->delta_compression_threads < 1)
+      ffd->delta_compression_threads = 1;
+    else if (ffd->delta_compression_threads > SVN_DELTA_MAX_THREADS)
+      ffd->delta_compression_threads = SVN_DELTA_MAX_THREADS;
+  }
+
   return SVN_NO_ERROR;
 }
 
@@ -1130,6 +1271,64 @@ write_config(svn_fs_t *fs,
 "### 'svnadmin verify' will check the rep-cache regardless of this setting." NL
 "### rep-sharing is enabled by default."                                     NL
 "# " CONFIG_OPTION_ENABLE_REP_SHARING " = true"                              NL
+""                                                                           NL
+"[" CONFIG_SECTION_PACKED_REVPROPS "]"                                       NL
+"### When packing a shard, 'svnadmin pack' also packs the revision"          NL
+"### properties of that shard into one or more pack files.  This parameter"  NL
+"### limits the size of each of these files in kBytes.  Larger files mean"   NL
+"### fewer files on disk but more data to rewrite whenever a revision"       NL
+"### property of a packed revision gets changed.  A revision whose"          NL
+"### properties exceed this limit will be stored in a file of its own."      NL
+"### The default is 64 kBytes."                                              NL
+"# " CONFIG_OPTION_REVPROP_PACK_SIZE " = 64"                                 NL
+""                                                                           NL
+"[" CONFIG_SECTION_PACKING "]"                                               NL
+"### 'svnadmin pack' can write the pack files of several shards at the"      NL
+"### same time.  This parameter sets the number of shards being packed"      NL
+"### concurrently.  Higher values speed up packing of large repositories"    NL
+"### on machines with multiple CPUs and fast storage, but only while the"    NL
+"### repository is not being served from the same disks.  The values are"   NL
+"### capped at 64.  The default is 1, i.e. shards get packed one by one."    NL
+"# " CONFIG_OPTION_PACK_THREADS " = 1"                                       NL
+"### By default, a pack file is the concatenation of the revision files of"  NL
+"### its shard.  If this is set to true, 'svnadmin pack' will instead group" NL
+"### the data of all revisions in a shard by path, such that reading e.g."   NL
+"### the history of a file or a checkout touches fewer, contiguous parts"    NL
+"### of the pack file.  Packing takes longer and an additional index file"   NL
+"### is being written per shard.  The default is false."                     NL
+"# " CONFIG_OPTION_REORDER_ITEMS " = false"                                  NL
+""                                                                           NL
+"[" CONFIG_SECTION_DELTIFICATION "]"                                         NL
+"### File contents are stored as deltas against earlier versions, which"    NL
+"### in turn may be deltas.  Reading a file must combine all deltas down"   NL
+"### to the first self-contained representation.  This parameter limits"   NL
+"### the number of representations being combined for newly committed"     NL
+"### file contents.  A commit that would exceed this limit stores the"      NL
+"### contents as a self-compressed fulltext instead, starting a new delta"  NL
+"### chain.  Lower values speed up reading frequently changed files at"     NL
+"### the expense of repository size.  The default is 0, i.e. no limit."    NL
+"# " CONFIG_OPTION_MAX_DELTA_CHAIN_LENGTH " = 0"                             NL
+"### Deltas are stored as a sequence of windows, each covering a range of"  NL
+"### the old and the new contents.  Changes that move data farther than"    NL
+"### one window cannot be expressed as copies and every window adds some"   NL
+"### overhead when reading.  This parameter sets the window size in kBytes" NL
+"### for newly stored deltas.  Values up to 16384 (16 MB) may reduce the"   NL
+"### size of large files in the repository but need more memory during"     NL
+"### commits.  Only Subversion 1.8 and later can read repositories of"      NL
+"### this format, so the larger windows never reach older readers."         NL
+"### The default is 0, i.e. the standard 100 kBytes."                       NL
+"# " CONFIG_OPTION_DELTA_WINDOW_SIZE " = 0"                                  NL
+"### Deltas get compressed before being stored.  'zlib' compresses well"   NL
+"### while 'lz4' is several times faster to decompress, which speeds up"    NL
+"### reading file contents in exchange for a larger repository.  The"       NL
+"### setting applies to newly stored deltas only.  The default is 'zlib'."  NL
+"# " CONFIG_OPTION_COMPRESSION " = zlib"                                     NL
+"### Compressing large deltas may take a significant part of the time it"   NL
+"### takes to commit them.  With values larger than 1, up to that many"     NL
+"### threads compress the delta windows while the next ones are being"      NL
+"### computed.  The stored data is the same in either case."               NL
+"### The default is 1, i.e. compress in the committing thread."            NL
+"# " CONFIG_OPTION_COMPRESSION_THREADS " = 1"                                NL
 
 ;
 #undef NL
@@ -1281,6 +1480,109 @@ upgrade_body(void *baton, apr_pool_t *pool)
   if (format < SVN_FS_FS__MIN_PACKED_FORMAT)
     SVN_ERR(svn_io_file_create(path_min_unpacked_rev(fs, pool), "0\n", pool));
 
+  /* If our filesystem predates the revprop generation file, create it. */
+  if (format < SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+    SVN_ERR(create_file_ignore_eexist(path_revprop_generation(fs, pool),
+                                      "0\n", pool));
+
+  /* Packed shards of older formats come with text manifests.  Convert
+     them before bumping the format; since already converted manifests
+     are left alone, re-running an interrupted upgrade completes it.
+     Readers tell both manifest formats apart by their first byte, so
+     concurrent readers keep working in the meantime. */
+  if (format >= SVN_FS_FS__MIN_PACKED_FORMAT
+      && format < SVN_FS_FS__MIN_BINARY_MANIFEST_FORMAT
+      && max_files_per_dir)
+    {
+      svn_revnum_t min_unpacked_rev;
+      apr_int64_t shard;
+      apr_pool_t *iterpool = svn_pool_create(pool);
+
+      SVN_ERR(read_min_unpacked_rev(&min_unpacked_rev,
+                                    path_min_unpacked_rev(fs, pool), pool));
+
+      for (shard = 0; shard < min_unpacked_rev / max_files_per_dir; shard++)
+        {
+          svn_pool_clear(iterpool);
+          SVN_ERR(convert_manifest_to_binary(
+                      svn_dirent_join_many(iterpool, fs->path, PATH_REVS_DIR,
+                                           apr_psprintf(iterpool,
+                                                        "%" APR_INT64_T_FMT
+                                                        ".pack", shard),
+                                           PATH_MANIFEST, NULL),
+                      max_files_per_dir, iterpool));
+        }
+
+      svn_pool_destroy(iterpool);
+    }
+
+  /* If we have packed shards but no packed revprops, pack the revprops
+     of those shards now.  The unpacked revprops will only be removed
+     once the new format is in place. */
+  if (format >= SVN_FS_FS__MIN_PACKED_FORMAT
+      && format < SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT
+      && max_files_per_dir)
+    {
+      svn_revnum_t min_unpacked_rev;
+      apr_int64_t shard;
+      const char *revprops_dir = svn_dirent_join(fs->path, PATH_REVPROPS_DIR,
+                                                 pool);
+      apr_int64_t pack_size;
+      const char *value;
+      svn_config_t *config;
+      apr_pool_t *iterpool = svn_pool_create(pool);
+
+      SVN_ERR(read_min_unpacked_rev(&min_unpacked_rev,
+                                    path_min_unpacked_rev(fs, pool), pool));
+
+      /* ffd->revprop_pack_size has not been set for the old format. */
+      SVN_ERR(svn_config_read2(&config,
+                               svn_dirent_join(fs->path, PATH_CONFIG, pool),
+                               FALSE, FALSE, pool));
+      svn_config_get(config, &value, CONFIG_SECTION_PACKED_REVPROPS,
+                     CONFIG_OPTION_REVPROP_PACK_SIZE, "64");
+      SVN_ERR(svn_cstring_atoi64(&pack_size, value));
+
+      for (shard = 0; shard < min_unpacked_rev / max_files_per_dir; shard++)
+        {
+          svn_pool_clear(iterpool);
+          SVN_ERR(pack_revprops_shard(
+                      svn_dirent_join(revprops_dir,
+                                      apr_psprintf(iterpool,
+                                                   "%" APR_INT64_T_FMT ".pack",
+                                                   shard),
+                                      iterpool),
+                      svn_dirent_join(revprops_dir,
+                                      apr_psprintf(iterpool,
+                                                   "%" APR_INT64_T_FMT,
+                                                   shard),
+                                      iterpool),
+                      shard, max_files_per_dir, pack_size * 1024,
+                      NULL, NULL, iterpool));
+        }
+
+      /* Bump the format file. */
+      SVN_ERR(write_format(format_path, SVN_FS_FS__FORMAT_NUMBER,
+                           max_files_per_dir, TRUE, pool));
+
+      /* Now that the packed revprops are authoritative, remove the
+         unpacked ones. */
+      for (shard = 0; shard < min_unpacked_rev / max_files_per_dir; shard++)
+        {
+          svn_pool_clear(iterpool);
+          SVN_ERR(delete_revprops_shard(
+                      svn_dirent_join(revprops_dir,
+                                      apr_psprintf(iterpool,
+                                                   "%" APR_INT64_T_FMT,
+                                                   shard),
+                                      iterpool),
+                      shard, max_files_per_dir, NULL, NULL, iterpool));
+        }
+
+      svn_pool_destroy(iterpool);
+      return SVN_NO_ERROR;
+    }
+
   /* Bump the format file. */
   return write_format(format_path, SVN_FS_FS__FORMAT_NUMBER, max_files_per_dir,
                       TRUE, pool);
@@ -1449,6 +1751,14 @@ svn_fs_fs__youngest_rev(svn_revnum_t *youngest_p,
   return SVN_NO_ERROR;
 }
 
+svn_error_t *
+svn_fs_fs__read_youngest(svn_revnum_t *youngest_p,
+                         const char *fs_path,
+                         apr_pool_t *pool)
+{
+  return svn_error_trace(get_youngest(youngest_p, fs_path, pool));
+}
+
 /* Given a revision file FILE that has been pre-positioned at the
    beginning of a Node-Rev header block, read in that header block and
    store it in the apr_hash_t HEADERS.  All allocations will be from
@@ -1616,6 +1926,97 @@ open_pack_or_rev_file(apr_file_t **file,
   return svn_error_trace(err);
 }
 
+/* Size of an entry in a binary pack manifest. */
+#define MANIFEST_ENTRY_SIZE 8
+
+/* Store OFFSET in BUFFER as a MANIFEST_ENTRY_SIZE bytes big-endian
+   number. */
+static void
+encode_manifest_entry(unsigned char *buffer, apr_off_t offset)
+{
+  apr_uint64_t value = (apr_uint64_t)offset;
+  int i;
+
+  for (i = MANIFEST_ENTRY_SIZE - 1; i >= 0; --i)
+    {
+      buffer[i] = (unsigned char)(value & 0xff);
+      value >>= 8;
+    }
+}
+
+/* Return the offset stored in the binary manifest entry at BUFFER. */
+static apr_off_t
+decode_manifest_entry(const unsigned char *buffer)
+{
+  apr_uint64_t value = 0;
+  int i;
+
+  for (i = 0; i < MANIFEST_ENTRY_SIZE; ++i)
+    value = (value << 8) | buffer[i];
+
+  return (apr_off_t)value;
+}
+
+/* Parse the textual pack manifest CONTENT, which will be modified, into
+   *MANIFEST, an array of apr_off_t.  MAX_FILES_PER_DIR is the shard size.
+   Allocate the result in POOL. */
+static svn_error_t *
+parse_text_manifest(apr_array_header_t **manifest,
+                    svn_stringbuf_t *content,
+                    int max_files_per_dir,
+                    apr_pool_t *pool)
+{
+  char *line, *eol;
+
+  *manifest = apr_array_make(pool, max_files_per_dir, sizeof(apr_off_t));
+  for (line = content->data; *line; line = eol + 1)
+    {
+      apr_int64_t val;
+      svn_error_t *err;
+
+      eol = strchr(line, '\n');
+      if (eol)
+        *eol = '\0';
+
+      err = svn_cstring_atoi64(&val, line);
+      if (err)
+        return svn_error_createf(SVN_ERR_FS_CORRUPT, err,
+                                 _("Manifest offset '%s' too large"),
+                                 line);
+      APR_ARRAY_PUSH(*manifest, apr_off_t) = (apr_off_t)val;
+
+      if (! eol)
+        break;
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Parse the binary pack manifest CONTENT read from PATH into *MANIFEST,
+   an array of apr_off_t.  Allocate the result in POOL. */
+static svn_error_t *
+parse_binary_manifest(apr_array_header_t **manifest,
+                      const svn_stringbuf_t *content,
+                      const char *path,
+                      apr_pool_t *pool)
+{
+  const unsigned char *data = (const unsigned char *)content->data;
+  apr_size_t count = content->len / MANIFEST_ENTRY_SIZE;
+  apr_size_t i;
+
+  if (content->len % MANIFEST_ENTRY_SIZE)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Manifest '%s' has an invalid size"),
+                             svn_dirent_local_style(path, pool));
+
+  *manifest = apr_array_make(pool, (int)count, sizeof(apr_off_t));
+  for (i = 0; i < count; ++i)
+    APR_ARRAY_PUSH(*manifest, apr_off_t)
+      = decode_manifest_entry(data + i * MANIFEST_ENTRY_SIZE);
+
+  return SVN_NO_ERROR;
+}
+
 /* Given REV in FS, set *REV_OFFSET to REV's offset in the packed file.
    Use POOL for temporary allocations. */
 static svn_error_t *
@@ -1625,12 +2026,12 @@ get_packed_offset(apr_off_t *rev_offset,
                   apr_pool_t *pool)
 {
   fs_fs_data_t *ffd = fs->fsap_data;
-  svn_stream_t *manifest_stream;
+  svn_stringbuf_t *content;
   svn_boolean_t is_cached;
   svn_revnum_t shard;
   apr_int64_t shard_pos;
   apr_array_header_t *manifest;
-  apr_pool_t *iterpool;
+  const char *path;
 
   shard = rev / ffd->max_files_per_dir;
 
@@ -1647,124 +2048,435 @@ get_packed_offset(apr_off_t *rev_offset,
   if (is_cached)
       return SVN_NO_ERROR;
 
-  /* Open the manifest file. */
-  SVN_ERR(svn_stream_open_readonly(&manifest_stream,
-                                   path_rev_packed(fs, rev, "manifest", pool),
-                                   pool, pool));
+  /* While we're here, let's just read the entire manifest file into
+     an array, so we can cache the entire thing. */
+  path = path_rev_packed(fs, rev, "manifest", pool);
+  SVN_ERR(svn_stringbuf_from_file2(&content, path, pool));
+
+  /* Don't trust the format number to tell us the manifest format:
+     'svnadmin upgrade' converts manifests before bumping it.  The first
+     revision of every shard is at offset 0.  Text manifests therefore
+     start with the digit '0' and binary ones with a NUL. */
+  if (content->len && content->data[0] == '0')
+    SVN_ERR(parse_text_manifest(&manifest, content, ffd->max_files_per_dir,
+                                pool));
+  else
+    SVN_ERR(parse_binary_manifest(&manifest, content, path, pool));
 
-  /* While we're here, let's just read the entire manifest file into an array,
-     so we can cache the entire thing. */
-  iterpool = svn_pool_create(pool);
-  manifest = apr_array_make(pool, ffd->max_files_per_dir, sizeof(apr_off_t));
-  while (1)
-    {
-      svn_stringbuf_t *sb;
-      svn_boolean_t eof;
-      apr_int64_t val;
-      svn_error_t *err;
+  if (shard_pos >= manifest->nelts)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Manifest for revision %ld is too short"),
+                             rev);
 
-      svn_pool_clear(iterpool);
-      SVN_ERR(svn_stream_readline(manifest_stream, &sb, "\n", &eof, iterpool));
-      if (eof)
-        break;
+  *rev_offset = APR_ARRAY_IDX(manifest, shard_pos, apr_off_t);
 
-      err = svn_cstring_atoi64(&val, sb->data);
-      if (err)
-        return svn_error_createf(SVN_ERR_FS_CORRUPT, err,
-                                 _("Manifest offset '%s' too large"),
-                                 sb->data);
-      APR_ARRAY_PUSH(manifest, apr_off_t) = (apr_off_t)val;
+  /* Cache the array. */
+  return svn_cache__set(ffd->packed_offset_cache, &shard, manifest, pool);
+}
+
+/* Read the item index of the pack file containing the packed revision
+   REV in FS into *INDEX, an array of apr_off_t laid out as described
+   for svn_fs_fs__get_item_offset().  If that pack file has no item
+   index, return an array containing just a 0 revision count.  Allocate
+   the result in POOL. */
+static svn_error_t *
+read_item_index(apr_array_header_t **index,
+                svn_fs_t *fs,
+                svn_revnum_t rev,
+                apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  const char *path = path_rev_packed(fs, rev, PATH_ITEM_INDEX, pool);
+  svn_stringbuf_t *content;
+  svn_error_t *err;
+  apr_off_t *values;
+  apr_off_t count, i;
+
+  err = svn_stringbuf_from_file2(&content, path, pool);
+  if (err && APR_STATUS_IS_ENOENT(err->apr_err))
+    {
+      svn_error_clear(err);
+      *index = apr_array_make(pool, 1, sizeof(apr_off_t));
+      APR_ARRAY_PUSH(*index, apr_off_t) = 0;
+      return SVN_NO_ERROR;
     }
-  svn_pool_destroy(iterpool);
+  SVN_ERR(err);
 
-  *rev_offset = APR_ARRAY_IDX(manifest, rev % ffd->max_files_per_dir,
-                              apr_off_t);
+  /* Same encoding as the binary manifest. */
+  SVN_ERR(parse_binary_manifest(index, content, path, pool));
 
-  /* Close up shop and cache the array. */
-  SVN_ERR(svn_stream_close(manifest_stream));
-  return svn_cache__set(ffd->packed_offset_cache, &shard, manifest, pool);
+  /* Make sure that lookups will stay within the array. */
+  values = (apr_off_t *)(*index)->elts;
+  count = (*index)->nelts ? values[0] : -1;
+  if (count != ffd->max_files_per_dir
+      || (*index)->nelts < count + 2
+      || values[1] != 0
+      || (*index)->nelts != count + 2 + 2 * values[count + 1])
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Item index '%s' is corrupt"),
+                             svn_dirent_local_style(path, pool));
+
+  for (i = 0; i < count; ++i)
+    if (values[i + 1] >= values[i + 2])
+      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                               _("Item index '%s' is corrupt"),
+                               svn_dirent_local_style(path, pool));
+
+  return SVN_NO_ERROR;
 }
 
-/* Open the revision file for revision REV in filesystem FS and store
-   the newly opened file in FILE.  Seek to location OFFSET before
-   returning.  Perform temporary allocations in POOL. */
+/* If the pack file containing the packed revision REV in FS has an item
+   index, set *INDEXED to TRUE and *PACK_OFFSET to the position in that
+   pack file of what is found at OFFSET in the revision file of REV.  A
+   negative OFFSET denotes the end of the revision file.  Otherwise, set
+   *INDEXED to FALSE.  Use POOL for temporary allocations. */
 static svn_error_t *
-open_and_seek_revision(apr_file_t **file,
-                       svn_fs_t *fs,
-                       svn_revnum_t rev,
-                       apr_off_t offset,
-                       apr_pool_t *pool)
+lookup_item_index(svn_boolean_t *indexed,
+                  apr_off_t *pack_offset,
+                  svn_fs_t *fs,
+                  svn_revnum_t rev,
+                  apr_off_t offset,
+                  apr_pool_t *pool)
 {
-  apr_file_t *rev_file;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  svn_fs_fs__item_offset_baton_t baton;
+  svn_boolean_t is_cached;
+  svn_revnum_t shard;
 
-  SVN_ERR(ensure_revision_exists(fs, rev, pool));
+  *indexed = FALSE;
+  if (ffd->format < SVN_FS_FS__MIN_PACK_ITEM_INDEX_FORMAT)
+    return SVN_NO_ERROR;
 
-  SVN_ERR(open_pack_or_rev_file(&rev_file, fs, rev, pool));
+  shard = rev / ffd->max_files_per_dir;
+  baton.shard_pos = rev % ffd->max_files_per_dir;
+  baton.offset = offset;
+  baton.indexed = FALSE;
 
-  if (is_packed_rev(fs, rev))
+  SVN_ERR(svn_cache__get_partial((void **) pack_offset, &is_cached,
+                                 ffd->item_index_cache, &shard,
+                                 svn_fs_fs__get_item_offset, &baton,
+                                 pool));
+  if (! is_cached)
     {
-      apr_off_t rev_offset;
+      apr_array_header_t *index;
 
-      SVN_ERR(get_packed_offset(&rev_offset, fs, rev, pool));
-      offset += rev_offset;
+      SVN_ERR(read_item_index(&index, fs, rev, pool));
+      SVN_ERR(svn_fs_fs__get_item_offset((void **) pack_offset, index->elts,
+                                         index->nelts * sizeof(apr_off_t),
+                                         &baton, pool));
+      SVN_ERR(svn_cache__set(ffd->item_index_cache, &shard, index, pool));
     }
 
-  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
-
-  *file = rev_file;
+  if (baton.indexed && *pack_offset < 0)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Offset %" APR_OFF_T_FMT " in revision %ld "
+                               "not found in item index"),
+                             offset, rev);
 
+  *indexed = baton.indexed;
   return SVN_NO_ERROR;
 }
 
-/* Open the representation for a node-revision in transaction TXN_ID
-   in filesystem FS and store the newly opened file in FILE.  Seek to
-   location OFFSET before returning.  Perform temporary allocations in
-   POOL.  Only appropriate for file contents, nor props or directory
-   contents. */
+/* Given the packed revision REV in FS, set *PACK_OFFSET to the position
+   in REV's pack file of what is found at OFFSET in the revision file of
+   REV.  Use POOL for temporary allocations. */
 static svn_error_t *
-open_and_seek_transaction(apr_file_t **file,
-                          svn_fs_t *fs,
-                          const char *txn_id,
-                          representation_t *rep,
-                          apr_pool_t *pool)
+get_packed_item_offset(apr_off_t *pack_offset,
+                       svn_fs_t *fs,
+                       svn_revnum_t rev,
+                       apr_off_t offset,
+                       apr_pool_t *pool)
 {
-  apr_file_t *rev_file;
-  apr_off_t offset;
-
-  SVN_ERR(svn_io_file_open(&rev_file, path_txn_proto_rev(fs, txn_id, pool),
-                           APR_READ | APR_BUFFERED, APR_OS_DEFAULT, pool));
+  svn_boolean_t indexed;
+  apr_off_t rev_offset;
 
-  offset = rep->offset;
-  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
+  SVN_ERR(lookup_item_index(&indexed, pack_offset, fs, rev, offset, pool));
+  if (indexed)
+    return SVN_NO_ERROR;
 
-  *file = rev_file;
+  /* Plain concatenation of revision files. */
+  SVN_ERR(get_packed_offset(&rev_offset, fs, rev, pool));
+  *pack_offset = rev_offset + offset;
 
   return SVN_NO_ERROR;
 }
 
-/* Given a node-id ID, and a representation REP in filesystem FS, open
-   the correct file and seek to the correction location.  Store this
-   file in *FILE_P.  Perform any allocations in POOL. */
-static svn_error_t *
-open_and_seek_representation(apr_file_t **file_p,
-                             svn_fs_t *fs,
-                             representation_t *rep,
-                             apr_pool_t *pool)
+/* Pack files never change once written.  On platforms with a large
+ * enough address space, we map them into memory upon first access and
+ * keep them mapped for the lifetime of the svn_fs_t.  Reading noderevs,
+ * representation headers and delta windows from packed revisions will
+ * then be served from memory instead of seek() and read() calls.
+ */
+#if APR_HAS_MMAP && APR_SIZEOF_VOIDP >= 8
+#define MMAP_PACK_FILES
+#endif
+
+/* A pack file mapped into memory. */
+typedef struct pack_mapping_t
 {
-  if (! rep->txn_id)
-    return open_and_seek_revision(file_p, fs, rep->revision, rep->offset,
-                                  pool);
-  else
-    return open_and_seek_transaction(file_p, fs, rep->txn_id, rep, pool);
-}
+  /* The pack file contents.  NULL, if the file could not be mapped. */
+  const char *data;
 
-/* Parse the description of a representation from STRING and store it
-   into *REP_P.  If the representation is mutable (the revision is
-   given as -1), then use TXN_ID for the representation's txn_id
-   field.  If MUTABLE_REP_TRUNCATED is true, then this representation
-   is for property or directory contents, and no information will be
-   expected except the "-1" revision number for a mutable
-   representation.  Allocate *REP_P in POOL. */
+  /* Number of bytes in DATA. */
+  apr_off_t size;
+
+  /* Path of the pack file, for error messages. */
+  const char *path;
+
+  /* The file name part of txdelta window cache keys for this pack file.
+     Matches what get_window_key() derives from the pack file name. */
+  const char *window_key;
+} pack_mapping_t;
+
+#ifdef MMAP_PACK_FILES
+/* Set *MAPPING to the entry for the pack file of SHARD in FS's
+   PACK_MAPPINGS, creating it if necessary.  REV is any revision within
+   SHARD.  The caller must hold FFD->PACK_MAPPINGS_LOCK.  Use POOL for
+   temporary allocations. */
+static svn_error_t *
+get_pack_mapping_body(pack_mapping_t **mapping,
+                      svn_fs_t *fs,
+                      apr_int64_t shard,
+                      svn_revnum_t rev,
+                      apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  pack_mapping_t *result;
+
+  result = apr_hash_get(ffd->pack_mappings, &shard, sizeof(shard));
+  if (result == NULL)
+    {
+      apr_file_t *file;
+      apr_finfo_t finfo;
+      apr_mmap_t *mmap;
+      svn_error_t *err;
+
+      result = apr_pcalloc(fs->pool, sizeof(*result));
+      result->path = path_rev_packed(fs, rev, "pack", fs->pool);
+      result->window_key = apr_psprintf(fs->pool, "%" APR_INT64_T_FMT ".",
+                                        shard);
+
+      /* The mapping remains valid after the file has been closed. */
+      err = svn_io_file_open(&file, result->path, APR_READ, APR_OS_DEFAULT,
+                             pool);
+      if (! err)
+        {
+          err = svn_io_file_info_get(&finfo, APR_FINFO_SIZE, file, pool);
+          if (! err && finfo.size > 0
+              && apr_mmap_create(&mmap, file, 0, (apr_size_t)finfo.size,
+                                 APR_MMAP_READ, fs->pool) == APR_SUCCESS)
+            {
+              result->data = mmap->mm;
+              result->size = finfo.size;
+            }
+
+          err = svn_error_compose_create(err, svn_io_file_close(file, pool));
+        }
+
+      /* Don't try again but fall back to file I/O for this shard. */
+      svn_error_clear(err);
+
+      apr_hash_set(ffd->pack_mappings,
+                   apr_pmemdup(fs->pool, &shard, sizeof(shard)),
+                   sizeof(shard), result);
+    }
+
+  *mapping = result;
+  return SVN_NO_ERROR;
+}
+#endif
+
+/* Set *MAPPING to the memory mapping of the pack file containing REV in
+   FS.  Set it to NULL, if REV is not packed or the pack file cannot be
+   mapped.  Use POOL for temporary allocations. */
+static svn_error_t *
+get_pack_mapping(const pack_mapping_t **mapping,
+                 svn_fs_t *fs,
+                 svn_revnum_t rev,
+                 apr_pool_t *pool)
+{
+#ifdef MMAP_PACK_FILES
+  fs_fs_data_t *ffd = fs->fsap_data;
+  apr_int64_t shard;
+  pack_mapping_t *result;
+
+  *mapping = NULL;
+  if (! is_packed_rev(fs, rev))
+    return SVN_NO_ERROR;
+
+  /* The svn_fs_t may be used by several threads at once. */
+  shard = rev / ffd->max_files_per_dir;
+  SVN_MUTEX__WITH_LOCK(ffd->pack_mappings_lock,
+                       get_pack_mapping_body(&result, fs, shard, rev, pool));
+
+  if (result->data)
+    *mapping = result;
+#else
+  *mapping = NULL;
+#endif
+
+  return SVN_NO_ERROR;
+}
+
+/* If revision REV in FS is packed and its pack file has been mapped into
+   memory, set *MAPPING to that mapping and *PACK_OFFSET to the position
+   of OFFSET within REV in the pack file.  Otherwise, set *MAPPING to NULL.
+   Use POOL for temporary allocations. */
+static svn_error_t *
+map_revision(const pack_mapping_t **mapping,
+             apr_off_t *pack_offset,
+             svn_fs_t *fs,
+             svn_revnum_t rev,
+             apr_off_t offset,
+             apr_pool_t *pool)
+{
+  SVN_ERR(ensure_revision_exists(fs, rev, pool));
+  SVN_ERR(get_pack_mapping(mapping, fs, rev, pool));
+  if (*mapping == NULL)
+    return SVN_NO_ERROR;
+
+  if (offset < 0)
+    *pack_offset = -1;
+  else
+    SVN_ERR(get_packed_item_offset(pack_offset, fs, rev, offset, pool));
+  if (*pack_offset < 0 || *pack_offset > (*mapping)->size)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Offset %" APR_OFF_T_FMT " in revision %ld "
+                               "is beyond the end of pack file '%s'"),
+                             offset, rev,
+                             svn_dirent_local_style((*mapping)->path, pool));
+
+  return SVN_NO_ERROR;
+}
+
+/* Baton for a stream reading from a memory-mapped pack file. */
+typedef struct mapped_stream_baton_t
+{
+  /* The first byte to read. */
+  const char *data;
+
+  /* Number of bytes available at DATA. */
+  apr_size_t size;
+
+  /* Number of bytes read so far. */
+  apr_size_t pos;
+} mapped_stream_baton_t;
+
+/* Implements svn_read_fn_t for mapped_stream_baton_t. */
+static svn_error_t *
+read_handler_mapped(void *baton, char *buffer, apr_size_t *len)
+{
+  mapped_stream_baton_t *b = baton;
+
+  if (*len > b->size - b->pos)
+    *len = b->size - b->pos;
+
+  memcpy(buffer, b->data + b->pos, *len);
+  b->pos += *len;
+
+  return SVN_NO_ERROR;
+}
+
+/* Return a stream reading the contents of MAPPING, starting at OFFSET.
+   If BATON_P is not NULL, return the stream's baton in *BATON_P such that
+   the caller can tell how many bytes have been read.  Allocate the
+   result in POOL. */
+static svn_stream_t *
+mapped_stream_create(mapped_stream_baton_t **baton_p,
+                     const pack_mapping_t *mapping,
+                     apr_off_t offset,
+                     apr_pool_t *pool)
+{
+  mapped_stream_baton_t *baton = apr_pcalloc(pool, sizeof(*baton));
+  svn_stream_t *stream;
+
+  baton->data = mapping->data + offset;
+  baton->size = (apr_size_t)(mapping->size - offset);
+
+  stream = svn_stream_create(baton, pool);
+  svn_stream_set_read(stream, read_handler_mapped);
+
+  if (baton_p)
+    *baton_p = baton;
+
+  return stream;
+}
+
+/* Open the revision file for revision REV in filesystem FS and store
+   the newly opened file in FILE.  Seek to location OFFSET before
+   returning.  Perform temporary allocations in POOL. */
+static svn_error_t *
+open_and_seek_revision(apr_file_t **file,
+                       svn_fs_t *fs,
+                       svn_revnum_t rev,
+                       apr_off_t offset,
+                       apr_pool_t *pool)
+{
+  apr_file_t *rev_file;
+
+  SVN_ERR(ensure_revision_exists(fs, rev, pool));
+
+  SVN_ERR(open_pack_or_rev_file(&rev_file, fs, rev, pool));
+
+  if (is_packed_rev(fs, rev))
+    SVN_ERR(get_packed_item_offset(&offset, fs, rev, offset, pool));
+
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
+
+  *file = rev_file;
+
+  return SVN_NO_ERROR;
+}
+
+/* Open the representation for a node-revision in transaction TXN_ID
+   in filesystem FS and store the newly opened file in FILE.  Seek to
+   location OFFSET before returning.  Perform temporary allocations in
+   POOL.  Only appropriate for file contents, nor props or directory
+   contents. */
+static svn_error_t *
+open_and_seek_transaction(apr_file_t **file,
+                          svn_fs_t *fs,
+                          const char *txn_id,
+                          representation_t *rep,
+                          apr_pool_t *pool)
+{
+  apr_file_t *rev_file;
+  apr_off_t offset;
+
+  SVN_ERR(svn_io_file_open(&rev_file, path_txn_proto_rev(fs, txn_id, pool),
+                           APR_READ | APR_BUFFERED, APR_OS_DEFAULT, pool));
+
+  offset = rep->offset;
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
+
+  *file = rev_file;
+
+  return SVN_NO_ERROR;
+}
+
+/* Given a node-id ID, and a representation REP in filesystem FS, open
+   the correct file and seek to the correction location.  Store this
+   file in *FILE_P.  Perform any allocations in POOL. */
+static svn_error_t *
+open_and_seek_representation(apr_file_t **file_p,
+                             svn_fs_t *fs,
+                             representation_t *rep,
+                             apr_pool_t *pool)
+{
+  if (! rep->txn_id)
+    return open_and_seek_revision(file_p, fs, rep->revision, rep->offset,
+                                  pool);
+  else
+    return open_and_seek_transaction(file_p, fs, rep->txn_id, rep, pool);
+}
+
+/* Parse the description of a representation from STRING and store it
+   into *REP_P.  If the representation is mutable (the revision is
+   given as -1), then use TXN_ID for the representation's txn_id
+   field.  If MUTABLE_REP_TRUNCATED is true, then this representation
+   is for property or directory contents, and no information will be
+   expected except the "-1" revision number for a mutable
+   representation.  Allocate *REP_P in POOL. */
 static svn_error_t *
 read_rep_offsets_body(representation_t **rep_p,
                       char *string,
@@ -1979,11 +2691,28 @@ get_node_revision_body(node_revision_t **noderev_p,
     }
   else
     {
-      /* This is a revision node-rev. */
-      err = open_and_seek_revision(&revision_file, fs,
-                                   svn_fs_fs__id_rev(id),
-                                   svn_fs_fs__id_offset(id),
-                                   pool);
+      /* This is a revision node-rev.  Packed ones may be read from
+         memory. */
+      const pack_mapping_t *mapping;
+      apr_off_t offset;
+
+      err = map_revision(&mapping, &offset, fs, svn_fs_fs__id_rev(id),
+                         svn_fs_fs__id_offset(id), pool);
+      if (! err && mapping)
+        {
+          SVN_ERR(svn_fs_fs__read_noderev(noderev_p,
+                                          mapped_stream_create(NULL, mapping,
+                                                               offset, pool),
+                                          pool));
+
+          return set_cached_node_revision_body(*noderev_p, fs, id, pool);
+        }
+
+      if (! err)
+        err = open_and_seek_revision(&revision_file, fs,
+                                     svn_fs_fs__id_rev(id),
+                                     svn_fs_fs__id_offset(id),
+                                     pool);
     }
 
   if (err)
@@ -2331,23 +3060,18 @@ struct rep_args
   svn_filesize_t base_length;
 };
 
-/* Read the next line from file FILE and parse it as a text
-   representation entry.  Return the parsed entry in *REP_ARGS_P.
-   Perform all allocations in POOL. */
+/* Parse the text representation entry in BUFFER and return it in
+   *REP_ARGS_P.  Set *REP_ARGS_P to NULL if BUFFER is malformed.
+   BUFFER will be modified.  Perform all allocations in POOL. */
 static svn_error_t *
-read_rep_line(struct rep_args **rep_args_p,
-              apr_file_t *file,
-              apr_pool_t *pool)
+parse_rep_line(struct rep_args **rep_args_p,
+               char *buffer,
+               apr_pool_t *pool)
 {
-  char buffer[160];
-  apr_size_t limit;
   struct rep_args *rep_args;
   char *str, *last_str = buffer;
   apr_int64_t val;
 
-  limit = sizeof(buffer);
-  SVN_ERR(svn_io_read_length_line(file, buffer, &limit, pool));
-
   rep_args = apr_pcalloc(pool, sizeof(*rep_args));
   rep_args->is_delta = FALSE;
 
@@ -2395,9 +3119,65 @@ read_rep_line(struct rep_args **rep_args_p,
   return SVN_NO_ERROR;
 
  error:
-  return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                           _("Malformed representation header at %s"),
-                           path_and_offset_of(file, pool));
+  *rep_args_p = NULL;
+  return SVN_NO_ERROR;
+}
+
+/* Read the next line from file FILE and parse it as a text
+   representation entry.  Return the parsed entry in *REP_ARGS_P.
+   Perform all allocations in POOL. */
+static svn_error_t *
+read_rep_line(struct rep_args **rep_args_p,
+              apr_file_t *file,
+              apr_pool_t *pool)
+{
+  char buffer[160];
+  apr_size_t limit;
+
+  limit = sizeof(buffer);
+  SVN_ERR(svn_io_read_length_line(file, buffer, &limit, pool));
+  SVN_ERR(parse_rep_line(rep_args_p, buffer, pool));
+  if (*rep_args_p == NULL)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Malformed representation header at %s"),
+                             path_and_offset_of(file, pool));
+
+  return SVN_NO_ERROR;
+}
+
+/* Like read_rep_line but read the line at *OFFSET in the pack file
+   MAPPING and advance *OFFSET to the beginning of the next line. */
+static svn_error_t *
+read_mapped_rep_line(struct rep_args **rep_args_p,
+                     const pack_mapping_t *mapping,
+                     apr_off_t *offset,
+                     apr_pool_t *pool)
+{
+  char buffer[160];
+  const char *line = mapping->data + *offset;
+  apr_size_t limit = sizeof(buffer) - 1;
+  const char *eol;
+
+  if ((apr_off_t)limit > mapping->size - *offset)
+    limit = (apr_size_t)(mapping->size - *offset);
+
+  eol = memchr(line, '\n', limit);
+  if (eol)
+    {
+      memcpy(buffer, line, eol - line);
+      buffer[eol - line] = '\0';
+      SVN_ERR(parse_rep_line(rep_args_p, buffer, pool));
+    }
+
+  if (eol == NULL || *rep_args_p == NULL)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Malformed representation header at %s:%"
+                               APR_OFF_T_FMT),
+                             svn_dirent_local_style(mapping->path, pool),
+                             *offset);
+
+  *offset += eol - line + 1;
+  return SVN_NO_ERROR;
 }
 
 /* Given a revision file REV_FILE, opened to REV in FS, find the Node-ID
@@ -2450,86 +3230,45 @@ get_fs_id_at_offset(svn_fs_id_t **id_p,
 }
 
 
-/* Given an open revision file REV_FILE in FS for REV, locate the trailer that
-   specifies the offset to the root node-id and to the changed path
-   information.  Store the root node offset in *ROOT_OFFSET and the
-   changed path offset in *CHANGES_OFFSET.  If either of these
-   pointers is NULL, do nothing with it.
-
-   If PACKED is true, REV_FILE should be a packed shard file.
-   ### There is currently no such parameter.  This function assumes that
-       is_packed_rev(FS, REV) will indicate whether REV_FILE is a packed
-       file.  Therefore FS->fsap_data->min_unpacked_rev must not have been
-       refreshed since REV_FILE was opened if there is a possibility that
-       revision REV may have become packed since then.
-       TODO: Take an IS_PACKED parameter instead, in order to remove this
-       requirement.
-
-   Allocate temporary variables from POOL. */
+/* Read the trailer of revision REV from REV_FILE, where END_OFFSET is
+   the position just behind the last byte of REV in that file, and set
+   *ROOT_OFFSET and *CHANGES_OFFSET to the offsets specified therein.
+   Those are relative to the start of the revision file.  If either of
+   these pointers is NULL, do nothing with it.  Allocate temporary
+   variables from POOL. */
 static svn_error_t *
-get_root_changes_offset(apr_off_t *root_offset,
-                        apr_off_t *changes_offset,
-                        apr_file_t *rev_file,
-                        svn_fs_t *fs,
-                        svn_revnum_t rev,
-                        apr_pool_t *pool)
+read_revision_trailer(apr_off_t *root_offset,
+                      apr_off_t *changes_offset,
+                      apr_file_t *rev_file,
+                      apr_off_t end_offset,
+                      svn_revnum_t rev,
+                      apr_pool_t *pool)
 {
-  fs_fs_data_t *ffd = fs->fsap_data;
   apr_off_t offset;
-  apr_off_t rev_offset;
   char buf[64];
   int i, num_bytes;
   const char *str;
   apr_size_t len;
-  apr_seek_where_t seek_relative;
 
-  /* Determine where to seek to in the file.
+  /* We will assume that the last line containing the two offsets
+     will never be longer than 64 characters. */
+  offset = end_offset - sizeof(buf);
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
 
-     If we've got a pack file, we want to seek to the end of the desired
-     revision.  But we don't track that, so we seek to the beginning of the
-     next revision.
+  /* Read in this last block, from which we will identify the last line. */
+  len = sizeof(buf);
+  SVN_ERR(svn_io_file_read(rev_file, buf, &len, pool));
 
-     Unless the next revision is in a different file, in which case, we can
-     just seek to the end of the pack file -- just like we do in the
-     non-packed case. */
-  if (is_packed_rev(fs, rev) && ((rev + 1) % ffd->max_files_per_dir != 0))
+  /* This cast should be safe since the maximum amount read, 64, will
+     never be bigger than the size of an int. */
+  num_bytes = (int) len;
+
+  /* The last byte should be a newline. */
+  if (buf[num_bytes - 1] != '\n')
     {
-      SVN_ERR(get_packed_offset(&offset, fs, rev + 1, pool));
-      seek_relative = APR_SET;
-    }
-  else
-    {
-      seek_relative = APR_END;
-      offset = 0;
-    }
-
-  /* Offset of the revision from the start of the pack file, if applicable. */
-  if (is_packed_rev(fs, rev))
-    SVN_ERR(get_packed_offset(&rev_offset, fs, rev, pool));
-  else
-    rev_offset = 0;
-
-  /* We will assume that the last line containing the two offsets
-     will never be longer than 64 characters. */
-  SVN_ERR(svn_io_file_seek(rev_file, seek_relative, &offset, pool));
-
-  offset -= sizeof(buf);
-  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
-
-  /* Read in this last block, from which we will identify the last line. */
-  len = sizeof(buf);
-  SVN_ERR(svn_io_file_read(rev_file, buf, &len, pool));
-
-  /* This cast should be safe since the maximum amount read, 64, will
-     never be bigger than the size of an int. */
-  num_bytes = (int) len;
-
-  /* The last byte should be a newline. */
-  if (buf[num_bytes - 1] != '\n')
-    {
-      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                               _("Revision file (r%ld) lacks trailing newline"),
-                               rev);
+      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                               _("Revision file (r%ld) lacks trailing newline"),
+                               rev);
     }
 
   /* Look for the next previous newline. */
@@ -2566,7 +3305,7 @@ get_root_changes_offset(apr_off_t *root_offset,
 
       buf[i] = '\0';
       SVN_ERR(svn_cstring_atoi64(&val, str));
-      *root_offset = rev_offset + (apr_off_t)val;
+      *root_offset = (apr_off_t)val;
     }
 
   i++;
@@ -2583,7 +3322,96 @@ get_root_changes_offset(apr_off_t *root_offset,
 
       buf[i] = '\0';
       SVN_ERR(svn_cstring_atoi64(&val, str));
-      *changes_offset = rev_offset + (apr_off_t)val;
+      *changes_offset = (apr_off_t)val;
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Given an open revision file REV_FILE in FS for REV, locate the trailer that
+   specifies the offset to the root node-id and to the changed path
+   information.  Store the root node offset in *ROOT_OFFSET and the
+   changed path offset in *CHANGES_OFFSET.  If either of these
+   pointers is NULL, do nothing with it.
+
+   If PACKED is true, REV_FILE should be a packed shard file.
+   ### There is currently no such parameter.  This function assumes that
+       is_packed_rev(FS, REV) will indicate whether REV_FILE is a packed
+       file.  Therefore FS->fsap_data->min_unpacked_rev must not have been
+       refreshed since REV_FILE was opened if there is a possibility that
+       revision REV may have become packed since then.
+       TODO: Take an IS_PACKED parameter instead, in order to remove this
+       requirement.
+
+   Allocate temporary variables from POOL. */
+static svn_error_t *
+get_root_changes_offset(apr_off_t *root_offset,
+                        apr_off_t *changes_offset,
+                        apr_file_t *rev_file,
+                        svn_fs_t *fs,
+                        svn_revnum_t rev,
+                        apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  apr_off_t offset;
+  apr_off_t rev_offset;
+  apr_seek_where_t seek_relative;
+  svn_boolean_t indexed = FALSE;
+
+  /* Determine where to seek to in the file.
+
+     If we've got a pack file, we want to seek to the end of the desired
+     revision.  Reordered pack files track that in their item index.
+     Otherwise, we seek to the beginning of the next revision.
+
+     Unless the next revision is in a different file, in which case, we can
+     just seek to the end of the pack file -- just like we do in the
+     non-packed case. */
+  if (is_packed_rev(fs, rev))
+    SVN_ERR(lookup_item_index(&indexed, &offset, fs, rev, -1, pool));
+
+  if (indexed)
+    {
+      seek_relative = APR_SET;
+    }
+  else if (is_packed_rev(fs, rev)
+           && ((rev + 1) % ffd->max_files_per_dir != 0))
+    {
+      SVN_ERR(get_packed_offset(&offset, fs, rev + 1, pool));
+      seek_relative = APR_SET;
+    }
+  else
+    {
+      seek_relative = APR_END;
+      offset = 0;
+    }
+
+  /* Offset of the revision from the start of the pack file, if applicable.
+     Items of reordered pack files get translated individually below. */
+  if (is_packed_rev(fs, rev) && !indexed)
+    SVN_ERR(get_packed_offset(&rev_offset, fs, rev, pool));
+  else
+    rev_offset = 0;
+
+  SVN_ERR(svn_io_file_seek(rev_file, seek_relative, &offset, pool));
+  SVN_ERR(read_revision_trailer(root_offset, changes_offset, rev_file,
+                                offset, rev, pool));
+
+  if (indexed)
+    {
+      if (root_offset)
+        SVN_ERR(get_packed_item_offset(root_offset, fs, rev, *root_offset,
+                                       pool));
+      if (changes_offset)
+        SVN_ERR(get_packed_item_offset(changes_offset, fs, rev,
+                                       *changes_offset, pool));
+    }
+  else
+    {
+      if (root_offset)
+        *root_offset += rev_offset;
+      if (changes_offset)
+        *changes_offset += rev_offset;
     }
 
   return SVN_NO_ERROR;
@@ -2687,5023 +3515,6558 @@ svn_fs_fs__rev_get_root(svn_fs_id_t **root_id_p,
   return SVN_NO_ERROR;
 }
 
-/* Set the revision property list of revision REV in filesystem FS to
-   PROPLIST.  Use POOL for temporary allocations. */
-static svn_error_t *
-set_revision_proplist(svn_fs_t *fs,
-                      svn_revnum_t rev,
-                      apr_hash_t *proplist,
-                      apr_pool_t *pool)
-{
-  SVN_ERR(ensure_revision_exists(fs, rev, pool));
+/* Revprop caching and packing.
+ *
+ * Starting with SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT, packing a shard
+ * also packs the revprops of that shard (except those of r0) into
+ * revprops/<shard>.pack/.  That folder contains a number of pack files
+ * of at most ffd->revprop_pack_size bytes each (unless a single revision
+ * exceeds that limit), plus a manifest.  Each pack file is named after
+ * the first revision it contains and has the following layout:
+ *
+ *   <first revision>\n
+ *   <number of revisions N>\n
+ *   <size of the serialized revprops of the first revision>\n
+ *   ...
+ *   <size of the serialized revprops of the N-th revision>\n
+ *   \n
+ *   <serialized revprops of the first revision>
+ *   ...
+ *   <serialized revprops of the N-th revision>
+ *
+ * The manifest lists, one line per packed revision of the shard, the
+ * name of the pack file containing that revision's revprops.  It does
+ * not change after the shard has been packed.  Changing a packed revprop
+ * rewrites the respective pack file.
+ *
+ * Since revprops are mutable, the revprop cache uses (revision, revprop
+ * generation) as its key.  The generation is stored in the file
+ * PATH_REVPROP_GENERATION.  Writers bump it to an odd value before
+ * modifying any revprop and to the next even value afterwards, while
+ * holding the repository write lock.  Readers read the generation
+ * before the revprops and bypass the cache while it is odd.  Hence,
+ * cached entries will never be older than the generation they are keyed
+ * by, even if other processes change revprops concurrently.
+ */
 
-  /* if (1); null condition for easier merging to revprop-packing */
-    {
-      const char *final_path = path_revprops(fs, rev, pool);
-      const char *tmp_path;
-      const char *perms_reference;
-      svn_stream_t *stream;
+/* The parsed contents of a revprop pack file.
+ */
+typedef struct packed_revprops_t
+{
+  /* first revision in the pack file */
+  svn_revnum_t start_revision;
 
-      /* ### do we have a directory sitting around already? we really shouldn't
-         ### have to get the dirname here. */
-      SVN_ERR(svn_stream_open_unique(&stream, &tmp_path,
-                                     svn_dirent_dirname(final_path, pool),
-                                     svn_io_file_del_none, pool, pool));
-      SVN_ERR(svn_hash_write2(proplist, stream, SVN_HASH_TERMINATOR, pool));
-      SVN_ERR(svn_stream_close(stream));
+  /* serialized revprops (svn_string_t *) of all revisions in the pack
+     file, beginning with START_REVISION */
+  apr_array_header_t *revprops;
+} packed_revprops_t;
 
-      /* We use the rev file of this revision as the perms reference,
-         because when setting revprops for the first time, the revprop
-         file won't exist and therefore can't serve as its own reference.
-         (Whereas the rev file should already exist at this point.) */
-      SVN_ERR(svn_fs_fs__path_rev_absolute(&perms_reference, fs, rev, pool));
-      SVN_ERR(move_into_place(tmp_path, final_path, perms_reference, pool));
+/* Read the current revprop generation of FS into *GENERATION.  A missing
+   generation file counts as generation 0.  Use POOL for temporaries. */
+static svn_error_t *
+read_revprop_generation(apr_int64_t *generation,
+                        svn_fs_t *fs,
+                        apr_pool_t *pool)
+{
+  char *buf;
+  svn_error_t *err = read_current(path_revprop_generation(fs, pool),
+                                  &buf, pool);
+  if (err && APR_STATUS_IS_ENOENT(err->apr_err))
+    {
+      svn_error_clear(err);
+      *generation = 0;
+      return SVN_NO_ERROR;
     }
 
-  return SVN_NO_ERROR;
+  SVN_ERR(err);
+  return svn_error_trace(svn_cstring_atoi64(generation, buf));
 }
 
+/* Make GENERATION the current revprop generation of FS.  Use POOL for
+   temporaries. */
 static svn_error_t *
-revision_proplist(apr_hash_t **proplist_p,
-                  svn_fs_t *fs,
-                  svn_revnum_t rev,
-                  apr_pool_t *pool)
+write_revprop_generation(svn_fs_t *fs,
+                         apr_int64_t generation,
+                         apr_pool_t *pool)
 {
-  apr_hash_t *proplist;
+  const char *final_path = path_revprop_generation(fs, pool);
+  const char *tmp_path;
+  svn_stream_t *stream;
 
-  SVN_ERR(ensure_revision_exists(fs, rev, pool));
+  SVN_ERR(svn_stream_open_unique(&stream, &tmp_path, fs->path,
+                                 svn_io_file_del_none, pool, pool));
+  SVN_ERR(svn_stream_printf(stream, pool, "%" APR_INT64_T_FMT "\n",
+                            generation));
+  SVN_ERR(svn_stream_close(stream));
+
+  return move_into_place(tmp_path, final_path,
+                         svn_fs_fs__path_current(fs, pool), pool);
+}
 
-  /* if (1); null condition for easier merging to revprop-packing */
+/* Tell readers in FS that revprops are about to change by making the
+   revprop generation odd.  Return that generation in *GENERATION.
+   The caller must hold the write lock.  Use POOL for temporaries. */
+static svn_error_t *
+begin_revprop_change(apr_int64_t *generation,
+                     svn_fs_t *fs,
+                     apr_pool_t *pool)
+{
+  SVN_ERR(read_revprop_generation(generation, fs, pool));
+  if (*generation % 2 == 0)
     {
-      apr_file_t *revprop_file = NULL;
-      svn_error_t *err = SVN_NO_ERROR;
-      int i;
-      apr_pool_t *iterpool;
+      ++*generation;
+      SVN_ERR(write_revprop_generation(fs, *generation, pool));
+    }
 
-      proplist = apr_hash_make(pool);
-      iterpool = svn_pool_create(pool);
-      for (i = 0; i < RECOVERABLE_RETRY_COUNT; i++)
-        {
-          svn_pool_clear(iterpool);
+  return SVN_NO_ERROR;
+}
 
-          /* Clear err here rather than after finding a recoverable error so
-           * we can return that error on the last iteration of the loop. */
-          svn_error_clear(err);
-          err = svn_io_file_open(&revprop_file, path_revprops(fs, rev,
-                                                              iterpool),
-                                 APR_READ | APR_BUFFERED, APR_OS_DEFAULT,
-                                 iterpool);
-          if (err)
-            {
-              if (APR_STATUS_IS_ENOENT(err->apr_err))
-                {
-                  svn_error_clear(err);
-                  return svn_error_createf(SVN_ERR_FS_NO_SUCH_REVISION, NULL,
-                                           _("No such revision %ld"), rev);
-                }
-#ifdef ESTALE
-              else if (APR_TO_OS_ERROR(err->apr_err) == ESTALE
-                       || APR_TO_OS_ERROR(err->apr_err) == EIO
-                       || APR_TO_OS_ERROR(err->apr_err) == ENOENT)
-                continue;
-#endif
-              return svn_error_trace(err);
-            }
+/* Finish a revprop change in FS that begin_revprop_change started with
+   GENERATION by bumping the generation to the next even value.  Use POOL
+   for temporaries. */
+static svn_error_t *
+end_revprop_change(svn_fs_t *fs,
+                   apr_int64_t generation,
+                   apr_pool_t *pool)
+{
+  return svn_error_trace(write_revprop_generation(fs, generation + 1, pool));
+}
 
-          SVN_ERR(svn_hash__clear(proplist, iterpool));
-          RETRY_RECOVERABLE(err, revprop_file,
-                            svn_hash_read2(proplist,
-                                           svn_stream_from_aprfile2(
-                                                revprop_file, TRUE, iterpool),
-                                           SVN_HASH_TERMINATOR, pool));
+/* Return TRUE, if the revprops of FS may be cached at revprop GENERATION.
+ */
+static svn_boolean_t
+revprops_cachable(svn_fs_t *fs, apr_int64_t generation)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
 
-          IGNORE_RECOVERABLE(err, svn_io_file_close(revprop_file, iterpool));
+  /* Older servers don't bump the generation upon revprop changes.
+     Therefore, we can only cache revprops if the format prevents those
+     from accessing the repository. */
+  return ffd->revprop_cache
+      && ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT
+      && generation % 2 == 0;
+}
 
-          break;
-        }
+/* Return the revprop cache key for revision REV at revprop GENERATION.
+   Allocate the result in POOL. */
+static const char *
+get_revprop_cache_key(svn_revnum_t rev,
+                      apr_int64_t generation,
+                      apr_pool_t *pool)
+{
+  return svn_fs_fs__combine_two_numbers(rev, generation, pool);
+}
 
-      if (err)
-        return svn_error_trace(err);
-      svn_pool_destroy(iterpool);
-    }
+/* Serialize PROPLIST into *SERIALIZED, allocated in POOL.
+ */
+static svn_error_t *
+serialize_revprops(svn_string_t **serialized,
+                   apr_hash_t *proplist,
+                   apr_pool_t *pool)
+{
+  svn_stringbuf_t *buffer = svn_stringbuf_create_empty(pool);
+  svn_stream_t *stream = svn_stream_from_stringbuf(buffer, pool);
 
-  *proplist_p = proplist;
+  SVN_ERR(svn_hash_write2(proplist, stream, SVN_HASH_TERMINATOR, pool));
+  SVN_ERR(svn_stream_close(stream));
 
+  *serialized = svn_stringbuf__morph_into_string(buffer);
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__revision_proplist(apr_hash_t **proplist_p,
-                             svn_fs_t *fs,
-                             svn_revnum_t rev,
-                             apr_pool_t *pool)
+/* Parse the revprops of revision REV in SERIALIZED into *PROPLIST,
+   allocated in POOL. */
+static svn_error_t *
+parse_revprops(apr_hash_t **proplist,
+               const svn_string_t *serialized,
+               svn_revnum_t rev,
+               apr_pool_t *pool)
 {
-  SVN_ERR(revision_proplist(proplist_p, fs, rev, pool));
+  svn_error_t *err;
+
+  *proplist = apr_hash_make(pool);
+  err = svn_hash_read2(*proplist, svn_stream_from_string(serialized, pool),
+                       SVN_HASH_TERMINATOR, pool);
+  if (err)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, err,
+                             _("Revprops of revision %ld are corrupt"),
+                             rev);
 
   return SVN_NO_ERROR;
 }
 
-/* Represents where in the current svndiff data block each
-   representation is. */
-struct rep_state
+/* Return an error about the revprop pack file at PATH being corrupt.
+ */
+static svn_error_t *
+corrupt_revprop_pack(const char *path, apr_pool_t *pool)
 {
-  apr_file_t *file;
-                    /* The txdelta window cache to use or NULL. */
-  svn_cache__t *window_cache;
-                    /* Caches un-deltified windows. May be NULL. */
-  svn_cache__t *combined_cache;
-  apr_off_t start;  /* The starting offset for the raw
-                       svndiff/plaintext data minus header. */
-  apr_off_t off;    /* The current offset into the file. */
-  apr_off_t end;    /* The end offset of the raw data. */
-  int ver;          /* If a delta, what svndiff version? */
-  int chunk_index;
-};
+  return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                           _("Revprop pack file '%s' is corrupt"),
+                           svn_dirent_local_style(path, pool));
+}
 
-/* See create_rep_state, which wraps this and adds another error. */
+/* Parse the next line of the revprop pack file header at *DATA, which
+   must end before END, as a number and return it in *VALUE.  Move *DATA
+   to the beginning of the next line.  PATH is the pack file name to use
+   in error messages.  Use POOL for temporaries. */
 static svn_error_t *
-create_rep_state_body(struct rep_state **rep_state,
-                      struct rep_args **rep_args,
-                      representation_t *rep,
-                      svn_fs_t *fs,
+read_pack_header_line(apr_int64_t *value,
+                      const char **data,
+                      const char *end,
+                      const char *path,
                       apr_pool_t *pool)
 {
-  fs_fs_data_t *ffd = fs->fsap_data;
-  struct rep_state *rs = apr_pcalloc(pool, sizeof(*rs));
-  struct rep_args *ra;
-  unsigned char buf[4];
+  const char *eol = memchr(*data, '\n', end - *data);
+  if (eol == NULL)
+    return corrupt_revprop_pack(path, pool);
 
-  SVN_ERR(open_and_seek_representation(&rs->file, fs, rep, pool));
-  rs->window_cache = ffd->txdelta_window_cache;
-  rs->combined_cache = ffd->combined_window_cache;
-
-  SVN_ERR(read_rep_line(&ra, rs->file, pool));
-  SVN_ERR(get_file_offset(&rs->start, rs->file, pool));
-  rs->off = rs->start;
-  rs->end = rs->start + rep->size;
-  *rep_state = rs;
-  *rep_args = ra;
+  if (svn_cstring_atoi64(value, apr_pstrmemdup(pool, *data, eol - *data)))
+    return corrupt_revprop_pack(path, pool);
 
-  if (ra->is_delta == FALSE)
-    /* This is a plaintext, so just return the current rep_state. */
-    return SVN_NO_ERROR;
+  *data = eol + 1;
+  return SVN_NO_ERROR;
+}
 
-  /* We are dealing with a delta, find out what version. */
-  SVN_ERR(svn_io_file_read_full2(rs->file, buf, sizeof(buf),
-                                 NULL, NULL, pool));
-  /* ### Layering violation */
-  if (! ((buf[0] == 'S') && (buf[1] == 'V') && (buf[2] == 'N')))
-    return svn_error_create
-      (SVN_ERR_FS_CORRUPT, NULL,
-       _("Malformed svndiff data in representation"));
-  rs->ver = buf[3];
-  rs->chunk_index = 0;
-  rs->off += 4;
-
-  return SVN_NO_ERROR;
-}
-
-/* Read the rep args for REP in filesystem FS and create a rep_state
-   for reading the representation.  Return the rep_state in *REP_STATE
-   and the rep args in *REP_ARGS, both allocated in POOL. */
+/* Read the revprop pack file at PATH into *REVPROPS.  Allocate the result
+   in POOL. */
 static svn_error_t *
-create_rep_state(struct rep_state **rep_state,
-                 struct rep_args **rep_args,
-                 representation_t *rep,
-                 svn_fs_t *fs,
-                 apr_pool_t *pool)
+read_revprop_pack_file(packed_revprops_t **revprops,
+                       const char *path,
+                       apr_pool_t *pool)
 {
-  svn_error_t *err = create_rep_state_body(rep_state, rep_args, rep, fs, pool);
-  if (err && err->apr_err == SVN_ERR_FS_CORRUPT)
-    {
-      fs_fs_data_t *ffd = fs->fsap_data;
+  packed_revprops_t *result = apr_pcalloc(pool, sizeof(*result));
+  svn_stringbuf_t *content = NULL;
+  svn_error_t *err = SVN_NO_ERROR;
+  const char *data, *end;
+  apr_int64_t start_revision, count, i;
+  apr_int64_t *sizes;
+  int retry;
 
-      /* ### This always returns "-1" for transaction reps, because
-         ### this particular bit of code doesn't know if the rep is
-         ### stored in the protorev or in the mutable area (for props
-         ### or dir contents).  It is pretty rare for FSFS to *read*
-         ### from the protorev file, though, so this is probably OK.
-         ### And anyone going to debug corruption errors is probably
-         ### going to jump straight to this comment anyway! */
-      return svn_error_createf(SVN_ERR_FS_CORRUPT, err,
-                               "Corrupt representation '%s'",
-                               rep
-                               ? representation_string(rep, ffd->format, TRUE,
-                                                       TRUE, pool)
-                               : "(null)");
+  /* Pack files get replaced when revprops change.  Be prepared for NFS
+     to report the old file handle as stale. */
+  for (retry = 0; retry < RECOVERABLE_RETRY_COUNT; retry++)
+    {
+      RETRY_RECOVERABLE(err, NULL,
+                        svn_stringbuf_from_file2(&content, path, pool));
+      break;
     }
-  /* ### Call representation_string() ? */
-  return svn_error_trace(err);
-}
+  SVN_ERR(err);
 
-struct rep_read_baton
-{
-  /* The FS from which we're reading. */
-  svn_fs_t *fs;
+  data = content->data;
+  end = content->data + content->len;
 
-  /* If not NULL, this is the base for the first delta window in rs_list */
-  svn_stringbuf_t *base_window;
+  SVN_ERR(read_pack_header_line(&start_revision, &data, end, path, pool));
+  SVN_ERR(read_pack_header_line(&count, &data, end, path, pool));
+  if (start_revision < 1 || count < 1 || count > content->len)
+    return corrupt_revprop_pack(path, pool);
 
-  /* The state of all prior delta representations. */
-  apr_array_header_t *rs_list;
+  sizes = apr_palloc(pool, count * sizeof(*sizes));
+  for (i = 0; i < count; ++i)
+    SVN_ERR(read_pack_header_line(&sizes[i], &data, end, path, pool));
 
-  /* The plaintext state, if there is a plaintext. */
-  struct rep_state *src_state;
+  /* The header is terminated by an empty line. */
+  if (data == end || *data != '\n')
+    return corrupt_revprop_pack(path, pool);
+  ++data;
 
-  /* The index of the current delta chunk, if we are reading a delta. */
-  int chunk_index;
+  result->start_revision = (svn_revnum_t)start_revision;
+  result->revprops = apr_array_make(pool, (int)count, sizeof(svn_string_t *));
+  for (i = 0; i < count; ++i)
+    {
+      svn_string_t *serialized;
 
-  /* The buffer where we store undeltified data. */
-  char *buf;
-  apr_size_t buf_pos;
-  apr_size_t buf_len;
+      if (sizes[i] < 0 || sizes[i] > end - data)
+        return corrupt_revprop_pack(path, pool);
 
-  /* A checksum context for summing the data read in order to verify it.
-     Note: we don't need to use the sha1 checksum because we're only doing
-     data verification, for which md5 is perfectly safe.  */
-  svn_checksum_ctx_t *md5_checksum_ctx;
+      serialized = apr_palloc(pool, sizeof(*serialized));
+      serialized->data = data;
+      serialized->len = (apr_size_t)sizes[i];
+      APR_ARRAY_PUSH(result->revprops, svn_string_t *) = serialized;
 
-  svn_boolean_t checksum_finalized;
+      data += sizes[i];
+    }
 
-  /* The stored checksum of the representation we are reading, its
-     length, and the amount we've read so far.  Some of this
-     information is redundant with rs_list and src_state, but it's
-     convenient for the checksumming code to have it here. */
-  svn_checksum_t *md5_checksum;
+  if (data != end)
+    return corrupt_revprop_pack(path, pool);
 
-  svn_filesize_t len;
-  svn_filesize_t off;
+  *revprops = result;
+  return SVN_NO_ERROR;
+}
 
-  /* The key for the fulltext cache for this rep, if there is a
-     fulltext cache. */
-  const char *fulltext_cache_key;
-  /* The text we've been reading, if we're going to cache it. */
-  svn_stringbuf_t *current_fulltext;
+/* Write REVPROPS in revprop pack file format to STREAM.  Use POOL for
+   temporaries. */
+static svn_error_t *
+write_revprop_pack(svn_stream_t *stream,
+                   packed_revprops_t *revprops,
+                   apr_pool_t *pool)
+{
+  int i;
 
-  /* Used for temporary allocations during the read. */
-  apr_pool_t *pool;
+  SVN_ERR(svn_stream_printf(stream, pool, "%ld\n%d\n",
+                            revprops->start_revision,
+                            revprops->revprops->nelts));
+  for (i = 0; i < revprops->revprops->nelts; ++i)
+    SVN_ERR(svn_stream_printf(stream, pool, "%" APR_SIZE_T_FMT "\n",
+                              APR_ARRAY_IDX(revprops->revprops, i,
+                                            svn_string_t *)->len));
+  SVN_ERR(svn_stream_printf(stream, pool, "\n"));
 
-  /* Pool used to store file handles and other data that is persistant
-     for the entire stream read. */
-  apr_pool_t *filehandle_pool;
-};
+  for (i = 0; i < revprops->revprops->nelts; ++i)
+    {
+      svn_string_t *serialized = APR_ARRAY_IDX(revprops->revprops, i,
+                                               svn_string_t *);
+      apr_size_t len = serialized->len;
 
-/* Combine the name of the rev file in RS with the given OFFSET to form
- * a cache lookup key.  Allocations will be made from POOL.  May return
- * NULL if the key cannot be constructed. */
-static const char*
-get_window_key(struct rep_state *rs, apr_off_t offset, apr_pool_t *pool)
-{
-  const char *name;
-  const char *last_part;
-  const char *name_last;
+      SVN_ERR(svn_stream_write(stream, serialized->data, &len));
+    }
 
-  /* the rev file name containing the txdelta window.
-   * If this fails we are in serious trouble anyways.
-   * And if nobody else detects the problems, the file content checksum
-   * comparison _will_ find them.
-   */
-  if (apr_file_name_get(&name, rs->file))
-    return NULL;
+  return SVN_NO_ERROR;
+}
 
-  /* Handle packed files as well by scanning backwards until we find the
-   * revision or pack number. */
-  name_last = name + strlen(name) - 1;
-  while (! svn_ctype_isdigit(*name_last))
-    --name_last;
+/* Set *PATH to the name of the pack file that contains the revprops of
+   the packed revision REV in FS.  Allocate the result in POOL. */
+static svn_error_t *
+get_revprop_pack_file(const char **path,
+                      svn_fs_t *fs,
+                      svn_revnum_t rev,
+                      apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  const char *pack_dir = path_revprops_pack_shard(fs, rev, pool);
+  svn_revnum_t first_rev = rev - rev % ffd->max_files_per_dir;
+  svn_stringbuf_t *content;
+  apr_array_header_t *manifest;
 
-  last_part = name_last;
-  while (svn_ctype_isdigit(*last_part))
-    --last_part;
+  /* The revprops of r0 never get packed. */
+  if (first_rev == 0)
+    first_rev = 1;
 
-  /* We must differentiate between packed files (as of today, the number
-   * is being followed by a dot) and non-packed files (followed by \0).
-   * Otherwise, there might be overlaps in the numbering range if the
-   * repo gets packed after caching the txdeltas of non-packed revs.
-   * => add the first non-digit char to the packed number. */
-  if (name_last[1] != '\0')
-    ++name_last;
+  SVN_ERR(svn_stringbuf_from_file2(&content,
+                                   svn_dirent_join(pack_dir, PATH_MANIFEST,
+                                                   pool),
+                                   pool));
+  manifest = svn_cstring_split(content->data, "\n", TRUE, pool);
+  if (rev - first_rev >= manifest->nelts)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Revprop manifest for revision %ld "
+                               "is too short"), rev);
 
-  /* copy one char MORE than the actual number to mark packed files,
-   * i.e. packed revision file content uses different key space then
-   * non-packed ones: keys for packed rev file content ends with a dot
-   * for non-packed rev files they end with a digit. */
-  name = apr_pstrndup(pool, last_part + 1, name_last - last_part);
-  return svn_fs_fs__combine_number_and_string(offset, name, pool);
+  *path = svn_dirent_join(pack_dir,
+                          APR_ARRAY_IDX(manifest, rev - first_rev,
+                                        const char *),
+                          pool);
+  return SVN_NO_ERROR;
 }
 
-/* Read the WINDOW_P for the rep state RS from the current FSFS session's
- * cache. This will be a no-op and IS_CACHED will be set to FALSE if no
- * cache has been given. If a cache is available IS_CACHED will inform
- * the caller about the success of the lookup. Allocations (of the window
- * in particualar) will be made from POOL.
- *
- * If the information could be found, put RS and the position within the
- * rev file into the same state as if the data had just been read from it.
- */
+/* Read the revprops of the packed revision REV in FS into *PACK and set
+   *PATH to the pack file they were read from.  Allocate the results in
+   POOL. */
 static svn_error_t *
-get_cached_window(svn_txdelta_window_t **window_p,
-                  struct rep_state *rs,
-                  svn_boolean_t *is_cached,
+read_revprop_pack(packed_revprops_t **pack,
+                  const char **path,
+                  svn_fs_t *fs,
+                  svn_revnum_t rev,
                   apr_pool_t *pool)
 {
-  if (! rs->window_cache)
-    {
-      /* txdelta window has not been enabled */
-      *is_cached = FALSE;
-    }
-  else
+  SVN_ERR(get_revprop_pack_file(path, fs, rev, pool));
+  SVN_ERR(read_revprop_pack_file(pack, *path, pool));
+
+  if (   rev < (*pack)->start_revision
+      || rev >= (*pack)->start_revision + (*pack)->revprops->nelts)
+    return corrupt_revprop_pack(*path, pool);
+
+  return SVN_NO_ERROR;
+}
+
+/* Read the revprops of the packed revision REV in FS into *PROPLIST_P.
+   If revprops may be cached at revprop GENERATION, put the revprops of
+   all revisions in the same pack file into the revprop cache.  Allocate
+   the result in POOL. */
+static svn_error_t *
+read_packed_revprop(apr_hash_t **proplist_p,
+                    svn_fs_t *fs,
+                    svn_revnum_t rev,
+                    apr_int64_t generation,
+                    apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  packed_revprops_t *pack;
+  const char *path;
+  int i;
+
+  SVN_ERR(read_revprop_pack(&pack, &path, fs, rev, pool));
+  SVN_ERR(parse_revprops(proplist_p,
+                         APR_ARRAY_IDX(pack->revprops,
+                                       rev - pack->start_revision,
+                                       svn_string_t *),
+                         rev, pool));
+
+  /* Parsing is cheap compared to reading the pack file again.  Chances
+     are that the revprops of neighbouring revisions will be requested
+     soon (e.g. by 'svn log'). */
+  if (revprops_cachable(fs, generation))
     {
-      /* ask the cache for the desired txdelta window */
-      svn_fs_fs__txdelta_cached_window_t *cached_window;
-      SVN_ERR(svn_cache__get((void **) &cached_window,
-                             is_cached,
-                             rs->window_cache,
-                             get_window_key(rs, rs->off, pool),
-                             pool));
+      apr_pool_t *iterpool = svn_pool_create(pool);
 
-      if (*is_cached)
+      for (i = 0; i < pack->revprops->nelts; ++i)
         {
-          /* found it. Pass it back to the caller. */
-          *window_p = cached_window->window;
+          svn_revnum_t cached_rev = pack->start_revision + i;
+          apr_hash_t *proplist = *proplist_p;
 
-          /* manipulate the RS as if we just read the data */
-          rs->chunk_index++;
-          rs->off = cached_window->end_offset;
-
-          /* manipulate the rev file as if we just read from it */
-          SVN_ERR(svn_io_file_seek(rs->file, APR_SET, &rs->off, pool));
+          svn_pool_clear(iterpool);
+          if (cached_rev != rev)
+            SVN_ERR(parse_revprops(&proplist,
+                                   APR_ARRAY_IDX(pack->revprops, i,
+                                                 svn_string_t *),
+                                   cached_rev, iterpool));
+
+          SVN_ERR(svn_cache__set(ffd->revprop_cache,
+                                 get_revprop_cache_key(cached_rev, generation,
+                                                       iterpool),
+                                 proplist, iterpool));
         }
+
+      svn_pool_destroy(iterpool);
     }
 
   return SVN_NO_ERROR;
 }
 
-/* Store the WINDOW read at OFFSET for the rep state RS in the current
- * FSFS session's cache. This will be a no-op if no cache has been given.
- * Temporary allocations will be made from SCRATCH_POOL. */
+/* Read the revprops of the non-packed revision REV in FS into
+   *PROPLIST_P, allocated in POOL. */
 static svn_error_t *
-set_cached_window(svn_txdelta_window_t *window,
-                  struct rep_state *rs,
-                  apr_off_t offset,
-                  apr_pool_t *scratch_pool)
+read_non_packed_revprop(apr_hash_t **proplist_p,
+                        svn_fs_t *fs,
+                        svn_revnum_t rev,
+                        apr_pool_t *pool)
 {
-  if (rs->window_cache)
+  apr_hash_t *proplist;
+  apr_file_t *revprop_file = NULL;
+  svn_error_t *err = SVN_NO_ERROR;
+  int i;
+  apr_pool_t *iterpool;
+
+  proplist = apr_hash_make(pool);
+  iterpool = svn_pool_create(pool);
+  for (i = 0; i < RECOVERABLE_RETRY_COUNT; i++)
     {
-      /* store the window and the first offset _past_ it */
-      svn_fs_fs__txdelta_cached_window_t cached_window = { window, rs->off };
+      svn_pool_clear(iterpool);
 
-      /* but key it with the start offset because that is the known state
-       * when we will look it up */
-      return svn_cache__set(rs->window_cache,
-                            get_window_key(rs, offset, scratch_pool),
-                            &cached_window,
-                            scratch_pool);
+      /* Clear err here rather than after finding a recoverable error so
+       * we can return that error on the last iteration of the loop. */
+      svn_error_clear(err);
+      err = svn_io_file_open(&revprop_file, path_revprops(fs, rev,
+                                                          iterpool),
+                             APR_READ | APR_BUFFERED, APR_OS_DEFAULT,
+                             iterpool);
+      if (err)
+        {
+          if (APR_STATUS_IS_ENOENT(err->apr_err))
+            {
+              svn_error_clear(err);
+              return svn_error_createf(SVN_ERR_FS_NO_SUCH_REVISION, NULL,
+                                       _("No such revision %ld"), rev);
+            }
+#ifdef ESTALE
+          else if (APR_TO_OS_ERROR(err->apr_err) == ESTALE
+                   || APR_TO_OS_ERROR(err->apr_err) == EIO
+                   || APR_TO_OS_ERROR(err->apr_err) == ENOENT)
+            continue;
+#endif
+          return svn_error_trace(err);
+        }
+
+      SVN_ERR(svn_hash__clear(proplist, iterpool));
+      RETRY_RECOVERABLE(err, revprop_file,
+                        svn_hash_read2(proplist,
+                                       svn_stream_from_aprfile2(
+                                            revprop_file, TRUE, iterpool),
+                                       SVN_HASH_TERMINATOR, pool));
+
+      IGNORE_RECOVERABLE(err, svn_io_file_close(revprop_file, iterpool));
+
+      break;
     }
 
+  if (err)
+    return svn_error_trace(err);
+  svn_pool_destroy(iterpool);
+
+  *proplist_p = proplist;
+
   return SVN_NO_ERROR;
 }
 
-/* Read the WINDOW_P for the rep state RS from the current FSFS session's
- * cache. This will be a no-op and IS_CACHED will be set to FALSE if no
- * cache has been given. If a cache is available IS_CACHED will inform
- * the caller about the success of the lookup. Allocations (of the window
- * in particualar) will be made from POOL.
- */
+/* Set the revprops of the packed revision REV in FS to PROPLIST by
+   rewriting the pack file that contains them.  Use POOL for temporary
+   allocations. */
 static svn_error_t *
-get_cached_combined_window(svn_stringbuf_t **window_p,
-                           struct rep_state *rs,
-                           svn_boolean_t *is_cached,
-                           apr_pool_t *pool)
+write_packed_revprop(svn_fs_t *fs,
+                     svn_revnum_t rev,
+                     apr_hash_t *proplist,
+                     apr_pool_t *pool)
 {
-  if (! rs->combined_cache)
-    {
-      /* txdelta window has not been enabled */
-      *is_cached = FALSE;
-    }
-  else
-    {
-      /* ask the cache for the desired txdelta window */
-      return svn_cache__get((void **)window_p,
-                            is_cached,
-                            rs->combined_cache,
-                            get_window_key(rs, rs->start, pool),
-                            pool);
-    }
+  packed_revprops_t *pack;
+  const char *final_path;
+  const char *tmp_path;
+  svn_stream_t *stream;
 
-  return SVN_NO_ERROR;
+  SVN_ERR(read_revprop_pack(&pack, &final_path, fs, rev, pool));
+  SVN_ERR(serialize_revprops(&APR_ARRAY_IDX(pack->revprops,
+                                            rev - pack->start_revision,
+                                            svn_string_t *),
+                             proplist, pool));
+
+  SVN_ERR(svn_stream_open_unique(&stream, &tmp_path,
+                                 svn_dirent_dirname(final_path, pool),
+                                 svn_io_file_del_none, pool, pool));
+  SVN_ERR(write_revprop_pack(stream, pack, pool));
+  SVN_ERR(svn_stream_close(stream));
+
+  return move_into_place(tmp_path, final_path, final_path, pool);
 }
 
-/* Store the WINDOW read at OFFSET for the rep state RS in the current
- * FSFS session's cache. This will be a no-op if no cache has been given.
- * Temporary allocations will be made from SCRATCH_POOL. */
+/* Set the revision property list of revision REV in filesystem FS to
+   PROPLIST.  Use POOL for temporary allocations. */
 static svn_error_t *
-set_cached_combined_window(svn_stringbuf_t *window,
-                           struct rep_state *rs,
-                           apr_off_t offset,
-                           apr_pool_t *scratch_pool)
+set_revision_proplist(svn_fs_t *fs,
+                      svn_revnum_t rev,
+                      apr_hash_t *proplist,
+                      apr_pool_t *pool)
 {
-  if (rs->combined_cache)
+  SVN_ERR(ensure_revision_exists(fs, rev, pool));
+
+  if (is_packed_revprop(fs, rev))
     {
-      /* but key it with the start offset because that is the known state
-       * when we will look it up */
-      return svn_cache__set(rs->combined_cache,
-                            get_window_key(rs, offset, scratch_pool),
-                            window,
-                            scratch_pool);
+      SVN_ERR(write_packed_revprop(fs, rev, proplist, pool));
+    }
+  else
+    {
+      const char *final_path = path_revprops(fs, rev, pool);
+      const char *tmp_path;
+      const char *perms_reference;
+      svn_stream_t *stream;
+
+      /* ### do we have a directory sitting around already? we really shouldn't
+         ### have to get the dirname here. */
+      SVN_ERR(svn_stream_open_unique(&stream, &tmp_path,
+                                     svn_dirent_dirname(final_path, pool),
+                                     svn_io_file_del_none, pool, pool));
+      SVN_ERR(svn_hash_write2(proplist, stream, SVN_HASH_TERMINATOR, pool));
+      SVN_ERR(svn_stream_close(stream));
+
+      /* We use the rev file of this revision as the perms reference,
+         because when setting revprops for the first time, the revprop
+         file won't exist and therefore can't serve as its own reference.
+         (Whereas the rev file should already exist at this point.) */
+      SVN_ERR(svn_fs_fs__path_rev_absolute(&perms_reference, fs, rev, pool));
+      SVN_ERR(move_into_place(tmp_path, final_path, perms_reference, pool));
     }
 
   return SVN_NO_ERROR;
 }
 
-/* Build an array of rep_state structures in *LIST giving the delta
-   reps from first_rep to a plain-text or self-compressed rep.  Set
-   *SRC_STATE to the plain-text rep we find at the end of the chain,
-   or to NULL if the final delta representation is self-compressed.
-   The representation to start from is designated by filesystem FS, id
-   ID, and representation REP.
-   Also, set *WINDOW_P to the base window content for *LIST, if it
-   could be found in cache. Otherwise, *LIST will contain the base
-   representation for the whole delta chain.  */
 static svn_error_t *
-build_rep_list(apr_array_header_t **list,
-               svn_stringbuf_t **window_p,
-               struct rep_state **src_state,
-               svn_fs_t *fs,
-               representation_t *first_rep,
-               apr_pool_t *pool)
+revision_proplist(apr_hash_t **proplist_p,
+                  svn_fs_t *fs,
+                  svn_revnum_t rev,
+                  apr_pool_t *pool)
 {
-  representation_t rep;
-  struct rep_state *rs;
-  struct rep_args *rep_args;
-  svn_boolean_t is_cached = FALSE;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  apr_int64_t generation = 0;
+  svn_boolean_t cachable = FALSE;
 
-  *list = apr_array_make(pool, 1, sizeof(struct rep_state *));
-  rep = *first_rep;
+  SVN_ERR(ensure_revision_exists(fs, rev, pool));
 
-  while (1)
+  /* The generation must be read before the revprops themselves.  Any
+     change after that point will bump the generation again. */
+  if (ffd->revprop_cache
+      && ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
     {
-      SVN_ERR(create_rep_state(&rs, &rep_args, &rep, fs, pool));
-      SVN_ERR(get_cached_combined_window(window_p, rs, &is_cached, pool));
+      SVN_ERR(read_revprop_generation(&generation, fs, pool));
+      cachable = revprops_cachable(fs, generation);
+    }
+
+  if (cachable)
+    {
+      svn_boolean_t is_cached;
+
+      SVN_ERR(svn_cache__get((void **) proplist_p, &is_cached,
+                             ffd->revprop_cache,
+                             get_revprop_cache_key(rev, generation, pool),
+                             pool));
       if (is_cached)
-        {
-          /* We already have a reconstructed window in our cache.
-             Write a pseudo rep_state with the full length. */
-          rs->off = rs->start;
-          rs->end = rs->start + (*window_p)->len;
-          *src_state = rs;
-          return SVN_NO_ERROR;
-        }
+        return SVN_NO_ERROR;
+    }
 
-      if (rep_args->is_delta == FALSE)
+  if (! is_packed_revprop(fs, rev))
+    {
+      svn_error_t *err = read_non_packed_revprop(proplist_p, fs, rev, pool);
+
+      /* The shard may have been packed since we last looked. */
+      if (err && err->apr_err == SVN_ERR_FS_NO_SUCH_REVISION
+          && ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT
+          && ffd->max_files_per_dir)
         {
-          /* This is a plaintext, so just return the current rep_state. */
-          *src_state = rs;
-          return SVN_NO_ERROR;
+          svn_error_clear(err);
+          SVN_ERR(update_min_unpacked_rev(fs, pool));
+          if (! is_packed_revprop(fs, rev))
+            return svn_error_createf(SVN_ERR_FS_NO_SUCH_REVISION, NULL,
+                                     _("No such revision %ld"), rev);
         }
-
-      /* Push this rep onto the list.  If it's self-compressed, we're done. */
-      APR_ARRAY_PUSH(*list, struct rep_state *) = rs;
-      if (rep_args->is_delta_vs_empty)
+      else
         {
-          *src_state = NULL;
+          SVN_ERR(err);
+          if (cachable)
+            SVN_ERR(svn_cache__set(ffd->revprop_cache,
+                                   get_revprop_cache_key(rev, generation,
+                                                         pool),
+                                   *proplist_p, pool));
+
           return SVN_NO_ERROR;
         }
-
-      rep.revision = rep_args->base_revision;
-      rep.offset = rep_args->base_offset;
-      rep.size = rep_args->base_length;
-      rep.txn_id = NULL;
     }
-}
 
+  /* Also caches the revprops of the neighbouring revisions. */
+  return svn_error_trace(read_packed_revprop(proplist_p, fs, rev,
+                                             generation, pool));
+}
 
-/* Create a rep_read_baton structure for node revision NODEREV in
-   filesystem FS and store it in *RB_P.  If FULLTEXT_CACHE_KEY is not
-   NULL, it is the rep's key in the fulltext cache, and a stringbuf
-   must be allocated to store the text.  Perform all allocations in
-   POOL.  If rep is mutable, it must be for file contents. */
-static svn_error_t *
-rep_read_get_baton(struct rep_read_baton **rb_p,
-                   svn_fs_t *fs,
-                   representation_t *rep,
-                   const char *fulltext_cache_key,
-                   apr_pool_t *pool)
+svn_error_t *
+svn_fs_fs__revision_proplist(apr_hash_t **proplist_p,
+                             svn_fs_t *fs,
+                             svn_revnum_t rev,
+                             apr_pool_t *pool)
 {
-  struct rep_read_baton *b;
-
-  b = apr_pcalloc(pool, sizeof(*b));
-  b->fs = fs;
-  b->base_window = NULL;
-  b->chunk_index = 0;
-  b->buf = NULL;
-  b->md5_checksum_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
-  b->checksum_finalized = FALSE;
-  b->md5_checksum = svn_checksum_dup(rep->md5_checksum, pool);
-  b->len = rep->expanded_size ? rep->expanded_size : rep->size;
-  b->off = 0;
-  b->fulltext_cache_key = fulltext_cache_key;
-  b->pool = svn_pool_create(pool);
-  b->filehandle_pool = svn_pool_create(pool);
-
-  if (fulltext_cache_key)
-    b->current_fulltext = svn_stringbuf_create_ensure
-                            ((apr_size_t)b->len,
-                             b->filehandle_pool);
-  else
-    b->current_fulltext = NULL;
-
-  SVN_ERR(build_rep_list(&b->rs_list, &b->base_window,
-                         &b->src_state, fs, rep,
-                         b->filehandle_pool));
-
-  /* Save our output baton. */
-  *rb_p = b;
+  SVN_ERR(revision_proplist(proplist_p, fs, rev, pool));
 
   return SVN_NO_ERROR;
 }
 
-/* Skip forwards to THIS_CHUNK in REP_STATE and then read the next delta
-   window into *NWIN. */
+/* Represents where in the current svndiff data block each
+   representation is. */
+struct rep_state
+{
+  apr_file_t *file;
+                    /* If not NULL, the mapped pack file to read from
+                       instead of FILE, which will then be NULL. */
+  const pack_mapping_t *mapping;
+                    /* The txdelta window cache to use or NULL. */
+  svn_cache__t *window_cache;
+                    /* Caches un-deltified windows. May be NULL. */
+  svn_cache__t *combined_cache;
+  apr_off_t start;  /* The starting offset for the raw
+                       svndiff/plaintext data minus header. */
+  apr_off_t off;    /* The current offset into the file. */
+  apr_off_t end;    /* The end offset of the raw data. */
+  int ver;          /* If a delta, what svndiff version? */
+  int chunk_index;
+};
+
+/* See create_rep_state, which wraps this and adds another error. */
 static svn_error_t *
-read_window(svn_txdelta_window_t **nwin, int this_chunk, struct rep_state *rs,
-            apr_pool_t *pool)
+create_rep_state_body(struct rep_state **rep_state,
+                      struct rep_args **rep_args,
+                      representation_t *rep,
+                      svn_fs_t *fs,
+                      apr_pool_t *pool)
 {
-  svn_stream_t *stream;
-  svn_boolean_t is_cached;
-  apr_off_t old_offset;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  struct rep_state *rs = apr_pcalloc(pool, sizeof(*rs));
+  struct rep_args *ra;
+  unsigned char buf[4];
 
-  SVN_ERR_ASSERT(rs->chunk_index <= this_chunk);
+  /* Packed reps may be read from memory. */
+  if (! rep->txn_id)
+    SVN_ERR(map_revision(&rs->mapping, &rs->start, fs, rep->revision,
+                         rep->offset, pool));
 
-  /* Skip windows to reach the current chunk if we aren't there yet. */
-  while (rs->chunk_index < this_chunk)
+  if (rs->mapping)
     {
-      SVN_ERR(svn_txdelta_skip_svndiff_window(rs->file, rs->ver, pool));
-      rs->chunk_index++;
-      SVN_ERR(get_file_offset(&rs->off, rs->file, pool));
-      if (rs->off >= rs->end)
-        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                _("Reading one svndiff window read "
-                                  "beyond the end of the "
-                                  "representation"));
+      SVN_ERR(read_mapped_rep_line(&ra, rs->mapping, &rs->start, pool));
+      if (rep->size > rs->mapping->size - rs->start)
+        return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                                 _("Representation in revision %ld "
+                                   "exceeds its pack file"),
+                                 rep->revision);
+    }
+  else
+    {
+      SVN_ERR(open_and_seek_representation(&rs->file, fs, rep, pool));
+      SVN_ERR(read_rep_line(&ra, rs->file, pool));
+      SVN_ERR(get_file_offset(&rs->start, rs->file, pool));
     }
 
-  /* Read the next window. But first, try to find it in the cache. */
-  SVN_ERR(get_cached_window(nwin, rs, &is_cached, pool));
-  if (is_cached)
-    return SVN_NO_ERROR;
-
-  /* Actually read the next window. */
-  old_offset = rs->off;
-  stream = svn_stream_from_aprfile2(rs->file, TRUE, pool);
-  SVN_ERR(svn_txdelta_read_svndiff_window(nwin, stream, rs->ver, pool));
-  rs->chunk_index++;
-  SVN_ERR(get_file_offset(&rs->off, rs->file, pool));
+  rs->window_cache = ffd->txdelta_window_cache;
+  rs->combined_cache = ffd->combined_window_cache;
+  rs->off = rs->start;
+  rs->end = rs->start + rep->size;
+  *rep_state = rs;
+  *rep_args = ra;
 
-  if (rs->off > rs->end)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Reading one svndiff window read beyond "
-                              "the end of the representation"));
+  if (ra->is_delta == FALSE)
+    /* This is a plaintext, so just return the current rep_state. */
+    return SVN_NO_ERROR;
 
-  /* the window has not been cached before, thus cache it now
-   * (if caching is used for them at all) */
-  return set_cached_window(*nwin, rs, old_offset, pool);
-}
-
-/* Get the undeltified window that is a result of combining all deltas
-   from the current desired representation identified in *RB with its
-   base representation.  Store the window in *RESULT. */
-static svn_error_t *
-get_combined_window(svn_stringbuf_t **result,
-                    struct rep_read_baton *rb)
-{
-  apr_pool_t *pool, *new_pool, *window_pool;
-  int i;
-  svn_txdelta_window_t *window;
-  apr_array_header_t *windows;
-  svn_stringbuf_t *source, *buf = rb->base_window;
-  struct rep_state *rs;
-
-  /* Read all windows that we need to combine. This is fine because
-     the size of each window is relatively small (100kB) and skip-
-     delta limits the number of deltas in a chain to well under 100.
-     Stop early if one of them does not depend on its predecessors. */
-  window_pool = svn_pool_create(rb->pool);
-  windows = apr_array_make(window_pool, 0, sizeof(svn_txdelta_window_t *));
-  for (i = 0; i < rb->rs_list->nelts; ++i)
-    {
-      rs = APR_ARRAY_IDX(rb->rs_list, i, struct rep_state *);
-      SVN_ERR(read_window(&window, rb->chunk_index, rs, window_pool));
-
-      APR_ARRAY_PUSH(windows, svn_txdelta_window_t *) = window;
-      if (window->src_ops == 0)
-        {
-          ++i;
-          break;
-        }
-    }
-
-  /* Combine in the windows from the other delta reps. */
-  pool = svn_pool_create(rb->pool);
-  for (--i; i >= 0; --i)
+  /* We are dealing with a delta, find out what version. */
+  if (rs->mapping)
     {
-      rs = APR_ARRAY_IDX(rb->rs_list, i, struct rep_state *);
-      window = APR_ARRAY_IDX(windows, i, svn_txdelta_window_t *);
-
-      /* Combine this window with the current one. */
-      source = buf;
-      new_pool = svn_pool_create(rb->pool);
-      buf = svn_stringbuf_create_ensure(window->tview_len, new_pool);
-      buf->len = window->tview_len;
-
-      svn_txdelta_apply_instructions(window, source ? source->data : NULL,
-                                     buf->data, &buf->len);
-      if (buf->len != window->tview_len)
+      if (rs->end - rs->start < (apr_off_t)sizeof(buf))
         return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                _("svndiff window length is "
-                                  "corrupt"));
-
-      /* Cache windows only if the whole rep content could be read as a
-         single chunk.  Only then will no other chunk need a deeper RS
-         list than the cached chunk. */
-      if ((rb->chunk_index == 0) && (rs->off == rs->end))
-        SVN_ERR(set_cached_combined_window(buf, rs, rs->start, new_pool));
-
-      /* Cycle pools so that we only need to hold three windows at a time. */
-      svn_pool_destroy(pool);
-      pool = new_pool;
+                                _("Malformed svndiff data in "
+                                  "representation"));
+      memcpy(buf, rs->mapping->data + rs->start, sizeof(buf));
     }
+  else
+    SVN_ERR(svn_io_file_read_full2(rs->file, buf, sizeof(buf),
+                                   NULL, NULL, pool));
+  /* ### Layering violation */
+  if (! ((buf[0] == 'S') && (buf[1] == 'V') && (buf[2] == 'N')))
+    return svn_error_create
+      (SVN_ERR_FS_CORRUPT, NULL,
+       _("Malformed svndiff data in representation"));
+  rs->ver = buf[3];
+  rs->chunk_index = 0;
+  rs->off += 4;
 
-  svn_pool_destroy(window_pool);
-
-  *result = buf;
   return SVN_NO_ERROR;
 }
 
-/* Returns whether or not the expanded fulltext of the file is cachable
- * based on its size SIZE.  The decision depends on the cache used by RB.
- */
-static svn_boolean_t
-fulltext_size_is_cachable(fs_fs_data_t *ffd, svn_filesize_t size)
-{
-  return (size < APR_SIZE_MAX)
-      && svn_cache__is_cachable(ffd->fulltext_cache, (apr_size_t)size);
-}
-
-/* Close method used on streams returned by read_representation().
- */
+/* Read the rep args for REP in filesystem FS and create a rep_state
+   for reading the representation.  Return the rep_state in *REP_STATE
+   and the rep args in *REP_ARGS, both allocated in POOL. */
 static svn_error_t *
-rep_read_contents_close(void *baton)
+create_rep_state(struct rep_state **rep_state,
+                 struct rep_args **rep_args,
+                 representation_t *rep,
+                 svn_fs_t *fs,
+                 apr_pool_t *pool)
 {
-  struct rep_read_baton *rb = baton;
-
-  svn_pool_destroy(rb->pool);
-  svn_pool_destroy(rb->filehandle_pool);
+  svn_error_t *err = create_rep_state_body(rep_state, rep_args, rep, fs, pool);
+  if (err && err->apr_err == SVN_ERR_FS_CORRUPT)
+    {
+      fs_fs_data_t *ffd = fs->fsap_data;
 
-  return SVN_NO_ERROR;
+      /* ### This always returns "-1" for transaction reps, because
+         ### this particular bit of code doesn't know if the rep is
+         ### stored in the protorev or in the mutable area (for props
+         ### or dir contents).  It is pretty rare for FSFS to *read*
+         ### from the protorev file, though, so this is probably OK.
+         ### And anyone going to debug corruption errors is probably
+         ### going to jump straight to this comment anyway! */
+      return svn_error_createf(SVN_ERR_FS_CORRUPT, err,
+                               "Corrupt representation '%s'",
+                               rep
+                               ? representation_string(rep, ffd->format, TRUE,
+                                                       TRUE, pool)
+                               : "(null)");
+    }
+  /* ### Call representation_string() ? */
+  return svn_error_trace(err);
 }
 
-/* Return the next *LEN bytes of the rep and store them in *BUF. */
-static svn_error_t *
-get_contents(struct rep_read_baton *rb,
-             char *buf,
-             apr_size_t *len)
+struct rep_read_baton
 {
-  apr_size_t copy_len, remaining = *len, offset;
-  char *cur = buf;
-  struct rep_state *rs;
+  /* The FS from which we're reading. */
+  svn_fs_t *fs;
 
-  /* Special case for when there are no delta reps, only a plain
-     text. */
-  if (rb->rs_list->nelts == 0)
-    {
-      copy_len = remaining;
-      rs = rb->src_state;
+  /* If not NULL, this is the base for the first delta window in rs_list */
+  svn_stringbuf_t *base_window;
 
-      if (rb->base_window != NULL)
-        {
-          /* We got the desired rep directly from the cache.
-             This is where we need the pseudo rep_state created
-             by build_rep_list(). */
-          offset = rs->off - rs->start;
-          if (copy_len + offset > rb->base_window->len)
-            copy_len = offset < rb->base_window->len
-                     ? rb->base_window->len - offset
-                     : 0;
+  /* The state of all prior delta representations. */
+  apr_array_header_t *rs_list;
 
-          memcpy (cur, rb->base_window->data + offset, copy_len);
-        }
-      else
-        {
-          if (((apr_off_t) copy_len) > rs->end - rs->off)
-            copy_len = (apr_size_t) (rs->end - rs->off);
-          SVN_ERR(svn_io_file_read_full2(rs->file, cur, copy_len, NULL,
-                                         NULL, rb->pool));
-        }
+  /* The plaintext state, if there is a plaintext. */
+  struct rep_state *src_state;
 
-      rs->off += copy_len;
-      *len = copy_len;
-      return SVN_NO_ERROR;
-    }
+  /* The index of the current delta chunk, if we are reading a delta. */
+  int chunk_index;
 
-  while (remaining > 0)
-    {
-      /* If we have buffered data from a previous chunk, use that. */
-      if (rb->buf)
-        {
-          /* Determine how much to copy from the buffer. */
-          copy_len = rb->buf_len - rb->buf_pos;
-          if (copy_len > remaining)
-            copy_len = remaining;
+  /* The buffer where we store undeltified data. */
+  char *buf;
+  apr_size_t buf_pos;
+  apr_size_t buf_len;
 
-          /* Actually copy the data. */
-          memcpy(cur, rb->buf + rb->buf_pos, copy_len);
-          rb->buf_pos += copy_len;
-          cur += copy_len;
-          remaining -= copy_len;
+  /* A checksum context for summing the data read in order to verify it.
+     Note: we don't need to use the sha1 checksum because we're only doing
+     data verification, for which md5 is perfectly safe.  */
+  svn_checksum_ctx_t *md5_checksum_ctx;
 
-          /* If the buffer is all used up, clear it and empty the
-             local pool. */
-          if (rb->buf_pos == rb->buf_len)
-            {
-              svn_pool_clear(rb->pool);
-              rb->buf = NULL;
-            }
-        }
-      else
-        {
-          svn_stringbuf_t *sbuf = NULL;
+  svn_boolean_t checksum_finalized;
 
-          rs = APR_ARRAY_IDX(rb->rs_list, 0, struct rep_state *);
-          if (rs->off == rs->end)
-            break;
+  /* The stored checksum of the representation we are reading, its
+     length, and the amount we've read so far.  Some of this
+     information is redundant with rs_list and src_state, but it's
+     convenient for the checksumming code to have it here. */
+  svn_checksum_t *md5_checksum;
 
-          /* Get more buffered data by evaluating a chunk. */
-          SVN_ERR(get_combined_window(&sbuf, rb));
+  svn_filesize_t len;
+  svn_filesize_t off;
 
-          rb->chunk_index++;
-          rb->buf_len = sbuf->len;
-          rb->buf = sbuf->data;
-          rb->buf_pos = 0;
-        }
-    }
+  /* The key for the fulltext cache for this rep, if there is a
+     fulltext cache. */
+  const char *fulltext_cache_key;
+  /* The text we've been reading, if we're going to cache it. */
+  svn_stringbuf_t *current_fulltext;
 
-  *len = cur - buf;
+  /* Used for temporary allocations during the read. */
+  apr_pool_t *pool;
 
-  return SVN_NO_ERROR;
-}
+  /* Pool used to store file handles and other data that is persistant
+     for the entire stream read. */
+  apr_pool_t *filehandle_pool;
+};
 
-/* BATON is of type `rep_read_baton'; read the next *LEN bytes of the
-   representation and store them in *BUF.  Sum as we read and verify
-   the MD5 sum at the end. */
-static svn_error_t *
-rep_read_contents(void *baton,
-                  char *buf,
-                  apr_size_t *len)
+/* Combine the name of the rev file in RS with the given OFFSET to form
+ * a cache lookup key.  Allocations will be made from POOL.  May return
+ * NULL if the key cannot be constructed. */
+static const char*
+get_window_key(struct rep_state *rs, apr_off_t offset, apr_pool_t *pool)
 {
-  struct rep_read_baton *rb = baton;
-
-  /* Get the next block of data. */
-  SVN_ERR(get_contents(rb, buf, len));
+  const char *name;
+  const char *last_part;
+  const char *name_last;
 
-  if (rb->current_fulltext)
-    svn_stringbuf_appendbytes(rb->current_fulltext, buf, *len);
+  /* Mapped pack files know their key already. */
+  if (rs->mapping)
+    return svn_fs_fs__combine_number_and_string(offset,
+                                                rs->mapping->window_key,
+                                                pool);
 
-  /* Perform checksumming.  We want to check the checksum as soon as
-     the last byte of data is read, in case the caller never performs
-     a short read, but we don't want to finalize the MD5 context
-     twice. */
-  if (!rb->checksum_finalized)
-    {
-      SVN_ERR(svn_checksum_update(rb->md5_checksum_ctx, buf, *len));
-      rb->off += *len;
-      if (rb->off == rb->len)
-        {
-          svn_checksum_t *md5_checksum;
-
-          rb->checksum_finalized = TRUE;
-          SVN_ERR(svn_checksum_final(&md5_checksum, rb->md5_checksum_ctx,
-                                     rb->pool));
-          if (!svn_checksum_match(md5_checksum, rb->md5_checksum))
-            return svn_error_create(SVN_ERR_FS_CORRUPT,
-                    svn_checksum_mismatch_err(rb->md5_checksum, md5_checksum,
-                        rb->pool,
-                        _("Checksum mismatch while reading representation")),
-                    NULL);
-        }
-    }
+  /* the rev file name containing the txdelta window.
+   * If this fails we are in serious trouble anyways.
+   * And if nobody else detects the problems, the file content checksum
+   * comparison _will_ find them.
+   */
+  if (apr_file_name_get(&name, rs->file))
+    return NULL;
 
-  if (rb->off == rb->len && rb->current_fulltext)
-    {
-      fs_fs_data_t *ffd = rb->fs->fsap_data;
-      SVN_ERR(svn_cache__set(ffd->fulltext_cache, rb->fulltext_cache_key,
-                             rb->current_fulltext, rb->pool));
-      rb->current_fulltext = NULL;
-    }
+  /* Handle packed files as well by scanning backwards until we find the
+   * revision or pack number. */
+  name_last = name + strlen(name) - 1;
+  while (! svn_ctype_isdigit(*name_last))
+    --name_last;
 
-  return SVN_NO_ERROR;
-}
+  last_part = name_last;
+  while (svn_ctype_isdigit(*last_part))
+    --last_part;
 
+  /* We must differentiate between packed files (as of today, the number
+   * is being followed by a dot) and non-packed files (followed by \0).
+   * Otherwise, there might be overlaps in the numbering range if the
+   * repo gets packed after caching the txdeltas of non-packed revs.
+   * => add the first non-digit char to the packed number. */
+  if (name_last[1] != '\0')
+    ++name_last;
 
-/* Return a stream in *CONTENTS_P that will read the contents of a
-   representation stored at the location given by REP.  Appropriate
-   for any kind of immutable representation, but only for file
-   contents (not props or directory contents) in mutable
-   representations.
+  /* copy one char MORE than the actual number to mark packed files,
+   * i.e. packed revision file content uses different key space then
+   * non-packed ones: keys for packed rev file content ends with a dot
+   * for non-packed rev files they end with a digit. */
+  name = apr_pstrndup(pool, last_part + 1, name_last - last_part);
+  return svn_fs_fs__combine_number_and_string(offset, name, pool);
+}
 
-   If REP is NULL, the representation is assumed to be empty, and the
-   empty stream is returned.
-*/
+/* Read the WINDOW_P for the rep state RS from the current FSFS session's
+ * cache. This will be a no-op and IS_CACHED will be set to FALSE if no
+ * cache has been given. If a cache is available IS_CACHED will inform
+ * the caller about the success of the lookup. Allocations (of the window
+ * in particualar) will be made from POOL.
+ *
+ * If the information could be found, put RS and the position within the
+ * rev file into the same state as if the data had just been read from it.
+ */
 static svn_error_t *
-read_representation(svn_stream_t **contents_p,
-                    svn_fs_t *fs,
-                    representation_t *rep,
-                    apr_pool_t *pool)
+get_cached_window(svn_txdelta_window_t **window_p,
+                  struct rep_state *rs,
+                  svn_boolean_t *is_cached,
+                  apr_pool_t *pool)
 {
-  if (! rep)
+  if (! rs->window_cache)
     {
-      *contents_p = svn_stream_empty(pool);
+      /* txdelta window has not been enabled */
+      *is_cached = FALSE;
     }
   else
     {
-      fs_fs_data_t *ffd = fs->fsap_data;
-      const char *fulltext_cache_key = NULL;
-      svn_filesize_t len = rep->expanded_size ? rep->expanded_size : rep->size;
-      struct rep_read_baton *rb;
+      /* ask the cache for the desired txdelta window */
+      svn_fs_fs__txdelta_cached_window_t *cached_window;
+      SVN_ERR(svn_cache__get((void **) &cached_window,
+                             is_cached,
+                             rs->window_cache,
+                             get_window_key(rs, rs->off, pool),
+                             pool));
 
-      if (ffd->fulltext_cache && SVN_IS_VALID_REVNUM(rep->revision)
-          && fulltext_size_is_cachable(ffd, len))
+      if (*is_cached)
         {
-          svn_stringbuf_t *fulltext;
-          svn_boolean_t is_cached;
-          fulltext_cache_key = apr_psprintf(pool, "%ld/%" APR_OFF_T_FMT,
-                                      rep->revision, rep->offset);
-          SVN_ERR(svn_cache__get((void **) &fulltext, &is_cached,
-                                 ffd->fulltext_cache, fulltext_cache_key,
-                                 pool));
-          if (is_cached)
-            {
-              *contents_p = svn_stream_from_stringbuf(fulltext, pool);
-              return SVN_NO_ERROR;
-            }
-        }
+          /* found it. Pass it back to the caller. */
+          *window_p = cached_window->window;
 
-      SVN_ERR(rep_read_get_baton(&rb, fs, rep, fulltext_cache_key, pool));
+          /* manipulate the RS as if we just read the data */
+          rs->chunk_index++;
+          rs->off = cached_window->end_offset;
 
-      *contents_p = svn_stream_create(rb, pool);
-      svn_stream_set_read(*contents_p, rep_read_contents);
-      svn_stream_set_close(*contents_p, rep_read_contents_close);
+          /* manipulate the rev file as if we just read from it */
+          if (rs->file)
+            SVN_ERR(svn_io_file_seek(rs->file, APR_SET, &rs->off, pool));
+        }
     }
 
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__get_contents(svn_stream_t **contents_p,
-                        svn_fs_t *fs,
-                        node_revision_t *noderev,
-                        apr_pool_t *pool)
+/* Store the WINDOW read at OFFSET for the rep state RS in the current
+ * FSFS session's cache. This will be a no-op if no cache has been given.
+ * Temporary allocations will be made from SCRATCH_POOL. */
+static svn_error_t *
+set_cached_window(svn_txdelta_window_t *window,
+                  struct rep_state *rs,
+                  apr_off_t offset,
+                  apr_pool_t *scratch_pool)
 {
-  return read_representation(contents_p, fs, noderev->data_rep, pool);
+  if (rs->window_cache)
+    {
+      /* store the window and the first offset _past_ it */
+      svn_fs_fs__txdelta_cached_window_t cached_window = { window, rs->off };
+
+      /* but key it with the start offset because that is the known state
+       * when we will look it up */
+      return svn_cache__set(rs->window_cache,
+                            get_window_key(rs, offset, scratch_pool),
+                            &cached_window,
+                            scratch_pool);
+    }
+
+  return SVN_NO_ERROR;
 }
 
-/* Baton used when reading delta windows. */
-struct delta_read_baton
+/* Read the WINDOW_P for the rep state RS from the current FSFS session's
+ * cache. This will be a no-op and IS_CACHED will be set to FALSE if no
+ * cache has been given. If a cache is available IS_CACHED will inform
+ * the caller about the success of the lookup. Allocations (of the window
+ * in particualar) will be made from POOL.
+ */
+static svn_error_t *
+get_cached_combined_window(svn_stringbuf_t **window_p,
+                           struct rep_state *rs,
+                           svn_boolean_t *is_cached,
+                           apr_pool_t *pool)
 {
-  struct rep_state *rs;
-  svn_checksum_t *checksum;
-};
+  if (! rs->combined_cache)
+    {
+      /* txdelta window has not been enabled */
+      *is_cached = FALSE;
+    }
+  else
+    {
+      /* ask the cache for the desired txdelta window */
+      return svn_cache__get((void **)window_p,
+                            is_cached,
+                            rs->combined_cache,
+                            get_window_key(rs, rs->start, pool),
+                            pool);
+    }
 
-/* This implements the svn_txdelta_next_window_fn_t interface. */
+  return SVN_NO_ERROR;
+}
+
+/* Store the WINDOW read at OFFSET for the rep state RS in the current
+ * FSFS session's cache. This will be a no-op if no cache has been given.
+ * Temporary allocations will be made from SCRATCH_POOL. */
 static svn_error_t *
-delta_read_next_window(svn_txdelta_window_t **window, void *baton,
-                       apr_pool_t *pool)
+set_cached_combined_window(svn_stringbuf_t *window,
+                           struct rep_state *rs,
+                           apr_off_t offset,
+                           apr_pool_t *scratch_pool)
 {
-  struct delta_read_baton *drb = baton;
-
-  if (drb->rs->off == drb->rs->end)
+  if (rs->combined_cache)
     {
-      *window = NULL;
-      return SVN_NO_ERROR;
+      /* but key it with the start offset because that is the known state
+       * when we will look it up */
+      return svn_cache__set(rs->combined_cache,
+                            get_window_key(rs, offset, scratch_pool),
+                            window,
+                            scratch_pool);
     }
 
-  return read_window(window, drb->rs->chunk_index, drb->rs, pool);
+  return SVN_NO_ERROR;
 }
 
-/* This implements the svn_txdelta_md5_digest_fn_t interface. */
-static const unsigned char *
-delta_read_md5_digest(void *baton)
+/* Account for a read of a representation in FS that had to combine
+   LENGTH representations. */
+static void
+record_delta_chain(svn_fs_t *fs,
+                   int length)
 {
-  struct delta_read_baton *drb = baton;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  svn_fs_delta_chain_stats_t *stats = &ffd->delta_chain_stats;
 
-  if (drb->checksum->kind == svn_checksum_md5)
-    return drb->checksum->digest;
-  else
-    return NULL;
+  stats->read_count++;
+  stats->total_length += length;
+  if (length > stats->max_length)
+    stats->max_length = length;
 }
 
-svn_error_t *
-svn_fs_fs__get_file_delta_stream(svn_txdelta_stream_t **stream_p,
-                                 svn_fs_t *fs,
-                                 node_revision_t *source,
-                                 node_revision_t *target,
-                                 apr_pool_t *pool)
+void
+svn_fs_fs__get_delta_chain_stats(svn_fs_delta_chain_stats_t *stats,
+                                 svn_fs_t *fs)
 {
-  svn_stream_t *source_stream, *target_stream;
+  fs_fs_data_t *ffd = fs->fsap_data;
 
-  /* Try a shortcut: if the target is stored as a delta against the source,
-     then just use that delta. */
-  if (source && source->data_rep && target->data_rep)
+  *stats = ffd->delta_chain_stats;
+}
+
+/* Set *LENGTH to the number of representations that need to be combined
+   to reconstruct REP in FS, but stop counting at LIMIT.  Use POOL for
+   temporary allocations. */
+static svn_error_t *
+get_delta_chain_length(int *length,
+                       representation_t *rep,
+                       svn_fs_t *fs,
+                       int limit,
+                       apr_pool_t *pool)
+{
+  apr_pool_t *iterpool = svn_pool_create(pool);
+  representation_t base_rep = *rep;
+
+  for (*length = 1; *length < limit; ++*length)
     {
-      struct rep_state *rep_state;
+      struct rep_state *rs;
       struct rep_args *rep_args;
 
-      /* Read target's base rep if any. */
-      SVN_ERR(create_rep_state(&rep_state, &rep_args, target->data_rep,
-                               fs, pool));
-      /* If that matches source, then use this delta as is. */
-      if (rep_args->is_delta
-          && (rep_args->is_delta_vs_empty
-              || (rep_args->base_revision == source->data_rep->revision
-                  && rep_args->base_offset == source->data_rep->offset)))
-        {
-          /* Create the delta read baton. */
-          struct delta_read_baton *drb = apr_pcalloc(pool, sizeof(*drb));
-          drb->rs = rep_state;
-          drb->checksum = svn_checksum_dup(target->data_rep->md5_checksum,
-                                           pool);
-          *stream_p = svn_txdelta_stream_create(drb, delta_read_next_window,
-                                                delta_read_md5_digest, pool);
-          return SVN_NO_ERROR;
-        }
-      else
-        SVN_ERR(svn_io_file_close(rep_state->file, pool));
-    }
+      svn_pool_clear(iterpool);
+      SVN_ERR(create_rep_state(&rs, &rep_args, &base_rep, fs, iterpool));
+      if (! rep_args->is_delta || rep_args->is_delta_vs_empty)
+        break;
 
-  /* Read both fulltexts and construct a delta. */
-  if (source)
-    SVN_ERR(read_representation(&source_stream, fs, source->data_rep, pool));
-  else
-    source_stream = svn_stream_empty(pool);
-  SVN_ERR(read_representation(&target_stream, fs, target->data_rep, pool));
-  svn_txdelta(stream_p, source_stream, target_stream, pool);
+      base_rep.revision = rep_args->base_revision;
+      base_rep.offset = rep_args->base_offset;
+      base_rep.size = rep_args->base_length;
+      base_rep.txn_id = NULL;
+    }
 
+  svn_pool_destroy(iterpool);
   return SVN_NO_ERROR;
 }
 
-
-/* Fetch the contents of a directory into ENTRIES.  Values are stored
-   as filename to string mappings; further conversion is necessary to
-   convert them into svn_fs_dirent_t values. */
+/* Build an array of rep_state structures in *LIST giving the delta
+   reps from first_rep to a plain-text or self-compressed rep.  Set
+   *SRC_STATE to the plain-text rep we find at the end of the chain,
+   or to NULL if the final delta representation is self-compressed.
+   The representation to start from is designated by filesystem FS, id
+   ID, and representation REP.
+   Also, set *WINDOW_P to the base window content for *LIST, if it
+   could be found in cache. Otherwise, *LIST will contain the base
+   representation for the whole delta chain.  */
 static svn_error_t *
-get_dir_contents(apr_hash_t *entries,
-                 svn_fs_t *fs,
-                 node_revision_t *noderev,
-                 apr_pool_t *pool)
+build_rep_list(apr_array_header_t **list,
+               svn_stringbuf_t **window_p,
+               struct rep_state **src_state,
+               svn_fs_t *fs,
+               representation_t *first_rep,
+               apr_pool_t *pool)
 {
-  svn_stream_t *contents;
+  representation_t rep;
+  struct rep_state *rs;
+  struct rep_args *rep_args;
+  svn_boolean_t is_cached = FALSE;
+  int length = 0;
 
-  if (noderev->data_rep && noderev->data_rep->txn_id)
-    {
-      const char *filename = path_txn_node_children(fs, noderev->id, pool);
+  *list = apr_array_make(pool, 1, sizeof(struct rep_state *));
+  rep = *first_rep;
 
-      /* The representation is mutable.  Read the old directory
-         contents from the mutable children file, followed by the
-         changes we've made in this transaction. */
-      SVN_ERR(svn_stream_open_readonly(&contents, filename, pool, pool));
-      SVN_ERR(svn_hash_read2(entries, contents, SVN_HASH_TERMINATOR, pool));
-      SVN_ERR(svn_hash_read_incremental(entries, contents, NULL, pool));
-      SVN_ERR(svn_stream_close(contents));
-    }
-  else if (noderev->data_rep)
+  while (1)
     {
-      /* The representation is immutable.  Read it normally. */
-      SVN_ERR(read_representation(&contents, fs, noderev->data_rep, pool));
-      SVN_ERR(svn_hash_read2(entries, contents, SVN_HASH_TERMINATOR, pool));
-      SVN_ERR(svn_stream_close(contents));
-    }
+      SVN_ERR(create_rep_state(&rs, &rep_args, &rep, fs, pool));
+      ++length;
 
-  return SVN_NO_ERROR;
+      SVN_ERR(get_cached_combined_window(window_p, rs, &is_cached, pool));
+      if (is_cached)
+        {
+          /* We already have a reconstructed window in our cache.
+             Write a pseudo rep_state with the full length. */
+          rs->off = rs->start;
+          rs->end = rs->start + (*window_p)->len;
+          *src_state = rs;
+          record_delta_chain(fs, length);
+          return SVN_NO_ERROR;
+        }
+
+      if (rep_args->is_delta == FALSE)
+        {
+          /* This is a plaintext, so just return the current rep_state. */
+          *src_state = rs;
+          record_delta_chain(fs, length);
+          return SVN_NO_ERROR;
+        }
+
+      /* Push this rep onto the list.  If it's self-compressed, we're done. */
+      APR_ARRAY_PUSH(*list, struct rep_state *) = rs;
+      if (rep_args->is_delta_vs_empty)
+        {
+          *src_state = NULL;
+          record_delta_chain(fs, length);
+          return SVN_NO_ERROR;
+        }
+
+      rep.revision = rep_args->base_revision;
+      rep.offset = rep_args->base_offset;
+      rep.size = rep_args->base_length;
+      rep.txn_id = NULL;
+    }
 }
 
 
-static const char *
-unparse_dir_entry(svn_node_kind_t kind, const svn_fs_id_t *id,
-                  apr_pool_t *pool)
+/* Create a rep_read_baton structure for node revision NODEREV in
+   filesystem FS and store it in *RB_P.  If FULLTEXT_CACHE_KEY is not
+   NULL, it is the rep's key in the fulltext cache, and a stringbuf
+   must be allocated to store the text.  Perform all allocations in
+   POOL.  If rep is mutable, it must be for file contents. */
+static svn_error_t *
+rep_read_get_baton(struct rep_read_baton **rb_p,
+                   svn_fs_t *fs,
+                   representation_t *rep,
+                   const char *fulltext_cache_key,
+                   apr_pool_t *pool)
 {
-  return apr_psprintf(pool, "%s %s",
-                      (kind == svn_node_file) ? KIND_FILE : KIND_DIR,
-                      svn_fs_fs__id_unparse(id, pool)->data);
+  struct rep_read_baton *b;
+
+  b = apr_pcalloc(pool, sizeof(*b));
+  b->fs = fs;
+  b->base_window = NULL;
+  b->chunk_index = 0;
+  b->buf = NULL;
+  b->md5_checksum_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
+  b->checksum_finalized = FALSE;
+  b->md5_checksum = svn_checksum_dup(rep->md5_checksum, pool);
+  b->len = rep->expanded_size ? rep->expanded_size : rep->size;
+  b->off = 0;
+  b->fulltext_cache_key = fulltext_cache_key;
+  b->pool = svn_pool_create(pool);
+  b->filehandle_pool = svn_pool_create(pool);
+
+  if (fulltext_cache_key)
+    b->current_fulltext = svn_stringbuf_create_ensure
+                            ((apr_size_t)b->len,
+                             b->filehandle_pool);
+  else
+    b->current_fulltext = NULL;
+
+  SVN_ERR(build_rep_list(&b->rs_list, &b->base_window,
+                         &b->src_state, fs, rep,
+                         b->filehandle_pool));
+
+  /* Save our output baton. */
+  *rb_p = b;
+
+  return SVN_NO_ERROR;
 }
 
-/* Given a hash ENTRIES of dirent structions, return a hash in
-   *STR_ENTRIES_P, that has svn_string_t as the values in the format
-   specified by the fs_fs directory contents file.  Perform
-   allocations in POOL. */
+/* Skip the svndiff window at RS->OFF in the mapped pack file of RS by
+   advancing RS->OFF to the next window.  This is the in-memory equivalent
+   of svn_txdelta_skip_svndiff_window. */
 static svn_error_t *
-unparse_dir_entries(apr_hash_t **str_entries_p,
-                    apr_hash_t *entries,
-                    apr_pool_t *pool)
+skip_mapped_svndiff_window(struct rep_state *rs)
 {
-  apr_hash_index_t *hi;
-
-  *str_entries_p = apr_hash_make(pool);
+  const unsigned char *data = (const unsigned char *)rs->mapping->data;
+  const unsigned char *p = data + rs->off;
+  const unsigned char *end = data + rs->end;
+  apr_uint64_t sizes[5];
+  int i;
 
-  for (hi = apr_hash_first(pool, entries); hi; hi = apr_hash_next(hi))
+  /* The window header consists of the source view offset and length,
+     the target view length, and the lengths of the instructions and new
+     data sections, each encoded as a variable-length integer. */
+  for (i = 0; i < 5; ++i)
     {
-      const void *key;
-      apr_ssize_t klen;
-      svn_fs_dirent_t *dirent = svn__apr_hash_index_val(hi);
-      const char *new_val;
+      apr_uint64_t value = 0;
+      unsigned char c;
 
-      apr_hash_this(hi, &key, &klen, NULL);
-      new_val = unparse_dir_entry(dirent->kind, dirent->id, pool);
-      apr_hash_set(*str_entries_p, key, klen,
-                   svn_string_create(new_val, pool));
+      do
+        {
+          if (p == end)
+            return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                    _("Reading one svndiff window read "
+                                      "beyond the end of the "
+                                      "representation"));
+          c = *p++;
+          value = (value << 7) | (c & 0x7f);
+        }
+      while (c & 0x80);
+
+      sizes[i] = value;
     }
 
+  /* Skip the instructions and the new data. */
+  if (sizes[3] > (apr_uint64_t)(end - p)
+      || sizes[4] > (apr_uint64_t)(end - p) - sizes[3])
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Reading one svndiff window read "
+                              "beyond the end of the "
+                              "representation"));
+
+  rs->off = (p - data) + (apr_off_t)(sizes[3] + sizes[4]);
   return SVN_NO_ERROR;
 }
 
-
-/* Given a hash STR_ENTRIES with values as svn_string_t as specified
-   in an FSFS directory contents listing, return a hash of dirents in
-   *ENTRIES_P.  Perform allocations in POOL. */
+/* Skip forwards to THIS_CHUNK in REP_STATE and then read the next delta
+   window into *NWIN. */
 static svn_error_t *
-parse_dir_entries(apr_hash_t **entries_p,
-                  apr_hash_t *str_entries,
-                  const char *unparsed_id,
-                  apr_pool_t *pool)
+read_window(svn_txdelta_window_t **nwin, int this_chunk, struct rep_state *rs,
+            apr_pool_t *pool)
 {
-  apr_hash_index_t *hi;
+  svn_stream_t *stream;
+  svn_boolean_t is_cached;
+  apr_off_t old_offset;
 
-  *entries_p = apr_hash_make(pool);
+  SVN_ERR_ASSERT(rs->chunk_index <= this_chunk);
 
-  /* Translate the string dir entries into real entries. */
-  for (hi = apr_hash_first(pool, str_entries); hi; hi = apr_hash_next(hi))
+  /* Skip windows to reach the current chunk if we aren't there yet. */
+  while (rs->chunk_index < this_chunk)
     {
-      const char *name = svn__apr_hash_index_key(hi);
-      svn_string_t *str_val = svn__apr_hash_index_val(hi);
-      char *str, *last_str;
-      svn_fs_dirent_t *dirent = apr_pcalloc(pool, sizeof(*dirent));
-
-      last_str = apr_pstrdup(pool, str_val->data);
-      dirent->name = apr_pstrdup(pool, name);
-
-      str = svn_cstring_tokenize(" ", &last_str);
-      if (str == NULL)
-        return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                                 _("Directory entry corrupt in '%s'"),
-                                 unparsed_id);
-
-      if (strcmp(str, KIND_FILE) == 0)
-        {
-          dirent->kind = svn_node_file;
-        }
-      else if (strcmp(str, KIND_DIR) == 0)
+      if (rs->mapping)
         {
-          dirent->kind = svn_node_dir;
+          SVN_ERR(skip_mapped_svndiff_window(rs));
         }
       else
         {
-          return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                                   _("Directory entry corrupt in '%s'"),
-                                   unparsed_id);
+          SVN_ERR(svn_txdelta_skip_svndiff_window2(rs->file, rs->ver,
+                                                   SVN_DELTA_MAX_WINDOW_SIZE,
+                                                   pool));
+          SVN_ERR(get_file_offset(&rs->off, rs->file, pool));
         }
+      rs->chunk_index++;
+      if (rs->off >= rs->end)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Reading one svndiff window read "
+                                  "beyond the end of the "
+                                  "representation"));
+    }
 
-      str = svn_cstring_tokenize(" ", &last_str);
-      if (str == NULL)
-          return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                                   _("Directory entry corrupt in '%s'"),
-                                   unparsed_id);
+  /* Read the next window. But first, try to find it in the cache. */
+  SVN_ERR(get_cached_window(nwin, rs, &is_cached, pool));
+  if (is_cached)
+    return SVN_NO_ERROR;
 
-      dirent->id = svn_fs_fs__id_parse(str, strlen(str), pool);
+  /* Actually read the next window.  Our own reps may have been written
+     with a delta-window-size above the default. */
+  old_offset = rs->off;
+  if (rs->mapping)
+    {
+      mapped_stream_baton_t *baton;
 
-      apr_hash_set(*entries_p, dirent->name, APR_HASH_KEY_STRING, dirent);
+      stream = mapped_stream_create(&baton, rs->mapping, rs->off, pool);
+      SVN_ERR(svn_txdelta_read_svndiff_window2(nwin, stream, rs->ver,
+                                               SVN_DELTA_MAX_WINDOW_SIZE,
+                                               pool));
+      rs->off += baton->pos;
+    }
+  else
+    {
+      stream = svn_stream_from_aprfile2(rs->file, TRUE, pool);
+      SVN_ERR(svn_txdelta_read_svndiff_window2(nwin, stream, rs->ver,
+                                               SVN_DELTA_MAX_WINDOW_SIZE,
+                                               pool));
+      SVN_ERR(get_file_offset(&rs->off, rs->file, pool));
     }
+  rs->chunk_index++;
 
-  return SVN_NO_ERROR;
+  if (rs->off > rs->end)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Reading one svndiff window read beyond "
+                              "the end of the representation"));
+
+  /* the window has not been cached before, thus cache it now
+   * (if caching is used for them at all) */
+  return set_cached_window(*nwin, rs, old_offset, pool);
 }
 
-/* Return the cache object in FS responsible to storing the directory
- * the NODEREV. If none exists, return NULL. */
-static svn_cache__t *
-locate_dir_cache(svn_fs_t *fs,
-                 node_revision_t *noderev)
-{
-  fs_fs_data_t *ffd = fs->fsap_data;
-  return svn_fs_fs__id_txn_id(noderev->id)
-      ? ffd->txn_dir_cache
-      : ffd->dir_cache;
-}
-
-svn_error_t *
-svn_fs_fs__rep_contents_dir(apr_hash_t **entries_p,
-                            svn_fs_t *fs,
-                            node_revision_t *noderev,
-                            apr_pool_t *pool)
+/* Get the undeltified window that is a result of combining all deltas
+   from the current desired representation identified in *RB with its
+   base representation.  Store the window in *RESULT. */
+static svn_error_t *
+get_combined_window(svn_stringbuf_t **result,
+                    struct rep_read_baton *rb)
 {
-  const char *unparsed_id = NULL;
-  apr_hash_t *unparsed_entries, *parsed_entries;
+  apr_pool_t *pool, *new_pool, *window_pool;
+  int i;
+  svn_txdelta_window_t *window;
+  apr_array_header_t *windows;
+  svn_stringbuf_t *source, *buf = rb->base_window;
+  struct rep_state *rs;
 
-  /* find the cache we may use */
-  svn_cache__t *cache = locate_dir_cache(fs, noderev);
-  if (cache)
+  /* Read all windows that we need to combine. This is fine because
+     the size of each window is relatively small (100kB) and skip-
+     delta limits the number of deltas in a chain to well under 100.
+     Stop early if one of them does not depend on its predecessors. */
+  window_pool = svn_pool_create(rb->pool);
+  windows = apr_array_make(window_pool, 0, sizeof(svn_txdelta_window_t *));
+  for (i = 0; i < rb->rs_list->nelts; ++i)
     {
-      svn_boolean_t found;
+      rs = APR_ARRAY_IDX(rb->rs_list, i, struct rep_state *);
+      SVN_ERR(read_window(&window, rb->chunk_index, rs, window_pool));
 
-      unparsed_id = svn_fs_fs__id_unparse(noderev->id, pool)->data;
-      SVN_ERR(svn_cache__get((void **) entries_p, &found, cache,
-                             unparsed_id, pool));
-      if (found)
-        return SVN_NO_ERROR;
+      APR_ARRAY_PUSH(windows, svn_txdelta_window_t *) = window;
+      if (window->src_ops == 0)
+        {
+          ++i;
+          break;
+        }
     }
 
-  /* Read in the directory hash. */
-  unparsed_entries = apr_hash_make(pool);
-  SVN_ERR(get_dir_contents(unparsed_entries, fs, noderev, pool));
-  SVN_ERR(parse_dir_entries(&parsed_entries, unparsed_entries,
-                            unparsed_id, pool));
+  /* Combine in the windows from the other delta reps. */
+  pool = svn_pool_create(rb->pool);
+  for (--i; i >= 0; --i)
+    {
+      rs = APR_ARRAY_IDX(rb->rs_list, i, struct rep_state *);
+      window = APR_ARRAY_IDX(windows, i, svn_txdelta_window_t *);
 
-  /* Update the cache, if we are to use one. */
-  if (cache)
-    SVN_ERR(svn_cache__set(cache, unparsed_id, parsed_entries, pool));
+      /* Combine this window with the current one. */
+      source = buf;
+      new_pool = svn_pool_create(rb->pool);
+      buf = svn_stringbuf_create_ensure(window->tview_len, new_pool);
+      buf->len = window->tview_len;
 
-  *entries_p = parsed_entries;
+      svn_txdelta_apply_instructions(window, source ? source->data : NULL,
+                                     buf->data, &buf->len);
+      if (buf->len != window->tview_len)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("svndiff window length is "
+                                  "corrupt"));
+
+      /* Cache windows only if the whole rep content could be read as a
+         single chunk.  Only then will no other chunk need a deeper RS
+         list than the cached chunk. */
+      if ((rb->chunk_index == 0) && (rs->off == rs->end))
+        SVN_ERR(set_cached_combined_window(buf, rs, rs->start, new_pool));
+
+      /* Cycle pools so that we only need to hold three windows at a time. */
+      svn_pool_destroy(pool);
+      pool = new_pool;
+    }
+
+  svn_pool_destroy(window_pool);
+
+  *result = buf;
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__rep_contents_dir_entry(svn_fs_dirent_t **dirent,
-                                  svn_fs_t *fs,
-                                  node_revision_t *noderev,
-                                  const char *name,
-                                  apr_pool_t *result_pool,
-                                  apr_pool_t *scratch_pool)
+/* Returns whether or not the expanded fulltext of the file is cachable
+ * based on its size SIZE.  The decision depends on the cache used by RB.
+ */
+static svn_boolean_t
+fulltext_size_is_cachable(fs_fs_data_t *ffd, svn_filesize_t size)
 {
-  svn_boolean_t found = FALSE;
+  return (size < APR_SIZE_MAX)
+      && svn_cache__is_cachable(ffd->fulltext_cache, (apr_size_t)size);
+}
 
-  /* find the cache we may use */
-  svn_cache__t *cache = locate_dir_cache(fs, noderev);
-  if (cache)
-    {
-      const char *unparsed_id =
-        svn_fs_fs__id_unparse(noderev->id, scratch_pool)->data;
+/* Close method used on streams returned by read_representation().
+ */
+static svn_error_t *
+rep_read_contents_close(void *baton)
+{
+  struct rep_read_baton *rb = baton;
 
-      /* Cache lookup. */
-      SVN_ERR(svn_cache__get_partial((void **)dirent,
-                                     &found,
-                                     cache,
-                                     unparsed_id,
-                                     svn_fs_fs__extract_dir_entry,
-                                     (void*)name,
-                                     result_pool));
-    }
+  svn_pool_destroy(rb->pool);
+  svn_pool_destroy(rb->filehandle_pool);
 
-  /* fetch data from disk if we did not find it in the cache */
-  if (! found)
+  return SVN_NO_ERROR;
+}
+
+/* Return the next *LEN bytes of the rep and store them in *BUF. */
+static svn_error_t *
+get_contents(struct rep_read_baton *rb,
+             char *buf,
+             apr_size_t *len)
+{
+  apr_size_t copy_len, remaining = *len, offset;
+  char *cur = buf;
+  struct rep_state *rs;
+
+  /* Special case for when there are no delta reps, only a plain
+     text. */
+  if (rb->rs_list->nelts == 0)
     {
-      apr_hash_t *entries;
-      svn_fs_dirent_t *entry;
-      svn_fs_dirent_t *entry_copy = NULL;
+      copy_len = remaining;
+      rs = rb->src_state;
 
-      /* read the dir from the file system. It will probably be put it
-         into the cache for faster lookup in future calls. */
-      SVN_ERR(svn_fs_fs__rep_contents_dir(&entries, fs, noderev,
-                                          scratch_pool));
+      if (rb->base_window != NULL)
+        {
+          /* We got the desired rep directly from the cache.
+             This is where we need the pseudo rep_state created
+             by build_rep_list(). */
+          offset = rs->off - rs->start;
+          if (copy_len + offset > rb->base_window->len)
+            copy_len = offset < rb->base_window->len
+                     ? rb->base_window->len - offset
+                     : 0;
 
-      /* find desired entry and return a copy in POOL, if found */
-      entry = apr_hash_get(entries, name, APR_HASH_KEY_STRING);
-      if (entry != NULL)
+          memcpy (cur, rb->base_window->data + offset, copy_len);
+        }
+      else
         {
-          entry_copy = apr_palloc(result_pool, sizeof(*entry_copy));
-          entry_copy->name = apr_pstrdup(result_pool, entry->name);
-          entry_copy->id = svn_fs_fs__id_copy(entry->id, result_pool);
-          entry_copy->kind = entry->kind;
+          if (((apr_off_t) copy_len) > rs->end - rs->off)
+            copy_len = (apr_size_t) (rs->end - rs->off);
+          if (rs->mapping)
+            memcpy(cur, rs->mapping->data + rs->off, copy_len);
+          else
+            SVN_ERR(svn_io_file_read_full2(rs->file, cur, copy_len, NULL,
+                                           NULL, rb->pool));
         }
 
-      *dirent = entry_copy;
+      rs->off += copy_len;
+      *len = copy_len;
+      return SVN_NO_ERROR;
     }
 
-  return SVN_NO_ERROR;
-}
+  while (remaining > 0)
+    {
+      /* If we have buffered data from a previous chunk, use that. */
+      if (rb->buf)
+        {
+          /* Determine how much to copy from the buffer. */
+          copy_len = rb->buf_len - rb->buf_pos;
+          if (copy_len > remaining)
+            copy_len = remaining;
 
-svn_error_t *
-svn_fs_fs__get_proplist(apr_hash_t **proplist_p,
-                        svn_fs_t *fs,
-                        node_revision_t *noderev,
-                        apr_pool_t *pool)
-{
-  apr_hash_t *proplist;
-  svn_stream_t *stream;
+          /* Actually copy the data. */
+          memcpy(cur, rb->buf + rb->buf_pos, copy_len);
+          rb->buf_pos += copy_len;
+          cur += copy_len;
+          remaining -= copy_len;
 
-  proplist = apr_hash_make(pool);
+          /* If the buffer is all used up, clear it and empty the
+             local pool. */
+          if (rb->buf_pos == rb->buf_len)
+            {
+              svn_pool_clear(rb->pool);
+              rb->buf = NULL;
+            }
+        }
+      else
+        {
+          svn_stringbuf_t *sbuf = NULL;
 
-  if (noderev->prop_rep && noderev->prop_rep->txn_id)
-    {
-      const char *filename = path_txn_node_props(fs, noderev->id, pool);
+          rs = APR_ARRAY_IDX(rb->rs_list, 0, struct rep_state *);
+          if (rs->off == rs->end)
+            break;
 
-      SVN_ERR(svn_stream_open_readonly(&stream, filename, pool, pool));
-      SVN_ERR(svn_hash_read2(proplist, stream, SVN_HASH_TERMINATOR, pool));
-      SVN_ERR(svn_stream_close(stream));
-    }
-  else if (noderev->prop_rep)
-    {
-      SVN_ERR(read_representation(&stream, fs, noderev->prop_rep, pool));
-      SVN_ERR(svn_hash_read2(proplist, stream, SVN_HASH_TERMINATOR, pool));
-      SVN_ERR(svn_stream_close(stream));
+          /* Get more buffered data by evaluating a chunk. */
+          SVN_ERR(get_combined_window(&sbuf, rb));
+
+          rb->chunk_index++;
+          rb->buf_len = sbuf->len;
+          rb->buf = sbuf->data;
+          rb->buf_pos = 0;
+        }
     }
 
-  *proplist_p = proplist;
+  *len = cur - buf;
 
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__file_length(svn_filesize_t *length,
-                       node_revision_t *noderev,
-                       apr_pool_t *pool)
-{
-  if (noderev->data_rep)
-    *length = noderev->data_rep->expanded_size;
-  else
-    *length = 0;
-
-  return SVN_NO_ERROR;
-}
-
-svn_boolean_t
-svn_fs_fs__noderev_same_rep_key(representation_t *a,
-                                representation_t *b)
+/* BATON is of type `rep_read_baton'; read the next *LEN bytes of the
+   representation and store them in *BUF.  Sum as we read and verify
+   the MD5 sum at the end. */
+static svn_error_t *
+rep_read_contents(void *baton,
+                  char *buf,
+                  apr_size_t *len)
 {
-  if (a == b)
-    return TRUE;
+  struct rep_read_baton *rb = baton;
 
-  if (a == NULL || b == NULL)
-    return FALSE;
+  /* Get the next block of data. */
+  SVN_ERR(get_contents(rb, buf, len));
 
-  if (a->offset != b->offset)
-    return FALSE;
+  if (rb->current_fulltext)
+    svn_stringbuf_appendbytes(rb->current_fulltext, buf, *len);
 
-  if (a->revision != b->revision)
-    return FALSE;
+  /* Perform checksumming.  We want to check the checksum as soon as
+     the last byte of data is read, in case the caller never performs
+     a short read, but we don't want to finalize the MD5 context
+     twice. */
+  if (!rb->checksum_finalized)
+    {
+      SVN_ERR(svn_checksum_update(rb->md5_checksum_ctx, buf, *len));
+      rb->off += *len;
+      if (rb->off == rb->len)
+        {
+          svn_checksum_t *md5_checksum;
 
-  if (a->uniquifier == b->uniquifier)
-    return TRUE;
+          rb->checksum_finalized = TRUE;
+          SVN_ERR(svn_checksum_final(&md5_checksum, rb->md5_checksum_ctx,
+                                     rb->pool));
+          if (!svn_checksum_match(md5_checksum, rb->md5_checksum))
+            return svn_error_create(SVN_ERR_FS_CORRUPT,
+                    svn_checksum_mismatch_err(rb->md5_checksum, md5_checksum,
+                        rb->pool,
+                        _("Checksum mismatch while reading representation")),
+                    NULL);
+        }
+    }
 
-  if (a->uniquifier == NULL || b->uniquifier == NULL)
-    return FALSE;
+  if (rb->off == rb->len && rb->current_fulltext)
+    {
+      fs_fs_data_t *ffd = rb->fs->fsap_data;
+      SVN_ERR(svn_cache__set(ffd->fulltext_cache, rb->fulltext_cache_key,
+                             rb->current_fulltext, rb->pool));
+      rb->current_fulltext = NULL;
+    }
 
-  return strcmp(a->uniquifier, b->uniquifier) == 0;
+  return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__file_checksum(svn_checksum_t **checksum,
-                         node_revision_t *noderev,
-                         svn_checksum_kind_t kind,
-                         apr_pool_t *pool)
+
+/* Return a stream in *CONTENTS_P that will read the contents of a
+   representation stored at the location given by REP.  Appropriate
+   for any kind of immutable representation, but only for file
+   contents (not props or directory contents) in mutable
+   representations.
+
+   If REP is NULL, the representation is assumed to be empty, and the
+   empty stream is returned.
+*/
+static svn_error_t *
+read_representation(svn_stream_t **contents_p,
+                    svn_fs_t *fs,
+                    representation_t *rep,
+                    apr_pool_t *pool)
 {
-  if (noderev->data_rep)
+  if (! rep)
     {
-      switch(kind)
+      *contents_p = svn_stream_empty(pool);
+    }
+  else
+    {
+      fs_fs_data_t *ffd = fs->fsap_data;
+      const char *fulltext_cache_key = NULL;
+      svn_filesize_t len = rep->expanded_size ? rep->expanded_size : rep->size;
+      struct rep_read_baton *rb;
+
+      if (ffd->fulltext_cache && SVN_IS_VALID_REVNUM(rep->revision)
+          && fulltext_size_is_cachable(ffd, len))
         {
-          case svn_checksum_md5:
-            *checksum = svn_checksum_dup(noderev->data_rep->md5_checksum,
-                                         pool);
-            break;
-          case svn_checksum_sha1:
-            *checksum = svn_checksum_dup(noderev->data_rep->sha1_checksum,
-                                         pool);
-            break;
-          default:
-            *checksum = NULL;
+          svn_stringbuf_t *fulltext;
+          svn_boolean_t is_cached;
+          fulltext_cache_key = apr_psprintf(pool, "%ld/%" APR_OFF_T_FMT,
+                                      rep->revision, rep->offset);
+          SVN_ERR(svn_cache__get((void **) &fulltext, &is_cached,
+                                 ffd->fulltext_cache, fulltext_cache_key,
+                                 pool));
+          if (is_cached)
+            {
+              *contents_p = svn_stream_from_stringbuf(fulltext, pool);
+              return SVN_NO_ERROR;
+            }
         }
+
+      SVN_ERR(rep_read_get_baton(&rb, fs, rep, fulltext_cache_key, pool));
+
+      *contents_p = svn_stream_create(rb, pool);
+      svn_stream_set_read(*contents_p, rep_read_contents);
+      svn_stream_set_close(*contents_p, rep_read_contents_close);
     }
-  else
-    *checksum = NULL;
 
   return SVN_NO_ERROR;
 }
 
-representation_t *
-svn_fs_fs__rep_copy(representation_t *rep,
-                    apr_pool_t *pool)
+svn_error_t *
+svn_fs_fs__get_contents(svn_stream_t **contents_p,
+                        svn_fs_t *fs,
+                        node_revision_t *noderev,
+                        apr_pool_t *pool)
 {
-  representation_t *rep_new;
-
-  if (rep == NULL)
-    return NULL;
-
-  rep_new = apr_pcalloc(pool, sizeof(*rep_new));
+  return read_representation(contents_p, fs, noderev->data_rep, pool);
+}
 
-  memcpy(rep_new, rep, sizeof(*rep_new));
-  rep_new->md5_checksum = svn_checksum_dup(rep->md5_checksum, pool);
-  rep_new->sha1_checksum = svn_checksum_dup(rep->sha1_checksum, pool);
-  rep_new->uniquifier = apr_pstrdup(pool, rep->uniquifier);
+/* Baton used when reading delta windows. */
+struct delta_read_baton
+{
+  struct rep_state *rs;
+  svn_checksum_t *checksum;
 
-  return rep_new;
-}
+  /* The first window of the rep, if it has been read ahead.  NULL
+     otherwise. */
+  svn_txdelta_window_t *first_window;
+};
 
-/* Merge the internal-use-only CHANGE into a hash of public-FS
-   svn_fs_path_change2_t CHANGES, collapsing multiple changes into a
-   single summarical (is that real word?) change per path.  Also keep
-   the COPYFROM_CACHE up to date with new adds and replaces.  */
+/* This implements the svn_txdelta_next_window_fn_t interface. */
 static svn_error_t *
-fold_change(apr_hash_t *changes,
-            const change_t *change,
-            apr_hash_t *copyfrom_cache)
+delta_read_next_window(svn_txdelta_window_t **window, void *baton,
+                       apr_pool_t *pool)
 {
-  apr_pool_t *pool = apr_hash_pool_get(changes);
-  svn_fs_path_change2_t *old_change, *new_change;
-  const char *path;
+  struct delta_read_baton *drb = baton;
 
-  if ((old_change = apr_hash_get(changes, change->path, APR_HASH_KEY_STRING)))
+  if (drb->first_window)
     {
-      /* This path already exists in the hash, so we have to merge
-         this change into the already existing one. */
+      *window = drb->first_window;
+      drb->first_window = NULL;
+      return SVN_NO_ERROR;
+    }
 
-      /* Sanity check:  only allow NULL node revision ID in the
-         `reset' case. */
-      if ((! change->noderev_id) && (change->kind != svn_fs_path_change_reset))
-        return svn_error_create
-          (SVN_ERR_FS_CORRUPT, NULL,
-           _("Missing required node revision ID"));
+  if (drb->rs->off == drb->rs->end)
+    {
+      *window = NULL;
+      return SVN_NO_ERROR;
+    }
 
-      /* Sanity check: we should be talking about the same node
-         revision ID as our last change except where the last change
-         was a deletion. */
-      if (change->noderev_id
-          && (! svn_fs_fs__id_eq(old_change->node_rev_id, change->noderev_id))
-          && (old_change->change_kind != svn_fs_path_change_delete))
-        return svn_error_create
-          (SVN_ERR_FS_CORRUPT, NULL,
-           _("Invalid change ordering: new node revision ID "
-             "without delete"));
+  return read_window(window, drb->rs->chunk_index, drb->rs, pool);
+}
 
-      /* Sanity check: an add, replacement, or reset must be the first
-         thing to follow a deletion. */
-      if ((old_change->change_kind == svn_fs_path_change_delete)
-          && (! ((change->kind == svn_fs_path_change_replace)
-                 || (change->kind == svn_fs_path_change_reset)
-                 || (change->kind == svn_fs_path_change_add))))
-        return svn_error_create
-          (SVN_ERR_FS_CORRUPT, NULL,
-           _("Invalid change ordering: non-add change on deleted path"));
+/* This implements the svn_txdelta_md5_digest_fn_t interface. */
+static const unsigned char *
+delta_read_md5_digest(void *baton)
+{
+  struct delta_read_baton *drb = baton;
 
-      /* Sanity check: an add can't follow anything except
-         a delete or reset.  */
-      if ((change->kind == svn_fs_path_change_add)
-          && (old_change->change_kind != svn_fs_path_change_delete)
-          && (old_change->change_kind != svn_fs_path_change_reset))
-        return svn_error_create
-          (SVN_ERR_FS_CORRUPT, NULL,
-           _("Invalid change ordering: add change on preexisting path"));
+  if (drb->checksum->kind == svn_checksum_md5)
+    return drb->checksum->digest;
+  else
+    return NULL;
+}
 
-      /* Now, merge that change in. */
-      switch (change->kind)
-        {
-        case svn_fs_path_change_reset:
-          /* A reset here will simply remove the path change from the
-             hash. */
-          old_change = NULL;
-          break;
+svn_error_t *
+svn_fs_fs__get_file_delta_stream(svn_txdelta_stream_t **stream_p,
+                                 svn_fs_t *fs,
+                                 node_revision_t *source,
+                                 node_revision_t *target,
+                                 apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  svn_stream_t *source_stream, *target_stream;
 
-        case svn_fs_path_change_delete:
-          if (old_change->change_kind == svn_fs_path_change_add)
-            {
-              /* If the path was introduced in this transaction via an
-                 add, and we are deleting it, just remove the path
-                 altogether. */
-              old_change = NULL;
-            }
-          else
-            {
-              /* A deletion overrules all previous changes. */
-              old_change->change_kind = svn_fs_path_change_delete;
-              old_change->text_mod = change->text_mod;
-              old_change->prop_mod = change->prop_mod;
-              old_change->copyfrom_rev = SVN_INVALID_REVNUM;
-              old_change->copyfrom_path = NULL;
-            }
-          break;
-
-        case svn_fs_path_change_add:
-        case svn_fs_path_change_replace:
-          /* An add at this point must be following a previous delete,
-             so treat it just like a replace. */
-          old_change->change_kind = svn_fs_path_change_replace;
-          old_change->node_rev_id = svn_fs_fs__id_copy(change->noderev_id,
-                                                       pool);
-          old_change->text_mod = change->text_mod;
-          old_change->prop_mod = change->prop_mod;
-          if (change->copyfrom_rev == SVN_INVALID_REVNUM)
-            {
-              old_change->copyfrom_rev = SVN_INVALID_REVNUM;
-              old_change->copyfrom_path = NULL;
-            }
-          else
-            {
-              old_change->copyfrom_rev = change->copyfrom_rev;
-              old_change->copyfrom_path = apr_pstrdup(pool,
-                                                      change->copyfrom_path);
-            }
-          break;
-
-        case svn_fs_path_change_modify:
-        default:
-          if (change->text_mod)
-            old_change->text_mod = TRUE;
-          if (change->prop_mod)
-            old_change->prop_mod = TRUE;
-          break;
-        }
-
-      /* Point our new_change to our (possibly modified) old_change. */
-      new_change = old_change;
-    }
-  else
+  /* Try a shortcut: if the target is stored as a delta against the source,
+     then just use that delta. */
+  if (source && source->data_rep && target->data_rep)
     {
-      /* This change is new to the hash, so make a new public change
-         structure from the internal one (in the hash's pool), and dup
-         the path into the hash's pool, too. */
-      new_change = apr_pcalloc(pool, sizeof(*new_change));
-      new_change->node_rev_id = svn_fs_fs__id_copy(change->noderev_id, pool);
-      new_change->change_kind = change->kind;
-      new_change->text_mod = change->text_mod;
-      new_change->prop_mod = change->prop_mod;
-      /* In FSFS, copyfrom_known is *always* true, since we've always
-       * stored copyfroms in changed paths lists. */
-      new_change->copyfrom_known = TRUE;
-      if (change->copyfrom_rev != SVN_INVALID_REVNUM)
+      struct rep_state *rep_state;
+      struct rep_args *rep_args;
+      svn_txdelta_window_t *first_window = NULL;
+      svn_boolean_t use_delta = FALSE;
+
+      /* Read target's base rep if any. */
+      SVN_ERR(create_rep_state(&rep_state, &rep_args, target->data_rep,
+                               fs, pool));
+      /* If that matches source, then use this delta as is. */
+      if (rep_args->is_delta
+          && (rep_args->is_delta_vs_empty
+              || (rep_args->base_revision == source->data_rep->revision
+                  && rep_args->base_offset == source->data_rep->offset)))
+        use_delta = TRUE;
+
+      /* Our consumers may pass the delta on to pre-1.8 clients that reject
+         windows above the default size.  All windows but the last one of
+         a rep have the same size, so if the first one is within limits,
+         the others will be as well. */
+      if (use_delta
+          && ffd->format >= SVN_FS_FS__MIN_LARGE_DELTA_WINDOW_FORMAT
+          && rep_state->off < rep_state->end)
         {
-          new_change->copyfrom_rev = change->copyfrom_rev;
-          new_change->copyfrom_path = apr_pstrdup(pool, change->copyfrom_path);
+          SVN_ERR(read_window(&first_window, rep_state->chunk_index,
+                              rep_state, pool));
+          if (first_window->sview_len > SVN_DELTA_DEFAULT_WINDOW_SIZE
+              || first_window->tview_len > SVN_DELTA_DEFAULT_WINDOW_SIZE)
+            use_delta = FALSE;
         }
-      else
+
+      if (use_delta)
         {
-          new_change->copyfrom_rev = SVN_INVALID_REVNUM;
-          new_change->copyfrom_path = NULL;
+          /* Create the delta read baton. */
+          struct delta_read_baton *drb = apr_pcalloc(pool, sizeof(*drb));
+          drb->rs = rep_state;
+          drb->checksum = svn_checksum_dup(target->data_rep->md5_checksum,
+                                           pool);
+          drb->first_window = first_window;
+          *stream_p = svn_txdelta_stream_create(drb, delta_read_next_window,
+                                                delta_read_md5_digest, pool);
+          return SVN_NO_ERROR;
         }
+      else if (rep_state->file)
+        SVN_ERR(svn_io_file_close(rep_state->file, pool));
     }
 
-  if (new_change)
-    new_change->node_kind = change->node_kind;
+  /* Read both fulltexts and construct a delta. */
+  if (source)
+    SVN_ERR(read_representation(&source_stream, fs, source->data_rep, pool));
+  else
+    source_stream = svn_stream_empty(pool);
+  SVN_ERR(read_representation(&target_stream, fs, target->data_rep, pool));
+  svn_txdelta(stream_p, source_stream, target_stream, pool);
 
-  /* Add (or update) this path.
+  return SVN_NO_ERROR;
+}
 
-     Note: this key might already be present, and it would be nice to
-     re-use its value, but there is no way to fetch it. The API makes no
-     guarantees that this (new) key will not be retained. Thus, we (again)
-     copy the key into the target pool to ensure a proper lifetime.  */
-  path = apr_pstrdup(pool, change->path);
-  apr_hash_set(changes, path, APR_HASH_KEY_STRING, new_change);
 
-  /* Update the copyfrom cache, if any. */
-  if (copyfrom_cache)
+/* Fetch the contents of a directory into ENTRIES.  Values are stored
+   as filename to string mappings; further conversion is necessary to
+   convert them into svn_fs_dirent_t values. */
+static svn_error_t *
+get_dir_contents(apr_hash_t *entries,
+                 svn_fs_t *fs,
+                 node_revision_t *noderev,
+                 apr_pool_t *pool)
+{
+  svn_stream_t *contents;
+
+  if (noderev->data_rep && noderev->data_rep->txn_id)
     {
-      apr_pool_t *copyfrom_pool = apr_hash_pool_get(copyfrom_cache);
-      const char *copyfrom_string = NULL, *copyfrom_key = path;
-      if (new_change)
-        {
-          if (SVN_IS_VALID_REVNUM(new_change->copyfrom_rev))
-            copyfrom_string = apr_psprintf(copyfrom_pool, "%ld %s",
-                                           new_change->copyfrom_rev,
-                                           new_change->copyfrom_path);
-          else
-            copyfrom_string = "";
-        }
-      /* We need to allocate a copy of the key in the copyfrom_pool if
-       * we're not doing a deletion and if it isn't already there. */
-      if (copyfrom_string && ! apr_hash_get(copyfrom_cache, copyfrom_key,
-                                            APR_HASH_KEY_STRING))
-        copyfrom_key = apr_pstrdup(copyfrom_pool, copyfrom_key);
-      apr_hash_set(copyfrom_cache, copyfrom_key, APR_HASH_KEY_STRING,
-                   copyfrom_string);
+      const char *filename = path_txn_node_children(fs, noderev->id, pool);
+
+      /* The representation is mutable.  Read the old directory
+         contents from the mutable children file, followed by the
+         changes we've made in this transaction. */
+      SVN_ERR(svn_stream_open_readonly(&contents, filename, pool, pool));
+      SVN_ERR(svn_hash_read2(entries, contents, SVN_HASH_TERMINATOR, pool));
+      SVN_ERR(svn_hash_read_incremental(entries, contents, NULL, pool));
+      SVN_ERR(svn_stream_close(contents));
+    }
+  else if (noderev->data_rep)
+    {
+      /* The representation is immutable.  Read it normally. */
+      SVN_ERR(read_representation(&contents, fs, noderev->data_rep, pool));
+      SVN_ERR(svn_hash_read2(entries, contents, SVN_HASH_TERMINATOR, pool));
+      SVN_ERR(svn_stream_close(contents));
     }
 
   return SVN_NO_ERROR;
 }
 
-/* The 256 is an arbitrary size large enough to hold the node id and the
- * various flags. */
-#define MAX_CHANGE_LINE_LEN FSFS_MAX_PATH_LEN + 256
 
-/* Read the next entry in the changes record from file FILE and store
-   the resulting change in *CHANGE_P.  If there is no next record,
-   store NULL there.  Perform all allocations from POOL. */
-static svn_error_t *
-read_change(change_t **change_p,
-            apr_file_t *file,
-            apr_pool_t *pool)
+static const char *
+unparse_dir_entry(svn_node_kind_t kind, const svn_fs_id_t *id,
+                  apr_pool_t *pool)
 {
-  char buf[MAX_CHANGE_LINE_LEN];
-  apr_size_t len = sizeof(buf);
-  change_t *change;
-  char *str, *last_str = buf, *kind_str;
-  svn_error_t *err;
+  return apr_psprintf(pool, "%s %s",
+                      (kind == svn_node_file) ? KIND_FILE : KIND_DIR,
+                      svn_fs_fs__id_unparse(id, pool)->data);
+}
 
-  /* Default return value. */
-  *change_p = NULL;
+/* Given a hash ENTRIES of dirent structions, return a hash in
+   *STR_ENTRIES_P, that has svn_string_t as the values in the format
+   specified by the fs_fs directory contents file.  Perform
+   allocations in POOL. */
+static svn_error_t *
+unparse_dir_entries(apr_hash_t **str_entries_p,
+                    apr_hash_t *entries,
+                    apr_pool_t *pool)
+{
+  apr_hash_index_t *hi;
 
-  err = svn_io_read_length_line(file, buf, &len, pool);
+  *str_entries_p = apr_hash_make(pool);
 
-  /* Check for a blank line. */
-  if (err || (len == 0))
+  for (hi = apr_hash_first(pool, entries); hi; hi = apr_hash_next(hi))
     {
-      if (err && APR_STATUS_IS_EOF(err->apr_err))
-        {
-          svn_error_clear(err);
-          return SVN_NO_ERROR;
-        }
-      if ((len == 0) && (! err))
-        return SVN_NO_ERROR;
-      return svn_error_trace(err);
+      const void *key;
+      apr_ssize_t klen;
+      svn_fs_dirent_t *dirent = svn__apr_hash_index_val(hi);
+      const char *new_val;
+
+      apr_hash_this(hi, &key, &klen, NULL);
+      new_val = unparse_dir_entry(dirent->kind, dirent->id, pool);
+      apr_hash_set(*str_entries_p, key, klen,
+                   svn_string_create(new_val, pool));
     }
 
-  change = apr_pcalloc(pool, sizeof(*change));
+  return SVN_NO_ERROR;
+}
 
-  /* Get the node-id of the change. */
-  str = svn_cstring_tokenize(" ", &last_str);
-  if (str == NULL)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Invalid changes line in rev-file"));
 
-  change->noderev_id = svn_fs_fs__id_parse(str, strlen(str), pool);
-  if (change->noderev_id == NULL)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Invalid changes line in rev-file"));
+/* Given a hash STR_ENTRIES with values as svn_string_t as specified
+   in an FSFS directory contents listing, return a hash of dirents in
+   *ENTRIES_P.  Perform allocations in POOL. */
+static svn_error_t *
+parse_dir_entries(apr_hash_t **entries_p,
+                  apr_hash_t *str_entries,
+                  const char *unparsed_id,
+                  apr_pool_t *pool)
+{
+  apr_hash_index_t *hi;
 
-  /* Get the change type. */
-  str = svn_cstring_tokenize(" ", &last_str);
-  if (str == NULL)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Invalid changes line in rev-file"));
+  *entries_p = apr_hash_make(pool);
 
-  /* Don't bother to check the format number before looking for
-   * node-kinds: just read them if you find them. */
-  change->node_kind = svn_node_unknown;
-  kind_str = strchr(str, '-');
-  if (kind_str)
+  /* Translate the string dir entries into real entries. */
+  for (hi = apr_hash_first(pool, str_entries); hi; hi = apr_hash_next(hi))
     {
-      /* Cap off the end of "str" (the action). */
-      *kind_str = '\0';
-      kind_str++;
-      if (strcmp(kind_str, KIND_FILE) == 0)
-        change->node_kind = svn_node_file;
-      else if (strcmp(kind_str, KIND_DIR) == 0)
-        change->node_kind = svn_node_dir;
-      else
-        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                _("Invalid changes line in rev-file"));
-    }
+      const char *name = svn__apr_hash_index_key(hi);
+      svn_string_t *str_val = svn__apr_hash_index_val(hi);
+      char *str, *last_str;
+      svn_fs_dirent_t *dirent = apr_pcalloc(pool, sizeof(*dirent));
 
-  if (strcmp(str, ACTION_MODIFY) == 0)
-    {
-      change->kind = svn_fs_path_change_modify;
-    }
-  else if (strcmp(str, ACTION_ADD) == 0)
-    {
-      change->kind = svn_fs_path_change_add;
-    }
-  else if (strcmp(str, ACTION_DELETE) == 0)
-    {
-      change->kind = svn_fs_path_change_delete;
-    }
-  else if (strcmp(str, ACTION_REPLACE) == 0)
-    {
-      change->kind = svn_fs_path_change_replace;
-    }
-  else if (strcmp(str, ACTION_RESET) == 0)
-    {
-      change->kind = svn_fs_path_change_reset;
-    }
-  else
-    {
-      return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                              _("Invalid change kind in rev file"));
-    }
+      last_str = apr_pstrdup(pool, str_val->data);
+      dirent->name = apr_pstrdup(pool, name);
 
-  /* Get the text-mod flag. */
-  str = svn_cstring_tokenize(" ", &last_str);
-  if (str == NULL)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Invalid changes line in rev-file"));
+      str = svn_cstring_tokenize(" ", &last_str);
+      if (str == NULL)
+        return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                                 _("Directory entry corrupt in '%s'"),
+                                 unparsed_id);
 
-  if (strcmp(str, FLAG_TRUE) == 0)
-    {
-      change->text_mod = TRUE;
-    }
-  else if (strcmp(str, FLAG_FALSE) == 0)
-    {
-      change->text_mod = FALSE;
-    }
-  else
-    {
-      return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                              _("Invalid text-mod flag in rev-file"));
-    }
+      if (strcmp(str, KIND_FILE) == 0)
+        {
+          dirent->kind = svn_node_file;
+        }
+      else if (strcmp(str, KIND_DIR) == 0)
+        {
+          dirent->kind = svn_node_dir;
+        }
+      else
+        {
+          return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                                   _("Directory entry corrupt in '%s'"),
+                                   unparsed_id);
+        }
 
-  /* Get the prop-mod flag. */
-  str = svn_cstring_tokenize(" ", &last_str);
-  if (str == NULL)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Invalid changes line in rev-file"));
+      str = svn_cstring_tokenize(" ", &last_str);
+      if (str == NULL)
+          return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                                   _("Directory entry corrupt in '%s'"),
+                                   unparsed_id);
 
-  if (strcmp(str, FLAG_TRUE) == 0)
-    {
-      change->prop_mod = TRUE;
-    }
-  else if (strcmp(str, FLAG_FALSE) == 0)
-    {
-      change->prop_mod = FALSE;
-    }
-  else
-    {
-      return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                              _("Invalid prop-mod flag in rev-file"));
+      dirent->id = svn_fs_fs__id_parse(str, strlen(str), pool);
+
+      apr_hash_set(*entries_p, dirent->name, APR_HASH_KEY_STRING, dirent);
     }
 
-  /* Get the changed path. */
-  change->path = apr_pstrdup(pool, last_str);
+  return SVN_NO_ERROR;
+}
 
+/* Return the cache object in FS responsible to storing the directory
+ * the NODEREV. If none exists, return NULL. */
+static svn_cache__t *
+locate_dir_cache(svn_fs_t *fs,
+                 node_revision_t *noderev)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  return svn_fs_fs__id_txn_id(noderev->id)
+      ? ffd->txn_dir_cache
+      : ffd->dir_cache;
+}
 
-  /* Read the next line, the copyfrom line. */
-  len = sizeof(buf);
-  SVN_ERR(svn_io_read_length_line(file, buf, &len, pool));
+svn_error_t *
+svn_fs_fs__rep_contents_dir(apr_hash_t **entries_p,
+                            svn_fs_t *fs,
+                            node_revision_t *noderev,
+                            apr_pool_t *pool)
+{
+  const char *unparsed_id = NULL;
+  apr_hash_t *unparsed_entries, *parsed_entries;
 
-  if (len == 0)
-    {
-      change->copyfrom_rev = SVN_INVALID_REVNUM;
-      change->copyfrom_path = NULL;
-    }
-  else
+  /* find the cache we may use */
+  svn_cache__t *cache = locate_dir_cache(fs, noderev);
+  if (cache)
     {
-      last_str = buf;
-      str = svn_cstring_tokenize(" ", &last_str);
-      if (! str)
-        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                _("Invalid changes line in rev-file"));
-      change->copyfrom_rev = SVN_STR_TO_REV(str);
-
-      if (! last_str)
-        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                _("Invalid changes line in rev-file"));
+      svn_boolean_t found;
 
-      change->copyfrom_path = apr_pstrdup(pool, last_str);
+      unparsed_id = svn_fs_fs__id_unparse(noderev->id, pool)->data;
+      SVN_ERR(svn_cache__get((void **) entries_p, &found, cache,
+                             unparsed_id, pool));
+      if (found)
+        return SVN_NO_ERROR;
     }
 
-  *change_p = change;
+  /* Read in the directory hash. */
+  unparsed_entries = apr_hash_make(pool);
+  SVN_ERR(get_dir_contents(unparsed_entries, fs, noderev, pool));
+  SVN_ERR(parse_dir_entries(&parsed_entries, unparsed_entries,
+                            unparsed_id, pool));
 
+  /* Update the cache, if we are to use one. */
+  if (cache)
+    SVN_ERR(svn_cache__set(cache, unparsed_id, parsed_entries, pool));
+
+  *entries_p = parsed_entries;
   return SVN_NO_ERROR;
 }
 
-/* Fetch all the changed path entries from FILE and store then in
-   *CHANGED_PATHS.  Folding is done to remove redundant or unnecessary
-   *data.  Store a hash of paths to copyfrom "REV PATH" strings in
-   COPYFROM_HASH if it is non-NULL.  If PREFOLDED is true, assume that
-   the changed-path entries have already been folded (by
-   write_final_changed_path_info) and may be out of order, so we shouldn't
-   remove children of replaced or deleted directories.  Do all
-   allocations in POOL. */
-static svn_error_t *
-fetch_all_changes(apr_hash_t *changed_paths,
-                  apr_hash_t *copyfrom_cache,
-                  apr_file_t *file,
-                  svn_boolean_t prefolded,
-                  apr_pool_t *pool)
+svn_error_t *
+svn_fs_fs__rep_contents_dir_entry(svn_fs_dirent_t **dirent,
+                                  svn_fs_t *fs,
+                                  node_revision_t *noderev,
+                                  const char *name,
+                                  apr_pool_t *result_pool,
+                                  apr_pool_t *scratch_pool)
 {
-  change_t *change;
-  apr_pool_t *iterpool = svn_pool_create(pool);
+  svn_boolean_t found = FALSE;
 
-  /* Read in the changes one by one, folding them into our local hash
-     as necessary. */
+  /* find the cache we may use */
+  svn_cache__t *cache = locate_dir_cache(fs, noderev);
+  if (cache)
+    {
+      const char *unparsed_id =
+        svn_fs_fs__id_unparse(noderev->id, scratch_pool)->data;
 
-  SVN_ERR(read_change(&change, file, iterpool));
+      /* Cache lookup. */
+      SVN_ERR(svn_cache__get_partial((void **)dirent,
+                                     &found,
+                                     cache,
+                                     unparsed_id,
+                                     svn_fs_fs__extract_dir_entry,
+                                     (void*)name,
+                                     result_pool));
+    }
 
-  while (change)
+  /* fetch data from disk if we did not find it in the cache */
+  if (! found)
     {
-      SVN_ERR(fold_change(changed_paths, change, copyfrom_cache));
+      apr_hash_t *entries;
+      svn_fs_dirent_t *entry;
+      svn_fs_dirent_t *entry_copy = NULL;
 
-      /* Now, if our change was a deletion or replacement, we have to
-         blow away any changes thus far on paths that are (or, were)
-         children of this path.
-         ### i won't bother with another iteration pool here -- at
-         most we talking about a few extra dups of paths into what
-         is already a temporary subpool.
-      */
+      /* read the dir from the file system. It will probably be put it
+         into the cache for faster lookup in future calls. */
+      SVN_ERR(svn_fs_fs__rep_contents_dir(&entries, fs, noderev,
+                                          scratch_pool));
 
-      if (((change->kind == svn_fs_path_change_delete)
-           || (change->kind == svn_fs_path_change_replace))
-          && ! prefolded)
+      /* find desired entry and return a copy in POOL, if found */
+      entry = apr_hash_get(entries, name, APR_HASH_KEY_STRING);
+      if (entry != NULL)
         {
-          apr_hash_index_t *hi;
-
-          for (hi = apr_hash_first(iterpool, changed_paths);
-               hi;
-               hi = apr_hash_next(hi))
-            {
-              /* KEY is the path. */
-              const char *path = svn__apr_hash_index_key(hi);
-              apr_ssize_t klen = svn__apr_hash_index_klen(hi);
-
-              /* If we come across our own path, ignore it. */
-              if (strcmp(change->path, path) == 0)
-                continue;
-
-              /* If we come across a child of our path, remove it. */
-              if (svn_dirent_is_child(change->path, path, iterpool))
-                apr_hash_set(changed_paths, path, klen, NULL);
-            }
+          entry_copy = apr_palloc(result_pool, sizeof(*entry_copy));
+          entry_copy->name = apr_pstrdup(result_pool, entry->name);
+          entry_copy->id = svn_fs_fs__id_copy(entry->id, result_pool);
+          entry_copy->kind = entry->kind;
         }
 
-      /* Clear the per-iteration subpool. */
-      svn_pool_clear(iterpool);
-
-      SVN_ERR(read_change(&change, file, iterpool));
+      *dirent = entry_copy;
     }
 
-  /* Destroy the per-iteration subpool. */
-  svn_pool_destroy(iterpool);
-
   return SVN_NO_ERROR;
 }
 
 svn_error_t *
-svn_fs_fs__txn_changes_fetch(apr_hash_t **changed_paths_p,
-                             svn_fs_t *fs,
-                             const char *txn_id,
-                             apr_pool_t *pool)
+svn_fs_fs__get_proplist(apr_hash_t **proplist_p,
+                        svn_fs_t *fs,
+                        node_revision_t *noderev,
+                        apr_pool_t *pool)
 {
-  apr_file_t *file;
-  apr_hash_t *changed_paths = apr_hash_make(pool);
-
-  SVN_ERR(svn_io_file_open(&file, path_txn_changes(fs, txn_id, pool),
-                           APR_READ | APR_BUFFERED, APR_OS_DEFAULT, pool));
+  apr_hash_t *proplist;
+  svn_stream_t *stream;
 
-  SVN_ERR(fetch_all_changes(changed_paths, NULL, file, FALSE, pool));
+  proplist = apr_hash_make(pool);
 
-  SVN_ERR(svn_io_file_close(file, pool));
+  if (noderev->prop_rep && noderev->prop_rep->txn_id)
+    {
+      const char *filename = path_txn_node_props(fs, noderev->id, pool);
 
-  *changed_paths_p = changed_paths;
+      SVN_ERR(svn_stream_open_readonly(&stream, filename, pool, pool));
+      SVN_ERR(svn_hash_read2(proplist, stream, SVN_HASH_TERMINATOR, pool));
+      SVN_ERR(svn_stream_close(stream));
+    }
+  else if (noderev->prop_rep)
+    {
+      SVN_ERR(read_representation(&stream, fs, noderev->prop_rep, pool));
+      SVN_ERR(svn_hash_read2(proplist, stream, SVN_HASH_TERMINATOR, pool));
+      SVN_ERR(svn_stream_close(stream));
+    }
+
+  *proplist_p = proplist;
 
   return SVN_NO_ERROR;
 }
 
 svn_error_t *
-svn_fs_fs__paths_changed(apr_hash_t **changed_paths_p,
-                         svn_fs_t *fs,
-                         svn_revnum_t rev,
-                         apr_hash_t *copyfrom_cache,
-                         apr_pool_t *pool)
+svn_fs_fs__file_length(svn_filesize_t *length,
+                       node_revision_t *noderev,
+                       apr_pool_t *pool)
 {
-  apr_off_t changes_offset;
-  apr_hash_t *changed_paths;
-  apr_file_t *revision_file;
-
-  SVN_ERR(ensure_revision_exists(fs, rev, pool));
-
-  SVN_ERR(open_pack_or_rev_file(&revision_file, fs, rev, pool));
-
-  SVN_ERR(get_root_changes_offset(NULL, &changes_offset, revision_file, fs,
-                                  rev, pool));
-
-  SVN_ERR(svn_io_file_seek(revision_file, APR_SET, &changes_offset, pool));
-
-  changed_paths = apr_hash_make(pool);
-
-  SVN_ERR(fetch_all_changes(changed_paths, copyfrom_cache, revision_file,
-                            TRUE, pool));
-
-  /* Close the revision file. */
-  SVN_ERR(svn_io_file_close(revision_file, pool));
-
-  *changed_paths_p = changed_paths;
+  if (noderev->data_rep)
+    *length = noderev->data_rep->expanded_size;
+  else
+    *length = 0;
 
   return SVN_NO_ERROR;
 }
 
-/* Copy a revision node-rev SRC into the current transaction TXN_ID in
-   the filesystem FS.  This is only used to create the root of a transaction.
-   Allocations are from POOL.  */
-static svn_error_t *
-create_new_txn_noderev_from_rev(svn_fs_t *fs,
-                                const char *txn_id,
-                                svn_fs_id_t *src,
-                                apr_pool_t *pool)
+svn_boolean_t
+svn_fs_fs__noderev_same_rep_key(representation_t *a,
+                                representation_t *b)
 {
-  node_revision_t *noderev;
-  const char *node_id, *copy_id;
+  if (a == b)
+    return TRUE;
 
-  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, src, pool));
+  if (a == NULL || b == NULL)
+    return FALSE;
 
-  if (svn_fs_fs__id_txn_id(noderev->id))
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Copying from transactions not allowed"));
+  if (a->offset != b->offset)
+    return FALSE;
 
-  noderev->predecessor_id = noderev->id;
-  noderev->predecessor_count++;
-  noderev->copyfrom_path = NULL;
-  noderev->copyfrom_rev = SVN_INVALID_REVNUM;
+  if (a->revision != b->revision)
+    return FALSE;
 
-  /* For the transaction root, the copyroot never changes. */
+  if (a->uniquifier == b->uniquifier)
+    return TRUE;
 
-  node_id = svn_fs_fs__id_node_id(noderev->id);
-  copy_id = svn_fs_fs__id_copy_id(noderev->id);
-  noderev->id = svn_fs_fs__id_txn_create(node_id, copy_id, txn_id, pool);
+  if (a->uniquifier == NULL || b->uniquifier == NULL)
+    return FALSE;
 
-  return svn_fs_fs__put_node_revision(fs, noderev->id, noderev, TRUE, pool);
+  return strcmp(a->uniquifier, b->uniquifier) == 0;
 }
 
-/* A structure used by get_and_increment_txn_key_body(). */
-struct get_and_increment_txn_key_baton {
-  svn_fs_t *fs;
-  char *txn_id;
-  apr_pool_t *pool;
-};
-
-/* Callback used in the implementation of create_txn_dir().  This gets
-   the current base 36 value in PATH_TXN_CURRENT and increments it.
-   It returns the original value by the baton. */
-static svn_error_t *
-get_and_increment_txn_key_body(void *baton, apr_pool_t *pool)
+svn_error_t *
+svn_fs_fs__file_checksum(svn_checksum_t **checksum,
+                         node_revision_t *noderev,
+                         svn_checksum_kind_t kind,
+                         apr_pool_t *pool)
 {
-  struct get_and_increment_txn_key_baton *cb = baton;
-  const char *txn_current_filename = path_txn_current(cb->fs, pool);
-  apr_file_t *txn_current_file = NULL;
-  const char *tmp_filename;
-  char next_txn_id[MAX_KEY_SIZE+3];
-  svn_error_t *err = SVN_NO_ERROR;
-  apr_pool_t *iterpool;
-  apr_size_t len;
-  int i;
-
-  cb->txn_id = apr_palloc(cb->pool, MAX_KEY_SIZE);
-
-  iterpool = svn_pool_create(pool);
-  for (i = 0; i < RECOVERABLE_RETRY_COUNT; ++i)
+  if (noderev->data_rep)
     {
-      svn_pool_clear(iterpool);
-
-      RETRY_RECOVERABLE(err, txn_current_file,
-                        svn_io_file_open(&txn_current_file,
-                                         txn_current_filename,
-                                         APR_READ | APR_BUFFERED,
-                                         APR_OS_DEFAULT, iterpool));
-      len = MAX_KEY_SIZE;
-      RETRY_RECOVERABLE(err, txn_current_file,
-                        svn_io_read_length_line(txn_current_file,
-                                                cb->txn_id,
-                                                &len,
-                                                iterpool));
-      IGNORE_RECOVERABLE(err, svn_io_file_close(txn_current_file,
-                                                iterpool));
-
-      break;
+      switch(kind)
+        {
+          case svn_checksum_md5:
+            *checksum = svn_checksum_dup(noderev->data_rep->md5_checksum,
+                                         pool);
+            break;
+          case svn_checksum_sha1:
+            *checksum = svn_checksum_dup(noderev->data_rep->sha1_checksum,
+                                         pool);
+            break;
+          default:
+            *checksum = NULL;
+        }
     }
-  SVN_ERR(err);
-
-  svn_pool_destroy(iterpool);
-
-  /* Increment the key and add a trailing \n to the string so the
-     txn-current file has a newline in it. */
-  svn_fs_fs__next_key(cb->txn_id, &len, next_txn_id);
-  next_txn_id[len] = '\n';
-  ++len;
-  next_txn_id[len] = '\0';
-
-  SVN_ERR(svn_io_write_unique(&tmp_filename,
-                              svn_dirent_dirname(txn_current_filename, pool),
-                              next_txn_id, len, svn_io_file_del_none, pool));
-  SVN_ERR(move_into_place(tmp_filename, txn_current_filename,
-                          txn_current_filename, pool));
+  else
+    *checksum = NULL;
 
   return SVN_NO_ERROR;
 }
 
-/* Create a unique directory for a transaction in FS based on revision
-   REV.  Return the ID for this transaction in *ID_P.  Use a sequence
-   value in the transaction ID to prevent reuse of transaction IDs. */
-static svn_error_t *
-create_txn_dir(const char **id_p, svn_fs_t *fs, svn_revnum_t rev,
-               apr_pool_t *pool)
+representation_t *
+svn_fs_fs__rep_copy(representation_t *rep,
+                    apr_pool_t *pool)
 {
-  struct get_and_increment_txn_key_baton cb;
-  const char *txn_dir;
+  representation_t *rep_new;
 
-  /* Get the current transaction sequence value, which is a base-36
-     number, from the txn-current file, and write an
-     incremented value back out to the file.  Place the revision
-     number the transaction is based off into the transaction id. */
-  cb.pool = pool;
-  cb.fs = fs;
-  SVN_ERR(with_txn_current_lock(fs,
-                                get_and_increment_txn_key_body,
-                                &cb,
-                                pool));
-  *id_p = apr_psprintf(pool, "%ld-%s", rev, cb.txn_id);
+  if (rep == NULL)
+    return NULL;
 
-  txn_dir = svn_dirent_join_many(pool,
-                                 fs->path,
-                                 PATH_TXNS_DIR,
-                                 apr_pstrcat(pool, *id_p, PATH_EXT_TXN,
-                                             (char *)NULL),
-                                 NULL);
+  rep_new = apr_pcalloc(pool, sizeof(*rep_new));
 
-  return svn_io_dir_make(txn_dir, APR_OS_DEFAULT, pool);
+  memcpy(rep_new, rep, sizeof(*rep_new));
+  rep_new->md5_checksum = svn_checksum_dup(rep->md5_checksum, pool);
+  rep_new->sha1_checksum = svn_checksum_dup(rep->sha1_checksum, pool);
+  rep_new->uniquifier = apr_pstrdup(pool, rep->uniquifier);
+
+  return rep_new;
 }
 
-/* Create a unique directory for a transaction in FS based on revision
-   REV.  Return the ID for this transaction in *ID_P.  This
-   implementation is used in svn 1.4 and earlier repositories and is
-   kept in 1.5 and greater to support the --pre-1.4-compatible and
-   --pre-1.5-compatible repository creation options.  Reused
-   transaction IDs are possible with this implementation. */
+/* Merge the internal-use-only CHANGE into a hash of public-FS
+   svn_fs_path_change2_t CHANGES, collapsing multiple changes into a
+   single summarical (is that real word?) change per path.  Also keep
+   the COPYFROM_CACHE up to date with new adds and replaces.  */
 static svn_error_t *
-create_txn_dir_pre_1_5(const char **id_p, svn_fs_t *fs, svn_revnum_t rev,
-                       apr_pool_t *pool)
+fold_change(apr_hash_t *changes,
+            const change_t *change,
+            apr_hash_t *copyfrom_cache)
 {
-  unsigned int i;
-  apr_pool_t *subpool;
-  const char *unique_path, *prefix;
-
-  /* Try to create directories named "<txndir>/<rev>-<uniqueifier>.txn". */
-  prefix = svn_dirent_join_many(pool, fs->path, PATH_TXNS_DIR,
-                                apr_psprintf(pool, "%ld", rev), NULL);
+  apr_pool_t *pool = apr_hash_pool_get(changes);
+  svn_fs_path_change2_t *old_change, *new_change;
+  const char *path;
 
-  subpool = svn_pool_create(pool);
-  for (i = 1; i <= 99999; i++)
+  if ((old_change = apr_hash_get(changes, change->path, APR_HASH_KEY_STRING)))
     {
-      svn_error_t *err;
+      /* This path already exists in the hash, so we have to merge
+         this change into the already existing one. */
 
-      svn_pool_clear(subpool);
-      unique_path = apr_psprintf(subpool, "%s-%u" PATH_EXT_TXN, prefix, i);
-      err = svn_io_dir_make(unique_path, APR_OS_DEFAULT, subpool);
-      if (! err)
-        {
-          /* We succeeded.  Return the basename minus the ".txn" extension. */
-          const char *name = svn_dirent_basename(unique_path, subpool);
-          *id_p = apr_pstrndup(pool, name,
-                               strlen(name) - strlen(PATH_EXT_TXN));
-          svn_pool_destroy(subpool);
+      /* Sanity check:  only allow NULL node revision ID in the
+         `reset' case. */
+      if ((! change->noderev_id) && (change->kind != svn_fs_path_change_reset))
+        return svn_error_create
+          (SVN_ERR_FS_CORRUPT, NULL,
+           _("Missing required node revision ID"));
+
+      /* Sanity check: we should be talking about the same node
+         revision ID as our last change except where the last change
+         was a deletion. */
+      if (change->noderev_id
+          && (! svn_fs_fs__id_eq(old_change->node_rev_id, change->noderev_id))
+          && (old_change->change_kind != svn_fs_path_change_delete))
+        return svn_error_create
+          (SVN_ERR_FS_CORRUPT, NULL,
+           _("Invalid change ordering: new node revision ID "
+             "without delete"));
+
+      /* Sanity check: an add, replacement, or reset must be the first
+         thing to follow a deletion. */
+      if ((old_change->change_kind == svn_fs_path_change_delete)
+          && (! ((change->kind == svn_fs_path_change_replace)
+                 || (change->kind == svn_fs_path_change_reset)
+                 || (change->kind == svn_fs_path_change_add))))
+        return svn_error_create
+          (SVN_ERR_FS_CORRUPT, NULL,
+           _("Invalid change ordering: non-add change on deleted path"));
+
+      /* Sanity check: an add can't follow anything except
+         a delete or reset.  */
+      if ((change->kind == svn_fs_path_change_add)
+          && (old_change->change_kind != svn_fs_path_change_delete)
+          && (old_change->change_kind != svn_fs_path_change_reset))
+        return svn_error_create
+          (SVN_ERR_FS_CORRUPT, NULL,
+           _("Invalid change ordering: add change on preexisting path"));
+
+      /* Now, merge that change in. */
+      switch (change->kind)
+        {
+        case svn_fs_path_change_reset:
+          /* A reset here will simply remove the path change from the
+             hash. */
+          old_change = NULL;
+          break;
+
+        case svn_fs_path_change_delete:
+          if (old_change->change_kind == svn_fs_path_change_add)
+            {
+              /* If the path was introduced in this transaction via an
+                 add, and we are deleting it, just remove the path
+                 altogether. */
+              old_change = NULL;
+            }
+          else
+            {
+              /* A deletion overrules all previous changes. */
+              old_change->change_kind = svn_fs_path_change_delete;
+              old_change->text_mod = change->text_mod;
+              old_change->prop_mod = change->prop_mod;
+              old_change->copyfrom_rev = SVN_INVALID_REVNUM;
+              old_change->copyfrom_path = NULL;
+            }
+          break;
+
+        case svn_fs_path_change_add:
+        case svn_fs_path_change_replace:
+          /* An add at this point must be following a previous delete,
+             so treat it just like a replace. */
+          old_change->change_kind = svn_fs_path_change_replace;
+          old_change->node_rev_id = svn_fs_fs__id_copy(change->noderev_id,
+                                                       pool);
+          old_change->text_mod = change->text_mod;
+          old_change->prop_mod = change->prop_mod;
+          if (change->copyfrom_rev == SVN_INVALID_REVNUM)
+            {
+              old_change->copyfrom_rev = SVN_INVALID_REVNUM;
+              old_change->copyfrom_path = NULL;
+            }
+          else
+            {
+              old_change->copyfrom_rev = change->copyfrom_rev;
+              old_change->copyfrom_path = apr_pstrdup(pool,
+                                                      change->copyfrom_path);
+            }
+          break;
+
+        case svn_fs_path_change_modify:
+        default:
+          if (change->text_mod)
+            old_change->text_mod = TRUE;
+          if (change->prop_mod)
+            old_change->prop_mod = TRUE;
+          break;
+        }
+
+      /* Point our new_change to our (possibly modified) old_change. */
+      new_change = old_change;
+    }
+  else
+    {
+      /* This change is new to the hash, so make a new public change
+         structure from the internal one (in the hash's pool), and dup
+         the path into the hash's pool, too. */
+      new_change = apr_pcalloc(pool, sizeof(*new_change));
+      new_change->node_rev_id = svn_fs_fs__id_copy(change->noderev_id, pool);
+      new_change->change_kind = change->kind;
+      new_change->text_mod = change->text_mod;
+      new_change->prop_mod = change->prop_mod;
+      /* In FSFS, copyfrom_known is *always* true, since we've always
+       * stored copyfroms in changed paths lists. */
+      new_change->copyfrom_known = TRUE;
+      if (change->copyfrom_rev != SVN_INVALID_REVNUM)
+        {
+          new_change->copyfrom_rev = change->copyfrom_rev;
+          new_change->copyfrom_path = apr_pstrdup(pool, change->copyfrom_path);
+        }
+      else
+        {
+          new_change->copyfrom_rev = SVN_INVALID_REVNUM;
+          new_change->copyfrom_path = NULL;
+        }
+    }
+
+  if (new_change)
+    new_change->node_kind = change->node_kind;
+
+  /* Add (or update) this path.
+
+     Note: this key might already be present, and it would be nice to
+     re-use its value, but there is no way to fetch it. The API makes no
+     guarantees that this (new) key will not be retained. Thus, we (again)
+     copy the key into the target pool to ensure a proper lifetime.  */
+  path = apr_pstrdup(pool, change->path);
+  apr_hash_set(changes, path, APR_HASH_KEY_STRING, new_change);
+
+  /* Update the copyfrom cache, if any. */
+  if (copyfrom_cache)
+    {
+      apr_pool_t *copyfrom_pool = apr_hash_pool_get(copyfrom_cache);
+      const char *copyfrom_string = NULL, *copyfrom_key = path;
+      if (new_change)
+        {
+          if (SVN_IS_VALID_REVNUM(new_change->copyfrom_rev))
+            copyfrom_string = apr_psprintf(copyfrom_pool, "%ld %s",
+                                           new_change->copyfrom_rev,
+                                           new_change->copyfrom_path);
+          else
+            copyfrom_string = "";
+        }
+      /* We need to allocate a copy of the key in the copyfrom_pool if
+       * we're not doing a deletion and if it isn't already there. */
+      if (copyfrom_string && ! apr_hash_get(copyfrom_cache, copyfrom_key,
+                                            APR_HASH_KEY_STRING))
+        copyfrom_key = apr_pstrdup(copyfrom_pool, copyfrom_key);
+      apr_hash_set(copyfrom_cache, copyfrom_key, APR_HASH_KEY_STRING,
+                   copyfrom_string);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* The 256 is an arbitrary size large enough to hold the node id and the
+ * various flags. */
+#define MAX_CHANGE_LINE_LEN FSFS_MAX_PATH_LEN + 256
+
+/* Read the next entry in the changes record from file FILE and store
+   the resulting change in *CHANGE_P.  If there is no next record,
+   store NULL there.  Perform all allocations from POOL. */
+static svn_error_t *
+read_change(change_t **change_p,
+            apr_file_t *file,
+            apr_pool_t *pool)
+{
+  char buf[MAX_CHANGE_LINE_LEN];
+  apr_size_t len = sizeof(buf);
+  change_t *change;
+  char *str, *last_str = buf, *kind_str;
+  svn_error_t *err;
+
+  /* Default return value. */
+  *change_p = NULL;
+
+  err = svn_io_read_length_line(file, buf, &len, pool);
+
+  /* Check for a blank line. */
+  if (err || (len == 0))
+    {
+      if (err && APR_STATUS_IS_EOF(err->apr_err))
+        {
+          svn_error_clear(err);
           return SVN_NO_ERROR;
         }
-      if (! APR_STATUS_IS_EEXIST(err->apr_err))
-        return svn_error_trace(err);
-      svn_error_clear(err);
+      if ((len == 0) && (! err))
+        return SVN_NO_ERROR;
+      return svn_error_trace(err);
+    }
+
+  change = apr_pcalloc(pool, sizeof(*change));
+
+  /* Get the node-id of the change. */
+  str = svn_cstring_tokenize(" ", &last_str);
+  if (str == NULL)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Invalid changes line in rev-file"));
+
+  change->noderev_id = svn_fs_fs__id_parse(str, strlen(str), pool);
+  if (change->noderev_id == NULL)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Invalid changes line in rev-file"));
+
+  /* Get the change type. */
+  str = svn_cstring_tokenize(" ", &last_str);
+  if (str == NULL)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Invalid changes line in rev-file"));
+
+  /* Don't bother to check the format number before looking for
+   * node-kinds: just read them if you find them. */
+  change->node_kind = svn_node_unknown;
+  kind_str = strchr(str, '-');
+  if (kind_str)
+    {
+      /* Cap off the end of "str" (the action). */
+      *kind_str = '\0';
+      kind_str++;
+      if (strcmp(kind_str, KIND_FILE) == 0)
+        change->node_kind = svn_node_file;
+      else if (strcmp(kind_str, KIND_DIR) == 0)
+        change->node_kind = svn_node_dir;
+      else
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Invalid changes line in rev-file"));
+    }
+
+  if (strcmp(str, ACTION_MODIFY) == 0)
+    {
+      change->kind = svn_fs_path_change_modify;
+    }
+  else if (strcmp(str, ACTION_ADD) == 0)
+    {
+      change->kind = svn_fs_path_change_add;
+    }
+  else if (strcmp(str, ACTION_DELETE) == 0)
+    {
+      change->kind = svn_fs_path_change_delete;
+    }
+  else if (strcmp(str, ACTION_REPLACE) == 0)
+    {
+      change->kind = svn_fs_path_change_replace;
+    }
+  else if (strcmp(str, ACTION_RESET) == 0)
+    {
+      change->kind = svn_fs_path_change_reset;
+    }
+  else
+    {
+      return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                              _("Invalid change kind in rev file"));
+    }
+
+  /* Get the text-mod flag. */
+  str = svn_cstring_tokenize(" ", &last_str);
+  if (str == NULL)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Invalid changes line in rev-file"));
+
+  if (strcmp(str, FLAG_TRUE) == 0)
+    {
+      change->text_mod = TRUE;
+    }
+  else if (strcmp(str, FLAG_FALSE) == 0)
+    {
+      change->text_mod = FALSE;
+    }
+  else
+    {
+      return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                              _("Invalid text-mod flag in rev-file"));
+    }
+
+  /* Get the prop-mod flag. */
+  str = svn_cstring_tokenize(" ", &last_str);
+  if (str == NULL)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Invalid changes line in rev-file"));
+
+  if (strcmp(str, FLAG_TRUE) == 0)
+    {
+      change->prop_mod = TRUE;
+    }
+  else if (strcmp(str, FLAG_FALSE) == 0)
+    {
+      change->prop_mod = FALSE;
+    }
+  else
+    {
+      return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                              _("Invalid prop-mod flag in rev-file"));
+    }
+
+  /* Get the changed path. */
+  change->path = apr_pstrdup(pool, last_str);
+
+
+  /* Read the next line, the copyfrom line. */
+  len = sizeof(buf);
+  SVN_ERR(svn_io_read_length_line(file, buf, &len, pool));
+
+  if (len == 0)
+    {
+      change->copyfrom_rev = SVN_INVALID_REVNUM;
+      change->copyfrom_path = NULL;
+    }
+  else
+    {
+      last_str = buf;
+      str = svn_cstring_tokenize(" ", &last_str);
+      if (! str)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Invalid changes line in rev-file"));
+      change->copyfrom_rev = SVN_STR_TO_REV(str);
+
+      if (! last_str)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Invalid changes line in rev-file"));
+
+      change->copyfrom_path = apr_pstrdup(pool, last_str);
+    }
+
+  *change_p = change;
+
+  return SVN_NO_ERROR;
+}
+
+/* Fetch all the changed path entries from FILE and store then in
+   *CHANGED_PATHS.  Folding is done to remove redundant or unnecessary
+   *data.  Store a hash of paths to copyfrom "REV PATH" strings in
+   COPYFROM_HASH if it is non-NULL.  If PREFOLDED is true, assume that
+   the changed-path entries have already been folded (by
+   write_final_changed_path_info) and may be out of order, so we shouldn't
+   remove children of replaced or deleted directories.  Do all
+   allocations in POOL. */
+static svn_error_t *
+fetch_all_changes(apr_hash_t *changed_paths,
+                  apr_hash_t *copyfrom_cache,
+                  apr_file_t *file,
+                  svn_boolean_t prefolded,
+                  apr_pool_t *pool)
+{
+  change_t *change;
+  apr_pool_t *iterpool = svn_pool_create(pool);
+
+  /* Read in the changes one by one, folding them into our local hash
+     as necessary. */
+
+  SVN_ERR(read_change(&change, file, iterpool));
+
+  while (change)
+    {
+      SVN_ERR(fold_change(changed_paths, change, copyfrom_cache));
+
+      /* Now, if our change was a deletion or replacement, we have to
+         blow away any changes thus far on paths that are (or, were)
+         children of this path.
+         ### i won't bother with another iteration pool here -- at
+         most we talking about a few extra dups of paths into what
+         is already a temporary subpool.
+      */
+
+      if (((change->kind == svn_fs_path_change_delete)
+           || (change->kind == svn_fs_path_change_replace))
+          && ! prefolded)
+        {
+          apr_hash_index_t *hi;
+
+          for (hi = apr_hash_first(iterpool, changed_paths);
+               hi;
+               hi = apr_hash_next(hi))
+            {
+              /* KEY is the path. */
+              const char *path = svn__apr_hash_index_key(hi);
+              apr_ssize_t klen = svn__apr_hash_index_klen(hi);
+
+              /* If we come across our own path, ignore it. */
+              if (strcmp(change->path, path) == 0)
+                continue;
+
+              /* If we come across a child of our path, remove it. */
+              if (svn_dirent_is_child(change->path, path, iterpool))
+                apr_hash_set(changed_paths, path, klen, NULL);
+            }
+        }
+
+      /* Clear the per-iteration subpool. */
+      svn_pool_clear(iterpool);
+
+      SVN_ERR(read_change(&change, file, iterpool));
+    }
+
+  /* Destroy the per-iteration subpool. */
+  svn_pool_destroy(iterpool);
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_fs_fs__txn_changes_fetch(apr_hash_t **changed_paths_p,
+                             svn_fs_t *fs,
+                             const char *txn_id,
+                             apr_pool_t *pool)
+{
+  apr_file_t *file;
+  apr_hash_t *changed_paths = apr_hash_make(pool);
+
+  SVN_ERR(svn_io_file_open(&file, path_txn_changes(fs, txn_id, pool),
+                           APR_READ | APR_BUFFERED, APR_OS_DEFAULT, pool));
+
+  SVN_ERR(fetch_all_changes(changed_paths, NULL, file, FALSE, pool));
+
+  SVN_ERR(svn_io_file_close(file, pool));
+
+  *changed_paths_p = changed_paths;
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_fs_fs__paths_changed(apr_hash_t **changed_paths_p,
+                         svn_fs_t *fs,
+                         svn_revnum_t rev,
+                         apr_hash_t *copyfrom_cache,
+                         apr_pool_t *pool)
+{
+  apr_off_t changes_offset;
+  apr_hash_t *changed_paths;
+  apr_file_t *revision_file;
+
+  SVN_ERR(ensure_revision_exists(fs, rev, pool));
+
+  SVN_ERR(open_pack_or_rev_file(&revision_file, fs, rev, pool));
+
+  SVN_ERR(get_root_changes_offset(NULL, &changes_offset, revision_file, fs,
+                                  rev, pool));
+
+  SVN_ERR(svn_io_file_seek(revision_file, APR_SET, &changes_offset, pool));
+
+  changed_paths = apr_hash_make(pool);
+
+  SVN_ERR(fetch_all_changes(changed_paths, copyfrom_cache, revision_file,
+                            TRUE, pool));
+
+  /* Close the revision file. */
+  SVN_ERR(svn_io_file_close(revision_file, pool));
+
+  *changed_paths_p = changed_paths;
+
+  return SVN_NO_ERROR;
+}
+
+/* Copy a revision node-rev SRC into the current transaction TXN_ID in
+   the filesystem FS.  This is only used to create the root of a transaction.
+   Allocations are from POOL.  */
+static svn_error_t *
+create_new_txn_noderev_from_rev(svn_fs_t *fs,
+                                const char *txn_id,
+                                svn_fs_id_t *src,
+                                apr_pool_t *pool)
+{
+  node_revision_t *noderev;
+  const char *node_id, *copy_id;
+
+  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, src, pool));
+
+  if (svn_fs_fs__id_txn_id(noderev->id))
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Copying from transactions not allowed"));
+
+  noderev->predecessor_id = noderev->id;
+  noderev->predecessor_count++;
+  noderev->copyfrom_path = NULL;
+  noderev->copyfrom_rev = SVN_INVALID_REVNUM;
+
+  /* For the transaction root, the copyroot never changes. */
+
+  node_id = svn_fs_fs__id_node_id(noderev->id);
+  copy_id = svn_fs_fs__id_copy_id(noderev->id);
+  noderev->id = svn_fs_fs__id_txn_create(node_id, copy_id, txn_id, pool);
+
+  return svn_fs_fs__put_node_revision(fs, noderev->id, noderev, TRUE, pool);
+}
+
+/* A structure used by get_and_increment_txn_key_body(). */
+struct get_and_increment_txn_key_baton {
+  svn_fs_t *fs;
+  char *txn_id;
+  apr_pool_t *pool;
+};
+
+/* Callback used in the implementation of create_txn_dir().  This gets
+   the current base 36 value in PATH_TXN_CURRENT and increments it.
+   It returns the original value by the baton. */
+static svn_error_t *
+get_and_increment_txn_key_body(void *baton, apr_pool_t *pool)
+{
+  struct get_and_increment_txn_key_baton *cb = baton;
+  const char *txn_current_filename = path_txn_current(cb->fs, pool);
+  apr_file_t *txn_current_file = NULL;
+  const char *tmp_filename;
+  char next_txn_id[MAX_KEY_SIZE+3];
+  svn_error_t *err = SVN_NO_ERROR;
+  apr_pool_t *iterpool;
+  apr_size_t len;
+  int i;
+
+  cb->txn_id = apr_palloc(cb->pool, MAX_KEY_SIZE);
+
+  iterpool = svn_pool_create(pool);
+  for (i = 0; i < RECOVERABLE_RETRY_COUNT; ++i)
+    {
+      svn_pool_clear(iterpool);
+
+      RETRY_RECOVERABLE(err, txn_current_file,
+                        svn_io_file_open(&txn_current_file,
+                                         txn_current_filename,
+                                         APR_READ | APR_BUFFERED,
+                                         APR_OS_DEFAULT, iterpool));
+      len = MAX_KEY_SIZE;
+      RETRY_RECOVERABLE(err, txn_current_file,
+                        svn_io_read_length_line(txn_current_file,
+                                                cb->txn_id,
+                                                &len,
+                                                iterpool));
+      IGNORE_RECOVERABLE(err, svn_io_file_close(txn_current_file,
+                                                iterpool));
+
+      break;
+    }
+  SVN_ERR(err);
+
+  svn_pool_destroy(iterpool);
+
+  /* Increment the key and add a trailing \n to the string so the
+     txn-current file has a newline in it. */
+  svn_fs_fs__next_key(cb->txn_id, &len, next_txn_id);
+  next_txn_id[len] = '\n';
+  ++len;
+  next_txn_id[len] = '\0';
+
+  SVN_ERR(svn_io_write_unique(&tmp_filename,
+                              svn_dirent_dirname(txn_current_filename, pool),
+                              next_txn_id, len, svn_io_file_del_none, pool));
+  SVN_ERR(move_into_place(tmp_filename, txn_current_filename,
+                          txn_current_filename, pool));
+
+  return SVN_NO_ERROR;
+}
+
+/* Create a unique directory for a transaction in FS based on revision
+   REV.  Return the ID for this transaction in *ID_P.  Use a sequence
+   value in the transaction ID to prevent reuse of transaction IDs. */
+static svn_error_t *
+create_txn_dir(const char **id_p, svn_fs_t *fs, svn_revnum_t rev,
+               apr_pool_t *pool)
+{
+  struct get_and_increment_txn_key_baton cb;
+  const char *txn_dir;
+
+  /* Get the current transaction sequence value, which is a base-36
+     number, from the txn-current file, and write an
+     incremented value back out to the file.  Place the revision
+     number the transaction is based off into the transaction id. */
+  cb.pool = pool;
+  cb.fs = fs;
+  SVN_ERR(with_txn_current_lock(fs,
+                                get_and_increment_txn_key_body,
+                                &cb,
+                                pool));
+  *id_p = apr_psprintf(pool, "%ld-%s", rev, cb.txn_id);
+
+  txn_dir = svn_dirent_join_many(pool,
+                                 fs->path,
+                                 PATH_TXNS_DIR,
+                                 apr_pstrcat(pool, *id_p, PATH_EXT_TXN,
+                                             (char *)NULL),
+                                 NULL);
+
+  return svn_io_dir_make(txn_dir, APR_OS_DEFAULT, pool);
+}
+
+/* Create a unique directory for a transaction in FS based on revision
+   REV.  Return the ID for this transaction in *ID_P.  This
+   implementation is used in svn 1.4 and earlier repositories and is
+   kept in 1.5 and greater to support the --pre-1.4-compatible and
+   --pre-1.5-compatible repository creation options.  Reused
+   transaction IDs are possible with this implementation. */
+static svn_error_t *
+create_txn_dir_pre_1_5(const char **id_p, svn_fs_t *fs, svn_revnum_t rev,
+                       apr_pool_t *pool)
+{
+  unsigned int i;
+  apr_pool_t *subpool;
+  const char *unique_path, *prefix;
+
+  /* Try to create directories named "<txndir>/<rev>-<uniqueifier>.txn". */
+  prefix = svn_dirent_join_many(pool, fs->path, PATH_TXNS_DIR,
+                                apr_psprintf(pool, "%ld", rev), NULL);
+
+  subpool = svn_pool_create(pool);
+  for (i = 1; i <= 99999; i++)
+    {
+      svn_error_t *err;
+
+      svn_pool_clear(subpool);
+      unique_path = apr_psprintf(subpool, "%s-%u" PATH_EXT_TXN, prefix, i);
+      err = svn_io_dir_make(unique_path, APR_OS_DEFAULT, subpool);
+      if (! err)
+        {
+          /* We succeeded.  Return the basename minus the ".txn" extension. */
+          const char *name = svn_dirent_basename(unique_path, subpool);
+          *id_p = apr_pstrndup(pool, name,
+                               strlen(name) - strlen(PATH_EXT_TXN));
+          svn_pool_destroy(subpool);
+          return SVN_NO_ERROR;
+        }
+      if (! APR_STATUS_IS_EEXIST(err->apr_err))
+        return svn_error_trace(err);
+      svn_error_clear(err);
+    }
+
+  return svn_error_createf(SVN_ERR_IO_UNIQUE_NAMES_EXHAUSTED,
+                           NULL,
+                           _("Unable to create transaction directory "
+                             "in '%s' for revision %ld"),
+                           svn_dirent_local_style(fs->path, pool),
+                           rev);
+}
+
+svn_error_t *
+svn_fs_fs__create_txn(svn_fs_txn_t **txn_p,
+                      svn_fs_t *fs,
+                      svn_revnum_t rev,
+                      apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+  svn_fs_txn_t *txn;
+  svn_fs_id_t *root_id;
+
+  txn = apr_pcalloc(pool, sizeof(*txn));
+
+  /* Get the txn_id. */
+  if (ffd->format >= SVN_FS_FS__MIN_TXN_CURRENT_FORMAT)
+    SVN_ERR(create_txn_dir(&txn->id, fs, rev, pool));
+  else
+    SVN_ERR(create_txn_dir_pre_1_5(&txn->id, fs, rev, pool));
+
+  txn->fs = fs;
+  txn->base_rev = rev;
+
+  txn->vtable = &txn_vtable;
+  *txn_p = txn;
+
+  /* Create a new root node for this transaction. */
+  SVN_ERR(svn_fs_fs__rev_get_root(&root_id, fs, rev, pool));
+  SVN_ERR(create_new_txn_noderev_from_rev(fs, txn->id, root_id, pool));
+
+  /* Create an empty rev file. */
+  SVN_ERR(svn_io_file_create(path_txn_proto_rev(fs, txn->id, pool), "",
+                             pool));
+
+  /* Create an empty rev-lock file. */
+  SVN_ERR(svn_io_file_create(path_txn_proto_rev_lock(fs, txn->id, pool), "",
+                             pool));
+
+  /* Create an empty changes file. */
+  SVN_ERR(svn_io_file_create(path_txn_changes(fs, txn->id, pool), "",
+                             pool));
+
+  /* Create the next-ids file. */
+  return svn_io_file_create(path_txn_next_ids(fs, txn->id, pool), "0 0\n",
+                            pool);
+}
+
+/* Store the property list for transaction TXN_ID in PROPLIST.
+   Perform temporary allocations in POOL. */
+static svn_error_t *
+get_txn_proplist(apr_hash_t *proplist,
+                 svn_fs_t *fs,
+                 const char *txn_id,
+                 apr_pool_t *pool)
+{
+  svn_stream_t *stream;
+
+  /* Check for issue #3696. (When we find and fix the cause, we can change
+   * this to an assertion.) */
+  if (txn_id == NULL)
+    return svn_error_create(SVN_ERR_INCORRECT_PARAMS, NULL,
+                            _("Internal error: a null transaction id was "
+                              "passed to get_txn_proplist()"));
+
+  /* Open the transaction properties file. */
+  SVN_ERR(svn_stream_open_readonly(&stream, path_txn_props(fs, txn_id, pool),
+                                   pool, pool));
+
+  /* Read in the property list. */
+  SVN_ERR(svn_hash_read2(proplist, stream, SVN_HASH_TERMINATOR, pool));
+
+  return svn_stream_close(stream);
+}
+
+svn_error_t *
+svn_fs_fs__change_txn_prop(svn_fs_txn_t *txn,
+                           const char *name,
+                           const svn_string_t *value,
+                           apr_pool_t *pool)
+{
+  apr_array_header_t *props = apr_array_make(pool, 1, sizeof(svn_prop_t));
+  svn_prop_t prop;
+
+  prop.name = name;
+  prop.value = value;
+  APR_ARRAY_PUSH(props, svn_prop_t) = prop;
+
+  return svn_fs_fs__change_txn_props(txn, props, pool);
+}
+
+svn_error_t *
+svn_fs_fs__change_txn_props(svn_fs_txn_t *txn,
+                            const apr_array_header_t *props,
+                            apr_pool_t *pool)
+{
+  const char *txn_prop_filename;
+  svn_stringbuf_t *buf;
+  svn_stream_t *stream;
+  apr_hash_t *txn_prop = apr_hash_make(pool);
+  int i;
+  svn_error_t *err;
+
+  err = get_txn_proplist(txn_prop, txn->fs, txn->id, pool);
+  /* Here - and here only - we need to deal with the possibility that the
+     transaction property file doesn't yet exist.  The rest of the
+     implementation assumes that the file exists, but we're called to set the
+     initial transaction properties as the transaction is being created. */
+  if (err && (APR_STATUS_IS_ENOENT(err->apr_err)))
+    svn_error_clear(err);
+  else if (err)
+    return svn_error_trace(err);
+
+  for (i = 0; i < props->nelts; i++)
+    {
+      svn_prop_t *prop = &APR_ARRAY_IDX(props, i, svn_prop_t);
+
+      apr_hash_set(txn_prop, prop->name, APR_HASH_KEY_STRING, prop->value);
+    }
+
+  /* Create a new version of the file and write out the new props. */
+  /* Open the transaction properties file. */
+  buf = svn_stringbuf_create_ensure(1024, pool);
+  stream = svn_stream_from_stringbuf(buf, pool);
+  SVN_ERR(svn_hash_write2(txn_prop, stream, SVN_HASH_TERMINATOR, pool));
+  SVN_ERR(svn_stream_close(stream));
+  SVN_ERR(svn_io_write_unique(&txn_prop_filename,
+                              path_txn_dir(txn->fs, txn->id, pool),
+                              buf->data,
+                              buf->len,
+                              svn_io_file_del_none,
+                              pool));
+  return svn_io_file_rename(txn_prop_filename,
+                            path_txn_props(txn->fs, txn->id, pool),
+                            pool);
+}
+
+svn_error_t *
+svn_fs_fs__get_txn(transaction_t **txn_p,
+                   svn_fs_t *fs,
+                   const char *txn_id,
+                   apr_pool_t *pool)
+{
+  transaction_t *txn;
+  node_revision_t *noderev;
+  svn_fs_id_t *root_id;
+
+  txn = apr_pcalloc(pool, sizeof(*txn));
+  txn->proplist = apr_hash_make(pool);
+
+  SVN_ERR(get_txn_proplist(txn->proplist, fs, txn_id, pool));
+  root_id = svn_fs_fs__id_txn_create("0", "0", txn_id, pool);
+
+  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, root_id, pool));
+
+  txn->root_id = svn_fs_fs__id_copy(noderev->id, pool);
+  txn->base_id = svn_fs_fs__id_copy(noderev->predecessor_id, pool);
+  txn->copies = NULL;
+
+  *txn_p = txn;
+
+  return SVN_NO_ERROR;
+}
+
+/* Write out the currently available next node_id NODE_ID and copy_id
+   COPY_ID for transaction TXN_ID in filesystem FS.  The next node-id is
+   used both for creating new unique nodes for the given transaction, as
+   well as uniquifying representations.  Perform temporary allocations in
+   POOL. */
+static svn_error_t *
+write_next_ids(svn_fs_t *fs,
+               const char *txn_id,
+               const char *node_id,
+               const char *copy_id,
+               apr_pool_t *pool)
+{
+  apr_file_t *file;
+  svn_stream_t *out_stream;
+
+  SVN_ERR(svn_io_file_open(&file, path_txn_next_ids(fs, txn_id, pool),
+                           APR_WRITE | APR_TRUNCATE,
+                           APR_OS_DEFAULT, pool));
+
+  out_stream = svn_stream_from_aprfile2(file, TRUE, pool);
+
+  SVN_ERR(svn_stream_printf(out_stream, pool, "%s %s\n", node_id, copy_id));
+
+  SVN_ERR(svn_stream_close(out_stream));
+  return svn_io_file_close(file, pool);
+}
+
+/* Find out what the next unique node-id and copy-id are for
+   transaction TXN_ID in filesystem FS.  Store the results in *NODE_ID
+   and *COPY_ID.  The next node-id is used both for creating new unique
+   nodes for the given transaction, as well as uniquifying representations.
+   Perform all allocations in POOL. */
+static svn_error_t *
+read_next_ids(const char **node_id,
+              const char **copy_id,
+              svn_fs_t *fs,
+              const char *txn_id,
+              apr_pool_t *pool)
+{
+  apr_file_t *file;
+  char buf[MAX_KEY_SIZE*2+3];
+  apr_size_t limit;
+  char *str, *last_str = buf;
+
+  SVN_ERR(svn_io_file_open(&file, path_txn_next_ids(fs, txn_id, pool),
+                           APR_READ | APR_BUFFERED, APR_OS_DEFAULT, pool));
+
+  limit = sizeof(buf);
+  SVN_ERR(svn_io_read_length_line(file, buf, &limit, pool));
+
+  SVN_ERR(svn_io_file_close(file, pool));
+
+  /* Parse this into two separate strings. */
+
+  str = svn_cstring_tokenize(" ", &last_str);
+  if (! str)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("next-id file corrupt"));
+
+  *node_id = apr_pstrdup(pool, str);
+
+  str = svn_cstring_tokenize(" ", &last_str);
+  if (! str)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("next-id file corrupt"));
+
+  *copy_id = apr_pstrdup(pool, str);
+
+  return SVN_NO_ERROR;
+}
+
+/* Get a new and unique to this transaction node-id for transaction
+   TXN_ID in filesystem FS.  Store the new node-id in *NODE_ID_P.
+   Node-ids are guaranteed to be unique to this transction, but may
+   not necessarily be sequential.  Perform all allocations in POOL. */
+static svn_error_t *
+get_new_txn_node_id(const char **node_id_p,
+                    svn_fs_t *fs,
+                    const char *txn_id,
+                    apr_pool_t *pool)
+{
+  const char *cur_node_id, *cur_copy_id;
+  char *node_id;
+  apr_size_t len;
+
+  /* First read in the current next-ids file. */
+  SVN_ERR(read_next_ids(&cur_node_id, &cur_copy_id, fs, txn_id, pool));
+
+  node_id = apr_pcalloc(pool, strlen(cur_node_id) + 2);
+
+  len = strlen(cur_node_id);
+  svn_fs_fs__next_key(cur_node_id, &len, node_id);
+
+  SVN_ERR(write_next_ids(fs, txn_id, node_id, cur_copy_id, pool));
+
+  *node_id_p = apr_pstrcat(pool, "_", cur_node_id, (char *)NULL);
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_fs_fs__create_node(const svn_fs_id_t **id_p,
+                       svn_fs_t *fs,
+                       node_revision_t *noderev,
+                       const char *copy_id,
+                       const char *txn_id,
+                       apr_pool_t *pool)
+{
+  const char *node_id;
+  const svn_fs_id_t *id;
+
+  /* Get a new node-id for this node. */
+  SVN_ERR(get_new_txn_node_id(&node_id, fs, txn_id, pool));
+
+  id = svn_fs_fs__id_txn_create(node_id, copy_id, txn_id, pool);
+
+  noderev->id = id;
+
+  SVN_ERR(svn_fs_fs__put_node_revision(fs, noderev->id, noderev, FALSE, pool));
+
+  *id_p = id;
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_fs_fs__purge_txn(svn_fs_t *fs,
+                     const char *txn_id,
+                     apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+
+  /* Remove the shared transaction object associated with this transaction. */
+  SVN_ERR(purge_shared_txn(fs, txn_id, pool));
+  /* Remove the directory associated with this transaction. */
+  SVN_ERR(svn_io_remove_dir2(path_txn_dir(fs, txn_id, pool), FALSE,
+                             NULL, NULL, pool));
+  if (ffd->format >= SVN_FS_FS__MIN_PROTOREVS_DIR_FORMAT)
+    {
+      /* Delete protorev and its lock, which aren't in the txn
+         directory.  It's OK if they don't exist (for example, if this
+         is post-commit and the proto-rev has been moved into
+         place). */
+      SVN_ERR(svn_io_remove_file2(path_txn_proto_rev(fs, txn_id, pool),
+                                  TRUE, pool));
+      SVN_ERR(svn_io_remove_file2(path_txn_proto_rev_lock(fs, txn_id, pool),
+                                  TRUE, pool));
     }
+  return SVN_NO_ERROR;
+}
 
-  return svn_error_createf(SVN_ERR_IO_UNIQUE_NAMES_EXHAUSTED,
-                           NULL,
-                           _("Unable to create transaction directory "
-                             "in '%s' for revision %ld"),
-                           svn_dirent_local_style(fs->path, pool),
-                           rev);
+
+svn_error_t *
+svn_fs_fs__abort_txn(svn_fs_txn_t *txn,
+                     apr_pool_t *pool)
+{
+  SVN_ERR(svn_fs__check_fs(txn->fs, TRUE));
+
+  /* Now, purge the transaction. */
+  SVN_ERR_W(svn_fs_fs__purge_txn(txn->fs, txn->id, pool),
+            apr_psprintf(pool, _("Transaction '%s' cleanup failed"),
+                         txn->id));
+
+  return SVN_NO_ERROR;
 }
 
+
 svn_error_t *
-svn_fs_fs__create_txn(svn_fs_txn_t **txn_p,
-                      svn_fs_t *fs,
-                      svn_revnum_t rev,
-                      apr_pool_t *pool)
+svn_fs_fs__set_entry(svn_fs_t *fs,
+                     const char *txn_id,
+                     node_revision_t *parent_noderev,
+                     const char *name,
+                     const svn_fs_id_t *id,
+                     svn_node_kind_t kind,
+                     apr_pool_t *pool)
 {
+  representation_t *rep = parent_noderev->data_rep;
+  const char *filename = path_txn_node_children(fs, parent_noderev->id, pool);
+  apr_file_t *file;
+  svn_stream_t *out;
   fs_fs_data_t *ffd = fs->fsap_data;
-  svn_fs_txn_t *txn;
-  svn_fs_id_t *root_id;
+  apr_pool_t *subpool = svn_pool_create(pool);
 
-  txn = apr_pcalloc(pool, sizeof(*txn));
+  if (!rep || !rep->txn_id)
+    {
+      const char *unique_suffix;
 
-  /* Get the txn_id. */
-  if (ffd->format >= SVN_FS_FS__MIN_TXN_CURRENT_FORMAT)
-    SVN_ERR(create_txn_dir(&txn->id, fs, rev, pool));
-  else
-    SVN_ERR(create_txn_dir_pre_1_5(&txn->id, fs, rev, pool));
+      {
+        apr_hash_t *entries;
 
-  txn->fs = fs;
-  txn->base_rev = rev;
+        svn_pool_clear(subpool);
 
-  txn->vtable = &txn_vtable;
-  *txn_p = txn;
+        /* Before we can modify the directory, we need to dump its old
+           contents into a mutable representation file. */
+        SVN_ERR(svn_fs_fs__rep_contents_dir(&entries, fs, parent_noderev,
+                                            subpool));
+        SVN_ERR(unparse_dir_entries(&entries, entries, subpool));
+        SVN_ERR(svn_io_file_open(&file, filename,
+                                 APR_WRITE | APR_CREATE | APR_BUFFERED,
+                                 APR_OS_DEFAULT, pool));
+        out = svn_stream_from_aprfile2(file, TRUE, pool);
+        SVN_ERR(svn_hash_write2(entries, out, SVN_HASH_TERMINATOR, subpool));
 
-  /* Create a new root node for this transaction. */
-  SVN_ERR(svn_fs_fs__rev_get_root(&root_id, fs, rev, pool));
-  SVN_ERR(create_new_txn_noderev_from_rev(fs, txn->id, root_id, pool));
+        svn_pool_clear(subpool);
+      }
 
-  /* Create an empty rev file. */
-  SVN_ERR(svn_io_file_create(path_txn_proto_rev(fs, txn->id, pool), "",
-                             pool));
+      /* Mark the node-rev's data rep as mutable. */
+      rep = apr_pcalloc(pool, sizeof(*rep));
+      rep->revision = SVN_INVALID_REVNUM;
+      rep->txn_id = txn_id;
+      SVN_ERR(get_new_txn_node_id(&unique_suffix, fs, txn_id, pool));
+      rep->uniquifier = apr_psprintf(pool, "%s/%s", txn_id, unique_suffix);
+      parent_noderev->data_rep = rep;
+      SVN_ERR(svn_fs_fs__put_node_revision(fs, parent_noderev->id,
+                                           parent_noderev, FALSE, pool));
+    }
+  else
+    {
+      /* The directory rep is already mutable, so just open it for append. */
+      SVN_ERR(svn_io_file_open(&file, filename, APR_WRITE | APR_APPEND,
+                               APR_OS_DEFAULT, pool));
+      out = svn_stream_from_aprfile2(file, TRUE, pool);
+    }
 
-  /* Create an empty rev-lock file. */
-  SVN_ERR(svn_io_file_create(path_txn_proto_rev_lock(fs, txn->id, pool), "",
-                             pool));
+  /* if we have a directory cache for this transaction, update it */
+  svn_pool_clear(subpool);
+  if (ffd->txn_dir_cache)
+    {
+      /* build parameters: (name, new entry) pair */
+      const char *key =
+          svn_fs_fs__id_unparse(parent_noderev->id, subpool)->data;
+      replace_baton_t baton = {name, NULL};
 
-  /* Create an empty changes file. */
-  SVN_ERR(svn_io_file_create(path_txn_changes(fs, txn->id, pool), "",
-                             pool));
+      if (id)
+        {
+          baton.new_entry = apr_pcalloc(subpool, sizeof(*baton.new_entry));
+          baton.new_entry->name = name;
+          baton.new_entry->kind = kind;
+          baton.new_entry->id = id;
+        }
 
-  /* Create the next-ids file. */
-  return svn_io_file_create(path_txn_next_ids(fs, txn->id, pool), "0 0\n",
-                            pool);
+      /* actually update the cached directory (if cached) */
+      SVN_ERR(svn_cache__set_partial(ffd->txn_dir_cache, key,
+                                     svn_fs_fs__replace_dir_entry, &baton,
+                                     subpool));
+    }
+  svn_pool_clear(subpool);
+
+  /* Append an incremental hash entry for the entry change. */
+  if (id)
+    {
+      const char *val = unparse_dir_entry(kind, id, subpool);
+
+      SVN_ERR(svn_stream_printf(out, subpool, "K %" APR_SIZE_T_FMT "\n%s\n"
+                                "V %" APR_SIZE_T_FMT "\n%s\n",
+                                strlen(name), name,
+                                strlen(val), val));
+    }
+  else
+    {
+      SVN_ERR(svn_stream_printf(out, subpool, "D %" APR_SIZE_T_FMT "\n%s\n",
+                                strlen(name), name));
+    }
+
+  SVN_ERR(svn_io_file_close(file, subpool));
+  svn_pool_destroy(subpool);
+  return SVN_NO_ERROR;
 }
 
-/* Store the property list for transaction TXN_ID in PROPLIST.
-   Perform temporary allocations in POOL. */
+/* Write a single change entry, path PATH, change CHANGE, and copyfrom
+   string COPYFROM, into the file specified by FILE.  Only include the
+   node kind field if INCLUDE_NODE_KIND is true.  All temporary
+   allocations are in POOL. */
 static svn_error_t *
-get_txn_proplist(apr_hash_t *proplist,
-                 svn_fs_t *fs,
-                 const char *txn_id,
-                 apr_pool_t *pool)
+write_change_entry(apr_file_t *file,
+                   const char *path,
+                   svn_fs_path_change2_t *change,
+                   svn_boolean_t include_node_kind,
+                   apr_pool_t *pool)
 {
-  svn_stream_t *stream;
-
-  /* Check for issue #3696. (When we find and fix the cause, we can change
-   * this to an assertion.) */
-  if (txn_id == NULL)
-    return svn_error_create(SVN_ERR_INCORRECT_PARAMS, NULL,
-                            _("Internal error: a null transaction id was "
-                              "passed to get_txn_proplist()"));
+  const char *idstr, *buf;
+  const char *change_string = NULL;
+  const char *kind_string = "";
 
-  /* Open the transaction properties file. */
-  SVN_ERR(svn_stream_open_readonly(&stream, path_txn_props(fs, txn_id, pool),
-                                   pool, pool));
+  switch (change->change_kind)
+    {
+    case svn_fs_path_change_modify:
+      change_string = ACTION_MODIFY;
+      break;
+    case svn_fs_path_change_add:
+      change_string = ACTION_ADD;
+      break;
+    case svn_fs_path_change_delete:
+      change_string = ACTION_DELETE;
+      break;
+    case svn_fs_path_change_replace:
+      change_string = ACTION_REPLACE;
+      break;
+    case svn_fs_path_change_reset:
+      change_string = ACTION_RESET;
+      break;
+    default:
+      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                               _("Invalid change type %d"),
+                               change->change_kind);
+    }
 
-  /* Read in the property list. */
-  SVN_ERR(svn_hash_read2(proplist, stream, SVN_HASH_TERMINATOR, pool));
+  if (change->node_rev_id)
+    idstr = svn_fs_fs__id_unparse(change->node_rev_id, pool)->data;
+  else
+    idstr = ACTION_RESET;
 
-  return svn_stream_close(stream);
-}
+  if (include_node_kind)
+    {
+      SVN_ERR_ASSERT(change->node_kind == svn_node_dir
+                     || change->node_kind == svn_node_file);
+      kind_string = apr_psprintf(pool, "-%s",
+                                 change->node_kind == svn_node_dir
+                                 ? KIND_DIR : KIND_FILE);
+    }
+  buf = apr_psprintf(pool, "%s %s%s %s %s %s\n",
+                     idstr, change_string, kind_string,
+                     change->text_mod ? FLAG_TRUE : FLAG_FALSE,
+                     change->prop_mod ? FLAG_TRUE : FLAG_FALSE,
+                     path);
 
-svn_error_t *
-svn_fs_fs__change_txn_prop(svn_fs_txn_t *txn,
-                           const char *name,
-                           const svn_string_t *value,
-                           apr_pool_t *pool)
-{
-  apr_array_header_t *props = apr_array_make(pool, 1, sizeof(svn_prop_t));
-  svn_prop_t prop;
+  SVN_ERR(svn_io_file_write_full(file, buf, strlen(buf), NULL, pool));
 
-  prop.name = name;
-  prop.value = value;
-  APR_ARRAY_PUSH(props, svn_prop_t) = prop;
+  if (SVN_IS_VALID_REVNUM(change->copyfrom_rev))
+    {
+      buf = apr_psprintf(pool, "%ld %s", change->copyfrom_rev,
+                         change->copyfrom_path);
+      SVN_ERR(svn_io_file_write_full(file, buf, strlen(buf), NULL, pool));
+    }
 
-  return svn_fs_fs__change_txn_props(txn, props, pool);
+  return svn_io_file_write_full(file, "\n", 1, NULL, pool);
 }
 
 svn_error_t *
-svn_fs_fs__change_txn_props(svn_fs_txn_t *txn,
-                            const apr_array_header_t *props,
-                            apr_pool_t *pool)
+svn_fs_fs__add_change(svn_fs_t *fs,
+                      const char *txn_id,
+                      const char *path,
+                      const svn_fs_id_t *id,
+                      svn_fs_path_change_kind_t change_kind,
+                      svn_boolean_t text_mod,
+                      svn_boolean_t prop_mod,
+                      svn_node_kind_t node_kind,
+                      svn_revnum_t copyfrom_rev,
+                      const char *copyfrom_path,
+                      apr_pool_t *pool)
 {
-  const char *txn_prop_filename;
-  svn_stringbuf_t *buf;
-  svn_stream_t *stream;
-  apr_hash_t *txn_prop = apr_hash_make(pool);
-  int i;
-  svn_error_t *err;
+  apr_file_t *file;
+  svn_fs_path_change2_t *change;
 
-  err = get_txn_proplist(txn_prop, txn->fs, txn->id, pool);
-  /* Here - and here only - we need to deal with the possibility that the
-     transaction property file doesn't yet exist.  The rest of the
-     implementation assumes that the file exists, but we're called to set the
-     initial transaction properties as the transaction is being created. */
-  if (err && (APR_STATUS_IS_ENOENT(err->apr_err)))
-    svn_error_clear(err);
-  else if (err)
-    return svn_error_trace(err);
+  SVN_ERR(svn_io_file_open(&file, path_txn_changes(fs, txn_id, pool),
+                           APR_APPEND | APR_WRITE | APR_CREATE
+                           | APR_BUFFERED, APR_OS_DEFAULT, pool));
 
-  for (i = 0; i < props->nelts; i++)
-    {
-      svn_prop_t *prop = &APR_ARRAY_IDX(props, i, svn_prop_t);
+  change = svn_fs__path_change_create_internal(id, change_kind, pool);
+  change->text_mod = text_mod;
+  change->prop_mod = prop_mod;
+  change->node_kind = node_kind;
+  change->copyfrom_rev = copyfrom_rev;
+  change->copyfrom_path = apr_pstrdup(pool, copyfrom_path);
 
-      apr_hash_set(txn_prop, prop->name, APR_HASH_KEY_STRING, prop->value);
-    }
+  SVN_ERR(write_change_entry(file, path, change, TRUE, pool));
 
-  /* Create a new version of the file and write out the new props. */
-  /* Open the transaction properties file. */
-  buf = svn_stringbuf_create_ensure(1024, pool);
-  stream = svn_stream_from_stringbuf(buf, pool);
-  SVN_ERR(svn_hash_write2(txn_prop, stream, SVN_HASH_TERMINATOR, pool));
-  SVN_ERR(svn_stream_close(stream));
-  SVN_ERR(svn_io_write_unique(&txn_prop_filename,
-                              path_txn_dir(txn->fs, txn->id, pool),
-                              buf->data,
-                              buf->len,
-                              svn_io_file_del_none,
-                              pool));
-  return svn_io_file_rename(txn_prop_filename,
-                            path_txn_props(txn->fs, txn->id, pool),
-                            pool);
+  return svn_io_file_close(file, pool);
 }
 
-svn_error_t *
-svn_fs_fs__get_txn(transaction_t **txn_p,
-                   svn_fs_t *fs,
-                   const char *txn_id,
-                   apr_pool_t *pool)
+/* This baton is used by the representation writing streams.  It keeps
+   track of the checksum information as well as the total size of the
+   representation so far. */
+struct rep_write_baton
 {
-  transaction_t *txn;
-  node_revision_t *noderev;
-  svn_fs_id_t *root_id;
+  /* The FS we are writing to. */
+  svn_fs_t *fs;
 
-  txn = apr_pcalloc(pool, sizeof(*txn));
-  txn->proplist = apr_hash_make(pool);
+  /* Actual file to which we are writing. */
+  svn_stream_t *rep_stream;
 
-  SVN_ERR(get_txn_proplist(txn->proplist, fs, txn_id, pool));
-  root_id = svn_fs_fs__id_txn_create("0", "0", txn_id, pool);
+  /* A stream from the delta combiner.  Data written here gets
+     deltified, then eventually written to rep_stream. */
+  svn_stream_t *delta_stream;
 
-  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, root_id, pool));
+  /* Where is this representation header stored. */
+  apr_off_t rep_offset;
 
-  txn->root_id = svn_fs_fs__id_copy(noderev->id, pool);
-  txn->base_id = svn_fs_fs__id_copy(noderev->predecessor_id, pool);
-  txn->copies = NULL;
+  /* Start of the actual data. */
+  apr_off_t delta_start;
 
-  *txn_p = txn;
+  /* How many bytes have been written to this rep already. */
+  svn_filesize_t rep_size;
 
-  return SVN_NO_ERROR;
-}
+  /* The node revision for which we're writing out info. */
+  node_revision_t *noderev;
 
-/* Write out the currently available next node_id NODE_ID and copy_id
-   COPY_ID for transaction TXN_ID in filesystem FS.  The next node-id is
-   used both for creating new unique nodes for the given transaction, as
-   well as uniquifying representations.  Perform temporary allocations in
-   POOL. */
-static svn_error_t *
-write_next_ids(svn_fs_t *fs,
-               const char *txn_id,
-               const char *node_id,
-               const char *copy_id,
-               apr_pool_t *pool)
-{
+  /* Actual output file. */
   apr_file_t *file;
-  svn_stream_t *out_stream;
+  /* Lock 'cookie' used to unlock the output file once we've finished
+     writing to it. */
+  void *lockcookie;
 
-  SVN_ERR(svn_io_file_open(&file, path_txn_next_ids(fs, txn_id, pool),
-                           APR_WRITE | APR_TRUNCATE,
-                           APR_OS_DEFAULT, pool));
+  svn_checksum_ctx_t *md5_checksum_ctx;
+  svn_checksum_ctx_t *sha1_checksum_ctx;
 
-  out_stream = svn_stream_from_aprfile2(file, TRUE, pool);
+  apr_pool_t *pool;
 
-  SVN_ERR(svn_stream_printf(out_stream, pool, "%s %s\n", node_id, copy_id));
+  apr_pool_t *parent_pool;
+};
 
-  SVN_ERR(svn_stream_close(out_stream));
-  return svn_io_file_close(file, pool);
+/* Handler for the write method of the representation writable stream.
+   BATON is a rep_write_baton, DATA is the data to write, and *LEN is
+   the length of this data. */
+static svn_error_t *
+rep_write_contents(void *baton,
+                   const char *data,
+                   apr_size_t *len)
+{
+  struct rep_write_baton *b = baton;
+
+  SVN_ERR(svn_checksum_update(b->md5_checksum_ctx, data, *len));
+  SVN_ERR(svn_checksum_update(b->sha1_checksum_ctx, data, *len));
+  b->rep_size += *len;
+
+  /* If we are writing a delta, use that stream. */
+  if (b->delta_stream)
+    return svn_stream_write(b->delta_stream, data, len);
+  else
+    return svn_stream_write(b->rep_stream, data, len);
 }
 
-/* Find out what the next unique node-id and copy-id are for
-   transaction TXN_ID in filesystem FS.  Store the results in *NODE_ID
-   and *COPY_ID.  The next node-id is used both for creating new unique
-   nodes for the given transaction, as well as uniquifying representations.
-   Perform all allocations in POOL. */
+/* Given a node-revision NODEREV in filesystem FS, return the
+   representation in *REP to use as the base for a text representation
+   delta.  Perform temporary allocations in *POOL. */
 static svn_error_t *
-read_next_ids(const char **node_id,
-              const char **copy_id,
-              svn_fs_t *fs,
-              const char *txn_id,
-              apr_pool_t *pool)
+choose_delta_base(representation_t **rep,
+                  svn_fs_t *fs,
+                  node_revision_t *noderev,
+                  apr_pool_t *pool)
 {
-  apr_file_t *file;
-  char buf[MAX_KEY_SIZE*2+3];
-  apr_size_t limit;
-  char *str, *last_str = buf;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  int count;
+  int walk;
+  node_revision_t *base;
 
-  SVN_ERR(svn_io_file_open(&file, path_txn_next_ids(fs, txn_id, pool),
-                           APR_READ | APR_BUFFERED, APR_OS_DEFAULT, pool));
+  /* If we have no predecessors, then use the empty stream as a
+     base. */
+  if (! noderev->predecessor_count)
+    {
+      *rep = NULL;
+      return SVN_NO_ERROR;
+    }
 
-  limit = sizeof(buf);
-  SVN_ERR(svn_io_read_length_line(file, buf, &limit, pool));
+  /* Flip the rightmost '1' bit of the predecessor count to determine
+     which file rev (counting from 0) we want to use.  (To see why
+     count & (count - 1) unsets the rightmost set bit, think about how
+     you decrement a binary number.) */
+  count = noderev->predecessor_count;
+  count = count & (count - 1);
 
-  SVN_ERR(svn_io_file_close(file, pool));
+  /* We use skip delta for limiting the number of delta operations
+     along very long node histories.  Close to HEAD however, we create
+     a linear history to minimize delta size.  */
+  walk = noderev->predecessor_count - count;
+  if (walk < SVN_FS_FS_MAX_LINEAR_DELTIFICATION)
+    count = noderev->predecessor_count - 1;
 
-  /* Parse this into two separate strings. */
+  /* Finding the delta base over a very long distance can become extremely
+     expensive for very deep histories, possibly causing client timeouts etc.
+     OTOH, this is a rare operation and its gains are minimal. Lets simply
+     start deltification anew close every other 1000 changes or so.  */
+  if (walk > SVN_FS_FS_MAX_DELTIFICATION_WALK)
+    {
+      *rep = NULL;
+      return SVN_NO_ERROR;
+    }
 
-  str = svn_cstring_tokenize(" ", &last_str);
-  if (! str)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("next-id file corrupt"));
+  /* Walk back a number of predecessors equal to the difference
+     between count and the original predecessor count.  (For example,
+     if noderev has ten predecessors and we want the eighth file rev,
+     walk back two predecessors.) */
+  base = noderev;
+  while ((count++) < noderev->predecessor_count)
+    SVN_ERR(svn_fs_fs__get_node_revision(&base, fs,
+                                         base->predecessor_id, pool));
 
-  *node_id = apr_pstrdup(pool, str);
+  *rep = base->data_rep;
 
-  str = svn_cstring_tokenize(" ", &last_str);
-  if (! str)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("next-id file corrupt"));
+  /* Start a new delta chain if the new rep would make reading it
+     combine more representations than configured. */
+  if (*rep && ffd->max_delta_chain_length)
+    {
+      int length;
 
-  *copy_id = apr_pstrdup(pool, str);
+      SVN_ERR(get_delta_chain_length(&length, *rep, fs,
+                                     ffd->max_delta_chain_length, pool));
+      if (length >= ffd->max_delta_chain_length)
+        *rep = NULL;
+    }
 
   return SVN_NO_ERROR;
 }
 
-/* Get a new and unique to this transaction node-id for transaction
-   TXN_ID in filesystem FS.  Store the new node-id in *NODE_ID_P.
-   Node-ids are guaranteed to be unique to this transction, but may
-   not necessarily be sequential.  Perform all allocations in POOL. */
+/* Return the svndiff version to use for new deltas in the filesystem
+   described by FFD. */
+static int
+get_svndiff_version(fs_fs_data_t *ffd)
+{
+  if (ffd->delta_compression_lz4)
+    return 2;
+
+  return ffd->format >= SVN_FS_FS__MIN_SVNDIFF1_FORMAT ? 1 : 0;
+}
+
+/* Get a rep_write_baton and store it in *WB_P for the representation
+   indicated by NODEREV in filesystem FS.  Perform allocations in
+   POOL.  Only appropriate for file contents, not for props or
+   directory contents. */
 static svn_error_t *
-get_new_txn_node_id(const char **node_id_p,
+rep_write_get_baton(struct rep_write_baton **wb_p,
                     svn_fs_t *fs,
-                    const char *txn_id,
+                    node_revision_t *noderev,
                     apr_pool_t *pool)
 {
-  const char *cur_node_id, *cur_copy_id;
-  char *node_id;
-  apr_size_t len;
+  struct rep_write_baton *b;
+  apr_file_t *file;
+  representation_t *base_rep;
+  svn_stream_t *source;
+  const char *header;
+  svn_txdelta_window_handler_t wh;
+  void *whb;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  int diff_version = get_svndiff_version(ffd);
 
-  /* First read in the current next-ids file. */
-  SVN_ERR(read_next_ids(&cur_node_id, &cur_copy_id, fs, txn_id, pool));
+  b = apr_pcalloc(pool, sizeof(*b));
 
-  node_id = apr_pcalloc(pool, strlen(cur_node_id) + 2);
+  b->sha1_checksum_ctx = svn_checksum_ctx_create(svn_checksum_sha1, pool);
+  b->md5_checksum_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
 
-  len = strlen(cur_node_id);
-  svn_fs_fs__next_key(cur_node_id, &len, node_id);
+  b->fs = fs;
+  b->parent_pool = pool;
+  b->pool = svn_pool_create(pool);
+  b->rep_size = 0;
+  b->noderev = noderev;
 
-  SVN_ERR(write_next_ids(fs, txn_id, node_id, cur_copy_id, pool));
+  /* Open the prototype rev file and seek to its end. */
+  SVN_ERR(get_writable_proto_rev(&file, &b->lockcookie,
+                                 fs, svn_fs_fs__id_txn_id(noderev->id),
+                                 b->pool));
 
-  *node_id_p = apr_pstrcat(pool, "_", cur_node_id, (char *)NULL);
+  b->file = file;
+  b->rep_stream = svn_stream_from_aprfile2(file, TRUE, b->pool);
 
-  return SVN_NO_ERROR;
-}
+  SVN_ERR(get_file_offset(&b->rep_offset, file, b->pool));
 
-svn_error_t *
-svn_fs_fs__create_node(const svn_fs_id_t **id_p,
-                       svn_fs_t *fs,
-                       node_revision_t *noderev,
-                       const char *copy_id,
-                       const char *txn_id,
-                       apr_pool_t *pool)
-{
-  const char *node_id;
-  const svn_fs_id_t *id;
+  /* Get the base for this delta. */
+  SVN_ERR(choose_delta_base(&base_rep, fs, noderev, b->pool));
+  SVN_ERR(read_representation(&source, fs, base_rep, b->pool));
 
-  /* Get a new node-id for this node. */
-  SVN_ERR(get_new_txn_node_id(&node_id, fs, txn_id, pool));
+  /* Write out the rep header. */
+  if (base_rep)
+    {
+      header = apr_psprintf(b->pool, REP_DELTA " %ld %" APR_OFF_T_FMT " %"
+                            SVN_FILESIZE_T_FMT "\n",
+                            base_rep->revision, base_rep->offset,
+                            base_rep->size);
+    }
+  else
+    {
+      header = REP_DELTA "\n";
+    }
+  SVN_ERR(svn_io_file_write_full(file, header, strlen(header), NULL,
+                                 b->pool));
 
-  id = svn_fs_fs__id_txn_create(node_id, copy_id, txn_id, pool);
+  /* Now determine the offset of the actual svndiff data. */
+  SVN_ERR(get_file_offset(&b->delta_start, file, b->pool));
 
-  noderev->id = id;
+  /* Prepare to write the svndiff data. */
+  svn_txdelta_to_svndiff4(&wh,
+                          &whb,
+                          b->rep_stream,
+                          diff_version,
+                          SVN_DELTA_COMPRESSION_LEVEL_DEFAULT,
+                          ffd->delta_compression_threads,
+                          pool);
 
-  SVN_ERR(svn_fs_fs__put_node_revision(fs, noderev->id, noderev, FALSE, pool));
+  b->delta_stream = svn_txdelta_target_push2(wh, whb, source,
+                                             ffd->delta_window_size,
+                                             b->pool);
 
-  *id_p = id;
+  *wb_p = b;
 
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__purge_txn(svn_fs_t *fs,
-                     const char *txn_id,
-                     apr_pool_t *pool)
+/* For the hash REP->SHA1, try to find an already existing representation
+   in FS and return it in *OUT_REP.  If no such representation exists or
+   if rep sharing has been disabled for FS, NULL will be returned.  Since
+   there may be new duplicate representations within the same uncommitted
+   revision, those can be passed in REPS_HASH (maps a sha1 digest onto
+   representation_t*), otherwise pass in NULL for REPS_HASH.
+   POOL will be used for allocations. The lifetime of the returned rep is
+   limited by both, POOL and REP lifetime.
+ */
+static svn_error_t *
+get_shared_rep(representation_t **old_rep,
+               svn_fs_t *fs,
+               representation_t *rep,
+               apr_hash_t *reps_hash,
+               apr_pool_t *pool)
 {
+  svn_error_t *err;
   fs_fs_data_t *ffd = fs->fsap_data;
 
-  /* Remove the shared transaction object associated with this transaction. */
-  SVN_ERR(purge_shared_txn(fs, txn_id, pool));
-  /* Remove the directory associated with this transaction. */
-  SVN_ERR(svn_io_remove_dir2(path_txn_dir(fs, txn_id, pool), FALSE,
-                             NULL, NULL, pool));
-  if (ffd->format >= SVN_FS_FS__MIN_PROTOREVS_DIR_FORMAT)
-    {
-      /* Delete protorev and its lock, which aren't in the txn
-         directory.  It's OK if they don't exist (for example, if this
-         is post-commit and the proto-rev has been moved into
-         place). */
-      SVN_ERR(svn_io_remove_file2(path_txn_proto_rev(fs, txn_id, pool),
-                                  TRUE, pool));
-      SVN_ERR(svn_io_remove_file2(path_txn_proto_rev_lock(fs, txn_id, pool),
-                                  TRUE, pool));
-    }
-  return SVN_NO_ERROR;
-}
+  /* Return NULL, if rep sharing has been disabled. */
+  *old_rep = NULL;
+  if (!ffd->rep_sharing_allowed)
+    return SVN_NO_ERROR;
 
+  /* Check and see if we already have a representation somewhere that's
+     identical to the one we just wrote out.  Start with the hash lookup
+     because it is cheepest. */
+  if (reps_hash)
+    *old_rep = apr_hash_get(reps_hash,
+                            rep->sha1_checksum->digest,
+                            APR_SHA1_DIGESTSIZE);
 
-svn_error_t *
-svn_fs_fs__abort_txn(svn_fs_txn_t *txn,
-                     apr_pool_t *pool)
-{
-  SVN_ERR(svn_fs__check_fs(txn->fs, TRUE));
+  /* If we haven't found anything yet, try harder and consult our DB. */
+  if (*old_rep == NULL)
+    {
+      err = svn_fs_fs__get_rep_reference(old_rep, fs, rep->sha1_checksum,
+                                         pool);
+      /* ### Other error codes that we shouldn't mask out? */
+      if (err == SVN_NO_ERROR
+          || err->apr_err == SVN_ERR_FS_CORRUPT
+          || SVN_ERROR_IN_CATEGORY(err->apr_err,
+                                   SVN_ERR_MALFUNC_CATEGORY_START))
+        {
+          /* Fatal error; don't mask it.
 
-  /* Now, purge the transaction. */
-  SVN_ERR_W(svn_fs_fs__purge_txn(txn->fs, txn->id, pool),
-            apr_psprintf(pool, _("Transaction '%s' cleanup failed"),
-                         txn->id));
+             In particular, this block is triggered when the rep-cache refers
+             to revisions in the future.  We signal that as a corruption situation
+             since, once those revisions are less than youngest (because of more
+             commits), the rep-cache would be invalid.
+           */
+          SVN_ERR(err);
+        }
+      else
+        {
+          /* Something's wrong with the rep-sharing index.  We can continue
+             without rep-sharing, but warn.
+           */
+          (fs->warning)(fs->warning_baton, err);
+          svn_error_clear(err);
+          *old_rep = NULL;
+        }
+    }
+
+  /* Add information that is missing in the cached data. */
+  if (*old_rep)
+    {
+      /* Use the old rep for this content. */
+      (*old_rep)->md5_checksum = rep->md5_checksum;
+      (*old_rep)->uniquifier = rep->uniquifier;
+    }
 
   return SVN_NO_ERROR;
 }
 
-
-svn_error_t *
-svn_fs_fs__set_entry(svn_fs_t *fs,
-                     const char *txn_id,
-                     node_revision_t *parent_noderev,
-                     const char *name,
-                     const svn_fs_id_t *id,
-                     svn_node_kind_t kind,
-                     apr_pool_t *pool)
+/* Close handler for the representation write stream.  BATON is a
+   rep_write_baton.  Writes out a new node-rev that correctly
+   references the representation we just finished writing. */
+static svn_error_t *
+rep_write_contents_close(void *baton)
 {
-  representation_t *rep = parent_noderev->data_rep;
-  const char *filename = path_txn_node_children(fs, parent_noderev->id, pool);
-  apr_file_t *file;
-  svn_stream_t *out;
-  fs_fs_data_t *ffd = fs->fsap_data;
-  apr_pool_t *subpool = svn_pool_create(pool);
-
-  if (!rep || !rep->txn_id)
-    {
-      const char *unique_suffix;
-
-      {
-        apr_hash_t *entries;
-
-        svn_pool_clear(subpool);
-
-        /* Before we can modify the directory, we need to dump its old
-           contents into a mutable representation file. */
-        SVN_ERR(svn_fs_fs__rep_contents_dir(&entries, fs, parent_noderev,
-                                            subpool));
-        SVN_ERR(unparse_dir_entries(&entries, entries, subpool));
-        SVN_ERR(svn_io_file_open(&file, filename,
-                                 APR_WRITE | APR_CREATE | APR_BUFFERED,
-                                 APR_OS_DEFAULT, pool));
-        out = svn_stream_from_aprfile2(file, TRUE, pool);
-        SVN_ERR(svn_hash_write2(entries, out, SVN_HASH_TERMINATOR, subpool));
+  struct rep_write_baton *b = baton;
+  const char *unique_suffix;
+  representation_t *rep;
+  representation_t *old_rep;
+  apr_off_t offset;
 
-        svn_pool_clear(subpool);
-      }
+  rep = apr_pcalloc(b->parent_pool, sizeof(*rep));
+  rep->offset = b->rep_offset;
 
-      /* Mark the node-rev's data rep as mutable. */
-      rep = apr_pcalloc(pool, sizeof(*rep));
-      rep->revision = SVN_INVALID_REVNUM;
-      rep->txn_id = txn_id;
-      SVN_ERR(get_new_txn_node_id(&unique_suffix, fs, txn_id, pool));
-      rep->uniquifier = apr_psprintf(pool, "%s/%s", txn_id, unique_suffix);
-      parent_noderev->data_rep = rep;
-      SVN_ERR(svn_fs_fs__put_node_revision(fs, parent_noderev->id,
-                                           parent_noderev, FALSE, pool));
-    }
-  else
-    {
-      /* The directory rep is already mutable, so just open it for append. */
-      SVN_ERR(svn_io_file_open(&file, filename, APR_WRITE | APR_APPEND,
-                               APR_OS_DEFAULT, pool));
-      out = svn_stream_from_aprfile2(file, TRUE, pool);
-    }
+  /* Close our delta stream so the last bits of svndiff are written
+     out. */
+  if (b->delta_stream)
+    SVN_ERR(svn_stream_close(b->delta_stream));
 
-  /* if we have a directory cache for this transaction, update it */
-  svn_pool_clear(subpool);
-  if (ffd->txn_dir_cache)
-    {
-      /* build parameters: (name, new entry) pair */
-      const char *key =
-          svn_fs_fs__id_unparse(parent_noderev->id, subpool)->data;
-      replace_baton_t baton = {name, NULL};
+  /* Determine the length of the svndiff data. */
+  SVN_ERR(get_file_offset(&offset, b->file, b->pool));
+  rep->size = offset - b->delta_start;
 
-      if (id)
-        {
-          baton.new_entry = apr_pcalloc(subpool, sizeof(*baton.new_entry));
-          baton.new_entry->name = name;
-          baton.new_entry->kind = kind;
-          baton.new_entry->id = id;
-        }
+  /* Fill in the rest of the representation field. */
+  rep->expanded_size = b->rep_size;
+  rep->txn_id = svn_fs_fs__id_txn_id(b->noderev->id);
+  SVN_ERR(get_new_txn_node_id(&unique_suffix, b->fs, rep->txn_id, b->pool));
+  rep->uniquifier = apr_psprintf(b->parent_pool, "%s/%s", rep->txn_id,
+                                 unique_suffix);
+  rep->revision = SVN_INVALID_REVNUM;
 
-      /* actually update the cached directory (if cached) */
-      SVN_ERR(svn_cache__set_partial(ffd->txn_dir_cache, key,
-                                     svn_fs_fs__replace_dir_entry, &baton,
-                                     subpool));
-    }
-  svn_pool_clear(subpool);
+  /* Finalize the checksum. */
+  SVN_ERR(svn_checksum_final(&rep->md5_checksum, b->md5_checksum_ctx,
+                              b->parent_pool));
+  SVN_ERR(svn_checksum_final(&rep->sha1_checksum, b->sha1_checksum_ctx,
+                              b->parent_pool));
 
-  /* Append an incremental hash entry for the entry change. */
-  if (id)
+  /* Check and see if we already have a representation somewhere that's
+     identical to the one we just wrote out. */
+  SVN_ERR(get_shared_rep(&old_rep, b->fs, rep, NULL, b->parent_pool));
+
+  if (old_rep)
     {
-      const char *val = unparse_dir_entry(kind, id, subpool);
+      /* We need to erase from the protorev the data we just wrote. */
+      SVN_ERR(svn_io_file_trunc(b->file, b->rep_offset, b->pool));
 
-      SVN_ERR(svn_stream_printf(out, subpool, "K %" APR_SIZE_T_FMT "\n%s\n"
-                                "V %" APR_SIZE_T_FMT "\n%s\n",
-                                strlen(name), name,
-                                strlen(val), val));
+      /* Use the old rep for this content. */
+      b->noderev->data_rep = old_rep;
     }
   else
     {
-      SVN_ERR(svn_stream_printf(out, subpool, "D %" APR_SIZE_T_FMT "\n%s\n",
-                                strlen(name), name));
+      /* Write out our cosmetic end marker. */
+      SVN_ERR(svn_stream_printf(b->rep_stream, b->pool, "ENDREP\n"));
+
+      b->noderev->data_rep = rep;
     }
 
-  SVN_ERR(svn_io_file_close(file, subpool));
-  svn_pool_destroy(subpool);
+  /* Write out the new node-rev information. */
+  SVN_ERR(svn_fs_fs__put_node_revision(b->fs, b->noderev->id, b->noderev, FALSE,
+                                       b->pool));
+
+  SVN_ERR(svn_io_file_close(b->file, b->pool));
+  SVN_ERR(unlock_proto_rev(b->fs, rep->txn_id, b->lockcookie, b->pool));
+  svn_pool_destroy(b->pool);
+
   return SVN_NO_ERROR;
 }
 
-/* Write a single change entry, path PATH, change CHANGE, and copyfrom
-   string COPYFROM, into the file specified by FILE.  Only include the
-   node kind field if INCLUDE_NODE_KIND is true.  All temporary
-   allocations are in POOL. */
+/* Store a writable stream in *CONTENTS_P that will receive all data
+   written and store it as the file data representation referenced by
+   NODEREV in filesystem FS.  Perform temporary allocations in
+   POOL.  Only appropriate for file data, not props or directory
+   contents. */
 static svn_error_t *
-write_change_entry(apr_file_t *file,
-                   const char *path,
-                   svn_fs_path_change2_t *change,
-                   svn_boolean_t include_node_kind,
+set_representation(svn_stream_t **contents_p,
+                   svn_fs_t *fs,
+                   node_revision_t *noderev,
                    apr_pool_t *pool)
 {
-  const char *idstr, *buf;
-  const char *change_string = NULL;
-  const char *kind_string = "";
-
-  switch (change->change_kind)
-    {
-    case svn_fs_path_change_modify:
-      change_string = ACTION_MODIFY;
-      break;
-    case svn_fs_path_change_add:
-      change_string = ACTION_ADD;
-      break;
-    case svn_fs_path_change_delete:
-      change_string = ACTION_DELETE;
-      break;
-    case svn_fs_path_change_replace:
-      change_string = ACTION_REPLACE;
-      break;
-    case svn_fs_path_change_reset:
-      change_string = ACTION_RESET;
-      break;
-    default:
-      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                               _("Invalid change type %d"),
-                               change->change_kind);
-    }
-
-  if (change->node_rev_id)
-    idstr = svn_fs_fs__id_unparse(change->node_rev_id, pool)->data;
-  else
-    idstr = ACTION_RESET;
+  struct rep_write_baton *wb;
 
-  if (include_node_kind)
-    {
-      SVN_ERR_ASSERT(change->node_kind == svn_node_dir
-                     || change->node_kind == svn_node_file);
-      kind_string = apr_psprintf(pool, "-%s",
-                                 change->node_kind == svn_node_dir
-                                 ? KIND_DIR : KIND_FILE);
-    }
-  buf = apr_psprintf(pool, "%s %s%s %s %s %s\n",
-                     idstr, change_string, kind_string,
-                     change->text_mod ? FLAG_TRUE : FLAG_FALSE,
-                     change->prop_mod ? FLAG_TRUE : FLAG_FALSE,
-                     path);
+  if (! svn_fs_fs__id_txn_id(noderev->id))
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Attempted to write to non-transaction '%s'"),
+                             svn_fs_fs__id_unparse(noderev->id, pool)->data);
 
-  SVN_ERR(svn_io_file_write_full(file, buf, strlen(buf), NULL, pool));
+  SVN_ERR(rep_write_get_baton(&wb, fs, noderev, pool));
 
-  if (SVN_IS_VALID_REVNUM(change->copyfrom_rev))
-    {
-      buf = apr_psprintf(pool, "%ld %s", change->copyfrom_rev,
-                         change->copyfrom_path);
-      SVN_ERR(svn_io_file_write_full(file, buf, strlen(buf), NULL, pool));
-    }
+  *contents_p = svn_stream_create(wb, pool);
+  svn_stream_set_write(*contents_p, rep_write_contents);
+  svn_stream_set_close(*contents_p, rep_write_contents_close);
 
-  return svn_io_file_write_full(file, "\n", 1, NULL, pool);
+  return SVN_NO_ERROR;
 }
 
 svn_error_t *
-svn_fs_fs__add_change(svn_fs_t *fs,
-                      const char *txn_id,
-                      const char *path,
-                      const svn_fs_id_t *id,
-                      svn_fs_path_change_kind_t change_kind,
-                      svn_boolean_t text_mod,
-                      svn_boolean_t prop_mod,
-                      svn_node_kind_t node_kind,
-                      svn_revnum_t copyfrom_rev,
-                      const char *copyfrom_path,
-                      apr_pool_t *pool)
+svn_fs_fs__set_contents(svn_stream_t **stream,
+                        svn_fs_t *fs,
+                        node_revision_t *noderev,
+                        apr_pool_t *pool)
 {
-  apr_file_t *file;
-  svn_fs_path_change2_t *change;
-
-  SVN_ERR(svn_io_file_open(&file, path_txn_changes(fs, txn_id, pool),
-                           APR_APPEND | APR_WRITE | APR_CREATE
-                           | APR_BUFFERED, APR_OS_DEFAULT, pool));
-
-  change = svn_fs__path_change_create_internal(id, change_kind, pool);
-  change->text_mod = text_mod;
-  change->prop_mod = prop_mod;
-  change->node_kind = node_kind;
-  change->copyfrom_rev = copyfrom_rev;
-  change->copyfrom_path = apr_pstrdup(pool, copyfrom_path);
-
-  SVN_ERR(write_change_entry(file, path, change, TRUE, pool));
+  if (noderev->kind != svn_node_file)
+    return svn_error_create(SVN_ERR_FS_NOT_FILE, NULL,
+                            _("Can't set text contents of a directory"));
 
-  return svn_io_file_close(file, pool);
+  return set_representation(stream, fs, noderev, pool);
 }
 
-/* This baton is used by the representation writing streams.  It keeps
-   track of the checksum information as well as the total size of the
-   representation so far. */
-struct rep_write_baton
+svn_error_t *
+svn_fs_fs__create_successor(const svn_fs_id_t **new_id_p,
+                            svn_fs_t *fs,
+                            const svn_fs_id_t *old_idp,
+                            node_revision_t *new_noderev,
+                            const char *copy_id,
+                            const char *txn_id,
+                            apr_pool_t *pool)
 {
-  /* The FS we are writing to. */
-  svn_fs_t *fs;
-
-  /* Actual file to which we are writing. */
-  svn_stream_t *rep_stream;
-
-  /* A stream from the delta combiner.  Data written here gets
-     deltified, then eventually written to rep_stream. */
-  svn_stream_t *delta_stream;
-
-  /* Where is this representation header stored. */
-  apr_off_t rep_offset;
-
-  /* Start of the actual data. */
-  apr_off_t delta_start;
-
-  /* How many bytes have been written to this rep already. */
-  svn_filesize_t rep_size;
-
-  /* The node revision for which we're writing out info. */
-  node_revision_t *noderev;
-
-  /* Actual output file. */
-  apr_file_t *file;
-  /* Lock 'cookie' used to unlock the output file once we've finished
-     writing to it. */
-  void *lockcookie;
+  const svn_fs_id_t *id;
 
-  svn_checksum_ctx_t *md5_checksum_ctx;
-  svn_checksum_ctx_t *sha1_checksum_ctx;
+  if (! copy_id)
+    copy_id = svn_fs_fs__id_copy_id(old_idp);
+  id = svn_fs_fs__id_txn_create(svn_fs_fs__id_node_id(old_idp), copy_id,
+                                txn_id, pool);
 
-  apr_pool_t *pool;
+  new_noderev->id = id;
 
-  apr_pool_t *parent_pool;
-};
+  if (! new_noderev->copyroot_path)
+    {
+      new_noderev->copyroot_path = apr_pstrdup(pool,
+                                               new_noderev->created_path);
+      new_noderev->copyroot_rev = svn_fs_fs__id_rev(new_noderev->id);
+    }
 
-/* Handler for the write method of the representation writable stream.
-   BATON is a rep_write_baton, DATA is the data to write, and *LEN is
-   the length of this data. */
-static svn_error_t *
-rep_write_contents(void *baton,
-                   const char *data,
-                   apr_size_t *len)
-{
-  struct rep_write_baton *b = baton;
+  SVN_ERR(svn_fs_fs__put_node_revision(fs, new_noderev->id, new_noderev, FALSE,
+                                       pool));
 
-  SVN_ERR(svn_checksum_update(b->md5_checksum_ctx, data, *len));
-  SVN_ERR(svn_checksum_update(b->sha1_checksum_ctx, data, *len));
-  b->rep_size += *len;
+  *new_id_p = id;
 
-  /* If we are writing a delta, use that stream. */
-  if (b->delta_stream)
-    return svn_stream_write(b->delta_stream, data, len);
-  else
-    return svn_stream_write(b->rep_stream, data, len);
+  return SVN_NO_ERROR;
 }
 
-/* Given a node-revision NODEREV in filesystem FS, return the
-   representation in *REP to use as the base for a text representation
-   delta.  Perform temporary allocations in *POOL. */
-static svn_error_t *
-choose_delta_base(representation_t **rep,
-                  svn_fs_t *fs,
-                  node_revision_t *noderev,
-                  apr_pool_t *pool)
-{
-  int count;
-  int walk;
-  node_revision_t *base;
-
-  /* If we have no predecessors, then use the empty stream as a
-     base. */
-  if (! noderev->predecessor_count)
-    {
-      *rep = NULL;
-      return SVN_NO_ERROR;
-    }
-
-  /* Flip the rightmost '1' bit of the predecessor count to determine
-     which file rev (counting from 0) we want to use.  (To see why
-     count & (count - 1) unsets the rightmost set bit, think about how
-     you decrement a binary number.) */
-  count = noderev->predecessor_count;
-  count = count & (count - 1);
+svn_error_t *
+svn_fs_fs__set_proplist(svn_fs_t *fs,
+                        node_revision_t *noderev,
+                        apr_hash_t *proplist,
+                        apr_pool_t *pool)
+{
+  const char *filename = path_txn_node_props(fs, noderev->id, pool);
+  apr_file_t *file;
+  svn_stream_t *out;
 
-  /* We use skip delta for limiting the number of delta operations
-     along very long node histories.  Close to HEAD however, we create
-     a linear history to minimize delta size.  */
-  walk = noderev->predecessor_count - count;
-  if (walk < SVN_FS_FS_MAX_LINEAR_DELTIFICATION)
-    count = noderev->predecessor_count - 1;
+  /* Dump the property list to the mutable property file. */
+  SVN_ERR(svn_io_file_open(&file, filename,
+                           APR_WRITE | APR_CREATE | APR_TRUNCATE
+                           | APR_BUFFERED, APR_OS_DEFAULT, pool));
+  out = svn_stream_from_aprfile2(file, TRUE, pool);
+  SVN_ERR(svn_hash_write2(proplist, out, SVN_HASH_TERMINATOR, pool));
+  SVN_ERR(svn_io_file_close(file, pool));
 
-  /* Finding the delta base over a very long distance can become extremely
-     expensive for very deep histories, possibly causing client timeouts etc.
-     OTOH, this is a rare operation and its gains are minimal. Lets simply
-     start deltification anew close every other 1000 changes or so.  */
-  if (walk > SVN_FS_FS_MAX_DELTIFICATION_WALK)
+  /* Mark the node-rev's prop rep as mutable, if not already done. */
+  if (!noderev->prop_rep || !noderev->prop_rep->txn_id)
     {
-      *rep = NULL;
-      return SVN_NO_ERROR;
+      noderev->prop_rep = apr_pcalloc(pool, sizeof(*noderev->prop_rep));
+      noderev->prop_rep->txn_id = svn_fs_fs__id_txn_id(noderev->id);
+      SVN_ERR(svn_fs_fs__put_node_revision(fs, noderev->id, noderev, FALSE, pool));
     }
 
-  /* Walk back a number of predecessors equal to the difference
-     between count and the original predecessor count.  (For example,
-     if noderev has ten predecessors and we want the eighth file rev,
-     walk back two predecessors.) */
-  base = noderev;
-  while ((count++) < noderev->predecessor_count)
-    SVN_ERR(svn_fs_fs__get_node_revision(&base, fs,
-                                         base->predecessor_id, pool));
-
-  *rep = base->data_rep;
-
   return SVN_NO_ERROR;
 }
 
-/* Get a rep_write_baton and store it in *WB_P for the representation
-   indicated by NODEREV in filesystem FS.  Perform allocations in
-   POOL.  Only appropriate for file contents, not for props or
-   directory contents. */
+/* Read the 'current' file for filesystem FS and store the next
+   available node id in *NODE_ID, and the next available copy id in
+   *COPY_ID.  Allocations are performed from POOL. */
 static svn_error_t *
-rep_write_get_baton(struct rep_write_baton **wb_p,
-                    svn_fs_t *fs,
-                    node_revision_t *noderev,
-                    apr_pool_t *pool)
+get_next_revision_ids(const char **node_id,
+                      const char **copy_id,
+                      svn_fs_t *fs,
+                      apr_pool_t *pool)
 {
-  struct rep_write_baton *b;
-  apr_file_t *file;
-  representation_t *base_rep;
-  svn_stream_t *source;
-  const char *header;
-  svn_txdelta_window_handler_t wh;
-  void *whb;
-  fs_fs_data_t *ffd = fs->fsap_data;
-  int diff_version = ffd->format >= SVN_FS_FS__MIN_SVNDIFF1_FORMAT ? 1 : 0;
+  char *buf;
+  char *str;
 
-  b = apr_pcalloc(pool, sizeof(*b));
+  SVN_ERR(read_current(svn_fs_fs__path_current(fs, pool), &buf, pool));
 
-  b->sha1_checksum_ctx = svn_checksum_ctx_create(svn_checksum_sha1, pool);
-  b->md5_checksum_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
+  str = svn_cstring_tokenize(" ", &buf);
+  if (! str)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Corrupt 'current' file"));
 
-  b->fs = fs;
-  b->parent_pool = pool;
-  b->pool = svn_pool_create(pool);
-  b->rep_size = 0;
-  b->noderev = noderev;
+  str = svn_cstring_tokenize(" ", &buf);
+  if (! str)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Corrupt 'current' file"));
 
-  /* Open the prototype rev file and seek to its end. */
-  SVN_ERR(get_writable_proto_rev(&file, &b->lockcookie,
-                                 fs, svn_fs_fs__id_txn_id(noderev->id),
-                                 b->pool));
+  *node_id = apr_pstrdup(pool, str);
 
-  b->file = file;
-  b->rep_stream = svn_stream_from_aprfile2(file, TRUE, b->pool);
+  str = svn_cstring_tokenize(" ", &buf);
+  if (! str)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Corrupt 'current' file"));
 
-  SVN_ERR(get_file_offset(&b->rep_offset, file, b->pool));
+  *copy_id = apr_pstrdup(pool, str);
 
-  /* Get the base for this delta. */
-  SVN_ERR(choose_delta_base(&base_rep, fs, noderev, b->pool));
-  SVN_ERR(read_representation(&source, fs, base_rep, b->pool));
+  return SVN_NO_ERROR;
+}
 
-  /* Write out the rep header. */
-  if (base_rep)
-    {
-      header = apr_psprintf(b->pool, REP_DELTA " %ld %" APR_OFF_T_FMT " %"
-                            SVN_FILESIZE_T_FMT "\n",
-                            base_rep->revision, base_rep->offset,
-                            base_rep->size);
-    }
-  else
-    {
-      header = REP_DELTA "\n";
-    }
-  SVN_ERR(svn_io_file_write_full(file, header, strlen(header), NULL,
-                                 b->pool));
+/* This baton is used by the stream created for write_hash_rep. */
+struct write_hash_baton
+{
+  svn_stream_t *stream;
 
-  /* Now determine the offset of the actual svndiff data. */
-  SVN_ERR(get_file_offset(&b->delta_start, file, b->pool));
+  apr_size_t size;
 
-  /* Prepare to write the svndiff data. */
-  svn_txdelta_to_svndiff3(&wh,
-                          &whb,
-                          b->rep_stream,
-                          diff_version,
-                          SVN_DELTA_COMPRESSION_LEVEL_DEFAULT,
-                          pool);
+  svn_checksum_ctx_t *md5_ctx;
+  svn_checksum_ctx_t *sha1_ctx;
+};
+
+/* The handler for the write_hash_rep stream.  BATON is a
+   write_hash_baton, DATA has the data to write and *LEN is the number
+   of bytes to write. */
+static svn_error_t *
+write_hash_handler(void *baton,
+                   const char *data,
+                   apr_size_t *len)
+{
+  struct write_hash_baton *whb = baton;
 
-  b->delta_stream = svn_txdelta_target_push(wh, whb, source, b->pool);
+  SVN_ERR(svn_checksum_update(whb->md5_ctx, data, *len));
+  SVN_ERR(svn_checksum_update(whb->sha1_ctx, data, *len));
 
-  *wb_p = b;
+  SVN_ERR(svn_stream_write(whb->stream, data, len));
+  whb->size += *len;
 
   return SVN_NO_ERROR;
 }
 
-/* For the hash REP->SHA1, try to find an already existing representation
-   in FS and return it in *OUT_REP.  If no such representation exists or
-   if rep sharing has been disabled for FS, NULL will be returned.  Since
-   there may be new duplicate representations within the same uncommitted
-   revision, those can be passed in REPS_HASH (maps a sha1 digest onto
-   representation_t*), otherwise pass in NULL for REPS_HASH.
-   POOL will be used for allocations. The lifetime of the returned rep is
-   limited by both, POOL and REP lifetime.
- */
+/* Write out the hash HASH as a text representation to file FILE.  In
+   the process, record position, the total size of the dump and MD5 as
+   well as SHA1 in REP.   If rep sharing has been enabled and REPS_HASH
+   is not NULL, it will be used in addition to the on-disk cache to find
+   earlier reps with the same content.  When such existing reps can be
+   found,  we will truncate the one just written from the file and return
+   the existing rep.  Perform temporary allocations in POOL. */
 static svn_error_t *
-get_shared_rep(representation_t **old_rep,
+write_hash_rep(representation_t *rep,
+               apr_file_t *file,
+               apr_hash_t *hash,
                svn_fs_t *fs,
-               representation_t *rep,
                apr_hash_t *reps_hash,
                apr_pool_t *pool)
 {
-  svn_error_t *err;
-  fs_fs_data_t *ffd = fs->fsap_data;
+  svn_stream_t *stream;
+  struct write_hash_baton *whb;
+  representation_t *old_rep;
 
-  /* Return NULL, if rep sharing has been disabled. */
-  *old_rep = NULL;
-  if (!ffd->rep_sharing_allowed)
-    return SVN_NO_ERROR;
+  SVN_ERR(get_file_offset(&rep->offset, file, pool));
+
+  whb = apr_pcalloc(pool, sizeof(*whb));
+
+  whb->stream = svn_stream_from_aprfile2(file, TRUE, pool);
+  whb->size = 0;
+  whb->md5_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
+  whb->sha1_ctx = svn_checksum_ctx_create(svn_checksum_sha1, pool);
+
+  stream = svn_stream_create(whb, pool);
+  svn_stream_set_write(stream, write_hash_handler);
+
+  SVN_ERR(svn_stream_printf(whb->stream, pool, "PLAIN\n"));
+
+  SVN_ERR(svn_hash_write2(hash, stream, SVN_HASH_TERMINATOR, pool));
+
+  /* Store the results. */
+  SVN_ERR(svn_checksum_final(&rep->md5_checksum, whb->md5_ctx, pool));
+  SVN_ERR(svn_checksum_final(&rep->sha1_checksum, whb->sha1_ctx, pool));
 
   /* Check and see if we already have a representation somewhere that's
-     identical to the one we just wrote out.  Start with the hash lookup
-     because it is cheepest. */
-  if (reps_hash)
-    *old_rep = apr_hash_get(reps_hash,
-                            rep->sha1_checksum->digest,
-                            APR_SHA1_DIGESTSIZE);
+     identical to the one we just wrote out. */
+  SVN_ERR(get_shared_rep(&old_rep, fs, rep, reps_hash, pool));
 
-  /* If we haven't found anything yet, try harder and consult our DB. */
-  if (*old_rep == NULL)
+  if (old_rep)
     {
-      err = svn_fs_fs__get_rep_reference(old_rep, fs, rep->sha1_checksum,
-                                         pool);
-      /* ### Other error codes that we shouldn't mask out? */
-      if (err == SVN_NO_ERROR
-          || err->apr_err == SVN_ERR_FS_CORRUPT
-          || SVN_ERROR_IN_CATEGORY(err->apr_err,
-                                   SVN_ERR_MALFUNC_CATEGORY_START))
-        {
-          /* Fatal error; don't mask it.
+      /* We need to erase from the protorev the data we just wrote. */
+      SVN_ERR(svn_io_file_trunc(file, rep->offset, pool));
 
-             In particular, this block is triggered when the rep-cache refers
-             to revisions in the future.  We signal that as a corruption situation
-             since, once those revisions are less than youngest (because of more
-             commits), the rep-cache would be invalid.
-           */
-          SVN_ERR(err);
-        }
-      else
-        {
-          /* Something's wrong with the rep-sharing index.  We can continue
-             without rep-sharing, but warn.
-           */
-          (fs->warning)(fs->warning_baton, err);
-          svn_error_clear(err);
-          *old_rep = NULL;
-        }
+      /* Use the old rep for this content. */
+      memcpy(rep, old_rep, sizeof (*rep));
     }
-
-  /* Add information that is missing in the cached data. */
-  if (*old_rep)
+  else
     {
-      /* Use the old rep for this content. */
-      (*old_rep)->md5_checksum = rep->md5_checksum;
-      (*old_rep)->uniquifier = rep->uniquifier;
+      /* Write out our cosmetic end marker. */
+      SVN_ERR(svn_stream_printf(whb->stream, pool, "ENDREP\n"));
+
+      /* update the representation */
+      rep->size = whb->size;
+      rep->expanded_size = 0;
     }
 
   return SVN_NO_ERROR;
 }
 
-/* Close handler for the representation write stream.  BATON is a
-   rep_write_baton.  Writes out a new node-rev that correctly
-   references the representation we just finished writing. */
+/* Write out the hash HASH pertaining to the NODEREV in FS as a deltified
+   text representation to file FILE.  In the process, record the total size
+   and the md5 digest in REP.  If rep sharing has been enabled and REPS_HASH
+   is not NULL, it will be used in addition to the on-disk cache to find
+   earlier reps with the same content.  When such existing reps can be found,
+   we will truncate the one just written from the file and return the existing
+   rep.  Perform temporary allocations in POOL. */
+#ifdef SVN_FS_FS_DELTIFY_DIRECTORIES
 static svn_error_t *
-rep_write_contents_close(void *baton)
+write_hash_delta_rep(representation_t *rep,
+                     apr_file_t *file,
+                     apr_hash_t *hash,
+                     svn_fs_t *fs,
+                     node_revision_t *noderev,
+                     apr_hash_t *reps_hash,
+                     apr_pool_t *pool)
 {
-  struct rep_write_baton *b = baton;
-  const char *unique_suffix;
-  representation_t *rep;
+  svn_txdelta_window_handler_t diff_wh;
+  void *diff_whb;
+
+  svn_stream_t *file_stream;
+  svn_stream_t *stream;
+  representation_t *base_rep;
   representation_t *old_rep;
-  apr_off_t offset;
+  svn_stream_t *source;
+  const char *header;
 
-  rep = apr_pcalloc(b->parent_pool, sizeof(*rep));
-  rep->offset = b->rep_offset;
+  apr_off_t rep_end = 0;
+  apr_off_t delta_start = 0;
 
-  /* Close our delta stream so the last bits of svndiff are written
-     out. */
-  if (b->delta_stream)
-    SVN_ERR(svn_stream_close(b->delta_stream));
+  struct write_hash_baton *whb;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  int diff_version = get_svndiff_version(ffd);
 
-  /* Determine the length of the svndiff data. */
-  SVN_ERR(get_file_offset(&offset, b->file, b->pool));
-  rep->size = offset - b->delta_start;
+  /* Get the base for this delta. */
+  SVN_ERR(choose_delta_base(&base_rep, fs, noderev, pool));
+  SVN_ERR(read_representation(&source, fs, base_rep, pool));
 
-  /* Fill in the rest of the representation field. */
-  rep->expanded_size = b->rep_size;
-  rep->txn_id = svn_fs_fs__id_txn_id(b->noderev->id);
-  SVN_ERR(get_new_txn_node_id(&unique_suffix, b->fs, rep->txn_id, b->pool));
-  rep->uniquifier = apr_psprintf(b->parent_pool, "%s/%s", rep->txn_id,
-                                 unique_suffix);
-  rep->revision = SVN_INVALID_REVNUM;
+  SVN_ERR(get_file_offset(&rep->offset, file, pool));
 
-  /* Finalize the checksum. */
-  SVN_ERR(svn_checksum_final(&rep->md5_checksum, b->md5_checksum_ctx,
-                              b->parent_pool));
-  SVN_ERR(svn_checksum_final(&rep->sha1_checksum, b->sha1_checksum_ctx,
-                              b->parent_pool));
+  /* Write out the rep header. */
+  if (base_rep)
+    {
+      header = apr_psprintf(pool, REP_DELTA " %ld %" APR_OFF_T_FMT " %"
+                            SVN_FILESIZE_T_FMT "\n",
+                            base_rep->revision, base_rep->offset,
+                            base_rep->size);
+    }
+  else
+    {
+      header = REP_DELTA "\n";
+    }
+  SVN_ERR(svn_io_file_write_full(file, header, strlen(header), NULL,
+                                 pool));
+
+  SVN_ERR(get_file_offset(&delta_start, file, pool));
+  file_stream = svn_stream_from_aprfile2(file, TRUE, pool);
+
+  /* Prepare to write the svndiff data. */
+  svn_txdelta_to_svndiff4(&diff_wh,
+                          &diff_whb,
+                          file_stream,
+                          diff_version,
+                          SVN_DELTA_COMPRESSION_LEVEL_DEFAULT,
+                          ffd->delta_compression_threads,
+                          pool);
+
+  whb = apr_pcalloc(pool, sizeof(*whb));
+  whb->stream = svn_txdelta_target_push2(diff_wh, diff_whb, source,
+                                         ffd->delta_window_size, pool);
+  whb->size = 0;
+  whb->md5_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
+  whb->sha1_ctx = svn_checksum_ctx_create(svn_checksum_sha1, pool);
+
+  /* serialize the hash */
+  stream = svn_stream_create(whb, pool);
+  svn_stream_set_write(stream, write_hash_handler);
+
+  SVN_ERR(svn_hash_write2(hash, stream, SVN_HASH_TERMINATOR, pool));
+  SVN_ERR(svn_stream_close(whb->stream));
+
+  /* Store the results. */
+  SVN_ERR(svn_checksum_final(&rep->md5_checksum, whb->md5_ctx, pool));
+  SVN_ERR(svn_checksum_final(&rep->sha1_checksum, whb->sha1_ctx, pool));
 
   /* Check and see if we already have a representation somewhere that's
      identical to the one we just wrote out. */
-  SVN_ERR(get_shared_rep(&old_rep, b->fs, rep, NULL, b->parent_pool));
+  SVN_ERR(get_shared_rep(&old_rep, fs, rep, reps_hash, pool));
 
   if (old_rep)
     {
       /* We need to erase from the protorev the data we just wrote. */
-      SVN_ERR(svn_io_file_trunc(b->file, b->rep_offset, b->pool));
+      SVN_ERR(svn_io_file_trunc(file, rep->offset, pool));
 
       /* Use the old rep for this content. */
-      b->noderev->data_rep = old_rep;
+      memcpy(rep, old_rep, sizeof (*rep));
     }
   else
     {
       /* Write out our cosmetic end marker. */
-      SVN_ERR(svn_stream_printf(b->rep_stream, b->pool, "ENDREP\n"));
+      SVN_ERR(get_file_offset(&rep_end, file, pool));
+      SVN_ERR(svn_stream_printf(file_stream, pool, "ENDREP\n"));
 
-      b->noderev->data_rep = rep;
+      /* update the representation */
+      rep->expanded_size = whb->size;
+      rep->size = rep_end - delta_start;
     }
 
-  /* Write out the new node-rev information. */
-  SVN_ERR(svn_fs_fs__put_node_revision(b->fs, b->noderev->id, b->noderev, FALSE,
-                                       b->pool));
-
-  SVN_ERR(svn_io_file_close(b->file, b->pool));
-  SVN_ERR(unlock_proto_rev(b->fs, rep->txn_id, b->lockcookie, b->pool));
-  svn_pool_destroy(b->pool);
-
   return SVN_NO_ERROR;
 }
+#endif
 
-/* Store a writable stream in *CONTENTS_P that will receive all data
-   written and store it as the file data representation referenced by
-   NODEREV in filesystem FS.  Perform temporary allocations in
-   POOL.  Only appropriate for file data, not props or directory
-   contents. */
+/* Sanity check ROOT_NODEREV, a candidate for being the root node-revision
+   of (not yet committed) revision REV in FS.  Use POOL for temporary
+   allocations.
+
+   If you change this function, consider updating svn_fs_fs__verify() too.
+ */
 static svn_error_t *
-set_representation(svn_stream_t **contents_p,
-                   svn_fs_t *fs,
-                   node_revision_t *noderev,
-                   apr_pool_t *pool)
+validate_root_noderev(svn_fs_t *fs,
+                      node_revision_t *root_noderev,
+                      svn_revnum_t rev,
+                      apr_pool_t *pool)
 {
-  struct rep_write_baton *wb;
-
-  if (! svn_fs_fs__id_txn_id(noderev->id))
-    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                             _("Attempted to write to non-transaction '%s'"),
-                             svn_fs_fs__id_unparse(noderev->id, pool)->data);
-
-  SVN_ERR(rep_write_get_baton(&wb, fs, noderev, pool));
-
-  *contents_p = svn_stream_create(wb, pool);
-  svn_stream_set_write(*contents_p, rep_write_contents);
-  svn_stream_set_close(*contents_p, rep_write_contents_close);
+  svn_revnum_t head_revnum = rev-1;
+  int head_predecessor_count;
 
-  return SVN_NO_ERROR;
-}
+  SVN_ERR_ASSERT(rev > 0);
 
-svn_error_t *
-svn_fs_fs__set_contents(svn_stream_t **stream,
-                        svn_fs_t *fs,
-                        node_revision_t *noderev,
-                        apr_pool_t *pool)
-{
-  if (noderev->kind != svn_node_file)
-    return svn_error_create(SVN_ERR_FS_NOT_FILE, NULL,
-                            _("Can't set text contents of a directory"));
+  /* Compute HEAD_PREDECESSOR_COUNT. */
+  {
+    svn_fs_root_t *head_revision;
+    const svn_fs_id_t *head_root_id;
+    node_revision_t *head_root_noderev;
 
-  return set_representation(stream, fs, noderev, pool);
-}
+    /* Get /@HEAD's noderev. */
+    SVN_ERR(svn_fs_fs__revision_root(&head_revision, fs, head_revnum, pool));
+    SVN_ERR(svn_fs_fs__node_id(&head_root_id, head_revision, "/", pool));
+    SVN_ERR(svn_fs_fs__get_node_revision(&head_root_noderev, fs, head_root_id,
+                                         pool));
 
-svn_error_t *
-svn_fs_fs__create_successor(const svn_fs_id_t **new_id_p,
-                            svn_fs_t *fs,
-                            const svn_fs_id_t *old_idp,
-                            node_revision_t *new_noderev,
-                            const char *copy_id,
-                            const char *txn_id,
-                            apr_pool_t *pool)
-{
-  const svn_fs_id_t *id;
+    head_predecessor_count = head_root_noderev->predecessor_count;
+  }
 
-  if (! copy_id)
-    copy_id = svn_fs_fs__id_copy_id(old_idp);
-  id = svn_fs_fs__id_txn_create(svn_fs_fs__id_node_id(old_idp), copy_id,
-                                txn_id, pool);
+  /* Check that the root noderev's predecessor count equals REV.
 
-  new_noderev->id = id;
+     This kind of corruption was seen on svn.apache.org (both on
+     the root noderev and on other fspaths' noderevs); see
+     issue #4129.
 
-  if (! new_noderev->copyroot_path)
+     Normally (rev == root_noderev->predecessor_count), but here we
+     use a more roundabout check that should only trigger on new instances
+     of the corruption, rather then trigger on each and every new commit
+     to a repository that has triggered the bug somewhere in its root
+     noderev's history.
+   */
+  if (root_noderev->predecessor_count != -1
+      && (root_noderev->predecessor_count - head_predecessor_count)
+         != (rev - head_revnum))
     {
-      new_noderev->copyroot_path = apr_pstrdup(pool,
-                                               new_noderev->created_path);
-      new_noderev->copyroot_rev = svn_fs_fs__id_rev(new_noderev->id);
+      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                               _("predecessor count for "
+                                 "the root node-revision is wrong: "
+                                 "found (%d+%ld != %d), committing r%ld"),
+                                 head_predecessor_count,
+                                 rev - head_revnum, /* This is equal to 1. */
+                                 root_noderev->predecessor_count,
+                                 rev);
     }
 
-  SVN_ERR(svn_fs_fs__put_node_revision(fs, new_noderev->id, new_noderev, FALSE,
-                                       pool));
-
-  *new_id_p = id;
-
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__set_proplist(svn_fs_t *fs,
-                        node_revision_t *noderev,
-                        apr_hash_t *proplist,
-                        apr_pool_t *pool)
-{
-  const char *filename = path_txn_node_props(fs, noderev->id, pool);
-  apr_file_t *file;
-  svn_stream_t *out;
+/* Copy a node-revision specified by id ID in fileystem FS from a
+   transaction into the proto-rev-file FILE.  Set *NEW_ID_P to a
+   pointer to the new node-id which will be allocated in POOL.
+   If this is a directory, copy all children as well.
 
-  /* Dump the property list to the mutable property file. */
-  SVN_ERR(svn_io_file_open(&file, filename,
-                           APR_WRITE | APR_CREATE | APR_TRUNCATE
-                           | APR_BUFFERED, APR_OS_DEFAULT, pool));
-  out = svn_stream_from_aprfile2(file, TRUE, pool);
-  SVN_ERR(svn_hash_write2(proplist, out, SVN_HASH_TERMINATOR, pool));
-  SVN_ERR(svn_io_file_close(file, pool));
+   START_NODE_ID and START_COPY_ID are
+   the first available node and copy ids for this filesystem, for older
+   FS formats.
+
+   REV is the revision number that this proto-rev-file will represent.
+
+   INITIAL_OFFSET is the offset of the proto-rev-file on entry to
+   commit_body.
 
-  /* Mark the node-rev's prop rep as mutable, if not already done. */
-  if (!noderev->prop_rep || !noderev->prop_rep->txn_id)
-    {
-      noderev->prop_rep = apr_pcalloc(pool, sizeof(*noderev->prop_rep));
-      noderev->prop_rep->txn_id = svn_fs_fs__id_txn_id(noderev->id);
-      SVN_ERR(svn_fs_fs__put_node_revision(fs, noderev->id, noderev, FALSE, pool));
-    }
+   If REPS_TO_CACHE is not NULL, append to it a copy (allocated in
+   REPS_POOL) of each data rep that is new in this revision.
 
-  return SVN_NO_ERROR;
-}
+   If REPS_HASH is not NULL, append copies (allocated in REPS_POOL)
+   of the representations of each property rep that is new in this
+   revision.
 
-/* Read the 'current' file for filesystem FS and store the next
-   available node id in *NODE_ID, and the next available copy id in
-   *COPY_ID.  Allocations are performed from POOL. */
+   AT_ROOT is true if the node revision being written is the root
+   node-revision.  It is only controls additional sanity checking
+   logic.
+
+   Temporary allocations are also from POOL. */
 static svn_error_t *
-get_next_revision_ids(const char **node_id,
-                      const char **copy_id,
-                      svn_fs_t *fs,
-                      apr_pool_t *pool)
+write_final_rev(const svn_fs_id_t **new_id_p,
+                apr_file_t *file,
+                svn_revnum_t rev,
+                svn_fs_t *fs,
+                const svn_fs_id_t *id,
+                const char *start_node_id,
+                const char *start_copy_id,
+                apr_off_t initial_offset,
+                apr_array_header_t *reps_to_cache,
+                apr_hash_t *reps_hash,
+                apr_pool_t *reps_pool,
+                svn_boolean_t at_root,
+                apr_pool_t *pool)
 {
-  char *buf;
-  char *str;
+  node_revision_t *noderev;
+  apr_off_t my_offset;
+  char my_node_id_buf[MAX_KEY_SIZE + 2];
+  char my_copy_id_buf[MAX_KEY_SIZE + 2];
+  const svn_fs_id_t *new_id;
+  const char *node_id, *copy_id, *my_node_id, *my_copy_id;
+  fs_fs_data_t *ffd = fs->fsap_data;
 
-  SVN_ERR(read_current(svn_fs_fs__path_current(fs, pool), &buf, pool));
+  *new_id_p = NULL;
 
-  str = svn_cstring_tokenize(" ", &buf);
-  if (! str)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Corrupt 'current' file"));
+  /* Check to see if this is a transaction node. */
+  if (! svn_fs_fs__id_txn_id(id))
+    return SVN_NO_ERROR;
 
-  str = svn_cstring_tokenize(" ", &buf);
-  if (! str)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Corrupt 'current' file"));
+  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, id, pool));
 
-  *node_id = apr_pstrdup(pool, str);
+  if (noderev->kind == svn_node_dir)
+    {
+      apr_pool_t *subpool;
+      apr_hash_t *entries, *str_entries;
+      apr_hash_index_t *hi;
 
-  str = svn_cstring_tokenize(" ", &buf);
-  if (! str)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Corrupt 'current' file"));
+      /* This is a directory.  Write out all the children first. */
+      subpool = svn_pool_create(pool);
 
-  *copy_id = apr_pstrdup(pool, str);
+      SVN_ERR(svn_fs_fs__rep_contents_dir(&entries, fs, noderev, pool));
 
-  return SVN_NO_ERROR;
-}
+      for (hi = apr_hash_first(pool, entries); hi; hi = apr_hash_next(hi))
+        {
+          svn_fs_dirent_t *dirent = svn__apr_hash_index_val(hi);
 
-/* This baton is used by the stream created for write_hash_rep. */
-struct write_hash_baton
-{
-  svn_stream_t *stream;
+          svn_pool_clear(subpool);
+          SVN_ERR(write_final_rev(&new_id, file, rev, fs, dirent->id,
+                                  start_node_id, start_copy_id, initial_offset,
+                                  reps_to_cache, reps_hash, reps_pool, FALSE,
+                                  subpool));
+          if (new_id && (svn_fs_fs__id_rev(new_id) == rev))
+            dirent->id = svn_fs_fs__id_copy(new_id, pool);
+        }
+      svn_pool_destroy(subpool);
 
-  apr_size_t size;
+      if (noderev->data_rep && noderev->data_rep->txn_id)
+        {
+          /* Write out the contents of this directory as a text rep. */
+          SVN_ERR(unparse_dir_entries(&str_entries, entries, pool));
 
-  svn_checksum_ctx_t *md5_ctx;
-  svn_checksum_ctx_t *sha1_ctx;
-};
+          noderev->data_rep->txn_id = NULL;
+          noderev->data_rep->revision = rev;
 
-/* The handler for the write_hash_rep stream.  BATON is a
-   write_hash_baton, DATA has the data to write and *LEN is the number
-   of bytes to write. */
-static svn_error_t *
-write_hash_handler(void *baton,
-                   const char *data,
-                   apr_size_t *len)
-{
-  struct write_hash_baton *whb = baton;
+#ifdef SVN_FS_FS_DELTIFY_DIRECTORIES
+          SVN_ERR(write_hash_delta_rep(noderev->data_rep, file,
+                                       str_entries, fs, noderev, NULL,
+                                       pool));
+#else
+          SVN_ERR(write_hash_rep(noderev->data_rep, file, str_entries,
+                                 fs, NULL, pool));
+#endif
+        }
+    }
+  else
+    {
+      /* This is a file.  We should make sure the data rep, if it
+         exists in a "this" state, gets rewritten to our new revision
+         num. */
 
-  SVN_ERR(svn_checksum_update(whb->md5_ctx, data, *len));
-  SVN_ERR(svn_checksum_update(whb->sha1_ctx, data, *len));
+      if (noderev->data_rep && noderev->data_rep->txn_id)
+        {
+          noderev->data_rep->txn_id = NULL;
+          noderev->data_rep->revision = rev;
 
-  SVN_ERR(svn_stream_write(whb->stream, data, len));
-  whb->size += *len;
+          /* See issue 3845.  Some unknown mechanism caused the
+             protorev file to get truncated, so check for that
+             here.  */
+          if (noderev->data_rep->offset + noderev->data_rep->size
+              > initial_offset)
+            return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                    _("Truncated protorev file detected"));
+        }
+    }
 
-  return SVN_NO_ERROR;
-}
+  /* Fix up the property reps. */
+  if (noderev->prop_rep && noderev->prop_rep->txn_id)
+    {
+      apr_hash_t *proplist;
+      SVN_ERR(svn_fs_fs__get_proplist(&proplist, fs, noderev, pool));
 
-/* Write out the hash HASH as a text representation to file FILE.  In
-   the process, record position, the total size of the dump and MD5 as
-   well as SHA1 in REP.   If rep sharing has been enabled and REPS_HASH
-   is not NULL, it will be used in addition to the on-disk cache to find
-   earlier reps with the same content.  When such existing reps can be
-   found,  we will truncate the one just written from the file and return
-   the existing rep.  Perform temporary allocations in POOL. */
-static svn_error_t *
-write_hash_rep(representation_t *rep,
-               apr_file_t *file,
-               apr_hash_t *hash,
-               svn_fs_t *fs,
-               apr_hash_t *reps_hash,
-               apr_pool_t *pool)
-{
-  svn_stream_t *stream;
-  struct write_hash_baton *whb;
-  representation_t *old_rep;
+      noderev->prop_rep->txn_id = NULL;
+      noderev->prop_rep->revision = rev;
 
-  SVN_ERR(get_file_offset(&rep->offset, file, pool));
+#ifdef SVN_FS_FS_DELTIFY_PROPS
+      SVN_ERR(write_hash_delta_rep(noderev->prop_rep, file,
+                                   proplist, fs, noderev, reps_hash,
+                                   pool));
+#else
+      SVN_ERR(write_hash_rep(noderev->prop_rep, file, proplist,
+                             fs, reps_hash, pool));
+#endif
+    }
 
-  whb = apr_pcalloc(pool, sizeof(*whb));
 
-  whb->stream = svn_stream_from_aprfile2(file, TRUE, pool);
-  whb->size = 0;
-  whb->md5_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
-  whb->sha1_ctx = svn_checksum_ctx_create(svn_checksum_sha1, pool);
+  /* Convert our temporary ID into a permanent revision one. */
+  SVN_ERR(get_file_offset(&my_offset, file, pool));
 
-  stream = svn_stream_create(whb, pool);
-  svn_stream_set_write(stream, write_hash_handler);
+  node_id = svn_fs_fs__id_node_id(noderev->id);
+  if (*node_id == '_')
+    {
+      if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
+        my_node_id = apr_psprintf(pool, "%s-%ld", node_id + 1, rev);
+      else
+        {
+          svn_fs_fs__add_keys(start_node_id, node_id + 1, my_node_id_buf);
+          my_node_id = my_node_id_buf;
+        }
+    }
+  else
+    my_node_id = node_id;
 
-  SVN_ERR(svn_stream_printf(whb->stream, pool, "PLAIN\n"));
+  copy_id = svn_fs_fs__id_copy_id(noderev->id);
+  if (*copy_id == '_')
+    {
+      if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
+        my_copy_id = apr_psprintf(pool, "%s-%ld", copy_id + 1, rev);
+      else
+        {
+          svn_fs_fs__add_keys(start_copy_id, copy_id + 1, my_copy_id_buf);
+          my_copy_id = my_copy_id_buf;
+        }
+    }
+  else
+    my_copy_id = copy_id;
 
-  SVN_ERR(svn_hash_write2(hash, stream, SVN_HASH_TERMINATOR, pool));
+  if (noderev->copyroot_rev == SVN_INVALID_REVNUM)
+    noderev->copyroot_rev = rev;
 
-  /* Store the results. */
-  SVN_ERR(svn_checksum_final(&rep->md5_checksum, whb->md5_ctx, pool));
-  SVN_ERR(svn_checksum_final(&rep->sha1_checksum, whb->sha1_ctx, pool));
+  new_id = svn_fs_fs__id_rev_create(my_node_id, my_copy_id, rev, my_offset,
+                                    pool);
 
-  /* Check and see if we already have a representation somewhere that's
-     identical to the one we just wrote out. */
-  SVN_ERR(get_shared_rep(&old_rep, fs, rep, reps_hash, pool));
+  noderev->id = new_id;
+
+  if (ffd->rep_sharing_allowed)
+    {
+      /* Save the data representation's hash in the rep cache. */
+      if (   noderev->data_rep && noderev->kind == svn_node_file
+          && noderev->data_rep->revision == rev)
+        {
+          SVN_ERR_ASSERT(reps_to_cache && reps_pool);
+          APR_ARRAY_PUSH(reps_to_cache, representation_t *)
+            = svn_fs_fs__rep_copy(noderev->data_rep, reps_pool);
+        }
+
+      if (noderev->prop_rep && noderev->prop_rep->revision == rev)
+        {
+          /* Add new property reps to hash and on-disk cache. */
+          representation_t *copy
+            = svn_fs_fs__rep_copy(noderev->prop_rep, reps_pool);
+
+          SVN_ERR_ASSERT(reps_to_cache && reps_pool);
+          APR_ARRAY_PUSH(reps_to_cache, representation_t *) = copy;
+
+          apr_hash_set(reps_hash,
+                        copy->sha1_checksum->digest,
+                        APR_SHA1_DIGESTSIZE,
+                        copy);
+        }
+    }
 
-  if (old_rep)
-    {
-      /* We need to erase from the protorev the data we just wrote. */
-      SVN_ERR(svn_io_file_trunc(file, rep->offset, pool));
+  /* don't serialize SHA1 for dirs to disk (waste of space) */
+  if (noderev->data_rep && noderev->kind == svn_node_dir)
+    noderev->data_rep->sha1_checksum = NULL;
 
-      /* Use the old rep for this content. */
-      memcpy(rep, old_rep, sizeof (*rep));
-    }
-  else
-    {
-      /* Write out our cosmetic end marker. */
-      SVN_ERR(svn_stream_printf(whb->stream, pool, "ENDREP\n"));
+  /* don't serialize SHA1 for props to disk (waste of space) */
+  if (noderev->prop_rep)
+    noderev->prop_rep->sha1_checksum = NULL;
 
-      /* update the representation */
-      rep->size = whb->size;
-      rep->expanded_size = 0;
-    }
+  /* Write out our new node-revision. */
+  if (at_root)
+    SVN_ERR(validate_root_noderev(fs, noderev, rev, pool));
+  SVN_ERR(svn_fs_fs__write_noderev(svn_stream_from_aprfile2(file, TRUE, pool),
+                                   noderev, ffd->format,
+                                   svn_fs_fs__fs_supports_mergeinfo(fs),
+                                   pool));
+
+  /* Return our ID that references the revision file. */
+  *new_id_p = noderev->id;
 
   return SVN_NO_ERROR;
 }
 
-/* Write out the hash HASH pertaining to the NODEREV in FS as a deltified
-   text representation to file FILE.  In the process, record the total size
-   and the md5 digest in REP.  If rep sharing has been enabled and REPS_HASH
-   is not NULL, it will be used in addition to the on-disk cache to find
-   earlier reps with the same content.  When such existing reps can be found,
-   we will truncate the one just written from the file and return the existing
-   rep.  Perform temporary allocations in POOL. */
-#ifdef SVN_FS_FS_DELTIFY_DIRECTORIES
+/* Write the changed path info from transaction TXN_ID in filesystem
+   FS to the permanent rev-file FILE.  *OFFSET_P is set the to offset
+   in the file of the beginning of this information.  Perform
+   temporary allocations in POOL. */
 static svn_error_t *
-write_hash_delta_rep(representation_t *rep,
-                     apr_file_t *file,
-                     apr_hash_t *hash,
-                     svn_fs_t *fs,
-                     node_revision_t *noderev,
-                     apr_hash_t *reps_hash,
-                     apr_pool_t *pool)
+write_final_changed_path_info(apr_off_t *offset_p,
+                              apr_file_t *file,
+                              svn_fs_t *fs,
+                              const char *txn_id,
+                              apr_pool_t *pool)
 {
-  svn_txdelta_window_handler_t diff_wh;
-  void *diff_whb;
-
-  svn_stream_t *file_stream;
-  svn_stream_t *stream;
-  representation_t *base_rep;
-  representation_t *old_rep;
-  svn_stream_t *source;
-  const char *header;
-
-  apr_off_t rep_end = 0;
-  apr_off_t delta_start = 0;
-
-  struct write_hash_baton *whb;
+  apr_hash_t *changed_paths;
+  apr_off_t offset;
+  apr_hash_index_t *hi;
+  apr_pool_t *iterpool = svn_pool_create(pool);
   fs_fs_data_t *ffd = fs->fsap_data;
-  int diff_version = ffd->format >= SVN_FS_FS__MIN_SVNDIFF1_FORMAT ? 1 : 0;
+  svn_boolean_t include_node_kinds =
+      ffd->format >= SVN_FS_FS__MIN_KIND_IN_CHANGED_FORMAT;
 
-  /* Get the base for this delta. */
-  SVN_ERR(choose_delta_base(&base_rep, fs, noderev, pool));
-  SVN_ERR(read_representation(&source, fs, base_rep, pool));
+  SVN_ERR(get_file_offset(&offset, file, pool));
 
-  SVN_ERR(get_file_offset(&rep->offset, file, pool));
+  SVN_ERR(svn_fs_fs__txn_changes_fetch(&changed_paths, fs, txn_id, pool));
 
-  /* Write out the rep header. */
-  if (base_rep)
-    {
-      header = apr_psprintf(pool, REP_DELTA " %ld %" APR_OFF_T_FMT " %"
-                            SVN_FILESIZE_T_FMT "\n",
-                            base_rep->revision, base_rep->offset,
-                            base_rep->size);
-    }
-  else
+  /* Iterate through the changed paths one at a time, and convert the
+     temporary node-id into a permanent one for each change entry. */
+  for (hi = apr_hash_first(pool, changed_paths); hi; hi = apr_hash_next(hi))
     {
-      header = REP_DELTA "\n";
-    }
-  SVN_ERR(svn_io_file_write_full(file, header, strlen(header), NULL,
-                                 pool));
-
-  SVN_ERR(get_file_offset(&delta_start, file, pool));
-  file_stream = svn_stream_from_aprfile2(file, TRUE, pool);
-
-  /* Prepare to write the svndiff data. */
-  svn_txdelta_to_svndiff3(&diff_wh,
-                          &diff_whb,
-                          file_stream,
-                          diff_version,
-                          SVN_DELTA_COMPRESSION_LEVEL_DEFAULT,
-                          pool);
-
-  whb = apr_pcalloc(pool, sizeof(*whb));
-  whb->stream = svn_txdelta_target_push(diff_wh, diff_whb, source, pool);
-  whb->size = 0;
-  whb->md5_ctx = svn_checksum_ctx_create(svn_checksum_md5, pool);
-  whb->sha1_ctx = svn_checksum_ctx_create(svn_checksum_sha1, pool);
+      node_revision_t *noderev;
+      const svn_fs_id_t *id;
+      svn_fs_path_change2_t *change;
+      const char *path;
 
-  /* serialize the hash */
-  stream = svn_stream_create(whb, pool);
-  svn_stream_set_write(stream, write_hash_handler);
+      svn_pool_clear(iterpool);
 
-  SVN_ERR(svn_hash_write2(hash, stream, SVN_HASH_TERMINATOR, pool));
-  SVN_ERR(svn_stream_close(whb->stream));
+      change = svn__apr_hash_index_val(hi);
+      path = svn__apr_hash_index_key(hi);
 
-  /* Store the results. */
-  SVN_ERR(svn_checksum_final(&rep->md5_checksum, whb->md5_ctx, pool));
-  SVN_ERR(svn_checksum_final(&rep->sha1_checksum, whb->sha1_ctx, pool));
+      id = change->node_rev_id;
 
-  /* Check and see if we already have a representation somewhere that's
-     identical to the one we just wrote out. */
-  SVN_ERR(get_shared_rep(&old_rep, fs, rep, reps_hash, pool));
+      /* If this was a delete of a mutable node, then it is OK to
+         leave the change entry pointing to the non-existent temporary
+         node, since it will never be used. */
+      if ((change->change_kind != svn_fs_path_change_delete) &&
+          (! svn_fs_fs__id_txn_id(id)))
+        {
+          SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, id, iterpool));
 
-  if (old_rep)
-    {
-      /* We need to erase from the protorev the data we just wrote. */
-      SVN_ERR(svn_io_file_trunc(file, rep->offset, pool));
+          /* noderev has the permanent node-id at this point, so we just
+             substitute it for the temporary one. */
+          change->node_rev_id = noderev->id;
+        }
 
-      /* Use the old rep for this content. */
-      memcpy(rep, old_rep, sizeof (*rep));
+      /* Write out the new entry into the final rev-file. */
+      SVN_ERR(write_change_entry(file, path, change, include_node_kinds,
+                                 iterpool));
     }
-  else
-    {
-      /* Write out our cosmetic end marker. */
-      SVN_ERR(get_file_offset(&rep_end, file, pool));
-      SVN_ERR(svn_stream_printf(file_stream, pool, "ENDREP\n"));
 
-      /* update the representation */
-      rep->expanded_size = whb->size;
-      rep->size = rep_end - delta_start;
-    }
+  svn_pool_destroy(iterpool);
+
+  *offset_p = offset;
 
   return SVN_NO_ERROR;
 }
-#endif
-
-/* Sanity check ROOT_NODEREV, a candidate for being the root node-revision
-   of (not yet committed) revision REV in FS.  Use POOL for temporary
-   allocations.
 
-   If you change this function, consider updating svn_fs_fs__verify() too.
- */
+/* Atomically update the 'current' file to hold the specifed REV,
+   NEXT_NODE_ID, and NEXT_COPY_ID.  (The two next-ID parameters are
+   ignored and may be NULL if the FS format does not use them.)
+   Perform temporary allocations in POOL. */
 static svn_error_t *
-validate_root_noderev(svn_fs_t *fs,
-                      node_revision_t *root_noderev,
-                      svn_revnum_t rev,
-                      apr_pool_t *pool)
+write_current(svn_fs_t *fs, svn_revnum_t rev, const char *next_node_id,
+              const char *next_copy_id, apr_pool_t *pool)
 {
-  svn_revnum_t head_revnum = rev-1;
-  int head_predecessor_count;
+  char *buf;
+  const char *tmp_name, *name;
+  fs_fs_data_t *ffd = fs->fsap_data;
 
-  SVN_ERR_ASSERT(rev > 0);
+  /* Now we can just write out this line. */
+  if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
+    buf = apr_psprintf(pool, "%ld\n", rev);
+  else
+    buf = apr_psprintf(pool, "%ld %s %s\n", rev, next_node_id, next_copy_id);
 
-  /* Compute HEAD_PREDECESSOR_COUNT. */
-  {
-    svn_fs_root_t *head_revision;
-    const svn_fs_id_t *head_root_id;
-    node_revision_t *head_root_noderev;
+  name = svn_fs_fs__path_current(fs, pool);
+  SVN_ERR(svn_io_write_unique(&tmp_name,
+                              svn_dirent_dirname(name, pool),
+                              buf, strlen(buf),
+                              svn_io_file_del_none, pool));
 
-    /* Get /@HEAD's noderev. */
-    SVN_ERR(svn_fs_fs__revision_root(&head_revision, fs, head_revnum, pool));
-    SVN_ERR(svn_fs_fs__node_id(&head_root_id, head_revision, "/", pool));
-    SVN_ERR(svn_fs_fs__get_node_revision(&head_root_noderev, fs, head_root_id,
-                                         pool));
+  return move_into_place(tmp_name, name, name, pool);
+}
 
-    head_predecessor_count = head_root_noderev->predecessor_count;
-  }
+/* Update the 'current' file to hold the correct next node and copy_ids
+   from transaction TXN_ID in filesystem FS.  The current revision is
+   set to REV.  Perform temporary allocations in POOL. */
+static svn_error_t *
+write_final_current(svn_fs_t *fs,
+                    const char *txn_id,
+                    svn_revnum_t rev,
+                    const char *start_node_id,
+                    const char *start_copy_id,
+                    apr_pool_t *pool)
+{
+  const char *txn_node_id, *txn_copy_id;
+  char new_node_id[MAX_KEY_SIZE + 2];
+  char new_copy_id[MAX_KEY_SIZE + 2];
+  fs_fs_data_t *ffd = fs->fsap_data;
 
-  /* Check that the root noderev's predecessor count equals REV.
+  if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
+    return write_current(fs, rev, NULL, NULL, pool);
 
-     This kind of corruption was seen on svn.apache.org (both on
-     the root noderev and on other fspaths' noderevs); see
-     issue #4129.
+  /* To find the next available ids, we add the id that used to be in
+     the 'current' file, to the next ids from the transaction file. */
+  SVN_ERR(read_next_ids(&txn_node_id, &txn_copy_id, fs, txn_id, pool));
 
-     Normally (rev == root_noderev->predecessor_count), but here we
-     use a more roundabout check that should only trigger on new instances
-     of the corruption, rather then trigger on each and every new commit
-     to a repository that has triggered the bug somewhere in its root
-     noderev's history.
-   */
-  if (root_noderev->predecessor_count != -1
-      && (root_noderev->predecessor_count - head_predecessor_count)
-         != (rev - head_revnum))
-    {
-      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                               _("predecessor count for "
-                                 "the root node-revision is wrong: "
-                                 "found (%d+%ld != %d), committing r%ld"),
-                                 head_predecessor_count,
-                                 rev - head_revnum, /* This is equal to 1. */
-                                 root_noderev->predecessor_count,
-                                 rev);
-    }
+  svn_fs_fs__add_keys(start_node_id, txn_node_id, new_node_id);
+  svn_fs_fs__add_keys(start_copy_id, txn_copy_id, new_copy_id);
 
-  return SVN_NO_ERROR;
+  return write_current(fs, rev, new_node_id, new_copy_id, pool);
 }
 
-/* Copy a node-revision specified by id ID in fileystem FS from a
-   transaction into the proto-rev-file FILE.  Set *NEW_ID_P to a
-   pointer to the new node-id which will be allocated in POOL.
-   If this is a directory, copy all children as well.
-
-   START_NODE_ID and START_COPY_ID are
-   the first available node and copy ids for this filesystem, for older
-   FS formats.
+/* Verify that the user registed with FS has all the locks necessary to
+   permit all the changes associate with TXN_NAME.
+   The FS write lock is assumed to be held by the caller. */
+static svn_error_t *
+verify_locks(svn_fs_t *fs,
+             const char *txn_name,
+             apr_pool_t *pool)
+{
+  apr_pool_t *subpool = svn_pool_create(pool);
+  apr_hash_t *changes;
+  apr_hash_index_t *hi;
+  apr_array_header_t *changed_paths;
+  svn_stringbuf_t *last_recursed = NULL;
+  int i;
 
-   REV is the revision number that this proto-rev-file will represent.
+  /* Fetch the changes for this transaction. */
+  SVN_ERR(svn_fs_fs__txn_changes_fetch(&changes, fs, txn_name, pool));
 
-   INITIAL_OFFSET is the offset of the proto-rev-file on entry to
-   commit_body.
+  /* Make an array of the changed paths, and sort them depth-first-ily.  */
+  changed_paths = apr_array_make(pool, apr_hash_count(changes) + 1,
+                                 sizeof(const char *));
+  for (hi = apr_hash_first(pool, changes); hi; hi = apr_hash_next(hi))
+    APR_ARRAY_PUSH(changed_paths, const char *) = svn__apr_hash_index_key(hi);
+  qsort(changed_paths->elts, changed_paths->nelts,
+        changed_paths->elt_size, svn_sort_compare_paths);
 
-   If REPS_TO_CACHE is not NULL, append to it a copy (allocated in
-   REPS_POOL) of each data rep that is new in this revision.
+  /* Now, traverse the array of changed paths, verify locks.  Note
+     that if we need to do a recursive verification a path, we'll skip
+     over children of that path when we get to them. */
+  for (i = 0; i < changed_paths->nelts; i++)
+    {
+      const char *path;
+      svn_fs_path_change2_t *change;
+      svn_boolean_t recurse = TRUE;
 
-   If REPS_HASH is not NULL, append copies (allocated in REPS_POOL)
-   of the representations of each property rep that is new in this
-   revision.
+      svn_pool_clear(subpool);
+      path = APR_ARRAY_IDX(changed_paths, i, const char *);
 
-   AT_ROOT is true if the node revision being written is the root
-   node-revision.  It is only controls additional sanity checking
-   logic.
+      /* If this path has already been verified as part of a recursive
+         check of one of its parents, no need to do it again.  */
+      if (last_recursed
+          && svn_dirent_is_child(last_recursed->data, path, subpool))
+        continue;
 
-   Temporary allocations are also from POOL. */
-static svn_error_t *
-write_final_rev(const svn_fs_id_t **new_id_p,
-                apr_file_t *file,
-                svn_revnum_t rev,
-                svn_fs_t *fs,
-                const svn_fs_id_t *id,
-                const char *start_node_id,
-                const char *start_copy_id,
-                apr_off_t initial_offset,
-                apr_array_header_t *reps_to_cache,
-                apr_hash_t *reps_hash,
-                apr_pool_t *reps_pool,
-                svn_boolean_t at_root,
-                apr_pool_t *pool)
-{
-  node_revision_t *noderev;
-  apr_off_t my_offset;
-  char my_node_id_buf[MAX_KEY_SIZE + 2];
-  char my_copy_id_buf[MAX_KEY_SIZE + 2];
-  const svn_fs_id_t *new_id;
-  const char *node_id, *copy_id, *my_node_id, *my_copy_id;
-  fs_fs_data_t *ffd = fs->fsap_data;
+      /* Fetch the change associated with our path.  */
+      change = apr_hash_get(changes, path, APR_HASH_KEY_STRING);
 
-  *new_id_p = NULL;
+      /* What does it mean to succeed at lock verification for a given
+         path?  For an existing file or directory getting modified
+         (text, props), it means we hold the lock on the file or
+         directory.  For paths being added or removed, we need to hold
+         the locks for that path and any children of that path.
 
-  /* Check to see if this is a transaction node. */
-  if (! svn_fs_fs__id_txn_id(id))
-    return SVN_NO_ERROR;
+         WHEW!  We have no reliable way to determine the node kind
+         of deleted items, but fortunately we are going to do a
+         recursive check on deleted paths regardless of their kind.  */
+      if (change->change_kind == svn_fs_path_change_modify)
+        recurse = FALSE;
+      SVN_ERR(svn_fs_fs__allow_locked_operation(path, fs, recurse, TRUE,
+                                                subpool));
 
-  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, id, pool));
+      /* If we just did a recursive check, remember the path we
+         checked (so children can be skipped).  */
+      if (recurse)
+        {
+          if (! last_recursed)
+            last_recursed = svn_stringbuf_create(path, pool);
+          else
+            svn_stringbuf_set(last_recursed, path);
+        }
+    }
+  svn_pool_destroy(subpool);
+  return SVN_NO_ERROR;
+}
 
-  if (noderev->kind == svn_node_dir)
-    {
-      apr_pool_t *subpool;
-      apr_hash_t *entries, *str_entries;
-      apr_hash_index_t *hi;
+/* Baton used for commit_body below. */
+struct commit_baton {
+  svn_revnum_t *new_rev_p;
+  svn_fs_t *fs;
+  svn_fs_txn_t *txn;
+  apr_array_header_t *reps_to_cache;
+  apr_hash_t *reps_hash;
+  apr_pool_t *reps_pool;
+};
 
-      /* This is a directory.  Write out all the children first. */
-      subpool = svn_pool_create(pool);
+/* The work-horse for svn_fs_fs__commit, called with the FS write lock.
+   This implements the svn_fs_fs__with_write_lock() 'body' callback
+   type.  BATON is a 'struct commit_baton *'. */
+static svn_error_t *
+commit_body(void *baton, apr_pool_t *pool)
+{
+  struct commit_baton *cb = baton;
+  fs_fs_data_t *ffd = cb->fs->fsap_data;
+  const char *old_rev_filename, *rev_filename, *proto_filename;
+  const char *revprop_filename, *final_revprop;
+  const svn_fs_id_t *root_id, *new_root_id;
+  const char *start_node_id = NULL, *start_copy_id = NULL;
+  svn_revnum_t old_rev, new_rev;
+  apr_file_t *proto_file;
+  void *proto_file_lockcookie;
+  apr_off_t initial_offset, changed_path_offset;
+  char *buf;
+  apr_hash_t *txnprops;
+  apr_array_header_t *txnprop_list;
+  svn_prop_t prop;
+  svn_string_t date;
 
-      SVN_ERR(svn_fs_fs__rep_contents_dir(&entries, fs, noderev, pool));
+  /* Get the current youngest revision. */
+  SVN_ERR(svn_fs_fs__youngest_rev(&old_rev, cb->fs, pool));
 
-      for (hi = apr_hash_first(pool, entries); hi; hi = apr_hash_next(hi))
-        {
-          svn_fs_dirent_t *dirent = svn__apr_hash_index_val(hi);
+  /* Check to make sure this transaction is based off the most recent
+     revision. */
+  if (cb->txn->base_rev != old_rev)
+    return svn_error_create(SVN_ERR_FS_TXN_OUT_OF_DATE, NULL,
+                            _("Transaction out of date"));
 
-          svn_pool_clear(subpool);
-          SVN_ERR(write_final_rev(&new_id, file, rev, fs, dirent->id,
-                                  start_node_id, start_copy_id, initial_offset,
-                                  reps_to_cache, reps_hash, reps_pool, FALSE,
-                                  subpool));
-          if (new_id && (svn_fs_fs__id_rev(new_id) == rev))
-            dirent->id = svn_fs_fs__id_copy(new_id, pool);
-        }
-      svn_pool_destroy(subpool);
+  /* Locks may have been added (or stolen) between the calling of
+     previous svn_fs.h functions and svn_fs_commit_txn(), so we need
+     to re-examine every changed-path in the txn and re-verify all
+     discovered locks. */
+  SVN_ERR(verify_locks(cb->fs, cb->txn->id, pool));
 
-      if (noderev->data_rep && noderev->data_rep->txn_id)
-        {
-          /* Write out the contents of this directory as a text rep. */
-          SVN_ERR(unparse_dir_entries(&str_entries, entries, pool));
+  /* Get the next node_id and copy_id to use. */
+  if (ffd->format < SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
+    SVN_ERR(get_next_revision_ids(&start_node_id, &start_copy_id, cb->fs,
+                                  pool));
 
-          noderev->data_rep->txn_id = NULL;
-          noderev->data_rep->revision = rev;
+  /* We are going to be one better than this puny old revision. */
+  new_rev = old_rev + 1;
 
-#ifdef SVN_FS_FS_DELTIFY_DIRECTORIES
-          SVN_ERR(write_hash_delta_rep(noderev->data_rep, file,
-                                       str_entries, fs, noderev, NULL,
-                                       pool));
-#else
-          SVN_ERR(write_hash_rep(noderev->data_rep, file, str_entries,
-                                 fs, NULL, pool));
-#endif
-        }
-    }
-  else
-    {
-      /* This is a file.  We should make sure the data rep, if it
-         exists in a "this" state, gets rewritten to our new revision
-         num. */
+  /* Get a write handle on the proto revision file. */
+  SVN_ERR(get_writable_proto_rev(&proto_file, &proto_file_lockcookie,
+                                 cb->fs, cb->txn->id, pool));
+  SVN_ERR(get_file_offset(&initial_offset, proto_file, pool));
 
-      if (noderev->data_rep && noderev->data_rep->txn_id)
-        {
-          noderev->data_rep->txn_id = NULL;
-          noderev->data_rep->revision = rev;
+  /* Write out all the node-revisions and directory contents. */
+  root_id = svn_fs_fs__id_txn_create("0", "0", cb->txn->id, pool);
+  SVN_ERR(write_final_rev(&new_root_id, proto_file, new_rev, cb->fs, root_id,
+                          start_node_id, start_copy_id, initial_offset,
+                          cb->reps_to_cache, cb->reps_hash, cb->reps_pool,
+                          TRUE, pool));
 
-          /* See issue 3845.  Some unknown mechanism caused the
-             protorev file to get truncated, so check for that
-             here.  */
-          if (noderev->data_rep->offset + noderev->data_rep->size
-              > initial_offset)
-            return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                    _("Truncated protorev file detected"));
-        }
-    }
+  /* Write the changed-path information. */
+  SVN_ERR(write_final_changed_path_info(&changed_path_offset, proto_file,
+                                        cb->fs, cb->txn->id, pool));
 
-  /* Fix up the property reps. */
-  if (noderev->prop_rep && noderev->prop_rep->txn_id)
-    {
-      apr_hash_t *proplist;
-      SVN_ERR(svn_fs_fs__get_proplist(&proplist, fs, noderev, pool));
+  /* Write the final line. */
+  buf = apr_psprintf(pool, "\n%" APR_OFF_T_FMT " %" APR_OFF_T_FMT "\n",
+                     svn_fs_fs__id_offset(new_root_id),
+                     changed_path_offset);
+  SVN_ERR(svn_io_file_write_full(proto_file, buf, strlen(buf), NULL,
+                                 pool));
+  SVN_ERR(svn_io_file_flush_to_disk(proto_file, pool));
+  SVN_ERR(svn_io_file_close(proto_file, pool));
 
-      noderev->prop_rep->txn_id = NULL;
-      noderev->prop_rep->revision = rev;
+  /* We don't unlock the prototype revision file immediately to avoid a
+     race with another caller writing to the prototype revision file
+     before we commit it. */
 
-#ifdef SVN_FS_FS_DELTIFY_PROPS
-      SVN_ERR(write_hash_delta_rep(noderev->prop_rep, file,
-                                   proplist, fs, noderev, reps_hash,
-                                   pool));
-#else
-      SVN_ERR(write_hash_rep(noderev->prop_rep, file, proplist,
-                             fs, reps_hash, pool));
-#endif
+  /* Remove any temporary txn props representing 'flags'. */
+  SVN_ERR(svn_fs_fs__txn_proplist(&txnprops, cb->txn, pool));
+  txnprop_list = apr_array_make(pool, 3, sizeof(svn_prop_t));
+  prop.value = NULL;
+
+  if (apr_hash_get(txnprops, SVN_FS__PROP_TXN_CHECK_OOD, APR_HASH_KEY_STRING))
+    {
+      prop.name = SVN_FS__PROP_TXN_CHECK_OOD;
+      APR_ARRAY_PUSH(txnprop_list, svn_prop_t) = prop;
     }
 
+  if (apr_hash_get(txnprops, SVN_FS__PROP_TXN_CHECK_LOCKS,
+                   APR_HASH_KEY_STRING))
+    {
+      prop.name = SVN_FS__PROP_TXN_CHECK_LOCKS;
+      APR_ARRAY_PUSH(txnprop_list, svn_prop_t) = prop;
+    }
 
-  /* Convert our temporary ID into a permanent revision one. */
-  SVN_ERR(get_file_offset(&my_offset, file, pool));
+  if (! apr_is_empty_array(txnprop_list))
+    SVN_ERR(svn_fs_fs__change_txn_props(cb->txn, txnprop_list, pool));
 
-  node_id = svn_fs_fs__id_node_id(noderev->id);
-  if (*node_id == '_')
+  /* Create the shard for the rev and revprop file, if we're sharding and
+     this is the first revision of a new shard.  We don't care if this
+     fails because the shard already existed for some reason. */
+  if (ffd->max_files_per_dir && new_rev % ffd->max_files_per_dir == 0)
     {
-      if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
-        my_node_id = apr_psprintf(pool, "%s-%ld", node_id + 1, rev);
-      else
+      /* if (1); null condition for easier merging to revprop-packing */
         {
-          svn_fs_fs__add_keys(start_node_id, node_id + 1, my_node_id_buf);
-          my_node_id = my_node_id_buf;
+          const char *new_dir = path_rev_shard(cb->fs, new_rev, pool);
+          svn_error_t *err = svn_io_dir_make(new_dir, APR_OS_DEFAULT, pool);
+          if (err && !APR_STATUS_IS_EEXIST(err->apr_err))
+            return svn_error_trace(err);
+          svn_error_clear(err);
+          SVN_ERR(svn_io_copy_perms(svn_dirent_join(cb->fs->path,
+                                                    PATH_REVS_DIR,
+                                                    pool),
+                                    new_dir, pool));
         }
-    }
-  else
-    my_node_id = node_id;
 
-  copy_id = svn_fs_fs__id_copy_id(noderev->id);
-  if (*copy_id == '_')
-    {
-      if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
-        my_copy_id = apr_psprintf(pool, "%s-%ld", copy_id + 1, rev);
-      else
+      /* Create the revprops shard. */
+      SVN_ERR_ASSERT(! is_packed_revprop(cb->fs, new_rev));
         {
-          svn_fs_fs__add_keys(start_copy_id, copy_id + 1, my_copy_id_buf);
-          my_copy_id = my_copy_id_buf;
+          const char *new_dir = path_revprops_shard(cb->fs, new_rev, pool);
+          svn_error_t *err = svn_io_dir_make(new_dir, APR_OS_DEFAULT, pool);
+          if (err && !APR_STATUS_IS_EEXIST(err->apr_err))
+            return svn_error_trace(err);
+          svn_error_clear(err);
+          SVN_ERR(svn_io_copy_perms(svn_dirent_join(cb->fs->path,
+                                                    PATH_REVPROPS_DIR,
+                                                    pool),
+                                    new_dir, pool));
         }
     }
-  else
-    my_copy_id = copy_id;
 
-  if (noderev->copyroot_rev == SVN_INVALID_REVNUM)
-    noderev->copyroot_rev = rev;
+  /* Move the finished rev file into place. */
+  SVN_ERR(svn_fs_fs__path_rev_absolute(&old_rev_filename,
+                                       cb->fs, old_rev, pool));
+  rev_filename = path_rev(cb->fs, new_rev, pool);
+  proto_filename = path_txn_proto_rev(cb->fs, cb->txn->id, pool);
+  SVN_ERR(move_into_place(proto_filename, rev_filename, old_rev_filename,
+                          pool));
 
-  new_id = svn_fs_fs__id_rev_create(my_node_id, my_copy_id, rev, my_offset,
-                                    pool);
+  /* Now that we've moved the prototype revision file out of the way,
+     we can unlock it (since further attempts to write to the file
+     will fail as it no longer exists).  We must do this so that we can
+     remove the transaction directory later. */
+  SVN_ERR(unlock_proto_rev(cb->fs, cb->txn->id, proto_file_lockcookie, pool));
 
-  noderev->id = new_id;
+  /* Update commit time to ensure that svn:date revprops remain ordered. */
+  date.data = svn_time_to_cstring(apr_time_now(), pool);
+  date.len = strlen(date.data);
 
-  if (ffd->rep_sharing_allowed)
-    {
-      /* Save the data representation's hash in the rep cache. */
-      if (   noderev->data_rep && noderev->kind == svn_node_file
-          && noderev->data_rep->revision == rev)
-        {
-          SVN_ERR_ASSERT(reps_to_cache && reps_pool);
-          APR_ARRAY_PUSH(reps_to_cache, representation_t *)
-            = svn_fs_fs__rep_copy(noderev->data_rep, reps_pool);
-        }
+  SVN_ERR(svn_fs_fs__change_txn_prop(cb->txn, SVN_PROP_REVISION_DATE,
+                                     &date, pool));
 
-      if (noderev->prop_rep && noderev->prop_rep->revision == rev)
-        {
-          /* Add new property reps to hash and on-disk cache. */
-          representation_t *copy
-            = svn_fs_fs__rep_copy(noderev->prop_rep, reps_pool);
+  /* Move the revprops file into place. */
+  SVN_ERR_ASSERT(! is_packed_revprop(cb->fs, new_rev));
+  revprop_filename = path_txn_props(cb->fs, cb->txn->id, pool);
+  final_revprop = path_revprops(cb->fs, new_rev, pool);
+  SVN_ERR(move_into_place(revprop_filename, final_revprop,
+                          old_rev_filename, pool));
 
-          SVN_ERR_ASSERT(reps_to_cache && reps_pool);
-          APR_ARRAY_PUSH(reps_to_cache, representation_t *) = copy;
+  /* Update the 'current' file. */
+  SVN_ERR(write_final_current(cb->fs, cb->txn->id, new_rev, start_node_id,
+                              start_copy_id, pool));
 
-          apr_hash_set(reps_hash,
-                        copy->sha1_checksum->digest,
-                        APR_SHA1_DIGESTSIZE,
-                        copy);
-        }
-    }
+  /* At this point the new revision is committed and globally visible
+     so let the caller know it succeeded by giving it the new revision
+     number, which fulfills svn_fs_commit_txn() contract.  Any errors
+     after this point do not change the fact that a new revision was
+     created. */
+  *cb->new_rev_p = new_rev;
 
-  /* don't serialize SHA1 for dirs to disk (waste of space) */
-  if (noderev->data_rep && noderev->kind == svn_node_dir)
-    noderev->data_rep->sha1_checksum = NULL;
+  ffd->youngest_rev_cache = new_rev;
 
-  /* don't serialize SHA1 for props to disk (waste of space) */
-  if (noderev->prop_rep)
-    noderev->prop_rep->sha1_checksum = NULL;
+  /* Remove this transaction directory. */
+  SVN_ERR(svn_fs_fs__purge_txn(cb->fs, cb->txn->id, pool));
 
-  /* Write out our new node-revision. */
-  if (at_root)
-    SVN_ERR(validate_root_noderev(fs, noderev, rev, pool));
-  SVN_ERR(svn_fs_fs__write_noderev(svn_stream_from_aprfile2(file, TRUE, pool),
-                                   noderev, ffd->format,
-                                   svn_fs_fs__fs_supports_mergeinfo(fs),
-                                   pool));
+  return SVN_NO_ERROR;
+}
 
-  /* Return our ID that references the revision file. */
-  *new_id_p = noderev->id;
+/* Add the representations in REPS_TO_CACHE (an array of representation_t *)
+ * to the rep-cache database of FS. */
+static svn_error_t *
+write_reps_to_cache(svn_fs_t *fs,
+                    const apr_array_header_t *reps_to_cache,
+                    apr_pool_t *scratch_pool)
+{
+  int i;
+
+  for (i = 0; i < reps_to_cache->nelts; i++)
+    {
+      representation_t *rep = APR_ARRAY_IDX(reps_to_cache, i, representation_t *);
+
+      /* FALSE because we don't care if another parallel commit happened to
+       * collide with us.  (Non-parallel collisions will not be detected.) */
+      SVN_ERR(svn_fs_fs__set_rep_reference(fs, rep, FALSE, scratch_pool));
+    }
 
   return SVN_NO_ERROR;
 }
 
-/* Write the changed path info from transaction TXN_ID in filesystem
-   FS to the permanent rev-file FILE.  *OFFSET_P is set the to offset
-   in the file of the beginning of this information.  Perform
-   temporary allocations in POOL. */
+/* Implements svn_sqlite__transaction_callback_t. */
 static svn_error_t *
-write_final_changed_path_info(apr_off_t *offset_p,
-                              apr_file_t *file,
-                              svn_fs_t *fs,
-                              const char *txn_id,
-                              apr_pool_t *pool)
+commit_sqlite_txn_callback(void *baton, svn_sqlite__db_t *db,
+                           apr_pool_t *scratch_pool)
 {
-  apr_hash_t *changed_paths;
-  apr_off_t offset;
-  apr_hash_index_t *hi;
-  apr_pool_t *iterpool = svn_pool_create(pool);
+  struct commit_baton *cb = baton;
+
+  /* Write new entries to the rep-sharing database.
+   *
+   * We use an sqlite transcation to speed things up;
+   * see <http://www.sqlite.org/faq.html#q19>.
+   */
+  SVN_ERR(write_reps_to_cache(cb->fs, cb->reps_to_cache, scratch_pool));
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_fs_fs__commit(svn_revnum_t *new_rev_p,
+                  svn_fs_t *fs,
+                  svn_fs_txn_t *txn,
+                  apr_pool_t *pool)
+{
+  struct commit_baton cb;
   fs_fs_data_t *ffd = fs->fsap_data;
-  svn_boolean_t include_node_kinds =
-      ffd->format >= SVN_FS_FS__MIN_KIND_IN_CHANGED_FORMAT;
 
-  SVN_ERR(get_file_offset(&offset, file, pool));
+  cb.new_rev_p = new_rev_p;
+  cb.fs = fs;
+  cb.txn = txn;
 
-  SVN_ERR(svn_fs_fs__txn_changes_fetch(&changed_paths, fs, txn_id, pool));
+  if (ffd->rep_sharing_allowed)
+    {
+      cb.reps_to_cache = apr_array_make(pool, 5, sizeof(representation_t *));
+      cb.reps_hash = apr_hash_make(pool);
+      cb.reps_pool = pool;
+    }
+  else
+    {
+      cb.reps_to_cache = NULL;
+      cb.reps_hash = NULL;
+      cb.reps_pool = NULL;
+    }
 
-  /* Iterate through the changed paths one at a time, and convert the
-     temporary node-id into a permanent one for each change entry. */
-  for (hi = apr_hash_first(pool, changed_paths); hi; hi = apr_hash_next(hi))
+  SVN_ERR(svn_fs_fs__with_write_lock(fs, commit_body, &cb, pool));
+
+  /* At this point, *NEW_REV_P has been set, so errors below won't affect
+     the success of the commit.  (See svn_fs_commit_txn().)  */
+
+  if (ffd->rep_sharing_allowed)
     {
-      node_revision_t *noderev;
-      const svn_fs_id_t *id;
-      svn_fs_path_change2_t *change;
-      const char *path;
+      SVN_ERR(svn_fs_fs__open_rep_cache(fs, pool));
+      SVN_ERR(svn_sqlite__with_transaction(ffd->rep_cache_db,
+                                           commit_sqlite_txn_callback,
+                                           &cb, pool));
+    }
 
-      svn_pool_clear(iterpool);
+  return SVN_NO_ERROR;
+}
 
-      change = svn__apr_hash_index_val(hi);
-      path = svn__apr_hash_index_key(hi);
 
-      id = change->node_rev_id;
+svn_error_t *
+svn_fs_fs__reserve_copy_id(const char **copy_id_p,
+                           svn_fs_t *fs,
+                           const char *txn_id,
+                           apr_pool_t *pool)
+{
+  const char *cur_node_id, *cur_copy_id;
+  char *copy_id;
+  apr_size_t len;
 
-      /* If this was a delete of a mutable node, then it is OK to
-         leave the change entry pointing to the non-existent temporary
-         node, since it will never be used. */
-      if ((change->change_kind != svn_fs_path_change_delete) &&
-          (! svn_fs_fs__id_txn_id(id)))
-        {
-          SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, id, iterpool));
+  /* First read in the current next-ids file. */
+  SVN_ERR(read_next_ids(&cur_node_id, &cur_copy_id, fs, txn_id, pool));
 
-          /* noderev has the permanent node-id at this point, so we just
-             substitute it for the temporary one. */
-          change->node_rev_id = noderev->id;
-        }
+  copy_id = apr_pcalloc(pool, strlen(cur_copy_id) + 2);
 
-      /* Write out the new entry into the final rev-file. */
-      SVN_ERR(write_change_entry(file, path, change, include_node_kinds,
-                                 iterpool));
-    }
+  len = strlen(cur_copy_id);
+  svn_fs_fs__next_key(cur_copy_id, &len, copy_id);
 
-  svn_pool_destroy(iterpool);
+  SVN_ERR(write_next_ids(fs, txn_id, cur_node_id, copy_id, pool));
 
-  *offset_p = offset;
+  *copy_id_p = apr_pstrcat(pool, "_", cur_copy_id, (char *)NULL);
 
   return SVN_NO_ERROR;
 }
 
-/* Atomically update the 'current' file to hold the specifed REV,
-   NEXT_NODE_ID, and NEXT_COPY_ID.  (The two next-ID parameters are
-   ignored and may be NULL if the FS format does not use them.)
-   Perform temporary allocations in POOL. */
+/* Write out the zeroth revision for filesystem FS. */
 static svn_error_t *
-write_current(svn_fs_t *fs, svn_revnum_t rev, const char *next_node_id,
-              const char *next_copy_id, apr_pool_t *pool)
+write_revision_zero(svn_fs_t *fs)
 {
-  char *buf;
-  const char *tmp_name, *name;
-  fs_fs_data_t *ffd = fs->fsap_data;
-
-  /* Now we can just write out this line. */
-  if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
-    buf = apr_psprintf(pool, "%ld\n", rev);
-  else
-    buf = apr_psprintf(pool, "%ld %s %s\n", rev, next_node_id, next_copy_id);
+  const char *path_revision_zero = path_rev(fs, 0, fs->pool);
+  apr_hash_t *proplist;
+  svn_string_t date;
 
-  name = svn_fs_fs__path_current(fs, pool);
-  SVN_ERR(svn_io_write_unique(&tmp_name,
-                              svn_dirent_dirname(name, pool),
-                              buf, strlen(buf),
-                              svn_io_file_del_none, pool));
+  /* Write out a rev file for revision 0. */
+  SVN_ERR(svn_io_file_create(path_revision_zero,
+                             "PLAIN\nEND\nENDREP\n"
+                             "id: 0.0.r0/17\n"
+                             "type: dir\n"
+                             "count: 0\n"
+                             "text: 0 0 4 4 "
+                             "2d2977d1c96f487abe4a1e202dd03b4e\n"
+                             "cpath: /\n"
+                             "\n\n17 107\n", fs->pool));
+  SVN_ERR(svn_io_set_file_read_only(path_revision_zero, FALSE, fs->pool));
 
-  return move_into_place(tmp_name, name, name, pool);
+  /* Set a date on revision 0. */
+  date.data = svn_time_to_cstring(apr_time_now(), fs->pool);
+  date.len = strlen(date.data);
+  proplist = apr_hash_make(fs->pool);
+  apr_hash_set(proplist, SVN_PROP_REVISION_DATE, APR_HASH_KEY_STRING, &date);
+  return set_revision_proplist(fs, 0, proplist, fs->pool);
 }
 
-/* Update the 'current' file to hold the correct next node and copy_ids
-   from transaction TXN_ID in filesystem FS.  The current revision is
-   set to REV.  Perform temporary allocations in POOL. */
-static svn_error_t *
-write_final_current(svn_fs_t *fs,
-                    const char *txn_id,
-                    svn_revnum_t rev,
-                    const char *start_node_id,
-                    const char *start_copy_id,
-                    apr_pool_t *pool)
+svn_error_t *
+svn_fs_fs__create(svn_fs_t *fs,
+                  const char *path,
+                  apr_pool_t *pool)
 {
-  const char *txn_node_id, *txn_copy_id;
-  char new_node_id[MAX_KEY_SIZE + 2];
-  char new_copy_id[MAX_KEY_SIZE + 2];
+  int format = SVN_FS_FS__FORMAT_NUMBER;
   fs_fs_data_t *ffd = fs->fsap_data;
 
-  if (ffd->format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
-    return write_current(fs, rev, NULL, NULL, pool);
+  fs->path = apr_pstrdup(pool, path);
+  /* See if compatibility with older versions was explicitly requested. */
+  if (fs->config)
+    {
+      if (apr_hash_get(fs->config, SVN_FS_CONFIG_PRE_1_4_COMPATIBLE,
+                                   APR_HASH_KEY_STRING))
+        format = 1;
+      else if (apr_hash_get(fs->config, SVN_FS_CONFIG_PRE_1_5_COMPATIBLE,
+                                        APR_HASH_KEY_STRING))
+        format = 2;
+      else if (apr_hash_get(fs->config, SVN_FS_CONFIG_PRE_1_6_COMPATIBLE,
+                                        APR_HASH_KEY_STRING))
+        format = 3;
+      else if (apr_hash_get(fs->config, SVN_FS_CONFIG_PRE_1_8_COMPATIBLE,
+                                        APR_HASH_KEY_STRING))
+        format = 4;
+    }
+  ffd->format = format;
 
-  /* To find the next available ids, we add the id that used to be in
-     the 'current' file, to the next ids from the transaction file. */
-  SVN_ERR(read_next_ids(&txn_node_id, &txn_copy_id, fs, txn_id, pool));
+  /* Override the default linear layout if this is a new-enough format. */
+  if (format >= SVN_FS_FS__MIN_LAYOUT_FORMAT_OPTION_FORMAT)
+    ffd->max_files_per_dir = SVN_FS_FS_DEFAULT_MAX_FILES_PER_DIR;
 
-  svn_fs_fs__add_keys(start_node_id, txn_node_id, new_node_id);
-  svn_fs_fs__add_keys(start_copy_id, txn_copy_id, new_copy_id);
+  /* Create the revision data directories. */
+  if (ffd->max_files_per_dir)
+    SVN_ERR(svn_io_make_dir_recursively(path_rev_shard(fs, 0, pool), pool));
+  else
+    SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path, PATH_REVS_DIR,
+                                                        pool),
+                                        pool));
 
-  return write_current(fs, rev, new_node_id, new_copy_id, pool);
+  /* Create the revprops directory. */
+  if (ffd->max_files_per_dir)
+    SVN_ERR(svn_io_make_dir_recursively(path_revprops_shard(fs, 0, pool),
+                                        pool));
+  else
+    SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path,
+                                                        PATH_REVPROPS_DIR,
+                                                        pool),
+                                        pool));
+
+  /* Create the transaction directory. */
+  SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path, PATH_TXNS_DIR,
+                                                      pool),
+                                      pool));
+
+  /* Create the protorevs directory. */
+  if (format >= SVN_FS_FS__MIN_PROTOREVS_DIR_FORMAT)
+    SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path, PATH_TXN_PROTOS_DIR,
+                                                      pool),
+                                        pool));
+
+  /* Create the 'current' file. */
+  SVN_ERR(svn_io_file_create(svn_fs_fs__path_current(fs, pool),
+                             (format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT
+                              ? "0\n" : "0 1 1\n"),
+                             pool));
+  SVN_ERR(svn_io_file_create(path_lock(fs, pool), "", pool));
+  SVN_ERR(svn_fs_fs__set_uuid(fs, NULL, pool));
+
+  SVN_ERR(write_revision_zero(fs));
+
+  SVN_ERR(write_config(fs, pool));
+
+  SVN_ERR(read_config(fs, pool));
+
+  /* Create the min unpacked rev file. */
+  if (ffd->format >= SVN_FS_FS__MIN_PACKED_FORMAT)
+    SVN_ERR(svn_io_file_create(path_min_unpacked_rev(fs, pool), "0\n", pool));
+
+  /* Create the revprop generation file. */
+  if (ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+    SVN_ERR(svn_io_file_create(path_revprop_generation(fs, pool), "0\n",
+                               pool));
+
+  /* Create the txn-current file if the repository supports
+     the transaction sequence file. */
+  if (format >= SVN_FS_FS__MIN_TXN_CURRENT_FORMAT)
+    {
+      SVN_ERR(svn_io_file_create(path_txn_current(fs, pool),
+                                 "0\n", pool));
+      SVN_ERR(svn_io_file_create(path_txn_current_lock(fs, pool),
+                                 "", pool));
+    }
+
+  /* This filesystem is ready.  Stamp it with a format number. */
+  SVN_ERR(write_format(path_format(fs, pool),
+                       ffd->format, ffd->max_files_per_dir, FALSE, pool));
+
+  ffd->youngest_rev_cache = 0;
+  return SVN_NO_ERROR;
 }
 
-/* Verify that the user registed with FS has all the locks necessary to
-   permit all the changes associate with TXN_NAME.
-   The FS write lock is assumed to be held by the caller. */
+/* Part of the recovery procedure.  Return the largest revision *REV in
+   filesystem FS.  Use POOL for temporary allocation. */
 static svn_error_t *
-verify_locks(svn_fs_t *fs,
-             const char *txn_name,
-             apr_pool_t *pool)
+recover_get_largest_revision(svn_fs_t *fs, svn_revnum_t *rev, apr_pool_t *pool)
 {
-  apr_pool_t *subpool = svn_pool_create(pool);
-  apr_hash_t *changes;
-  apr_hash_index_t *hi;
-  apr_array_header_t *changed_paths;
-  svn_stringbuf_t *last_recursed = NULL;
-  int i;
-
-  /* Fetch the changes for this transaction. */
-  SVN_ERR(svn_fs_fs__txn_changes_fetch(&changes, fs, txn_name, pool));
-
-  /* Make an array of the changed paths, and sort them depth-first-ily.  */
-  changed_paths = apr_array_make(pool, apr_hash_count(changes) + 1,
-                                 sizeof(const char *));
-  for (hi = apr_hash_first(pool, changes); hi; hi = apr_hash_next(hi))
-    APR_ARRAY_PUSH(changed_paths, const char *) = svn__apr_hash_index_key(hi);
-  qsort(changed_paths->elts, changed_paths->nelts,
-        changed_paths->elt_size, svn_sort_compare_paths);
+  /* Discovering the largest revision in the filesystem would be an
+     expensive operation if we did a readdir() or searched linearly,
+     so we'll do a form of binary search.  left is a revision that we
+     know exists, right a revision that we know does not exist. */
+  apr_pool_t *iterpool;
+  svn_revnum_t left, right = 1;
 
-  /* Now, traverse the array of changed paths, verify locks.  Note
-     that if we need to do a recursive verification a path, we'll skip
-     over children of that path when we get to them. */
-  for (i = 0; i < changed_paths->nelts; i++)
+  iterpool = svn_pool_create(pool);
+  /* Keep doubling right, until we find a revision that doesn't exist. */
+  while (1)
     {
-      const char *path;
-      svn_fs_path_change2_t *change;
-      svn_boolean_t recurse = TRUE;
+      svn_error_t *err;
+      apr_file_t *file;
 
-      svn_pool_clear(subpool);
-      path = APR_ARRAY_IDX(changed_paths, i, const char *);
+      err = open_pack_or_rev_file(&file, fs, right, iterpool);
+      svn_pool_clear(iterpool);
 
-      /* If this path has already been verified as part of a recursive
-         check of one of its parents, no need to do it again.  */
-      if (last_recursed
-          && svn_dirent_is_child(last_recursed->data, path, subpool))
-        continue;
+      if (err && err->apr_err == SVN_ERR_FS_NO_SUCH_REVISION)
+        {
+          svn_error_clear(err);
+          break;
+        }
+      else
+        SVN_ERR(err);
 
-      /* Fetch the change associated with our path.  */
-      change = apr_hash_get(changes, path, APR_HASH_KEY_STRING);
+      right <<= 1;
+    }
 
-      /* What does it mean to succeed at lock verification for a given
-         path?  For an existing file or directory getting modified
-         (text, props), it means we hold the lock on the file or
-         directory.  For paths being added or removed, we need to hold
-         the locks for that path and any children of that path.
+  left = right >> 1;
 
-         WHEW!  We have no reliable way to determine the node kind
-         of deleted items, but fortunately we are going to do a
-         recursive check on deleted paths regardless of their kind.  */
-      if (change->change_kind == svn_fs_path_change_modify)
-        recurse = FALSE;
-      SVN_ERR(svn_fs_fs__allow_locked_operation(path, fs, recurse, TRUE,
-                                                subpool));
+  /* We know that left exists and right doesn't.  Do a normal bsearch to find
+     the last revision. */
+  while (left + 1 < right)
+    {
+      svn_revnum_t probe = left + ((right - left) / 2);
+      svn_error_t *err;
+      apr_file_t *file;
 
-      /* If we just did a recursive check, remember the path we
-         checked (so children can be skipped).  */
-      if (recurse)
+      err = open_pack_or_rev_file(&file, fs, probe, iterpool);
+      svn_pool_clear(iterpool);
+
+      if (err && err->apr_err == SVN_ERR_FS_NO_SUCH_REVISION)
         {
-          if (! last_recursed)
-            last_recursed = svn_stringbuf_create(path, pool);
-          else
-            svn_stringbuf_set(last_recursed, path);
+          svn_error_clear(err);
+          right = probe;
+        }
+      else
+        {
+          SVN_ERR(err);
+          left = probe;
         }
     }
-  svn_pool_destroy(subpool);
+
+  svn_pool_destroy(iterpool);
+
+  /* left is now the largest revision that exists. */
+  *rev = left;
   return SVN_NO_ERROR;
 }
 
-/* Baton used for commit_body below. */
-struct commit_baton {
-  svn_revnum_t *new_rev_p;
-  svn_fs_t *fs;
-  svn_fs_txn_t *txn;
-  apr_array_header_t *reps_to_cache;
-  apr_hash_t *reps_hash;
-  apr_pool_t *reps_pool;
+/* A baton for reading a fixed amount from an open file.  For
+   recover_find_max_ids() below. */
+struct recover_read_from_file_baton
+{
+  apr_file_t *file;
+  apr_pool_t *pool;
+  apr_off_t remaining;
 };
 
-/* The work-horse for svn_fs_fs__commit, called with the FS write lock.
-   This implements the svn_fs_fs__with_write_lock() 'body' callback
-   type.  BATON is a 'struct commit_baton *'. */
+/* A stream read handler used by recover_find_max_ids() below.
+   Read and return at most BATON->REMAINING bytes from the stream,
+   returning nothing after that to indicate EOF. */
 static svn_error_t *
-commit_body(void *baton, apr_pool_t *pool)
+read_handler_recover(void *baton, char *buffer, apr_size_t *len)
 {
-  struct commit_baton *cb = baton;
-  fs_fs_data_t *ffd = cb->fs->fsap_data;
-  const char *old_rev_filename, *rev_filename, *proto_filename;
-  const char *revprop_filename, *final_revprop;
-  const svn_fs_id_t *root_id, *new_root_id;
-  const char *start_node_id = NULL, *start_copy_id = NULL;
-  svn_revnum_t old_rev, new_rev;
-  apr_file_t *proto_file;
-  void *proto_file_lockcookie;
-  apr_off_t initial_offset, changed_path_offset;
-  char *buf;
-  apr_hash_t *txnprops;
-  apr_array_header_t *txnprop_list;
-  svn_prop_t prop;
-  svn_string_t date;
+  struct recover_read_from_file_baton *b = baton;
+  svn_filesize_t bytes_to_read = *len;
 
-  /* Get the current youngest revision. */
-  SVN_ERR(svn_fs_fs__youngest_rev(&old_rev, cb->fs, pool));
+  if (b->remaining == 0)
+    {
+      /* Return a successful read of zero bytes to signal EOF. */
+      *len = 0;
+      return SVN_NO_ERROR;
+    }
 
-  /* Check to make sure this transaction is based off the most recent
-     revision. */
-  if (cb->txn->base_rev != old_rev)
-    return svn_error_create(SVN_ERR_FS_TXN_OUT_OF_DATE, NULL,
-                            _("Transaction out of date"));
+  if (bytes_to_read > b->remaining)
+    bytes_to_read = b->remaining;
+  b->remaining -= bytes_to_read;
 
-  /* Locks may have been added (or stolen) between the calling of
-     previous svn_fs.h functions and svn_fs_commit_txn(), so we need
-     to re-examine every changed-path in the txn and re-verify all
-     discovered locks. */
-  SVN_ERR(verify_locks(cb->fs, cb->txn->id, pool));
+  return svn_io_file_read_full2(b->file, buffer, (apr_size_t) bytes_to_read,
+                                len, NULL, b->pool);
+}
 
-  /* Get the next node_id and copy_id to use. */
-  if (ffd->format < SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
-    SVN_ERR(get_next_revision_ids(&start_node_id, &start_copy_id, cb->fs,
-                                  pool));
+/* Part of the recovery procedure.  Read the directory noderev at offset
+   OFFSET of file REV_FILE (the revision file of revision REV of
+   filesystem FS), and set MAX_NODE_ID and MAX_COPY_ID to be the node-id
+   and copy-id of that node, if greater than the current value stored
+   in either.  Recurse into any child directories that were modified in
+   this revision.
 
-  /* We are going to be one better than this puny old revision. */
-  new_rev = old_rev + 1;
+   MAX_NODE_ID and MAX_COPY_ID must be arrays of at least MAX_KEY_SIZE.
 
-  /* Get a write handle on the proto revision file. */
-  SVN_ERR(get_writable_proto_rev(&proto_file, &proto_file_lockcookie,
-                                 cb->fs, cb->txn->id, pool));
-  SVN_ERR(get_file_offset(&initial_offset, proto_file, pool));
+   Perform temporary allocation in POOL. */
+static svn_error_t *
+recover_find_max_ids(svn_fs_t *fs, svn_revnum_t rev,
+                     apr_file_t *rev_file, apr_off_t offset,
+                     char *max_node_id, char *max_copy_id,
+                     apr_pool_t *pool)
+{
+  apr_hash_t *headers;
+  char *value;
+  representation_t *data_rep;
+  struct rep_args *ra;
+  struct recover_read_from_file_baton baton;
+  svn_stream_t *stream;
+  apr_hash_t *entries;
+  apr_hash_index_t *hi;
+  apr_pool_t *iterpool;
 
-  /* Write out all the node-revisions and directory contents. */
-  root_id = svn_fs_fs__id_txn_create("0", "0", cb->txn->id, pool);
-  SVN_ERR(write_final_rev(&new_root_id, proto_file, new_rev, cb->fs, root_id,
-                          start_node_id, start_copy_id, initial_offset,
-                          cb->reps_to_cache, cb->reps_hash, cb->reps_pool,
-                          TRUE, pool));
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
+  SVN_ERR(read_header_block(&headers, svn_stream_from_aprfile2(rev_file, TRUE,
+                                                               pool),
+                            pool));
 
-  /* Write the changed-path information. */
-  SVN_ERR(write_final_changed_path_info(&changed_path_offset, proto_file,
-                                        cb->fs, cb->txn->id, pool));
+  /* Check that this is a directory.  It should be. */
+  value = apr_hash_get(headers, HEADER_TYPE, APR_HASH_KEY_STRING);
+  if (value == NULL || strcmp(value, KIND_DIR) != 0)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Recovery encountered a non-directory node"));
 
-  /* Write the final line. */
-  buf = apr_psprintf(pool, "\n%" APR_OFF_T_FMT " %" APR_OFF_T_FMT "\n",
-                     svn_fs_fs__id_offset(new_root_id),
-                     changed_path_offset);
-  SVN_ERR(svn_io_file_write_full(proto_file, buf, strlen(buf), NULL,
-                                 pool));
-  SVN_ERR(svn_io_file_flush_to_disk(proto_file, pool));
-  SVN_ERR(svn_io_file_close(proto_file, pool));
+  /* Get the data location.  No data location indicates an empty directory. */
+  value = apr_hash_get(headers, HEADER_TEXT, APR_HASH_KEY_STRING);
+  if (!value)
+    return SVN_NO_ERROR;
+  SVN_ERR(read_rep_offsets(&data_rep, value, NULL, FALSE, pool));
 
-  /* We don't unlock the prototype revision file immediately to avoid a
-     race with another caller writing to the prototype revision file
-     before we commit it. */
+  /* If the directory's data representation wasn't changed in this revision,
+     we've already scanned the directory's contents for noderevs, so we don't
+     need to again.  This will occur if a property is changed on a directory
+     without changing the directory's contents. */
+  if (data_rep->revision != rev)
+    return SVN_NO_ERROR;
 
-  /* Remove any temporary txn props representing 'flags'. */
-  SVN_ERR(svn_fs_fs__txn_proplist(&txnprops, cb->txn, pool));
-  txnprop_list = apr_array_make(pool, 3, sizeof(svn_prop_t));
-  prop.value = NULL;
+  /* We could use get_dir_contents(), but this is much cheaper.  It does
+     rely on directory entries being stored as PLAIN reps, though. */
+  offset = data_rep->offset;
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
+  SVN_ERR(read_rep_line(&ra, rev_file, pool));
+  if (ra->is_delta)
+    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                            _("Recovery encountered a deltified directory "
+                              "representation"));
 
-  if (apr_hash_get(txnprops, SVN_FS__PROP_TXN_CHECK_OOD, APR_HASH_KEY_STRING))
-    {
-      prop.name = SVN_FS__PROP_TXN_CHECK_OOD;
-      APR_ARRAY_PUSH(txnprop_list, svn_prop_t) = prop;
-    }
+  /* Now create a stream that's allowed to read only as much data as is
+     stored in the representation. */
+  baton.file = rev_file;
+  baton.pool = pool;
+  baton.remaining = data_rep->expanded_size;
+  stream = svn_stream_create(&baton, pool);
+  svn_stream_set_read(stream, read_handler_recover);
 
-  if (apr_hash_get(txnprops, SVN_FS__PROP_TXN_CHECK_LOCKS,
-                   APR_HASH_KEY_STRING))
+  /* Now read the entries from that stream. */
+  entries = apr_hash_make(pool);
+  SVN_ERR(svn_hash_read2(entries, stream, SVN_HASH_TERMINATOR, pool));
+  SVN_ERR(svn_stream_close(stream));
+
+  /* Now check each of the entries in our directory to find new node and
+     copy ids, and recurse into new subdirectories. */
+  iterpool = svn_pool_create(pool);
+  for (hi = apr_hash_first(pool, entries); hi; hi = apr_hash_next(hi))
     {
-      prop.name = SVN_FS__PROP_TXN_CHECK_LOCKS;
-      APR_ARRAY_PUSH(txnprop_list, svn_prop_t) = prop;
-    }
+      char *str_val;
+      char *str;
+      svn_node_kind_t kind;
+      svn_fs_id_t *id;
+      const char *node_id, *copy_id;
+      apr_off_t child_dir_offset;
+      const svn_string_t *path = svn__apr_hash_index_val(hi);
 
-  if (! apr_is_empty_array(txnprop_list))
-    SVN_ERR(svn_fs_fs__change_txn_props(cb->txn, txnprop_list, pool));
+      svn_pool_clear(iterpool);
 
-  /* Create the shard for the rev and revprop file, if we're sharding and
-     this is the first revision of a new shard.  We don't care if this
-     fails because the shard already existed for some reason. */
-  if (ffd->max_files_per_dir && new_rev % ffd->max_files_per_dir == 0)
-    {
-      /* if (1); null condition for easier merging to revprop-packing */
+      str_val = apr_pstrdup(iterpool, path->data);
+
+      str = svn_cstring_tokenize(" ", &str_val);
+      if (str == NULL)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Directory entry corrupt"));
+
+      if (strcmp(str, KIND_FILE) == 0)
+        kind = svn_node_file;
+      else if (strcmp(str, KIND_DIR) == 0)
+        kind = svn_node_dir;
+      else
         {
-          const char *new_dir = path_rev_shard(cb->fs, new_rev, pool);
-          svn_error_t *err = svn_io_dir_make(new_dir, APR_OS_DEFAULT, pool);
-          if (err && !APR_STATUS_IS_EEXIST(err->apr_err))
-            return svn_error_trace(err);
-          svn_error_clear(err);
-          SVN_ERR(svn_io_copy_perms(svn_dirent_join(cb->fs->path,
-                                                    PATH_REVS_DIR,
-                                                    pool),
-                                    new_dir, pool));
+          return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                  _("Directory entry corrupt"));
+        }
+
+      str = svn_cstring_tokenize(" ", &str_val);
+      if (str == NULL)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Directory entry corrupt"));
+
+      id = svn_fs_fs__id_parse(str, strlen(str), iterpool);
+
+      if (svn_fs_fs__id_rev(id) != rev)
+        {
+          /* If the node wasn't modified in this revision, we've already
+             checked the node and copy id. */
+          continue;
+        }
+
+      node_id = svn_fs_fs__id_node_id(id);
+      copy_id = svn_fs_fs__id_copy_id(id);
+
+      if (svn_fs_fs__key_compare(node_id, max_node_id) > 0)
+        {
+          SVN_ERR_ASSERT(strlen(node_id) < MAX_KEY_SIZE);
+          apr_cpystrn(max_node_id, node_id, MAX_KEY_SIZE);
         }
-
-      /* Create the revprops shard. */
-      SVN_ERR_ASSERT(! is_packed_revprop(cb->fs, new_rev));
+      if (svn_fs_fs__key_compare(copy_id, max_copy_id) > 0)
         {
-          const char *new_dir = path_revprops_shard(cb->fs, new_rev, pool);
-          svn_error_t *err = svn_io_dir_make(new_dir, APR_OS_DEFAULT, pool);
-          if (err && !APR_STATUS_IS_EEXIST(err->apr_err))
-            return svn_error_trace(err);
-          svn_error_clear(err);
-          SVN_ERR(svn_io_copy_perms(svn_dirent_join(cb->fs->path,
-                                                    PATH_REVPROPS_DIR,
-                                                    pool),
-                                    new_dir, pool));
+          SVN_ERR_ASSERT(strlen(copy_id) < MAX_KEY_SIZE);
+          apr_cpystrn(max_copy_id, copy_id, MAX_KEY_SIZE);
         }
-    }
 
-  /* Move the finished rev file into place. */
-  SVN_ERR(svn_fs_fs__path_rev_absolute(&old_rev_filename,
-                                       cb->fs, old_rev, pool));
-  rev_filename = path_rev(cb->fs, new_rev, pool);
-  proto_filename = path_txn_proto_rev(cb->fs, cb->txn->id, pool);
-  SVN_ERR(move_into_place(proto_filename, rev_filename, old_rev_filename,
-                          pool));
+      if (kind == svn_node_file)
+        continue;
 
-  /* Now that we've moved the prototype revision file out of the way,
-     we can unlock it (since further attempts to write to the file
-     will fail as it no longer exists).  We must do this so that we can
-     remove the transaction directory later. */
-  SVN_ERR(unlock_proto_rev(cb->fs, cb->txn->id, proto_file_lockcookie, pool));
+      child_dir_offset = svn_fs_fs__id_offset(id);
+      SVN_ERR(recover_find_max_ids(fs, rev, rev_file, child_dir_offset,
+                                   max_node_id, max_copy_id, iterpool));
+    }
+  svn_pool_destroy(iterpool);
 
-  /* Update commit time to ensure that svn:date revprops remain ordered. */
-  date.data = svn_time_to_cstring(apr_time_now(), pool);
-  date.len = strlen(date.data);
+  return SVN_NO_ERROR;
+}
 
-  SVN_ERR(svn_fs_fs__change_txn_prop(cb->txn, SVN_PROP_REVISION_DATE,
-                                     &date, pool));
+/* Baton used for recover_body below. */
+struct recover_baton {
+  svn_fs_t *fs;
+  svn_cancel_func_t cancel_func;
+  void *cancel_baton;
+};
 
-  /* Move the revprops file into place. */
-  SVN_ERR_ASSERT(! is_packed_revprop(cb->fs, new_rev));
-  revprop_filename = path_txn_props(cb->fs, cb->txn->id, pool);
-  final_revprop = path_revprops(cb->fs, new_rev, pool);
-  SVN_ERR(move_into_place(revprop_filename, final_revprop,
-                          old_rev_filename, pool));
+/* The work-horse for svn_fs_fs__recover, called with the FS
+   write lock.  This implements the svn_fs_fs__with_write_lock()
+   'body' callback type.  BATON is a 'struct recover_baton *'. */
+static svn_error_t *
+recover_body(void *baton, apr_pool_t *pool)
+{
+  struct recover_baton *b = baton;
+  svn_fs_t *fs = b->fs;
+  fs_fs_data_t *ffd = fs->fsap_data;
+  svn_revnum_t max_rev;
+  char next_node_id_buf[MAX_KEY_SIZE], next_copy_id_buf[MAX_KEY_SIZE];
+  char *next_node_id = NULL, *next_copy_id = NULL;
+  svn_revnum_t youngest_rev;
+  svn_node_kind_t youngest_revprops_kind;
 
-  /* Update the 'current' file. */
-  SVN_ERR(write_final_current(cb->fs, cb->txn->id, new_rev, start_node_id,
-                              start_copy_id, pool));
+  /* First, we need to know the largest revision in the filesystem. */
+  SVN_ERR(recover_get_largest_revision(fs, &max_rev, pool));
 
-  /* At this point the new revision is committed and globally visible
-     so let the caller know it succeeded by giving it the new revision
-     number, which fulfills svn_fs_commit_txn() contract.  Any errors
-     after this point do not change the fact that a new revision was
-     created. */
-  *cb->new_rev_p = new_rev;
+  /* Get the expected youngest revision */
+  SVN_ERR(get_youngest(&youngest_rev, fs->path, pool));
 
-  ffd->youngest_rev_cache = new_rev;
+  /* Policy note:
 
-  /* Remove this transaction directory. */
-  SVN_ERR(svn_fs_fs__purge_txn(cb->fs, cb->txn->id, pool));
+     Since the revprops file is written after the revs file, the true
+     maximum available revision is the youngest one for which both are
+     present.  That's probably the same as the max_rev we just found,
+     but if it's not, we could, in theory, repeatedly decrement
+     max_rev until we find a revision that has both a revs and
+     revprops file, then write db/current with that.
 
-  return SVN_NO_ERROR;
-}
+     But we choose not to.  If a repository is so corrupt that it's
+     missing at least one revprops file, we shouldn't assume that the
+     youngest revision for which both the revs and revprops files are
+     present is healthy.  In other words, we're willing to recover
+     from a missing or out-of-date db/current file, because db/current
+     is truly redundant -- it's basically a cache so we don't have to
+     find max_rev each time, albeit a cache with unusual semantics,
+     since it also officially defines when a revision goes live.  But
+     if we're missing more than the cache, it's time to back out and
+     let the admin reconstruct things by hand: correctness at that
+     point may depend on external things like checking a commit email
+     list, looking in particular working copies, etc.
 
-/* Add the representations in REPS_TO_CACHE (an array of representation_t *)
- * to the rep-cache database of FS. */
-static svn_error_t *
-write_reps_to_cache(svn_fs_t *fs,
-                    const apr_array_header_t *reps_to_cache,
-                    apr_pool_t *scratch_pool)
-{
-  int i;
+     This policy matches well with a typical naive backup scenario.
+     Say you're rsyncing your FSFS repository nightly to the same
+     location.  Once revs and revprops are written, you've got the
+     maximum rev; if the backup should bomb before db/current is
+     written, then db/current could stay arbitrarily out-of-date, but
+     we can still recover.  It's a small window, but we might as well
+     do what we can. */
 
-  for (i = 0; i < reps_to_cache->nelts; i++)
+  /* Even if db/current were missing, it would be created with 0 by
+     get_youngest(), so this conditional remains valid. */
+  if (youngest_rev > max_rev)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Expected current rev to be <= %ld "
+                               "but found %ld"), max_rev, youngest_rev);
+
+  /* We only need to search for maximum IDs for old FS formats which
+     se global ID counters. */
+  if (ffd->format < SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
     {
-      representation_t *rep = APR_ARRAY_IDX(reps_to_cache, i, representation_t *);
+      /* Next we need to find the maximum node id and copy id in use across the
+         filesystem.  Unfortunately, the only way we can get this information
+         is to scan all the noderevs of all the revisions and keep track as
+         we go along. */
+      svn_revnum_t rev;
+      apr_pool_t *iterpool = svn_pool_create(pool);
+      char max_node_id[MAX_KEY_SIZE] = "0", max_copy_id[MAX_KEY_SIZE] = "0";
+      apr_size_t len;
 
-      /* FALSE because we don't care if another parallel commit happened to
-       * collide with us.  (Non-parallel collisions will not be detected.) */
-      SVN_ERR(svn_fs_fs__set_rep_reference(fs, rep, FALSE, scratch_pool));
-    }
+      for (rev = 0; rev <= max_rev; rev++)
+        {
+          apr_file_t *rev_file;
+          apr_off_t root_offset;
 
-  return SVN_NO_ERROR;
-}
+          svn_pool_clear(iterpool);
 
-/* Implements svn_sqlite__transaction_callback_t. */
-static svn_error_t *
-commit_sqlite_txn_callback(void *baton, svn_sqlite__db_t *db,
-                           apr_pool_t *scratch_pool)
-{
-  struct commit_baton *cb = baton;
+          if (b->cancel_func)
+            SVN_ERR(b->cancel_func(b->cancel_baton));
 
-  /* Write new entries to the rep-sharing database.
-   *
-   * We use an sqlite transcation to speed things up;
-   * see <http://www.sqlite.org/faq.html#q19>.
-   */
-  SVN_ERR(write_reps_to_cache(cb->fs, cb->reps_to_cache, scratch_pool));
+          SVN_ERR(open_pack_or_rev_file(&rev_file, fs, rev, iterpool));
+          SVN_ERR(get_root_changes_offset(&root_offset, NULL, rev_file, fs, rev,
+                                          iterpool));
+          SVN_ERR(recover_find_max_ids(fs, rev, rev_file, root_offset,
+                                       max_node_id, max_copy_id, iterpool));
+          SVN_ERR(svn_io_file_close(rev_file, iterpool));
+        }
+      svn_pool_destroy(iterpool);
 
-  return SVN_NO_ERROR;
-}
+      /* Now that we finally have the maximum revision, node-id and copy-id, we
+         can bump the two ids to get the next of each. */
+      len = strlen(max_node_id);
+      svn_fs_fs__next_key(max_node_id, &len, next_node_id_buf);
+      next_node_id = next_node_id_buf;
+      len = strlen(max_copy_id);
+      svn_fs_fs__next_key(max_copy_id, &len, next_copy_id_buf);
+      next_copy_id = next_copy_id_buf;
+    }
 
-svn_error_t *
-svn_fs_fs__commit(svn_revnum_t *new_rev_p,
-                  svn_fs_t *fs,
-                  svn_fs_txn_t *txn,
-                  apr_pool_t *pool)
-{
-  struct commit_baton cb;
-  fs_fs_data_t *ffd = fs->fsap_data;
+  /* Before setting current, verify that there is a revprops file
+     for the youngest revision.  (Issue #2992) */
+  SVN_ERR(svn_io_check_path(path_revprops(fs, max_rev, pool),
+                            &youngest_revprops_kind, pool));
+  if (youngest_revprops_kind == svn_node_none)
+    {
+      svn_boolean_t missing = TRUE;
 
-  cb.new_rev_p = new_rev_p;
-  cb.fs = fs;
-  cb.txn = txn;
+      /* The youngest revision may be part of a packed shard. */
+      if (is_packed_revprop(fs, max_rev))
+        {
+          const char *pack_file;
+          svn_error_t *err = get_revprop_pack_file(&pack_file, fs, max_rev,
+                                                   pool);
+          if (err)
+            svn_error_clear(err);
+          else
+            {
+              svn_node_kind_t kind;
 
-  if (ffd->rep_sharing_allowed)
-    {
-      cb.reps_to_cache = apr_array_make(pool, 5, sizeof(representation_t *));
-      cb.reps_hash = apr_hash_make(pool);
-      cb.reps_pool = pool;
+              SVN_ERR(svn_io_check_path(pack_file, &kind, pool));
+              missing = kind != svn_node_file;
+            }
+        }
+
+      if (missing)
+        return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                                 _("Revision %ld has a revs file but no "
+                                   "revprops file"),
+                                 max_rev);
     }
-  else
+  else if (youngest_revprops_kind != svn_node_file)
     {
-      cb.reps_to_cache = NULL;
-      cb.reps_hash = NULL;
-      cb.reps_pool = NULL;
+      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                               _("Revision %ld has a non-file where its "
+                                 "revprops file should be"),
+                               max_rev);
     }
 
-  SVN_ERR(svn_fs_fs__with_write_lock(fs, commit_body, &cb, pool));
-
-  /* At this point, *NEW_REV_P has been set, so errors below won't affect
-     the success of the commit.  (See svn_fs_commit_txn().)  */
+  /* Prune younger-than-(newfound-youngest) revisions from the rep cache. */
+  if (ffd->format >= SVN_FS_FS__MIN_REP_SHARING_FORMAT)
+    SVN_ERR(svn_fs_fs__del_rep_reference(fs, max_rev, pool));
 
-  if (ffd->rep_sharing_allowed)
+  /* An interrupted revprop change leaves an odd revprop generation behind,
+     which would disable revprop caching.  Complete that change. */
+  if (ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
     {
-      SVN_ERR(svn_fs_fs__open_rep_cache(fs, pool));
-      SVN_ERR(svn_sqlite__with_transaction(ffd->rep_cache_db,
-                                           commit_sqlite_txn_callback,
-                                           &cb, pool));
+      apr_int64_t generation;
+
+      SVN_ERR(read_revprop_generation(&generation, fs, pool));
+      if (generation % 2)
+        SVN_ERR(end_revprop_change(fs, generation, pool));
     }
 
+  /* Now store the discovered youngest revision, and the next IDs if
+     relevant, in a new 'current' file. */
+  return write_current(fs, max_rev, next_node_id, next_copy_id, pool);
+}
+
+/* This implements the fs_library_vtable_t.recover() API. */
+svn_error_t *
+svn_fs_fs__recover(svn_fs_t *fs,
+                   svn_cancel_func_t cancel_func, void *cancel_baton,
+                   apr_pool_t *pool)
+{
+  struct recover_baton b;
+
+  /* We have no way to take out an exclusive lock in FSFS, so we're
+     restricted as to the types of recovery we can do.  Luckily,
+     we just want to recreate the 'current' file, and we can do that just
+     by blocking other writers. */
+  b.fs = fs;
+  b.cancel_func = cancel_func;
+  b.cancel_baton = cancel_baton;
+  return svn_fs_fs__with_write_lock(fs, recover_body, &b, pool);
+}
+
+svn_error_t *
+svn_fs_fs__get_uuid(svn_fs_t *fs,
+                    const char **uuid_p,
+                    apr_pool_t *pool)
+{
+  fs_fs_data_t *ffd = fs->fsap_data;
+
+  *uuid_p = apr_pstrdup(pool, ffd->uuid);
   return SVN_NO_ERROR;
 }
 
-
 svn_error_t *
-svn_fs_fs__reserve_copy_id(const char **copy_id_p,
-                           svn_fs_t *fs,
-                           const char *txn_id,
-                           apr_pool_t *pool)
+svn_fs_fs__set_uuid(svn_fs_t *fs,
+                    const char *uuid,
+                    apr_pool_t *pool)
 {
-  const char *cur_node_id, *cur_copy_id;
-  char *copy_id;
-  apr_size_t len;
+  char *my_uuid;
+  apr_size_t my_uuid_len;
+  const char *tmp_path;
+  const char *uuid_path = path_uuid(fs, pool);
+  fs_fs_data_t *ffd = fs->fsap_data;
 
-  /* First read in the current next-ids file. */
-  SVN_ERR(read_next_ids(&cur_node_id, &cur_copy_id, fs, txn_id, pool));
+  if (! uuid)
+    uuid = svn_uuid_generate(pool);
 
-  copy_id = apr_pcalloc(pool, strlen(cur_copy_id) + 2);
+  /* Make sure we have a copy in FS->POOL, and append a newline. */
+  my_uuid = apr_pstrcat(fs->pool, uuid, "\n", (char *)NULL);
+  my_uuid_len = strlen(my_uuid);
 
-  len = strlen(cur_copy_id);
-  svn_fs_fs__next_key(cur_copy_id, &len, copy_id);
+  SVN_ERR(svn_io_write_unique(&tmp_path,
+                              svn_dirent_dirname(uuid_path, pool),
+                              my_uuid, my_uuid_len,
+                              svn_io_file_del_none, pool));
 
-  SVN_ERR(write_next_ids(fs, txn_id, cur_node_id, copy_id, pool));
+  /* We use the permissions of the 'current' file, because the 'uuid'
+     file does not exist during repository creation. */
+  SVN_ERR(move_into_place(tmp_path, uuid_path,
+                          svn_fs_fs__path_current(fs, pool), pool));
 
-  *copy_id_p = apr_pstrcat(pool, "_", cur_copy_id, (char *)NULL);
+  /* Remove the newline we added, and stash the UUID. */
+  my_uuid[my_uuid_len - 1] = '\0';
+  ffd->uuid = my_uuid;
 
   return SVN_NO_ERROR;
 }
 
-/* Write out the zeroth revision for filesystem FS. */
-static svn_error_t *
-write_revision_zero(svn_fs_t *fs)
-{
-  const char *path_revision_zero = path_rev(fs, 0, fs->pool);
-  apr_hash_t *proplist;
-  svn_string_t date;
+/** Node origin lazy cache. */
 
-  /* Write out a rev file for revision 0. */
-  SVN_ERR(svn_io_file_create(path_revision_zero,
-                             "PLAIN\nEND\nENDREP\n"
-                             "id: 0.0.r0/17\n"
-                             "type: dir\n"
-                             "count: 0\n"
-                             "text: 0 0 4 4 "
-                             "2d2977d1c96f487abe4a1e202dd03b4e\n"
-                             "cpath: /\n"
-                             "\n\n17 107\n", fs->pool));
-  SVN_ERR(svn_io_set_file_read_only(path_revision_zero, FALSE, fs->pool));
+/* If directory PATH does not exist, create it and give it the same
+   permissions as FS_path.*/
+svn_error_t *
+svn_fs_fs__ensure_dir_exists(const char *path,
+                             const char *fs_path,
+                             apr_pool_t *pool)
+{
+  svn_error_t *err = svn_io_dir_make(path, APR_OS_DEFAULT, pool);
+  if (err && APR_STATUS_IS_EEXIST(err->apr_err))
+    {
+      svn_error_clear(err);
+      return SVN_NO_ERROR;
+    }
+  SVN_ERR(err);
 
-  /* Set a date on revision 0. */
-  date.data = svn_time_to_cstring(apr_time_now(), fs->pool);
-  date.len = strlen(date.data);
-  proplist = apr_hash_make(fs->pool);
-  apr_hash_set(proplist, SVN_PROP_REVISION_DATE, APR_HASH_KEY_STRING, &date);
-  return set_revision_proplist(fs, 0, proplist, fs->pool);
+  /* We successfully created a new directory.  Dup the permissions
+     from FS->path. */
+  return svn_io_copy_perms(fs_path, path, pool);
 }
 
-svn_error_t *
-svn_fs_fs__create(svn_fs_t *fs,
-                  const char *path,
-                  apr_pool_t *pool)
+/* Set *NODE_ORIGINS to a hash mapping 'const char *' node IDs to
+   'svn_string_t *' node revision IDs.  Use POOL for allocations. */
+static svn_error_t *
+get_node_origins_from_file(svn_fs_t *fs,
+                           apr_hash_t **node_origins,
+                           const char *node_origins_file,
+                           apr_pool_t *pool)
 {
-  int format = SVN_FS_FS__FORMAT_NUMBER;
-  fs_fs_data_t *ffd = fs->fsap_data;
+  apr_file_t *fd;
+  svn_error_t *err;
+  svn_stream_t *stream;
 
-  fs->path = apr_pstrdup(pool, path);
-  /* See if compatibility with older versions was explicitly requested. */
-  if (fs->config)
+  *node_origins = NULL;
+  err = svn_io_file_open(&fd, node_origins_file,
+                         APR_READ, APR_OS_DEFAULT, pool);
+  if (err && APR_STATUS_IS_ENOENT(err->apr_err))
     {
-      if (apr_hash_get(fs->config, SVN_FS_CONFIG_PRE_1_4_COMPATIBLE,
-                                   APR_HASH_KEY_STRING))
-        format = 1;
-      else if (apr_hash_get(fs->config, SVN_FS_CONFIG_PRE_1_5_COMPATIBLE,
-                                        APR_HASH_KEY_STRING))
-        format = 2;
-      else if (apr_hash_get(fs->config, SVN_FS_CONFIG_PRE_1_6_COMPATIBLE,
-                                        APR_HASH_KEY_STRING))
-        format = 3;
+      svn_error_clear(err);
+      return SVN_NO_ERROR;
     }
-  ffd->format = format;
+  SVN_ERR(err);
 
-  /* Override the default linear layout if this is a new-enough format. */
-  if (format >= SVN_FS_FS__MIN_LAYOUT_FORMAT_OPTION_FORMAT)
-    ffd->max_files_per_dir = SVN_FS_FS_DEFAULT_MAX_FILES_PER_DIR;
+  stream = svn_stream_from_aprfile2(fd, FALSE, pool);
+  *node_origins = apr_hash_make(pool);
+  SVN_ERR(svn_hash_read2(*node_origins, stream, SVN_HASH_TERMINATOR, pool));
+  return svn_stream_close(stream);
+}
 
-  /* Create the revision data directories. */
-  if (ffd->max_files_per_dir)
-    SVN_ERR(svn_io_make_dir_recursively(path_rev_shard(fs, 0, pool), pool));
-  else
-    SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path, PATH_REVS_DIR,
-                                                        pool),
-                                        pool));
+svn_error_t *
+svn_fs_fs__get_node_origin(const svn_fs_id_t **origin_id,
+                           svn_fs_t *fs,
+                           const char *node_id,
+                           apr_pool_t *pool)
+{
+  apr_hash_t *node_origins;
 
-  /* Create the revprops directory. */
-  if (ffd->max_files_per_dir)
-    SVN_ERR(svn_io_make_dir_recursively(path_revprops_shard(fs, 0, pool),
-                                        pool));
-  else
-    SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path,
-                                                        PATH_REVPROPS_DIR,
-                                                        pool),
-                                        pool));
+  *origin_id = NULL;
+  SVN_ERR(get_node_origins_from_file(fs, &node_origins,
+                                     path_node_origin(fs, node_id, pool),
+                                     pool));
+  if (node_origins)
+    {
+      svn_string_t *origin_id_str =
+        apr_hash_get(node_origins, node_id, APR_HASH_KEY_STRING);
+      if (origin_id_str)
+        *origin_id = svn_fs_fs__id_parse(origin_id_str->data,
+                                         origin_id_str->len, pool);
+    }
+  return SVN_NO_ERROR;
+}
 
-  /* Create the transaction directory. */
-  SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path, PATH_TXNS_DIR,
-                                                      pool),
-                                      pool));
 
-  /* Create the protorevs directory. */
-  if (format >= SVN_FS_FS__MIN_PROTOREVS_DIR_FORMAT)
-    SVN_ERR(svn_io_make_dir_recursively(svn_dirent_join(path, PATH_TXN_PROTOS_DIR,
-                                                      pool),
-                                        pool));
+/* Helper for svn_fs_fs__set_node_origin.  Takes a NODE_ID/NODE_REV_ID
+   pair and adds it to the NODE_ORIGINS_PATH file.  */
+static svn_error_t *
+set_node_origins_for_file(svn_fs_t *fs,
+                          const char *node_origins_path,
+                          const char *node_id,
+                          svn_string_t *node_rev_id,
+                          apr_pool_t *pool)
+{
+  const char *path_tmp;
+  svn_stream_t *stream;
+  apr_hash_t *origins_hash;
+  svn_string_t *old_node_rev_id;
 
-  /* Create the 'current' file. */
-  SVN_ERR(svn_io_file_create(svn_fs_fs__path_current(fs, pool),
-                             (format >= SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT
-                              ? "0\n" : "0 1 1\n"),
-                             pool));
-  SVN_ERR(svn_io_file_create(path_lock(fs, pool), "", pool));
-  SVN_ERR(svn_fs_fs__set_uuid(fs, NULL, pool));
+  SVN_ERR(svn_fs_fs__ensure_dir_exists(svn_dirent_join(fs->path,
+                                                       PATH_NODE_ORIGINS_DIR,
+                                                       pool),
+                                       fs->path, pool));
 
-  SVN_ERR(write_revision_zero(fs));
+  /* Read the previously existing origins (if any), and merge our
+     update with it. */
+  SVN_ERR(get_node_origins_from_file(fs, &origins_hash,
+                                     node_origins_path, pool));
+  if (! origins_hash)
+    origins_hash = apr_hash_make(pool);
 
-  SVN_ERR(write_config(fs, pool));
+  old_node_rev_id = apr_hash_get(origins_hash, node_id, APR_HASH_KEY_STRING);
 
-  SVN_ERR(read_config(fs, pool));
+  if (old_node_rev_id && !svn_string_compare(node_rev_id, old_node_rev_id))
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Node origin for '%s' exists with a different "
+                               "value (%s) than what we were about to store "
+                               "(%s)"),
+                             node_id, old_node_rev_id->data, node_rev_id->data);
 
-  /* Create the min unpacked rev file. */
-  if (ffd->format >= SVN_FS_FS__MIN_PACKED_FORMAT)
-    SVN_ERR(svn_io_file_create(path_min_unpacked_rev(fs, pool), "0\n", pool));
+  apr_hash_set(origins_hash, node_id, APR_HASH_KEY_STRING, node_rev_id);
 
-  /* Create the txn-current file if the repository supports
-     the transaction sequence file. */
-  if (format >= SVN_FS_FS__MIN_TXN_CURRENT_FORMAT)
-    {
-      SVN_ERR(svn_io_file_create(path_txn_current(fs, pool),
-                                 "0\n", pool));
-      SVN_ERR(svn_io_file_create(path_txn_current_lock(fs, pool),
-                                 "", pool));
-    }
+  /* Sure, there's a race condition here.  Two processes could be
+     trying to add different cache elements to the same file at the
+     same time, and the entries added by the first one to write will
+     be lost.  But this is just a cache of reconstructible data, so
+     we'll accept this problem in return for not having to deal with
+     locking overhead. */
 
-  /* This filesystem is ready.  Stamp it with a format number. */
-  SVN_ERR(write_format(path_format(fs, pool),
-                       ffd->format, ffd->max_files_per_dir, FALSE, pool));
+  /* Create a temporary file, write out our hash, and close the file. */
+  SVN_ERR(svn_stream_open_unique(&stream, &path_tmp,
+                                 svn_dirent_dirname(node_origins_path, pool),
+                                 svn_io_file_del_none, pool, pool));
+  SVN_ERR(svn_hash_write2(origins_hash, stream, SVN_HASH_TERMINATOR, pool));
+  SVN_ERR(svn_stream_close(stream));
 
-  ffd->youngest_rev_cache = 0;
-  return SVN_NO_ERROR;
+  /* Rename the temp file as the real destination */
+  return svn_io_file_rename(path_tmp, node_origins_path, pool);
 }
 
-/* Part of the recovery procedure.  Return the largest revision *REV in
-   filesystem FS.  Use POOL for temporary allocation. */
-static svn_error_t *
-recover_get_largest_revision(svn_fs_t *fs, svn_revnum_t *rev, apr_pool_t *pool)
+
+svn_error_t *
+svn_fs_fs__set_node_origin(svn_fs_t *fs,
+                           const char *node_id,
+                           const svn_fs_id_t *node_rev_id,
+                           apr_pool_t *pool)
 {
-  /* Discovering the largest revision in the filesystem would be an
-     expensive operation if we did a readdir() or searched linearly,
-     so we'll do a form of binary search.  left is a revision that we
-     know exists, right a revision that we know does not exist. */
-  apr_pool_t *iterpool;
-  svn_revnum_t left, right = 1;
+  svn_error_t *err;
+  const char *filename = path_node_origin(fs, node_id, pool);
 
-  iterpool = svn_pool_create(pool);
-  /* Keep doubling right, until we find a revision that doesn't exist. */
-  while (1)
+  err = set_node_origins_for_file(fs, filename,
+                                  node_id,
+                                  svn_fs_fs__id_unparse(node_rev_id, pool),
+                                  pool);
+  if (err && APR_STATUS_IS_EACCES(err->apr_err))
     {
-      svn_error_t *err;
-      apr_file_t *file;
+      /* It's just a cache; stop trying if I can't write. */
+      svn_error_clear(err);
+      err = NULL;
+    }
+  return svn_error_trace(err);
+}
 
-      err = open_pack_or_rev_file(&file, fs, right, iterpool);
-      svn_pool_clear(iterpool);
 
-      if (err && err->apr_err == SVN_ERR_FS_NO_SUCH_REVISION)
-        {
-          svn_error_clear(err);
-          break;
-        }
-      else
-        SVN_ERR(err);
+svn_error_t *
+svn_fs_fs__list_transactions(apr_array_header_t **names_p,
+                             svn_fs_t *fs,
+                             apr_pool_t *pool)
+{
+  const char *txn_dir;
+  apr_hash_t *dirents;
+  apr_hash_index_t *hi;
+  apr_array_header_t *names;
+  apr_size_t ext_len = strlen(PATH_EXT_TXN);
 
-      right <<= 1;
-    }
+  names = apr_array_make(pool, 1, sizeof(const char *));
 
-  left = right >> 1;
+  /* Get the transactions directory. */
+  txn_dir = svn_dirent_join(fs->path, PATH_TXNS_DIR, pool);
 
-  /* We know that left exists and right doesn't.  Do a normal bsearch to find
-     the last revision. */
-  while (left + 1 < right)
+  /* Now find a listing of this directory. */
+  SVN_ERR(svn_io_get_dirents3(&dirents, txn_dir, TRUE, pool, pool));
+
+  /* Loop through all the entries and return anything that ends with '.txn'. */
+  for (hi = apr_hash_first(pool, dirents); hi; hi = apr_hash_next(hi))
     {
-      svn_revnum_t probe = left + ((right - left) / 2);
-      svn_error_t *err;
-      apr_file_t *file;
+      const char *name = svn__apr_hash_index_key(hi);
+      apr_ssize_t klen = svn__apr_hash_index_klen(hi);
+      const char *id;
 
-      err = open_pack_or_rev_file(&file, fs, probe, iterpool);
-      svn_pool_clear(iterpool);
+      /* The name must end with ".txn" to be considered a transaction. */
+      if ((apr_size_t) klen <= ext_len
+          || (strcmp(name + klen - ext_len, PATH_EXT_TXN)) != 0)
+        continue;
 
-      if (err && err->apr_err == SVN_ERR_FS_NO_SUCH_REVISION)
-        {
-          svn_error_clear(err);
-          right = probe;
-        }
-      else
-        {
-          SVN_ERR(err);
-          left = probe;
-        }
+      /* Truncate the ".txn" extension and store the ID. */
+      id = apr_pstrndup(pool, name, strlen(name) - ext_len);
+      APR_ARRAY_PUSH(names, const char *) = id;
     }
 
-  svn_pool_destroy(iterpool);
+  *names_p = names;
 
-  /* left is now the largest revision that exists. */
-  *rev = left;
   return SVN_NO_ERROR;
 }
 
-/* A baton for reading a fixed amount from an open file.  For
-   recover_find_max_ids() below. */
-struct recover_read_from_file_baton
-{
-  apr_file_t *file;
-  apr_pool_t *pool;
-  apr_off_t remaining;
-};
-
-/* A stream read handler used by recover_find_max_ids() below.
-   Read and return at most BATON->REMAINING bytes from the stream,
-   returning nothing after that to indicate EOF. */
-static svn_error_t *
-read_handler_recover(void *baton, char *buffer, apr_size_t *len)
+svn_error_t *
+svn_fs_fs__open_txn(svn_fs_txn_t **txn_p,
+                    svn_fs_t *fs,
+                    const char *name,
+                    apr_pool_t *pool)
 {
-  struct recover_read_from_file_baton *b = baton;
-  svn_filesize_t bytes_to_read = *len;
+  svn_fs_txn_t *txn;
+  svn_node_kind_t kind;
+  transaction_t *local_txn;
 
-  if (b->remaining == 0)
-    {
-      /* Return a successful read of zero bytes to signal EOF. */
-      *len = 0;
-      return SVN_NO_ERROR;
-    }
+  /* First check to see if the directory exists. */
+  SVN_ERR(svn_io_check_path(path_txn_dir(fs, name, pool), &kind, pool));
 
-  if (bytes_to_read > b->remaining)
-    bytes_to_read = b->remaining;
-  b->remaining -= bytes_to_read;
+  /* Did we find it? */
+  if (kind != svn_node_dir)
+    return svn_error_createf(SVN_ERR_FS_NO_SUCH_TRANSACTION, NULL,
+                             _("No such transaction '%s'"),
+                             name);
 
-  return svn_io_file_read_full2(b->file, buffer, (apr_size_t) bytes_to_read,
-                                len, NULL, b->pool);
-}
+  txn = apr_pcalloc(pool, sizeof(*txn));
 
-/* Part of the recovery procedure.  Read the directory noderev at offset
-   OFFSET of file REV_FILE (the revision file of revision REV of
-   filesystem FS), and set MAX_NODE_ID and MAX_COPY_ID to be the node-id
-   and copy-id of that node, if greater than the current value stored
-   in either.  Recurse into any child directories that were modified in
-   this revision.
+  /* Read in the root node of this transaction. */
+  txn->id = apr_pstrdup(pool, name);
+  txn->fs = fs;
 
-   MAX_NODE_ID and MAX_COPY_ID must be arrays of at least MAX_KEY_SIZE.
+  SVN_ERR(svn_fs_fs__get_txn(&local_txn, fs, name, pool));
 
-   Perform temporary allocation in POOL. */
-static svn_error_t *
-recover_find_max_ids(svn_fs_t *fs, svn_revnum_t rev,
-                     apr_file_t *rev_file, apr_off_t offset,
-                     char *max_node_id, char *max_copy_id,
-                     apr_pool_t *pool)
-{
-  apr_hash_t *headers;
-  char *value;
-  representation_t *data_rep;
-  struct rep_args *ra;
-  struct recover_read_from_file_baton baton;
-  svn_stream_t *stream;
-  apr_hash_t *entries;
-  apr_hash_index_t *hi;
-  apr_pool_t *iterpool;
+  txn->base_rev = svn_fs_fs__id_rev(local_txn->base_id);
 
-  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
-  SVN_ERR(read_header_block(&headers, svn_stream_from_aprfile2(rev_file, TRUE,
-                                                               pool),
-                            pool));
+  txn->vtable = &txn_vtable;
+  *txn_p = txn;
 
-  /* Check that this is a directory.  It should be. */
-  value = apr_hash_get(headers, HEADER_TYPE, APR_HASH_KEY_STRING);
-  if (value == NULL || strcmp(value, KIND_DIR) != 0)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Recovery encountered a non-directory node"));
+  return SVN_NO_ERROR;
+}
 
-  /* Get the data location.  No data location indicates an empty directory. */
-  value = apr_hash_get(headers, HEADER_TEXT, APR_HASH_KEY_STRING);
-  if (!value)
-    return SVN_NO_ERROR;
-  SVN_ERR(read_rep_offsets(&data_rep, value, NULL, FALSE, pool));
+svn_error_t *
+svn_fs_fs__txn_proplist(apr_hash_t **table_p,
+                        svn_fs_txn_t *txn,
+                        apr_pool_t *pool)
+{
+  apr_hash_t *proplist = apr_hash_make(pool);
+  SVN_ERR(get_txn_proplist(proplist, txn->fs, txn->id, pool));
+  *table_p = proplist;
 
-  /* If the directory's data representation wasn't changed in this revision,
-     we've already scanned the directory's contents for noderevs, so we don't
-     need to again.  This will occur if a property is changed on a directory
-     without changing the directory's contents. */
-  if (data_rep->revision != rev)
-    return SVN_NO_ERROR;
+  return SVN_NO_ERROR;
+}
 
-  /* We could use get_dir_contents(), but this is much cheaper.  It does
-     rely on directory entries being stored as PLAIN reps, though. */
-  offset = data_rep->offset;
-  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, pool));
-  SVN_ERR(read_rep_line(&ra, rev_file, pool));
-  if (ra->is_delta)
-    return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                            _("Recovery encountered a deltified directory "
-                              "representation"));
+svn_error_t *
+svn_fs_fs__delete_node_revision(svn_fs_t *fs,
+                                const svn_fs_id_t *id,
+                                apr_pool_t *pool)
+{
+  node_revision_t *noderev;
 
-  /* Now create a stream that's allowed to read only as much data as is
-     stored in the representation. */
-  baton.file = rev_file;
-  baton.pool = pool;
-  baton.remaining = data_rep->expanded_size;
-  stream = svn_stream_create(&baton, pool);
-  svn_stream_set_read(stream, read_handler_recover);
+  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, id, pool));
 
-  /* Now read the entries from that stream. */
-  entries = apr_hash_make(pool);
-  SVN_ERR(svn_hash_read2(entries, stream, SVN_HASH_TERMINATOR, pool));
-  SVN_ERR(svn_stream_close(stream));
+  /* Delete any mutable property representation. */
+  if (noderev->prop_rep && noderev->prop_rep->txn_id)
+    SVN_ERR(svn_io_remove_file2(path_txn_node_props(fs, id, pool), FALSE,
+                                pool));
 
-  /* Now check each of the entries in our directory to find new node and
-     copy ids, and recurse into new subdirectories. */
-  iterpool = svn_pool_create(pool);
-  for (hi = apr_hash_first(pool, entries); hi; hi = apr_hash_next(hi))
+  /* Delete any mutable data representation. */
+  if (noderev->data_rep && noderev->data_rep->txn_id
+      && noderev->kind == svn_node_dir)
     {
-      char *str_val;
-      char *str;
-      svn_node_kind_t kind;
-      svn_fs_id_t *id;
-      const char *node_id, *copy_id;
-      apr_off_t child_dir_offset;
-      const svn_string_t *path = svn__apr_hash_index_val(hi);
-
-      svn_pool_clear(iterpool);
-
-      str_val = apr_pstrdup(iterpool, path->data);
-
-      str = svn_cstring_tokenize(" ", &str_val);
-      if (str == NULL)
-        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                _("Directory entry corrupt"));
+      fs_fs_data_t *ffd = fs->fsap_data;
+      SVN_ERR(svn_io_remove_file2(path_txn_node_children(fs, id, pool), FALSE,
+                                  pool));
 
-      if (strcmp(str, KIND_FILE) == 0)
-        kind = svn_node_file;
-      else if (strcmp(str, KIND_DIR) == 0)
-        kind = svn_node_dir;
-      else
+      /* remove the corresponding entry from the cache, if such exists */
+      if (ffd->txn_dir_cache)
         {
-          return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                  _("Directory entry corrupt"));
+          const char *key = svn_fs_fs__id_unparse(id, pool)->data;
+          SVN_ERR(svn_cache__set(ffd->txn_dir_cache, key, NULL, pool));
         }
+    }
 
-      str = svn_cstring_tokenize(" ", &str_val);
-      if (str == NULL)
-        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
-                                _("Directory entry corrupt"));
-
-      id = svn_fs_fs__id_parse(str, strlen(str), iterpool);
+  return svn_io_remove_file2(path_txn_node_rev(fs, id, pool), FALSE, pool);
+}
 
-      if (svn_fs_fs__id_rev(id) != rev)
-        {
-          /* If the node wasn't modified in this revision, we've already
-             checked the node and copy id. */
-          continue;
-        }
 
-      node_id = svn_fs_fs__id_node_id(id);
-      copy_id = svn_fs_fs__id_copy_id(id);
+
+/*** Revisions ***/
 
-      if (svn_fs_fs__key_compare(node_id, max_node_id) > 0)
-        {
-          SVN_ERR_ASSERT(strlen(node_id) < MAX_KEY_SIZE);
-          apr_cpystrn(max_node_id, node_id, MAX_KEY_SIZE);
-        }
-      if (svn_fs_fs__key_compare(copy_id, max_copy_id) > 0)
-        {
-          SVN_ERR_ASSERT(strlen(copy_id) < MAX_KEY_SIZE);
-          apr_cpystrn(max_copy_id, copy_id, MAX_KEY_SIZE);
-        }
+svn_error_t *
+svn_fs_fs__revision_prop(svn_string_t **value_p,
+                         svn_fs_t *fs,
+                         svn_revnum_t rev,
+                         const char *propname,
+                         apr_pool_t *pool)
+{
+  apr_hash_t *table;
 
-      if (kind == svn_node_file)
-        continue;
+  SVN_ERR(svn_fs__check_fs(fs, TRUE));
+  SVN_ERR(svn_fs_fs__revision_proplist(&table, fs, rev, pool));
 
-      child_dir_offset = svn_fs_fs__id_offset(id);
-      SVN_ERR(recover_find_max_ids(fs, rev, rev_file, child_dir_offset,
-                                   max_node_id, max_copy_id, iterpool));
-    }
-  svn_pool_destroy(iterpool);
+  *value_p = apr_hash_get(table, propname, APR_HASH_KEY_STRING);
 
   return SVN_NO_ERROR;
 }
 
-/* Baton used for recover_body below. */
-struct recover_baton {
+
+/* Baton used for change_rev_prop_body below. */
+struct change_rev_prop_baton {
   svn_fs_t *fs;
-  svn_cancel_func_t cancel_func;
-  void *cancel_baton;
+  svn_revnum_t rev;
+  const char *name;
+  const svn_string_t *const *old_value_p;
+  const svn_string_t *value;
 };
 
-/* The work-horse for svn_fs_fs__recover, called with the FS
+/* The work-horse for svn_fs_fs__change_rev_prop, called with the FS
    write lock.  This implements the svn_fs_fs__with_write_lock()
-   'body' callback type.  BATON is a 'struct recover_baton *'. */
+   'body' callback type.  BATON is a 'struct change_rev_prop_baton *'. */
 static svn_error_t *
-recover_body(void *baton, apr_pool_t *pool)
+change_rev_prop_body(void *baton, apr_pool_t *pool)
 {
-  struct recover_baton *b = baton;
-  svn_fs_t *fs = b->fs;
-  fs_fs_data_t *ffd = fs->fsap_data;
-  svn_revnum_t max_rev;
-  char next_node_id_buf[MAX_KEY_SIZE], next_copy_id_buf[MAX_KEY_SIZE];
-  char *next_node_id = NULL, *next_copy_id = NULL;
-  svn_revnum_t youngest_rev;
-  svn_node_kind_t youngest_revprops_kind;
+  struct change_rev_prop_baton *cb = baton;
+  fs_fs_data_t *ffd = cb->fs->fsap_data;
+  apr_hash_t *table;
 
-  /* First, we need to know the largest revision in the filesystem. */
-  SVN_ERR(recover_get_largest_revision(fs, &max_rev, pool));
+  SVN_ERR(svn_fs_fs__revision_proplist(&table, cb->fs, cb->rev, pool));
 
-  /* Get the expected youngest revision */
-  SVN_ERR(get_youngest(&youngest_rev, fs->path, pool));
+  if (cb->old_value_p)
+    {
+      const svn_string_t *wanted_value = *cb->old_value_p;
+      const svn_string_t *present_value = apr_hash_get(table, cb->name,
+                                                       APR_HASH_KEY_STRING);
+      if ((!wanted_value != !present_value)
+          || (wanted_value && present_value
+              && !svn_string_compare(wanted_value, present_value)))
+        {
+          /* What we expected isn't what we found. */
+          return svn_error_createf(SVN_ERR_FS_PROP_BASEVALUE_MISMATCH, NULL,
+                                   _("revprop '%s' has unexpected value in "
+                                     "filesystem"),
+                                   cb->name);
+        }
+      /* Fall through. */
+    }
+  apr_hash_set(table, cb->name, APR_HASH_KEY_STRING, cb->value);
 
-  /* Policy note:
+  /* Make readers in other processes bypass their revprop caches while
+     we modify the revprops on disk. */
+  if (ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+    {
+      apr_int64_t generation;
+      svn_error_t *err;
 
-     Since the revprops file is written after the revs file, the true
-     maximum available revision is the youngest one for which both are
-     present.  That's probably the same as the max_rev we just found,
-     but if it's not, we could, in theory, repeatedly decrement
-     max_rev until we find a revision that has both a revs and
-     revprops file, then write db/current with that.
+      SVN_ERR(begin_revprop_change(&generation, cb->fs, pool));
+      err = set_revision_proplist(cb->fs, cb->rev, table, pool);
 
-     But we choose not to.  If a repository is so corrupt that it's
-     missing at least one revprops file, we shouldn't assume that the
-     youngest revision for which both the revs and revprops files are
-     present is healthy.  In other words, we're willing to recover
-     from a missing or out-of-date db/current file, because db/current
-     is truly redundant -- it's basically a cache so we don't have to
-     find max_rev each time, albeit a cache with unusual semantics,
-     since it also officially defines when a revision goes live.  But
-     if we're missing more than the cache, it's time to back out and
-     let the admin reconstruct things by hand: correctness at that
-     point may depend on external things like checking a commit email
-     list, looking in particular working copies, etc.
+      /* The revprop files get replaced atomically, so we may safely
+         end the change even if writing them failed. */
+      return svn_error_compose_create(err,
+                                      end_revprop_change(cb->fs, generation,
+                                                         pool));
+    }
 
-     This policy matches well with a typical naive backup scenario.
-     Say you're rsyncing your FSFS repository nightly to the same
-     location.  Once revs and revprops are written, you've got the
-     maximum rev; if the backup should bomb before db/current is
-     written, then db/current could stay arbitrarily out-of-date, but
-     we can still recover.  It's a small window, but we might as well
-     do what we can. */
+  return set_revision_proplist(cb->fs, cb->rev, table, pool);
+}
 
-  /* Even if db/current were missing, it would be created with 0 by
-     get_youngest(), so this conditional remains valid. */
-  if (youngest_rev > max_rev)
-    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                             _("Expected current rev to be <= %ld "
-                               "but found %ld"), max_rev, youngest_rev);
+svn_error_t *
+svn_fs_fs__change_rev_prop(svn_fs_t *fs,
+                           svn_revnum_t rev,
+                           const char *name,
+                           const svn_string_t *const *old_value_p,
+                           const svn_string_t *value,
+                           apr_pool_t *pool)
+{
+  struct change_rev_prop_baton cb;
 
-  /* We only need to search for maximum IDs for old FS formats which
-     se global ID counters. */
-  if (ffd->format < SVN_FS_FS__MIN_NO_GLOBAL_IDS_FORMAT)
-    {
-      /* Next we need to find the maximum node id and copy id in use across the
-         filesystem.  Unfortunately, the only way we can get this information
-         is to scan all the noderevs of all the revisions and keep track as
-         we go along. */
-      svn_revnum_t rev;
-      apr_pool_t *iterpool = svn_pool_create(pool);
-      char max_node_id[MAX_KEY_SIZE] = "0", max_copy_id[MAX_KEY_SIZE] = "0";
-      apr_size_t len;
+  SVN_ERR(svn_fs__check_fs(fs, TRUE));
 
-      for (rev = 0; rev <= max_rev; rev++)
-        {
-          apr_file_t *rev_file;
-          apr_off_t root_offset;
+  cb.fs = fs;
+  cb.rev = rev;
+  cb.name = name;
+  cb.old_value_p = old_value_p;
+  cb.value = value;
 
-          svn_pool_clear(iterpool);
+  return svn_fs_fs__with_write_lock(fs, change_rev_prop_body, &cb, pool);
+}
 
-          if (b->cancel_func)
-            SVN_ERR(b->cancel_func(b->cancel_baton));
 
-          SVN_ERR(open_pack_or_rev_file(&rev_file, fs, rev, iterpool));
-          SVN_ERR(get_root_changes_offset(&root_offset, NULL, rev_file, fs, rev,
-                                          iterpool));
-          SVN_ERR(recover_find_max_ids(fs, rev, rev_file, root_offset,
-                                       max_node_id, max_copy_id, iterpool));
-          SVN_ERR(svn_io_file_close(rev_file, iterpool));
-        }
-      svn_pool_destroy(iterpool);
+
+/*** Transactions ***/
 
-      /* Now that we finally have the maximum revision, node-id and copy-id, we
-         can bump the two ids to get the next of each. */
-      len = strlen(max_node_id);
-      svn_fs_fs__next_key(max_node_id, &len, next_node_id_buf);
-      next_node_id = next_node_id_buf;
-      len = strlen(max_copy_id);
-      svn_fs_fs__next_key(max_copy_id, &len, next_copy_id_buf);
-      next_copy_id = next_copy_id_buf;
-    }
+svn_error_t *
+svn_fs_fs__get_txn_ids(const svn_fs_id_t **root_id_p,
+                       const svn_fs_id_t **base_root_id_p,
+                       svn_fs_t *fs,
+                       const char *txn_name,
+                       apr_pool_t *pool)
+{
+  transaction_t *txn;
+  SVN_ERR(svn_fs_fs__get_txn(&txn, fs, txn_name, pool));
+  *root_id_p = txn->root_id;
+  *base_root_id_p = txn->base_id;
+  return SVN_NO_ERROR;
+}
+
+
+/* Generic transaction operations.  */
+
+svn_error_t *
+svn_fs_fs__txn_prop(svn_string_t **value_p,
+                    svn_fs_txn_t *txn,
+                    const char *propname,
+                    apr_pool_t *pool)
+{
+  apr_hash_t *table;
+  svn_fs_t *fs = txn->fs;
+
+  SVN_ERR(svn_fs__check_fs(fs, TRUE));
+  SVN_ERR(svn_fs_fs__txn_proplist(&table, txn, pool));
+
+  *value_p = apr_hash_get(table, propname, APR_HASH_KEY_STRING);
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_fs_fs__begin_txn(svn_fs_txn_t **txn_p,
+                     svn_fs_t *fs,
+                     svn_revnum_t rev,
+                     apr_uint32_t flags,
+                     apr_pool_t *pool)
+{
+  svn_string_t date;
+  svn_prop_t prop;
+  apr_array_header_t *props = apr_array_make(pool, 3, sizeof(svn_prop_t));
+
+  SVN_ERR(svn_fs__check_fs(fs, TRUE));
+
+  SVN_ERR(svn_fs_fs__create_txn(txn_p, fs, rev, pool));
+
+  /* Put a datestamp on the newly created txn, so we always know
+     exactly how old it is.  (This will help sysadmins identify
+     long-abandoned txns that may need to be manually removed.)  When
+     a txn is promoted to a revision, this property will be
+     automatically overwritten with a revision datestamp. */
+  date.data = svn_time_to_cstring(apr_time_now(), pool);
+  date.len = strlen(date.data);
 
-  /* Before setting current, verify that there is a revprops file
-     for the youngest revision.  (Issue #2992) */
-  SVN_ERR(svn_io_check_path(path_revprops(fs, max_rev, pool),
-                            &youngest_revprops_kind, pool));
-  if (youngest_revprops_kind == svn_node_none)
+  prop.name = SVN_PROP_REVISION_DATE;
+  prop.value = &date;
+  APR_ARRAY_PUSH(props, svn_prop_t) = prop;
+
+  /* Set temporary txn props that represent the requested 'flags'
+     behaviors. */
+  if (flags & SVN_FS_TXN_CHECK_OOD)
     {
-      /* if (1); null condition for easier merging to revprop-packing */
-        {
-          return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                                   _("Revision %ld has a revs file but no "
-                                     "revprops file"),
-                                   max_rev);
-        }
+      prop.name = SVN_FS__PROP_TXN_CHECK_OOD;
+      prop.value = svn_string_create("true", pool);
+      APR_ARRAY_PUSH(props, svn_prop_t) = prop;
     }
-  else if (youngest_revprops_kind != svn_node_file)
+
+  if (flags & SVN_FS_TXN_CHECK_LOCKS)
     {
-      return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                               _("Revision %ld has a non-file where its "
-                                 "revprops file should be"),
-                               max_rev);
+      prop.name = SVN_FS__PROP_TXN_CHECK_LOCKS;
+      prop.value = svn_string_create("true", pool);
+      APR_ARRAY_PUSH(props, svn_prop_t) = prop;
     }
 
-  /* Prune younger-than-(newfound-youngest) revisions from the rep cache. */
-  if (ffd->format >= SVN_FS_FS__MIN_REP_SHARING_FORMAT)
-    SVN_ERR(svn_fs_fs__del_rep_reference(fs, max_rev, pool));
-
-  /* Now store the discovered youngest revision, and the next IDs if
-     relevant, in a new 'current' file. */
-  return write_current(fs, max_rev, next_node_id, next_copy_id, pool);
+  return svn_fs_fs__change_txn_props(*txn_p, props, pool);
 }
 
-/* This implements the fs_library_vtable_t.recover() API. */
-svn_error_t *
-svn_fs_fs__recover(svn_fs_t *fs,
-                   svn_cancel_func_t cancel_func, void *cancel_baton,
-                   apr_pool_t *pool)
+
+/****** Packing FSFS shards *********/
+
+/* Write a file FILENAME in directory FS_PATH, containing a single line
+ * with the number REVNUM in ASCII decimal.  Move the file into place
+ * atomically, overwriting any existing file.
+ *
+ * Similar to write_current(). */
+static svn_error_t *
+write_revnum_file(const char *fs_path,
+                  const char *filename,
+                  svn_revnum_t revnum,
+                  apr_pool_t *scratch_pool)
 {
-  struct recover_baton b;
+  const char *final_path, *tmp_path;
+  svn_stream_t *tmp_stream;
 
-  /* We have no way to take out an exclusive lock in FSFS, so we're
-     restricted as to the types of recovery we can do.  Luckily,
-     we just want to recreate the 'current' file, and we can do that just
-     by blocking other writers. */
-  b.fs = fs;
-  b.cancel_func = cancel_func;
-  b.cancel_baton = cancel_baton;
-  return svn_fs_fs__with_write_lock(fs, recover_body, &b, pool);
+  final_path = svn_dirent_join(fs_path, filename, scratch_pool);
+  SVN_ERR(svn_stream_open_unique(&tmp_stream, &tmp_path, fs_path,
+                                   svn_io_file_del_none,
+                                   scratch_pool, scratch_pool));
+  SVN_ERR(svn_stream_printf(tmp_stream, scratch_pool, "%ld\n", revnum));
+  SVN_ERR(svn_stream_close(tmp_stream));
+  SVN_ERR(move_into_place(tmp_path, final_path, final_path, scratch_pool));
+  return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__get_uuid(svn_fs_t *fs,
-                    const char **uuid_p,
-                    apr_pool_t *pool)
+/* Write the revprops collected in PACK into a new pack file in
+   PACK_FILE_DIR.  Use POOL for temporary allocations. */
+static svn_error_t *
+write_revprop_pack_file(const char *pack_file_dir,
+                        packed_revprops_t *pack,
+                        apr_pool_t *pool)
 {
-  fs_fs_data_t *ffd = fs->fsap_data;
+  const char *path = svn_dirent_join(pack_file_dir,
+                                     apr_psprintf(pool, "%ld",
+                                                  pack->start_revision),
+                                     pool);
+  svn_stream_t *stream;
 
-  *uuid_p = apr_pstrdup(pool, ffd->uuid);
-  return SVN_NO_ERROR;
+  SVN_ERR(svn_stream_open_writable(&stream, path, pool, pool));
+  SVN_ERR(write_revprop_pack(stream, pack, pool));
+  return svn_error_trace(svn_stream_close(stream));
 }
 
-svn_error_t *
-svn_fs_fs__set_uuid(svn_fs_t *fs,
-                    const char *uuid,
+/* Pack the revprops of shard SHARD in SHARD_PATH into PACK_FILE_DIR,
+   using pack files of at most MAX_PACK_SIZE bytes unless a single
+   revision's revprops exceed that limit.  Shards contain
+   MAX_FILES_PER_DIR revisions.  The revprops of r0 will not be packed.
+   The unpacked revprops remain untouched.  Use POOL for allocations.
+   CANCEL_FUNC and CANCEL_BATON are what you think they are.
+
+   If for some reason we detect a partial packing already performed, we
+   remove the pack folder and start again. */
+static svn_error_t *
+pack_revprops_shard(const char *pack_file_dir,
+                    const char *shard_path,
+                    apr_int64_t shard,
+                    int max_files_per_dir,
+                    apr_int64_t max_pack_size,
+                    svn_cancel_func_t cancel_func,
+                    void *cancel_baton,
                     apr_pool_t *pool)
 {
-  char *my_uuid;
-  apr_size_t my_uuid_len;
-  const char *tmp_path;
-  const char *uuid_path = path_uuid(fs, pool);
-  fs_fs_data_t *ffd = fs->fsap_data;
+  const char *manifest_file_path;
+  svn_stream_t *manifest_stream;
+  svn_revnum_t start_rev, end_rev, rev;
+  packed_revprops_t pack;
+  apr_int64_t pack_size = 0;
+  apr_pool_t *pack_pool, *iterpool;
 
-  if (! uuid)
-    uuid = svn_uuid_generate(pool);
+  /* Remove any existing pack folder for this shard, since it is
+     incomplete. */
+  SVN_ERR(svn_io_remove_dir2(pack_file_dir, TRUE, cancel_func, cancel_baton,
+                             pool));
 
-  /* Make sure we have a copy in FS->POOL, and append a newline. */
-  my_uuid = apr_pstrcat(fs->pool, uuid, "\n", (char *)NULL);
-  my_uuid_len = strlen(my_uuid);
+  /* Create the new directory and manifest file. */
+  manifest_file_path = svn_dirent_join(pack_file_dir, PATH_MANIFEST, pool);
+  SVN_ERR(svn_io_dir_make(pack_file_dir, APR_OS_DEFAULT, pool));
+  SVN_ERR(svn_stream_open_writable(&manifest_stream, manifest_file_path,
+                                   pool, pool));
 
-  SVN_ERR(svn_io_write_unique(&tmp_path,
-                              svn_dirent_dirname(uuid_path, pool),
-                              my_uuid, my_uuid_len,
-                              svn_io_file_del_none, pool));
+  start_rev = (svn_revnum_t) (shard * max_files_per_dir);
+  end_rev = (svn_revnum_t) ((shard + 1) * (max_files_per_dir) - 1);
+  if (start_rev == 0)
+    ++start_rev;
 
-  /* We use the permissions of the 'current' file, because the 'uuid'
-     file does not exist during repository creation. */
-  SVN_ERR(move_into_place(tmp_path, uuid_path,
-                          svn_fs_fs__path_current(fs, pool), pool));
+  pack_pool = svn_pool_create(pool);
+  iterpool = svn_pool_create(pool);
+  pack.start_revision = start_rev;
+  pack.revprops = apr_array_make(pack_pool, max_files_per_dir,
+                                 sizeof(svn_string_t *));
 
-  /* Remove the newline we added, and stash the UUID. */
-  my_uuid[my_uuid_len - 1] = '\0';
-  ffd->uuid = my_uuid;
+  /* Iterate over the revisions in this shard, collecting their revprops
+     in pack files. */
+  for (rev = start_rev; rev <= end_rev; rev++)
+    {
+      svn_stringbuf_t *serialized;
+      apr_finfo_t finfo;
+      const char *path;
 
-  return SVN_NO_ERROR;
-}
+      svn_pool_clear(iterpool);
 
-/** Node origin lazy cache. */
+      if (cancel_func)
+        SVN_ERR(cancel_func(cancel_baton));
 
-/* If directory PATH does not exist, create it and give it the same
-   permissions as FS_path.*/
-svn_error_t *
-svn_fs_fs__ensure_dir_exists(const char *path,
-                             const char *fs_path,
-                             apr_pool_t *pool)
-{
-  svn_error_t *err = svn_io_dir_make(path, APR_OS_DEFAULT, pool);
-  if (err && APR_STATUS_IS_EEXIST(err->apr_err))
-    {
-      svn_error_clear(err);
-      return SVN_NO_ERROR;
+      /* Get the size of the file. */
+      path = svn_dirent_join(shard_path, apr_psprintf(iterpool, "%ld", rev),
+                             iterpool);
+      SVN_ERR(svn_io_stat(&finfo, path, APR_FINFO_SIZE, iterpool));
+
+      /* Start a new pack file if the current one would become too large. */
+      if (pack.revprops->nelts && pack_size + finfo.size > max_pack_size)
+        {
+          SVN_ERR(write_revprop_pack_file(pack_file_dir, &pack, iterpool));
+
+          svn_pool_clear(pack_pool);
+          pack.start_revision = rev;
+          pack.revprops = apr_array_make(pack_pool, max_files_per_dir,
+                                         sizeof(svn_string_t *));
+          pack_size = 0;
+        }
+
+      SVN_ERR(svn_stringbuf_from_file2(&serialized, path, pack_pool));
+      APR_ARRAY_PUSH(pack.revprops, svn_string_t *)
+        = svn_stringbuf__morph_into_string(serialized);
+      pack_size += serialized->len;
+
+      /* Update the manifest. */
+      SVN_ERR(svn_stream_printf(manifest_stream, iterpool, "%ld\n",
+                                pack.start_revision));
     }
-  SVN_ERR(err);
 
-  /* We successfully created a new directory.  Dup the permissions
-     from FS->path. */
-  return svn_io_copy_perms(fs_path, path, pool);
+  if (pack.revprops->nelts)
+    SVN_ERR(write_revprop_pack_file(pack_file_dir, &pack, iterpool));
+
+  svn_pool_destroy(iterpool);
+  svn_pool_destroy(pack_pool);
+
+  SVN_ERR(svn_stream_close(manifest_stream));
+  SVN_ERR(svn_io_copy_perms(shard_path, pack_file_dir, pool));
+  SVN_ERR(svn_io_set_file_read_only(manifest_file_path, FALSE, pool));
+
+  return SVN_NO_ERROR;
 }
 
-/* Set *NODE_ORIGINS to a hash mapping 'const char *' node IDs to
-   'svn_string_t *' node revision IDs.  Use POOL for allocations. */
+/* Remove the unpacked revprops of shard SHARD in SHARD_PATH after they
+   have been packed.  Shards contain MAX_FILES_PER_DIR revisions.  The
+   revprops of r0 will be kept.  Use POOL for allocations.  CANCEL_FUNC
+   and CANCEL_BATON are what you think they are. */
 static svn_error_t *
-get_node_origins_from_file(svn_fs_t *fs,
-                           apr_hash_t **node_origins,
-                           const char *node_origins_file,
-                           apr_pool_t *pool)
+delete_revprops_shard(const char *shard_path,
+                      apr_int64_t shard,
+                      int max_files_per_dir,
+                      svn_cancel_func_t cancel_func,
+                      void *cancel_baton,
+                      apr_pool_t *pool)
 {
-  apr_file_t *fd;
-  svn_error_t *err;
-  svn_stream_t *stream;
-
-  *node_origins = NULL;
-  err = svn_io_file_open(&fd, node_origins_file,
-                         APR_READ, APR_OS_DEFAULT, pool);
-  if (err && APR_STATUS_IS_ENOENT(err->apr_err))
+  if (shard == 0)
     {
-      svn_error_clear(err);
-      return SVN_NO_ERROR;
-    }
-  SVN_ERR(err);
+      apr_pool_t *iterpool = svn_pool_create(pool);
+      int i;
 
-  stream = svn_stream_from_aprfile2(fd, FALSE, pool);
-  *node_origins = apr_hash_make(pool);
-  SVN_ERR(svn_hash_read2(*node_origins, stream, SVN_HASH_TERMINATOR, pool));
-  return svn_stream_close(stream);
-}
+      /* Delete all files except the one for r0. */
+      for (i = 1; i < max_files_per_dir; ++i)
+        {
+          svn_pool_clear(iterpool);
 
-svn_error_t *
-svn_fs_fs__get_node_origin(const svn_fs_id_t **origin_id,
-                           svn_fs_t *fs,
-                           const char *node_id,
-                           apr_pool_t *pool)
-{
-  apr_hash_t *node_origins;
+          if (cancel_func)
+            SVN_ERR(cancel_func(cancel_baton));
 
-  *origin_id = NULL;
-  SVN_ERR(get_node_origins_from_file(fs, &node_origins,
-                                     path_node_origin(fs, node_id, pool),
-                                     pool));
-  if (node_origins)
-    {
-      svn_string_t *origin_id_str =
-        apr_hash_get(node_origins, node_id, APR_HASH_KEY_STRING);
-      if (origin_id_str)
-        *origin_id = svn_fs_fs__id_parse(origin_id_str->data,
-                                         origin_id_str->len, pool);
+          SVN_ERR(svn_io_remove_file2(svn_dirent_join(shard_path,
+                                                      apr_psprintf(iterpool,
+                                                                   "%d", i),
+                                                      iterpool),
+                                      TRUE, iterpool));
+        }
+
+      svn_pool_destroy(iterpool);
     }
+  else
+    SVN_ERR(svn_io_remove_dir2(shard_path, TRUE,
+                               cancel_func, cancel_baton, pool));
+
   return SVN_NO_ERROR;
 }
 
-
-/* Helper for svn_fs_fs__set_node_origin.  Takes a NODE_ID/NODE_REV_ID
-   pair and adds it to the NODE_ORIGINS_PATH file.  */
+/* Append OFFSET to the pack manifest STREAM, using the binary manifest
+   format if BINARY is set.  Use POOL for temporary allocations. */
 static svn_error_t *
-set_node_origins_for_file(svn_fs_t *fs,
-                          const char *node_origins_path,
-                          const char *node_id,
-                          svn_string_t *node_rev_id,
-                          apr_pool_t *pool)
+write_manifest_entry(svn_stream_t *stream,
+                     apr_off_t offset,
+                     svn_boolean_t binary,
+                     apr_pool_t *pool)
 {
-  const char *path_tmp;
-  svn_stream_t *stream;
-  apr_hash_t *origins_hash;
-  svn_string_t *old_node_rev_id;
-
-  SVN_ERR(svn_fs_fs__ensure_dir_exists(svn_dirent_join(fs->path,
-                                                       PATH_NODE_ORIGINS_DIR,
-                                                       pool),
-                                       fs->path, pool));
-
-  /* Read the previously existing origins (if any), and merge our
-     update with it. */
-  SVN_ERR(get_node_origins_from_file(fs, &origins_hash,
-                                     node_origins_path, pool));
-  if (! origins_hash)
-    origins_hash = apr_hash_make(pool);
+  unsigned char buffer[MANIFEST_ENTRY_SIZE];
+  apr_size_t len = sizeof(buffer);
 
-  old_node_rev_id = apr_hash_get(origins_hash, node_id, APR_HASH_KEY_STRING);
+  if (! binary)
+    return svn_stream_printf(stream, pool, "%" APR_OFF_T_FMT "\n", offset);
 
-  if (old_node_rev_id && !svn_string_compare(node_rev_id, old_node_rev_id))
-    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
-                             _("Node origin for '%s' exists with a different "
-                               "value (%s) than what we were about to store "
-                               "(%s)"),
-                             node_id, old_node_rev_id->data, node_rev_id->data);
+  encode_manifest_entry(buffer, offset);
+  return svn_stream_write(stream, (const char *)buffer, &len);
+}
 
-  apr_hash_set(origins_hash, node_id, APR_HASH_KEY_STRING, node_rev_id);
+/* Rewrite the textual pack manifest at PATH in the binary manifest
+   format.  Do nothing if it has been converted already, e.g. by an
+   interrupted upgrade.  MAX_FILES_PER_DIR is the shard size.  Use POOL
+   for allocations. */
+static svn_error_t *
+convert_manifest_to_binary(const char *path,
+                           int max_files_per_dir,
+                           apr_pool_t *pool)
+{
+  svn_stringbuf_t *content;
+  apr_array_header_t *manifest;
+  svn_stream_t *stream;
+  const char *tmp_path;
+  int i;
 
-  /* Sure, there's a race condition here.  Two processes could be
-     trying to add different cache elements to the same file at the
-     same time, and the entries added by the first one to write will
-     be lost.  But this is just a cache of reconstructible data, so
-     we'll accept this problem in return for not having to deal with
-     locking overhead. */
+  /* The first revision of every shard is at offset 0.  Text manifests
+     therefore start with the digit '0' and binary ones with a NUL. */
+  SVN_ERR(svn_stringbuf_from_file2(&content, path, pool));
+  if (content->len == 0 || content->data[0] != '0')
+    return SVN_NO_ERROR;
 
-  /* Create a temporary file, write out our hash, and close the file. */
-  SVN_ERR(svn_stream_open_unique(&stream, &path_tmp,
-                                 svn_dirent_dirname(node_origins_path, pool),
+  SVN_ERR(parse_text_manifest(&manifest, content, max_files_per_dir, pool));
+
+  SVN_ERR(svn_stream_open_unique(&stream, &tmp_path,
+                                 svn_dirent_dirname(path, pool),
                                  svn_io_file_del_none, pool, pool));
-  SVN_ERR(svn_hash_write2(origins_hash, stream, SVN_HASH_TERMINATOR, pool));
+  for (i = 0; i < manifest->nelts; ++i)
+    SVN_ERR(write_manifest_entry(stream, APR_ARRAY_IDX(manifest, i, apr_off_t),
+                                 TRUE, pool));
   SVN_ERR(svn_stream_close(stream));
 
-  /* Rename the temp file as the real destination */
-  return svn_io_file_rename(path_tmp, node_origins_path, pool);
+  SVN_ERR(svn_io_set_file_read_write(path, FALSE, pool));
+  SVN_ERR(move_into_place(tmp_path, path, path, pool));
+  return svn_error_trace(svn_io_set_file_read_only(path, FALSE, pool));
 }
 
+/* Reordered pack files.
+ *
+ * Instead of concatenating the revision files of a shard, a pack file may
+ * group the items of all revisions in that shard by path: first the
+ * node-revisions, property and directory representations ordered by
+ * path and, for each path, by descending revision; then the file
+ * representations in the same order, such that delta chains of the
+ * same file end up next to each other; and finally everything else,
+ * e.g. the changed path lists and trailers, in revision order.
+ *
+ * Since node-revision IDs and representation pointers contain offsets
+ * within revision files, the items are not modified but an item index
+ * maps (revision, offset) to the position within the pack file; see
+ * svn_fs_fs__get_item_offset().
+ */
 
-svn_error_t *
-svn_fs_fs__set_node_origin(svn_fs_t *fs,
-                           const char *node_id,
-                           const svn_fs_id_t *node_rev_id,
-                           apr_pool_t *pool)
+/* The sections of a reordered pack file, in the order they appear in. */
+typedef enum pack_section_t
 {
-  svn_error_t *err;
-  const char *filename = path_node_origin(fs, node_id, pool);
+  pack_section_metadata,
+  pack_section_file_reps,
+  pack_section_other
+} pack_section_t;
 
-  err = set_node_origins_for_file(fs, filename,
-                                  node_id,
-                                  svn_fs_fs__id_unparse(node_rev_id, pool),
-                                  pool);
-  if (err && APR_STATUS_IS_EACCES(err->apr_err))
-    {
-      /* It's just a cache; stop trying if I can't write. */
-      svn_error_clear(err);
-      err = NULL;
-    }
-  return svn_error_trace(err);
-}
-
-
-svn_error_t *
-svn_fs_fs__list_transactions(apr_array_header_t **names_p,
-                             svn_fs_t *fs,
-                             apr_pool_t *pool)
+/* A contiguous range of bytes in a revision file that gets moved into
+   the pack file as a whole. */
+typedef struct pack_item_t
 {
-  const char *txn_dir;
-  apr_hash_t *dirents;
-  apr_hash_index_t *hi;
-  apr_array_header_t *names;
-  apr_size_t ext_len = strlen(PATH_EXT_TXN);
+  /* Location within the revision file. */
+  svn_revnum_t revision;
+  apr_off_t offset;
+  apr_off_t size;
 
-  names = apr_array_make(pool, 1, sizeof(const char *));
+  /* Where to put the item.  PATH is NULL for pack_section_other.
+     SUB_ORDER sorts the items of the same node-revision. */
+  pack_section_t section;
+  const char *path;
+  int sub_order;
 
-  /* Get the transactions directory. */
-  txn_dir = svn_dirent_join(fs->path, PATH_TXNS_DIR, pool);
+  /* Location within the pack file, once written. */
+  apr_off_t pack_offset;
+} pack_item_t;
 
-  /* Now find a listing of this directory. */
-  SVN_ERR(svn_io_get_dirents3(&dirents, txn_dir, TRUE, pool, pool));
+/* qsort()-compatible comparison function for pack_item_t * ordering
+   them as they shall appear in a reordered pack file. */
+static int
+compare_pack_items(const void *a, const void *b)
+{
+  const pack_item_t *lhs = *(const pack_item_t * const *)a;
+  const pack_item_t *rhs = *(const pack_item_t * const *)b;
+  int diff;
 
-  /* Loop through all the entries and return anything that ends with '.txn'. */
-  for (hi = apr_hash_first(pool, dirents); hi; hi = apr_hash_next(hi))
+  if (lhs->section != rhs->section)
+    return lhs->section < rhs->section ? -1 : 1;
+
+  if (lhs->section != pack_section_other)
     {
-      const char *name = svn__apr_hash_index_key(hi);
-      apr_ssize_t klen = svn__apr_hash_index_klen(hi);
-      const char *id;
+      diff = svn_path_compare_paths(lhs->path, rhs->path);
+      if (diff)
+        return diff;
 
-      /* The name must end with ".txn" to be considered a transaction. */
-      if ((apr_size_t) klen <= ext_len
-          || (strcmp(name + klen - ext_len, PATH_EXT_TXN)) != 0)
-        continue;
+      /* Latest revisions first; they are the most likely to be read. */
+      if (lhs->revision != rhs->revision)
+        return lhs->revision > rhs->revision ? -1 : 1;
 
-      /* Truncate the ".txn" extension and store the ID. */
-      id = apr_pstrndup(pool, name, strlen(name) - ext_len);
-      APR_ARRAY_PUSH(names, const char *) = id;
+      if (lhs->sub_order != rhs->sub_order)
+        return lhs->sub_order < rhs->sub_order ? -1 : 1;
     }
+  else if (lhs->revision != rhs->revision)
+    return lhs->revision < rhs->revision ? -1 : 1;
 
-  *names_p = names;
+  if (lhs->offset != rhs->offset)
+    return lhs->offset < rhs->offset ? -1 : 1;
 
-  return SVN_NO_ERROR;
+  return 0;
 }
 
-svn_error_t *
-svn_fs_fs__open_txn(svn_fs_txn_t **txn_p,
-                    svn_fs_t *fs,
-                    const char *name,
-                    apr_pool_t *pool)
+/* qsort()-compatible comparison function for pack_item_t * ordering
+   them by their offset within the revision file. */
+static int
+compare_pack_item_offsets(const void *a, const void *b)
 {
-  svn_fs_txn_t *txn;
-  svn_node_kind_t kind;
-  transaction_t *local_txn;
+  const pack_item_t *lhs = *(const pack_item_t * const *)a;
+  const pack_item_t *rhs = *(const pack_item_t * const *)b;
 
-  /* First check to see if the directory exists. */
-  SVN_ERR(svn_io_check_path(path_txn_dir(fs, name, pool), &kind, pool));
+  if (lhs->offset != rhs->offset)
+    return lhs->offset < rhs->offset ? -1 : 1;
 
-  /* Did we find it? */
-  if (kind != svn_node_dir)
-    return svn_error_createf(SVN_ERR_FS_NO_SUCH_TRANSACTION, NULL,
-                             _("No such transaction '%s'"),
-                             name);
+  return 0;
+}
 
-  txn = apr_pcalloc(pool, sizeof(*txn));
+/* Append a new pack_item_t for the byte range [OFFSET, OFFSET + SIZE)
+   of revision REV to ITEMS, putting it into SECTION with PATH and
+   SUB_ORDER.  Allocate the item in POOL. */
+static void
+add_pack_item(apr_array_header_t *items,
+              svn_revnum_t rev,
+              apr_off_t offset,
+              apr_off_t size,
+              pack_section_t section,
+              const char *path,
+              int sub_order,
+              apr_pool_t *pool)
+{
+  pack_item_t *item = apr_pcalloc(pool, sizeof(*item));
 
-  /* Read in the root node of this transaction. */
-  txn->id = apr_pstrdup(pool, name);
-  txn->fs = fs;
+  item->revision = rev;
+  item->offset = offset;
+  item->size = size;
+  item->section = section;
+  item->path = path ? apr_pstrdup(pool, path) : NULL;
+  item->sub_order = sub_order;
 
-  SVN_ERR(svn_fs_fs__get_txn(&local_txn, fs, name, pool));
+  APR_ARRAY_PUSH(items, pack_item_t *) = item;
+}
 
-  txn->base_rev = svn_fs_fs__id_rev(local_txn->base_id);
+/* Add the representation REP of the node-revision at PATH in revision
+   REV, read from REV_FILE, to ITEMS as described for add_pack_item(),
+   unless it is stored in a different revision.  If ENTRIES is not NULL
+   and REP is a PLAIN representation, read it as directory contents into
+   *ENTRIES; otherwise, set *ENTRIES to NULL.  Allocate the item in
+   RESULT_POOL and everything else in SCRATCH_POOL. */
+static svn_error_t *
+add_pack_rep_item(apr_hash_t **entries,
+                  apr_array_header_t *items,
+                  apr_file_t *rev_file,
+                  svn_revnum_t rev,
+                  representation_t *rep,
+                  pack_section_t section,
+                  const char *path,
+                  int sub_order,
+                  apr_pool_t *result_pool,
+                  apr_pool_t *scratch_pool)
+{
+  struct rep_args *ra;
+  apr_off_t offset = rep->offset;
+  char trailer[7];
 
-  txn->vtable = &txn_vtable;
-  *txn_p = txn;
+  if (entries)
+    *entries = NULL;
 
-  return SVN_NO_ERROR;
-}
+  if (rep->revision != rev)
+    return SVN_NO_ERROR;
 
-svn_error_t *
-svn_fs_fs__txn_proplist(apr_hash_t **table_p,
-                        svn_fs_txn_t *txn,
-                        apr_pool_t *pool)
-{
-  apr_hash_t *proplist = apr_hash_make(pool);
-  SVN_ERR(get_txn_proplist(proplist, txn->fs, txn->id, pool));
-  *table_p = proplist;
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, scratch_pool));
+  SVN_ERR(read_rep_line(&ra, rev_file, scratch_pool));
+
+  /* The data follows the header line. */
+  offset = 0;
+  SVN_ERR(svn_io_file_seek(rev_file, APR_CUR, &offset, scratch_pool));
+  offset += rep->size;
+
+  /* Read directory contents while we are here. */
+  if (entries && ! ra->is_delta)
+    {
+      struct recover_read_from_file_baton baton;
+      svn_stream_t *stream;
+
+      baton.file = rev_file;
+      baton.pool = scratch_pool;
+      baton.remaining = rep->size;
+      stream = svn_stream_create(&baton, scratch_pool);
+      svn_stream_set_read(stream, read_handler_recover);
+
+      *entries = apr_hash_make(scratch_pool);
+      SVN_ERR(svn_hash_read2(*entries, stream, SVN_HASH_TERMINATOR,
+                             scratch_pool));
+    }
+
+  /* Make sure that we got the extent of the representation right. */
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, scratch_pool));
+  SVN_ERR(svn_io_file_read_full2(rev_file, trailer, sizeof(trailer), NULL,
+                                 NULL, scratch_pool));
+  if (memcmp(trailer, "ENDREP\n", sizeof(trailer)) != 0)
+    return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                             _("Representation at offset %" APR_OFF_T_FMT
+                               " in revision %ld lacks ENDREP"),
+                             rep->offset, rev);
+
+  add_pack_item(items, rev, rep->offset,
+                offset + sizeof(trailer) - rep->offset,
+                section, path, sub_order, result_pool);
 
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__delete_node_revision(svn_fs_t *fs,
-                                const svn_fs_id_t *id,
-                                apr_pool_t *pool)
+/* Add the node-revision at OFFSET in REV_FILE, the revision file of REV,
+   plus all representations and node-revisions of its subtree that are
+   stored in the same revision to ITEMS.  Allocate the items in
+   RESULT_POOL and use SCRATCH_POOL for temporary allocations. */
+static svn_error_t *
+add_pack_noderev_items(apr_array_header_t *items,
+                       apr_file_t *rev_file,
+                       svn_revnum_t rev,
+                       apr_off_t offset,
+                       apr_pool_t *result_pool,
+                       apr_pool_t *scratch_pool)
 {
+  svn_stringbuf_t *block = svn_stringbuf_create_empty(scratch_pool);
   node_revision_t *noderev;
+  apr_hash_t *entries;
+  apr_hash_index_t *hi;
+  apr_pool_t *iterpool;
+  const char *end = NULL;
+  apr_off_t pos = offset;
 
-  SVN_ERR(svn_fs_fs__get_node_revision(&noderev, fs, id, pool));
-
-  /* Delete any mutable property representation. */
-  if (noderev->prop_rep && noderev->prop_rep->txn_id)
-    SVN_ERR(svn_io_remove_file2(path_txn_node_props(fs, id, pool), FALSE,
-                                pool));
-
-  /* Delete any mutable data representation. */
-  if (noderev->data_rep && noderev->data_rep->txn_id
-      && noderev->kind == svn_node_dir)
+  /* A node-revision is a header block terminated by an empty line. */
+  SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &pos, scratch_pool));
+  while (end == NULL)
     {
-      fs_fs_data_t *ffd = fs->fsap_data;
-      SVN_ERR(svn_io_remove_file2(path_txn_node_children(fs, id, pool), FALSE,
-                                  pool));
+      char buffer[1024];
+      apr_size_t len = sizeof(buffer);
+      svn_boolean_t eof;
 
-      /* remove the corresponding entry from the cache, if such exists */
-      if (ffd->txn_dir_cache)
-        {
-          const char *key = svn_fs_fs__id_unparse(id, pool)->data;
-          SVN_ERR(svn_cache__set(ffd->txn_dir_cache, key, NULL, pool));
-        }
+      SVN_ERR(svn_io_file_read_full2(rev_file, buffer, len, &len, &eof,
+                                     scratch_pool));
+      svn_stringbuf_appendbytes(block, buffer, len);
+      end = strstr(block->data, "\n\n");
+      if (end == NULL && eof)
+        return svn_error_createf(SVN_ERR_FS_CORRUPT, NULL,
+                                 _("Unterminated node-revision at offset %"
+                                   APR_OFF_T_FMT " in revision %ld"),
+                                 offset, rev);
     }
 
-  return svn_io_remove_file2(path_txn_node_rev(fs, id, pool), FALSE, pool);
-}
+  svn_stringbuf_chop(block, block->len - (end + 2 - block->data));
+  SVN_ERR(svn_fs_fs__read_noderev(&noderev,
+                                  svn_stream_from_stringbuf(block,
+                                                            scratch_pool),
+                                  scratch_pool));
 
+  add_pack_item(items, rev, offset, block->len, pack_section_metadata,
+                noderev->created_path, 0, result_pool);
 
-
-/*** Revisions ***/
+  if (noderev->prop_rep)
+    SVN_ERR(add_pack_rep_item(NULL, items, rev_file, rev, noderev->prop_rep,
+                              pack_section_metadata, noderev->created_path,
+                              1, result_pool, scratch_pool));
 
-svn_error_t *
-svn_fs_fs__revision_prop(svn_string_t **value_p,
-                         svn_fs_t *fs,
-                         svn_revnum_t rev,
-                         const char *propname,
-                         apr_pool_t *pool)
-{
-  apr_hash_t *table;
+  if (noderev->data_rep && noderev->kind == svn_node_file)
+    SVN_ERR(add_pack_rep_item(NULL, items, rev_file, rev, noderev->data_rep,
+                              pack_section_file_reps, noderev->created_path,
+                              0, result_pool, scratch_pool));
 
-  SVN_ERR(svn_fs__check_fs(fs, TRUE));
-  SVN_ERR(svn_fs_fs__revision_proplist(&table, fs, rev, pool));
+  if (noderev->data_rep == NULL || noderev->kind != svn_node_dir)
+    return SVN_NO_ERROR;
 
-  *value_p = apr_hash_get(table, propname, APR_HASH_KEY_STRING);
+  SVN_ERR(add_pack_rep_item(&entries, items, rev_file, rev,
+                            noderev->data_rep, pack_section_metadata,
+                            noderev->created_path, 2,
+                            result_pool, scratch_pool));
 
-  return SVN_NO_ERROR;
-}
+  /* Deltified directories are unusual.  Leave their children to
+     be added as unspecific data. */
+  if (entries == NULL)
+    return SVN_NO_ERROR;
 
+  /* Recurse into the nodes that got changed in this revision. */
+  iterpool = svn_pool_create(scratch_pool);
+  for (hi = apr_hash_first(scratch_pool, entries); hi; hi = apr_hash_next(hi))
+    {
+      const svn_string_t *entry = svn__apr_hash_index_val(hi);
+      char *str_val;
+      char *str;
+      const svn_fs_id_t *id;
 
-/* Baton used for change_rev_prop_body below. */
-struct change_rev_prop_baton {
-  svn_fs_t *fs;
-  svn_revnum_t rev;
-  const char *name;
-  const svn_string_t *const *old_value_p;
-  const svn_string_t *value;
-};
+      svn_pool_clear(iterpool);
 
-/* The work-horse for svn_fs_fs__change_rev_prop, called with the FS
-   write lock.  This implements the svn_fs_fs__with_write_lock()
-   'body' callback type.  BATON is a 'struct change_rev_prop_baton *'. */
-static svn_error_t *
-change_rev_prop_body(void *baton, apr_pool_t *pool)
-{
-  struct change_rev_prop_baton *cb = baton;
-  apr_hash_t *table;
+      str_val = apr_pstrdup(iterpool, entry->data);
+      str = svn_cstring_tokenize(" ", &str_val);
+      if (str)
+        str = svn_cstring_tokenize(" ", &str_val);
+      if (str == NULL)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Directory entry corrupt"));
 
-  SVN_ERR(svn_fs_fs__revision_proplist(&table, cb->fs, cb->rev, pool));
+      id = svn_fs_fs__id_parse(str, strlen(str), iterpool);
+      if (id == NULL)
+        return svn_error_create(SVN_ERR_FS_CORRUPT, NULL,
+                                _("Directory entry corrupt"));
 
-  if (cb->old_value_p)
-    {
-      const svn_string_t *wanted_value = *cb->old_value_p;
-      const svn_string_t *present_value = apr_hash_get(table, cb->name,
-                                                       APR_HASH_KEY_STRING);
-      if ((!wanted_value != !present_value)
-          || (wanted_value && present_value
-              && !svn_string_compare(wanted_value, present_value)))
-        {
-          /* What we expected isn't what we found. */
-          return svn_error_createf(SVN_ERR_FS_PROP_BASEVALUE_MISMATCH, NULL,
-                                   _("revprop '%s' has unexpected value in "
-                                     "filesystem"),
-                                   cb->name);
-        }
-      /* Fall through. */
+      if (svn_fs_fs__id_rev(id) == rev)
+        SVN_ERR(add_pack_noderev_items(items, rev_file, rev,
+                                       svn_fs_fs__id_offset(id),
+                                       result_pool, iterpool));
     }
-  apr_hash_set(table, cb->name, APR_HASH_KEY_STRING, cb->value);
+  svn_pool_destroy(iterpool);
 
-  return set_revision_proplist(cb->fs, cb->rev, table, pool);
+  return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__change_rev_prop(svn_fs_t *fs,
-                           svn_revnum_t rev,
-                           const char *name,
-                           const svn_string_t *const *old_value_p,
-                           const svn_string_t *value,
-                           apr_pool_t *pool)
-{
-  struct change_rev_prop_baton cb;
-
-  SVN_ERR(svn_fs__check_fs(fs, TRUE));
-
-  cb.fs = fs;
-  cb.rev = rev;
-  cb.name = name;
-  cb.old_value_p = old_value_p;
-  cb.value = value;
+/* Split revision REV, stored in the revision file at PATH, into items
+   and return them in *ITEMS, sorted by offset and covering the whole
+   file without gaps.  Allocate *ITEMS in RESULT_POOL and use
+   SCRATCH_POOL for temporary allocations. */
+static svn_error_t *
+get_pack_items(apr_array_header_t **items,
+               const char *path,
+               svn_revnum_t rev,
+               apr_pool_t *result_pool,
+               apr_pool_t *scratch_pool)
+{
+  apr_array_header_t *found = apr_array_make(scratch_pool, 16,
+                                             sizeof(pack_item_t *));
+  apr_file_t *rev_file;
+  apr_off_t size = 0, root_offset, changes_offset, next_offset;
+  svn_boolean_t analyzed;
+  svn_error_t *err;
+  int i;
 
-  return svn_fs_fs__with_write_lock(fs, change_rev_prop_body, &cb, pool);
-}
+  SVN_ERR(svn_io_file_open(&rev_file, path, APR_READ | APR_BUFFERED,
+                           APR_OS_DEFAULT, scratch_pool));
+  SVN_ERR(svn_io_file_seek(rev_file, APR_END, &size, scratch_pool));
+  SVN_ERR(read_revision_trailer(&root_offset, &changes_offset, rev_file,
+                                size, rev, scratch_pool));
 
+  /* Node-revisions and representations.  Revisions that we fail to
+     analyze are still valid.  Just keep them as they are. */
+  err = add_pack_noderev_items(found, rev_file, rev, root_offset,
+                               scratch_pool, scratch_pool);
+  if (err && err->apr_err != SVN_ERR_FS_CORRUPT)
+    return svn_error_compose_create(err,
+                                    svn_io_file_close(rev_file,
+                                                      scratch_pool));
 
-
-/*** Transactions ***/
+  analyzed = (err == SVN_NO_ERROR);
+  svn_error_clear(err);
+  SVN_ERR(svn_io_file_close(rev_file, scratch_pool));
 
-svn_error_t *
-svn_fs_fs__get_txn_ids(const svn_fs_id_t **root_id_p,
-                       const svn_fs_id_t **base_root_id_p,
-                       svn_fs_t *fs,
-                       const char *txn_name,
-                       apr_pool_t *pool)
-{
-  transaction_t *txn;
-  SVN_ERR(svn_fs_fs__get_txn(&txn, fs, txn_name, pool));
-  *root_id_p = txn->root_id;
-  *base_root_id_p = txn->base_id;
-  return SVN_NO_ERROR;
-}
+  if (analyzed)
+    {
+      /* The changed paths list is followed by the trailer. */
+      add_pack_item(found, rev, changes_offset, size - changes_offset,
+                    pack_section_other, NULL, 0, scratch_pool);
+      qsort(found->elts, found->nelts, found->elt_size,
+            compare_pack_item_offsets);
+    }
 
-
-/* Generic transaction operations.  */
+  /* Fill the gaps and drop shared representations. */
+  *items = apr_array_make(result_pool, found->nelts * 2 + 1,
+                          sizeof(pack_item_t *));
+  for (next_offset = 0, i = 0; analyzed && i < found->nelts; ++i)
+    {
+      pack_item_t *item = APR_ARRAY_IDX(found, i, pack_item_t *);
 
-svn_error_t *
-svn_fs_fs__txn_prop(svn_string_t **value_p,
-                    svn_fs_txn_t *txn,
-                    const char *propname,
-                    apr_pool_t *pool)
-{
-  apr_hash_t *table;
-  svn_fs_t *fs = txn->fs;
+      if (item->offset < next_offset)
+        {
+          const pack_item_t *last
+            = APR_ARRAY_IDX(*items, (*items)->nelts - 1, pack_item_t *);
 
-  SVN_ERR(svn_fs__check_fs(fs, TRUE));
-  SVN_ERR(svn_fs_fs__txn_proplist(&table, txn, pool));
+          /* The same representation used by multiple nodes. */
+          if (item->offset == last->offset && item->size == last->size)
+            continue;
 
-  *value_p = apr_hash_get(table, propname, APR_HASH_KEY_STRING);
+          /* Overlapping items.  Don't reorder this revision at all. */
+          break;
+        }
+
+      if (item->offset > next_offset)
+        add_pack_item(*items, rev, next_offset, item->offset - next_offset,
+                      pack_section_other, NULL, 0, result_pool);
+
+      add_pack_item(*items, rev, item->offset, item->size, item->section,
+                    item->path, item->sub_order, result_pool);
+      next_offset = item->offset + item->size;
+    }
+
+  if (! analyzed || i < found->nelts || next_offset != size)
+    {
+      apr_array_clear(*items);
+      add_pack_item(*items, rev, 0, size, pack_section_other, NULL, 0,
+                    result_pool);
+    }
 
   return SVN_NO_ERROR;
 }
 
-svn_error_t *
-svn_fs_fs__begin_txn(svn_fs_txn_t **txn_p,
-                     svn_fs_t *fs,
-                     svn_revnum_t rev,
-                     apr_uint32_t flags,
+/* Write the revisions of the shard starting at START_REV with
+   MAX_FILES_PER_DIR revision files in SHARD_PATH to PACK_STREAM in the
+   reordered layout described above.  Write the pack file offsets of the
+   start of each revision to the binary MANIFEST_STREAM and the item
+   index to a new file at INDEX_PATH.  CANCEL_FUNC and CANCEL_BATON are
+   what you think they are.  Use POOL for allocations. */
+static svn_error_t *
+write_reordered_pack(svn_stream_t *pack_stream,
+                     svn_stream_t *manifest_stream,
+                     const char *index_path,
+                     const char *shard_path,
+                     svn_revnum_t start_rev,
+                     int max_files_per_dir,
+                     svn_cancel_func_t cancel_func,
+                     void *cancel_baton,
                      apr_pool_t *pool)
 {
-  svn_string_t date;
-  svn_prop_t prop;
-  apr_array_header_t *props = apr_array_make(pool, 3, sizeof(svn_prop_t));
+  apr_array_header_t **rev_items = apr_palloc(pool, max_files_per_dir
+                                                      * sizeof(*rev_items));
+  apr_array_header_t *items = apr_array_make(pool, max_files_per_dir * 16,
+                                             sizeof(pack_item_t *));
+  apr_pool_t *iterpool = svn_pool_create(pool);
+  svn_stream_t *index_stream;
+  apr_file_t *rev_file = NULL;
+  svn_revnum_t file_rev = SVN_INVALID_REVNUM;
+  apr_off_t next_offset = 0, entry;
+  char *buffer = apr_palloc(pool, SVN__STREAM_CHUNK_SIZE);
+  int i, k;
 
-  SVN_ERR(svn_fs__check_fs(fs, TRUE));
+  /* Collect the items of all revisions. */
+  for (i = 0; i < max_files_per_dir; ++i)
+    {
+      svn_revnum_t rev = start_rev + i;
 
-  SVN_ERR(svn_fs_fs__create_txn(txn_p, fs, rev, pool));
+      svn_pool_clear(iterpool);
+      if (cancel_func)
+        SVN_ERR(cancel_func(cancel_baton));
 
-  /* Put a datestamp on the newly created txn, so we always know
-     exactly how old it is.  (This will help sysadmins identify
-     long-abandoned txns that may need to be manually removed.)  When
-     a txn is promoted to a revision, this property will be
-     automatically overwritten with a revision datestamp. */
-  date.data = svn_time_to_cstring(apr_time_now(), pool);
-  date.len = strlen(date.data);
+      SVN_ERR(get_pack_items(&rev_items[i],
+                             svn_dirent_join(shard_path,
+                                             apr_psprintf(iterpool, "%ld",
+                                                          rev),
+                                             iterpool),
+                             rev, pool, iterpool));
+      apr_array_cat(items, rev_items[i]);
+    }
 
-  prop.name = SVN_PROP_REVISION_DATE;
-  prop.value = &date;
-  APR_ARRAY_PUSH(props, svn_prop_t) = prop;
+  qsort(items->elts, items->nelts, items->elt_size, compare_pack_items);
 
-  /* Set temporary txn props that represent the requested 'flags'
-     behaviors. */
-  if (flags & SVN_FS_TXN_CHECK_OOD)
+  /* Copy them to the pack file in their new order. */
+  for (i = 0; i < items->nelts; ++i)
     {
-      prop.name = SVN_FS__PROP_TXN_CHECK_OOD;
-      prop.value = svn_string_create("true", pool);
-      APR_ARRAY_PUSH(props, svn_prop_t) = prop;
+      pack_item_t *item = APR_ARRAY_IDX(items, i, pack_item_t *);
+      apr_off_t offset = item->offset;
+      apr_off_t remaining = item->size;
+
+      if (cancel_func)
+        SVN_ERR(cancel_func(cancel_baton));
+
+      if (item->revision != file_rev)
+        {
+          svn_pool_clear(iterpool);
+          SVN_ERR(svn_io_file_open(&rev_file,
+                                   svn_dirent_join(shard_path,
+                                                   apr_psprintf(iterpool,
+                                                                "%ld",
+                                                                item->revision),
+                                                   iterpool),
+                                   APR_READ | APR_BUFFERED, APR_OS_DEFAULT,
+                                   iterpool));
+          file_rev = item->revision;
+        }
+
+      SVN_ERR(svn_io_file_seek(rev_file, APR_SET, &offset, iterpool));
+      while (remaining > 0)
+        {
+          apr_size_t len = (apr_size_t)MIN(remaining, SVN__STREAM_CHUNK_SIZE);
+
+          SVN_ERR(svn_io_file_read_full2(rev_file, buffer, len, NULL, NULL,
+                                         iterpool));
+          SVN_ERR(svn_stream_write(pack_stream, buffer, &len));
+          remaining -= len;
+        }
+
+      item->pack_offset = next_offset;
+      next_offset += item->size;
     }
+  svn_pool_destroy(iterpool);
 
-  if (flags & SVN_FS_TXN_CHECK_LOCKS)
+  /* Write the manifest and the item index. */
+  SVN_ERR(svn_stream_open_writable(&index_stream, index_path, pool, pool));
+  SVN_ERR(write_manifest_entry(index_stream, max_files_per_dir, TRUE, pool));
+  for (i = 0, entry = 0; i <= max_files_per_dir; ++i)
     {
-      prop.name = SVN_FS__PROP_TXN_CHECK_LOCKS;
-      prop.value = svn_string_create("true", pool);
-      APR_ARRAY_PUSH(props, svn_prop_t) = prop;
+      SVN_ERR(write_manifest_entry(index_stream, entry, TRUE, pool));
+      if (i < max_files_per_dir)
+        entry += rev_items[i]->nelts + 1;
     }
 
-  return svn_fs_fs__change_txn_props(*txn_p, props, pool);
-}
+  for (i = 0; i < max_files_per_dir; ++i)
+    {
+      pack_item_t *item = NULL;
 
-
-/****** Packing FSFS shards *********/
+      SVN_ERR(write_manifest_entry(manifest_stream,
+                                   APR_ARRAY_IDX(rev_items[i], 0,
+                                                 pack_item_t *)->pack_offset,
+                                   TRUE, pool));
 
-/* Write a file FILENAME in directory FS_PATH, containing a single line
- * with the number REVNUM in ASCII decimal.  Move the file into place
- * atomically, overwriting any existing file.
- *
- * Similar to write_current(). */
-static svn_error_t *
-write_revnum_file(const char *fs_path,
-                  const char *filename,
-                  svn_revnum_t revnum,
-                  apr_pool_t *scratch_pool)
-{
-  const char *final_path, *tmp_path;
-  svn_stream_t *tmp_stream;
+      for (k = 0; k < rev_items[i]->nelts; ++k)
+        {
+          item = APR_ARRAY_IDX(rev_items[i], k, pack_item_t *);
+          SVN_ERR(write_manifest_entry(index_stream, item->offset, TRUE,
+                                       pool));
+          SVN_ERR(write_manifest_entry(index_stream, item->pack_offset, TRUE,
+                                       pool));
+        }
 
-  final_path = svn_dirent_join(fs_path, filename, scratch_pool);
-  SVN_ERR(svn_stream_open_unique(&tmp_stream, &tmp_path, fs_path,
-                                   svn_io_file_del_none,
-                                   scratch_pool, scratch_pool));
-  SVN_ERR(svn_stream_printf(tmp_stream, scratch_pool, "%ld\n", revnum));
-  SVN_ERR(svn_stream_close(tmp_stream));
-  SVN_ERR(move_into_place(tmp_path, final_path, final_path, scratch_pool));
-  return SVN_NO_ERROR;
+      /* The end of the revision. */
+      SVN_ERR(write_manifest_entry(index_stream, item->offset + item->size,
+                                   TRUE, pool));
+      SVN_ERR(write_manifest_entry(index_stream,
+                                   item->pack_offset + item->size,
+                                   TRUE, pool));
+    }
+
+  return svn_stream_close(index_stream);
 }
 
-/* Pack a single shard SHARD in REVS_DIR, using POOL for allocations.
+/* Pack the revision files of shard SHARD in REVS_DIR into a pack file
+   and a manifest, using POOL for allocations.  FORMAT is the format of
+   the filesystem.  If REORDER_ITEMS is set and FORMAT supports it,
+   group the items in the pack file by path and write an item index.
+   If REVSPROPS_DIR is not NULL, pack the revprops of
+   that shard into pack files of at most REVPROP_PACK_SIZE bytes as well,
+   notifying NOTIFY_FUNC with NOTIFY_BATON (if not NULL) about it.
    CANCEL_FUNC and CANCEL_BATON are what you think they are.
 
+   This leaves the shard directories and the min-unpacked-rev file
+   alone; see finish_packed_shard().  Since it touches nothing but the
+   files of SHARD, it may be run concurrently for different shards.
+
    If for some reason we detect a partial packing already performed, we
    remove the pack file and start again. */
 static svn_error_t *
-pack_shard(const char *revs_dir,
-           const char *fs_path,
-           apr_int64_t shard,
-           int max_files_per_dir,
-           svn_fs_pack_notify_t notify_func,
-           void *notify_baton,
-           svn_cancel_func_t cancel_func,
-           void *cancel_baton,
-           apr_pool_t *pool)
+pack_shard_files(const char *revs_dir,
+                 const char *revsprops_dir,
+                 int format,
+                 apr_int64_t shard,
+                 int max_files_per_dir,
+                 apr_int64_t revprop_pack_size,
+                 svn_boolean_t reorder_items,
+                 svn_fs_pack_notify_t notify_func,
+                 void *notify_baton,
+                 svn_cancel_func_t cancel_func,
+                 void *cancel_baton,
+                 apr_pool_t *pool)
 {
   const char *pack_file_path, *manifest_file_path, *shard_path;
+  const char *index_file_path = NULL;
   const char *pack_file_dir;
   svn_stream_t *pack_stream, *manifest_stream;
   svn_revnum_t start_rev, end_rev, rev;
@@ -7720,11 +10083,6 @@ pack_shard(const char *revs_dir,
                                apr_psprintf(pool, "%" APR_INT64_T_FMT, shard),
                                pool);
 
-  /* Notify caller we're starting to pack this shard. */
-  if (notify_func)
-    SVN_ERR(notify_func(notify_baton, shard, svn_fs_pack_notify_start,
-                        pool));
-
   /* Remove any existing pack file for this shard, since it is incomplete. */
   SVN_ERR(svn_io_remove_dir2(pack_file_dir, TRUE, cancel_func, cancel_baton,
                              pool));
@@ -7741,8 +10099,17 @@ pack_shard(const char *revs_dir,
   next_offset = 0;
   iterpool = svn_pool_create(pool);
 
+  if (reorder_items && format >= SVN_FS_FS__MIN_PACK_ITEM_INDEX_FORMAT)
+    {
+      index_file_path = svn_dirent_join(pack_file_dir, PATH_ITEM_INDEX, pool);
+      SVN_ERR(write_reordered_pack(pack_stream, manifest_stream,
+                                   index_file_path, shard_path, start_rev,
+                                   max_files_per_dir,
+                                   cancel_func, cancel_baton, iterpool));
+    }
+
   /* Iterate over the revisions in this shard, squashing them together. */
-  for (rev = start_rev; rev <= end_rev; rev++)
+  for (rev = start_rev; !index_file_path && rev <= end_rev; rev++)
     {
       svn_stream_t *rev_stream;
       apr_finfo_t finfo;
@@ -7756,8 +10123,10 @@ pack_shard(const char *revs_dir,
       SVN_ERR(svn_io_stat(&finfo, path, APR_FINFO_SIZE, iterpool));
 
       /* Update the manifest. */
-      SVN_ERR(svn_stream_printf(manifest_stream, iterpool, "%" APR_OFF_T_FMT
-                                "\n", next_offset));
+      SVN_ERR(write_manifest_entry(manifest_stream, next_offset,
+                                   format
+                                     >= SVN_FS_FS__MIN_BINARY_MANIFEST_FORMAT,
+                                   iterpool));
       next_offset += finfo.size;
 
       /* Copy all the bits from the rev file to the end of the pack file. */
@@ -7766,26 +10135,116 @@ pack_shard(const char *revs_dir,
                                                              iterpool),
                           cancel_func, cancel_baton, iterpool));
     }
+  svn_pool_destroy(iterpool);
 
   SVN_ERR(svn_stream_close(manifest_stream));
   SVN_ERR(svn_stream_close(pack_stream));
   SVN_ERR(svn_io_copy_perms(shard_path, pack_file_dir, pool));
   SVN_ERR(svn_io_set_file_read_only(pack_file_path, FALSE, pool));
   SVN_ERR(svn_io_set_file_read_only(manifest_file_path, FALSE, pool));
+  if (index_file_path)
+    SVN_ERR(svn_io_set_file_read_only(index_file_path, FALSE, pool));
+
+  /* Pack the revprops of this shard. */
+  if (revsprops_dir)
+    {
+      if (notify_func)
+        SVN_ERR(notify_func(notify_baton, shard,
+                            svn_fs_pack_notify_start_revprop, pool));
+
+      SVN_ERR(pack_revprops_shard(
+                  svn_dirent_join(revsprops_dir,
+                                  apr_psprintf(pool,
+                                               "%" APR_INT64_T_FMT ".pack",
+                                               shard),
+                                  pool),
+                  svn_dirent_join(revsprops_dir,
+                                  apr_psprintf(pool, "%" APR_INT64_T_FMT,
+                                               shard),
+                                  pool),
+                  shard, max_files_per_dir, revprop_pack_size,
+                  cancel_func, cancel_baton, pool));
+
+      if (notify_func)
+        SVN_ERR(notify_func(notify_baton, shard,
+                            svn_fs_pack_notify_end_revprop, pool));
+    }
+
+  return SVN_NO_ERROR;
+}
+
+/* Make the shard SHARD, whose pack files have been written by
+   pack_shard_files(), the packed representation of its revisions:
+   bump the min-unpacked-rev file of the filesystem at FS_PATH past
+   SHARD and remove the shard directories from REVS_DIR and, if not
+   NULL, REVSPROPS_DIR.  All shards before SHARD must have been packed
+   already.  Use POOL for allocations. */
+static svn_error_t *
+finish_packed_shard(const char *revs_dir,
+                    const char *revsprops_dir,
+                    const char *fs_path,
+                    apr_int64_t shard,
+                    int max_files_per_dir,
+                    svn_cancel_func_t cancel_func,
+                    void *cancel_baton,
+                    apr_pool_t *pool)
+{
+  const char *shard_name = apr_psprintf(pool, "%" APR_INT64_T_FMT, shard);
 
   /* Update the min-unpacked-rev file to reflect our newly packed shard.
    * (This doesn't update ffd->min_unpacked_rev.  That will be updated by
    * update_min_unpacked_rev() when necessary.) */
   SVN_ERR(write_revnum_file(fs_path, PATH_MIN_UNPACKED_REV,
                             (svn_revnum_t)((shard + 1) * max_files_per_dir),
-                            iterpool));
-  svn_pool_destroy(iterpool);
+                            pool));
 
-  /* Finally, remove the existing shard directory. */
-  SVN_ERR(svn_io_remove_dir2(shard_path, TRUE, cancel_func, cancel_baton,
-                             pool));
+  /* Finally, remove the existing shard directories. */
+  SVN_ERR(svn_io_remove_dir2(svn_dirent_join(revs_dir, shard_name, pool),
+                             TRUE, cancel_func, cancel_baton, pool));
+  if (revsprops_dir)
+    SVN_ERR(delete_revprops_shard(svn_dirent_join(revsprops_dir, shard_name,
+                                                  pool),
+                                  shard, max_files_per_dir,
+                                  cancel_func, cancel_baton, pool));
+
+  return SVN_NO_ERROR;
+}
 
+/* Pack a single shard SHARD in REVS_DIR, using POOL for allocations.
+   FORMAT is the format of the filesystem at FS_PATH.
+   REORDER_ITEMS is passed through to pack_shard_files().
+   If REVSPROPS_DIR is not NULL, pack the revprops of that shard into
+   pack files of at most REVPROP_PACK_SIZE bytes as well.
+   CANCEL_FUNC and CANCEL_BATON are what you think they are. */
+static svn_error_t *
+pack_shard(const char *revs_dir,
+           const char *revsprops_dir,
+           const char *fs_path,
+           int format,
+           apr_int64_t shard,
+           int max_files_per_dir,
+           apr_int64_t revprop_pack_size,
+           svn_boolean_t reorder_items,
+           svn_fs_pack_notify_t notify_func,
+           void *notify_baton,
+           svn_cancel_func_t cancel_func,
+           void *cancel_baton,
+           apr_pool_t *pool)
+{
   /* Notify caller we're starting to pack this shard. */
+  if (notify_func)
+    SVN_ERR(notify_func(notify_baton, shard, svn_fs_pack_notify_start,
+                        pool));
+
+  SVN_ERR(pack_shard_files(revs_dir, revsprops_dir, format, shard,
+                           max_files_per_dir, revprop_pack_size,
+                           reorder_items, notify_func, notify_baton,
+                           cancel_func, cancel_baton, pool));
+  SVN_ERR(finish_packed_shard(revs_dir, revsprops_dir, fs_path, shard,
+                              max_files_per_dir, cancel_func, cancel_baton,
+                              pool));
+
+  /* Notify caller we're done packing this shard. */
   if (notify_func)
     SVN_ERR(notify_func(notify_baton, shard, svn_fs_pack_notify_end,
                         pool));
@@ -7793,6 +10252,192 @@ pack_shard(const char *revs_dir,
   return SVN_NO_ERROR;
 }
 
+#if APR_HAS_THREADS
+/* The work of a single pack_shard_thread(). */
+typedef struct pack_shard_job_t
+{
+  /* Parameters to pack_shard_files(). */
+  const char *revs_dir;
+  const char *revsprops_dir;
+  int format;
+  apr_int64_t shard;
+  int max_files_per_dir;
+  apr_int64_t revprop_pack_size;
+  svn_boolean_t reorder_items;
+  svn_cancel_func_t cancel_func;
+  void *cancel_baton;
+
+  /* Pool used by the thread only.  It comes with an allocator of its
+     own because pools sharing an allocator must not be used from
+     different threads. */
+  apr_pool_t *pool;
+
+  /* The outcome of pack_shard_files(). */
+  svn_error_t *err;
+} pack_shard_job_t;
+
+/* Thread function running pack_shard_files() for the pack_shard_job_t
+   in DATA. */
+static void * APR_THREAD_FUNC
+pack_shard_thread(apr_thread_t *tid, void *data)
+{
+  pack_shard_job_t *job = data;
+
+  job->err = pack_shard_files(job->revs_dir, job->revsprops_dir,
+                              job->format, job->shard,
+                              job->max_files_per_dir, job->revprop_pack_size,
+                              job->reorder_items, NULL, NULL,
+                              job->cancel_func, job->cancel_baton,
+                              job->pool);
+  return NULL;
+}
+
+/* Pack the shards FIRST_SHARD up to but not including END_SHARD like
+   pack_shard() does, but have up to THREAD_COUNT threads write the pack
+   files of different shards at the same time.  The remaining
+   parameters are the same as for pack_shard().
+
+   The shards are processed in batches of THREAD_COUNT.  Once all pack
+   files of a batch have been written, the shards get finished in order,
+   i.e. the min-unpacked-rev bumps remain serialized.  If packing a
+   shard failed, the preceding shards of the batch will still be
+   finished.  Notifications are sent from the calling thread, in the
+   same order as for the sequential case. */
+static svn_error_t *
+pack_shards_concurrently(const char *revs_dir,
+                         const char *revsprops_dir,
+                         const char *fs_path,
+                         int format,
+                         apr_int64_t first_shard,
+                         apr_int64_t end_shard,
+                         int max_files_per_dir,
+                         apr_int64_t revprop_pack_size,
+                         svn_boolean_t reorder_items,
+                         int thread_count,
+                         svn_fs_pack_notify_t notify_func,
+                         void *notify_baton,
+                         svn_cancel_func_t cancel_func,
+                         void *cancel_baton,
+                         apr_pool_t *pool)
+{
+  apr_pool_t *iterpool = svn_pool_create(pool);
+  apr_int64_t batch_start;
+
+  for (batch_start = first_shard;
+       batch_start < end_shard;
+       batch_start += thread_count)
+    {
+      int count = (int)MIN(thread_count, end_shard - batch_start);
+      pack_shard_job_t *jobs;
+      apr_thread_t **threads;
+      svn_error_t *err = SVN_NO_ERROR;
+      int i;
+
+      svn_pool_clear(iterpool);
+
+      if (cancel_func)
+        SVN_ERR(cancel_func(cancel_baton));
+
+      jobs = apr_pcalloc(iterpool, count * sizeof(*jobs));
+      threads = apr_pcalloc(iterpool, count * sizeof(*threads));
+
+      for (i = 0; i < count; ++i)
+        {
+          pack_shard_job_t *job = &jobs[i];
+          apr_allocator_t *allocator;
+          apr_status_t status;
+
+          job->revs_dir = revs_dir;
+          job->revsprops_dir = revsprops_dir;
+          job->format = format;
+          job->shard = batch_start + i;
+          job->max_files_per_dir = max_files_per_dir;
+          job->revprop_pack_size = revprop_pack_size;
+          job->reorder_items = reorder_items;
+          job->cancel_func = cancel_func;
+          job->cancel_baton = cancel_baton;
+
+          status = apr_allocator_create(&allocator);
+          if (status)
+            {
+              job->err = svn_error_wrap_apr(status,
+                                            _("Can't create allocator"));
+              continue;
+            }
+
+          apr_allocator_max_free_set(allocator,
+                                     SVN_ALLOCATOR_RECOMMENDED_MAX_FREE);
+          job->pool = svn_pool_create_ex(NULL, allocator);
+          apr_allocator_owner_set(allocator, job->pool);
+
+          status = apr_thread_create(&threads[i], NULL, pack_shard_thread,
+                                     job, iterpool);
+          if (status)
+            {
+              threads[i] = NULL;
+              job->err = svn_error_wrap_apr(status, _("Can't create thread"));
+            }
+        }
+
+      /* Wait for the whole batch before touching any of its results. */
+      for (i = 0; i < count; ++i)
+        if (threads[i])
+          {
+            apr_status_t thread_status;
+            apr_status_t status = apr_thread_join(&thread_status, threads[i]);
+
+            if (status)
+              jobs[i].err = svn_error_compose_create(
+                              jobs[i].err,
+                              svn_error_wrap_apr(status,
+                                                 _("Can't join thread")));
+          }
+
+      for (i = 0; i < count; ++i)
+        if (jobs[i].pool)
+          svn_pool_destroy(jobs[i].pool);
+
+      /* Finish the shards in order, up to the first failure. */
+      for (i = 0; i < count; ++i)
+        {
+          apr_int64_t shard = batch_start + i;
+
+          if (err || jobs[i].err)
+            {
+              err = svn_error_compose_create(err, jobs[i].err);
+              continue;
+            }
+
+          if (notify_func)
+            {
+              err = notify_func(notify_baton, shard,
+                                svn_fs_pack_notify_start, iterpool);
+              if (!err && revsprops_dir)
+                err = notify_func(notify_baton, shard,
+                                  svn_fs_pack_notify_start_revprop, iterpool);
+              if (!err && revsprops_dir)
+                err = notify_func(notify_baton, shard,
+                                  svn_fs_pack_notify_end_revprop, iterpool);
+            }
+
+          if (!err)
+            err = finish_packed_shard(revs_dir, revsprops_dir, fs_path, shard,
+                                      max_files_per_dir,
+                                      cancel_func, cancel_baton, iterpool);
+
+          if (!err && notify_func)
+            err = notify_func(notify_baton, shard, svn_fs_pack_notify_end,
+                              iterpool);
+        }
+
+      SVN_ERR(err);
+    }
+
+  svn_pool_destroy(iterpool);
+  return SVN_NO_ERROR;
+}
+#endif
+
 struct pack_baton
 {
   svn_fs_t *fs;
@@ -7823,12 +10468,14 @@ pack_body(void *baton,
           apr_pool_t *pool)
 {
   struct pack_baton *pb = baton;
+  fs_fs_data_t *ffd = pb->fs->fsap_data;
   int format, max_files_per_dir;
   apr_int64_t completed_shards;
   apr_int64_t i;
   svn_revnum_t youngest;
   apr_pool_t *iterpool;
   const char *data_path;
+  const char *revprops_data_path = NULL;
   svn_revnum_t min_unpacked_rev;
 
   SVN_ERR(read_format(&format, &max_files_per_dir, path_format(pb->fs, pool),
@@ -7858,6 +10505,22 @@ pack_body(void *baton,
     return SVN_NO_ERROR;
 
   data_path = svn_dirent_join(pb->fs->path, PATH_REVS_DIR, pool);
+  if (format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+    revprops_data_path = svn_dirent_join(pb->fs->path, PATH_REVPROPS_DIR,
+                                         pool);
+
+#if APR_HAS_THREADS
+  if (ffd->pack_threads > 1)
+    return pack_shards_concurrently(data_path, revprops_data_path,
+                                    pb->fs->path, format,
+                                    min_unpacked_rev / max_files_per_dir,
+                                    completed_shards, max_files_per_dir,
+                                    ffd->revprop_pack_size,
+                                    ffd->pack_reorder_items,
+                                    ffd->pack_threads,
+                                    pb->notify_func, pb->notify_baton,
+                                    pb->cancel_func, pb->cancel_baton, pool);
+#endif
 
   iterpool = svn_pool_create(pool);
   for (i = min_unpacked_rev / max_files_per_dir; i < completed_shards; i++)
@@ -7867,8 +10530,9 @@ pack_body(void *baton,
       if (pb->cancel_func)
         SVN_ERR(pb->cancel_func(pb->cancel_baton));
 
-      SVN_ERR(pack_shard(data_path, pb->fs->path, i, max_files_per_dir,
-                         pb->notify_func, pb->notify_baton,
+      SVN_ERR(pack_shard(data_path, revprops_data_path, pb->fs->path, format,
+                         i, max_files_per_dir, ffd->revprop_pack_size,
+                         ffd->pack_reorder_items, pb->notify_func, pb->notify_baton,
                          pb->cancel_func, pb->cancel_baton, iterpool));
     }
 
@@ -8223,6 +10887,7 @@ hotcopy_copy_packed_shard(svn_revnum_t *dst_min_unpacked_rev,
   const char *src_subdir_packed_shard;
   svn_revnum_t revprop_rev;
   apr_pool_t *iterpool;
+  fs_fs_data_t *src_ffd = src_fs->fsap_data;
 
   /* Copy the packed shard. */
   src_subdir = svn_dirent_join(src_fs->path, PATH_REVS_DIR, scratch_pool);
@@ -8240,18 +10905,38 @@ hotcopy_copy_packed_shard(svn_revnum_t *dst_min_unpacked_rev,
   /* Copy revprops belonging to revisions in this pack. */
   src_subdir = svn_dirent_join(src_fs->path, PATH_REVPROPS_DIR, scratch_pool);
   dst_subdir = svn_dirent_join(dst_fs->path, PATH_REVPROPS_DIR, scratch_pool);
-  iterpool = svn_pool_create(scratch_pool);
-  for (revprop_rev = rev;
-       revprop_rev < rev + max_files_per_dir;
-       revprop_rev++)
+
+  if (src_ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
     {
-      svn_pool_clear(iterpool);
+      /* Packed revprops are mutable; always copy the whole pack folder.
+       * The revprops of r0 are never packed. */
+      src_subdir_packed_shard = svn_dirent_join(src_subdir, packed_shard,
+                                                scratch_pool);
+      SVN_ERR(hotcopy_io_copy_dir_recursively(src_subdir_packed_shard,
+                                              dst_subdir, packed_shard,
+                                              TRUE /* copy_perms */,
+                                              NULL /* cancel_func */, NULL,
+                                              scratch_pool));
+      if (rev == 0)
+        SVN_ERR(hotcopy_copy_shard_file(src_subdir, dst_subdir,
+                                        0, max_files_per_dir,
+                                        scratch_pool));
+    }
+  else
+    {
+      iterpool = svn_pool_create(scratch_pool);
+      for (revprop_rev = rev;
+           revprop_rev < rev + max_files_per_dir;
+           revprop_rev++)
+        {
+          svn_pool_clear(iterpool);
 
-      SVN_ERR(hotcopy_copy_shard_file(src_subdir, dst_subdir,
-                                      revprop_rev, max_files_per_dir,
-                                      iterpool));
+          SVN_ERR(hotcopy_copy_shard_file(src_subdir, dst_subdir,
+                                          revprop_rev, max_files_per_dir,
+                                          iterpool));
+        }
+      svn_pool_destroy(iterpool);
     }
-  svn_pool_destroy(iterpool);
 
   /* If necessary, update the min-unpacked rev file in the hotcopy. */
   if (*dst_min_unpacked_rev < rev + max_files_per_dir)
@@ -8622,6 +11307,15 @@ hotcopy_body(void *baton, apr_pool_t *pool)
           else
             return svn_error_trace(err);
         }
+
+      /* Likewise for the revprop files which are now packed. */
+      if (incremental
+          && src_ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+        SVN_ERR(delete_revprops_shard(path_revprops_shard(dst_fs, rev,
+                                                          iterpool),
+                                      rev / max_files_per_dir,
+                                      max_files_per_dir,
+                                      cancel_func, cancel_baton, iterpool));
     }
 
   if (cancel_func)
@@ -8761,6 +11455,16 @@ hotcopy_body(void *baton, apr_pool_t *pool)
     SVN_ERR(svn_io_dir_file_copy(src_fs->path, dst_fs->path,
                                  PATH_TXN_CURRENT, pool));
 
+  /* Revprops in the destination may have changed.  Invalidate whatever
+   * readers of the destination may have cached. */
+  if (dst_ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+    {
+      apr_int64_t generation;
+
+      SVN_ERR(begin_revprop_change(&generation, dst_fs, pool));
+      SVN_ERR(end_revprop_change(dst_fs, generation, pool));
+    }
+
   /* Hotcopied FS is complete. Stamp it with a format file. */
   SVN_ERR(write_format(svn_dirent_join(dst_fs->path, PATH_FORMAT, pool),
                        dst_ffd->format, max_files_per_dir, TRUE, pool));
@@ -8833,6 +11537,10 @@ hotcopy_create_empty_dest(svn_fs_t *src_fs,
   if (dst_ffd->format >= SVN_FS_FS__MIN_PACKED_FORMAT)
     SVN_ERR(svn_io_file_create(path_min_unpacked_rev(dst_fs, pool),
                                                      "0\n", pool));
+  /* Create the revprop generation file. */
+  if (dst_ffd->format >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT)
+    SVN_ERR(svn_io_file_create(path_revprop_generation(dst_fs, pool),
+                               "0\n", pool));
   /* Create the txn-current file if the repository supports
      the transaction sequence file. */
   if (dst_ffd->format >= SVN_FS_FS__MIN_TXN_CURRENT_FORMAT)
@@ -108,6 +108,12 @@ svn_error_t *svn_fs_fs__youngest_rev(svn_revnum_t *youngest,
                                      svn_fs_t *fs,
                                      apr_pool_t *pool);
 
+/* Set *YOUNGEST to the youngest revision of the FSFS filesystem at
+   FS_PATH without opening it.  Do any temporary allocation in POOL. */
+svn_error_t *svn_fs_fs__read_youngest(svn_revnum_t *youngest,
+                                      const char *fs_path,
+                                      apr_pool_t *pool);
+
 /* Return an error iff REV does not exist in FS. */
 svn_error_t *
 svn_fs_fs__revision_exists(svn_revnum_t rev,
@@ -543,6 +549,41 @@ svn_fs_fs__initialize_txn_caches(svn_fs_t *fs,
 void
 svn_fs_fs__reset_txn_caches(svn_fs_t *fs);
 
+/* Remember FS as a repository whose data may be found in the process-wide
+   membuffer cache, such that snapshots of that cache can be validated
+   against it later.  COMMON_POOL is the fs-global pool; the caller must
+   serialize access to it. */
+void
+svn_fs_fs__register_cached_repository(svn_fs_t *fs,
+                                      apr_pool_t *common_pool);
+
+/* Write the content of the process-wide membuffer cache to the file at
+   PATH together with the UUID and youngest revision of all repositories
+   registered in COMMON_POOL.  This is a no-op if there is no such cache
+   or if no existing repository has been registered.  Use POOL for
+   temporary allocations. */
+svn_error_t *
+svn_fs_fs__save_cache(const char *path,
+                      apr_pool_t *pool,
+                      apr_pool_t *common_pool);
+
+/* Fill the process-wide membuffer cache with the snapshot previously
+   written to PATH by svn_fs_fs__save_cache.  The snapshot will be ignored
+   if it records no repository or if any of the repositories recorded in
+   it has been replaced or rolled back since, i.e. if its UUID changed or
+   its youngest revision is older than recorded.  Set *LOADED to TRUE if
+   the snapshot has been used.  Use POOL for temporary allocations. */
+svn_error_t *
+svn_fs_fs__load_cache(svn_boolean_t *loaded,
+                      const char *path,
+                      apr_pool_t *pool,
+                      apr_pool_t *common_pool);
+
+/* Copy the delta chain statistics gathered by FS so far into *STATS. */
+void
+svn_fs_fs__get_delta_chain_stats(svn_fs_delta_chain_stats_t *stats,
+                                 svn_fs_t *fs);
+
 /* Possibly pack the repository at PATH.  This just take full shards, and
    combines all the revision files into a single one, with a manifest header.
    Use optional CANCEL_FUNC/CANCEL_BATON for cancellation support.
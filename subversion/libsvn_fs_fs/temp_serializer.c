@@ -860,6 +860,53 @@ svn_fs_fs__get_sharded_offset(void **out,
   return SVN_NO_ERROR;
 }
 
+svn_error_t *
+svn_fs_fs__get_item_offset(void **out,
+                           const void *data,
+                           apr_size_t data_len,
+                           void *baton,
+                           apr_pool_t *pool)
+{
+  const apr_off_t *index = (const apr_off_t *)data;
+  svn_fs_fs__item_offset_baton_t *b = baton;
+  const apr_off_t *pairs;
+  apr_off_t lower, upper, middle;
+
+  *(apr_off_t *)out = -1;
+  b->indexed = index[0] != 0;
+  if (!b->indexed || b->shard_pos >= index[0])
+    return SVN_NO_ERROR;
+
+  pairs = index + index[0] + 2;
+  lower = index[b->shard_pos + 1];
+  upper = index[b->shard_pos + 2] - 1;
+
+  /* The last entry of each revision marks the end of its file. */
+  if (b->offset < 0)
+    {
+      *(apr_off_t *)out = pairs[2 * upper + 1];
+      return SVN_NO_ERROR;
+    }
+
+  if (b->offset > pairs[2 * upper])
+    return SVN_NO_ERROR;
+
+  /* binary search for the last item starting at or before OFFSET */
+  while (lower < upper)
+    {
+      middle = upper - (upper - lower) / 2;
+      if (pairs[2 * middle] <= b->offset)
+        lower = middle;
+      else
+        upper = middle - 1;
+    }
+
+  if (pairs[2 * lower] <= b->offset)
+    *(apr_off_t *)out = pairs[2 * lower + 1] + b->offset - pairs[2 * lower];
+
+  return SVN_NO_ERROR;
+}
+
 /* Utility function that returns the lowest index of the first entry in
  * *ENTRIES that points to a dir entry with a name equal or larger than NAME.
  * If an exact match has been found, *FOUND will be set to TRUE. COUNT is
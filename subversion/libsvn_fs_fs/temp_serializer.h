@@ -197,6 +197,43 @@ svn_fs_fs__get_sharded_offset(void **out,
                               void *baton,
                               apr_pool_t *pool);
 
+/**
+ * Baton type to be used with svn_fs_fs__get_item_offset.
+ */
+typedef struct svn_fs_fs__item_offset_baton_t
+{
+  /** Position of the revision within its shard. */
+  apr_int64_t shard_pos;
+
+  /** Offset within the revision file.  Negative values denote the end
+   * of the revision file. */
+  apr_off_t offset;
+
+  /** Will be set by the callback to indicate whether the pack file has
+   * an item index at all. */
+  svn_boolean_t indexed;
+} svn_fs_fs__item_offset_baton_t;
+
+/**
+ * Implements #svn_cache__partial_getter_func_t.  Within the serialized
+ * item index @a data and @a data_len, find the pack file offset
+ * corresponding to the revision file offset given in the
+ * #svn_fs_fs__item_offset_baton_t @a *baton and return it in (apr_off_t)
+ * @a *out.  An item index is an array of apr_off_t: the number N of
+ * revisions in the shard (0 if the pack file has no index), followed by
+ * N+1 entry numbers marking where each revision's entries start, followed
+ * by (revision file offset, pack file offset) pairs.  The pairs of each
+ * revision are sorted by revision file offset and end with one for the
+ * end of the revision file.  @a *out will be -1 if the offset is not
+ * covered by the index.
+ */
+svn_error_t *
+svn_fs_fs__get_item_offset(void **out,
+                           const void *data,
+                           apr_size_t data_len,
+                           void *baton,
+                           apr_pool_t *pool);
+
 /**
  * Implements #svn_cache__partial_getter_func_t for a single
  * #svn_fs_dirent_t within a serialized directory contents hash,
@@ -2372,7 +2372,7 @@ static svn_error_t * reporter_finish_report(void *report_baton,
   const char *report_target;
   apr_hash_t *request_headers = apr_hash_make(pool);
   apr_hash_set(request_headers, "Accept-Encoding", APR_HASH_KEY_STRING,
-               "svndiff1;q=0.9,svndiff;q=0.8");
+               "svndiff2;q=0.95,svndiff1;q=0.9,svndiff;q=0.8");
 
 
 #define SVN_RA_NEON__REPORT_TAIL  "</S:update-report>" DEBUG_CR
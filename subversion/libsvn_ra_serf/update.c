@@ -731,7 +731,7 @@ headers_fetch(serf_bucket_t *headers,
       serf_bucket_headers_setn(headers, SVN_DAV_DELTA_BASE_HEADER,
                                fetch_ctx->info->delta_base);
       serf_bucket_headers_setn(headers, "Accept-Encoding",
-                               "svndiff1;q=0.9,svndiff;q=0.8");
+                               "svndiff2;q=0.95,svndiff1;q=0.9,svndiff;q=0.8");
     }
   else if (fetch_ctx->conn->using_compression)
     {
@@ -631,15 +631,23 @@ static svn_error_t *open_session(svn_ra_svn__session_baton_t **sess_p,
    * capability list, and the URL, and subsequently there is an auth
    * request. */
   /* Client-side capabilities list: */
-  SVN_ERR(svn_ra_svn_write_tuple(conn, pool, "n(wwwwww)cc(?c)",
+  SVN_ERR(svn_ra_svn_write_tuple(conn, pool, "n(wwwwwwww)cc(?c)",
                                  (apr_uint64_t) 2,
                                  SVN_RA_SVN_CAP_EDIT_PIPELINE,
                                  SVN_RA_SVN_CAP_SVNDIFF1,
+                                 SVN_RA_SVN_CAP_SVNDIFF2,
+                                 SVN_RA_SVN_CAP_STREAM_COMPRESSION,
                                  SVN_RA_SVN_CAP_ABSENT_ENTRIES,
                                  SVN_RA_SVN_CAP_DEPTH,
                                  SVN_RA_SVN_CAP_MERGEINFO,
                                  SVN_RA_SVN_CAP_LOG_REVPROPS,
                                  url, "SVN/" SVN_VER_NUMBER, client_string));
+
+  /* If the server offered to compress the connection, everything after
+   * our response will be compressed. */
+  if (svn_ra_svn_has_capability(conn, SVN_RA_SVN_CAP_STREAM_COMPRESSION))
+    SVN_ERR(svn_ra_svn__enable_stream_compression(conn, pool));
+
   SVN_ERR(handle_auth_request(sess, pool));
 
   /* This is where the security layer would go into effect if we
@@ -304,6 +304,7 @@ static svn_error_t *ra_svn_apply_textdelta(void *file_baton,
 {
   ra_svn_baton_t *b = file_baton;
   svn_stream_t *diff_stream;
+  int svndiff_version;
 
   /* Tell the other side we're starting a text delta. */
   SVN_ERR(check_for_error(b->eb, pool));
@@ -318,11 +319,12 @@ static svn_error_t *ra_svn_apply_textdelta(void *file_baton,
   svn_stream_set_close(diff_stream, ra_svn_svndiff_close_handler);
 
   /* If the connection does not support SVNDIFF1 or if we don't want to use
-   * compression, use the non-compressing "version 0" implementation */
-  if (   svn_ra_svn_compression_level(b->conn) > 0
-      && svn_ra_svn_has_capability(b->conn, SVN_RA_SVN_CAP_SVNDIFF1))
-    svn_txdelta_to_svndiff3(wh, wh_baton, diff_stream, 1,
-                            b->conn->compression_level, pool);
+   * compression, use the non-compressing "version 0" implementation. */
+  svndiff_version = svn_ra_svn__svndiff_version(b->conn);
+  if (svndiff_version > 0)
+    svn_txdelta_to_svndiff4(wh, wh_baton, diff_stream, svndiff_version,
+                            b->conn->compression_level,
+                            b->conn->compression_threads, pool);
   else
     svn_txdelta_to_svndiff3(wh, wh_baton, diff_stream, 0,
                             b->conn->compression_level, pool);
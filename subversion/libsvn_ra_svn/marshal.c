@@ -77,6 +77,7 @@ svn_ra_svn_conn_t *svn_ra_svn_create_conn2(apr_socket_t *sock,
   conn->block_baton = NULL;
   conn->capabilities = apr_hash_make(pool);
   conn->compression_level = compression_level;
+  conn->compression_threads = 1;
   conn->pool = pool;
 
   if (sock != NULL)
@@ -146,6 +147,19 @@ svn_ra_svn_compression_level(svn_ra_svn_conn_t *conn)
   return conn->compression_level;
 }
 
+void
+svn_ra_svn_set_compression_threads(svn_ra_svn_conn_t *conn,
+                                   int thread_count)
+{
+  conn->compression_threads = thread_count;
+}
+
+int
+svn_ra_svn_compression_threads(svn_ra_svn_conn_t *conn)
+{
+  return conn->compression_threads;
+}
+
 const char *svn_ra_svn_conn_remote_host(svn_ra_svn_conn_t *conn)
 {
   return conn->remote_ip;
@@ -185,23 +199,32 @@ static const char *writebuf_push(svn_ra_svn_conn_t *conn, const char *data,
   return data + copylen;
 }
 
-/* Write data to socket or output file as appropriate. */
-static svn_error_t *writebuf_output(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
-                                    const char *data, apr_size_t len)
+/* Write the NVEC buffers in VEC to socket or output file as appropriate,
+ * using as few write operations as possible.  The contents of VEC will
+ * be modified. */
+static svn_error_t *writebuf_outputv(svn_ra_svn_conn_t *conn,
+                                     apr_pool_t *pool,
+                                     struct iovec *vec, int nvec)
 {
-  const char *end = data + len;
   apr_size_t count;
   apr_pool_t *subpool = NULL;
   svn_ra_svn__session_baton_t *session = conn->session;
 
-  while (data < end)
+  while (TRUE)
     {
-      count = end - data;
+      /* Skip the data that has been written already. */
+      while (nvec > 0 && vec->iov_len == 0)
+        {
+          vec++;
+          nvec--;
+        }
+      if (nvec == 0)
+        break;
 
       if (session && session->callbacks && session->callbacks->cancel_func)
         SVN_ERR((session->callbacks->cancel_func)(session->callbacks_baton));
 
-      SVN_ERR(svn_ra_svn__stream_write(conn->stream, data, &count));
+      SVN_ERR(svn_ra_svn__stream_writev(conn->stream, vec, nvec, &count));
       if (count == 0)
         {
           if (!subpool)
@@ -210,7 +233,6 @@ static svn_error_t *writebuf_output(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
             svn_pool_clear(subpool);
           SVN_ERR(conn->block_handler(conn, subpool, conn->block_baton));
         }
-      data += count;
 
       if (session)
         {
@@ -221,6 +243,17 @@ static svn_error_t *writebuf_output(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
             (cb->progress_func)(session->bytes_written + session->bytes_read,
                                 -1, cb->progress_baton, subpool);
         }
+
+      /* Advance behind the data written. */
+      for (; count > 0; vec++, nvec--)
+        if (count < vec->iov_len)
+          {
+            vec->iov_base = (char *)vec->iov_base + count;
+            vec->iov_len -= count;
+            break;
+          }
+        else
+          count -= vec->iov_len;
     }
 
   if (subpool)
@@ -228,6 +261,17 @@ static svn_error_t *writebuf_output(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
   return SVN_NO_ERROR;
 }
 
+/* Write data to socket or output file as appropriate. */
+static svn_error_t *writebuf_output(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
+                                    const char *data, apr_size_t len)
+{
+  struct iovec vec;
+
+  vec.iov_base = (void *)data;
+  vec.iov_len = len;
+  return writebuf_outputv(conn, pool, &vec, 1);
+}
+
 /* Write data from the write buffer out to the socket. */
 static svn_error_t *writebuf_flush(svn_ra_svn_conn_t *conn, apr_pool_t *pool)
 {
@@ -246,6 +290,24 @@ static svn_error_t *writebuf_write(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
 
   if (conn->write_pos > 0 && conn->write_pos + len > sizeof(conn->write_buf))
     {
+      if (len > sizeof(conn->write_buf))
+        {
+          /* Bulk data such as svndiff chunks gets sent together with the
+           * buffered data in a single gathering write instead of being
+           * copied through the write buffer. */
+          struct iovec vec[2];
+
+          vec[0].iov_base = conn->write_buf;
+          vec[0].iov_len = conn->write_pos;
+          vec[1].iov_base = (void *)data;
+          vec[1].iov_len = len;
+
+          /* Clear conn->write_pos first in case the block handler does
+           * a read. */
+          conn->write_pos = 0;
+          return writebuf_outputv(conn, pool, vec, 2);
+        }
+
       /* Fill and then empty the write buffer. */
       data = writebuf_push(conn, data, end);
       SVN_ERR(writebuf_flush(conn, pool));
@@ -487,6 +549,42 @@ svn_error_t *svn_ra_svn_flush(svn_ra_svn_conn_t *conn, apr_pool_t *pool)
   return writebuf_flush(conn, pool);
 }
 
+svn_error_t *
+svn_ra_svn__enable_stream_compression(svn_ra_svn_conn_t *conn,
+                                      apr_pool_t *pool)
+{
+  /* Everything before this point goes out uncompressed. */
+  SVN_ERR(writebuf_flush(conn, pool));
+
+  /* Anything already read belongs to the compressed stream. */
+  SVN_ERR(svn_ra_svn__stream_compressed(&conn->stream, conn->stream,
+                                        conn->compression_level,
+                                        conn->read_ptr,
+                                        conn->read_end - conn->read_ptr,
+                                        conn->pool));
+  conn->read_ptr = conn->read_buf;
+  conn->read_end = conn->read_buf;
+  conn->stream_compressed = TRUE;
+
+  return SVN_NO_ERROR;
+}
+
+int
+svn_ra_svn__svndiff_version(svn_ra_svn_conn_t *conn)
+{
+  /* Compressing the svndiff data again would only cost CPU time. */
+  if (conn->compression_level <= 0 || conn->stream_compressed)
+    return 0;
+
+  /* Prefer the faster LZ4-based SVNDIFF2 over zlib, if available. */
+  if (svn_ra_svn_has_capability(conn, SVN_RA_SVN_CAP_SVNDIFF2))
+    return 2;
+  if (svn_ra_svn_has_capability(conn, SVN_RA_SVN_CAP_SVNDIFF1))
+    return 1;
+
+  return 0;
+}
+
 /* --- WRITING TUPLES --- */
 
 static svn_error_t *vwrite_tuple(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
@@ -990,11 +1088,17 @@ svn_error_t *svn_ra_svn_read_cmd_response(svn_ra_svn_conn_t *conn,
                            status);
 }
 
-svn_error_t *svn_ra_svn_handle_commands2(svn_ra_svn_conn_t *conn,
-                                         apr_pool_t *pool,
-                                         const svn_ra_svn_cmd_entry_t *commands,
-                                         void *baton,
-                                         svn_boolean_t error_on_disconnect)
+/* Implements svn_ra_svn_handle_commands2() and, if UNTIL_IDLE is set,
+ * svn_ra_svn__handle_pending_commands().  Set *TERMINATED, if not NULL,
+ * to whether the command loop ended for good. */
+static svn_error_t *
+handle_commands(svn_boolean_t *terminated,
+                svn_ra_svn_conn_t *conn,
+                apr_pool_t *pool,
+                const svn_ra_svn_cmd_entry_t *commands,
+                void *baton,
+                svn_boolean_t error_on_disconnect,
+                svn_boolean_t until_idle)
 {
   apr_pool_t *subpool = svn_pool_create(pool);
   apr_pool_t *iterpool = svn_pool_create(subpool);
@@ -1004,12 +1108,28 @@ svn_error_t *svn_ra_svn_handle_commands2(svn_ra_svn_conn_t *conn,
   apr_array_header_t *params;
   apr_hash_t *cmd_hash = apr_hash_make(subpool);
 
+  if (terminated)
+    *terminated = TRUE;
+
   for (command = commands; command->cmdname; command++)
     apr_hash_set(cmd_hash, command->cmdname, APR_HASH_KEY_STRING, command);
 
   while (1)
     {
       svn_pool_clear(iterpool);
+
+      /* Don't block waiting for the next command.  Make sure the client
+         sees all our responses before it sends another one, though. */
+      if (until_idle
+          && conn->read_ptr == conn->read_end
+          && !svn_ra_svn__input_waiting(conn, iterpool))
+        {
+          SVN_ERR(svn_ra_svn_flush(conn, iterpool));
+          if (terminated)
+            *terminated = FALSE;
+          break;
+        }
+
       err = svn_ra_svn_read_tuple(conn, iterpool, "wl", &cmdname, &params);
       if (err)
         {
@@ -1053,6 +1173,28 @@ svn_error_t *svn_ra_svn_handle_commands2(svn_ra_svn_conn_t *conn,
   return SVN_NO_ERROR;
 }
 
+svn_error_t *svn_ra_svn_handle_commands2(svn_ra_svn_conn_t *conn,
+                                         apr_pool_t *pool,
+                                         const svn_ra_svn_cmd_entry_t *commands,
+                                         void *baton,
+                                         svn_boolean_t error_on_disconnect)
+{
+  return handle_commands(NULL, conn, pool, commands, baton,
+                         error_on_disconnect, FALSE);
+}
+
+svn_error_t *
+svn_ra_svn__handle_pending_commands(svn_boolean_t *terminated,
+                                    svn_ra_svn_conn_t *conn,
+                                    apr_pool_t *pool,
+                                    const svn_ra_svn_cmd_entry_t *commands,
+                                    void *baton,
+                                    svn_boolean_t error_on_disconnect)
+{
+  return handle_commands(terminated, conn, pool, commands, baton,
+                         error_on_disconnect, TRUE);
+}
+
 svn_error_t *svn_ra_svn_handle_commands(svn_ra_svn_conn_t *conn,
                                         apr_pool_t *pool,
                                         const svn_ra_svn_cmd_entry_t *commands,
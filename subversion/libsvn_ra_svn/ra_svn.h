@@ -44,6 +44,14 @@ typedef svn_boolean_t (*ra_svn_pending_fn_t)(void *baton);
 /* Callback function that sets the timeout value for a svn_ra_svn__stream_t. */
 typedef void (*ra_svn_timeout_fn_t)(void *baton, apr_interval_time_t timeout);
 
+/* Callback function that writes the NVEC buffers in VEC, in that order,
+ * to a svn_ra_svn__stream_t, returning the number of bytes written in
+ * *LEN. */
+typedef svn_error_t *(*ra_svn_writev_fn_t)(void *baton,
+                                           const struct iovec *vec,
+                                           int nvec,
+                                           apr_size_t *len);
+
 /* A stream abstraction for ra_svn.
  *
  * This is different from svn_stream_t in that it provides timeouts and
@@ -86,6 +94,8 @@ struct svn_ra_svn_conn_st {
   void *block_baton;
   apr_hash_t *capabilities;
   int compression_level;
+  int compression_threads;
+  svn_boolean_t stream_compressed;
   char *remote_ip;
   svn_delta_shim_callbacks_t *shim_callbacks;
   apr_pool_t *pool;
@@ -145,6 +155,19 @@ svn_ra_svn__stream_t *svn_ra_svn__stream_from_files(apr_file_t *in_file,
                                                     apr_file_t *out_file,
                                                     apr_pool_t *pool);
 
+/* Set *STREAM to a stream that compresses the data written to it before
+ * passing it on to INNER, using zlib with COMPRESSION_LEVEL, and
+ * decompresses the data read from INNER.  Every write gets flushed to
+ * INNER in full.  The LEN bytes at DATA have already been read from
+ * INNER and will be decompressed first.  Allocate the result in POOL.
+ */
+svn_error_t *svn_ra_svn__stream_compressed(svn_ra_svn__stream_t **stream,
+                                           svn_ra_svn__stream_t *inner,
+                                           int compression_level,
+                                           const char *data,
+                                           apr_size_t len,
+                                           apr_pool_t *pool);
+
 /* Create an svn_ra_svn__stream_t using READ_CB, WRITE_CB, TIMEOUT_CB,
  * PENDING_CB, and BATON.
  */
@@ -161,6 +184,19 @@ svn_ra_svn__stream_t *svn_ra_svn__stream_create(void *baton,
 svn_error_t *svn_ra_svn__stream_write(svn_ra_svn__stream_t *stream,
                                       const char *data, apr_size_t *len);
 
+/* Write the NVEC buffers in VEC to STREAM, returning the total number
+ * of bytes written in *LEN.  Like svn_ra_svn__stream_write(), this may
+ * write less than all of the data.  If STREAM has no gathering write
+ * callback, the buffers get written one at a time.
+ */
+svn_error_t *svn_ra_svn__stream_writev(svn_ra_svn__stream_t *stream,
+                                       const struct iovec *vec, int nvec,
+                                       apr_size_t *len);
+
+/* Let STREAM use WRITEV_CB for svn_ra_svn__stream_writev(). */
+void svn_ra_svn__stream_set_writev(svn_ra_svn__stream_t *stream,
+                                   ra_svn_writev_fn_t writev_cb);
+
 /* Read *LEN bytes from STREAM into DATA, returning the number of bytes
  * read in *LEN.
  */
@@ -26,6 +26,7 @@
 #include <apr_general.h>
 #include <apr_network_io.h>
 #include <apr_poll.h>
+#include <zlib.h>
 
 #include "svn_types.h"
 #include "svn_error.h"
@@ -33,6 +34,8 @@
 #include "svn_io.h"
 #include "svn_private_config.h"
 
+#include "private/svn_error_private.h"
+
 #include "ra_svn.h"
 
 struct svn_ra_svn__stream_st {
@@ -40,6 +43,7 @@ struct svn_ra_svn__stream_st {
   void *baton;
   ra_svn_pending_fn_t pending_fn;
   ra_svn_timeout_fn_t timeout_fn;
+  ra_svn_writev_fn_t writev_fn;
 };
 
 typedef struct sock_baton_t {
@@ -171,6 +175,18 @@ sock_write_cb(void *baton, const char *buffer, apr_size_t *len)
   return SVN_NO_ERROR;
 }
 
+/* Implements ra_svn_writev_fn_t */
+static svn_error_t *
+sock_writev_cb(void *baton, const struct iovec *vec, int nvec,
+               apr_size_t *len)
+{
+  sock_baton_t *b = baton;
+  apr_status_t status = apr_socket_sendv(b->sock, vec, nvec, len);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't write to connection"));
+  return SVN_NO_ERROR;
+}
+
 /* Implements ra_svn_timeout_fn_t */
 static void
 sock_timeout_cb(void *baton, apr_interval_time_t interval)
@@ -197,13 +213,280 @@ svn_ra_svn__stream_from_sock(apr_socket_t *sock,
                              apr_pool_t *pool)
 {
   sock_baton_t *b = apr_palloc(pool, sizeof(*b));
+  svn_ra_svn__stream_t *s;
 
   b->sock = sock;
   b->pool = pool;
 
-  return svn_ra_svn__stream_create(b, sock_read_cb, sock_write_cb,
-                                   sock_timeout_cb, sock_pending_cb,
-                                   pool);
+  s = svn_ra_svn__stream_create(b, sock_read_cb, sock_write_cb,
+                                sock_timeout_cb, sock_pending_cb, pool);
+  svn_ra_svn__stream_set_writev(s, sock_writev_cb);
+  return s;
+}
+
+
+/* Size of the buffers used by the compressing stream layer. */
+#define COMPRESSION_BUFFER_SIZE 16384
+
+/* Compress at most this many bytes per write.  This keeps the output
+ * buffer small and the number of bytes within what zlib can handle. */
+#define MAX_COMPRESSION_INPUT (16 * COMPRESSION_BUFFER_SIZE)
+
+typedef struct compressed_baton_t {
+  /* The stream transporting the compressed data. */
+  svn_ra_svn__stream_t *inner;
+
+  /* Decompression state, the compressed data read from INNER and the
+   * decompressed data not yet handed out by compressed_read_cb(). */
+  z_stream inflater;
+  char *in_buf;
+  char *read_buf;
+  apr_size_t read_pos;
+  apr_size_t read_len;
+
+  /* Compression state and the compressed data not yet written to INNER.
+   * WRITE_CONSUMED is the number of input bytes that WRITE_BUF
+   * represents, or 0 if all of it has been written. */
+  z_stream deflater;
+  svn_stringbuf_t *write_buf;
+  apr_size_t write_pos;
+  apr_size_t write_consumed;
+} compressed_baton_t;
+
+/* Decompress as much of the input buffered in B as fits into its read
+ * buffer, which must be empty. */
+static svn_error_t *
+compressed_inflate(compressed_baton_t *b)
+{
+  int zerr;
+
+  b->inflater.next_out = (Bytef *)b->read_buf;
+  b->inflater.avail_out = COMPRESSION_BUFFER_SIZE;
+  zerr = inflate(&b->inflater, Z_SYNC_FLUSH);
+
+  b->read_pos = 0;
+  b->read_len = COMPRESSION_BUFFER_SIZE - b->inflater.avail_out;
+
+  /* Z_BUF_ERROR only means that there was no input to process.
+   * The sender never terminates the compressed stream. */
+  if (zerr != Z_OK && zerr != Z_BUF_ERROR)
+    return svn_error_trace(svn_error__wrap_zlib(
+                             zerr == Z_STREAM_END ? Z_DATA_ERROR : zerr,
+                             "inflate",
+                             _("Decompression of connection data failed")));
+
+  return SVN_NO_ERROR;
+}
+
+static svn_error_t *
+compressed_read_cb(void *baton, char *buffer, apr_size_t *len)
+{
+  compressed_baton_t *b = baton;
+
+  while (b->read_pos == b->read_len)
+    {
+      if (b->inflater.avail_in == 0)
+        {
+          apr_size_t count = COMPRESSION_BUFFER_SIZE;
+
+          SVN_ERR(svn_ra_svn__stream_read(b->inner, b->in_buf, &count));
+          if (count == 0)
+            {
+              *len = 0;
+              return SVN_NO_ERROR;
+            }
+
+          b->inflater.next_in = (Bytef *)b->in_buf;
+          b->inflater.avail_in = (uInt)count;
+        }
+
+      SVN_ERR(compressed_inflate(b));
+    }
+
+  if (*len > b->read_len - b->read_pos)
+    *len = b->read_len - b->read_pos;
+  memcpy(buffer, b->read_buf + b->read_pos, *len);
+  b->read_pos += *len;
+
+  return SVN_NO_ERROR;
+}
+
+static svn_error_t *
+compressed_write_cb(void *baton, const char *buffer, apr_size_t *len)
+{
+  compressed_baton_t *b = baton;
+
+  /* If the previous call could not send all of the compressed data, the
+   * caller retries with the same data and we continue sending what we
+   * already have.  Otherwise, compress the new data.  Flushing after
+   * every write makes sure that the other side gets everything we sent
+   * so far, i.e. command boundaries are preserved. */
+  if (b->write_consumed == 0)
+    {
+      apr_size_t input_len = *len < MAX_COMPRESSION_INPUT
+                           ? *len
+                           : MAX_COMPRESSION_INPUT;
+
+      svn_stringbuf_setempty(b->write_buf);
+      b->write_pos = 0;
+      b->deflater.next_in = (Bytef *)buffer;
+      b->deflater.avail_in = (uInt)input_len;
+
+      do
+        {
+          int zerr;
+
+          svn_stringbuf_ensure(b->write_buf,
+                               b->write_buf->len + COMPRESSION_BUFFER_SIZE);
+          b->deflater.next_out = (Bytef *)b->write_buf->data
+                               + b->write_buf->len;
+          b->deflater.avail_out = COMPRESSION_BUFFER_SIZE;
+
+          zerr = deflate(&b->deflater, Z_SYNC_FLUSH);
+          if (zerr != Z_OK && zerr != Z_BUF_ERROR)
+            return svn_error_trace(svn_error__wrap_zlib(
+                                     zerr, "deflate",
+                                     _("Compression of connection data "
+                                       "failed")));
+
+          b->write_buf->len += COMPRESSION_BUFFER_SIZE
+                             - b->deflater.avail_out;
+        }
+      while (b->deflater.avail_out == 0);
+
+      b->write_consumed = input_len;
+    }
+
+  while (b->write_pos < b->write_buf->len)
+    {
+      apr_size_t count = b->write_buf->len - b->write_pos;
+
+      SVN_ERR(svn_ra_svn__stream_write(b->inner,
+                                       b->write_buf->data + b->write_pos,
+                                       &count));
+      if (count == 0)
+        {
+          /* Blocked.  Nothing of *LEN has been sent in full, yet. */
+          *len = 0;
+          return SVN_NO_ERROR;
+        }
+
+      b->write_pos += count;
+    }
+
+  *len = b->write_consumed;
+  b->write_consumed = 0;
+
+  return SVN_NO_ERROR;
+}
+
+static void
+compressed_timeout_cb(void *baton, apr_interval_time_t interval)
+{
+  compressed_baton_t *b = baton;
+  svn_ra_svn__stream_timeout(b->inner, interval);
+}
+
+static svn_boolean_t
+compressed_pending_cb(void *baton)
+{
+  compressed_baton_t *b = baton;
+
+  /* Received data may consist of nothing but a flush marker, so we have
+   * to decompress it to find out whether there is something to read. */
+  while (b->read_pos == b->read_len)
+    {
+      svn_error_t *err = SVN_NO_ERROR;
+
+      if (b->inflater.avail_in == 0)
+        {
+          apr_size_t count = COMPRESSION_BUFFER_SIZE;
+
+          if (! svn_ra_svn__stream_pending(b->inner))
+            return FALSE;
+
+          err = svn_ra_svn__stream_read(b->inner, b->in_buf, &count);
+          b->inflater.next_in = (Bytef *)b->in_buf;
+          b->inflater.avail_in = err ? 0 : (uInt)count;
+        }
+
+      if (!err)
+        err = compressed_inflate(b);
+
+      /* Let the next read report the problem. */
+      if (err)
+        {
+          svn_error_clear(err);
+          return TRUE;
+        }
+    }
+
+  return TRUE;
+}
+
+/* Pool cleanup function releasing the zlib state of the
+ * compressed_baton_t DATA. */
+static apr_status_t
+compressed_cleanup(void *data)
+{
+  compressed_baton_t *b = data;
+
+  inflateEnd(&b->inflater);
+  deflateEnd(&b->deflater);
+
+  return APR_SUCCESS;
+}
+
+svn_error_t *
+svn_ra_svn__stream_compressed(svn_ra_svn__stream_t **stream,
+                              svn_ra_svn__stream_t *inner,
+                              int compression_level,
+                              const char *data,
+                              apr_size_t len,
+                              apr_pool_t *pool)
+{
+  compressed_baton_t *b = apr_pcalloc(pool, sizeof(*b));
+  int zerr;
+
+  b->inner = inner;
+  b->in_buf = apr_palloc(pool, COMPRESSION_BUFFER_SIZE);
+  b->read_buf = apr_palloc(pool, COMPRESSION_BUFFER_SIZE);
+  b->write_buf = svn_stringbuf_create_ensure(COMPRESSION_BUFFER_SIZE, pool);
+
+  /* Data that has already been received belongs to the compressed
+   * stream. */
+  if (len > COMPRESSION_BUFFER_SIZE)
+    return svn_error_create(SVN_ERR_RA_SVN_MALFORMED_DATA, NULL,
+                            _("Too much data received before enabling "
+                              "compression"));
+  memcpy(b->in_buf, data, len);
+  b->inflater.next_in = (Bytef *)b->in_buf;
+  b->inflater.avail_in = (uInt)len;
+
+  zerr = inflateInit(&b->inflater);
+  if (zerr != Z_OK)
+    return svn_error_trace(svn_error__wrap_zlib(
+                             zerr, "inflateInit",
+                             _("Decompression of connection data failed")));
+
+  zerr = deflateInit(&b->deflater, compression_level);
+  if (zerr != Z_OK)
+    {
+      inflateEnd(&b->inflater);
+      return svn_error_trace(svn_error__wrap_zlib(
+                               zerr, "deflateInit",
+                               _("Compression of connection data failed")));
+    }
+
+  apr_pool_cleanup_register(pool, b, compressed_cleanup,
+                            apr_pool_cleanup_null);
+
+  *stream = svn_ra_svn__stream_create(b, compressed_read_cb,
+                                      compressed_write_cb,
+                                      compressed_timeout_cb,
+                                      compressed_pending_cb, pool);
+
+  return SVN_NO_ERROR;
 }
 
 svn_ra_svn__stream_t *
@@ -224,9 +507,17 @@ svn_ra_svn__stream_create(void *baton,
   s->baton = baton;
   s->timeout_fn = timeout_cb;
   s->pending_fn = pending_cb;
+  s->writev_fn = NULL;
   return s;
 }
 
+void
+svn_ra_svn__stream_set_writev(svn_ra_svn__stream_t *stream,
+                              ra_svn_writev_fn_t writev_cb)
+{
+  stream->writev_fn = writev_cb;
+}
+
 svn_error_t *
 svn_ra_svn__stream_write(svn_ra_svn__stream_t *stream,
                          const char *data, apr_size_t *len)
@@ -234,6 +525,28 @@ svn_ra_svn__stream_write(svn_ra_svn__stream_t *stream,
   return svn_stream_write(stream->stream, data, len);
 }
 
+svn_error_t *
+svn_ra_svn__stream_writev(svn_ra_svn__stream_t *stream,
+                          const struct iovec *vec, int nvec,
+                          apr_size_t *len)
+{
+  int i;
+
+  if (stream->writev_fn)
+    return stream->writev_fn(stream->baton, vec, nvec, len);
+
+  /* Write the first non-empty buffer; the caller will retry the rest. */
+  for (i = 0; i < nvec; ++i)
+    if (vec[i].iov_len)
+      {
+        *len = vec[i].iov_len;
+        return svn_stream_write(stream->stream, vec[i].iov_base, len);
+      }
+
+  *len = 0;
+  return SVN_NO_ERROR;
+}
+
 svn_error_t *
 svn_ra_svn__stream_read(svn_ra_svn__stream_t *stream, char *data,
                         apr_size_t *len)
@@ -25,6 +25,7 @@
 
 #include <apr_pools.h>
 #include <apr_file_io.h>
+#include <apr_lib.h>
 
 #include "svn_pools.h"
 #include "svn_error.h"
@@ -33,38 +34,69 @@
 #include "svn_repos.h"
 #include "svn_config.h"
 #include "svn_ctype.h"
+#include "svn_io.h"
+#include "private/svn_atomic.h"
 #include "private/svn_fspath.h"
+#include "private/svn_mutex.h"
+#include "private/svn_repos_private.h"
 
 
 /*** Structures. ***/
 
-/* Information for the config enumerators called during authz
-   lookup. */
-struct authz_lookup_baton {
-  /* The authz configuration. */
-  svn_config_t *config;
+/* How the match string of an authz rule selects users. */
+typedef enum authz_match_kind_t
+{
+  authz_match_all,            /* "*" */
+  authz_match_anonymous,      /* "$anonymous" */
+  authz_match_authenticated,  /* "$authenticated" */
+  authz_match_user,           /* A user name. */
+  authz_match_group,          /* "@group" */
+  authz_match_alias           /* "&alias" */
+} authz_match_kind_t;
+
+/* One line of a path section, i.e. one "match = rights" pair. */
+typedef struct authz_rule_t
+{
+  /* Whom the rule applies to, before applying INVERTED. */
+  authz_match_kind_t kind;
 
-  /* The user to authorize. */
-  const char *user;
+  /* Whether the match string started with '~'. */
+  svn_boolean_t inverted;
 
-  /* Explicitly granted rights. */
+  /* The user name for authz_match_user, the lower-cased group or alias
+     name for authz_match_group and authz_match_alias, NULL otherwise.
+     Group and alias names are case-insensitive, like all option names
+     in a svn_config_t. */
+  const char *name;
+
+  /* Rights explicitly granted and denied by this rule. */
   svn_repos_authz_access_t allow;
-  /* Explicitly denied rights. */
   svn_repos_authz_access_t deny;
+} authz_rule_t;
 
-  /* The rights required by the caller of the lookup. */
-  svn_repos_authz_access_t required_access;
+/* A node in the tree of paths that have rules attached to them.  The
+   root node represents "/". */
+typedef struct authz_node_t
+{
+  /* Rules of the "[/path]" section for this node, or NULL.  Array of
+     authz_rule_t. */
+  apr_array_header_t *rules;
 
-  /* The following are used exclusively in recursive lookups. */
+  /* Maps repository names to the rules of the "[repos:/path]" sections
+     for this node.  NULL if there are none. */
+  apr_hash_t *repos_rules;
 
-  /* The path in the repository (an fspath) to authorize. */
-  const char *repos_path;
-  /* repos_path prefixed by the repository name and a colon. */
-  const char *qualified_repos_path;
+  /* Maps path segments to authz_node_t *.  NULL for leaves. */
+  apr_hash_t *children;
+} authz_node_t;
 
-  /* Whether, at the end of a recursive lookup, access is granted. */
-  svn_boolean_t access;
-};
+/* Groups and aliases that a user is a member of.  Both hashes map
+   lower-cased names to themselves. */
+typedef struct authz_user_t
+{
+  apr_hash_t *groups;
+  apr_hash_t *aliases;
+} authz_user_t;
 
 /* Information for the config enumeration functions called during the
    validation process. */
@@ -74,15 +106,29 @@ struct authz_validate_baton {
                            enumerator, if any. */
 };
 
-/* Currently this structure is just a wrapper around a
-   svn_config_t. */
+/* The authz rules, compiled for fast lookups.  Once constructed, the
+   structure is never modified, except for the atomic counters, so it may
+   be shared between threads. */
 struct svn_authz_t
 {
-  svn_config_t *cfg;
+  /* All path rules. */
+  authz_node_t *root;
+
+  /* Maps user names to their authz_user_t.  Users not mentioned in any
+     group or alias are not members of any. */
+  apr_hash_t *users;
+
+  /* Counters reported by svn_repos__authz_get_stats(). */
+  volatile svn_atomic_t lookups;
+  volatile svn_atomic_t recursive_lookups;
+  volatile svn_atomic_t repos_lookups;
+  volatile svn_atomic_t batched_lookups;
+  volatile svn_atomic_t sections_checked;
+  volatile svn_atomic_t cache_hits;
 };
 
 
-
+
 /*** Checking access. ***/
 
 /* Determine whether the REQUIRED access is granted given what authz
@@ -128,351 +174,634 @@ authz_access_is_determined(svn_repos_authz_access_t allow,
     return FALSE;
 }
 
-/* Return TRUE is USER equals ALIAS. The alias definitions are in the
-   "aliases" sections of CFG. Use POOL for temporary allocations during
-   the lookup. */
+/* Return TRUE if RULE applies to USER, whose group and alias memberships
+ * are given by MEMBERSHIP (NULL if there are none).  USER is NULL for
+ * anonymous sessions.
+ */
 static svn_boolean_t
-authz_alias_is_user(svn_config_t *cfg,
-                    const char *alias,
-                    const char *user,
-                    apr_pool_t *pool)
+authz_rule_applies_to_user(const authz_rule_t *rule,
+                           const char *user,
+                           const authz_user_t *membership)
 {
-  const char *value;
-
-  svn_config_get(cfg, &value, "aliases", alias, NULL);
-  if (!value)
-    return FALSE;
+  svn_boolean_t applies;
 
-  if (strcmp(value, user) == 0)
-    return TRUE;
+  switch (rule->kind)
+    {
+      case authz_match_all:
+        applies = TRUE;
+        break;
+
+      case authz_match_anonymous:
+        applies = (user == NULL);
+        break;
+
+      case authz_match_authenticated:
+        applies = (user != NULL);
+        break;
+
+      case authz_match_user:
+        applies = (user != NULL && strcmp(user, rule->name) == 0);
+        break;
+
+      case authz_match_group:
+        applies = (membership != NULL
+                   && apr_hash_get(membership->groups, rule->name,
+                                   APR_HASH_KEY_STRING) != NULL);
+        break;
+
+      default: /* authz_match_alias */
+        applies = (membership != NULL
+                   && apr_hash_get(membership->aliases, rule->name,
+                                   APR_HASH_KEY_STRING) != NULL);
+        break;
+    }
 
-  return FALSE;
+  return rule->inverted ? !applies : applies;
 }
 
 
-/* Return TRUE if USER is in GROUP.  The group definitions are in the
-   "groups" section of CFG.  Use POOL for temporary allocations during
-   the lookup. */
-static svn_boolean_t
-authz_group_contains_user(svn_config_t *cfg,
-                          const char *group,
-                          const char *user,
-                          apr_pool_t *pool)
+/* Add the rights that the RULES of one section grant and deny to USER
+ * (with MEMBERSHIP) to *ALLOW and *DENY.  Count the section in AUTHZ's
+ * statistics.
+ */
+static void
+authz_apply_rules(svn_repos_authz_access_t *allow,
+                  svn_repos_authz_access_t *deny,
+                  svn_authz_t *authz,
+                  const apr_array_header_t *rules,
+                  const char *user,
+                  const authz_user_t *membership)
 {
-  const char *value;
-  apr_array_header_t *list;
   int i;
 
-  svn_config_get(cfg, &value, "groups", group, NULL);
-
-  list = svn_cstring_split(value, ",", TRUE, pool);
-
-  for (i = 0; i < list->nelts; i++)
+  svn_atomic_inc(&authz->sections_checked);
+  for (i = 0; i < rules->nelts; i++)
     {
-      const char *group_user = APR_ARRAY_IDX(list, i, char *);
+      const authz_rule_t *rule = &APR_ARRAY_IDX(rules, i, authz_rule_t);
 
-      /* If the 'user' is a subgroup, recurse into it. */
-      if (*group_user == '@')
+      if (authz_rule_applies_to_user(rule, user, membership))
         {
-          if (authz_group_contains_user(cfg, &group_user[1],
-                                        user, pool))
-            return TRUE;
+          *allow |= rule->allow;
+          *deny |= rule->deny;
         }
+    }
+}
 
-      /* If the 'user' is an alias, verify it. */
-      else if (*group_user == '&')
-        {
-          if (authz_alias_is_user(cfg, &group_user[1],
-                                  user, pool))
-            return TRUE;
-        }
 
-      /* If the user matches, stop. */
-      else if (strcmp(user, group_user) == 0)
-        return TRUE;
-    }
+/* Return the rules of NODE's section for REPOS_NAME, or NULL. */
+static const apr_array_header_t *
+authz_node_repos_rules(const authz_node_t *node,
+                       const char *repos_name)
+{
+  if (node->repos_rules == NULL)
+    return NULL;
 
-  return FALSE;
+  return apr_hash_get(node->repos_rules, repos_name, APR_HASH_KEY_STRING);
 }
 
 
-/* Determines whether an authz rule applies to the current
- * user, given the name part of the rule's name-value pair
- * in RULE_MATCH_STRING and the authz_lookup_baton object
- * B with the username in question.
+/* Return the child of NODE for the first segment of PATH, which must
+ * not start with a '/'.  Set *REST to what follows that segment and
+ * its separator, or to NULL if PATH has only one segment.  Return NULL
+ * if there is no such child.
  */
-static svn_boolean_t
-authz_line_applies_to_user(const char *rule_match_string,
-                           struct authz_lookup_baton *b,
-                           apr_pool_t *pool)
+static const authz_node_t *
+authz_node_child(const char **rest,
+                 const authz_node_t *node,
+                 const char *path)
 {
-  /* If the rule has an inversion, recurse and invert the result. */
-  if (rule_match_string[0] == '~')
-    return !authz_line_applies_to_user(&rule_match_string[1], b, pool);
+  const char *end = strchr(path, '/');
+  apr_ssize_t len = end ? end - path : (apr_ssize_t)strlen(path);
 
-  /* Check for special tokens. */
-  if (strcmp(rule_match_string, "$anonymous") == 0)
-    return (b->user == NULL);
-  if (strcmp(rule_match_string, "$authenticated") == 0)
-    return (b->user != NULL);
+  *rest = end ? end + 1 : NULL;
+  if (node->children == NULL || len == 0)
+    return NULL;
 
-  /* Check for a wildcard rule. */
-  if (strcmp(rule_match_string, "*") == 0)
-    return TRUE;
-
-  /* If we get here, then the rule is:
-   *  - Not an inversion rule.
-   *  - Not an authz token rule.
-   *  - Not a wildcard rule.
-   *
-   * All that's left over is regular user or group specifications.
-   */
-
-  /* If the session is anonymous, then a user/group
-   * rule definitely won't match.
-   */
-  if (b->user == NULL)
-    return FALSE;
-
-  /* Process the rule depending on whether it is
-   * a user, alias or group rule.
-   */
-  if (rule_match_string[0] == '@')
-    return authz_group_contains_user(
-      b->config, &rule_match_string[1], b->user, pool);
-  else if (rule_match_string[0] == '&')
-    return authz_alias_is_user(
-      b->config, &rule_match_string[1], b->user, pool);
-  else
-    return (strcmp(b->user, rule_match_string) == 0);
+  return apr_hash_get(node->children, path, len);
 }
 
 
-/* Callback to parse one line of an authz file and update the
- * authz_baton accordingly.
+/* Validate access to the given user for the given path.  This
+ * function checks rules for exactly the path represented by NODE, and
+ * first tries a section specific to the given repository before
+ * falling back to pan-repository rules.
+ *
+ * Update *access_granted to inform the caller of the outcome of the
+ * lookup.  Return a boolean indicating whether the access rights were
+ * successfully determined.
  */
 static svn_boolean_t
-authz_parse_line(const char *name, const char *value,
-                 void *baton, apr_pool_t *pool)
+authz_get_node_access(svn_authz_t *authz,
+                      const authz_node_t *node,
+                      const char *repos_name,
+                      const char *user,
+                      const authz_user_t *membership,
+                      svn_repos_authz_access_t required_access,
+                      svn_boolean_t *access_granted)
 {
-  struct authz_lookup_baton *b = baton;
+  svn_repos_authz_access_t allow = svn_authz_none;
+  svn_repos_authz_access_t deny = svn_authz_none;
+  const apr_array_header_t *rules;
 
-  /* Stop if the rule doesn't apply to this user. */
-  if (!authz_line_applies_to_user(name, b, pool))
-    return TRUE;
+  /* Try to locate a repository-specific block first. */
+  rules = authz_node_repos_rules(node, repos_name);
+  if (rules)
+    {
+      authz_apply_rules(&allow, &deny, authz, rules, user, membership);
 
-  /* Set the access grants for the rule. */
-  if (strchr(value, 'r'))
-    b->allow |= svn_authz_read;
-  else
-    b->deny |= svn_authz_read;
+      *access_granted = authz_access_is_granted(allow, deny,
+                                                required_access);
 
-  if (strchr(value, 'w'))
-    b->allow |= svn_authz_write;
-  else
-    b->deny |= svn_authz_write;
+      /* If the first test has determined access, stop now. */
+      if (authz_access_is_determined(allow, deny, required_access))
+        return TRUE;
+    }
 
-  return TRUE;
+  /* No repository specific rule, try pan-repository rules. */
+  if (node->rules)
+    authz_apply_rules(&allow, &deny, authz, node->rules, user, membership);
+
+  *access_granted = authz_access_is_granted(allow, deny, required_access);
+  return authz_access_is_determined(allow, deny, required_access);
 }
 
 
-/* Return TRUE iff the access rules in SECTION_NAME apply to PATH_SPEC
- * (which is a repository name, colon, and repository fspath, such as
- * "myrepos:/trunk/foo").
+/* Validate access to the given user for PATH (relative to NODE, without
+ * a leading '/', or NULL for NODE itself).  Rules for the deepest path
+ * take precedence, so descend as far as the tree allows and work our
+ * way back towards NODE.
+ *
+ * Update *access_granted and return whether access has been determined
+ * like authz_get_node_access() does.
  */
 static svn_boolean_t
-is_applicable_section(const char *path_spec,
-                      const char *section_name)
+authz_get_path_access(svn_authz_t *authz,
+                      const authz_node_t *node,
+                      const char *path,
+                      const char *repos_name,
+                      const char *user,
+                      const authz_user_t *membership,
+                      svn_repos_authz_access_t required_access,
+                      svn_boolean_t *access_granted)
 {
-  apr_size_t path_spec_len = strlen(path_spec);
+  if (path)
+    {
+      const char *rest;
+      const authz_node_t *child = authz_node_child(&rest, node, path);
 
-  return ((strncmp(path_spec, section_name, path_spec_len) == 0)
-          && (path_spec[path_spec_len - 1] == '/'
-              || section_name[path_spec_len] == '/'
-              || section_name[path_spec_len] == '\0'));
+      if (child && authz_get_path_access(authz, child, rest, repos_name,
+                                         user, membership, required_access,
+                                         access_granted))
+        return TRUE;
+    }
+
+  return authz_get_node_access(authz, node, repos_name, user, membership,
+                               required_access, access_granted);
 }
 
 
-/* Callback to parse a section and update the authz_baton if the
- * section denies access to the subtree the baton describes.
+/* Return FALSE if a single section of NODE, either repository-specific
+ * or not, conclusively denies the REQUIRED_ACCESS.
  */
 static svn_boolean_t
-authz_parse_section(const char *section_name, void *baton, apr_pool_t *pool)
+authz_node_grants(svn_authz_t *authz,
+                  const authz_node_t *node,
+                  const char *repos_name,
+                  const char *user,
+                  const authz_user_t *membership,
+                  svn_repos_authz_access_t required_access)
 {
-  struct authz_lookup_baton *b = baton;
-  svn_boolean_t conclusive;
+  const apr_array_header_t *sections[2];
+  int i;
 
-  /* Does the section apply to us? */
-  if (is_applicable_section(b->qualified_repos_path,
-                            section_name) == FALSE
-      && is_applicable_section(b->repos_path,
-                               section_name) == FALSE)
-    return TRUE;
+  sections[0] = authz_node_repos_rules(node, repos_name);
+  sections[1] = node->rules;
 
-  /* Work out what this section grants. */
-  b->allow = b->deny = 0;
-  svn_config_enumerate2(b->config, section_name,
-                        authz_parse_line, b, pool);
+  for (i = 0; i < 2; i++)
+    if (sections[i])
+      {
+        svn_repos_authz_access_t allow = svn_authz_none;
+        svn_repos_authz_access_t deny = svn_authz_none;
 
-  /* Has the section explicitly determined an access? */
-  conclusive = authz_access_is_determined(b->allow, b->deny,
-                                          b->required_access);
+        authz_apply_rules(&allow, &deny, authz, sections[i], user,
+                          membership);
 
-  /* Is access granted OR inconclusive? */
-  b->access = authz_access_is_granted(b->allow, b->deny,
-                                      b->required_access)
-    || !conclusive;
+        /* As long as access isn't conclusively denied, carry on. */
+        if (!authz_access_is_granted(allow, deny, required_access)
+            && authz_access_is_determined(allow, deny, required_access))
+          return FALSE;
+      }
 
-  /* As long as access isn't conclusively denied, carry on. */
-  return b->access;
+  return TRUE;
 }
 
 
-/* Validate access to the given user for the given path.  This
- * function checks rules for exactly the given path, and first tries
- * to access a section specific to the given repository before falling
- * back to pan-repository rules.
- *
- * Update *access_granted to inform the caller of the outcome of the
- * lookup.  Return a boolean indicating whether the access rights were
- * successfully determined.
+/* Validate access to the given user for the subtree starting at NODE.
+ * Check all sections for paths in the subtree for rules which deny the
+ * requested access.  Return FALSE as soon as one is found, TRUE if
+ * there is none.
  */
 static svn_boolean_t
-authz_get_path_access(svn_config_t *cfg, const char *repos_name,
-                      const char *path, const char *user,
+authz_get_tree_access(svn_authz_t *authz,
+                      const authz_node_t *node,
+                      const char *repos_name,
+                      const char *user,
+                      const authz_user_t *membership,
                       svn_repos_authz_access_t required_access,
-                      svn_boolean_t *access_granted,
                       apr_pool_t *pool)
 {
-  const char *qualified_path;
-  struct authz_lookup_baton baton = { 0 };
+  apr_hash_index_t *hi;
 
-  baton.config = cfg;
-  baton.user = user;
+  if (!authz_node_grants(authz, node, repos_name, user, membership,
+                         required_access))
+    return FALSE;
 
-  /* Try to locate a repository-specific block first. */
-  qualified_path = apr_pstrcat(pool, repos_name, ":", path, (char *)NULL);
-  svn_config_enumerate2(cfg, qualified_path,
-                        authz_parse_line, &baton, pool);
+  if (node->children)
+    for (hi = apr_hash_first(pool, node->children); hi; hi = apr_hash_next(hi))
+      if (!authz_get_tree_access(authz, svn__apr_hash_index_val(hi),
+                                 repos_name, user, membership,
+                                 required_access, pool))
+        return FALSE;
+
+  return TRUE;
+}
 
-  *access_granted = authz_access_is_granted(baton.allow, baton.deny,
-                                            required_access);
 
-  /* If the first test has determined access, stop now. */
-  if (authz_access_is_determined(baton.allow, baton.deny,
-                                 required_access))
-    return TRUE;
+/* Return TRUE if a single section of NODE or any node below it,
+ * either specific to REPOS_NAME or not, grants USER the
+ * REQUIRED_ACCESS.  Use POOL for temporary allocations.
+ */
+static svn_boolean_t
+authz_get_any_access(svn_authz_t *authz,
+                     const authz_node_t *node,
+                     const char *repos_name,
+                     const char *user,
+                     const authz_user_t *membership,
+                     svn_repos_authz_access_t required_access,
+                     apr_pool_t *pool)
+{
+  const apr_array_header_t *sections[2];
+  apr_hash_index_t *hi;
+  int i;
 
-  /* No repository specific rule, try pan-repository rules. */
-  svn_config_enumerate2(cfg, path, authz_parse_line, &baton, pool);
+  sections[0] = authz_node_repos_rules(node, repos_name);
+  sections[1] = node->rules;
+
+  for (i = 0; i < 2; i++)
+    if (sections[i])
+      {
+        svn_repos_authz_access_t allow = svn_authz_none;
+        svn_repos_authz_access_t deny = svn_authz_none;
+
+        authz_apply_rules(&allow, &deny, authz, sections[i], user,
+                          membership);
+
+        /* Stop on the first determined, granted access. */
+        if (authz_access_is_granted(allow, deny, required_access)
+            && authz_access_is_determined(allow, deny, required_access))
+          return TRUE;
+      }
+
+  if (node->children)
+    for (hi = apr_hash_first(pool, node->children); hi; hi = apr_hash_next(hi))
+      if (authz_get_any_access(authz, svn__apr_hash_index_val(hi),
+                               repos_name, user, membership,
+                               required_access, pool))
+        return TRUE;
 
-  *access_granted = authz_access_is_granted(baton.allow, baton.deny,
-                                            required_access);
-  return authz_access_is_determined(baton.allow, baton.deny,
-                                    required_access);
+  return FALSE;
 }
 
 
-/* Validate access to the given user for the subtree starting at the
- * given path.  This function walks the whole authz file in search of
- * rules applying to paths in the requested subtree which deny the
- * requested access.
- *
- * As soon as one is found, or else when the whole ACL file has been
- * searched, return the updated authorization status.
+
+/* Return the number of leading path segments that the canonical
+ * fspaths A and B have in common.
  */
-static svn_boolean_t
-authz_get_tree_access(svn_config_t *cfg, const char *repos_name,
-                      const char *path, const char *user,
-                      svn_repos_authz_access_t required_access,
-                      apr_pool_t *pool)
+static int
+authz_common_segments(const char *a, const char *b)
 {
-  struct authz_lookup_baton baton = { 0 };
+  int count = 0;
+  apr_size_t i;
 
-  baton.config = cfg;
-  baton.user = user;
-  baton.required_access = required_access;
-  baton.repos_path = path;
-  baton.qualified_repos_path = apr_pstrcat(pool, repos_name,
-                                           ":", path, (char *)NULL);
-  /* Default to access granted if no rules say otherwise. */
-  baton.access = TRUE;
+  for (i = 1; a[i] == b[i]; i++)
+    {
+      if (a[i] == '\0')
+        return i > 1 ? count + 1 : count;
+      if (a[i] == '/')
+        count++;
+    }
 
-  svn_config_enumerate_sections2(cfg, authz_parse_section,
-                                 &baton, pool);
+  /* One path may continue where the other one ends. */
+  if (i > 1 && ((a[i] == '\0' && b[i] == '/')
+                || (a[i] == '/' && b[i] == '\0')))
+    count++;
 
-  return baton.access;
+  return count;
 }
 
 
-/* Callback to parse sections of the configuration file, looking for
-   any kind of granted access.  Implements the
-   svn_config_section_enumerator2_t interface. */
+/*** Compiling the authz file. ***/
+
+/* Baton for the config enumerators called while compiling the rules. */
+struct authz_compile_baton
+{
+  /* The configuration being compiled. */
+  svn_config_t *config;
+
+  /* The authz being built. */
+  svn_authz_t *authz;
+
+  /* Maps lower-cased group names to their members as given in the
+     [groups] section (arrays of const char *). */
+  apr_hash_t *groups;
+
+  /* Maps lower-cased alias names to the user name they stand for. */
+  apr_hash_t *aliases;
+
+  /* The section currently compiled and its rules. */
+  apr_array_header_t *rules;
+
+  /* Pool for the compiled rules. */
+  apr_pool_t *pool;
+};
+
+/* Return a lower-cased copy of NAME allocated in POOL. */
+static const char *
+authz_lowercase(const char *name, apr_pool_t *pool)
+{
+  char *result = apr_pstrdup(pool, name);
+  char *p;
+
+  for (p = result; *p; ++p)
+    *p = (char)apr_tolower(*p);
+
+  return result;
+}
+
+/* Callback collecting the [groups] section.  Implements the
+   svn_config_enumerator2_t interface. */
+static svn_boolean_t
+authz_compile_group(const char *name, const char *value,
+                    void *baton, apr_pool_t *pool)
+{
+  struct authz_compile_baton *cb = baton;
+
+  apr_hash_set(cb->groups, authz_lowercase(name, pool), APR_HASH_KEY_STRING,
+               svn_cstring_split(value, ",", TRUE, pool));
+  return TRUE;
+}
+
+/* Callback collecting the [aliases] section.  Implements the
+   svn_config_enumerator2_t interface. */
 static svn_boolean_t
-authz_get_any_access_parser_cb(const char *section_name, void *baton,
-                               apr_pool_t *pool)
+authz_compile_alias(const char *name, const char *value,
+                    void *baton, apr_pool_t *pool)
 {
-  struct authz_lookup_baton *b = baton;
+  struct authz_compile_baton *cb = baton;
 
-  /* Does the section apply to the query? */
-  if (section_name[0] == '/'
-      || strncmp(section_name, b->qualified_repos_path,
-                 strlen(b->qualified_repos_path)) == 0)
+  apr_hash_set(cb->aliases, authz_lowercase(name, pool), APR_HASH_KEY_STRING,
+               apr_pstrdup(pool, value));
+  return TRUE;
+}
+
+/* Return the authz_user_t for USER in CB, creating it if necessary. */
+static authz_user_t *
+authz_get_user(struct authz_compile_baton *cb, const char *user)
+{
+  authz_user_t *result = apr_hash_get(cb->authz->users, user,
+                                      APR_HASH_KEY_STRING);
+  if (result == NULL)
     {
-      b->allow = b->deny = svn_authz_none;
+      result = apr_palloc(cb->pool, sizeof(*result));
+      result->groups = apr_hash_make(cb->pool);
+      result->aliases = apr_hash_make(cb->pool);
+      apr_hash_set(cb->authz->users, apr_pstrdup(cb->pool, user),
+                   APR_HASH_KEY_STRING, result);
+    }
+
+  return result;
+}
+
+/* Make all users in GROUP, including those of its subgroups, members of
+ * the lower-cased group name MEMBER_OF.  Group cycles have been ruled
+ * out by validation.  Use POOL for temporary allocations.
+ */
+static void
+authz_add_group_members(struct authz_compile_baton *cb,
+                        const char *group,
+                        const char *member_of,
+                        apr_pool_t *pool)
+{
+  apr_array_header_t *list = apr_hash_get(cb->groups, group,
+                                          APR_HASH_KEY_STRING);
+  int i;
 
-      svn_config_enumerate2(b->config, section_name,
-                            authz_parse_line, baton, pool);
-      b->access = authz_access_is_granted(b->allow, b->deny,
-                                          b->required_access);
+  if (list == NULL)
+    return;
 
-      /* Continue as long as we don't find a determined, granted access. */
-      return !(b->access
-               && authz_access_is_determined(b->allow, b->deny,
-                                             b->required_access));
+  for (i = 0; i < list->nelts; i++)
+    {
+      const char *group_user = APR_ARRAY_IDX(list, i, const char *);
+
+      if (*group_user == '@')
+        authz_add_group_members(cb, authz_lowercase(&group_user[1], pool),
+                                member_of, pool);
+      else
+        {
+          if (*group_user == '&')
+            group_user = apr_hash_get(cb->aliases,
+                                      authz_lowercase(&group_user[1], pool),
+                                      APR_HASH_KEY_STRING);
+          if (group_user)
+            apr_hash_set(authz_get_user(cb, group_user)->groups, member_of,
+                         APR_HASH_KEY_STRING, member_of);
+        }
     }
+}
+
+/* Resolve the group and alias memberships of all users in CB.  Use
+   POOL for temporary allocations. */
+static void
+authz_resolve_memberships(struct authz_compile_baton *cb,
+                          apr_pool_t *pool)
+{
+  apr_hash_index_t *hi;
+
+  for (hi = apr_hash_first(pool, cb->groups); hi; hi = apr_hash_next(hi))
+    authz_add_group_members(cb, svn__apr_hash_index_key(hi),
+                            apr_pstrdup(cb->pool,
+                                        svn__apr_hash_index_key(hi)),
+                            pool);
+
+  for (hi = apr_hash_first(pool, cb->aliases); hi; hi = apr_hash_next(hi))
+    {
+      const char *alias = apr_pstrdup(cb->pool, svn__apr_hash_index_key(hi));
+
+      apr_hash_set(authz_get_user(cb, svn__apr_hash_index_val(hi))->aliases,
+                   alias, APR_HASH_KEY_STRING, alias);
+    }
+}
+
+/* Callback compiling one line of a path section into CB->RULES.
+   Implements the svn_config_enumerator2_t interface. */
+static svn_boolean_t
+authz_compile_rule(const char *name, const char *value,
+                   void *baton, apr_pool_t *pool)
+{
+  struct authz_compile_baton *cb = baton;
+  authz_rule_t *rule = apr_array_push(cb->rules);
+
+  rule->inverted = (name[0] == '~');
+  if (rule->inverted)
+    name++;
+
+  rule->name = NULL;
+  if (strcmp(name, "$anonymous") == 0)
+    rule->kind = authz_match_anonymous;
+  else if (strcmp(name, "$authenticated") == 0)
+    rule->kind = authz_match_authenticated;
+  else if (strcmp(name, "*") == 0)
+    rule->kind = authz_match_all;
+  else if (name[0] == '@')
+    {
+      rule->kind = authz_match_group;
+      rule->name = authz_lowercase(&name[1], cb->pool);
+    }
+  else if (name[0] == '&')
+    {
+      rule->kind = authz_match_alias;
+      rule->name = authz_lowercase(&name[1], cb->pool);
+    }
+  else
+    {
+      rule->kind = authz_match_user;
+      rule->name = apr_pstrdup(cb->pool, name);
+    }
+
+  /* Set the access grants for the rule. */
+  rule->allow = svn_authz_none;
+  rule->deny = svn_authz_none;
+
+  if (strchr(value, 'r'))
+    rule->allow |= svn_authz_read;
+  else
+    rule->deny |= svn_authz_read;
+
+  if (strchr(value, 'w'))
+    rule->allow |= svn_authz_write;
+  else
+    rule->deny |= svn_authz_write;
 
   return TRUE;
 }
 
+/* Return the node for the canonical FSPATH in CB's tree, creating it and
+   its parents as necessary. */
+static authz_node_t *
+authz_make_node(struct authz_compile_baton *cb,
+                const char *fspath)
+{
+  authz_node_t *node = cb->authz->root;
+  const char *path = fspath + 1;
+
+  while (*path)
+    {
+      const char *end = strchr(path, '/');
+      apr_ssize_t len = end ? end - path : (apr_ssize_t)strlen(path);
+      authz_node_t *child = NULL;
+
+      if (node->children == NULL)
+        node->children = apr_hash_make(cb->pool);
+      else
+        child = apr_hash_get(node->children, path, len);
+
+      if (child == NULL)
+        {
+          child = apr_pcalloc(cb->pool, sizeof(*child));
+          apr_hash_set(node->children, apr_pstrndup(cb->pool, path, len),
+                       len, child);
+        }
+
+      node = child;
+      path += len;
+      if (*path)
+        path++;
+    }
+
+  return node;
+}
 
-/* Walk through the authz CFG to check if USER has the REQUIRED_ACCESS
- * to any path within the REPOSITORY.  Return TRUE if so.  Use POOL
- * for temporary allocations. */
+/* Callback compiling the section NAME into CB's tree.  Implements the
+   svn_config_section_enumerator2_t interface. */
 static svn_boolean_t
-authz_get_any_access(svn_config_t *cfg, const char *repos_name,
-                     const char *user,
-                     svn_repos_authz_access_t required_access,
-                     apr_pool_t *pool)
+authz_compile_section(const char *name, void *baton, apr_pool_t *pool)
 {
-  struct authz_lookup_baton baton = { 0 };
+  struct authz_compile_baton *cb = baton;
+  const char *fspath;
+  authz_node_t *node;
 
-  baton.config = cfg;
-  baton.user = user;
-  baton.required_access = required_access;
-  baton.access = FALSE; /* Deny access by default. */
-  baton.repos_path = "/";
-  baton.qualified_repos_path = apr_pstrcat(pool, repos_name,
-                                           ":/", (char *)NULL);
-
-  /* We could have used svn_config_enumerate2 for "repos_name:/".
-   * However, this requires access for root explicitly (which the user
-   * may not always have). So we end up enumerating the sections in
-   * the authz CFG and stop on the first match with some access for
-   * this user. */
-  svn_config_enumerate_sections2(cfg, authz_get_any_access_parser_cb,
-                                 &baton, pool);
-
-  /* If walking the configuration was inconclusive, deny access. */
-  if (!authz_access_is_determined(baton.allow,
-                                  baton.deny, baton.required_access))
-    return FALSE;
+  /* Skip group and alias definitions, just like validation does. */
+  if (strncmp(name, "groups", 6) == 0 || strncmp(name, "aliases", 7) == 0)
+    return TRUE;
 
-  return baton.access;
+  cb->rules = apr_array_make(cb->pool, 4, sizeof(authz_rule_t));
+  svn_config_enumerate2(cb->config, name, authz_compile_rule, cb, pool);
+
+  /* Validation made sure the path part is a canonical fspath. */
+  fspath = strchr(name, ':');
+  if (fspath)
+    {
+      node = authz_make_node(cb, fspath + 1);
+      if (node->repos_rules == NULL)
+        node->repos_rules = apr_hash_make(cb->pool);
+      apr_hash_set(node->repos_rules,
+                   apr_pstrndup(cb->pool, name, fspath - name),
+                   fspath - name, cb->rules);
+    }
+  else
+    {
+      node = authz_make_node(cb, name);
+      node->rules = cb->rules;
+    }
+
+  return TRUE;
 }
 
+/* Compile the validated authz rules in CFG into a new svn_authz_t,
+   allocated in RESULT_POOL, and return it in *AUTHZ_P.  Use
+   SCRATCH_POOL for temporary allocations. */
+static void
+authz_compile(svn_authz_t **authz_p,
+              svn_config_t *cfg,
+              apr_pool_t *result_pool,
+              apr_pool_t *scratch_pool)
+{
+  struct authz_compile_baton cb = { 0 };
+  svn_authz_t *authz = apr_pcalloc(result_pool, sizeof(*authz));
+
+  authz->root = apr_pcalloc(result_pool, sizeof(*authz->root));
+  authz->users = apr_hash_make(result_pool);
+
+  cb.config = cfg;
+  cb.authz = authz;
+  cb.groups = apr_hash_make(scratch_pool);
+  cb.aliases = apr_hash_make(scratch_pool);
+  cb.pool = result_pool;
+
+  svn_config_enumerate2(cfg, "groups", authz_compile_group, &cb,
+                        scratch_pool);
+  svn_config_enumerate2(cfg, "aliases", authz_compile_alias, &cb,
+                        scratch_pool);
+  authz_resolve_memberships(&cb, scratch_pool);
+
+  svn_config_enumerate_sections2(cfg, authz_compile_section, &cb,
+                                 scratch_pool);
+
+  *authz_p = authz;
+}
+
+
 
-
 /*** Validating the authz file. ***/
 
 /* Check for errors in GROUP's definition of CFG.  The errors
@@ -751,31 +1080,251 @@ static svn_boolean_t authz_validate_section(const char *name,
 
 
 
+/*** Sharing compiled authz files. ***/
+
+/* One authz file compiled by svn_repos__authz_read_cached(). */
+typedef struct authz_cache_entry_t
+{
+  /* The compiled rules. */
+  svn_authz_t *authz;
+
+  /* Modification time and size of the file when it was read. */
+  apr_time_t mtime;
+  svn_filesize_t size;
+
+  /* Number of pools the AUTHZ has been handed out to and that have not
+     been cleaned up yet.  Protected by AUTHZ_CACHE_LOCK. */
+  int refcount;
+
+  /* Set once a newer version of the file has replaced this entry in the
+     cache.  The entry is destroyed when the last reference goes away. */
+  svn_boolean_t superseded;
+
+  /* Root pool holding this entry and its AUTHZ. */
+  apr_pool_t *pool;
+} authz_cache_entry_t;
+
+/* Whether the cache below has been initialized. */
+static volatile svn_atomic_t authz_cache_init_state = 0;
+
+/* Maps authz file names to the authz_cache_entry_t of their latest
+   version, allocated in AUTHZ_CACHE_POOL.  Entries are only replaced,
+   never removed, so this grows with the number of files read. */
+static apr_hash_t *authz_cache = NULL;
+static apr_pool_t *authz_cache_pool = NULL;
+
+/* Serializes access to AUTHZ_CACHE and the entries' reference counts. */
+static svn_mutex__t *authz_cache_lock = NULL;
+
+/* Create the process-wide authz cache.  Implements the callback of
+   svn_atomic__init_once(). */
+static svn_error_t *
+authz_cache_init(void *baton, apr_pool_t *pool)
+{
+  /* The cache lives as long as the process, not as long as whoever
+     happens to read the first authz file. */
+  authz_cache_pool = svn_pool_create(NULL);
+  authz_cache = apr_hash_make(authz_cache_pool);
+  SVN_ERR(svn_mutex__init(&authz_cache_lock, TRUE, authz_cache_pool));
+
+  return SVN_NO_ERROR;
+}
+
+/* Find the cache entry for FILE and take a reference to it, if its
+   modification time and size match FINFO.  Otherwise, set *ENTRY_P to
+   NULL.  Call this only while holding AUTHZ_CACHE_LOCK. */
+static svn_error_t *
+authz_cache_lookup(authz_cache_entry_t **entry_p,
+                   const char *file,
+                   const apr_finfo_t *finfo)
+{
+  authz_cache_entry_t *entry = apr_hash_get(authz_cache, file,
+                                            APR_HASH_KEY_STRING);
+
+  if (entry && entry->mtime == finfo->mtime && entry->size == finfo->size)
+    entry->refcount++;
+  else
+    entry = NULL;
+
+  *entry_p = entry;
+  return SVN_NO_ERROR;
+}
+
+/* Make ENTRY the cache entry for FILE and set *OBSOLETE_P to the entry
+   that may have to be destroyed as a consequence, or to NULL.  Call this
+   only while holding AUTHZ_CACHE_LOCK. */
+static svn_error_t *
+authz_cache_insert(authz_cache_entry_t **obsolete_p,
+                   const char *file,
+                   authz_cache_entry_t *entry)
+{
+  authz_cache_entry_t *old = apr_hash_get(authz_cache, file,
+                                          APR_HASH_KEY_STRING);
+
+  *obsolete_p = NULL;
+  if (old)
+    {
+      old->superseded = TRUE;
+      if (old->refcount == 0)
+        *obsolete_p = old;
+
+      /* Keep the key allocated in the cache pool. */
+      apr_hash_set(authz_cache, file, APR_HASH_KEY_STRING, entry);
+    }
+  else
+    apr_hash_set(authz_cache, apr_pstrdup(authz_cache_pool, file),
+                 APR_HASH_KEY_STRING, entry);
+
+  return SVN_NO_ERROR;
+}
+
+/* Drop a reference to ENTRY and set *OBSOLETE_P to ENTRY if that was the
+   last reference to a superseded entry, NULL otherwise.  Call this only
+   while holding AUTHZ_CACHE_LOCK. */
+static svn_error_t *
+authz_cache_release(authz_cache_entry_t **obsolete_p,
+                    authz_cache_entry_t *entry)
+{
+  entry->refcount--;
+  *obsolete_p = (entry->superseded && entry->refcount == 0) ? entry : NULL;
+
+  return SVN_NO_ERROR;
+}
+
+/* Pool cleanup function dropping the reference to the
+   authz_cache_entry_t DATA held by the pool being cleaned up. */
+static apr_status_t
+authz_cache_entry_cleanup(void *data)
+{
+  authz_cache_entry_t *obsolete = NULL;
+  svn_error_t *err;
+
+  err = svn_mutex__lock(authz_cache_lock);
+  if (!err)
+    err = svn_mutex__unlock(authz_cache_lock,
+                            authz_cache_release(&obsolete, data));
+
+  if (err)
+    {
+      apr_status_t status = err->apr_err;
+      svn_error_clear(err);
+      return status;
+    }
+
+  if (obsolete)
+    svn_pool_destroy(obsolete->pool);
+
+  return APR_SUCCESS;
+}
+
+
+
 /*** Public functions. ***/
 
+
 svn_error_t *
 svn_repos_authz_read(svn_authz_t **authz_p, const char *file,
                      svn_boolean_t must_exist, apr_pool_t *pool)
 {
-  svn_authz_t *authz = apr_palloc(pool, sizeof(*authz));
+  svn_config_t *cfg;
   struct authz_validate_baton baton = { 0 };
+  apr_pool_t *scratch_pool = svn_pool_create(pool);
 
   baton.err = SVN_NO_ERROR;
 
-  /* Load the rule file. */
-  SVN_ERR(svn_config_read2(&authz->cfg, file, must_exist, TRUE, pool));
-  baton.config = authz->cfg;
+  /* Load the rule file.  Only the compiled rules are kept. */
+  SVN_ERR(svn_config_read2(&cfg, file, must_exist, TRUE, scratch_pool));
+  baton.config = cfg;
 
   /* Step through the entire rule file, stopping on error. */
-  svn_config_enumerate_sections2(authz->cfg, authz_validate_section,
-                                 &baton, pool);
+  svn_config_enumerate_sections2(cfg, authz_validate_section,
+                                 &baton, scratch_pool);
   SVN_ERR(baton.err);
 
-  *authz_p = authz;
+  authz_compile(authz_p, cfg, pool, scratch_pool);
+
+  svn_pool_destroy(scratch_pool);
   return SVN_NO_ERROR;
 }
 
 
+svn_error_t *
+svn_repos__authz_read_cached(svn_authz_t **authz_p, const char *file,
+                             svn_boolean_t must_exist, apr_pool_t *pool)
+{
+  apr_finfo_t finfo;
+  authz_cache_entry_t *entry;
+  authz_cache_entry_t *obsolete;
+  apr_pool_t *entry_pool;
+  svn_authz_t *authz;
+  svn_error_t *err;
+
+  /* Files we can't stat, e.g. missing ones, don't get cached.  Let
+     the normal reading code decide what to make of them. */
+  err = svn_io_stat(&finfo, file, APR_FINFO_MTIME | APR_FINFO_SIZE, pool);
+  if (err)
+    {
+      svn_error_clear(err);
+      return svn_repos_authz_read(authz_p, file, must_exist, pool);
+    }
+
+  SVN_ERR(svn_atomic__init_once(&authz_cache_init_state, authz_cache_init,
+                                NULL, pool));
+
+  SVN_MUTEX__WITH_LOCK(authz_cache_lock,
+                       authz_cache_lookup(&entry, file, &finfo));
+
+  if (entry)
+    {
+      svn_atomic_inc(&entry->authz->cache_hits);
+    }
+  else
+    {
+      /* Read and compile the file without holding the lock.  Should
+         another thread do the same concurrently, the last one to finish
+         wins and the other entry goes away with its last reference. */
+      entry_pool = svn_pool_create(NULL);
+      err = svn_repos_authz_read(&authz, file, must_exist, entry_pool);
+      if (err)
+        {
+          svn_pool_destroy(entry_pool);
+          return svn_error_trace(err);
+        }
+
+      entry = apr_pcalloc(entry_pool, sizeof(*entry));
+      entry->authz = authz;
+      entry->mtime = finfo.mtime;
+      entry->size = finfo.size;
+      entry->refcount = 1;
+      entry->pool = entry_pool;
+
+      SVN_MUTEX__WITH_LOCK(authz_cache_lock,
+                           authz_cache_insert(&obsolete, file, entry));
+      if (obsolete)
+        svn_pool_destroy(obsolete->pool);
+    }
+
+  apr_pool_cleanup_register(pool, entry, authz_cache_entry_cleanup,
+                            apr_pool_cleanup_null);
+
+  *authz_p = entry->authz;
+  return SVN_NO_ERROR;
+}
+
+
+void
+svn_repos__authz_get_stats(svn_repos__authz_stats_t *stats,
+                           svn_authz_t *authz)
+{
+  stats->lookups = svn_atomic_read(&authz->lookups);
+  stats->recursive_lookups = svn_atomic_read(&authz->recursive_lookups);
+  stats->repos_lookups = svn_atomic_read(&authz->repos_lookups);
+  stats->batched_lookups = svn_atomic_read(&authz->batched_lookups);
+  stats->sections_checked = svn_atomic_read(&authz->sections_checked);
+  stats->cache_hits = svn_atomic_read(&authz->cache_hits);
+}
+
+
 svn_error_t *
 svn_repos_authz_check_access(svn_authz_t *authz, const char *repos_name,
                              const char *path, const char *user,
@@ -783,51 +1332,195 @@ svn_repos_authz_check_access(svn_authz_t *authz, const char *repos_name,
                              svn_boolean_t *access_granted,
                              apr_pool_t *pool)
 {
-  const char *current_path;
+  const authz_user_t *membership = NULL;
+  const authz_node_t *node;
 
   if (!repos_name)
     repos_name = "";
 
+  if (user)
+    membership = apr_hash_get(authz->users, user, APR_HASH_KEY_STRING);
+
+  svn_atomic_inc(&authz->lookups);
+
   /* If PATH is NULL, check if the user has *any* access. */
   if (!path)
     {
-      *access_granted = authz_get_any_access(authz->cfg, repos_name,
-                                             user, required_access, pool);
+      svn_atomic_inc(&authz->repos_lookups);
+      *access_granted = authz_get_any_access(authz, authz->root, repos_name,
+                                             user, membership,
+                                             required_access, pool);
       return SVN_NO_ERROR;
     }
 
   /* Sanity check. */
   SVN_ERR_ASSERT(path[0] == '/');
 
-  /* Determine the granted access for the requested path. */
+  /* Determine the granted access for the requested path.  Deny access
+     by default, i.e. if no rule up to the root applies. */
   path = svn_fspath__canonicalize(path, pool);
-  current_path = path;
+  if (!authz_get_path_access(authz, authz->root, path[1] ? path + 1 : NULL,
+                             repos_name, user, membership, required_access,
+                             access_granted))
+    {
+      *access_granted = FALSE;
+      return SVN_NO_ERROR;
+    }
+
+  /* If the caller requested recursive access, we need to check all
+     rules for paths within PATH to see whether any of them are denied
+     to the requested user. */
+  if (*access_granted && (required_access & svn_authz_recursive))
+    {
+      const char *rest = path[1] ? path + 1 : NULL;
+
+      svn_atomic_inc(&authz->recursive_lookups);
+      for (node = authz->root; node && rest; )
+        node = authz_node_child(&rest, node, rest);
+
+      if (node)
+        *access_granted = authz_get_tree_access(authz, node, repos_name,
+                                                user, membership,
+                                                required_access, pool);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+
+/* Where svn_repos__authz_check_access_many() stands in the rule tree:
+   the node for one path segment and the access it leaves its
+   descendants with. */
+typedef struct authz_walk_frame_t
+{
+  const authz_node_t *node;
+  svn_boolean_t access_granted;
+} authz_walk_frame_t;
+
+svn_error_t *
+svn_repos__authz_check_access_many(svn_boolean_t *access_granted,
+                                   svn_authz_t *authz,
+                                   const char *repos_name,
+                                   const apr_array_header_t *paths,
+                                   const char *user,
+                                   svn_repos_authz_access_t required_access,
+                                   apr_pool_t *pool)
+{
+  const authz_user_t *membership = NULL;
+  apr_array_header_t *frames;
+  authz_walk_frame_t *frame;
+  const char *prev_path = NULL;
+  apr_pool_t *iterpool;
+  int i;
+
+  if (paths->nelts == 0)
+    return SVN_NO_ERROR;
 
-  while (!authz_get_path_access(authz->cfg, repos_name,
-                                current_path, user,
-                                required_access,
-                                access_granted,
-                                pool))
+  if (!repos_name)
+    repos_name = "";
+
+  if (user)
+    membership = apr_hash_get(authz->users, user, APR_HASH_KEY_STRING);
+
+  /* FRAMES holds the chain of tree nodes from the root down to the
+     deepest node matching the previous path.  Frames for the segments
+     a path shares with its predecessor are reused as they are. */
+  frames = apr_array_make(pool, 8, sizeof(authz_walk_frame_t));
+  frame = apr_array_push(frames);
+  frame->node = authz->root;
+  if (!authz_get_node_access(authz, authz->root, repos_name, user,
+                             membership, required_access,
+                             &frame->access_granted))
+    frame->access_granted = FALSE;
+
+  iterpool = svn_pool_create(pool);
+  for (i = 0; i < paths->nelts; i++)
     {
-      /* Stop if the loop hits the repository root with no
-         results. */
-      if (current_path[0] == '/' && current_path[1] == '\0')
+      const char *path = APR_ARRAY_IDX(paths, i, const char *);
+      const char *rest;
+      int depth;
+
+      svn_pool_clear(iterpool);
+
+      SVN_ERR_ASSERT(path[0] == '/');
+      if (!svn_fspath__is_canonical(path))
+        path = svn_fspath__canonicalize(path, pool);
+
+      /* Drop the frames not on the way to PATH. */
+      if (prev_path)
         {
-          /* Deny access by default. */
-          *access_granted = FALSE;
-          return SVN_NO_ERROR;
+          int common = authz_common_segments(prev_path, path);
+          if (frames->nelts > common + 1)
+            frames->nelts = common + 1;
         }
+      prev_path = path;
 
-      /* Work back to the parent path. */
-      current_path = svn_fspath__dirname(current_path, pool);
-    }
+      /* Skip the segments covered by the remaining frames. */
+      rest = path[1] ? path + 1 : NULL;
+      for (depth = 1; rest && depth < frames->nelts; depth++)
+        {
+          rest = strchr(rest, '/');
+          if (rest)
+            rest++;
+        }
 
-  /* If the caller requested recursive access, we need to walk through
-     the entire authz config to see whether any child paths are denied
-     to the requested user. */
-  if (*access_granted && (required_access & svn_authz_recursive))
-    *access_granted = authz_get_tree_access(authz->cfg, repos_name, path,
-                                            user, required_access, pool);
+      /* Descend as far as the rules go, deciding access for each node
+         on the way.  Nodes without conclusive rules inherit access from
+         their parent. */
+      frame = &APR_ARRAY_IDX(frames, frames->nelts - 1, authz_walk_frame_t);
+      while (rest)
+        {
+          const authz_node_t *child = authz_node_child(&rest, frame->node,
+                                                       rest);
+          svn_boolean_t parent_access = frame->access_granted;
+
+          if (child == NULL)
+            break;
+
+          frame = apr_array_push(frames);
+          frame->node = child;
+          if (!authz_get_node_access(authz, child, repos_name, user,
+                                     membership, required_access,
+                                     &frame->access_granted))
+            frame->access_granted = parent_access;
+        }
+
+      access_granted[i] = frame->access_granted;
 
+      /* For recursive lookups, any rule below PATH may still deny
+         access. */
+      if (access_granted[i] && (required_access & svn_authz_recursive))
+        {
+          svn_atomic_inc(&authz->recursive_lookups);
+          if (!rest)
+            access_granted[i] = authz_get_tree_access(authz, frame->node,
+                                                      repos_name, user,
+                                                      membership,
+                                                      required_access,
+                                                      iterpool);
+        }
+
+      svn_atomic_inc(&authz->lookups);
+      svn_atomic_inc(&authz->batched_lookups);
+    }
+
+  svn_pool_destroy(iterpool);
   return SVN_NO_ERROR;
 }
+
+
+svn_error_t *
+svn_repos__authz_read_func(svn_boolean_t *allowed,
+                           svn_fs_root_t *root,
+                           const char *path,
+                           void *baton,
+                           apr_pool_t *pool)
+{
+  svn_repos__authz_read_baton_t *rb = baton;
+
+  /* Relative and empty paths are relative to the repository root. */
+  return svn_repos_authz_check_access(rb->authz, rb->repos_name,
+                                      svn_fspath__canonicalize(path, pool),
+                                      rb->user, svn_authz_read, allowed,
+                                      pool);
+}
@@ -21,6 +21,10 @@
  */
 
 
+#include <apr_thread_proc.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_cond.h>
+
 #include "svn_private_config.h"
 #include "svn_pools.h"
 #include "svn_error.h"
@@ -34,7 +38,9 @@
 #include "svn_time.h"
 #include "svn_checksum.h"
 #include "svn_props.h"
+#include "svn_sorts.h"
 
+#include "private/svn_atomic.h"
 #include "private/svn_mergeinfo_private.h"
 #include "private/svn_fs_private.h"
 
@@ -1358,10 +1364,374 @@ verify_close_directory(void *dir_baton,
   return close_directory(dir_baton, pool);
 }
 
+/* Verify revision REV of FS by replaying it through a dump editor that
+   checks all directory entries, and by reading its revprops.  START_REV
+   is the oldest revision being verified.  Send warnings and the final
+   svn_repos_notify_verify_rev_end to NOTIFY_FUNC / NOTIFY_BATON, if not
+   NULL.  Use SCRATCH_POOL for temporary allocations. */
+static svn_error_t *
+verify_one_revision(svn_fs_t *fs,
+                    svn_revnum_t rev,
+                    svn_revnum_t start_rev,
+                    svn_repos_notify_func_t notify_func,
+                    void *notify_baton,
+                    svn_cancel_func_t cancel_func,
+                    void *cancel_baton,
+                    apr_pool_t *scratch_pool)
+{
+  const svn_delta_editor_t *dump_editor;
+  void *dump_edit_baton;
+  const svn_delta_editor_t *cancel_editor;
+  void *cancel_edit_baton;
+  svn_fs_root_t *to_root;
+  apr_hash_t *props;
+
+  /* Get cancellable dump editor, but with our close_directory handler. */
+  SVN_ERR(get_dump_editor(&dump_editor, &dump_edit_baton,
+                          fs, rev, "",
+                          svn_stream_empty(scratch_pool),
+                          NULL, NULL,
+                          verify_close_directory,
+                          notify_func, notify_baton,
+                          start_rev,
+                          FALSE, TRUE, /* use_deltas, verify */
+                          scratch_pool));
+  SVN_ERR(svn_delta_get_cancellation_editor(cancel_func, cancel_baton,
+                                            dump_editor, dump_edit_baton,
+                                            &cancel_editor,
+                                            &cancel_edit_baton,
+                                            scratch_pool));
+
+  SVN_ERR(svn_fs_revision_root(&to_root, fs, rev, scratch_pool));
+  SVN_ERR(svn_repos_replay2(to_root, "", SVN_INVALID_REVNUM, FALSE,
+                            cancel_editor, cancel_edit_baton,
+                            NULL, NULL, scratch_pool));
+  /* While our editor close_edit implementation is a no-op, we still
+     do this for completeness. */
+  SVN_ERR(cancel_editor->close_edit(cancel_edit_baton, scratch_pool));
+
+  SVN_ERR(svn_fs_revision_proplist(&props, fs, rev, scratch_pool));
+
+  if (notify_func)
+    {
+      svn_repos_notify_t *notify
+        = svn_repos_notify_create(svn_repos_notify_verify_rev_end,
+                                  scratch_pool);
+
+      notify->revision = rev;
+      notify_func(notify_baton, notify, scratch_pool);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+#if APR_HAS_THREADS
+/* Upper limit for the number of revisions per verify_range_t. */
+#define VERIFY_MAX_RANGE_SIZE 1000
+
+/* Number of verify_range_t per thread that we aim for, so that threads
+   running into expensive revisions don't hold up the others. */
+#define VERIFY_RANGES_PER_THREAD 8
+
+/* A range of revisions handed to a verify_thread() as a unit of work. */
+typedef struct verify_range_t
+{
+  svn_revnum_t start;
+  svn_revnum_t end;
+
+  /* Created by the verify_thread() and destroyed by the main thread right
+     after it delivered the notifications of this range.  NULL before and
+     after that. */
+  apr_pool_t *pool;
+
+  /* Copies of the svn_repos_notify_t * sent while verifying this range,
+     in the order they were sent, allocated in POOL. */
+  apr_array_header_t *notifications;
+
+  /* The outcome of the verification.  DONE gets set when the range has
+     been processed and both members are protected by the mutex in the
+     verify_shared_t. */
+  svn_error_t *err;
+  svn_boolean_t done;
+} verify_range_t;
+
+/* State shared between svn_repos_verify_fs3() and its verify_thread()s. */
+typedef struct verify_shared_t
+{
+  /* Path of the filesystem to verify and its oldest revision to verify. */
+  const char *fs_path;
+  svn_revnum_t start_rev;
+
+  /* All ranges to verify, in revision order. */
+  verify_range_t *ranges;
+  int range_count;
+
+  /* Protects NEXT_RANGE and the results in RANGES.  RANGE_DONE gets
+     signalled whenever a range has been processed. */
+  apr_thread_mutex_t *mutex;
+  apr_thread_cond_t *range_done;
+
+  /* Index of the first range not picked up by any thread yet. */
+  int next_range;
+
+  /* Set by the main thread when the remaining work is to be discarded. */
+  volatile svn_atomic_t aborted;
+} verify_shared_t;
+
+/* Return a new root pool that may be used from a thread other than the
+   creating one.  Pools sharing an allocator must not be used from
+   different threads, hence the allocator of its own. */
+static apr_pool_t *
+create_thread_pool(void)
+{
+  apr_allocator_t *allocator;
+  apr_pool_t *pool;
+
+  /* The global allocator is thread-safe, so fall back to that. */
+  if (apr_allocator_create(&allocator))
+    return svn_pool_create(NULL);
+
+  apr_allocator_max_free_set(allocator, SVN_ALLOCATOR_RECOMMENDED_MAX_FREE);
+  pool = svn_pool_create_ex(NULL, allocator);
+  apr_allocator_owner_set(allocator, pool);
+
+  return pool;
+}
+
+/* Implements svn_repos_notify_func_t.  Append a copy of NOTIFY to the
+   notifications of the verify_range_t in BATON. */
+static void
+record_notification(void *baton,
+                    const svn_repos_notify_t *notify,
+                    apr_pool_t *scratch_pool)
+{
+  verify_range_t *range = baton;
+  svn_repos_notify_t *copy = apr_pmemdup(range->pool, notify,
+                                         sizeof(*notify));
+
+  copy->warning_str = apr_pstrdup(range->pool, notify->warning_str);
+  copy->path = apr_pstrdup(range->pool, notify->path);
+  APR_ARRAY_PUSH(range->notifications, svn_repos_notify_t *) = copy;
+}
+
+/* Implements svn_cancel_func_t for verify_thread()s.  BATON is the
+   verify_shared_t. */
+static svn_error_t *
+check_verify_aborted(void *baton)
+{
+  verify_shared_t *shared = baton;
+
+  if (svn_atomic_read(&shared->aborted))
+    return svn_error_create(SVN_ERR_CANCELLED, NULL, NULL);
+
+  return SVN_NO_ERROR;
+}
+
+/* Verify RANGE in the filesystem FS, which is the one at SHARED->FS_PATH.
+   Use SCRATCH_POOL for temporary allocations. */
+static svn_error_t *
+verify_range(svn_fs_t *fs,
+             verify_range_t *range,
+             verify_shared_t *shared,
+             apr_pool_t *scratch_pool)
+{
+  apr_pool_t *iterpool = svn_pool_create(scratch_pool);
+  svn_revnum_t rev;
+
+  /* Backend-specific checks for this range first, just like the
+     sequential code does for the whole range. */
+  SVN_ERR(svn_fs_verify(shared->fs_path, check_verify_aborted, shared,
+                        range->start, range->end, scratch_pool));
+
+  for (rev = range->start; rev <= range->end; rev++)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(verify_one_revision(fs, rev, shared->start_rev,
+                                  record_notification, range,
+                                  check_verify_aborted, shared, iterpool));
+    }
+
+  svn_pool_destroy(iterpool);
+  return SVN_NO_ERROR;
+}
+
+/* Thread function verifying the ranges in the verify_shared_t DATA until
+   all of them have been picked up or the verification got aborted.
+   Every thread opens its own svn_fs_t. */
+static void * APR_THREAD_FUNC
+verify_thread(apr_thread_t *tid, void *data)
+{
+  verify_shared_t *shared = data;
+  apr_pool_t *pool = create_thread_pool();
+  apr_pool_t *iterpool = svn_pool_create(pool);
+  svn_fs_t *fs = NULL;
+
+  while (TRUE)
+    {
+      verify_range_t *range = NULL;
+      svn_error_t *err;
+
+      svn_pool_clear(iterpool);
+
+      apr_thread_mutex_lock(shared->mutex);
+      if (   !svn_atomic_read(&shared->aborted)
+          && shared->next_range < shared->range_count)
+        range = &shared->ranges[shared->next_range++];
+      apr_thread_mutex_unlock(shared->mutex);
+
+      if (range == NULL)
+        break;
+
+      range->pool = create_thread_pool();
+      range->notifications = apr_array_make(range->pool, 16,
+                                            sizeof(svn_repos_notify_t *));
+
+      err = fs ? SVN_NO_ERROR
+               : svn_fs_open(&fs, shared->fs_path, NULL, pool);
+      if (!err)
+        err = verify_range(fs, range, shared, iterpool);
+
+      apr_thread_mutex_lock(shared->mutex);
+      range->err = err;
+      range->done = TRUE;
+      apr_thread_cond_broadcast(shared->range_done);
+      apr_thread_mutex_unlock(shared->mutex);
+    }
+
+  svn_pool_destroy(pool);
+  return NULL;
+}
+
+/* Implement svn_repos_verify_fs3() for THREAD_COUNT > 1 threads, with
+   START_REV and END_REV already validated.  The main thread only hands
+   out revision ranges, waits for them in revision order and delivers
+   their notifications, so that NOTIFY_FUNC and CANCEL_FUNC only ever
+   get called from the calling thread. */
+static svn_error_t *
+verify_fs_concurrently(svn_fs_t *fs,
+                       svn_revnum_t start_rev,
+                       svn_revnum_t end_rev,
+                       int thread_count,
+                       svn_repos_notify_func_t notify_func,
+                       void *notify_baton,
+                       svn_cancel_func_t cancel_func,
+                       void *cancel_baton,
+                       apr_pool_t *pool)
+{
+  verify_shared_t *shared = apr_pcalloc(pool, sizeof(*shared));
+  apr_thread_t **threads;
+  apr_pool_t *iterpool = svn_pool_create(pool);
+  svn_revnum_t range_size;
+  svn_error_t *err = SVN_NO_ERROR;
+  apr_status_t status;
+  int i;
+
+  /* Split the revisions into ranges of roughly equal size. */
+  range_size = (end_rev - start_rev + 1)
+             / (thread_count * VERIFY_RANGES_PER_THREAD);
+  range_size = MAX(1, MIN(range_size, VERIFY_MAX_RANGE_SIZE));
+
+  shared->fs_path = svn_fs_path(fs, pool);
+  shared->start_rev = start_rev;
+  shared->range_count = (int)((end_rev - start_rev + range_size)
+                              / range_size);
+  shared->ranges = apr_pcalloc(pool,
+                               shared->range_count * sizeof(*shared->ranges));
+  for (i = 0; i < shared->range_count; ++i)
+    {
+      shared->ranges[i].start = start_rev + i * range_size;
+      shared->ranges[i].end = MIN(end_rev,
+                                  shared->ranges[i].start + range_size - 1);
+    }
+
+  status = apr_thread_mutex_create(&shared->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                   pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create mutex"));
+  status = apr_thread_cond_create(&shared->range_done, pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create condition variable"));
+
+  threads = apr_pcalloc(pool, thread_count * sizeof(*threads));
+  thread_count = MIN(thread_count, shared->range_count);
+  for (i = 0; i < thread_count; ++i)
+    {
+      status = apr_thread_create(&threads[i], NULL, verify_thread, shared,
+                                 pool);
+      if (status)
+        {
+          threads[i] = NULL;
+          err = svn_error_wrap_apr(status, _("Can't create thread"));
+          break;
+        }
+    }
+
+  /* Deliver the results in revision order while the threads proceed. */
+  for (i = 0; !err && i < shared->range_count; ++i)
+    {
+      verify_range_t *range = &shared->ranges[i];
+      int k;
+
+      svn_pool_clear(iterpool);
+
+      apr_thread_mutex_lock(shared->mutex);
+      while (!range->done && !err)
+        {
+          apr_thread_cond_timedwait(shared->range_done, shared->mutex,
+                                    apr_time_from_sec(1) / 10);
+          if (cancel_func)
+            err = cancel_func(cancel_baton);
+        }
+      apr_thread_mutex_unlock(shared->mutex);
+
+      if (err)
+        break;
+
+      if (notify_func)
+        for (k = 0; k < range->notifications->nelts; ++k)
+          notify_func(notify_baton,
+                      APR_ARRAY_IDX(range->notifications, k,
+                                    svn_repos_notify_t *),
+                      iterpool);
+
+      err = range->err;
+      range->err = SVN_NO_ERROR;
+
+      /* Release the notifications of delivered ranges right away. */
+      svn_pool_destroy(range->pool);
+      range->pool = NULL;
+    }
+
+  /* Stop all threads that are still busy and wait for them. */
+  svn_atomic_set(&shared->aborted, TRUE);
+  for (i = 0; i < thread_count; ++i)
+    if (threads[i])
+      {
+        apr_status_t thread_status;
+        apr_thread_join(&thread_status, threads[i]);
+      }
+
+  /* Discard the results that were not delivered. */
+  for (i = 0; i < shared->range_count; ++i)
+    {
+      svn_error_clear(shared->ranges[i].err);
+      if (shared->ranges[i].pool)
+        svn_pool_destroy(shared->ranges[i].pool);
+    }
+
+  apr_thread_cond_destroy(shared->range_done);
+  apr_thread_mutex_destroy(shared->mutex);
+  svn_pool_destroy(iterpool);
+
+  return svn_error_trace(err);
+}
+#endif
+
 svn_error_t *
-svn_repos_verify_fs2(svn_repos_t *repos,
+svn_repos_verify_fs3(svn_repos_t *repos,
                      svn_revnum_t start_rev,
                      svn_revnum_t end_rev,
+                     int thread_count,
                      svn_repos_notify_func_t notify_func,
                      void *notify_baton,
                      svn_cancel_func_t cancel_func,
@@ -1395,56 +1765,26 @@ svn_repos_verify_fs2(svn_repos_t *repos,
                                "(youngest revision is %ld)"),
                              end_rev, youngest);
 
-  /* Verify global/auxiliary data and backend-specific data first. */
-  SVN_ERR(svn_fs_verify(svn_fs_path(fs, pool), cancel_func, cancel_baton,
-                        start_rev, end_rev, pool));
-
-  /* Create a notify object that we can reuse within the loop. */
-  if (notify_func)
-    notify = svn_repos_notify_create(svn_repos_notify_verify_rev_end,
-                                     pool);
-
-  for (rev = start_rev; rev <= end_rev; rev++)
+#if APR_HAS_THREADS
+  if (thread_count > 1 && end_rev > start_rev)
     {
-      const svn_delta_editor_t *dump_editor;
-      void *dump_edit_baton;
-      const svn_delta_editor_t *cancel_editor;
-      void *cancel_edit_baton;
-      svn_fs_root_t *to_root;
-      apr_hash_t *props;
-
-      svn_pool_clear(iterpool);
-
-      /* Get cancellable dump editor, but with our close_directory handler. */
-      SVN_ERR(get_dump_editor(&dump_editor, &dump_edit_baton,
-                              fs, rev, "",
-                              svn_stream_empty(iterpool),
-                              NULL, NULL,
-                              verify_close_directory,
-                              notify_func, notify_baton,
-                              start_rev,
-                              FALSE, TRUE, /* use_deltas, verify */
-                              iterpool));
-      SVN_ERR(svn_delta_get_cancellation_editor(cancel_func, cancel_baton,
-                                                dump_editor, dump_edit_baton,
-                                                &cancel_editor,
-                                                &cancel_edit_baton,
-                                                iterpool));
-
-      SVN_ERR(svn_fs_revision_root(&to_root, fs, rev, iterpool));
-      SVN_ERR(svn_repos_replay2(to_root, "", SVN_INVALID_REVNUM, FALSE,
-                                cancel_editor, cancel_edit_baton,
-                                NULL, NULL, iterpool));
-      /* While our editor close_edit implementation is a no-op, we still
-         do this for completeness. */
-      SVN_ERR(cancel_editor->close_edit(cancel_edit_baton, iterpool));
-
-      SVN_ERR(svn_fs_revision_proplist(&props, fs, rev, iterpool));
+      SVN_ERR(verify_fs_concurrently(fs, start_rev, end_rev, thread_count,
+                                     notify_func, notify_baton,
+                                     cancel_func, cancel_baton, iterpool));
+    }
+  else
+#endif
+    {
+      /* Verify global/auxiliary data and backend-specific data first. */
+      SVN_ERR(svn_fs_verify(svn_fs_path(fs, pool), cancel_func, cancel_baton,
+                            start_rev, end_rev, pool));
 
-      if (notify_func)
+      for (rev = start_rev; rev <= end_rev; rev++)
         {
-          notify->revision = rev;
-          notify_func(notify_baton, notify, iterpool);
+          svn_pool_clear(iterpool);
+          SVN_ERR(verify_one_revision(fs, rev, start_rev,
+                                      notify_func, notify_baton,
+                                      cancel_func, cancel_baton, iterpool));
         }
     }
 
@@ -39,9 +39,66 @@
 #include "repos.h"
 #include "private/svn_fspath.h"
 #include "private/svn_mergeinfo_private.h"
+#include "private/svn_repos_private.h"
 
 
 
+/* Set *LIST to the changes in CHANGES (as svn_sort__item_t, keyed by
+ * path).
+ *
+ * If AUTHZ_READ_FUNC is svn_repos__authz_read_func(), put *LIST in path
+ * order, check the readability of all changed paths in one pass and set
+ * *READABLE to an array holding the result for each element of *LIST.
+ * Otherwise, leave *LIST unsorted, set *READABLE to NULL and leave the
+ * checks to the caller.
+ *
+ * Allocate the results in POOL.
+ */
+static svn_error_t *
+list_changes(apr_array_header_t **list,
+             svn_boolean_t **readable,
+             apr_hash_t *changes,
+             svn_repos_authz_func_t authz_read_func,
+             void *authz_read_baton,
+             apr_pool_t *pool)
+{
+  svn_repos__authz_read_baton_t *rb = authz_read_baton;
+  apr_array_header_t *paths;
+  apr_hash_index_t *hi;
+  int i;
+
+  *readable = NULL;
+
+  /* Sorting only pays off for the batched authz check. */
+  if (authz_read_func != svn_repos__authz_read_func)
+    {
+      *list = apr_array_make(pool, apr_hash_count(changes),
+                             sizeof(svn_sort__item_t));
+      for (hi = apr_hash_first(pool, changes); hi; hi = apr_hash_next(hi))
+        {
+          svn_sort__item_t *item = apr_array_push(*list);
+          apr_hash_this(hi, &item->key, &item->klen, &item->value);
+        }
+
+      return SVN_NO_ERROR;
+    }
+
+  *list = svn_sort__hash(changes, svn_sort_compare_items_as_paths, pool);
+
+  paths = apr_array_make(pool, (*list)->nelts, sizeof(const char *));
+  for (i = 0; i < (*list)->nelts; i++)
+    APR_ARRAY_PUSH(paths, const char *)
+      = APR_ARRAY_IDX(*list, i, svn_sort__item_t).key;
+
+  *readable = apr_palloc(pool, paths->nelts * sizeof(**readable));
+  return svn_error_trace(
+           svn_repos__authz_check_access_many(*readable, rb->authz,
+                                              rb->repos_name, paths,
+                                              rb->user, svn_authz_read,
+                                              pool));
+}
+
+
 svn_error_t *
 svn_repos_check_revision_access(svn_repos_revision_access_level_t *access_level,
                                 svn_repos_t *repos,
@@ -53,7 +110,9 @@ svn_repos_check_revision_access(svn_repos_revision_access_level_t *access_level,
   svn_fs_t *fs = svn_repos_fs(repos);
   svn_fs_root_t *rev_root;
   apr_hash_t *changes;
-  apr_hash_index_t *hi;
+  apr_array_header_t *list;
+  svn_boolean_t *all_readable;
+  int i;
   svn_boolean_t found_readable = FALSE;
   svn_boolean_t found_unreadable = FALSE;
   apr_pool_t *subpool;
@@ -75,20 +134,24 @@ svn_repos_check_revision_access(svn_repos_revision_access_level_t *access_level,
 
   /* Otherwise, we have to check the readability of each changed
      path, or at least enough to answer the question asked. */
+  SVN_ERR(list_changes(&list, &all_readable, changes,
+                       authz_read_func, authz_read_baton, pool));
   subpool = svn_pool_create(pool);
-  for (hi = apr_hash_first(pool, changes); hi; hi = apr_hash_next(hi))
+  for (i = 0; i < list->nelts; i++)
     {
-      const void *key;
-      void *val;
-      svn_fs_path_change2_t *change;
+      const svn_sort__item_t *item = &APR_ARRAY_IDX(list, i,
+                                                    svn_sort__item_t);
+      const char *key = item->key;
+      svn_fs_path_change2_t *change = item->value;
       svn_boolean_t readable;
 
       svn_pool_clear(subpool);
-      apr_hash_this(hi, &key, NULL, &val);
-      change = val;
 
-      SVN_ERR(authz_read_func(&readable, rev_root, key,
-                              authz_read_baton, subpool));
+      if (all_readable)
+        readable = all_readable[i];
+      else
+        SVN_ERR(authz_read_func(&readable, rev_root, key,
+                                authz_read_baton, subpool));
       if (! readable)
         found_unreadable = TRUE;
       else
@@ -182,7 +245,9 @@ detect_changed(apr_hash_t **changed,
                apr_pool_t *pool)
 {
   apr_hash_t *changes;
-  apr_hash_index_t *hi;
+  apr_array_header_t *list;
+  svn_boolean_t *all_readable;
+  int i;
   apr_pool_t *subpool;
   svn_boolean_t found_readable = FALSE;
   svn_boolean_t found_unreadable = FALSE;
@@ -195,34 +260,37 @@ detect_changed(apr_hash_t **changed,
        revision is readable, then.  */
     return SVN_NO_ERROR;
 
+  /* Checking all paths in one go is much cheaper than calling
+     AUTHZ_READ_FUNC for each of them, if we can. */
+  SVN_ERR(list_changes(&list, &all_readable, changes,
+                       authz_read_func, authz_read_baton, pool));
   subpool = svn_pool_create(pool);
 
-  for (hi = apr_hash_first(pool, changes); hi; hi = apr_hash_next(hi))
+  for (i = 0; i < list->nelts; i++)
     {
       /* NOTE:  Much of this loop is going to look quite similar to
          svn_repos_check_revision_access(), but we have to do more things
          here, so we'll live with the duplication. */
-      const void *key;
-      void *val;
-      svn_fs_path_change2_t *change;
-      const char *path;
+      const svn_sort__item_t *sort_item = &APR_ARRAY_IDX(list, i,
+                                                         svn_sort__item_t);
+      const char *path = sort_item->key;
+      svn_fs_path_change2_t *change = sort_item->value;
       char action;
       svn_log_changed_path2_t *item;
 
       svn_pool_clear(subpool);
 
-      /* KEY will be the path, VAL the change. */
-      apr_hash_this(hi, &key, NULL, &val);
-      path = (const char *) key;
-      change = val;
-
       /* Skip path if unreadable. */
       if (authz_read_func)
         {
           svn_boolean_t readable;
-          SVN_ERR(authz_read_func(&readable,
-                                  root, path,
-                                  authz_read_baton, subpool));
+
+          if (all_readable)
+            readable = all_readable[i];
+          else
+            SVN_ERR(authz_read_func(&readable,
+                                    root, path,
+                                    authz_read_baton, subpool));
           if (! readable)
             {
               found_unreadable = TRUE;
@@ -35,6 +35,7 @@
 
 #include "private/svn_dep_compat.h"
 #include "private/svn_fspath.h"
+#include "private/svn_repos_private.h"
 #include "private/svn_subr_private.h"
 
 #define NUM_CACHED_SOURCE_ROOTS 4
@@ -124,6 +125,11 @@ typedef struct report_baton_t
   svn_repos_authz_func_t authz_read_func;
   void *authz_read_baton;
 
+  /* The target path of a directory whose whole subtree is readable, or
+     NULL.  Only set if AUTHZ_READ_FUNC is svn_repos__authz_read_func(),
+     see mark_readable_subtree(). */
+  const char *authz_readable_root;
+
   /* The spill-buffer holding the report. */
   svn_spillbuf_reader_t *reader;
 
@@ -655,13 +661,45 @@ static svn_error_t *
 check_auth(report_baton_t *b, svn_boolean_t *allowed, const char *path,
            apr_pool_t *pool)
 {
-  if (b->authz_read_func)
+  if (b->authz_read_func
+      && !(b->authz_readable_root
+           && svn_fspath__skip_ancestor(b->authz_readable_root, path)))
     return b->authz_read_func(allowed, b->t_root, path,
                               b->authz_read_baton, pool);
   *allowed = TRUE;
   return SVN_NO_ERROR;
 }
 
+/* If B's authz_read_func is svn_repos__authz_read_func() and the rules
+   allow reading everything at and below the directory T_PATH, make
+   T_PATH B's readable subtree root and set *MARKED to TRUE.  The
+   entries in that subtree then don't need to be checked one by one.
+   Otherwise, set *MARKED to FALSE.  Use POOL for temporary allocations. */
+static svn_error_t *
+mark_readable_subtree(report_baton_t *b, svn_boolean_t *marked,
+                      const char *t_path, apr_pool_t *pool)
+{
+  svn_repos__authz_read_baton_t *rb = b->authz_read_baton;
+  svn_boolean_t readable;
+
+  *marked = FALSE;
+  if (b->authz_read_func != svn_repos__authz_read_func
+      || b->authz_readable_root)
+    return SVN_NO_ERROR;
+
+  SVN_ERR(svn_repos_authz_check_access(rb->authz, rb->repos_name, t_path,
+                                       rb->user,
+                                       svn_authz_read | svn_authz_recursive,
+                                       &readable, pool));
+  if (readable)
+    {
+      b->authz_readable_root = t_path;
+      *marked = TRUE;
+    }
+
+  return SVN_NO_ERROR;
+}
+
 /* Create a dirent in *ENTRY for the given ROOT and PATH.  We use this to
    replace the source or target dirent when a report pathinfo tells us to
    change paths or revisions. */
@@ -1053,6 +1091,7 @@ delta_dirs(report_baton_t *b, svn_revnum_t s_rev, const char *s_path,
   apr_pool_t *subpool;
   const char *name, *s_fullpath, *t_fullpath, *e_fullpath;
   path_info_t *info;
+  svn_boolean_t readable_subtree;
 
   /* Compare the property lists.  If we're starting empty, pass a NULL
      source path so that we add all the properties.
@@ -1072,6 +1111,10 @@ delta_dirs(report_baton_t *b, svn_revnum_t s_rev, const char *s_path,
         }
       SVN_ERR(svn_fs_dir_entries(&t_entries, b->t_root, t_path, pool));
 
+      /* One recursive authz check may spare us checking every entry
+         below this directory. */
+      SVN_ERR(mark_readable_subtree(b, &readable_subtree, t_path, pool));
+
       /* Iterate over the report information for this directory. */
       subpool = svn_pool_create(pool);
 
@@ -1232,6 +1275,9 @@ delta_dirs(report_baton_t *b, svn_revnum_t s_rev, const char *s_path,
 
       /* Destroy iteration subpool. */
       svn_pool_destroy(subpool);
+
+      if (readable_subtree)
+        b->authz_readable_root = NULL;
     }
   return SVN_NO_ERROR;
 }
@@ -1497,6 +1543,7 @@ svn_repos_begin_report2(void **report_baton,
   b->edit_baton = edit_baton;
   b->authz_read_func = authz_read_func;
   b->authz_read_baton = authz_read_baton;
+  b->authz_readable_root = NULL;
   b->revision_infos = apr_hash_make(pool);
   b->pool = pool;
   b->reader = svn_spillbuf__reader_create(1000 /* blocksize */,
@@ -23,13 +23,21 @@
 
 #include <assert.h>
 #include <apr_md5.h>
+#include <apr_shm.h>
+#include <apr_global_mutex.h>
+#include <apr_thread_rwlock.h>
+#include <apr_atomic.h>
 #include "svn_pools.h"
 #include "svn_checksum.h"
 #include "md5.h"
 #include "svn_private_config.h"
 #include "cache.h"
 #include "svn_string.h"
+#include "svn_io.h"
+#include "svn_dirent_uri.h"
+#include "svn_version.h"
 #include "private/svn_dep_compat.h"
+#include "private/svn_string_private.h"
 #include "private/svn_mutex.h"
 
 /*
@@ -50,8 +58,19 @@
  * Only the start address of these two data parts are given as a native
  * pointer. All other references are expressed as offsets to these pointers.
  * With that design, it is relatively easy to share the same data structure
- * between different processes and / or to persist them on disk. These
- * out-of-process features have not been implemented, yet.
+ * between different processes and / or to persist them on disk.
+ *
+ * svn_cache__membuffer_cache_create_shared() makes use of that: it places
+ * the segment headers, directories and data buffers in a single anonymous
+ * shared memory block. Processes forked after the cache has been created
+ * inherit that mapping at the same address and will therefore see the
+ * same cache content. Access to each segment is then serialized by an
+ * APR global mutex, i.e. across threads as well as processes.
+ *
+ * Process-local caches use a reader / writer lock per segment instead.
+ * Lookups only need shared access: they don't modify the directory and
+ * update the hit statistics atomically. Only insertions, modifications
+ * and the resulting evictions need exclusive access to the segment.
  *
  * The data buffer usage information is implicitly given by the directory
  * entries. Every USED entry has a reference to the previous and the next
@@ -314,9 +333,9 @@ typedef struct entry_t
   apr_size_t size;
 
   /* Number of (read) hits for this entry. Will be reset upon write.
-   * Only valid for used entries.
+   * Only valid for used entries. Readers update it atomically.
    */
-  apr_uint32_t hit_count;
+  volatile apr_uint32_t hit_count;
 
   /* Reference to the next used entry in the order defined by offset.
    * NO_INDEX indicates the end of the list; this entry must be referenced
@@ -436,13 +455,143 @@ struct svn_membuffer_t
    */
   apr_uint64_t total_hits;
 
+  /* Number of hits and reads recorded by readers since the last time
+   * the segment got locked for writing.  Readers may only hold a shared
+   * lock and increment these atomically.  The next writer adds them to
+   * HIT_COUNT, TOTAL_HITS and TOTAL_READS, see write_lock_cache.
+   */
+  volatile apr_uint32_t pending_hits;
+  volatile apr_uint32_t pending_reads;
+
+#if APR_HAS_THREADS
   /* A lock for intra-process synchronization to the cache, or NULL if
    * the cache's creator doesn't feel the cache needs to be
-   * thread-safe.
+   * thread-safe.  Lookups only acquire it for reading.
    */
-  svn_mutex__t *mutex;
+  apr_thread_rwlock_t *lock;
+#endif
+
+  /* A lock for inter-process synchronization if this segment lives in
+   * shared memory. NULL for process-local caches. If set, LOCK will
+   * be NULL because the global mutex also serializes between threads.
+   *
+   * Please note that the mutex object itself lives in process-local
+   * memory. Forked processes get their own copy of it at the same address.
+   */
+  apr_global_mutex_t *shared_mutex;
 };
 
+/* Acquire shared access to the CACHE segment, i.e. we may read from it
+ * and update the hit counters atomically but not modify it otherwise.
+ */
+static svn_error_t *
+read_lock_cache(svn_membuffer_t *cache)
+{
+  if (cache->shared_mutex)
+    {
+      apr_status_t status = apr_global_mutex_lock(cache->shared_mutex);
+      if (status)
+        return svn_error_wrap_apr(status, _("Can't lock cache mutex"));
+    }
+
+#if APR_HAS_THREADS
+  if (cache->lock)
+    {
+      apr_status_t status = apr_thread_rwlock_rdlock(cache->lock);
+      if (status)
+        return svn_error_wrap_apr(status, _("Can't lock cache mutex"));
+    }
+#endif
+
+  return SVN_NO_ERROR;
+}
+
+/* Acquire exclusive access to the CACHE segment.  Since no reader may be
+ * active at that point, fold the statistics they gathered into the
+ * segment totals.
+ */
+static svn_error_t *
+write_lock_cache(svn_membuffer_t *cache)
+{
+  apr_uint32_t hits;
+
+  if (cache->shared_mutex)
+    {
+      apr_status_t status = apr_global_mutex_lock(cache->shared_mutex);
+      if (status)
+        return svn_error_wrap_apr(status, _("Can't write-lock cache mutex"));
+    }
+
+#if APR_HAS_THREADS
+  if (cache->lock)
+    {
+      apr_status_t status = apr_thread_rwlock_wrlock(cache->lock);
+      if (status)
+        return svn_error_wrap_apr(status, _("Can't write-lock cache mutex"));
+    }
+#endif
+
+  hits = apr_atomic_xchg32(&cache->pending_hits, 0);
+  cache->hit_count += hits;
+  cache->total_hits += hits;
+  cache->total_reads += apr_atomic_xchg32(&cache->pending_reads, 0);
+
+  return SVN_NO_ERROR;
+}
+
+/* Release the lock(s) protecting the CACHE segment that have been
+ * acquired by read_lock_cache or write_lock_cache. ERR is the result of
+ * the operation performed while holding the lock; return it or the
+ * unlock error, if any.
+ */
+static svn_error_t *
+unlock_cache(svn_membuffer_t *cache, svn_error_t *err)
+{
+#if APR_HAS_THREADS
+  if (cache->lock)
+    {
+      apr_status_t status = apr_thread_rwlock_unlock(cache->lock);
+      if (err)
+        return err;
+
+      if (status)
+        return svn_error_wrap_apr(status, _("Can't unlock cache mutex"));
+    }
+#endif
+
+  if (cache->shared_mutex)
+    {
+      apr_status_t status = apr_global_mutex_unlock(cache->shared_mutex);
+      if (err)
+        return err;
+
+      if (status)
+        return svn_error_wrap_apr(status, _("Can't unlock cache mutex"));
+    }
+
+  return err;
+}
+
+/* Execute EXPR while holding a shared lock for the CACHE segment.
+ * Same semantics as SVN_MUTEX__WITH_LOCK.
+ */
+#define WITH_READ_LOCK(cache, expr)                     \
+do {                                                    \
+  svn_membuffer_t *cache__locked = (cache);             \
+  SVN_ERR(read_lock_cache(cache__locked));              \
+  SVN_ERR(unlock_cache(cache__locked, (expr)));         \
+} while (0)
+
+/* Execute EXPR while holding an exclusive lock for the CACHE segment.
+ * Same semantics as SVN_MUTEX__WITH_LOCK.
+ */
+#define WITH_WRITE_LOCK(cache, expr)                    \
+do {                                                    \
+  svn_membuffer_t *cache__locked = (cache);             \
+  SVN_ERR(write_lock_cache(cache__locked));             \
+  SVN_ERR(unlock_cache(cache__locked, (expr)));         \
+} while (0)
+
 /* Align integer VALUE to the next ITEM_ALIGNMENT boundary.
  */
 #define ALIGN_VALUE(value) (((value) + ITEM_ALIGNMENT-1) & -ITEM_ALIGNMENT)
@@ -936,21 +1085,75 @@ static void* secure_aligned_alloc(apr_pool_t *pool,
   return memory;
 }
 
+/* Allocate SIZE bytes of cache memory. If *SHM_NEXT is not NULL, take
+ * them from the shared memory block at that position and move the
+ * position up accordingly. Otherwise, allocate from POOL. Zero the
+ * memory if ZERO has been set. Return NULL upon failed allocations.
+ */
+static void *
+cache_alloc(unsigned char **shm_next,
+            apr_size_t size,
+            svn_boolean_t zero,
+            apr_pool_t *pool)
+{
+  void *memory;
+
+  if (*shm_next == NULL)
+    return secure_aligned_alloc(pool, size, zero);
+
+  memory = *shm_next;
+  *shm_next += ALIGN_VALUE(size);
+  if (zero)
+    memset(memory, 0, size);
+
+  return memory;
+}
+
+/* Create an anonymous shared memory block of at least SIZE bytes that
+ * will be inherited by all processes forked from this one. Return its
+ * ITEM_ALIGNMENT-aligned start address in *BASE. The block will be
+ * released when POOL gets cleaned up.
+ */
+static svn_error_t *
+create_shared_block(unsigned char **base,
+                    apr_size_t size,
+                    apr_pool_t *pool)
+{
+#if APR_HAS_SHARED_MEMORY
+  apr_shm_t *shm;
+  apr_status_t status = apr_shm_create(&shm, size + ITEM_ALIGNMENT,
+                                       NULL, pool);
+  if (status)
+    return svn_error_wrap_apr(status,
+                              _("Can't create shared memory for cache"));
+
+  *base = ALIGN_POINTER(apr_shm_baseaddr_get(shm));
+  return SVN_NO_ERROR;
+#else
+  return svn_error_create(SVN_ERR_UNSUPPORTED_FEATURE, NULL,
+                          _("Shared memory caches are not supported "
+                            "on this platform"));
+#endif
+}
+
 /* Create a new membuffer cache instance. If the TOTAL_SIZE of the
  * memory i too small to accomodate the DICTIONARY_SIZE, the latte
  * will be resized automatically. Also, a minumum size is assured
  * for the DICTIONARY_SIZE. THREAD_SAFE may be FALSE, if there will
  * be no concurrent acccess to the CACHE returned.
  *
- * All allocations, in particular the data buffer and dictionary will
+ * If SHARED is set, the cache will be allocated in shared memory and
+ * access to it will be synchronized across processes as well. Otherwise,
+ * all allocations, in particular the data buffer and dictionary will
  * be made from POOL.
  */
-svn_error_t *
-svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
-                                  apr_size_t total_size,
-                                  apr_size_t directory_size,
-                                  svn_boolean_t thread_safe,
-                                  apr_pool_t *pool)
+static svn_error_t *
+membuffer_cache_create(svn_membuffer_t **cache,
+                       apr_size_t total_size,
+                       apr_size_t directory_size,
+                       svn_boolean_t thread_safe,
+                       svn_boolean_t shared,
+                       apr_pool_t *pool)
 {
   svn_membuffer_t *c;
 
@@ -963,6 +1166,9 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
   apr_uint64_t data_size;
   apr_uint64_t max_entry_size;
 
+  /* next free position in the shared memory block, if we use one */
+  unsigned char *shm_next = NULL;
+
   /* Determine a reasonable number of cache segments. Segmentation is
    * only useful for multi-threaded / multi-core servers as it reduces
    * lock contention on these systems.
@@ -979,9 +1185,6 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
 
   segment_count = 1 << segment_count_shift;
 
-  /* allocate cache as an array of segments / cache objects */
-  c = apr_palloc(pool, segment_count * sizeof(*c));
-
   /* Split total cache size into segments of equal size
    */
   total_size >>= segment_count_shift;
@@ -1026,6 +1229,23 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
     }
 
   group_init_size = 1 + group_count / (8 * GROUP_INIT_GRANULARITY);
+
+  /* A shared cache must keep all its state, i.e. the segment headers
+   * as well as the directories and data buffers, in shared memory.
+   */
+  if (shared)
+    SVN_ERR(create_shared_block(&shm_next,
+                                  ALIGN_VALUE(segment_count * sizeof(*c))
+                                + segment_count
+                                  * (  ALIGN_VALUE(group_count
+                                                   * sizeof(entry_group_t))
+                                     + ALIGN_VALUE(group_init_size)
+                                     + ALIGN_VALUE((apr_size_t)data_size)),
+                                pool));
+
+  /* allocate cache as an array of segments / cache objects */
+  c = cache_alloc(&shm_next, segment_count * sizeof(*c), FALSE, pool);
+
   for (seg = 0; seg < segment_count; ++seg)
     {
       /* allocate buffers and initialize cache members
@@ -1033,19 +1253,23 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
       c[seg].segment_count = segment_count;
 
       c[seg].group_count = group_count;
-      c[seg].directory = apr_pcalloc(pool,
-                                     group_count * sizeof(entry_group_t));
+      c[seg].directory = cache_alloc(&shm_next,
+                                     group_count * sizeof(entry_group_t),
+                                     TRUE,
+                                     pool);
 
       /* Allocate and initialize directory entries as "not initialized",
          hence "unused" */
-      c[seg].group_initialized = apr_pcalloc(pool, group_init_size);
+      c[seg].group_initialized = cache_alloc(&shm_next, group_init_size,
+                                             TRUE, pool);
 
       c[seg].first = NO_INDEX;
       c[seg].last = NO_INDEX;
       c[seg].next = NO_INDEX;
 
       c[seg].data_size = data_size;
-      c[seg].data = secure_aligned_alloc(pool, (apr_size_t)data_size, FALSE);
+      c[seg].data = cache_alloc(&shm_next, (apr_size_t)data_size, FALSE,
+                                pool);
       c[seg].current_data = 0;
       c[seg].data_used = 0;
       c[seg].max_entry_size = max_entry_size;
@@ -1055,6 +1279,8 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
       c[seg].total_reads = 0;
       c[seg].total_writes = 0;
       c[seg].total_hits = 0;
+      c[seg].pending_hits = 0;
+      c[seg].pending_reads = 0;
 
       /* were allocations successful?
        * If not, initialize a minimal cache structure.
@@ -1066,10 +1292,33 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
           return svn_error_wrap_apr(APR_ENOMEM, _("OOM"));
         }
 
-      /* A lock for intra-process synchronization to the cache, or NULL if
-       * the cache's creator doesn't feel the cache needs to be
-       * thread-safe. */
-      SVN_ERR(svn_mutex__init(&c[seg].mutex, thread_safe, pool));
+#if APR_HAS_THREADS
+      c[seg].lock = NULL;
+#endif
+      c[seg].shared_mutex = NULL;
+      if (shared)
+        {
+          /* A lock for inter-process (and inter-thread) synchronization.
+           * Let APR pick the most efficient mechanism available. */
+          apr_status_t status = apr_global_mutex_create(&c[seg].shared_mutex,
+                                                        NULL,
+                                                        APR_LOCK_DEFAULT,
+                                                        pool);
+          if (status)
+            return svn_error_wrap_apr(status,
+                                      _("Can't create cache mutex"));
+        }
+#if APR_HAS_THREADS
+      else if (thread_safe)
+        {
+          /* A lock for intra-process synchronization to the cache.
+           * Readers will not block each other. */
+          apr_status_t status = apr_thread_rwlock_create(&c[seg].lock, pool);
+          if (status)
+            return svn_error_wrap_apr(status,
+                                      _("Can't create cache mutex"));
+        }
+#endif
     }
 
   /* done here
@@ -1078,6 +1327,407 @@ svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
   return SVN_NO_ERROR;
 }
 
+svn_error_t *
+svn_cache__membuffer_cache_create(svn_membuffer_t **cache,
+                                  apr_size_t total_size,
+                                  apr_size_t directory_size,
+                                  svn_boolean_t thread_safe,
+                                  apr_pool_t *pool)
+{
+  return membuffer_cache_create(cache, total_size, directory_size,
+                                thread_safe, FALSE, pool);
+}
+
+svn_error_t *
+svn_cache__membuffer_cache_create_shared(svn_membuffer_t **cache,
+                                         apr_size_t total_size,
+                                         apr_size_t directory_size,
+                                         apr_pool_t *pool)
+{
+  return membuffer_cache_create(cache, total_size, directory_size,
+                                TRUE, TRUE, pool);
+}
+
+svn_error_t *
+svn_cache__membuffer_cache_child_init(svn_membuffer_t *cache,
+                                      apr_pool_t *pool)
+{
+  apr_uint32_t seg;
+
+  for (seg = 0; seg < cache->segment_count; ++seg)
+    if (cache[seg].shared_mutex)
+      {
+        /* On all platforms that support fork(), APR re-initializes the
+         * global mutex in place, i.e. the pointer stored in the shared
+         * segment header remains valid for all processes. */
+        apr_global_mutex_t *mutex = cache[seg].shared_mutex;
+        apr_status_t status = apr_global_mutex_child_init(&mutex, NULL,
+                                                          pool);
+        if (status)
+          return svn_error_wrap_apr(status,
+                                    _("Can't re-open cache mutex"));
+      }
+
+  return SVN_NO_ERROR;
+}
+
+
+/* Identifies snapshot files written by svn_cache__membuffer_cache_save.
+ */
+#define SNAPSHOT_MAGIC "SVN-MEMBUFFER"
+
+/* Increment this whenever the snapshot file layout changes.
+ */
+#define SNAPSHOT_FORMAT 1
+
+/* Header of a cache snapshot file. Since snapshots contain the raw
+ * directory and data buffer content, we only accept snapshots that were
+ * written by the same Subversion version with the same cache geometry.
+ */
+typedef struct snapshot_header_t
+{
+  /* SNAPSHOT_MAGIC, zero-padded */
+  char magic[16];
+
+  /* SVN_VER_NUMBER of the writer, zero-padded. Serialized items
+   * may change their layout between versions. */
+  char version[32];
+
+  /* SNAPSHOT_FORMAT */
+  apr_uint32_t format;
+
+  /* sizeof(entry_t) and ITEM_ALIGNMENT of the writer */
+  apr_uint32_t entry_size;
+  apr_uint32_t item_alignment;
+
+  /* cache geometry */
+  apr_uint32_t segment_count;
+  apr_uint32_t group_count;
+  apr_uint64_t data_size;
+
+  /* length of the validation data following this header */
+  apr_uint64_t validation_len;
+} snapshot_header_t;
+
+/* The variable part of a segment header as stored in a snapshot.
+ * The respective directory, init flags and data buffer contents follow
+ * it directly, terminated by an MD5 checksum over all of them.
+ */
+typedef struct snapshot_segment_t
+{
+  apr_uint64_t current_data;
+  apr_uint64_t data_used;
+  apr_uint64_t hit_count;
+  apr_uint32_t first;
+  apr_uint32_t last;
+  apr_uint32_t next;
+  apr_uint32_t used_entries;
+} snapshot_segment_t;
+
+/* Return the size of the group init flags vector in SEGMENT.
+ */
+static apr_size_t
+get_group_init_size(svn_membuffer_t *segment)
+{
+  return 1 + segment->group_count / (8 * GROUP_INIT_GRANULARITY);
+}
+
+/* Fill the snapshot HEADER for CACHE.
+ */
+static void
+init_snapshot_header(snapshot_header_t *header,
+                     svn_membuffer_t *cache)
+{
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+  apr_cpystrn(header->version, SVN_VER_NUMBER, sizeof(header->version));
+  header->format = SNAPSHOT_FORMAT;
+  header->entry_size = sizeof(entry_t);
+  header->item_alignment = ITEM_ALIGNMENT;
+  header->segment_count = cache->segment_count;
+  header->group_count = cache->group_count;
+  header->data_size = cache->data_size;
+}
+
+/* Write SIZE bytes from DATA to FILE and add them to the checksum CTX.
+ * Use SCRATCH_POOL for temporary allocations.
+ */
+static svn_error_t *
+write_checksummed(apr_file_t *file,
+                  svn_checksum_ctx_t *ctx,
+                  const void *data,
+                  apr_size_t size,
+                  apr_pool_t *scratch_pool)
+{
+  SVN_ERR(svn_checksum_update(ctx, data, size));
+  return svn_io_file_write_full(file, data, size, NULL, scratch_pool);
+}
+
+/* Read SIZE bytes from FILE into DATA and add them to the checksum CTX.
+ * Use SCRATCH_POOL for temporary allocations.
+ */
+static svn_error_t *
+read_checksummed(apr_file_t *file,
+                 svn_checksum_ctx_t *ctx,
+                 void *data,
+                 apr_size_t size,
+                 apr_pool_t *scratch_pool)
+{
+  SVN_ERR(svn_io_file_read_full2(file, data, size, NULL, NULL,
+                                 scratch_pool));
+  return svn_checksum_update(ctx, data, size);
+}
+
+/* Write the content of the cache SEGMENT to FILE.
+ *
+ * Note: This function requires the caller to serialization access.
+ */
+static svn_error_t *
+save_segment(svn_membuffer_t *segment,
+             apr_file_t *file,
+             apr_pool_t *scratch_pool)
+{
+  snapshot_segment_t state;
+  svn_checksum_ctx_t *ctx = svn_checksum_ctx_create(svn_checksum_md5,
+                                                    scratch_pool);
+  svn_checksum_t *checksum;
+
+  memset(&state, 0, sizeof(state));
+  state.current_data = segment->current_data;
+  state.data_used = segment->data_used;
+  state.hit_count = segment->hit_count;
+  state.first = segment->first;
+  state.last = segment->last;
+  state.next = segment->next;
+  state.used_entries = segment->used_entries;
+
+  SVN_ERR(write_checksummed(file, ctx, &state, sizeof(state),
+                            scratch_pool));
+  SVN_ERR(write_checksummed(file, ctx, segment->directory,
+                            segment->group_count * sizeof(entry_group_t),
+                            scratch_pool));
+  SVN_ERR(write_checksummed(file, ctx, segment->group_initialized,
+                            get_group_init_size(segment), scratch_pool));
+  SVN_ERR(write_checksummed(file, ctx, segment->data,
+                            (apr_size_t)segment->data_size, scratch_pool));
+
+  SVN_ERR(svn_checksum_final(&checksum, ctx, scratch_pool));
+  return svn_io_file_write_full(file, checksum->digest, APR_MD5_DIGESTSIZE,
+                                NULL, scratch_pool);
+}
+
+/* Mark all entries in SEGMENT as unused and the data buffer as empty.
+ *
+ * Note: This function requires the caller to serialization access.
+ */
+static void
+reset_segment(svn_membuffer_t *segment)
+{
+  memset(segment->group_initialized, 0, get_group_init_size(segment));
+
+  segment->first = NO_INDEX;
+  segment->last = NO_INDEX;
+  segment->next = NO_INDEX;
+  segment->current_data = 0;
+  segment->data_used = 0;
+  segment->used_entries = 0;
+  segment->hit_count = 0;
+}
+
+/* Read the content of the cache SEGMENT from FILE. If the data read is
+ * incomplete or corrupt, leave SEGMENT empty and set *VALID to FALSE.
+ *
+ * Note: This function requires the caller to serialization access.
+ */
+static svn_error_t *
+load_segment(svn_boolean_t *valid,
+             svn_membuffer_t *segment,
+             apr_file_t *file,
+             apr_pool_t *scratch_pool)
+{
+  snapshot_segment_t state;
+  svn_checksum_ctx_t *ctx = svn_checksum_ctx_create(svn_checksum_md5,
+                                                    scratch_pool);
+  svn_checksum_t *checksum;
+  svn_checksum_t expected;
+  unsigned char digest[APR_MD5_DIGESTSIZE];
+  svn_error_t *err;
+
+  err = read_checksummed(file, ctx, &state, sizeof(state), scratch_pool);
+  if (!err)
+    err = read_checksummed(file, ctx, segment->directory,
+                           segment->group_count * sizeof(entry_group_t),
+                           scratch_pool);
+  if (!err)
+    err = read_checksummed(file, ctx, segment->group_initialized,
+                           get_group_init_size(segment), scratch_pool);
+  if (!err)
+    err = read_checksummed(file, ctx, segment->data,
+                           (apr_size_t)segment->data_size, scratch_pool);
+  if (!err)
+    err = svn_io_file_read_full2(file, digest, sizeof(digest), NULL, NULL,
+                                 scratch_pool);
+
+  /* We have overwritten parts of the segment already. Make sure we
+   * don't leave it in an inconsistent state. */
+  if (err)
+    {
+      reset_segment(segment);
+      *valid = FALSE;
+
+      return svn_error_trace(err);
+    }
+
+  SVN_ERR(svn_checksum_final(&checksum, ctx, scratch_pool));
+  expected.kind = svn_checksum_md5;
+  expected.digest = digest;
+
+  *valid = svn_checksum_match(checksum, &expected)
+        && state.current_data <= segment->data_size
+        && state.data_used <= segment->data_size;
+  if (! *valid)
+    {
+      reset_segment(segment);
+      return SVN_NO_ERROR;
+    }
+
+  segment->current_data = state.current_data;
+  segment->data_used = state.data_used;
+  segment->hit_count = state.hit_count;
+  segment->first = state.first;
+  segment->last = state.last;
+  segment->next = state.next;
+  segment->used_entries = state.used_entries;
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_cache__membuffer_cache_save(svn_membuffer_t *cache,
+                                const char *path,
+                                const svn_string_t *validation,
+                                apr_pool_t *scratch_pool)
+{
+  snapshot_header_t header;
+  apr_file_t *file;
+  const char *temp_path;
+  apr_uint32_t seg;
+  apr_pool_t *iterpool = svn_pool_create(scratch_pool);
+
+  /* Write to a temporary file first such that readers will never
+   * see incomplete snapshots. */
+  SVN_ERR(svn_io_open_unique_file3(&file, &temp_path,
+                                   svn_dirent_dirname(path, scratch_pool),
+                                   svn_io_file_del_on_pool_cleanup,
+                                   scratch_pool, scratch_pool));
+
+  init_snapshot_header(&header, cache);
+  header.validation_len = validation ? validation->len : 0;
+
+  SVN_ERR(svn_io_file_write_full(file, &header, sizeof(header), NULL,
+                                 scratch_pool));
+  if (validation)
+    SVN_ERR(svn_io_file_write_full(file, validation->data, validation->len,
+                                   NULL, scratch_pool));
+
+  /* Segments will be locked one at a time, i.e. the snapshot does not
+   * represent a single point in time. Since segments are independent
+   * from one another, that is o.k. */
+  for (seg = 0; seg < cache->segment_count; ++seg)
+    {
+      svn_pool_clear(iterpool);
+      WITH_WRITE_LOCK(cache + seg,
+                      save_segment(cache + seg, file, iterpool));
+    }
+
+  svn_pool_destroy(iterpool);
+
+  SVN_ERR(svn_io_file_flush_to_disk(file, scratch_pool));
+  SVN_ERR(svn_io_file_close(file, scratch_pool));
+
+  return svn_error_trace(svn_io_file_rename(temp_path, path, scratch_pool));
+}
+
+svn_error_t *
+svn_cache__membuffer_cache_load(svn_boolean_t *loaded,
+                                svn_membuffer_t *cache,
+                                const char *path,
+                                svn_cache__validate_func_t validate_func,
+                                void *validate_baton,
+                                apr_pool_t *scratch_pool)
+{
+  snapshot_header_t header;
+  snapshot_header_t expected_header;
+  apr_file_t *file;
+  apr_size_t bytes_read;
+  svn_boolean_t valid = TRUE;
+  svn_error_t *err;
+  apr_uint32_t seg;
+  apr_pool_t *iterpool;
+
+  *loaded = FALSE;
+
+  /* A missing snapshot is not an error. We simply start cold. */
+  err = svn_io_file_open(&file, path, APR_READ | APR_BUFFERED,
+                         APR_OS_DEFAULT, scratch_pool);
+  if (err && APR_STATUS_IS_ENOENT(err->apr_err))
+    {
+      svn_error_clear(err);
+      return SVN_NO_ERROR;
+    }
+  SVN_ERR(err);
+
+  /* Is this snapshot compatible with our cache? */
+  SVN_ERR(svn_io_file_read_full2(file, &header, sizeof(header), &bytes_read,
+                                 NULL, scratch_pool));
+  init_snapshot_header(&expected_header, cache);
+  expected_header.validation_len = header.validation_len;
+
+  if (   bytes_read != sizeof(header)
+      || memcmp(&header, &expected_header, sizeof(header))
+      || header.validation_len > APR_SIZE_MAX - 1)
+    return svn_error_trace(svn_io_file_close(file, scratch_pool));
+
+  /* Let the caller check whether the cached content is still valid. */
+  if (validate_func)
+    {
+      svn_stringbuf_t *validation
+        = svn_stringbuf_create_ensure((apr_size_t)header.validation_len,
+                                      scratch_pool);
+      SVN_ERR(svn_io_file_read_full2(file, validation->data,
+                                     (apr_size_t)header.validation_len,
+                                     NULL, NULL, scratch_pool));
+      validation->len = (apr_size_t)header.validation_len;
+      validation->data[validation->len] = '\0';
+
+      SVN_ERR(validate_func(&valid, validate_baton,
+                            svn_stringbuf__morph_into_string(validation),
+                            scratch_pool));
+      if (! valid)
+        return svn_error_trace(svn_io_file_close(file, scratch_pool));
+    }
+  else
+    {
+      apr_off_t offset = (apr_off_t)header.validation_len;
+      SVN_ERR(svn_io_file_seek(file, APR_CUR, &offset, scratch_pool));
+    }
+
+  /* Replace the segment contents.  A corrupted segment will simply
+   * be left empty. */
+  iterpool = svn_pool_create(scratch_pool);
+  for (seg = 0; seg < cache->segment_count && valid; ++seg)
+    {
+      svn_pool_clear(iterpool);
+      WITH_WRITE_LOCK(cache + seg,
+                      load_segment(&valid, cache + seg, file, iterpool));
+    }
+
+  svn_pool_destroy(iterpool);
+
+  *loaded = valid;
+  return svn_error_trace(svn_io_file_close(file, scratch_pool));
+}
+
 
 /* Try to insert the serialized item given in BUFFER with SIZE into
  * the group GROUP_INDEX of CACHE and uniquely identify it by hash
@@ -1178,14 +1828,14 @@ membuffer_cache_set(svn_membuffer_t *cache,
 
   /* The actual cache data access needs to sync'ed
    */
-  SVN_MUTEX__WITH_LOCK(cache->mutex,
-                       membuffer_cache_set_internal(cache,
-                                                    to_find,
-                                                    group_index,
-                                                    buffer,
-                                                    size,
-                                                    DEBUG_CACHE_MEMBUFFER_TAG
-                                                    scratch_pool));
+  WITH_WRITE_LOCK(cache,
+                  membuffer_cache_set_internal(cache,
+                                               to_find,
+                                               group_index,
+                                               buffer,
+                                               size,
+                                               DEBUG_CACHE_MEMBUFFER_TAG
+                                               scratch_pool));
   return SVN_NO_ERROR;
 }
 
@@ -1213,7 +1863,7 @@ membuffer_cache_get_internal(svn_membuffer_t *cache,
   /* The actual cache data access needs to sync'ed
    */
   entry = find_entry(cache, group_index, to_find, FALSE);
-  cache->total_reads++;
+  apr_atomic_inc32(&cache->pending_reads);
   if (entry == NULL)
     {
       /* no such entry found.
@@ -1243,11 +1893,10 @@ membuffer_cache_get_internal(svn_membuffer_t *cache,
 
 #endif
 
-  /* update hit statistics
+  /* update hit statistics.  We may only hold a shared lock.
    */
-  entry->hit_count++;
-  cache->hit_count++;
-  cache->total_hits++;
+  apr_atomic_inc32(&entry->hit_count);
+  apr_atomic_inc32(&cache->pending_hits);
 
   *item_size = entry->size;
 
@@ -1284,14 +1933,14 @@ membuffer_cache_get(svn_membuffer_t *cache,
       return SVN_NO_ERROR;
     }
 
-  SVN_MUTEX__WITH_LOCK(cache->mutex,
-                       membuffer_cache_get_internal(cache,
-                                                    group_index,
-                                                    to_find,
-                                                    &buffer,
-                                                    &size,
-                                                    DEBUG_CACHE_MEMBUFFER_TAG
-                                                    result_pool));
+  WITH_READ_LOCK(cache,
+                 membuffer_cache_get_internal(cache,
+                                              group_index,
+                                              to_find,
+                                              &buffer,
+                                              &size,
+                                              DEBUG_CACHE_MEMBUFFER_TAG
+                                              result_pool));
 
   /* re-construct the original data object from its serialized form.
    */
@@ -1327,7 +1976,7 @@ membuffer_cache_get_partial_internal(svn_membuffer_t *cache,
                                      apr_pool_t *result_pool)
 {
   entry_t *entry = find_entry(cache, group_index, to_find, FALSE);
-  cache->total_reads++;
+  apr_atomic_inc32(&cache->pending_reads);
   if (entry == NULL)
     {
       *item = NULL;
@@ -1339,9 +1988,9 @@ membuffer_cache_get_partial_internal(svn_membuffer_t *cache,
     {
       *found = TRUE;
 
-      entry->hit_count++;
-      cache->hit_count++;
-      cache->total_hits++;
+      /* We may only hold a shared lock. */
+      apr_atomic_inc32(&entry->hit_count);
+      apr_atomic_inc32(&cache->pending_hits);
 
 #ifdef SVN_DEBUG_CACHE_MEMBUFFER
 
@@ -1392,11 +2041,11 @@ membuffer_cache_get_partial(svn_membuffer_t *cache,
   group_index = get_group_index(&cache, key, key_len, to_find, result_pool);
 
   if (group_index != NO_INDEX)
-    SVN_MUTEX__WITH_LOCK(cache->mutex,
-                         membuffer_cache_get_partial_internal
-                             (cache, group_index, to_find, item, found,
-                              deserializer, baton, DEBUG_CACHE_MEMBUFFER_TAG
-                              result_pool));
+    WITH_READ_LOCK(cache,
+                   membuffer_cache_get_partial_internal
+                       (cache, group_index, to_find, item, found,
+                        deserializer, baton, DEBUG_CACHE_MEMBUFFER_TAG
+                        result_pool));
 
   return SVN_NO_ERROR;
 }
@@ -1529,11 +2178,11 @@ membuffer_cache_set_partial(svn_membuffer_t *cache,
   group_index = get_group_index(&cache, key, key_len, to_find, scratch_pool);
 
   if (group_index != NO_INDEX)
-    SVN_MUTEX__WITH_LOCK(cache->mutex,
-                         membuffer_cache_set_partial_internal
-                             (cache, group_index, to_find, func, baton,
-                              DEBUG_CACHE_MEMBUFFER_TAG_ARG
-                              scratch_pool));
+    WITH_WRITE_LOCK(cache,
+                    membuffer_cache_set_partial_internal
+                        (cache, group_index, to_find, func, baton,
+                         DEBUG_CACHE_MEMBUFFER_TAG_ARG
+                         scratch_pool));
 
   /* done here -> unlock the cache
    */
@@ -1896,8 +2545,8 @@ svn_membuffer_cache_get_info(void *cache_void,
   for (i = 0; i < cache->membuffer->segment_count; ++i)
     {
       svn_membuffer_t *segment = cache->membuffer + i;
-      SVN_MUTEX__WITH_LOCK(segment->mutex,
-                           svn_membuffer_get_segment_info(segment, info));
+      WITH_READ_LOCK(segment,
+                     svn_membuffer_get_segment_info(segment, info));
     }
 
   return SVN_NO_ERROR;
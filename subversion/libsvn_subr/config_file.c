@@ -1087,6 +1087,12 @@ svn_config_ensure(const char *config_dir, apr_pool_t *pool)
         "### ra_local (the file:// scheme). The value represents the number" NL
         "### of MB used by the cache."                                       NL
         "# memory-cache-size = 16"                                           NL
+        "### Set diff-threads to the number of threads used by 'svn diff'"   NL
+        "### and 'svn merge' to compare files.  The results are the same as" NL
+        "### with the default of 1; they just arrive faster for diffs and"   NL
+        "### merges touching many files.  External diff and diff3 commands"  NL
+        "### always run one at a time."                                      NL
+        "# diff-threads = 4"                                                 NL
         ""                                                                   NL
         "### Section for configuring automatic properties."                  NL
         "[auto-props]"                                                       NL
@@ -0,0 +1,319 @@
+/*
+ * lz4.c :  fast compression using the LZ4 block format
+ *
+ * ====================================================================
+ *    Licensed to the Apache Software Foundation (ASF) under one
+ *    or more contributor license agreements.  See the NOTICE file
+ *    distributed with this work for additional information
+ *    regarding copyright ownership.  The ASF licenses this file
+ *    to you under the Apache License, Version 2.0 (the
+ *    "License"); you may not use this file except in compliance
+ *    with the License.  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing,
+ *    software distributed under the License is distributed on an
+ *    "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *    KIND, either express or implied.  See the License for the
+ *    specific language governing permissions and limitations
+ *    under the License.
+ * ====================================================================
+ */
+
+#include <string.h>
+
+#include "svn_string.h"
+#include "svn_error.h"
+
+#include "private/svn_subr_private.h"
+
+#include "svn_private_config.h"
+
+/* An LZ4 block is a sequence of "sequences".  Each one starts with a
+ * token byte whose upper 4 bits give the number of literal bytes and
+ * whose lower 4 bits give the match length minus MIN_MATCH.  A value of
+ * 15 in either field is followed by additional length bytes that get
+ * added until one of them is not 255.  Next come the literals, a 16 bit
+ * little-endian match offset and the additional match length bytes.
+ * The last sequence of a block consists of literals only.
+ *
+ * For compatibility with other LZ4 decoders, the last match must start
+ * at least MF_LIMIT bytes before the end of the data and the last
+ * LAST_LITERALS bytes are always literals.
+ */
+
+/* Shortest match that can be encoded. */
+#define MIN_MATCH 4
+
+/* No match may start within the last MF_LIMIT bytes. */
+#define MF_LIMIT 12
+
+/* The final bytes of the data that are always stored as literals. */
+#define LAST_LITERALS 5
+
+/* Largest distance a match offset can express. */
+#define MAX_DISTANCE 0xffff
+
+/* Value of a length nibble that indicates additional length bytes. */
+#define RUN_MASK 15
+
+/* Number of bits in the hash values used to find match candidates.
+ * The table needs 4 << HASH_LOG bytes of stack space. */
+#define HASH_LOG 12
+
+/* Fetch 4 bytes from P without alignment requirements. */
+static APR_INLINE apr_uint32_t
+read32(const unsigned char *p)
+{
+  apr_uint32_t value;
+  memcpy(&value, p, sizeof(value));
+  return value;
+}
+
+/* Map the 4 bytes VALUE to a slot in the hash table. */
+static APR_INLINE apr_uint32_t
+hash_func(apr_uint32_t value)
+{
+  return (value * 2654435761u) >> (32 - HASH_LOG);
+}
+
+/* Write the remainder LEN of a length field that did not fit into its
+ * token nibble to OP.  Return the position after the last byte written. */
+static unsigned char *
+write_length(unsigned char *op, apr_size_t len)
+{
+  for (; len >= 255; len -= 255)
+    *op++ = 255;
+  *op++ = (unsigned char)len;
+
+  return op;
+}
+
+/* Write a sequence with LITERAL_LEN literal bytes from LITERALS to OP,
+ * followed by a match of MATCH_LEN bytes at OFFSET.  A MATCH_LEN of 0
+ * indicates the final, literal-only sequence.  Return the position after
+ * the last byte written. */
+static unsigned char *
+write_sequence(unsigned char *op,
+               const unsigned char *literals,
+               apr_size_t literal_len,
+               apr_size_t offset,
+               apr_size_t match_len)
+{
+  unsigned char *token = op++;
+
+  if (literal_len >= RUN_MASK)
+    {
+      *token = RUN_MASK << 4;
+      op = write_length(op, literal_len - RUN_MASK);
+    }
+  else
+    *token = (unsigned char)(literal_len << 4);
+
+  memcpy(op, literals, literal_len);
+  op += literal_len;
+
+  if (match_len)
+    {
+      *op++ = (unsigned char)(offset & 0xff);
+      *op++ = (unsigned char)(offset >> 8);
+
+      match_len -= MIN_MATCH;
+      if (match_len >= RUN_MASK)
+        {
+          *token |= RUN_MASK;
+          op = write_length(op, match_len - RUN_MASK);
+        }
+      else
+        *token |= (unsigned char)match_len;
+    }
+
+  return op;
+}
+
+apr_size_t
+svn__lz4_compress_bound(apr_size_t len)
+{
+  return len + len / 255 + 16;
+}
+
+void
+svn__lz4_compress(svn_stringbuf_t *out,
+                  const char *data,
+                  apr_size_t len)
+{
+  const unsigned char *start = (const unsigned char *)data;
+  const unsigned char *end = start + len;
+  const unsigned char *anchor = start;
+  const unsigned char *ip = start;
+  unsigned char *op;
+
+  svn_stringbuf_ensure(out, out->len + svn__lz4_compress_bound(len));
+  op = (unsigned char *)out->data + out->len;
+
+  if (len > MF_LIMIT)
+    {
+      const unsigned char *match_limit = end - MF_LIMIT;
+      apr_uint32_t table[1 << HASH_LOG];
+
+      memset(table, 0, sizeof(table));
+      while (ip < match_limit)
+        {
+          apr_uint32_t h = hash_func(read32(ip));
+          const unsigned char *ref = start + table[h];
+          apr_size_t match_len, max_len;
+
+          table[h] = (apr_uint32_t)(ip - start);
+          if (   ref >= ip
+              || ip - ref > MAX_DISTANCE
+              || read32(ref) != read32(ip))
+            {
+              /* Skip faster through data that does not compress. */
+              ip += 1 + ((ip - anchor) >> 6);
+              continue;
+            }
+
+          /* Extend the match backwards into the pending literals ... */
+          while (ip > anchor && ref > start && ip[-1] == ref[-1])
+            {
+              --ip;
+              --ref;
+            }
+
+          /* ... and forwards as far as the format permits. */
+          max_len = end - LAST_LITERALS - ip;
+          for (match_len = MIN_MATCH;
+               match_len < max_len && ip[match_len] == ref[match_len];
+               ++match_len)
+            ;
+
+          op = write_sequence(op, anchor, ip - anchor, ip - ref, match_len);
+          ip += match_len;
+          anchor = ip;
+
+          /* Remember a position inside the match for future references. */
+          if (ip < match_limit)
+            table[hash_func(read32(ip - 2))] = (apr_uint32_t)(ip - 2 - start);
+        }
+    }
+
+  op = write_sequence(op, anchor, end - anchor, 0, 0);
+  out->len = op - (unsigned char *)out->data;
+  out->data[out->len] = '\0';
+}
+
+/* Read the additional length bytes at *IP and before END and add them
+ * to *LEN.  Return FALSE if the data ends prematurely or *LEN would
+ * exceed LIMIT. */
+static svn_boolean_t
+read_length(apr_size_t *len,
+            const unsigned char **ip,
+            const unsigned char *end,
+            apr_size_t limit)
+{
+  unsigned char c;
+
+  do
+    {
+      if (*ip >= end)
+        return FALSE;
+
+      c = *(*ip)++;
+      *len += c;
+      if (*len > limit)
+        return FALSE;
+    }
+  while (c == 255);
+
+  return TRUE;
+}
+
+svn_error_t *
+svn__lz4_decompress(svn_stringbuf_t *out,
+                    const char *data,
+                    apr_size_t len,
+                    apr_size_t original_len)
+{
+  const unsigned char *ip = (const unsigned char *)data;
+  const unsigned char *end = ip + len;
+  unsigned char *start, *op, *op_end;
+
+  svn_stringbuf_setempty(out);
+  svn_stringbuf_ensure(out, original_len);
+  start = (unsigned char *)out->data;
+  op = start;
+  op_end = start + original_len;
+
+  while (TRUE)
+    {
+      apr_size_t literal_len, match_len, offset;
+      unsigned char token;
+
+      if (ip >= end)
+        break;
+
+      token = *ip++;
+
+      /* Copy the literals. */
+      literal_len = token >> 4;
+      if (   literal_len == RUN_MASK
+          && !read_length(&literal_len, &ip, end, original_len))
+        break;
+
+      if (   literal_len > (apr_size_t)(end - ip)
+          || literal_len > (apr_size_t)(op_end - op))
+        break;
+
+      memcpy(op, ip, literal_len);
+      ip += literal_len;
+      op += literal_len;
+
+      /* The last sequence has no match part. */
+      if (ip == end)
+        {
+          if (op != op_end)
+            break;
+
+          out->len = original_len;
+          out->data[out->len] = '\0';
+          return SVN_NO_ERROR;
+        }
+
+      /* Copy the match, which may overlap with its own output. */
+      if (end - ip < 2)
+        break;
+
+      offset = ip[0] | ((apr_size_t)ip[1] << 8);
+      ip += 2;
+      if (offset == 0 || offset > (apr_size_t)(op - start))
+        break;
+
+      match_len = token & RUN_MASK;
+      if (   match_len == RUN_MASK
+          && !read_length(&match_len, &ip, end, original_len))
+        break;
+
+      match_len += MIN_MATCH;
+      if (match_len > (apr_size_t)(op_end - op))
+        break;
+
+      if (offset >= match_len)
+        {
+          memcpy(op, op - offset, match_len);
+          op += match_len;
+        }
+      else
+        {
+          const unsigned char *ref = op - offset;
+          unsigned char *match_end = op + match_len;
+
+          while (op < match_end)
+            *op++ = *ref++;
+        }
+    }
+
+  svn_stringbuf_setempty(out);
+  return svn_error_create(SVN_ERR_LZ4_DECOMPRESSION_FAILED, NULL,
+                          _("Invalid LZ4 compressed data"));
+}
@@ -53,13 +53,17 @@ static svn_cache_config_t cache_settings =
                   * value (< 100) may be more suitable.
                   */
 #ifdef APR_HAS_THREADS
-    FALSE        /* assume multi-threaded operation.
+    FALSE,       /* assume multi-threaded operation.
                   * Because this simply activates proper synchronization
                   * between threads, it is a safe default.
                   */
 #else
-    TRUE         /* single-threaded is the only supported mode of operation */
+    TRUE,        /* single-threaded is the only supported mode of operation */
 #endif
+    FALSE        /* process-local cache.
+                  * Sharing the cache requires the server to allocate it
+                  * before forking its worker processes.
+                  */
 };
 
 /* Get the current FSFS cache configuration. */
@@ -69,6 +73,11 @@ svn_cache_config_get(void)
   return &cache_settings;
 }
 
+/* The process-global (singleton) membuffer cache. NULL until it has been
+ * created by the first call to svn_cache__get_global_membuffer_cache.
+ */
+static svn_membuffer_t * volatile cache = NULL;
+
 /* Access the process-global (singleton) membuffer cache. The first call
  * will automatically allocate the cache using the current cache config.
  * NULL will be returned if the desired cache size is 0 or if the cache
@@ -77,8 +86,6 @@ svn_cache_config_get(void)
 svn_membuffer_t *
 svn_cache__get_global_membuffer_cache(void)
 {
-  static svn_membuffer_t * volatile cache = NULL;
-
   apr_uint64_t cache_size = cache_settings.cache_size;
   if (!cache && cache_size)
     {
@@ -115,12 +122,33 @@ svn_cache__get_global_membuffer_cache(void)
         return NULL;
       apr_allocator_owner_set(allocator, pool);
 
-      err = svn_cache__membuffer_cache_create(
-          &new_cache,
-          (apr_size_t)cache_size,
-          (apr_size_t)(cache_size / 16),
-          ! svn_cache_config_get()->single_threaded,
-          pool);
+      /* Try shared memory first, if requested. Fall back to a
+       * process-local cache if that is not supported.
+       */
+      err = NULL;
+      if (cache_settings.shared)
+        {
+          err = svn_cache__membuffer_cache_create_shared(
+              &new_cache,
+              (apr_size_t)cache_size,
+              (apr_size_t)(cache_size / 16),
+              pool);
+          if (err)
+            {
+              svn_error_clear(err);
+              apr_pool_clear(pool);
+              err = NULL;
+              new_cache = NULL;
+            }
+        }
+
+      if (new_cache == NULL)
+        err = svn_cache__membuffer_cache_create(
+            &new_cache,
+            (apr_size_t)cache_size,
+            (apr_size_t)(cache_size / 16),
+            ! svn_cache_config_get()->single_threaded,
+            pool);
 
       /* Some error occured. Most likely it's an OOM error but we don't
        * really care. Simply release all cache memory and disable caching
@@ -165,3 +193,18 @@ svn_cache_config_set(const svn_cache_config_t *settings)
   cache_settings = *settings;
 }
 
+void
+svn_cache_config_allocate(void)
+{
+  svn_cache__get_global_membuffer_cache();
+}
+
+svn_error_t *
+svn_cache_config_child_init(apr_pool_t *pool)
+{
+  if (cache)
+    SVN_ERR(svn_cache__membuffer_cache_child_init(cache, pool));
+
+  return SVN_NO_ERROR;
+}
+
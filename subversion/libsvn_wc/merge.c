@@ -995,52 +995,52 @@ merge_file_trivial(svn_skel_t **work_items,
 }
 
 
-/* XXX Insane amount of parameters... */
-static svn_error_t*
-merge_text_file(svn_skel_t **work_items,
-                enum svn_wc_merge_outcome_t *merge_outcome,
-                const merge_target_t *mt,
-                const char *left_abspath,
-                const char *right_abspath,
-                const char *left_label,
-                const char *right_label,
-                const char *target_label,
-                svn_boolean_t dry_run,
-                const svn_wc_conflict_version_t *left_version,
-                const svn_wc_conflict_version_t *right_version,
-                const char *detranslated_target_abspath,
-                svn_wc_conflict_resolver_func2_t conflict_func,
-                void *conflict_baton,
-                svn_cancel_func_t cancel_func,
-                void *cancel_baton,
-                apr_pool_t *result_pool,
-                apr_pool_t *scratch_pool)
+/* Open a temporary file for writing; this is where diff3 will write the
+   merged results of the merge into MT.  We want to use a tempfile with a
+   name that reflects the original, in case this ultimately winds up in a
+   conflict resolution editor.  Set *RESULT_F to the open file and
+   *RESULT_TARGET to its path, both allocated in RESULT_POOL. */
+static svn_error_t *
+open_merge_result(apr_file_t **result_f,
+                  const char **result_target,
+                  const merge_target_t *mt,
+                  apr_pool_t *result_pool,
+                  apr_pool_t *scratch_pool)
 {
-  apr_pool_t *pool = scratch_pool;  /* ### temporary rename  */
-  svn_boolean_t contains_conflicts;
-  apr_file_t *result_f;
-  const char *result_target;
   const char *base_name;
   const char *temp_dir;
-  svn_skel_t *work_item;
-
-  *work_items = NULL;
 
   base_name = svn_dirent_basename(mt->local_abspath, scratch_pool);
 
-  /* Open a second temporary file for writing; this is where diff3
-     will write the merged results.  We want to use a tempfile
-     with a name that reflects the original, in case this
-     ultimately winds up in a conflict resolution editor.  */
   SVN_ERR(svn_wc__db_temp_wcroot_tempdir(&temp_dir, mt->db, mt->wri_abspath,
-                                         pool, pool));
-  SVN_ERR(svn_io_open_uniquely_named(&result_f, &result_target,
+                                         scratch_pool, scratch_pool));
+  SVN_ERR(svn_io_open_uniquely_named(result_f, result_target,
                                      temp_dir, base_name, ".tmp",
-                                     svn_io_file_del_none, pool, pool));
+                                     svn_io_file_del_none,
+                                     result_pool, scratch_pool));
+
+  return SVN_NO_ERROR;
+}
+
+/* Run the external or internal merge, as requested by MT, and write the
+   result to RESULT_F.  See do_text_merge() for the other arguments.
 
-  /* Run the external or internal merge, as requested. */
+   This neither accesses the working copy database nor allocates from
+   anything but SCRATCH_POOL, so it may run on any thread. */
+static svn_error_t *
+run_text_merge(svn_boolean_t *contains_conflicts,
+               apr_file_t *result_f,
+               const merge_target_t *mt,
+               const char *detranslated_target_abspath,
+               const char *left_abspath,
+               const char *right_abspath,
+               const char *target_label,
+               const char *left_label,
+               const char *right_label,
+               apr_pool_t *scratch_pool)
+{
   if (mt->diff3_cmd)
-      SVN_ERR(do_text_merge_external(&contains_conflicts,
+      SVN_ERR(do_text_merge_external(contains_conflicts,
                                      result_f,
                                      mt,
                                      detranslated_target_abspath,
@@ -1049,9 +1049,9 @@ merge_text_file(svn_skel_t **work_items,
                                      target_label,
                                      left_label,
                                      right_label,
-                                     pool));
+                                     scratch_pool));
   else /* Use internal merge. */
-    SVN_ERR(do_text_merge(&contains_conflicts,
+    SVN_ERR(do_text_merge(contains_conflicts,
                           result_f,
                           mt,
                           detranslated_target_abspath,
@@ -1060,9 +1060,40 @@ merge_text_file(svn_skel_t **work_items,
                           target_label,
                           left_label,
                           right_label,
-                          pool));
+                          scratch_pool));
+
+  return SVN_NO_ERROR;
+}
+
+/* Handle the outcome of a text merge that wrote its (closed) result to
+   RESULT_TARGET and found conflicts if CONTAINS_CONFLICTS is TRUE.
+   XXX Insane amount of parameters... */
+static svn_error_t*
+merge_text_file(svn_skel_t **work_items,
+                enum svn_wc_merge_outcome_t *merge_outcome,
+                const merge_target_t *mt,
+                const char *left_abspath,
+                const char *right_abspath,
+                const char *left_label,
+                const char *right_label,
+                const char *target_label,
+                svn_boolean_t dry_run,
+                const svn_wc_conflict_version_t *left_version,
+                const svn_wc_conflict_version_t *right_version,
+                const char *detranslated_target_abspath,
+                const char *result_target,
+                svn_boolean_t contains_conflicts,
+                svn_wc_conflict_resolver_func2_t conflict_func,
+                void *conflict_baton,
+                svn_cancel_func_t cancel_func,
+                void *cancel_baton,
+                apr_pool_t *result_pool,
+                apr_pool_t *scratch_pool)
+{
+  apr_pool_t *pool = scratch_pool;  /* ### temporary rename  */
+  svn_skel_t *work_item;
 
-  SVN_ERR(svn_io_file_close(result_f, pool));
+  *work_items = NULL;
 
   if (contains_conflicts && ! dry_run)
     {
@@ -1344,116 +1375,187 @@ merge_binary_file(svn_skel_t **work_items,
   return SVN_NO_ERROR;
 }
 
-/* XXX Insane amount of parameters... */
-svn_error_t *
-svn_wc__internal_merge(svn_skel_t **work_items,
-                       enum svn_wc_merge_outcome_t *merge_outcome,
-                       svn_wc__db_t *db,
-                       const char *left_abspath,
-                       const svn_wc_conflict_version_t *left_version,
-                       const char *right_abspath,
-                       const svn_wc_conflict_version_t *right_version,
-                       const char *target_abspath,
-                       const char *wri_abspath,
-                       const char *left_label,
-                       const char *right_label,
-                       const char *target_label,
-                       apr_hash_t *actual_props,
-                       svn_boolean_t dry_run,
-                       const char *diff3_cmd,
-                       const apr_array_header_t *merge_options,
-                       const apr_array_header_t *prop_diff,
-                       svn_wc_conflict_resolver_func2_t conflict_func,
-                       void *conflict_baton,
-                       svn_cancel_func_t cancel_func,
-                       void *cancel_baton,
-                       apr_pool_t *result_pool,
-                       apr_pool_t *scratch_pool)
+/* The state of a merge between its preparation and its completion. */
+struct svn_wc__text_merge_t
 {
+  merge_target_t mt;
+
+  /* Whether there is no versioned target to merge into at all. */
+  svn_boolean_t no_target;
+
+  const char *left_abspath;       /* LEFT with the target's eol style */
+  const char *right_abspath;
+  const char *left_label;
+  const char *right_label;
+  const char *target_label;
+  const svn_wc_conflict_version_t *left_version;
+  const svn_wc_conflict_version_t *right_version;
+  svn_boolean_t dry_run;
+
+  svn_boolean_t is_binary;
   const char *detranslated_target_abspath;
-  svn_boolean_t is_binary = FALSE;
+
+  /* The outcome and work items of the trivial merge attempt. */
+  enum svn_wc_merge_outcome_t merge_outcome;
+  svn_skel_t *work_items;
+
+  /* The merge result of a text merge, if one is needed. */
+  apr_file_t *result_f;
+  const char *result_target;
+  svn_boolean_t contains_conflicts;
+};
+
+/* Prepare the merge described by the arguments of svn_wc__internal_merge()
+   in the caller-initialized *MERGE: detranslate the target, try a trivial
+   merge and, if that does not do, open the file for the result of a text
+   merge.  Allocate the work items in RESULT_POOL and everything else in
+   STATE_POOL, which must live until the merge has been completed. */
+static svn_error_t *
+prepare_merge(svn_wc__text_merge_t *merge,
+              svn_wc__db_t *db,
+              const char *left_abspath,
+              const svn_wc_conflict_version_t *left_version,
+              const char *right_abspath,
+              const svn_wc_conflict_version_t *right_version,
+              const char *target_abspath,
+              const char *wri_abspath,
+              const char *left_label,
+              const char *right_label,
+              const char *target_label,
+              apr_hash_t *actual_props,
+              svn_boolean_t dry_run,
+              const char *diff3_cmd,
+              const apr_array_header_t *merge_options,
+              const apr_array_header_t *prop_diff,
+              svn_cancel_func_t cancel_func,
+              void *cancel_baton,
+              apr_pool_t *result_pool,
+              apr_pool_t *state_pool)
+{
+  merge_target_t *mt = &merge->mt;
   const svn_prop_t *mimeprop;
-  svn_skel_t *work_item;
-  merge_target_t mt;
 
   SVN_ERR_ASSERT(svn_dirent_is_absolute(left_abspath));
   SVN_ERR_ASSERT(svn_dirent_is_absolute(right_abspath));
   SVN_ERR_ASSERT(svn_dirent_is_absolute(target_abspath));
 
-  *work_items = NULL;
-
   /* Fill the merge target baton */
-  mt.db = db;
-  mt.local_abspath = target_abspath;
-  mt.wri_abspath = wri_abspath;
-  mt.actual_props = actual_props;
-  mt.prop_diff = prop_diff;
-  mt.diff3_cmd = diff3_cmd;
-  mt.merge_options = merge_options;
+  mt->db = db;
+  mt->local_abspath = target_abspath;
+  mt->wri_abspath = wri_abspath;
+  mt->actual_props = actual_props;
+  mt->prop_diff = prop_diff;
+  mt->diff3_cmd = diff3_cmd;
+  mt->merge_options = merge_options;
+
+  merge->right_abspath = right_abspath;
+  merge->left_label = left_label;
+  merge->right_label = right_label;
+  merge->target_label = target_label;
+  merge->left_version = left_version;
+  merge->right_version = right_version;
+  merge->dry_run = dry_run;
+  merge->work_items = NULL;
+  merge->result_f = NULL;
+  merge->result_target = NULL;
+  merge->contains_conflicts = FALSE;
 
   /* Decide if the merge target is a text or binary file. */
-  if ((mimeprop = get_prop(&mt, SVN_PROP_MIME_TYPE))
+  if ((mimeprop = get_prop(mt, SVN_PROP_MIME_TYPE))
       && mimeprop->value)
-    is_binary = svn_mime_type_is_binary(mimeprop->value->data);
+    merge->is_binary = svn_mime_type_is_binary(mimeprop->value->data);
   else
     {
-      const char *value = svn_prop_get_value(mt.actual_props,
+      const char *value = svn_prop_get_value(mt->actual_props,
                                              SVN_PROP_MIME_TYPE);
 
-      is_binary = value && svn_mime_type_is_binary(value);
+      merge->is_binary = value && svn_mime_type_is_binary(value);
     }
 
-  SVN_ERR(detranslate_wc_file(&detranslated_target_abspath, &mt,
-                              (! is_binary) && diff3_cmd != NULL,
+  SVN_ERR(detranslate_wc_file(&merge->detranslated_target_abspath, mt,
+                              (! merge->is_binary) && diff3_cmd != NULL,
                               target_abspath,
                               cancel_func, cancel_baton,
-                              scratch_pool, scratch_pool));
+                              state_pool, state_pool));
 
   /* We cannot depend on the left file to contain the same eols as the
      right file. If the merge target has mods, this will mark the entire
      file as conflicted, so we need to compensate. */
-  SVN_ERR(maybe_update_target_eols(&left_abspath, &mt, left_abspath,
+  SVN_ERR(maybe_update_target_eols(&merge->left_abspath, mt, left_abspath,
                                    cancel_func, cancel_baton,
-                                   scratch_pool, scratch_pool));
+                                   state_pool, state_pool));
 
-  SVN_ERR(merge_file_trivial(work_items, merge_outcome,
-                             left_abspath, right_abspath,
+  SVN_ERR(merge_file_trivial(&merge->work_items, &merge->merge_outcome,
+                             merge->left_abspath, right_abspath,
                              target_abspath, dry_run, db,
-                             result_pool, scratch_pool));
+                             result_pool, state_pool));
+
+  if (merge->merge_outcome == svn_wc_merge_no_merge && ! merge->is_binary)
+    SVN_ERR(open_merge_result(&merge->result_f, &merge->result_target,
+                              mt, state_pool, state_pool));
+
+  return SVN_NO_ERROR;
+}
+
+/* Finish the prepared and run MERGE: handle conflicts and set *WORK_ITEMS
+   to the work items that install the result, allocated in RESULT_POOL.
+   Set *MERGE_OUTCOME to the outcome of the merge.  See
+   svn_wc__internal_merge() for the other arguments. */
+static svn_error_t *
+complete_merge(svn_skel_t **work_items,
+               enum svn_wc_merge_outcome_t *merge_outcome,
+               svn_wc__text_merge_t *merge,
+               svn_wc_conflict_resolver_func2_t conflict_func,
+               void *conflict_baton,
+               svn_cancel_func_t cancel_func,
+               void *cancel_baton,
+               apr_pool_t *result_pool,
+               apr_pool_t *scratch_pool)
+{
+  svn_skel_t *work_item;
+
+  *work_items = merge->work_items;
+  *merge_outcome = merge->merge_outcome;
+
   if (*merge_outcome == svn_wc_merge_no_merge)
     {
-      if (is_binary)
+      if (merge->is_binary)
         {
           SVN_ERR(merge_binary_file(work_items,
                                     merge_outcome,
-                                    &mt,
-                                    left_abspath,
-                                    right_abspath,
-                                    left_label,
-                                    right_label,
-                                    target_label,
-                                    dry_run,
-                                    left_version,
-                                    right_version,
-                                    detranslated_target_abspath,
+                                    &merge->mt,
+                                    merge->left_abspath,
+                                    merge->right_abspath,
+                                    merge->left_label,
+                                    merge->right_label,
+                                    merge->target_label,
+                                    merge->dry_run,
+                                    merge->left_version,
+                                    merge->right_version,
+                                    merge->detranslated_target_abspath,
                                     conflict_func,
                                     conflict_baton,
                                     result_pool, scratch_pool));
         }
       else
         {
+          SVN_ERR(svn_io_file_close(merge->result_f, scratch_pool));
+          merge->result_f = NULL;
+
           SVN_ERR(merge_text_file(work_items,
                                   merge_outcome,
-                                  &mt,
-                                  left_abspath,
-                                  right_abspath,
-                                  left_label,
-                                  right_label,
-                                  target_label,
-                                  dry_run,
-                                  left_version,
-                                  right_version,
-                                  detranslated_target_abspath,
+                                  &merge->mt,
+                                  merge->left_abspath,
+                                  merge->right_abspath,
+                                  merge->left_label,
+                                  merge->right_label,
+                                  merge->target_label,
+                                  merge->dry_run,
+                                  merge->left_version,
+                                  merge->right_version,
+                                  merge->detranslated_target_abspath,
+                                  merge->result_target,
+                                  merge->contains_conflicts,
                                   conflict_func, conflict_baton,
                                   cancel_func, cancel_baton,
                                   result_pool, scratch_pool));
@@ -1463,10 +1565,10 @@ svn_wc__internal_merge(svn_skel_t **work_items,
   /* Merging is complete.  Regardless of text or binariness, we might
      need to tweak the executable bit on the new working file, and
      possibly make it read-only. */
-  if (! dry_run)
+  if (! merge->dry_run)
     {
-      SVN_ERR(svn_wc__wq_build_sync_file_flags(&work_item, db,
-                                               target_abspath,
+      SVN_ERR(svn_wc__wq_build_sync_file_flags(&work_item, merge->mt.db,
+                                               merge->mt.local_abspath,
                                                result_pool, scratch_pool));
       *work_items = svn_wc__wq_merge(*work_items, work_item, result_pool);
     }
@@ -1474,36 +1576,83 @@ svn_wc__internal_merge(svn_skel_t **work_items,
   return SVN_NO_ERROR;
 }
 
+/* XXX Insane amount of parameters... */
+svn_error_t *
+svn_wc__internal_merge(svn_skel_t **work_items,
+                       enum svn_wc_merge_outcome_t *merge_outcome,
+                       svn_wc__db_t *db,
+                       const char *left_abspath,
+                       const svn_wc_conflict_version_t *left_version,
+                       const char *right_abspath,
+                       const svn_wc_conflict_version_t *right_version,
+                       const char *target_abspath,
+                       const char *wri_abspath,
+                       const char *left_label,
+                       const char *right_label,
+                       const char *target_label,
+                       apr_hash_t *actual_props,
+                       svn_boolean_t dry_run,
+                       const char *diff3_cmd,
+                       const apr_array_header_t *merge_options,
+                       const apr_array_header_t *prop_diff,
+                       svn_wc_conflict_resolver_func2_t conflict_func,
+                       void *conflict_baton,
+                       svn_cancel_func_t cancel_func,
+                       void *cancel_baton,
+                       apr_pool_t *result_pool,
+                       apr_pool_t *scratch_pool)
+{
+  svn_wc__text_merge_t merge;
+
+  SVN_ERR(prepare_merge(&merge, db,
+                        left_abspath, left_version,
+                        right_abspath, right_version,
+                        target_abspath, wri_abspath,
+                        left_label, right_label, target_label,
+                        actual_props, dry_run,
+                        diff3_cmd, merge_options, prop_diff,
+                        cancel_func, cancel_baton,
+                        result_pool, scratch_pool));
+
+  SVN_ERR(svn_wc__merge_run(&merge, scratch_pool));
+
+  return svn_error_trace(complete_merge(work_items, merge_outcome, &merge,
+                                        conflict_func, conflict_baton,
+                                        cancel_func, cancel_baton,
+                                        result_pool, scratch_pool));
+}
+
 
 svn_error_t *
-svn_wc_merge4(enum svn_wc_merge_outcome_t *merge_outcome,
-              svn_wc_context_t *wc_ctx,
-              const char *left_abspath,
-              const char *right_abspath,
-              const char *target_abspath,
-              const char *left_label,
-              const char *right_label,
-              const char *target_label,
-              const svn_wc_conflict_version_t *left_version,
-              const svn_wc_conflict_version_t *right_version,
-              svn_boolean_t dry_run,
-              const char *diff3_cmd,
-              const apr_array_header_t *merge_options,
-              const apr_array_header_t *prop_diff,
-              svn_wc_conflict_resolver_func2_t conflict_func,
-              void *conflict_baton,
-              svn_cancel_func_t cancel_func,
-              void *cancel_baton,
-              apr_pool_t *scratch_pool)
+svn_wc__merge_prepare(svn_wc__text_merge_t **merge,
+                      svn_wc_context_t *wc_ctx,
+                      const char *left_abspath,
+                      const char *right_abspath,
+                      const char *target_abspath,
+                      const char *left_label,
+                      const char *right_label,
+                      const char *target_label,
+                      const svn_wc_conflict_version_t *left_version,
+                      const svn_wc_conflict_version_t *right_version,
+                      svn_boolean_t dry_run,
+                      const char *diff3_cmd,
+                      const apr_array_header_t *merge_options,
+                      const apr_array_header_t *prop_diff,
+                      svn_cancel_func_t cancel_func,
+                      void *cancel_baton,
+                      apr_pool_t *result_pool,
+                      apr_pool_t *scratch_pool)
 {
   const char *dir_abspath = svn_dirent_dirname(target_abspath, scratch_pool);
-  svn_skel_t *work_items;
+  apr_array_header_t *options = NULL;
   apr_hash_t *actual_props;
 
   SVN_ERR_ASSERT(svn_dirent_is_absolute(left_abspath));
   SVN_ERR_ASSERT(svn_dirent_is_absolute(right_abspath));
   SVN_ERR_ASSERT(svn_dirent_is_absolute(target_abspath));
 
+  *merge = apr_pcalloc(result_pool, sizeof(**merge));
+
   /* Before we do any work, make sure we hold a write lock.  */
   if (!dry_run)
     SVN_ERR(svn_wc__write_check(wc_ctx->db, dir_abspath, scratch_pool));
@@ -1519,7 +1668,7 @@ svn_wc_merge4(enum svn_wc_merge_outcome_t *merge_outcome,
 
     if (kind == svn_kind_unknown)
       {
-        *merge_outcome = svn_wc_merge_no_merge;
+        (*merge)->no_target = TRUE;
         return SVN_NO_ERROR;
       }
 
@@ -1528,38 +1677,99 @@ svn_wc_merge4(enum svn_wc_merge_outcome_t *merge_outcome,
 
     if (hidden)
       {
-        *merge_outcome = svn_wc_merge_no_merge;
+        (*merge)->no_target = TRUE;
         return SVN_NO_ERROR;
       }
   }
 
   SVN_ERR(svn_wc__db_read_props(&actual_props, wc_ctx->db, target_abspath,
-                                scratch_pool, scratch_pool));
+                                result_pool, scratch_pool));
+
+  /* The merge may outlive the caller's copies of its arguments. */
+  if (merge_options)
+    {
+      int i;
+
+      options = apr_array_make(result_pool, merge_options->nelts,
+                               sizeof(const char *));
+      for (i = 0; i < merge_options->nelts; i++)
+        APR_ARRAY_PUSH(options, const char *)
+          = apr_pstrdup(result_pool,
+                        APR_ARRAY_IDX(merge_options, i, const char *));
+    }
+
+  SVN_ERR(prepare_merge(*merge, wc_ctx->db,
+                        apr_pstrdup(result_pool, left_abspath),
+                        svn_wc_conflict_version_dup(left_version,
+                                                    result_pool),
+                        apr_pstrdup(result_pool, right_abspath),
+                        svn_wc_conflict_version_dup(right_version,
+                                                    result_pool),
+                        apr_pstrdup(result_pool, target_abspath),
+                        apr_pstrdup(result_pool, target_abspath),
+                        apr_pstrdup(result_pool, left_label),
+                        apr_pstrdup(result_pool, right_label),
+                        apr_pstrdup(result_pool, target_label),
+                        actual_props, dry_run,
+                        apr_pstrdup(result_pool, diff3_cmd),
+                        options,
+                        prop_diff ? svn_prop_array_dup(prop_diff,
+                                                       result_pool)
+                                  : NULL,
+                        cancel_func, cancel_baton,
+                        result_pool, result_pool));
+
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+svn_wc__merge_run(svn_wc__text_merge_t *merge,
+                  apr_pool_t *scratch_pool)
+{
+  if (merge->result_f == NULL)
+    return SVN_NO_ERROR;
+
+  return svn_error_trace(run_text_merge(&merge->contains_conflicts,
+                                        merge->result_f,
+                                        &merge->mt,
+                                        merge->detranslated_target_abspath,
+                                        merge->left_abspath,
+                                        merge->right_abspath,
+                                        merge->target_label,
+                                        merge->left_label,
+                                        merge->right_label,
+                                        scratch_pool));
+}
+
+svn_error_t *
+svn_wc__merge_complete(enum svn_wc_merge_outcome_t *merge_outcome,
+                       svn_wc__text_merge_t *merge,
+                       svn_wc_conflict_resolver_func2_t conflict_func,
+                       void *conflict_baton,
+                       svn_cancel_func_t cancel_func,
+                       void *cancel_baton,
+                       apr_pool_t *scratch_pool)
+{
+  svn_skel_t *work_items;
+
+  if (merge->no_target)
+    {
+      *merge_outcome = svn_wc_merge_no_merge;
+      return SVN_NO_ERROR;
+    }
 
   /* Queue all the work.  */
-  SVN_ERR(svn_wc__internal_merge(&work_items,
-                                 merge_outcome,
-                                 wc_ctx->db,
-                                 left_abspath, left_version,
-                                 right_abspath, right_version,
-                                 target_abspath,
-                                 target_abspath,
-                                 left_label, right_label, target_label,
-                                 actual_props,
-                                 dry_run,
-                                 diff3_cmd,
-                                 merge_options,
-                                 prop_diff,
-                                 conflict_func, conflict_baton,
-                                 cancel_func, cancel_baton,
-                                 scratch_pool, scratch_pool));
+  SVN_ERR(complete_merge(&work_items, merge_outcome, merge,
+                         conflict_func, conflict_baton,
+                         cancel_func, cancel_baton,
+                         scratch_pool, scratch_pool));
 
   /* If this isn't a dry run, then run the work!  */
-  if (!dry_run)
+  if (!merge->dry_run)
     {
-      SVN_ERR(svn_wc__db_wq_add(wc_ctx->db, target_abspath, work_items,
-                                scratch_pool));
-      SVN_ERR(svn_wc__wq_run(wc_ctx->db, target_abspath,
+      SVN_ERR(svn_wc__db_wq_add(merge->mt.db, merge->mt.local_abspath,
+                                work_items, scratch_pool));
+      SVN_ERR(svn_wc__wq_run(merge->mt.db, merge->mt.local_abspath,
                              cancel_func, cancel_baton,
                              scratch_pool));
     }
@@ -1568,6 +1778,45 @@ svn_wc_merge4(enum svn_wc_merge_outcome_t *merge_outcome,
 }
 
 
+svn_error_t *
+svn_wc_merge4(enum svn_wc_merge_outcome_t *merge_outcome,
+              svn_wc_context_t *wc_ctx,
+              const char *left_abspath,
+              const char *right_abspath,
+              const char *target_abspath,
+              const char *left_label,
+              const char *right_label,
+              const char *target_label,
+              const svn_wc_conflict_version_t *left_version,
+              const svn_wc_conflict_version_t *right_version,
+              svn_boolean_t dry_run,
+              const char *diff3_cmd,
+              const apr_array_header_t *merge_options,
+              const apr_array_header_t *prop_diff,
+              svn_wc_conflict_resolver_func2_t conflict_func,
+              void *conflict_baton,
+              svn_cancel_func_t cancel_func,
+              void *cancel_baton,
+              apr_pool_t *scratch_pool)
+{
+  svn_wc__text_merge_t *merge;
+
+  SVN_ERR(svn_wc__merge_prepare(&merge, wc_ctx,
+                                left_abspath, right_abspath, target_abspath,
+                                left_label, right_label, target_label,
+                                left_version, right_version,
+                                dry_run, diff3_cmd, merge_options, prop_diff,
+                                cancel_func, cancel_baton,
+                                scratch_pool, scratch_pool));
+  SVN_ERR(svn_wc__merge_run(merge, scratch_pool));
+
+  return svn_error_trace(svn_wc__merge_complete(merge_outcome, merge,
+                                                conflict_func, conflict_baton,
+                                                cancel_func, cancel_baton,
+                                                scratch_pool));
+}
+
+
 /* Constructor for the result-structure returned by conflict callbacks. */
 svn_wc_conflict_result_t *
 svn_wc_create_conflict_result(svn_wc_conflict_choice_t choice,
@@ -46,6 +46,7 @@
 #include "svn_repos.h"
 #include "svn_dirent_uri.h"
 #include "private/svn_fspath.h"
+#include "private/svn_repos_private.h"
 
 
 #ifdef APLOG_USE_MODULE
@@ -200,8 +201,8 @@ get_access_conf(request_rec *r, authz_svn_config_rec *conf)
   access_conf = user_data;
   if (access_conf == NULL)
     {
-      svn_err = svn_repos_authz_read(&access_conf, access_file,
-                                     TRUE, r->connection->pool);
+      svn_err = svn_repos__authz_read_cached(&access_conf, access_file,
+                                             TRUE, r->connection->pool);
       if (svn_err)
         {
           ap_log_rerror(APLOG_MARK, APLOG_ERR,
@@ -385,6 +385,9 @@ const char *dav_svn__get_root_dir(request_rec *r);
 /* Return the data compression level to be used over the wire. */
 int dav_svn__get_compression_level(void);
 
+/* Return the number of threads compressing the data of a response. */
+int dav_svn__get_compression_threads(void);
+
 /* Return the hook script environment parsed from the configuration. */
 apr_hash_t *dav_svn__get_hooks_env(request_rec *r);
 
@@ -108,10 +108,14 @@ extern module AP_MODULE_DECLARE_DATA dav_svn_module;
 /* The authz_svn provider for bypassing path authz. */
 static authz_svn__subreq_bypass_func_t pathauthz_bypass_func = NULL;
 
-/* The compression level we will pass to svn_txdelta_to_svndiff3()
+/* The compression level we will pass to svn_txdelta_to_svndiff4()
  * for wire-compression */
 static int svn__compression_level = SVN_DELTA_COMPRESSION_LEVEL_DEFAULT;
 
+/* The number of threads svn_txdelta_to_svndiff4() may use to compress
+ * the data of a single response. */
+static int svn__compression_threads = 1;
+
 static int
 init(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s)
 {
@@ -133,9 +137,28 @@ init(apr_pool_t *p, apr_pool_t *plog, apr_pool_t *ptemp, server_rec *s)
   conf = ap_get_module_config(s->module_config, &dav_svn_module);
   svn_utf_initialize2(p, conf->use_utf8);
 
+  /* A shared cache must be created in the parent process such that
+   * all worker processes will inherit it. */
+  if (svn_cache_config_get()->shared)
+    svn_cache_config_allocate();
+
   return OK;
 }
 
+/* Implements the #child_init hook: attach to the inherited cache. */
+static void
+init_child(apr_pool_t *p, server_rec *s)
+{
+  svn_error_t *serr = svn_cache_config_child_init(p);
+  if (serr)
+    {
+      ap_log_perror(APLOG_MARK, APLOG_ERR, serr->apr_err, p,
+                    "mod_dav_svn: error calling svn_cache_config_child_init: "
+                    "'%s'", serr->message ? serr->message : "(no more info)");
+      svn_error_clear(serr);
+    }
+}
+
 static int
 init_dso(apr_pool_t *pconf, apr_pool_t *plog, apr_pool_t *ptemp)
 {
@@ -495,6 +518,17 @@ SVNInMemoryCacheSize_cmd(cmd_parms *cmd, void *config, const char *arg1)
   return NULL;
 }
 
+static const char *
+SVNSharedMemoryCache_cmd(cmd_parms *cmd, void *config, int arg)
+{
+  svn_cache_config_t settings = *svn_cache_config_get();
+
+  settings.shared = arg;
+  svn_cache_config_set(&settings);
+
+  return NULL;
+}
+
 static const char *
 SVNCompressionLevel_cmd(cmd_parms *cmd, void *config, const char *arg1)
 {
@@ -520,6 +554,28 @@ SVNCompressionLevel_cmd(cmd_parms *cmd, void *config, const char *arg1)
   return NULL;
 }
 
+static const char *
+SVNCompressionThreads_cmd(cmd_parms *cmd, void *config, const char *arg1)
+{
+  int value = 0;
+  svn_error_t *err = svn_cstring_atoi(&value, arg1);
+  if (err)
+    {
+      svn_error_clear(err);
+      return "Invalid decimal number for the SVN compression thread count.";
+    }
+
+  if ((value < 1) || (value > SVN_DELTA_MAX_THREADS))
+    return apr_psprintf(cmd->pool,
+                        "%d is not a valid number of compression threads. "
+                        "The valid range is 1 .. %d.",
+                        value, (int)SVN_DELTA_MAX_THREADS);
+
+  svn__compression_threads = value;
+
+  return NULL;
+}
+
 static const char *
 SVNUseUTF8_cmd(cmd_parms *cmd, void *config, int arg)
 {
@@ -853,6 +909,12 @@ dav_svn__get_compression_level(void)
   return svn__compression_level;
 }
 
+int
+dav_svn__get_compression_threads(void)
+{
+  return svn__compression_threads;
+}
+
 apr_hash_t *
 dav_svn__get_hooks_env(request_rec *r)
 {
@@ -1089,6 +1151,14 @@ static const command_rec cmds[] =
                 "specifies the maximum size in kB per process of Subversion's "
                 "in-memory object cache (default value is 16384; 0 deactivates "
                 "the cache)."),
+
+  /* per server */
+  AP_INIT_FLAG("SVNSharedMemoryCache", SVNSharedMemoryCache_cmd, NULL,
+               RSRC_CONF,
+               "places Subversion's in-memory object cache in shared memory "
+               "such that all worker processes use the same cache "
+               "(default is Off)."),
+
   /* per server */
   AP_INIT_TAKE1("SVNCompressionLevel", SVNCompressionLevel_cmd, NULL,
                 RSRC_CONF,
@@ -1096,6 +1166,13 @@ static const command_rec cmds[] =
                 "content over the network (0 for no compression, 9 for "
                 "maximum, 5 is default)."),
 
+  /* per server */
+  AP_INIT_TAKE1("SVNCompressionThreads", SVNCompressionThreads_cmd, NULL,
+                RSRC_CONF,
+                "specifies the number of threads compressing file content "
+                "for a single request while the next data is being read "
+                "(1 .. 16, 1 is default)."),
+
   /* per server */
   AP_INIT_FLAG("SVNUseUTF8",
                SVNUseUTF8_cmd, NULL,
@@ -1128,6 +1205,7 @@ register_hooks(apr_pool_t *pconf)
 {
   ap_hook_pre_config(init_dso, NULL, NULL, APR_HOOK_REALLY_FIRST);
   ap_hook_post_config(init, NULL, NULL, APR_HOOK_MIDDLE);
+  ap_hook_child_init(init_child, NULL, NULL, APR_HOOK_MIDDLE);
 
   /* our provider */
   dav_register_provider(pconf, "svn", &provider);
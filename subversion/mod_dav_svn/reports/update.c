@@ -778,9 +778,10 @@ upd_apply_textdelta(void *file_baton,
                                                      wb->uc->output,
                                                      file->pool);
 
-  svn_txdelta_to_svndiff3(&(wb->handler), &(wb->handler_baton),
+  svn_txdelta_to_svndiff4(&(wb->handler), &(wb->handler_baton),
                           base64_stream, file->uc->svndiff_version,
-                          dav_svn__get_compression_level(), file->pool);
+                          dav_svn__get_compression_level(),
+                          dav_svn__get_compression_threads(), file->pool);
 
   *handler = window_handler;
   *handler_baton = wb;
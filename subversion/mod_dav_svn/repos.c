@@ -1685,7 +1685,12 @@ negotiate_encoding_prefs(request_rec *r, int *svndiff_version)
     {
       struct accept_rec rec = APR_ARRAY_IDX(encoding_prefs, i,
                                             struct accept_rec);
-      if (strcmp(rec.name, "svndiff1") == 0)
+      if (strcmp(rec.name, "svndiff2") == 0)
+        {
+          *svndiff_version = 2;
+          break;
+        }
+      else if (strcmp(rec.name, "svndiff1") == 0)
         {
           *svndiff_version = 1;
           break;
@@ -3599,9 +3604,10 @@ deliver(const dav_resource *resource, ap_filter_t *output)
           svn_stream_set_close(o_stream, close_filter);
 
           /* get a handler/baton for writing into the output stream */
-          svn_txdelta_to_svndiff3(&handler, &h_baton,
+          svn_txdelta_to_svndiff4(&handler, &h_baton,
                                   o_stream, resource->info->svndiff_version,
                                   dav_svn__get_compression_level(),
+                                  dav_svn__get_compression_threads(),
                                   resource->pool);
 
           /* got everything set up. read in delta windows and shove them into
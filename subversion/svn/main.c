@@ -211,7 +211,17 @@ const apr_getopt_option_t svn_cl__options[] =
                        "                             "
                        "   -p (--show-c-function):\n"
                        "                             "
-                       "      Show C function name in diff output.")},
+                       "      Show C function name in diff output.\n"
+                       "                             "
+                       "   --histogram:\n"
+                       "                             "
+                       "      Use the histogram diff algorithm.\n"
+                       "                             "
+                       "   --memory-limit MB:\n"
+                       "                             "
+                       "      Diff large files through a window of about\n"
+                       "                             "
+                       "      MB megabytes.")},
   {"targets",       opt_targets, 1,
                     N_("pass contents of file ARG as additional args")},
   {"depth",         opt_depth, 1,
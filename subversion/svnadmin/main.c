@@ -189,7 +189,10 @@ enum svnadmin__cmdline_options_t
     svnadmin__wait,
     svnadmin__pre_1_4_compatible,
     svnadmin__pre_1_5_compatible,
-    svnadmin__pre_1_6_compatible
+    svnadmin__pre_1_6_compatible,
+    svnadmin__pre_1_8_compatible,
+    svnadmin__threads,
+    svnadmin__delta_chain_stats
   };
 
 /* Option codes and descriptions.
@@ -278,11 +281,24 @@ static const apr_getopt_option_t options_table[] =
      N_("use format compatible with Subversion versions\n"
         "                             earlier than 1.6")},
 
+    {"pre-1.8-compatible",     svnadmin__pre_1_8_compatible, 0,
+     N_("use format compatible with Subversion versions\n"
+        "                             earlier than 1.8")},
+
     {"memory-cache-size",     'M', 1,
      N_("size of the extra in-memory cache in MB used to\n"
         "                             minimize redundant operations. Default: 16.\n"
         "                             [used for FSFS repositories only]")},
 
+    {"threads",       svnadmin__threads, 1,
+     N_("number of threads to use for verification.\n"
+        "                             Default: 1.")},
+
+    {"delta-chain-stats", svnadmin__delta_chain_stats, 0,
+     N_("print statistics on the delta chains read while\n"
+        "                             verifying; implies --threads 1\n"
+        "                             [used for FSFS repositories only]")},
+
     {NULL}
   };
 
@@ -303,7 +319,8 @@ static const svn_opt_subcommand_desc2_t cmd_table[] =
     "Create a new, empty repository at REPOS_PATH.\n"),
    {svnadmin__bdb_txn_nosync, svnadmin__bdb_log_keep,
     svnadmin__config_dir, svnadmin__fs_type, svnadmin__pre_1_4_compatible,
-    svnadmin__pre_1_5_compatible, svnadmin__pre_1_6_compatible
+    svnadmin__pre_1_5_compatible, svnadmin__pre_1_6_compatible,
+    svnadmin__pre_1_8_compatible
     } },
 
   {"deltify", subcommand_deltify, {0}, N_
@@ -459,7 +476,7 @@ static const svn_opt_subcommand_desc2_t cmd_table[] =
   {"verify", subcommand_verify, {0}, N_
    ("usage: svnadmin verify REPOS_PATH\n\n"
     "Verifies the data stored in the repository.\n"),
-  {'r', 'q', 'M'} },
+  {'r', 'q', 'M', svnadmin__threads, svnadmin__delta_chain_stats} },
 
   { NULL, NULL, {0}, NULL, {0} }
 };
@@ -473,6 +490,7 @@ struct svnadmin_opt_state
   svn_boolean_t pre_1_4_compatible;                 /* --pre-1.4-compatible */
   svn_boolean_t pre_1_5_compatible;                 /* --pre-1.5-compatible */
   svn_boolean_t pre_1_6_compatible;                 /* --pre-1.6-compatible */
+  svn_boolean_t pre_1_8_compatible;                 /* --pre-1.8-compatible */
   svn_opt_revision_t start_revision, end_revision;  /* -r X[:Y] */
   svn_boolean_t help;                               /* --help or -? */
   svn_boolean_t version;                            /* --version */
@@ -492,6 +510,8 @@ struct svnadmin_opt_state
   enum svn_repos_load_uuid uuid_action;             /* --ignore-uuid,
                                                        --force-uuid */
   apr_uint64_t memory_cache_size;                   /* --memory-cache-size M */
+  int threads;                                      /* --threads */
+  svn_boolean_t delta_chain_stats;                  /* --delta-chain-stats */
   const char *parent_dir;
 
   const char *config_dir;    /* Overriding Configuration Directory */
@@ -623,6 +643,11 @@ subcommand_create(apr_getopt_t *os, void *baton, apr_pool_t *pool)
                  APR_HASH_KEY_STRING,
                  "1");
 
+  if (opt_state->pre_1_8_compatible)
+    apr_hash_set(fs_config, SVN_FS_CONFIG_PRE_1_8_COMPATIBLE,
+                 APR_HASH_KEY_STRING,
+                 "1");
+
   SVN_ERR(svn_repos_create(&repos, opt_state->repository_path,
                            NULL, NULL, NULL, fs_config, pool));
   svn_fs_set_warning_func(svn_repos_fs(repos), warning_func, NULL);
@@ -1431,10 +1456,34 @@ subcommand_verify(apr_getopt_t *os, void *baton, apr_pool_t *pool)
   if (! opt_state->quiet)
     progress_stream = recode_stream_create(stderr, pool);
 
-  return svn_repos_verify_fs2(repos, lower, upper,
-                              !opt_state->quiet
-                                ? repos_notify_handler : NULL,
-                              progress_stream, check_cancel, NULL, pool);
+  /* The statistics are gathered per svn_fs_t.  Concurrent verification
+     would read through filesystem objects of its own. */
+  SVN_ERR(svn_repos_verify_fs3(repos, lower, upper,
+                               opt_state->delta_chain_stats
+                                 ? 1 : opt_state->threads,
+                               !opt_state->quiet
+                                 ? repos_notify_handler : NULL,
+                               progress_stream, check_cancel, NULL, pool));
+
+  if (opt_state->delta_chain_stats)
+    {
+      svn_fs_delta_chain_stats_t stats;
+
+      SVN_ERR(svn_fs_get_delta_chain_stats(&stats, fs, pool));
+      SVN_ERR(svn_cmdline_printf(pool,
+                                 _("Representations read: %" APR_UINT64_T_FMT
+                                   "\n"), stats.read_count));
+      SVN_ERR(svn_cmdline_printf(pool,
+                                 _("Average delta chain length: %.2f\n"),
+                                 stats.read_count
+                                   ? (double)stats.total_length
+                                     / (double)stats.read_count
+                                   : 0.0));
+      SVN_ERR(svn_cmdline_printf(pool, _("Longest delta chain: %d\n"),
+                                 stats.max_length));
+    }
+
+  return SVN_NO_ERROR;
 }
 
 /* This implements `svn_opt_subcommand_t'. */
@@ -1816,6 +1865,7 @@ main(int argc, const char *argv[])
   opt_state.start_revision.kind = svn_opt_revision_unspecified;
   opt_state.end_revision.kind = svn_opt_revision_unspecified;
   opt_state.memory_cache_size = svn_cache_config_get()->cache_size;
+  opt_state.threads = 1;
 
   /* Parse options. */
   err = svn_cmdline__getopt_init(&os, argc, argv, pool);
@@ -1903,6 +1953,21 @@ main(int argc, const char *argv[])
       case svnadmin__pre_1_6_compatible:
         opt_state.pre_1_6_compatible = TRUE;
         break;
+      case svnadmin__pre_1_8_compatible:
+        opt_state.pre_1_8_compatible = TRUE;
+        break;
+      case svnadmin__threads:
+        err = svn_cstring_atoi(&opt_state.threads, opt_arg);
+        if (! err && opt_state.threads < 1)
+          err = svn_error_createf(SVN_ERR_CL_ARG_PARSING_ERROR, NULL,
+                                  _("Invalid number of threads '%s'"),
+                                  opt_arg);
+        if (err)
+          return svn_cmdline_handle_exit_error(err, pool, "svnadmin: ");
+        break;
+      case svnadmin__delta_chain_stats:
+        opt_state.delta_chain_stats = TRUE;
+        break;
       case svnadmin__fs_type:
         err = svn_utf_cstring_to_utf8(&opt_state.fs_type, opt_arg, pool);
         if (err)
@@ -2097,7 +2162,7 @@ main(int argc, const char *argv[])
     svn_cache_config_t settings = *svn_cache_config_get();
 
     settings.cache_size = opt_state.memory_cache_size;
-    settings.single_threaded = TRUE;
+    settings.single_threaded = opt_state.threads <= 1;
 
     svn_cache_config_set(&settings);
   }
@@ -28,6 +28,7 @@
 #include <apr_general.h>
 #include <apr_getopt.h>
 #include <apr_network_io.h>
+#include <apr_poll.h>
 #include <apr_signal.h>
 #include <apr_thread_proc.h>
 #include <apr_portable.h>
@@ -98,6 +99,31 @@ enum run_mode {
 
 #endif
 
+#if APR_HAS_THREADS
+/* Default number of worker threads kept alive while there are no
+   connections to serve. */
+#define THREADPOOL_MIN_SIZE 1
+
+/* Default number of connections served concurrently in threaded mode. */
+#define THREADPOOL_MAX_SIZE 256
+
+/* Worker threads in excess of the minimum terminate after having been
+   idle for this long. */
+#define THREADPOOL_THREAD_IDLE_LIMIT apr_time_from_sec(5)
+
+/* When shutting down, don't wait longer than this for the worker threads
+   to finish the requests they are currently processing. */
+#define THREADPOOL_STOP_TIMEOUT apr_time_from_sec(10)
+
+/* Maximum number of idle connections parked in the poll set with
+   --multiplex.  Further idle connections keep their worker thread. */
+#define REACTOR_POLLSET_SIZE 65536
+#endif
+
+/* Backlog of the listening socket in threaded mode.  Connections that
+   neither a worker nor the connection queue can take wait there. */
+#define THREADPOOL_LISTEN_BACKLOG 128
+
 
 #ifdef WIN32
 static apr_os_sock_t winservice_svnserve_accept_socket = INVALID_SOCKET;
@@ -148,6 +174,12 @@ void winservice_notify_stop(void)
 #define SVNSERVE_OPT_CACHE_TXDELTAS  265
 #define SVNSERVE_OPT_CACHE_FULLTEXTS 266
 #define SVNSERVE_OPT_SINGLE_CONN     267
+#define SVNSERVE_OPT_SHARED_CACHE    268
+#define SVNSERVE_OPT_CACHE_SNAPSHOT  269
+#define SVNSERVE_OPT_COMPRESSION_THREADS 270
+#define SVNSERVE_OPT_MIN_THREADS     271
+#define SVNSERVE_OPT_MAX_THREADS     272
+#define SVNSERVE_OPT_MULTIPLEX       273
 
 static const apr_getopt_option_t svnserve__options[] =
   {
@@ -198,6 +230,10 @@ static const apr_getopt_option_t svnserve__options[] =
         "[0 .. no compression, 5 .. default, \n"
         "                             "
         " 9 .. maximum compression]")},
+    {"compression-threads", SVNSERVE_OPT_COMPRESSION_THREADS, 1,
+     N_("number of threads compressing the data sent to\n"
+        "                             "
+        "a single client.  Default is 1.")},
     {"memory-cache-size", 'M', 1,
      N_("size of the extra in-memory cache in MB used to\n"
         "                             "
@@ -222,11 +258,55 @@ static const apr_getopt_option_t svnserve__options[] =
         "Default is yes.\n"
         "                             "
         "[used for FSFS repositories only]")},
+    {"shared-cache", SVNSERVE_OPT_SHARED_CACHE, 0,
+     N_("share the in-memory cache between all forked\n"
+        "                             "
+        "server processes instead of giving each process\n"
+        "                             "
+        "its own private cache.\n"
+        "                             "
+        "[mode: daemon; used for FSFS repositories only]")},
+    {"cache-snapshot", SVNSERVE_OPT_CACHE_SNAPSHOT, 1,
+     N_("read the in-memory cache contents from ARG\n"
+        "                             "
+        "at startup and write them back to ARG when\n"
+        "                             "
+        "terminated by SIGTERM or SIGINT.\n"
+        "                             "
+        "Not available with forked servers.\n"
+        "                             "
+        "[mode: daemon; used for FSFS repositories only]")},
 #ifdef CONNECTION_HAVE_THREAD_OPTION
     /* ### Making the assumption here that WIN32 never has fork and so
      * ### this option never exists when --service exists. */
     {"threads",          'T', 0, N_("use threads instead of fork "
                                     "[mode: daemon]")},
+#endif
+#if APR_HAS_THREADS
+    {"min-threads",      SVNSERVE_OPT_MIN_THREADS, 1,
+     N_("number of worker threads to keep alive even\n"
+        "                             "
+        "when there are no connections to serve.\n"
+        "                             "
+        "Default is 1.\n"
+        "                             "
+        "[used only with --threads]")},
+    {"max-threads",      SVNSERVE_OPT_MAX_THREADS, 1,
+     N_("maximum number of connections served at the\n"
+        "                             "
+        "same time; further connections have to wait.\n"
+        "                             "
+        "Default is 256.\n"
+        "                             "
+        "[used only with --threads]")},
+    {"multiplex",        SVNSERVE_OPT_MULTIPLEX, 0,
+     N_("occupy a worker thread only while a client is\n"
+        "                             "
+        "sending commands; wait for the next command of\n"
+        "                             "
+        "all idle clients in a single thread.\n"
+        "                             "
+        "[used only with --threads]")},
 #endif
     {"foreground",        SVNSERVE_OPT_FOREGROUND, 0,
      N_("run in foreground (useful for debugging)\n"
@@ -326,6 +406,33 @@ static void sigchld_handler(int signo)
 }
 #endif
 
+/* Set when we have been asked to terminate while a cache snapshot
+   needs to be written before we exit. */
+static volatile sig_atomic_t termination_requested = FALSE;
+
+/* Signal handler for SIGTERM and SIGINT, used with --cache-snapshot. */
+static void termination_handler(int signo)
+{
+  /* Just flag the request; the accept() gets interrupted and the main
+     loop will do the rest. */
+  termination_requested = TRUE;
+}
+
+#if APR_HAS_THREADS
+/* Keep the signals that termination_handler() got installed for away
+   from the calling thread.  They must reach the main thread to interrupt
+   its accept(). */
+static void block_termination_signals(void)
+{
+#ifndef WIN32
+  apr_signal_block(SIGTERM);
+#ifdef SIGINT
+  apr_signal_block(SIGINT);
+#endif
+#endif
+}
+#endif
+
 /* Redirect stdout to stderr.  ARG is the pool.
  *
  * In tunnel or inetd mode, we don't want hook scripts corrupting the
@@ -352,18 +459,367 @@ struct serve_thread_t {
   svn_ra_svn_conn_t *conn;
   serve_params_t *params;
   apr_pool_t *pool;
+
+  /* The connection's socket and, once the initial exchange is done,
+     the session state.  Only used with --multiplex. */
+  apr_socket_t *sock;
+  server_baton_t *session;
+
+  /* Next connection waiting in the connection_queue_t or, once a worker
+     took it from there, being served by one. */
+  struct serve_thread_t *next;
 };
 
 #if APR_HAS_THREADS
-static void * APR_THREAD_FUNC serve_thread(apr_thread_t *tid, void *data)
+/* Accepted connections waiting to be served, together with the pool of
+   worker threads serving them. */
+typedef struct connection_queue_t {
+  /* Protects all members below. */
+  apr_thread_mutex_t *mutex;
+
+  /* Signaled whenever a connection got queued. */
+  apr_thread_cond_t *not_empty;
+
+  /* Signaled whenever a worker took a connection from the queue. */
+  apr_thread_cond_t *not_full;
+
+  /* Signaled whenever a worker thread terminates. */
+  apr_thread_cond_t *thread_exit;
+
+  /* FIFO of connections not picked up by any worker, yet, and its
+     length.  The latter never exceeds MAX_THREADS. */
+  struct serve_thread_t *first;
+  struct serve_thread_t *last;
+  int queued;
+
+  /* Connections currently being served by a worker thread, linked by
+     their NEXT member.  Does not contain the ones served with
+     --multiplex. */
+  struct serve_thread_t *active;
+
+  /* Number of worker threads and how many of them wait for work. */
+  int threads;
+  int idle;
+
+  /* Limits to the number of worker threads. */
+  int min_threads;
+  int max_threads;
+
+  /* Attributes for new worker threads. */
+  apr_threadattr_t *tattr;
+
+  /* With --multiplex, idle connections wait in this poll set for their
+     next command.  NULL otherwise. */
+  apr_pollset_t *parked;
+
+  /* Set by stop_connection_queue().  Connections that get queued or
+     become idle from then on get closed. */
+  svn_boolean_t stopping;
+} connection_queue_t;
+
+/* Create a connection queue in POOL for up to MAX_THREADS worker threads
+   of which MIN_THREADS shall remain even when idle. */
+static svn_error_t *
+create_connection_queue(connection_queue_t **queue,
+                        int min_threads,
+                        int max_threads,
+                        apr_pool_t *pool)
 {
-  struct serve_thread_t *d = data;
+  connection_queue_t *result = apr_pcalloc(pool, sizeof(*result));
+  apr_status_t status;
+
+  status = apr_thread_mutex_create(&result->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                   pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create mutex"));
+
+  status = apr_thread_cond_create(&result->not_empty, pool);
+  if (!status)
+    status = apr_thread_cond_create(&result->not_full, pool);
+  if (!status)
+    status = apr_thread_cond_create(&result->thread_exit, pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create condition variable"));
+
+  status = apr_threadattr_create(&result->tattr, pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create threadattr"));
 
-  svn_error_clear(serve(d->conn, d->params, d->pool));
+  status = apr_threadattr_detach_set(result->tattr, 1);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't set detached state"));
+
+  result->min_threads = min_threads;
+  result->max_threads = max_threads;
+
+  *queue = result;
+  return SVN_NO_ERROR;
+}
+
+/* Serve the connection D until its client has no more commands for us
+   right now, then park it in QUEUE's poll set.  Close it once the
+   session is over. */
+static void
+serve_until_idle(connection_queue_t *queue, struct serve_thread_t *d)
+{
+  svn_boolean_t terminated = TRUE;
+  svn_error_t *err = SVN_NO_ERROR;
+  apr_pollfd_t pfd = { 0 };
+
+  if (d->session == NULL)
+    err = serve_init(&d->session, d->conn, d->params, d->pool);
+
+  pfd.p = d->pool;
+  pfd.desc_type = APR_POLL_SOCKET;
+  pfd.reqevents = APR_POLLIN;
+  pfd.desc.s = d->sock;
+  pfd.client_data = d;
+
+  while (!err && d->session)
+    {
+      apr_int32_t nsds;
+      svn_boolean_t stopping;
+
+      err = serve_pending(&terminated, d->session, d->conn, d->pool);
+      if (err || terminated)
+        break;
+
+      /* Don't keep idle connections while shutting down. */
+      apr_thread_mutex_lock(queue->mutex);
+      stopping = queue->stopping;
+      apr_thread_mutex_unlock(queue->mutex);
+      if (stopping)
+        break;
+
+      if (apr_pollset_add(queue->parked, &pfd) == APR_SUCCESS)
+        return;
+
+      /* The poll set is full.  Wait for the next command right here. */
+      apr_poll(&pfd, 1, &nsds, -1);
+    }
+
+  svn_error_clear(err);
   svn_pool_destroy(d->pool);
+}
+
+/* "Arguments" passed to a worker thread */
+struct worker_thread_t {
+  connection_queue_t *queue;
+
+  /* Root pool holding the thread's own data, including this struct. */
+  apr_pool_t *pool;
+};
+
+/* Thread function serving the connections from the queue given in the
+   worker_thread_t DATA, one at a time.  Threads in excess of the queue's
+   minimum terminate once they have been idle for a while. */
+static void * APR_THREAD_FUNC worker_thread(apr_thread_t *tid, void *data)
+{
+  struct worker_thread_t *w = data;
+  connection_queue_t *queue = w->queue;
+  svn_boolean_t stopping;
+
+  block_termination_signals();
+
+  apr_thread_mutex_lock(queue->mutex);
+  while (1)
+    {
+      struct serve_thread_t *d;
+
+      while (queue->first == NULL)
+        {
+          apr_status_t status;
+
+          if (queue->stopping)
+            {
+              queue->threads--;
+              apr_thread_cond_broadcast(queue->thread_exit);
+              apr_thread_mutex_unlock(queue->mutex);
+              svn_pool_destroy(w->pool);
+              return NULL;
+            }
+
+          queue->idle++;
+          if (queue->threads > queue->min_threads)
+            status = apr_thread_cond_timedwait(queue->not_empty,
+                                               queue->mutex,
+                                               THREADPOOL_THREAD_IDLE_LIMIT);
+          else
+            status = apr_thread_cond_wait(queue->not_empty, queue->mutex);
+          queue->idle--;
+
+          if (APR_STATUS_IS_TIMEUP(status)
+              && queue->first == NULL
+              && queue->threads > queue->min_threads)
+            {
+              queue->threads--;
+              apr_thread_cond_broadcast(queue->thread_exit);
+              apr_thread_mutex_unlock(queue->mutex);
+              svn_pool_destroy(w->pool);
+              return NULL;
+            }
+        }
+
+      d = queue->first;
+      queue->first = d->next;
+      if (queue->first == NULL)
+        queue->last = NULL;
+      queue->queued--;
+
+      /* Let stop_connection_queue() find this connection. */
+      if (!queue->parked)
+        {
+          d->next = queue->active;
+          queue->active = d;
+        }
+      stopping = queue->stopping;
+
+      apr_thread_cond_signal(queue->not_full);
+      apr_thread_mutex_unlock(queue->mutex);
+
+      if (queue->parked)
+        {
+          serve_until_idle(queue, d);
+        }
+      else
+        {
+          struct serve_thread_t **link;
+
+          if (!stopping)
+            svn_error_clear(serve(d->conn, d->params, d->pool));
+
+          apr_thread_mutex_lock(queue->mutex);
+          for (link = &queue->active; *link != d; link = &(*link)->next)
+            ;
+          *link = d->next;
+          apr_thread_mutex_unlock(queue->mutex);
+
+          svn_pool_destroy(d->pool);
+        }
+
+      apr_thread_mutex_lock(queue->mutex);
+    }
+}
+
+/* Append the connection D to QUEUE and make sure there is a worker
+   thread to serve it.  If the queue is full, wait until a worker takes
+   a connection from it; in the meantime, new connections pile up in the
+   listen backlog. */
+static svn_error_t *
+queue_connection(connection_queue_t *queue,
+                 struct serve_thread_t *d)
+{
+  apr_status_t status = APR_SUCCESS;
+
+  apr_thread_mutex_lock(queue->mutex);
+
+  while (queue->queued >= queue->max_threads && !queue->stopping)
+    apr_thread_cond_wait(queue->not_full, queue->mutex);
+
+  /* We are shutting down, nobody is going to serve D. */
+  if (queue->stopping)
+    {
+      apr_thread_mutex_unlock(queue->mutex);
+      svn_pool_destroy(d->pool);
+      return SVN_NO_ERROR;
+    }
+
+  d->next = NULL;
+  if (queue->last)
+    queue->last->next = d;
+  else
+    queue->first = d;
+  queue->last = d;
+  queue->queued++;
+
+  /* Start another worker unless an idle one will pick up D. */
+  if (queue->idle < queue->queued && queue->threads < queue->max_threads)
+    {
+      apr_thread_t *tid;
+      apr_pool_t *thread_pool = svn_pool_create(NULL);
+      struct worker_thread_t *w = apr_palloc(thread_pool, sizeof(*w));
+
+      w->queue = queue;
+      w->pool = thread_pool;
+      status = apr_thread_create(&tid, queue->tattr, worker_thread, w,
+                                 thread_pool);
+      if (status)
+        svn_pool_destroy(thread_pool);
+      else
+        queue->threads++;
+    }
+
+  /* Running workers will get to D eventually. */
+  if (status && queue->threads > 0)
+    status = APR_SUCCESS;
+
+  apr_thread_cond_signal(queue->not_empty);
+  apr_thread_mutex_unlock(queue->mutex);
+
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create thread"));
+
+  return SVN_NO_ERROR;
+}
+
+/* Thread function waiting for the next command on all connections parked
+   in the connection_queue_t DATA and handing them back to the workers. */
+static void * APR_THREAD_FUNC reactor_thread(apr_thread_t *tid, void *data)
+{
+  connection_queue_t *queue = data;
+
+  block_termination_signals();
+
+  while (1)
+    {
+      apr_int32_t count, i;
+      const apr_pollfd_t *ready;
+
+      /* Retry if interrupted by a signal. */
+      if (apr_pollset_poll(queue->parked, -1, &count, &ready))
+        continue;
+
+      for (i = 0; i < count; ++i)
+        {
+          apr_pollset_remove(queue->parked, &ready[i]);
+          svn_error_clear(queue_connection(queue, ready[i].client_data));
+        }
+    }
 
   return NULL;
 }
+
+/* Close all connections in QUEUE that are not being served yet and stop
+   reading from the others, so that their workers terminate once they
+   have finished the current request.  Wait for that to happen but not
+   longer than THREADPOOL_STOP_TIMEOUT.  Connections parked in the poll
+   set stay there untouched until the process exits. */
+static void
+stop_connection_queue(connection_queue_t *queue)
+{
+  struct serve_thread_t *d;
+  apr_time_t deadline = apr_time_now() + THREADPOOL_STOP_TIMEOUT;
+
+  apr_thread_mutex_lock(queue->mutex);
+  queue->stopping = TRUE;
+  apr_thread_cond_broadcast(queue->not_empty);
+  apr_thread_cond_broadcast(queue->not_full);
+
+  /* Idle clients would otherwise keep their workers waiting forever. */
+  for (d = queue->active; d; d = d->next)
+    apr_socket_shutdown(d->sock, APR_SHUTDOWN_READ);
+
+  while (queue->threads > 0)
+    {
+      apr_time_t now = apr_time_now();
+      if (now >= deadline)
+        break;
+
+      apr_thread_cond_timedwait(queue->thread_exit, queue->mutex,
+                                deadline - now);
+    }
+  apr_thread_mutex_unlock(queue->mutex);
+}
 #endif
 
 /* Write the PID of the current process as a decimal number, followed by a
@@ -423,8 +879,10 @@ int main(int argc, const char *argv[])
   svn_ra_svn_conn_t *conn;
   apr_proc_t proc;
 #if APR_HAS_THREADS
-  apr_threadattr_t *tattr;
-  apr_thread_t *tid;
+  connection_queue_t *connection_queue = NULL;
+  int min_threads = THREADPOOL_MIN_SIZE;
+  int max_threads = THREADPOOL_MAX_SIZE;
+  svn_boolean_t multiplex = FALSE;
 
   struct serve_thread_t *thread_data;
 #endif
@@ -443,6 +901,8 @@ int main(int argc, const char *argv[])
   const char *config_filename = NULL;
   const char *pid_filename = NULL;
   const char *log_filename = NULL;
+  svn_boolean_t shared_cache = FALSE;
+  const char *cache_snapshot = NULL;
   svn_node_kind_t kind;
 
   /* Initialize the app. */
@@ -478,6 +938,8 @@ int main(int argc, const char *argv[])
   params.pwdb = NULL;
   params.authzdb = NULL;
   params.compression_level = SVN_DELTA_COMPRESSION_LEVEL_DEFAULT;
+  params.compression_threads = 1;
+  params.repos_cache = NULL;
   params.log_file = NULL;
   params.username_case = CASE_ASIS;
   params.memory_cache_size = (apr_uint64_t)-1;
@@ -612,6 +1074,32 @@ int main(int argc, const char *argv[])
             params.compression_level = SVN_DELTA_COMPRESSION_LEVEL_MAX;
           break;
 
+        case SVNSERVE_OPT_COMPRESSION_THREADS:
+          params.compression_threads = atoi(arg);
+          if (params.compression_threads < 1)
+            params.compression_threads = 1;
+          if (params.compression_threads > SVN_DELTA_MAX_THREADS)
+            params.compression_threads = SVN_DELTA_MAX_THREADS;
+          break;
+
+#if APR_HAS_THREADS
+        case SVNSERVE_OPT_MIN_THREADS:
+          min_threads = atoi(arg);
+          if (min_threads < 0)
+            min_threads = 0;
+          break;
+
+        case SVNSERVE_OPT_MAX_THREADS:
+          max_threads = atoi(arg);
+          if (max_threads < 1)
+            max_threads = 1;
+          break;
+
+        case SVNSERVE_OPT_MULTIPLEX:
+          multiplex = TRUE;
+          break;
+#endif
+
         case 'M':
           params.memory_cache_size = 0x100000 * apr_strtoi64(arg, NULL, 0);
           break;
@@ -626,6 +1114,17 @@ int main(int argc, const char *argv[])
              = svn_tristate__from_word(arg) == svn_tristate_true;
           break;
 
+        case SVNSERVE_OPT_SHARED_CACHE:
+          shared_cache = TRUE;
+          break;
+
+        case SVNSERVE_OPT_CACHE_SNAPSHOT:
+          SVN_INT_ERR(svn_utf_cstring_to_utf8(&cache_snapshot, arg, pool));
+          cache_snapshot = svn_dirent_internal_style(cache_snapshot, pool);
+          SVN_INT_ERR(svn_dirent_get_absolute(&cache_snapshot,
+                                              cache_snapshot, pool));
+          break;
+
 #ifdef WIN32
         case SVNSERVE_OPT_SERVICE:
           if (run_mode != run_mode_service)
@@ -713,6 +1212,31 @@ int main(int argc, const char *argv[])
       exit(1);
     }
 
+#if APR_HAS_THREADS
+  if (multiplex && handling_mode != connection_mode_thread)
+    {
+      svn_error_clear
+        (svn_cmdline_fprintf
+           (stderr, pool,
+            _("Option --multiplex is only valid with --threads.\n")));
+      exit(1);
+    }
+#endif
+
+  /* The snapshot gets saved by this process and can only be validated
+   * against the repositories opened by it.  Forked children open them
+   * in their own processes. */
+  if (cache_snapshot && run_mode == run_mode_daemon
+      && handling_mode == connection_mode_fork)
+    {
+      svn_error_clear
+        (svn_cmdline_fprintf
+           (stderr, pool,
+            _("Option --cache-snapshot requires --threads or "
+              "--single-thread.\n")));
+      exit(1);
+    }
+
   if (run_mode == run_mode_inetd || run_mode == run_mode_tunnel)
     {
       params.tunnel = (run_mode == run_mode_tunnel);
@@ -739,6 +1263,7 @@ int main(int argc, const char *argv[])
       conn = svn_ra_svn_create_conn2(NULL, in_file, out_file,
                                      params.compression_level,
                                      connection_pool);
+      svn_ra_svn_set_compression_threads(conn, params.compression_threads);
       svn_error_clear(serve(conn, &params, connection_pool));
       exit(0);
     }
@@ -859,7 +1384,9 @@ int main(int argc, const char *argv[])
       return svn_cmdline_handle_exit_error(err, pool, "svnserve: ");
     }
 
-  apr_socket_listen(sock, 7);
+  apr_socket_listen(sock, handling_mode == connection_mode_thread
+                            ? THREADPOOL_LISTEN_BACKLOG
+                            : 7);
 
 #if APR_HAS_FORK
   if (run_mode != run_mode_listen_once && !foreground)
@@ -918,9 +1445,86 @@ int main(int argc, const char *argv[])
 #endif
       }
 
+    /* Only forked connections need a cache in shared memory.
+     * Connection threads share the process-local one anyway. */
+    settings.shared = shared_cache
+                   && handling_mode == connection_mode_fork
+                   && run_mode != run_mode_listen_once;
+
     svn_cache_config_set(&settings);
+
+    /* The shared cache must exist before we fork the first child. */
+    if (settings.shared)
+      svn_cache_config_allocate();
   }
 
+  /* Connections served by this process may reuse the repositories opened
+   * for earlier ones.  Forked children would not benefit from that. */
+  if (handling_mode != connection_mode_fork
+      && run_mode != run_mode_listen_once)
+    {
+#if APR_HAS_THREADS
+      if (handling_mode == connection_mode_thread)
+        {
+          if (min_threads > max_threads)
+            min_threads = max_threads;
+
+          SVN_INT_ERR(create_connection_queue(&connection_queue, min_threads,
+                                              max_threads, pool));
+          if (multiplex)
+            {
+              apr_thread_t *tid;
+
+              /* Workers park idle connections while the reactor thread
+               * waits in the poll set, hence it must be thread-safe.
+               * APR uses epoll for it on Linux. */
+              status = apr_pollset_create(&connection_queue->parked,
+                                          REACTOR_POLLSET_SIZE, pool,
+                                          APR_POLLSET_THREADSAFE);
+              if (status)
+                {
+                  err = svn_error_wrap_apr(status,
+                                           _("Can't create poll set"));
+                  return svn_cmdline_handle_exit_error(err, pool,
+                                                       "svnserve: ");
+                }
+
+              status = apr_thread_create(&tid, connection_queue->tattr,
+                                         reactor_thread, connection_queue,
+                                         pool);
+              if (status)
+                {
+                  err = svn_error_wrap_apr(status, _("Can't create thread"));
+                  return svn_cmdline_handle_exit_error(err, pool,
+                                                       "svnserve: ");
+                }
+            }
+          SVN_INT_ERR(repos_cache_create(&params.repos_cache, max_threads,
+                                         pool));
+        }
+      else
+#endif
+        SVN_INT_ERR(repos_cache_create(&params.repos_cache, 1, pool));
+    }
+
+  /* Warm up the caches with what a previous instance left behind. */
+  if (cache_snapshot && run_mode != run_mode_listen_once)
+    {
+      svn_boolean_t loaded;
+
+      err = svn_fs_load_cache(&loaded, cache_snapshot, pool);
+      if (err)
+        {
+          log_error(err, params.log_file, NULL, NULL, NULL, pool);
+          svn_error_clear(err);
+        }
+
+      apr_signal(SIGTERM, termination_handler);
+#ifdef SIGINT
+      apr_signal(SIGINT, termination_handler);
+#endif
+    }
+
   while (1)
     {
 #ifdef WIN32
@@ -953,6 +1557,27 @@ int main(int argc, const char *argv[])
                                          connection_pool) == APR_CHILD_DONE)
             ;
         }
+      if (termination_requested)
+        {
+          /* Save the cache contents for our successor.  The signal may
+           * have arrived while we were serving a connection ourselves,
+           * so check even if accept() succeeded. */
+          if (status == APR_SUCCESS)
+            apr_socket_close(usock);
+          svn_pool_destroy(connection_pool);
+          apr_socket_close(sock);
+
+#if APR_HAS_THREADS
+          /* Don't let the workers update the caches while we save them. */
+          if (connection_queue)
+            stop_connection_queue(connection_queue);
+#endif
+
+          err = svn_fs_save_cache(cache_snapshot, pool);
+          if (err)
+            return svn_cmdline_handle_exit_error(err, pool, "svnserve: ");
+          exit(0);
+        }
       if (APR_STATUS_IS_EINTR(status))
         {
           svn_pool_destroy(connection_pool);
@@ -982,6 +1607,7 @@ int main(int argc, const char *argv[])
       conn = svn_ra_svn_create_conn2(usock, NULL, NULL,
                                      params.compression_level,
                                      connection_pool);
+      svn_ra_svn_set_compression_threads(conn, params.compression_threads);
 
       if (run_mode == run_mode_listen_once)
         {
@@ -1004,7 +1630,9 @@ int main(int argc, const char *argv[])
           if (status == APR_INCHILD)
             {
               apr_socket_close(sock);
-              err = serve(conn, &params, connection_pool);
+              err = svn_cache_config_child_init(connection_pool);
+              if (! err)
+                err = serve(conn, &params, connection_pool);
               log_error(err, params.log_file,
                         svn_ra_svn_conn_remote_host(conn),
                         NULL, NULL, /* user, repos */
@@ -1032,35 +1660,19 @@ int main(int argc, const char *argv[])
           break;
 
         case connection_mode_thread:
-          /* Create a detached thread for each connection.  That's not a
-             particularly sophisticated strategy for a threaded server, it's
-             little different from forking one process per connection. */
+          /* Hand the connection to the worker threads.  They get started
+             on demand, up to the configured maximum, and stay around for
+             a while afterwards to serve the next burst of connections. */
 #if APR_HAS_THREADS
-          status = apr_threadattr_create(&tattr, connection_pool);
-          if (status)
-            {
-              err = svn_error_wrap_apr(status, _("Can't create threadattr"));
-              svn_handle_error2(err, stderr, FALSE, "svnserve: ");
-              svn_error_clear(err);
-              exit(1);
-            }
-          status = apr_threadattr_detach_set(tattr, 1);
-          if (status)
-            {
-              err = svn_error_wrap_apr(status, _("Can't set detached state"));
-              svn_handle_error2(err, stderr, FALSE, "svnserve: ");
-              svn_error_clear(err);
-              exit(1);
-            }
           thread_data = apr_palloc(connection_pool, sizeof(*thread_data));
           thread_data->conn = conn;
           thread_data->params = &params;
           thread_data->pool = connection_pool;
-          status = apr_thread_create(&tid, tattr, serve_thread, thread_data,
-                                     connection_pool);
-          if (status)
+          thread_data->sock = usock;
+          thread_data->session = NULL;
+          err = queue_connection(connection_queue, thread_data);
+          if (err)
             {
-              err = svn_error_wrap_apr(status, _("Can't create thread"));
               svn_handle_error2(err, stderr, FALSE, "svnserve: ");
               svn_error_clear(err);
               exit(1);
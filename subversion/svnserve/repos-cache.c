@@ -0,0 +1,291 @@
+/*
+ * repos-cache.c :  Reuse opened repositories across svnserve connections
+ *
+ * ====================================================================
+ *    Licensed to the Apache Software Foundation (ASF) under one
+ *    or more contributor license agreements.  See the NOTICE file
+ *    distributed with this work for additional information
+ *    regarding copyright ownership.  The ASF licenses this file
+ *    to you under the Apache License, Version 2.0 (the
+ *    "License"); you may not use this file except in compliance
+ *    with the License.  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing,
+ *    software distributed under the License is distributed on an
+ *    "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *    KIND, either express or implied.  See the License for the
+ *    specific language governing permissions and limitations
+ *    under the License.
+ * ====================================================================
+ */
+
+
+
+#include <apr_hash.h>
+#include <apr_time.h>
+
+#if APR_HAS_THREADS
+#include <apr_thread_mutex.h>
+#endif
+
+#include "svn_pools.h"
+#include "svn_error.h"
+#include "svn_repos.h"
+
+#include "svn_private_config.h"
+
+#include "server.h"
+
+/* Idle handles that have not been used for this long get closed instead
+   of being handed out again.  That limits the memory held by repositories
+   no longer accessed and makes sure we eventually notice a repository
+   that has been replaced on disk. */
+#define MAX_HANDLE_IDLE_TIME apr_time_from_sec(60)
+
+/* An opened repository that is either in use by exactly one connection
+   or waiting in the cache for the next one. */
+typedef struct repos_handle_t
+{
+  /* The repository and its filesystem.  Neither is thread-safe, so a
+     handle is never used by more than one connection at a time. */
+  svn_repos_t *repos;
+
+  /* Root pool owning REPOS.  It has its own allocator, so it may be
+     used by whatever thread serves the current connection. */
+  apr_pool_t *pool;
+
+  /* The cache entry to return this handle to. */
+  struct repos_entry_t *entry;
+
+  /* When the handle was last returned to the cache. */
+  apr_time_t released;
+
+  /* Next idle handle for the same repository. */
+  struct repos_handle_t *next;
+} repos_handle_t;
+
+/* All handles cached for one repository. */
+typedef struct repos_entry_t
+{
+  /* Repository root path; this is the key in the cache's hash. */
+  const char *path;
+
+  /* Linked list of idle handles, the most recently released one first. */
+  repos_handle_t *first;
+
+  /* Length of the FIRST list. */
+  int count;
+
+  /* The cache this entry belongs to. */
+  repos_cache_t *cache;
+} repos_entry_t;
+
+struct repos_cache_t
+{
+  /* Maps repository root paths to repos_entry_t *.  Entries are never
+     removed, so this grows with the number of repositories served. */
+  apr_hash_t *entries;
+
+  /* Keep at most this many idle handles per repository. */
+  int max_idle;
+
+  /* Pool for the hash and its entries. */
+  apr_pool_t *pool;
+
+#if APR_HAS_THREADS
+  /* Serializes all access to ENTRIES and their handle lists. */
+  apr_thread_mutex_t *mutex;
+#endif
+};
+
+/* Lock / unlock CACHE, if we are using threads. */
+static void
+lock_cache(repos_cache_t *cache)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_lock(cache->mutex);
+#endif
+}
+
+static void
+unlock_cache(repos_cache_t *cache)
+{
+#if APR_HAS_THREADS
+  apr_thread_mutex_unlock(cache->mutex);
+#endif
+}
+
+/* Warning function installed while a handle sits in the cache.  The
+   connection that used it last has already gone, so there is nobody
+   left to report to. */
+static void
+idle_warning_func(void *baton, svn_error_t *err)
+{
+}
+
+/* Return a new root pool with its own allocator. */
+static apr_pool_t *
+create_handle_pool(void)
+{
+  apr_allocator_t *allocator;
+  apr_pool_t *pool;
+
+  if (apr_allocator_create(&allocator))
+    return svn_pool_create(NULL);
+
+  apr_allocator_max_free_set(allocator, SVN_ALLOCATOR_RECOMMENDED_MAX_FREE);
+  pool = svn_pool_create_ex(NULL, allocator);
+  apr_allocator_owner_set(allocator, pool);
+
+  return pool;
+}
+
+/* Pool cleanup function returning the repos_handle_t DATA to its cache
+   once the connection using it is done. */
+static apr_status_t
+release_handle(void *data)
+{
+  repos_handle_t *handle = data;
+  repos_entry_t *entry = handle->entry;
+
+  /* Don't keep references into the connection's pools. */
+  svn_repos_hooks_setenv(handle->repos, NULL);
+  svn_fs_set_warning_func(svn_repos_fs(handle->repos), idle_warning_func,
+                          NULL);
+
+  lock_cache(entry->cache);
+
+  if (entry->count < entry->cache->max_idle)
+    {
+      handle->released = apr_time_now();
+      handle->next = entry->first;
+      entry->first = handle;
+      entry->count++;
+      handle = NULL;
+    }
+
+  unlock_cache(entry->cache);
+
+  /* The cache is full.  Close the repository. */
+  if (handle)
+    svn_pool_destroy(handle->pool);
+
+  return APR_SUCCESS;
+}
+
+svn_error_t *
+repos_cache_create(repos_cache_t **cache,
+                   int max_idle,
+                   apr_pool_t *pool)
+{
+  repos_cache_t *result = apr_pcalloc(pool, sizeof(*result));
+#if APR_HAS_THREADS
+  apr_status_t status;
+
+  status = apr_thread_mutex_create(&result->mutex, APR_THREAD_MUTEX_DEFAULT,
+                                   pool);
+  if (status)
+    return svn_error_wrap_apr(status, _("Can't create mutex"));
+#endif
+
+  result->entries = apr_hash_make(pool);
+  result->max_idle = max_idle;
+  result->pool = pool;
+
+  *cache = result;
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *
+repos_cache_open(svn_repos_t **repos,
+                 repos_cache_t *cache,
+                 const char *path,
+                 apr_hash_t *fs_config,
+                 apr_pool_t *pool)
+{
+  repos_entry_t *entry;
+  repos_handle_t *handle;
+  repos_handle_t *expired = NULL;
+  apr_time_t now = apr_time_now();
+  svn_error_t *err;
+
+  lock_cache(cache);
+
+  entry = apr_hash_get(cache->entries, path, APR_HASH_KEY_STRING);
+  if (entry == NULL)
+    {
+      entry = apr_pcalloc(cache->pool, sizeof(*entry));
+      entry->path = apr_pstrdup(cache->pool, path);
+      entry->cache = cache;
+      apr_hash_set(cache->entries, entry->path, APR_HASH_KEY_STRING, entry);
+    }
+
+  /* Handles are sorted by release time, so everything after the first
+     stale one is stale as well. */
+  if (entry->first && now - entry->first->released > MAX_HANDLE_IDLE_TIME)
+    {
+      expired = entry->first;
+      entry->first = NULL;
+      entry->count = 0;
+    }
+  else if (entry->first)
+    {
+      repos_handle_t *iter;
+      int count = 1;
+
+      for (iter = entry->first; iter->next; iter = iter->next, ++count)
+        if (now - iter->next->released > MAX_HANDLE_IDLE_TIME)
+          {
+            expired = iter->next;
+            iter->next = NULL;
+            entry->count = count;
+            break;
+          }
+    }
+
+  handle = entry->first;
+  if (handle)
+    {
+      entry->first = handle->next;
+      entry->count--;
+      handle->next = NULL;
+    }
+
+  unlock_cache(cache);
+
+  /* Close stale handles outside the lock. */
+  while (expired)
+    {
+      repos_handle_t *next = expired->next;
+      svn_pool_destroy(expired->pool);
+      expired = next;
+    }
+
+  if (handle == NULL)
+    {
+      apr_pool_t *handle_pool = create_handle_pool();
+
+      handle = apr_pcalloc(handle_pool, sizeof(*handle));
+      handle->pool = handle_pool;
+      handle->entry = entry;
+
+      /* The filesystem keeps a reference to its configuration. */
+      err = svn_repos_open2(&handle->repos, path,
+                            fs_config ? apr_hash_copy(handle_pool, fs_config)
+                                      : NULL,
+                            handle_pool);
+      if (err)
+        {
+          svn_pool_destroy(handle_pool);
+          return err;
+        }
+    }
+
+  apr_pool_cleanup_register(pool, handle, release_handle,
+                            apr_pool_cleanup_null);
+
+  *repos = handle->repos;
+  return SVN_NO_ERROR;
+}
@@ -53,6 +53,7 @@
 #include "private/svn_log.h"
 #include "private/svn_mergeinfo_private.h"
 #include "private/svn_fspath.h"
+#include "private/svn_repos_private.h"
 
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>   /* For getpid() */
@@ -293,7 +294,8 @@ svn_error_t *load_configs(svn_config_t **cfg,
 
       authzdb_path = svn_dirent_canonicalize(authzdb_path, pool);
       authzdb_path = svn_dirent_join(base, authzdb_path, pool);
-      err = svn_repos_authz_read(authzdb, authzdb_path, TRUE, pool);
+      err = svn_repos__authz_read_cached(authzdb, authzdb_path, TRUE,
+                                         pool);
       if (err)
         {
           if (server)
@@ -373,6 +375,27 @@ static void convert_case(char *text, svn_boolean_t to_uppercase)
     }
 }
 
+/* Return the username to use for authz lookups in B, i.e. B->user with
+   any username case normalization applied, or NULL for anonymous
+   access. */
+static const char *get_authz_user(server_baton_t *b)
+{
+  /* If we have a username, and we've not yet used it + any username
+     case normalization that might be requested to determine "the
+     username we used for authz purposes", do so now. */
+  if (b->user && (! b->authz_user))
+    {
+      char *authz_user = apr_pstrdup(b->pool, b->user);
+      if (b->username_case == CASE_FORCE_UPPER)
+        convert_case(authz_user, TRUE);
+      else if (b->username_case == CASE_FORCE_LOWER)
+        convert_case(authz_user, FALSE);
+      b->authz_user = authz_user;
+    }
+
+  return b->authz_user;
+}
+
 /* Set *ALLOWED to TRUE if PATH is accessible in the REQUIRED mode to
    the user described in BATON according to the authz rules in BATON.
    Use POOL for temporary allocations only.  If no authz rules are
@@ -402,48 +425,36 @@ static svn_error_t *authz_check_access(svn_boolean_t *allowed,
   if (path)
     path = svn_fspath__canonicalize(path, pool);
 
-  /* If we have a username, and we've not yet used it + any username
-     case normalization that might be requested to determine "the
-     username we used for authz purposes", do so now. */
-  if (b->user && (! b->authz_user))
-    {
-      char *authz_user = apr_pstrdup(b->pool, b->user);
-      if (b->username_case == CASE_FORCE_UPPER)
-        convert_case(authz_user, TRUE);
-      else if (b->username_case == CASE_FORCE_LOWER)
-        convert_case(authz_user, FALSE);
-      b->authz_user = authz_user;
-    }
-
   return svn_repos_authz_check_access(b->authzdb, b->authz_repos_name,
-                                      path, b->authz_user, required,
+                                      path, get_authz_user(b), required,
                                       allowed, pool);
 }
 
-/* Set *ALLOWED to TRUE if PATH is readable by the user described in
- * BATON.  Use POOL for temporary allocations only.  ROOT is not used.
- * Implements the svn_repos_authz_func_t interface.
- */
-static svn_error_t *authz_check_access_cb(svn_boolean_t *allowed,
-                                          svn_fs_root_t *root,
-                                          const char *path,
-                                          void *baton,
-                                          apr_pool_t *pool)
-{
-  server_baton_t *sb = baton;
-
-  return authz_check_access(allowed, path, svn_authz_read, sb, pool);
-}
-
 /* If authz is enabled in the specified BATON, return a read authorization
-   function. Otherwise, return NULL. */
+   function. Otherwise, return NULL.  The function expects the baton
+   returned by authz_check_access_cb_baton().
+
+   That function is the stock one from libsvn_repos, which allows
+   svn_repos_get_logs4() and the update reporter to check many paths
+   at once. */
 static svn_repos_authz_func_t authz_check_access_cb_func(server_baton_t *baton)
 {
   if (baton->authzdb)
-     return authz_check_access_cb;
+     return svn_repos__authz_read_func;
   return NULL;
 }
 
+/* Return the baton for the function returned by
+   authz_check_access_cb_func(BATON). */
+static void *authz_check_access_cb_baton(server_baton_t *baton)
+{
+  baton->authz_read_baton.authz = baton->authzdb;
+  baton->authz_read_baton.repos_name = baton->authz_repos_name;
+  baton->authz_read_baton.user = get_authz_user(baton);
+
+  return &baton->authz_read_baton;
+}
+
 /* Set *ALLOWED to TRUE if the REQUIRED access to PATH is granted,
  * according to the state in BATON.  Use POOL for temporary
  * allocations only.  ROOT is not used.  Implements the
@@ -892,7 +903,7 @@ static svn_error_t *accept_report(svn_boolean_t *only_empty_entry,
                                       send_copyfrom_args,
                                       editor, edit_baton,
                                       authz_check_access_cb_func(b),
-                                      b, pool));
+                                      authz_check_access_cb_baton(b), pool));
 
   rb.sb = b;
   rb.repos_url = svn_path_uri_decode(b->repos_url, pool);
@@ -1060,7 +1071,8 @@ static svn_error_t *do_change_rev_prop(svn_ra_svn_conn_t *conn,
   SVN_CMD_ERR(svn_repos_fs_change_rev_prop4(b->repos, rev, b->user,
                                             name, old_value_p, value,
                                             TRUE, TRUE,
-                                            authz_check_access_cb_func(b), b,
+                                            authz_check_access_cb_func(b),
+                                            authz_check_access_cb_baton(b),
                                             pool));
   SVN_ERR(svn_ra_svn_write_cmd_response(conn, pool, ""));
 
@@ -1133,7 +1145,8 @@ static svn_error_t *rev_proplist(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
 
   SVN_ERR(trivial_auth_request(conn, pool, b));
   SVN_CMD_ERR(svn_repos_fs_revision_proplist(&props, b->repos, rev,
-                                             authz_check_access_cb_func(b), b,
+                                             authz_check_access_cb_func(b),
+                                             authz_check_access_cb_baton(b),
                                              pool));
   SVN_ERR(svn_ra_svn_write_tuple(conn, pool, "w((!", "success"));
   SVN_ERR(svn_ra_svn_write_proplist(conn, pool, props));
@@ -1155,7 +1168,8 @@ static svn_error_t *rev_prop(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
 
   SVN_ERR(trivial_auth_request(conn, pool, b));
   SVN_CMD_ERR(svn_repos_fs_revision_prop(&value, b->repos, rev, name,
-                                         authz_check_access_cb_func(b), b,
+                                         authz_check_access_cb_func(b),
+                                         authz_check_access_cb_baton(b),
                                          pool));
   SVN_ERR(svn_ra_svn_write_cmd_response(conn, pool, "(?s)", value));
   return SVN_NO_ERROR;
@@ -1869,7 +1883,8 @@ static svn_error_t *get_mergeinfo(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
                                          canonical_paths, rev,
                                          inherit,
                                          include_descendants,
-                                         authz_check_access_cb_func(b), b,
+                                         authz_check_access_cb_func(b),
+                                         authz_check_access_cb_baton(b),
                                          pool));
   SVN_ERR(svn_mergeinfo__remove_prefix_from_catalog(&mergeinfo, mergeinfo,
                                                     b->fs_path->data, pool));
@@ -2048,7 +2063,8 @@ static svn_error_t *log_cmd(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
   err = svn_repos_get_logs4(b->repos, full_paths, start_rev, end_rev,
                             (int) limit, send_changed_paths, strict_node,
                             include_merged_revisions, revprops,
-                            authz_check_access_cb_func(b), b, log_receiver,
+                            authz_check_access_cb_func(b),
+                            authz_check_access_cb_baton(b), log_receiver,
                             &lb, pool);
 
   write_err = svn_ra_svn_write_word(conn, pool, "done");
@@ -2186,7 +2202,8 @@ static svn_error_t *get_locations(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
 
   err = svn_repos_trace_node_locations(b->fs, &fs_locations, abs_path,
                                        peg_revision, location_revisions,
-                                       authz_check_access_cb_func(b), b, pool);
+                                       authz_check_access_cb_func(b),
+                                       authz_check_access_cb_baton(b), pool);
 
   /* Now, write the results to the connection. */
   if (!err)
@@ -2285,7 +2302,8 @@ static svn_error_t *get_location_segments(svn_ra_svn_conn_t *conn,
   err = svn_repos_node_location_segments(b->repos, abs_path,
                                          peg_revision, start_rev, end_rev,
                                          gls_receiver, (void *)conn,
-                                         authz_check_access_cb_func(b), b,
+                                         authz_check_access_cb_func(b),
+                                         authz_check_access_cb_baton(b),
                                          pool);
   write_err = svn_ra_svn_write_word(conn, pool, "done");
   if (write_err)
@@ -2348,16 +2366,20 @@ static svn_error_t *file_rev_handler(void *baton, const char *path,
   /* Prepare for the delta or just write an empty string. */
   if (d_handler)
     {
+      int svndiff_version;
+
       stream = svn_stream_create(baton, pool);
       svn_stream_set_write(stream, svndiff_handler);
       svn_stream_set_close(stream, svndiff_close_handler);
 
       /* If the connection does not support SVNDIFF1 or if we don't want to use
-       * compression, use the non-compressing "version 0" implementation */
-      if (   svn_ra_svn_compression_level(frb->conn) > 0
-          && svn_ra_svn_has_capability(frb->conn, SVN_RA_SVN_CAP_SVNDIFF1))
-        svn_txdelta_to_svndiff3(d_handler, d_baton, stream, 1,
-                                svn_ra_svn_compression_level(frb->conn), pool);
+       * compression, use the non-compressing "version 0" implementation. */
+      svndiff_version = svn_ra_svn__svndiff_version(frb->conn);
+      if (svndiff_version > 0)
+        svn_txdelta_to_svndiff4(d_handler, d_baton, stream, svndiff_version,
+                                svn_ra_svn_compression_level(frb->conn),
+                                svn_ra_svn_compression_threads(frb->conn),
+                                pool);
       else
         svn_txdelta_to_svndiff3(d_handler, d_baton, stream, 0,
                                 svn_ra_svn_compression_level(frb->conn), pool);
@@ -2403,7 +2425,8 @@ static svn_error_t *get_file_revs(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
 
   err = svn_repos_get_file_revs2(b->repos, full_path, start_rev, end_rev,
                                  include_merged_revisions,
-                                 authz_check_access_cb_func(b), b,
+                                 authz_check_access_cb_func(b),
+                                 authz_check_access_cb_baton(b),
                                  file_rev_handler, &frb, pool);
   write_err = svn_ra_svn_write_word(conn, pool, "done");
   if (write_err)
@@ -2723,7 +2746,8 @@ static svn_error_t *get_locks(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
   SVN_ERR(log_command(b, conn, pool, "get-locks %s",
                       svn_path_uri_encode(full_path, pool)));
   SVN_CMD_ERR(svn_repos_fs_get_locks2(&locks, b->repos, full_path, depth,
-                                      authz_check_access_cb_func(b), b, pool));
+                                      authz_check_access_cb_func(b),
+                                      authz_check_access_cb_baton(b), pool));
 
   SVN_ERR(svn_ra_svn_write_tuple(conn, pool, "w((!", "success"));
   for (hi = apr_hash_first(pool, locks); hi; hi = apr_hash_next(hi))
@@ -2760,7 +2784,8 @@ static svn_error_t *replay_one_revision(svn_ra_svn_conn_t *conn,
   if (! err)
     err = svn_repos_replay2(root, b->fs_path->data, low_water_mark,
                             send_deltas, editor, edit_baton,
-                            authz_check_access_cb_func(b), b, pool);
+                            authz_check_access_cb_func(b),
+                            authz_check_access_cb_baton(b), pool);
 
   if (err)
     svn_error_clear(editor->abort_edit(edit_baton, pool));
@@ -2812,7 +2837,7 @@ static svn_error_t *replay_range(svn_ra_svn_conn_t *conn, apr_pool_t *pool,
 
       SVN_CMD_ERR(svn_repos_fs_revision_proplist(&props, b->repos, rev,
                                                  authz_check_access_cb_func(b),
-                                                 b,
+                                                 authz_check_access_cb_baton(b),
                                                  iterpool));
       SVN_ERR(svn_ra_svn_write_tuple(conn, iterpool, "w(!", "revprops"));
       SVN_ERR(svn_ra_svn_write_proplist(conn, iterpool, props));
@@ -3000,7 +3025,11 @@ static svn_error_t *find_repos(const char *url, const char *root,
                              "No repository found in '%s'", url);
 
   /* Open the repository and fill in b with the resulting information. */
-  SVN_ERR(svn_repos_open2(&b->repos, repos_root, b->fs_config, pool));
+  if (b->repos_cache)
+    SVN_ERR(repos_cache_open(&b->repos, b->repos_cache, repos_root,
+                             b->fs_config, pool));
+  else
+    SVN_ERR(svn_repos_open2(&b->repos, repos_root, b->fs_config, pool));
   SVN_ERR(svn_repos_remember_client_capabilities(b->repos, capabilities));
   b->fs = svn_repos_fs(b->repos);
   fs_path = full_path + strlen(repos_root);
@@ -3218,45 +3247,52 @@ fetch_base_func(const char **filename,
   return SVN_NO_ERROR;
 }
 
-svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
-                   apr_pool_t *pool)
+svn_error_t *serve_init(server_baton_t **session,
+                        svn_ra_svn_conn_t *conn,
+                        serve_params_t *params,
+                        apr_pool_t *pool)
 {
   svn_error_t *err, *io_err;
   apr_uint64_t ver;
   const char *uuid, *client_url, *ra_client_string, *client_string;
   apr_array_header_t *caplist, *cap_words;
-  server_baton_t b;
-  fs_warning_baton_t warn_baton;
+  server_baton_t *b = apr_pcalloc(pool, sizeof(*b));
+  fs_warning_baton_t *warn_baton = apr_pcalloc(pool, sizeof(*warn_baton));
   svn_stringbuf_t *cap_log = svn_stringbuf_create_empty(pool);
 
-  b.tunnel = params->tunnel;
-  b.tunnel_user = get_tunnel_user(params, pool);
-  b.read_only = params->read_only;
-  b.user = NULL;
-  b.username_case = params->username_case;
-  b.authz_user = NULL;
-  b.cfg = params->cfg;
-  b.pwdb = params->pwdb;
-  b.authzdb = params->authzdb;
-  b.realm = NULL;
-  b.log_file = params->log_file;
-  b.pool = pool;
-  b.use_sasl = FALSE;
+  *session = NULL;
+
+  b->tunnel = params->tunnel;
+  b->tunnel_user = get_tunnel_user(params, pool);
+  b->read_only = params->read_only;
+  b->user = NULL;
+  b->username_case = params->username_case;
+  b->authz_user = NULL;
+  b->cfg = params->cfg;
+  b->pwdb = params->pwdb;
+  b->authzdb = params->authzdb;
+  b->realm = NULL;
+  b->log_file = params->log_file;
+  b->repos_cache = params->repos_cache;
+  b->pool = pool;
+  b->use_sasl = FALSE;
 
   /* construct FS configuration parameters */
-  b.fs_config = apr_hash_make(pool);
-  apr_hash_set(b.fs_config, SVN_FS_CONFIG_FSFS_CACHE_DELTAS,
+  b->fs_config = apr_hash_make(pool);
+  apr_hash_set(b->fs_config, SVN_FS_CONFIG_FSFS_CACHE_DELTAS,
                APR_HASH_KEY_STRING, params->cache_txdeltas ? "1" : "0");
-  apr_hash_set(b.fs_config, SVN_FS_CONFIG_FSFS_CACHE_FULLTEXTS,
+  apr_hash_set(b->fs_config, SVN_FS_CONFIG_FSFS_CACHE_FULLTEXTS,
                APR_HASH_KEY_STRING, params->cache_fulltexts ? "1" : "0");
 
   /* Send greeting.  We don't support version 1 any more, so we can
    * send an empty mechlist. */
   if (params->compression_level > 0)
-    SVN_ERR(svn_ra_svn_write_cmd_response(conn, pool, "nn()(wwwwwwww)",
+    SVN_ERR(svn_ra_svn_write_cmd_response(conn, pool, "nn()(wwwwwwwwww)",
                                           (apr_uint64_t) 2, (apr_uint64_t) 2,
                                           SVN_RA_SVN_CAP_EDIT_PIPELINE,
                                           SVN_RA_SVN_CAP_SVNDIFF1,
+                                          SVN_RA_SVN_CAP_SVNDIFF2,
+                                          SVN_RA_SVN_CAP_STREAM_COMPRESSION,
                                           SVN_RA_SVN_CAP_ABSENT_ENTRIES,
                                           SVN_RA_SVN_CAP_COMMIT_REVPROPS,
                                           SVN_RA_SVN_CAP_DEPTH,
@@ -3287,6 +3323,12 @@ svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
   client_url = svn_uri_canonicalize(client_url, pool);
   SVN_ERR(svn_ra_svn_set_capabilities(conn, caplist));
 
+  /* We offered stream compression only if compression is enabled.
+   * The client switches right after sending its response. */
+  if (params->compression_level > 0
+      && svn_ra_svn_has_capability(conn, SVN_RA_SVN_CAP_STREAM_COMPRESSION))
+    SVN_ERR(svn_ra_svn__enable_stream_compression(conn, pool));
+
   /* All released versions of Subversion support edit-pipeline,
    * so we do not accept connections from clients that do not. */
   if (! svn_ra_svn_has_capability(conn, SVN_RA_SVN_CAP_EDIT_PIPELINE))
@@ -3322,19 +3364,19 @@ svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
       }
   }
 
-  err = find_repos(client_url, params->root, &b, conn, cap_words, pool);
+  err = find_repos(client_url, params->root, b, conn, cap_words, pool);
   if (!err)
     {
-      SVN_ERR(auth_request(conn, pool, &b, READ_ACCESS, FALSE));
-      if (current_access(&b) == NO_ACCESS)
+      SVN_ERR(auth_request(conn, pool, b, READ_ACCESS, FALSE));
+      if (current_access(b) == NO_ACCESS)
         err = error_create_and_log(SVN_ERR_RA_NOT_AUTHORIZED, NULL,
                                    "Not authorized for access",
-                                   &b, conn, pool);
+                                   b, conn, pool);
     }
   if (err)
     {
-      log_error(err, b.log_file, svn_ra_svn_conn_remote_host(conn),
-                b.user, NULL, pool);
+      log_error(err, b->log_file, svn_ra_svn_conn_remote_host(conn),
+                b->user, NULL, pool);
       io_err = svn_ra_svn_write_cmd_failure(conn, pool, err);
       svn_error_clear(err);
       SVN_ERR(io_err);
@@ -3350,18 +3392,18 @@ svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
     client_string = "-";
   else
     client_string = svn_path_uri_encode(client_string, pool);
-  SVN_ERR(log_command(&b, conn, pool,
+  SVN_ERR(log_command(b, conn, pool,
                       "open %" APR_UINT64_T_FMT " cap=(%s) %s %s %s",
                       ver, cap_log->data,
-                      svn_path_uri_encode(b.fs_path->data, pool),
+                      svn_path_uri_encode(b->fs_path->data, pool),
                       ra_client_string, client_string));
 
-  warn_baton.server = &b;
-  warn_baton.conn = conn;
-  warn_baton.pool = svn_pool_create(pool);
-  svn_fs_set_warning_func(b.fs, fs_warning_func, &warn_baton);
+  warn_baton->server = b;
+  warn_baton->conn = conn;
+  warn_baton->pool = svn_pool_create(pool);
+  svn_fs_set_warning_func(b->fs, fs_warning_func, warn_baton);
 
-  SVN_ERR(svn_fs_get_uuid(b.fs, &uuid, pool));
+  SVN_ERR(svn_fs_get_uuid(b->fs, &uuid, pool));
 
   /* We can't claim mergeinfo capability until we know whether the
      repository supports mergeinfo (i.e., is not a 1.4 repository),
@@ -3371,11 +3413,11 @@ svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
      the client has sent the url. */
   {
     svn_boolean_t supports_mergeinfo;
-    SVN_ERR(svn_repos_has_capability(b.repos, &supports_mergeinfo,
+    SVN_ERR(svn_repos_has_capability(b->repos, &supports_mergeinfo,
                                      SVN_REPOS_CAPABILITY_MERGEINFO, pool));
 
     SVN_ERR(svn_ra_svn_write_tuple(conn, pool, "w(cc(!",
-                                   "success", uuid, b.repos_url));
+                                   "success", uuid, b->repos_url));
     if (supports_mergeinfo)
       SVN_ERR(svn_ra_svn_write_word(conn, pool, SVN_RA_SVN_CAP_MERGEINFO));
     SVN_ERR(svn_ra_svn_write_tuple(conn, pool, "!))"));
@@ -3389,10 +3431,32 @@ svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
     callbacks->fetch_base_func = fetch_base_func;
     callbacks->fetch_props_func = fetch_props_func;
     callbacks->fetch_kind_func = fetch_kind_func;
-    callbacks->fetch_baton = &b;
+    callbacks->fetch_baton = b;
 
     SVN_ERR(svn_ra_svn__set_shim_callbacks(conn, callbacks));
   }
 
-  return svn_ra_svn_handle_commands2(conn, pool, main_commands, &b, FALSE);
+  *session = b;
+  return SVN_NO_ERROR;
+}
+
+svn_error_t *serve_pending(svn_boolean_t *terminated,
+                           server_baton_t *session,
+                           svn_ra_svn_conn_t *conn,
+                           apr_pool_t *pool)
+{
+  return svn_ra_svn__handle_pending_commands(terminated, conn, pool,
+                                             main_commands, session, FALSE);
+}
+
+svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
+                   apr_pool_t *pool)
+{
+  server_baton_t *b;
+
+  SVN_ERR(serve_init(&b, conn, params, pool));
+  if (b == NULL)
+    return SVN_NO_ERROR;
+
+  return svn_ra_svn_handle_commands2(conn, pool, main_commands, b, FALSE);
 }
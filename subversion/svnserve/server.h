@@ -36,8 +36,13 @@ extern "C" {
 #include "svn_repos.h"
 #include "svn_ra_svn.h"
 
+#include "private/svn_repos_private.h"
+
 enum username_case_type { CASE_FORCE_UPPER, CASE_FORCE_LOWER, CASE_ASIS };
 
+/* A process-wide cache of opened repositories (see repos-cache.c). */
+typedef struct repos_cache_t repos_cache_t;
+
 typedef struct server_baton_t {
   svn_repos_t *repos;
   const char *repos_name;  /* URI-encoded name of repository (not for authz) */
@@ -53,12 +58,15 @@ typedef struct server_baton_t {
   const char *user;        /* Authenticated username of the user */
   enum username_case_type username_case; /* Case-normalize the username? */
   const char *authz_user;  /* Username for authz ('user' + 'username_case') */
+  svn_repos__authz_read_baton_t authz_read_baton; /* For authz callbacks */
   svn_boolean_t tunnel;    /* Tunneled through login agent */
   const char *tunnel_user; /* Allow EXTERNAL to authenticate as this */
   svn_boolean_t read_only; /* Disallow write access (global flag) */
   svn_boolean_t use_sasl;  /* Use Cyrus SASL for authentication;
                               always false if SVN_HAVE_SASL not defined */
   apr_file_t *log_file;    /* Log filehandle. */
+  repos_cache_t *repos_cache; /* Where to get the repository from; may be
+                                 NULL */
   apr_pool_t *pool;
 } server_baton_t;
 
@@ -125,12 +133,58 @@ typedef struct serve_params_t {
      Defaults to SVN_DELTA_COMPRESSION_LEVEL_DEFAULT. */
   int compression_level;
 
+  /* Number of threads that may compress the data sent to a single
+     client.  Defaults to 1. */
+  int compression_threads;
+
+  /* If not NULL, reuse the repositories opened for earlier connections
+     of this process from this cache instead of opening them again. */
+  repos_cache_t *repos_cache;
+
 } serve_params_t;
 
 /* Serve the connection CONN according to the parameters PARAMS. */
 svn_error_t *serve(svn_ra_svn_conn_t *conn, serve_params_t *params,
                    apr_pool_t *pool);
 
+/* Perform the initial exchange on CONN according to the parameters
+   PARAMS: greeting, repository lookup and authentication.  Set *SESSION
+   to the resulting session state, allocated in POOL, or to NULL if the
+   client is not to be served any further.  serve() is serve_init()
+   followed by handling commands until the client disconnects. */
+svn_error_t *serve_init(server_baton_t **session,
+                        svn_ra_svn_conn_t *conn,
+                        serve_params_t *params,
+                        apr_pool_t *pool);
+
+/* Handle the commands the client of SESSION has already sent over CONN
+   and return once we would have to wait for the next one.  Set
+   *TERMINATED to TRUE if the session is over.  POOL must be the pool
+   that has been passed to serve_init(). */
+svn_error_t *serve_pending(svn_boolean_t *terminated,
+                           server_baton_t *session,
+                           svn_ra_svn_conn_t *conn,
+                           apr_pool_t *pool);
+
+/* Create a repository cache in POOL that keeps up to MAX_IDLE unused
+   repository handles per repository, and return it in *CACHE.  The cache
+   may be used from multiple threads concurrently. */
+svn_error_t *repos_cache_create(repos_cache_t **cache,
+                                int max_idle,
+                                apr_pool_t *pool);
+
+/* Set *REPOS to the repository at PATH, taken from CACHE if a handle is
+   available there or opened with FS_CONFIG otherwise.  The handle is
+   reserved for the caller until POOL gets cleared or destroyed, at which
+   point it is returned to CACHE.  Per-connection state such as the hook
+   environment and the FS warning function must be set up again by every
+   user of the handle. */
+svn_error_t *repos_cache_open(svn_repos_t **repos,
+                              repos_cache_t *cache,
+                              const char *path,
+                              apr_hash_t *fs_config,
+                              apr_pool_t *pool);
+
 /* Load a svnserve configuration file located at FILENAME into CFG,
    and if such as found, then:
 
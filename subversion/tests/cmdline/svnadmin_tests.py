@@ -536,6 +536,62 @@ def verify_windows_paths_in_repos(sbox):
                "* Verified revision 1.\n",
                "* Verified revision 2.\n"], errput)
 
+def verify_with_threads(sbox):
+  "svnadmin verify --threads"
+
+  sbox.build(create_wc = False)
+  for i in range(2, 12):
+    svntest.actions.run_and_verify_svn(None, None, [],
+                                       'mkdir', '-m', 'log_msg',
+                                       sbox.repo_url + '/dir%d' % i)
+
+  # The output must be the same as for the sequential verification.
+  expected = ["* Verified revision %d.\n" % i for i in range(0, 12)]
+  exit_code, output, errput = svntest.main.run_svnadmin("verify",
+                                                        "--threads", "3",
+                                                        sbox.repo_dir)
+  svntest.verify.compare_and_display_lines(
+    "Error while running 'svnadmin verify --threads 3'.",
+    'STDERR', expected, errput)
+
+  # A sub-range must work as well.
+  exit_code, output, errput = svntest.main.run_svnadmin("verify",
+                                                        "--threads", "4",
+                                                        "-r", "5:9",
+                                                        sbox.repo_dir)
+  svntest.verify.compare_and_display_lines(
+    "Error while running 'svnadmin verify --threads 4 -r 5:9'.",
+    'STDERR', expected[5:10], errput)
+
+@SkipUnless(svntest.main.is_fs_type_fsfs)
+def verify_delta_chain_stats(sbox):
+  "svnadmin verify --delta-chain-stats"
+
+  sbox.build()
+  iota_path = os.path.join(sbox.wc_dir, 'iota')
+  for i in range(3):
+    svntest.main.file_append(iota_path, 'line %d\n' % i)
+    svntest.main.run_svn(None, 'ci', sbox.wc_dir, '--quiet', '-m', 'log msg')
+
+  # The statistics go to stdout; --threads must not make them disappear.
+  exit_code, output, errput = svntest.main.run_svnadmin("verify", "--quiet",
+                                                        "--delta-chain-stats",
+                                                        "--threads", "2",
+                                                        sbox.repo_dir)
+  if errput:
+    raise SVNUnexpectedStderr(errput)
+
+  if len(output) != 3:
+    raise svntest.Failure("Unexpected output: %s" % output)
+  read_count = int(output[0].split(':')[1])
+  average = float(output[1].split(':')[1])
+  longest = int(output[2].split(':')[1])
+
+  # The last version of iota is a delta against an earlier one.
+  if read_count == 0 or average < 1.0 or longest < 2:
+    raise svntest.Failure("Unexpected delta chain statistics: %s" % output)
+
+
 #----------------------------------------------------------------------
 
 # Returns the filename of the rev or revprop file (according to KIND)
@@ -549,12 +605,18 @@ def fsfs_file(repo_dir, kind, rev):
       shard = int(rev) // svntest.main.options.fsfs_sharding
       path = os.path.join(repo_dir, 'db', kind, str(shard), rev)
 
-      if svntest.main.options.fsfs_packing is None or kind == 'revprops':
-        # we don't pack revprops
+      if svntest.main.options.fsfs_packing is None:
         return path
       elif os.path.exists(path):
         # rev exists outside a pack file.
         return path
+      elif kind == 'revprops':
+        # didn't find the plain file; look it up in the revprop manifest
+        pack_dir = os.path.join(repo_dir, 'db', kind, ('%d.pack' % shard))
+        first_rev = max(shard * svntest.main.options.fsfs_sharding, 1)
+        manifest = open(os.path.join(pack_dir, 'manifest')).readlines()
+        return os.path.join(pack_dir,
+                            manifest[int(rev) - first_rev].strip())
       else:
         # didn't find the plain file; assume it's in a pack file
         return os.path.join(repo_dir, 'db', kind, ('%d.pack' % shard), 'pack')
@@ -1840,6 +1902,8 @@ test_list = [ None,
               hotcopy_format,
               setrevprop,
               verify_windows_paths_in_repos,
+              verify_with_threads,
+              verify_delta_chain_stats,
               verify_incremental_fsfs,
               recover_fsfs,
               load_with_parent_dir,
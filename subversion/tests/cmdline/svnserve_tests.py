@@ -0,0 +1,369 @@
+#!/usr/bin/env python
+#
+#  svnserve_tests.py: tests of svnserve's threaded connection handling
+#
+#  Subversion is a tool for revision control.
+#  See http://subversion.apache.org for more information.
+#
+# ====================================================================
+#    Licensed to the Apache Software Foundation (ASF) under one
+#    or more contributor license agreements.  See the NOTICE file
+#    distributed with this work for additional information
+#    regarding copyright ownership.  The ASF licenses this file
+#    to you under the Apache License, Version 2.0 (the
+#    "License"); you may not use this file except in compliance
+#    with the License.  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#    Unless required by applicable law or agreed to in writing,
+#    software distributed under the License is distributed on an
+#    "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+#    KIND, either express or implied.  See the License for the
+#    specific language governing permissions and limitations
+#    under the License.
+######################################################################
+
+# General modules
+import os, re, socket, subprocess, time, logging
+
+logger = logging.getLogger()
+
+# Our testing module
+import svntest
+
+# (abbreviation)
+Skip = svntest.testcase.Skip_deco
+SkipUnless = svntest.testcase.SkipUnless_deco
+XFail = svntest.testcase.XFail_deco
+Issues = svntest.testcase.Issues_deco
+Issue = svntest.testcase.Issue_deco
+Wimp = svntest.testcase.Wimp_deco
+
+######################################################################
+# Helpers
+
+# These tests start their own svnserve, independent of the RA layer
+# the test suite itself is run against.
+svnserve_binary = os.path.abspath('../../svnserve/svnserve'
+                                  + svntest.main._exe)
+
+# Give up on a server that does not respond within this many seconds.
+SERVER_TIMEOUT = 30
+
+def start_svnserve(root, *varargs):
+  """Start a daemon svnserve serving the repositories below ROOT on a
+  free local port.  Pass VARARGS as additional options.  Return the
+  server process and its port.  Skip the test if svnserve has no
+  --multiplex option, i.e. has been built without thread support."""
+
+  exit_code, output, errput = svntest.main.run_command(svnserve_binary, 1, 0,
+                                                       '--help')
+  if not [line for line in output if '--multiplex' in line]:
+    raise svntest.Skip
+
+  # Let the OS pick a port that is free right now.
+  s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+  s.bind(('127.0.0.1', 0))
+  port = s.getsockname()[1]
+  s.close()
+
+  args = [svnserve_binary, '-d', '--foreground',
+          '--listen-host', '127.0.0.1', '--listen-port', str(port),
+          '-r', os.path.abspath(root)] + list(varargs)
+  logger.info('CMD: %s' % ' '.join(args))
+  server = subprocess.Popen(args, stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE)
+
+  # Wait for the server to accept connections.
+  deadline = time.time() + SERVER_TIMEOUT
+  while True:
+    if server.poll() is not None:
+      raise svntest.Failure('svnserve exited: %s'
+                            % server.stderr.read().rstrip())
+    try:
+      s = socket.create_connection(('127.0.0.1', port), SERVER_TIMEOUT)
+      s.close()
+      break
+    except socket.error:
+      if time.time() > deadline:
+        stop_svnserve(server)
+        raise svntest.Failure('svnserve did not start listening')
+      time.sleep(0.1)
+
+  return server, port
+
+def stop_svnserve(server):
+  "Terminate the svnserve process SERVER and wait for it to exit."
+
+  if server.poll() is None:
+    server.terminate()
+  server.wait()
+
+def repos_url(port, repo_dir):
+  "Return the svn:// URL of REPO_DIR served by the svnserve at PORT."
+
+  return 'svn://127.0.0.1:%d/%s' % (port, os.path.basename(repo_dir))
+
+def split_items(data, count):
+  """Return up to COUNT complete top-level items at the start of the
+  ra_svn protocol DATA as a list of strings, followed by the rest of
+  DATA."""
+
+  items = []
+  depth = 0
+  start = pos = 0
+  while pos < len(data) and len(items) < count:
+    c = data[pos]
+    if c == '(':
+      depth += 1
+      pos += 1
+    elif c == ')':
+      depth -= 1
+      pos += 1
+      if depth == 0:
+        items.append(data[start:pos].strip())
+        start = pos
+    elif c.isdigit():
+      end = pos
+      while end < len(data) and data[end].isdigit():
+        end += 1
+      if end == len(data):
+        break
+      if data[end] == ':':
+        # A string: skip its contents, whatever they are.
+        end += 1 + int(data[pos:end])
+        if end > len(data):
+          break
+      pos = end
+    else:
+      pos += 1
+
+  return items, data[start:]
+
+class RawConnection:
+  """An svn:// connection to REPO_URL that has completed the initial
+  exchange and then just sits there.  Only speaks as much of the
+  protocol as these tests need."""
+
+  def __init__(self, port, repo_url):
+    self.sock = socket.create_connection(('127.0.0.1', port), SERVER_TIMEOUT)
+    self.data = ''
+
+    # Greeting, then anonymous authentication followed by the
+    # repository information.
+    self.read_items(1)
+    self.send('( 2 ( edit-pipeline svndiff1 ) %d:%s ) '
+              % (len(repo_url), repo_url))
+    mechs = self.read_items(1)[0]
+    if 'ANONYMOUS' not in mechs:
+      raise svntest.Failure('Anonymous access not offered: ' + mechs)
+    self.send('( ANONYMOUS ( 0: ) ) ')
+    self.read_items(2)
+
+  def send(self, text):
+    self.sock.sendall(text.encode('ascii'))
+
+  def read_items(self, count):
+    "Read COUNT top-level items from the server and return them."
+
+    items, rest = split_items(self.data, count)
+    while len(items) < count:
+      chunk = self.sock.recv(4096)
+      if not chunk:
+        raise svntest.Failure('Connection closed by svnserve')
+      self.data += chunk.decode('latin-1')
+      items, rest = split_items(self.data, count)
+
+    self.data = rest
+    return items
+
+  def get_latest_rev(self):
+    "Return the youngest revision as reported by the server."
+
+    self.send('( get-latest-rev ( ) ) ')
+    auth, response = self.read_items(2)
+    match = re.match(r'\( success \( (\d+) \) \)', response)
+    if not match:
+      raise svntest.Failure('Unexpected response: ' + response)
+    return int(match.group(1))
+
+  def close(self):
+    self.sock.close()
+
+######################################################################
+# Tests
+#
+#   Each test must return on success or raise on failure.
+
+
+#----------------------------------------------------------------------
+
+def multiplex_idle_connections(sbox):
+  "--multiplex with more idle clients than threads"
+
+  sbox.build(create_wc=False)
+
+  server, port = start_svnserve(os.path.dirname(sbox.repo_dir),
+                                '--threads', '--multiplex',
+                                '--min-threads', '1', '--max-threads', '2')
+  try:
+    url = repos_url(port, sbox.repo_dir)
+
+    # None of these occupies a worker thread while idle.
+    idle = [RawConnection(port, url) for i in range(5)]
+
+    # So other clients still get served.
+    svntest.actions.run_and_verify_svn(None, ['A/\n', 'iota\n'], [],
+                                       'ls', url)
+    svntest.actions.run_and_verify_svn(None, svntest.verify.AnyOutput, [],
+                                       'mkdir', '-m', 'log msg',
+                                       url + '/newdir')
+
+    # And the idle connections get picked up again once they talk.
+    for conn in idle:
+      if conn.get_latest_rev() != 2:
+        raise svntest.Failure('Idle connection sees stale HEAD')
+    for conn in idle:
+      if conn.get_latest_rev() != 2:
+        raise svntest.Failure('Idle connection sees stale HEAD')
+
+    for conn in idle:
+      conn.close()
+
+    svntest.actions.run_and_verify_svn(None, ['A/\n', 'iota\n', 'newdir/\n'],
+                                       [], 'ls', url)
+  finally:
+    stop_svnserve(server)
+
+#----------------------------------------------------------------------
+
+def repos_cache_reuse_and_eviction(sbox):
+  "reuse and eviction of cached repositories"
+
+  sbox.build(create_wc=False)
+  other_repo_dir, other_url = sbox.add_repo_path('other')
+  svntest.main.create_repos(other_repo_dir)
+  svntest.actions.enable_revprop_changes(sbox.repo_dir)
+
+  exit_code, output, errput = svntest.main.run_svnlook('uuid', sbox.repo_dir)
+  uuid = output[0].strip()
+  exit_code, output, errput = svntest.main.run_svnlook('uuid', other_repo_dir)
+  other_uuid = output[0].strip()
+
+  # With a single thread, svnserve keeps only one idle handle per
+  # repository and closes the surplus ones.
+  server, port = start_svnserve(os.path.dirname(sbox.repo_dir),
+                                '--threads', '--multiplex',
+                                '--max-threads', '1')
+  try:
+    url = repos_url(port, sbox.repo_dir)
+    other_url = repos_url(port, other_repo_dir)
+
+    # Hold several handles of the same repository at once.
+    conns = [RawConnection(port, url) for i in range(3)]
+    other_conn = RawConnection(port, other_url)
+
+    svntest.actions.run_and_verify_svn(None, svntest.verify.AnyOutput, [],
+                                       'mkdir', '-m', 'log msg',
+                                       url + '/dir2')
+
+    # Every handle must see the commit made through another one.
+    for conn in conns:
+      if conn.get_latest_rev() != 2:
+        raise svntest.Failure('Repository handle sees stale HEAD')
+    if other_conn.get_latest_rev() != 0:
+      raise svntest.Failure('Repositories got mixed up')
+
+    # Return the handles to the cache, which evicts all but one of them.
+    for conn in conns:
+      conn.close()
+    other_conn.close()
+
+    # The remaining cached handles must keep tracking their repositories.
+    for rev in range(3, 6):
+      svntest.actions.run_and_verify_svn(None, svntest.verify.AnyOutput, [],
+                                         'mkdir', '-m', 'log msg',
+                                         url + '/dir%d' % rev)
+      svntest.actions.run_and_verify_svn(None, svntest.verify.AnyOutput, [],
+                                         'propset', '--revprop',
+                                         '-r', str(rev), 'svn:log',
+                                         'changed %d' % rev, url)
+      svntest.actions.run_and_verify_svn(None, ['changed %d\n' % rev], [],
+                                         'propget', '--revprop',
+                                         '-r', str(rev), 'svn:log', url)
+      svntest.actions.run_and_verify_info([{'Revision' : str(rev),
+                                            'Repository UUID' : uuid}],
+                                          url)
+      svntest.actions.run_and_verify_info([{'Revision' : '0',
+                                            'Repository UUID' : other_uuid}],
+                                          other_url)
+
+    svntest.actions.run_and_verify_svn(None,
+                                       ['A/\n', 'dir2/\n', 'dir3/\n',
+                                        'dir4/\n', 'dir5/\n', 'iota\n'],
+                                       [], 'ls', url)
+  finally:
+    stop_svnserve(server)
+
+#----------------------------------------------------------------------
+
+def terminate_with_idle_connection(sbox):
+  "SIGTERM with --cache-snapshot and an idle client"
+
+  sbox.build(create_wc=False)
+  snapshot = os.path.abspath(sbox.repo_dir + '.snapshot')
+
+  # Without --multiplex, the idle client occupies a worker thread.
+  server, port = start_svnserve(os.path.dirname(sbox.repo_dir),
+                                '--threads', '--cache-snapshot', snapshot)
+  try:
+    url = repos_url(port, sbox.repo_dir)
+    idle = RawConnection(port, url)
+    if idle.get_latest_rev() != 1:
+      raise svntest.Failure('Unexpected HEAD')
+
+    # The server must not wait for the client to go away.
+    server.terminate()
+    deadline = time.time() + SERVER_TIMEOUT
+    while server.poll() is None:
+      if time.time() > deadline:
+        raise svntest.Failure('svnserve hangs on an idle connection')
+      time.sleep(0.1)
+
+    if server.returncode != 0:
+      raise svntest.Failure('svnserve exited with %d: %s'
+                            % (server.returncode,
+                               server.stderr.read().rstrip()))
+    if not os.path.exists(snapshot):
+      raise svntest.Failure('No cache snapshot written')
+    idle.close()
+  finally:
+    stop_svnserve(server)
+
+  # The next instance starts from that snapshot.
+  server, port = start_svnserve(os.path.dirname(sbox.repo_dir),
+                                '--threads', '--cache-snapshot', snapshot)
+  try:
+    svntest.actions.run_and_verify_svn(None, ['A/\n', 'iota\n'], [],
+                                       'ls', repos_url(port, sbox.repo_dir))
+  finally:
+    stop_svnserve(server)
+
+
+########################################################################
+# Run the tests
+
+# list all tests here, starting with None:
+test_list = [ None,
+              multiplex_idle_connections,
+              repos_cache_reuse_and_eviction,
+              terminate_with_idle_connection,
+             ]
+
+if __name__ == '__main__':
+  svntest.main.run_tests(test_list)
+  # NOTREACHED
+
+
+### End of file.
@@ -31,6 +31,7 @@
 #include "../../libsvn_client/client.h"
 #include "svn_pools.h"
 #include "svn_client.h"
+#include "svn_config.h"
 #include "svn_repos.h"
 #include "svn_subst.h"
 
@@ -721,6 +722,299 @@ test_youngest_common_ancestor(const svn_test_opts_t *opts,
 }
 
 
+/* Run svn_client_diff6() between revisions 1 and 2 of REPOS_URL with the
+   diff-threads option set to THREADS and return the output in *OUTPUT. */
+static svn_error_t *
+run_diff_with_threads(svn_stringbuf_t **output,
+                      const char *repos_url,
+                      const char *threads,
+                      svn_boolean_t use_git_diff_format,
+                      apr_pool_t *pool)
+{
+  svn_opt_revision_t rev1 = { svn_opt_revision_number, { 1 } };
+  svn_opt_revision_t rev2 = { svn_opt_revision_number, { 2 } };
+  svn_client_ctx_t *ctx;
+  svn_config_t *cfg;
+  svn_stream_t *errstream = svn_stream_empty(pool);
+
+  SVN_ERR(svn_config_create(&cfg, FALSE, pool));
+  svn_config_set(cfg, SVN_CONFIG_SECTION_MISCELLANY,
+                 SVN_CONFIG_OPTION_DIFF_THREADS, threads);
+
+  SVN_ERR(svn_client_create_context(&ctx, pool));
+  ctx->config = apr_hash_make(pool);
+  apr_hash_set(ctx->config, SVN_CONFIG_CATEGORY_CONFIG, APR_HASH_KEY_STRING,
+               cfg);
+
+  *output = svn_stringbuf_create_empty(pool);
+  SVN_ERR(svn_client_diff6(NULL, repos_url, &rev1, repos_url, &rev2,
+                           NULL, svn_depth_infinity,
+                           FALSE /* ignore_ancestry */,
+                           FALSE /* no_diff_deleted */,
+                           FALSE /* show_copies_as_adds */,
+                           FALSE /* ignore_content_type */,
+                           FALSE /* ignore_prop_diff */,
+                           use_git_diff_format, "UTF-8",
+                           svn_stream_from_stringbuf(*output, pool),
+                           errstream, NULL, ctx, pool));
+
+  return SVN_NO_ERROR;
+}
+
+static svn_error_t *
+test_diff_threads(const svn_test_opts_t *opts,
+                  apr_pool_t *pool)
+{
+  const char *repos_url;
+  svn_repos_t *repos;
+  svn_fs_txn_t *txn;
+  svn_fs_root_t *txn_root;
+  svn_revnum_t committed_rev;
+  svn_stringbuf_t *expected, *actual;
+  int i;
+
+  SVN_ERR(create_greek_repos(&repos_url, "test-diff-threads", opts, pool));
+
+  /* Revision 2 changes the text and the properties of some files,
+     deletes one and adds lots of them, so that there are more text
+     diffs than threads. */
+  SVN_ERR(svn_repos_open2(&repos, "test-diff-threads", NULL, pool));
+  SVN_ERR(svn_fs_begin_txn2(&txn, svn_repos_fs(repos), 1, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&txn_root, txn, pool));
+  SVN_ERR(svn_test__set_file_contents(txn_root, "iota",
+                                      "This is the file 'iota'.\n"
+                                      "With a second line.\n", pool));
+  SVN_ERR(svn_fs_change_node_prop(txn_root, "iota", "color",
+                                  svn_string_create("red", pool), pool));
+  SVN_ERR(svn_test__set_file_contents(txn_root, "A/mu",
+                                      "The file 'mu' changed.\n", pool));
+  SVN_ERR(svn_fs_change_node_prop(txn_root, "A/B/lambda", "color",
+                                  svn_string_create("blue", pool), pool));
+  SVN_ERR(svn_fs_change_node_prop(txn_root, "A/D", "color",
+                                  svn_string_create("green", pool), pool));
+  SVN_ERR(svn_fs_delete(txn_root, "A/D/G/pi", pool));
+  for (i = 0; i < 40; i++)
+    {
+      const char *path = apr_psprintf(pool, "A/C/file%d", i);
+
+      SVN_ERR(svn_fs_make_file(txn_root, path, pool));
+      SVN_ERR(svn_test__set_file_contents(txn_root, path,
+                                          apr_psprintf(pool,
+                                                       "line 1\nline %d\n",
+                                                       i),
+                                          pool));
+      if (i % 3 == 0)
+        SVN_ERR(svn_fs_change_node_prop(txn_root, path, "number",
+                                        svn_string_createf(pool, "%d", i),
+                                        pool));
+    }
+  SVN_ERR(svn_repos_fs_commit_txn(NULL, repos, &committed_rev, txn, pool));
+  SVN_TEST_ASSERT(committed_rev == 2);
+
+  /* The output doesn't depend on the number of threads. */
+  for (i = 0; i < 2; i++)
+    {
+      svn_boolean_t use_git_diff_format = (i == 1);
+
+      SVN_ERR(run_diff_with_threads(&expected, repos_url, "1",
+                                    use_git_diff_format, pool));
+      SVN_ERR(run_diff_with_threads(&actual, repos_url, "4",
+                                    use_git_diff_format, pool));
+
+      SVN_TEST_ASSERT(strstr(expected->data, "A/C/file39") != NULL);
+      SVN_TEST_ASSERT(strstr(expected->data, "Property changes on: ")
+                      != NULL);
+      SVN_TEST_STRING_ASSERT(actual->data, expected->data);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+
+/* Baton for merge_notify(). */
+typedef struct merge_notify_baton_t
+{
+  const char *wc_abspath;
+  svn_stringbuf_t *notifications;
+} merge_notify_baton_t;
+
+/* Implements svn_wc_notify_func2_t, logging the notifications of a merge
+   into the working copy of the merge_notify_baton_t BATON. */
+static void
+merge_notify(void *baton,
+             const svn_wc_notify_t *notify,
+             apr_pool_t *pool)
+{
+  merge_notify_baton_t *b = baton;
+  const char *relpath = svn_dirent_skip_ancestor(b->wc_abspath,
+                                                 notify->path);
+
+  svn_stringbuf_appendcstr(b->notifications,
+                           apr_psprintf(pool, "%d %d %d %s\n",
+                                        notify->action,
+                                        notify->content_state,
+                                        notify->prop_state,
+                                        relpath ? relpath : notify->path));
+}
+
+/* Check out 'branch' of REPOS_URL, modify some of its files locally and
+   merge revision 4 of 'A' into it with the diff-threads option set to
+   THREADS.  Return the notifications of the merge in *NOTIFICATIONS and
+   the resulting contents of the files in *CONTENTS. */
+static svn_error_t *
+run_merge_with_threads(svn_stringbuf_t **notifications,
+                       svn_stringbuf_t **contents,
+                       const char *repos_url,
+                       const char *threads,
+                       apr_pool_t *pool)
+{
+  svn_opt_revision_t head_rev = { svn_opt_revision_head, { 0 } };
+  svn_opt_revision_t rev3 = { svn_opt_revision_number, { 3 } };
+  svn_opt_revision_t rev4 = { svn_opt_revision_number, { 4 } };
+  const char *source_url = svn_path_url_add_component2(repos_url, "A", pool);
+  svn_client_ctx_t *ctx;
+  svn_config_t *cfg;
+  merge_notify_baton_t nb;
+  const char *wc_path;
+  int i;
+
+  SVN_ERR(svn_dirent_get_absolute(&wc_path,
+                                  apr_pstrcat(pool, "test-merge-threads-wc",
+                                              threads, (char *)NULL),
+                                  pool));
+  SVN_ERR(svn_io_remove_dir2(wc_path, TRUE, NULL, NULL, pool));
+  svn_test_add_dir_cleanup(wc_path);
+
+  SVN_ERR(svn_config_create(&cfg, FALSE, pool));
+  svn_config_set(cfg, SVN_CONFIG_SECTION_MISCELLANY,
+                 SVN_CONFIG_OPTION_DIFF_THREADS, threads);
+
+  SVN_ERR(svn_client_create_context(&ctx, pool));
+  ctx->config = apr_hash_make(pool);
+  apr_hash_set(ctx->config, SVN_CONFIG_CATEGORY_CONFIG, APR_HASH_KEY_STRING,
+               cfg);
+
+  SVN_ERR(svn_client_checkout3(NULL,
+                               svn_path_url_add_component2(repos_url,
+                                                           "branch", pool),
+                               wc_path, &head_rev, &head_rev,
+                               svn_depth_infinity, TRUE, FALSE, ctx, pool));
+
+  /* Local changes that merge cleanly with the incoming ones, and some
+     that conflict with them. */
+  for (i = 0; i < 40; i += 2)
+    SVN_ERR(svn_io_file_create(svn_dirent_join(wc_path,
+                                               apr_psprintf(pool,
+                                                            "C/file%d", i),
+                                               pool),
+                               (i % 5 == 0)
+                                 ? "line 1 mine\nline 2\nline 3\n"
+                                 : "line 1\nline 2\nline 3 mine\n",
+                               pool));
+
+  nb.wc_abspath = wc_path;
+  nb.notifications = svn_stringbuf_create_empty(pool);
+  ctx->notify_func2 = merge_notify;
+  ctx->notify_baton2 = &nb;
+
+  SVN_ERR(svn_client_merge4(source_url, &rev3, source_url, &rev4, wc_path,
+                            svn_depth_infinity,
+                            FALSE /* ignore_ancestry */,
+                            FALSE /* force */,
+                            FALSE /* record_only */,
+                            FALSE /* dry_run */,
+                            FALSE /* allow_mixed_rev */,
+                            NULL, ctx, pool));
+
+  *notifications = nb.notifications;
+  *contents = svn_stringbuf_create_empty(pool);
+  for (i = 0; i < 40; i++)
+    {
+      const char *path = apr_psprintf(pool, "C/file%d", i);
+      svn_stringbuf_t *file_contents;
+
+      SVN_ERR(svn_stringbuf_from_file2(&file_contents,
+                                       svn_dirent_join(wc_path, path, pool),
+                                       pool));
+      svn_stringbuf_appendcstr(*contents, path);
+      svn_stringbuf_appendcstr(*contents, ":\n");
+      svn_stringbuf_appendstr(*contents, file_contents);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+static svn_error_t *
+test_merge_threads(const svn_test_opts_t *opts,
+                   apr_pool_t *pool)
+{
+  const char *repos_url;
+  svn_repos_t *repos;
+  svn_fs_t *fs;
+  svn_fs_txn_t *txn;
+  svn_fs_root_t *txn_root, *rev_root;
+  svn_revnum_t committed_rev;
+  svn_stringbuf_t *expected_notifications, *actual_notifications;
+  svn_stringbuf_t *expected_contents, *actual_contents;
+  int i;
+
+  SVN_ERR(create_greek_repos(&repos_url, "test-merge-threads", opts, pool));
+  SVN_ERR(svn_repos_open2(&repos, "test-merge-threads", NULL, pool));
+  fs = svn_repos_fs(repos);
+
+  /* Revision 2 adds more files than there are threads, revision 3
+     branches 'A' off and revision 4 changes all those files. */
+  SVN_ERR(svn_fs_begin_txn2(&txn, fs, 1, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&txn_root, txn, pool));
+  for (i = 0; i < 40; i++)
+    {
+      const char *path = apr_psprintf(pool, "A/C/file%d", i);
+
+      SVN_ERR(svn_fs_make_file(txn_root, path, pool));
+      SVN_ERR(svn_test__set_file_contents(txn_root, path,
+                                          "line 1\nline 2\nline 3\n", pool));
+    }
+  SVN_ERR(svn_repos_fs_commit_txn(NULL, repos, &committed_rev, txn, pool));
+  SVN_TEST_ASSERT(committed_rev == 2);
+
+  SVN_ERR(svn_fs_begin_txn2(&txn, fs, 2, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&txn_root, txn, pool));
+  SVN_ERR(svn_fs_revision_root(&rev_root, fs, 2, pool));
+  SVN_ERR(svn_fs_copy(rev_root, "A", txn_root, "branch", pool));
+  SVN_ERR(svn_repos_fs_commit_txn(NULL, repos, &committed_rev, txn, pool));
+  SVN_TEST_ASSERT(committed_rev == 3);
+
+  SVN_ERR(svn_fs_begin_txn2(&txn, fs, 3, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&txn_root, txn, pool));
+  for (i = 0; i < 40; i++)
+    SVN_ERR(svn_test__set_file_contents(txn_root,
+                                        apr_psprintf(pool, "A/C/file%d", i),
+                                        "line 1 theirs\nline 2\nline 3\n",
+                                        pool));
+  SVN_ERR(svn_repos_fs_commit_txn(NULL, repos, &committed_rev, txn, pool));
+  SVN_TEST_ASSERT(committed_rev == 4);
+
+  /* Neither the notifications nor the results depend on the number of
+     threads. */
+  SVN_ERR(run_merge_with_threads(&expected_notifications,
+                                 &expected_contents, repos_url, "1", pool));
+  SVN_ERR(run_merge_with_threads(&actual_notifications,
+                                 &actual_contents, repos_url, "4", pool));
+
+  SVN_TEST_ASSERT(strstr(expected_contents->data,
+                         "C/file39:\nline 1 theirs\n") != NULL);
+  SVN_TEST_ASSERT(strstr(expected_contents->data,
+                         "C/file2:\nline 1 theirs\nline 2\nline 3 mine\n")
+                  != NULL);
+  SVN_TEST_ASSERT(strstr(expected_contents->data, "<<<<<<< .working")
+                  != NULL);
+  SVN_TEST_STRING_ASSERT(actual_notifications->data,
+                         expected_notifications->data);
+  SVN_TEST_STRING_ASSERT(actual_contents->data, expected_contents->data);
+
+  return SVN_NO_ERROR;
+}
+
 /* ========================================================================== */
 
 struct svn_test_descriptor_t test_funcs[] =
@@ -737,5 +1031,7 @@ struct svn_test_descriptor_t test_funcs[] =
     SVN_TEST_OPTS_PASS(test_16k_add, "test adding 16k files"),
 #endif
     SVN_TEST_OPTS_PASS(test_youngest_common_ancestor, "test youngest_common_ancestor"),
+    SVN_TEST_OPTS_PASS(test_diff_threads, "test diff-threads"),
+    SVN_TEST_OPTS_PASS(test_merge_threads, "test diff-threads with merges"),
     SVN_TEST_NULL
   };
@@ -36,6 +36,7 @@
 #include "svn_delta.h"
 #include "svn_pools.h"
 #include "svn_error.h"
+#include "svn_sorts.h"
 
 #include "../../libsvn_delta/delta.h"
 #include "delta-window-test.h"
@@ -283,9 +284,11 @@ copy_tempfile(apr_file_t *fp, apr_pool_t *pool)
 
 
 
-/* Implements svn_test_driver_t. */
+/* Run the random delta test, encoding the deltas as svndiff version 1.
+   If VARY_VERSIONS is set, cycle through all svndiff versions instead. */
 static svn_error_t *
-random_test(apr_pool_t *pool)
+do_random_test(apr_pool_t *pool,
+               svn_boolean_t vary_versions)
 {
   apr_uint32_t seed, maxlen;
   apr_size_t bytes_range;
@@ -332,7 +335,8 @@ random_test(apr_pool_t *pool)
 
       /* Make stage 2: encode the text delta in svndiff format using
                        varying compression levels. */
-      svn_txdelta_to_svndiff3(&handler, &handler_baton, stream, 1, i % 10,
+      svn_txdelta_to_svndiff3(&handler, &handler_baton, stream,
+                              vary_versions ? i % 3 : 1, i % 10,
                               delta_pool);
 
       /* Make stage 1: create the text delta.  */
@@ -359,6 +363,20 @@ random_test(apr_pool_t *pool)
   return SVN_NO_ERROR;
 }
 
+/* Implements svn_test_driver_t. */
+static svn_error_t *
+random_test(apr_pool_t *pool)
+{
+  return do_random_test(pool, FALSE);
+}
+
+/* Implements svn_test_driver_t. */
+static svn_error_t *
+random_versions_test(apr_pool_t *pool)
+{
+  return do_random_test(pool, TRUE);
+}
+
 
 
 /* (Note: *LAST_SEED is an output parameter.) */
@@ -501,6 +519,438 @@ random_combine_test(apr_pool_t *pool)
 }
 
 
+/* Set *SVNDIFF to the uncompressed svndiff representation of the delta
+   between the files SOURCE and TARGET, rewinding both files first.
+   Allocate the result in POOL. */
+static svn_error_t *
+get_svndiff(svn_stringbuf_t **svndiff,
+            apr_file_t *source,
+            apr_file_t *target,
+            apr_pool_t *pool)
+{
+  svn_txdelta_stream_t *txdelta_stream;
+  svn_txdelta_window_handler_t handler;
+  void *handler_baton;
+  apr_pool_t *delta_pool = svn_pool_create(pool);
+
+  rewind_file(source);
+  rewind_file(target);
+  *svndiff = svn_stringbuf_create_empty(pool);
+
+  svn_txdelta_to_svndiff3(&handler, &handler_baton,
+                          svn_stream_from_stringbuf(*svndiff, delta_pool),
+                          0, 0, delta_pool);
+  svn_txdelta(&txdelta_stream,
+              svn_stream_from_aprfile(source, delta_pool),
+              svn_stream_from_aprfile(target, delta_pool),
+              delta_pool);
+  SVN_ERR(svn_txdelta_send_txstream(txdelta_stream, handler, handler_baton,
+                                    delta_pool));
+
+  svn_pool_destroy(delta_pool);
+  return SVN_NO_ERROR;
+}
+
+/* Implements svn_test_driver_t. */
+static svn_error_t *
+xdelta_kernels_test(apr_pool_t *pool)
+{
+  static const svn_txdelta__xdelta_kernel_t kernels[] =
+    {
+      svn_txdelta__xdelta_kernel_sse2,
+      svn_txdelta__xdelta_kernel_avx2
+    };
+
+  apr_uint32_t seed, maxlen;
+  apr_size_t bytes_range;
+  int i, iterations, dump_files, print_windows;
+  apr_size_t k;
+  const char *random_bytes;
+  svn_error_t *err = SVN_NO_ERROR;
+
+  init_params(&seed, &maxlen, &iterations, &dump_files, &print_windows,
+              &random_bytes, &bytes_range, pool);
+
+  for (i = 0; i < iterations && !err; i++)
+    {
+      apr_uint32_t subseed_base = svn_test_rand(&seed);
+      apr_file_t *source = generate_random_file(maxlen, subseed_base, &seed,
+                                                random_bytes, bytes_range,
+                                                dump_files, pool);
+      apr_file_t *target = generate_random_file(maxlen, subseed_base, &seed,
+                                                random_bytes, bytes_range,
+                                                dump_files, pool);
+      svn_stringbuf_t *expected, *actual;
+
+      /* All kernels must produce exactly what the portable code does. */
+      svn_txdelta__xdelta_use_kernel(svn_txdelta__xdelta_kernel_scalar);
+      err = get_svndiff(&expected, source, target, pool);
+
+      for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && !err; k++)
+        {
+          if (! svn_txdelta__xdelta_use_kernel(kernels[k]))
+            continue;
+
+          err = get_svndiff(&actual, source, target, pool);
+          if (!err && ! svn_stringbuf_compare(expected, actual))
+            err = svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                    "xdelta kernel %d differs from the "
+                                    "scalar one (seed: %lu)",
+                                    (int)kernels[k], (unsigned long)seed);
+        }
+
+      apr_file_close(source);
+      apr_file_close(target);
+    }
+
+  svn_txdelta__xdelta_use_kernel(svn_txdelta__xdelta_kernel_auto);
+  return err;
+}
+
+
+/* Deltify TARGET against SOURCE using WINDOW_SIZE and return the svndiff
+   in *SVNDIFF.  Verify that applying it to SOURCE yields TARGET, reading
+   it with a parser that accepts windows of that size. */
+static svn_error_t *
+deltify_and_apply(svn_stringbuf_t **svndiff,
+                  svn_stringbuf_t *source,
+                  svn_stringbuf_t *target,
+                  apr_size_t window_size,
+                  apr_pool_t *pool)
+{
+  svn_txdelta_stream_t *txdelta_stream;
+  svn_txdelta_window_handler_t handler;
+  void *handler_baton;
+  svn_stringbuf_t *result = svn_stringbuf_create_empty(pool);
+  svn_stream_t *stream;
+  char header[4];
+  apr_size_t len = sizeof(header);
+  apr_size_t target_len = 0;
+
+  *svndiff = svn_stringbuf_create_empty(pool);
+  svn_txdelta_to_svndiff3(&handler, &handler_baton,
+                          svn_stream_from_stringbuf(*svndiff, pool),
+                          0, 0, pool);
+  svn_txdelta2(&txdelta_stream,
+               svn_stream_from_stringbuf(source, pool),
+               svn_stream_from_stringbuf(target, pool),
+               window_size, pool);
+  SVN_ERR(svn_txdelta_send_txstream(txdelta_stream, handler, handler_baton,
+                                    pool));
+
+  svn_txdelta_apply(svn_stream_from_stringbuf(source, pool),
+                    svn_stream_from_stringbuf(result, pool),
+                    NULL, NULL, pool, &handler, &handler_baton);
+  stream = svn_stream_from_stringbuf(*svndiff, pool);
+  SVN_ERR(svn_stream_read(stream, header, &len));
+  while (target_len < target->len)
+    {
+      svn_txdelta_window_t *window;
+
+      SVN_ERR(svn_txdelta_read_svndiff_window2(&window, stream, header[3],
+                                               window_size, pool));
+      SVN_ERR(handler(window, handler_baton));
+      target_len += window->tview_len;
+    }
+  SVN_ERR(handler(NULL, handler_baton));
+
+  if (! svn_stringbuf_compare(result, target))
+    return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                             "delta with window size %" APR_SIZE_T_FMT
+                             " does not reproduce the target",
+                             window_size);
+
+  return SVN_NO_ERROR;
+}
+
+/* Implements svn_test_driver_t. */
+static svn_error_t *
+large_window_test(apr_pool_t *pool)
+{
+  enum { DATA_SIZE = 1024 * 1024 };
+
+  svn_stringbuf_t *source = svn_stringbuf_create_ensure(DATA_SIZE, pool);
+  svn_stringbuf_t *target = svn_stringbuf_create_ensure(DATA_SIZE, pool);
+  svn_stringbuf_t *small_delta, *large_delta;
+  svn_txdelta_window_handler_t handler;
+  void *handler_baton;
+  svn_stream_t *stream;
+  svn_error_t *err;
+  apr_uint32_t seed = 4711;
+  apr_size_t i, len;
+
+  /* Incompressible source data. */
+  for (i = 0; i < DATA_SIZE; ++i)
+    svn_stringbuf_appendbyte(source, (char)svn_test_rand(&seed));
+
+  /* The target swaps both halves, i.e. all data moves by half a MB. */
+  svn_stringbuf_appendbytes(target, source->data + DATA_SIZE / 2,
+                            DATA_SIZE / 2);
+  svn_stringbuf_appendbytes(target, source->data, DATA_SIZE / 2);
+
+  SVN_ERR(deltify_and_apply(&small_delta, source, target, 0, pool));
+  SVN_ERR(deltify_and_apply(&large_delta, source, target, 2 * DATA_SIZE,
+                            pool));
+
+  /* The parsers used for network data don't accept large windows. */
+  svn_txdelta_apply(svn_stream_from_stringbuf(source, pool),
+                    svn_stream_empty(pool),
+                    NULL, NULL, pool, &handler, &handler_baton);
+  stream = svn_txdelta_parse_svndiff(handler, handler_baton, TRUE, pool);
+  len = large_delta->len;
+  err = svn_stream_write(stream, large_delta->data, &len);
+  SVN_TEST_ASSERT(err && err->apr_err == SVN_ERR_SVNDIFF_CORRUPT_WINDOW);
+  svn_error_clear(err);
+
+  /* Default windows can't see the moved data, a single window can. */
+  if (small_delta->len < DATA_SIZE / 2)
+    return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                             "unexpectedly small default delta: %"
+                             APR_SIZE_T_FMT " bytes", small_delta->len);
+  if (large_delta->len > DATA_SIZE / 100)
+    return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                             "large window delta too big: %"
+                             APR_SIZE_T_FMT " bytes", large_delta->len);
+
+  /* Oversized windows get clipped but still produce valid deltas. */
+  SVN_ERR(deltify_and_apply(&large_delta, source, target,
+                            4 * SVN_DELTA_MAX_WINDOW_SIZE, pool));
+
+  return SVN_NO_ERROR;
+}
+
+
+/* Set *SVNDIFF to the svndiff VERSION encoding of the delta between
+   SOURCE and TARGET, compressed on THREAD_COUNT threads. */
+static svn_error_t *
+encode_svndiff(svn_stringbuf_t **svndiff,
+               svn_stringbuf_t *source,
+               svn_stringbuf_t *target,
+               int version,
+               int thread_count,
+               apr_pool_t *pool)
+{
+  svn_txdelta_stream_t *txdelta_stream;
+  svn_txdelta_window_handler_t handler;
+  void *handler_baton;
+
+  *svndiff = svn_stringbuf_create_empty(pool);
+  svn_txdelta_to_svndiff4(&handler, &handler_baton,
+                          svn_stream_from_stringbuf(*svndiff, pool),
+                          version, SVN_DELTA_COMPRESSION_LEVEL_DEFAULT,
+                          thread_count, pool);
+  svn_txdelta(&txdelta_stream,
+              svn_stream_from_stringbuf(source, pool),
+              svn_stream_from_stringbuf(target, pool),
+              pool);
+  return svn_txdelta_send_txstream(txdelta_stream, handler, handler_baton,
+                                   pool);
+}
+
+/* Implements svn_test_driver_t. */
+static svn_error_t *
+concurrent_encoder_test(apr_pool_t *pool)
+{
+  enum { DATA_SIZE = 1024 * 1024 };
+
+  svn_stringbuf_t *source = svn_stringbuf_create_ensure(DATA_SIZE, pool);
+  svn_stringbuf_t *target = svn_stringbuf_create_ensure(DATA_SIZE, pool);
+  apr_uint32_t seed = 815;
+  apr_size_t i;
+  int version;
+
+  /* Compressible data spanning many windows, with random edits. */
+  for (i = 0; i < DATA_SIZE; ++i)
+    svn_stringbuf_appendbyte(source, (char)('a' + svn_test_rand(&seed) % 8));
+  for (i = 0; i < DATA_SIZE; ++i)
+    svn_stringbuf_appendbyte(target, svn_test_rand(&seed) % 16
+                                     ? source->data[i]
+                                     : (char)svn_test_rand(&seed));
+
+  for (version = 1; version <= 2; ++version)
+    {
+      apr_pool_t *iterpool = svn_pool_create(pool);
+      svn_stringbuf_t *expected, *actual, *result;
+      svn_txdelta_window_handler_t handler;
+      void *handler_baton;
+      svn_stream_t *stream;
+      apr_size_t len;
+
+      SVN_ERR(encode_svndiff(&expected, source, target, version, 1,
+                             iterpool));
+      SVN_ERR(encode_svndiff(&actual, source, target, version, 4,
+                             iterpool));
+
+      /* The windows must be written in order and be identical. */
+      if (! svn_stringbuf_compare(expected, actual))
+        return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                 "concurrent svndiff%d encoding differs "
+                                 "from the single-threaded one", version);
+
+      result = svn_stringbuf_create_empty(iterpool);
+      svn_txdelta_apply(svn_stream_from_stringbuf(source, iterpool),
+                        svn_stream_from_stringbuf(result, iterpool),
+                        NULL, NULL, iterpool, &handler, &handler_baton);
+      stream = svn_txdelta_parse_svndiff(handler, handler_baton, TRUE,
+                                         iterpool);
+      len = actual->len;
+      SVN_ERR(svn_stream_write(stream, actual->data, &len));
+      SVN_ERR(svn_stream_close(stream));
+
+      if (! svn_stringbuf_compare(result, target))
+        return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                 "concurrent svndiff%d encoding does not "
+                                 "reproduce the target", version);
+
+      svn_pool_destroy(iterpool);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+
+/* Implements svn_test_driver_t. */
+static svn_error_t *
+concurrent_small_deltas_test(apr_pool_t *pool)
+{
+  /* No window at all, single windows and the smallest two-window delta. */
+  static const apr_size_t sizes[] = { 0, 1, 1000, SVN_DELTA_WINDOW_SIZE,
+                                      SVN_DELTA_WINDOW_SIZE + 1 };
+  enum { SMALL_FILE_SIZE = 1000, SMALL_FILE_COUNT = 500 };
+
+  apr_pool_t *iterpool = svn_pool_create(pool);
+  svn_stringbuf_t *source, *target, *expected, *actual;
+  apr_uint32_t seed = 1729;
+  apr_time_t start, single_threaded, concurrent;
+  apr_size_t i, k;
+
+  for (k = 0; k < sizeof(sizes) / sizeof(sizes[0]); ++k)
+    {
+      svn_pool_clear(iterpool);
+      source = svn_stringbuf_create_empty(iterpool);
+      target = svn_stringbuf_create_empty(iterpool);
+      for (i = 0; i < sizes[k]; ++i)
+        {
+          svn_stringbuf_appendbyte(source,
+                                   (char)('a' + svn_test_rand(&seed) % 8));
+          svn_stringbuf_appendbyte(target,
+                                   (char)('a' + svn_test_rand(&seed) % 8));
+        }
+
+      SVN_ERR(encode_svndiff(&expected, source, target, 1, 1, iterpool));
+      SVN_ERR(encode_svndiff(&actual, source, target, 1,
+                             SVN_DELTA_MAX_THREADS, iterpool));
+
+      if (! svn_stringbuf_compare(expected, actual))
+        return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                 "concurrent encoding of a %" APR_SIZE_T_FMT
+                                 " byte delta differs from the "
+                                 "single-threaded one", sizes[k]);
+    }
+
+  /* Small files are a single window and must not pay for starting
+     threads.  Be generous, we only want to catch gross regressions. */
+  source = svn_stringbuf_create_empty(pool);
+  target = svn_stringbuf_create_empty(pool);
+  for (i = 0; i < SMALL_FILE_SIZE; ++i)
+    {
+      svn_stringbuf_appendbyte(source, (char)('a' + svn_test_rand(&seed) % 8));
+      svn_stringbuf_appendbyte(target, (char)('a' + svn_test_rand(&seed) % 8));
+    }
+
+  start = apr_time_now();
+  for (i = 0; i < SMALL_FILE_COUNT; ++i)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(encode_svndiff(&expected, source, target, 1, 1, iterpool));
+    }
+  single_threaded = apr_time_now() - start;
+
+  start = apr_time_now();
+  for (i = 0; i < SMALL_FILE_COUNT; ++i)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(encode_svndiff(&actual, source, target, 1,
+                             SVN_DELTA_MAX_THREADS, iterpool));
+    }
+  concurrent = apr_time_now() - start;
+
+  if (concurrent > 2 * single_threaded + APR_USEC_PER_SEC / 20)
+    return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                             "encoding %d small deltas took %" APR_TIME_T_FMT
+                             " usec with %d threads but only %"
+                             APR_TIME_T_FMT " usec with one",
+                             SMALL_FILE_COUNT, concurrent,
+                             SVN_DELTA_MAX_THREADS, single_threaded);
+
+  svn_pool_destroy(iterpool);
+  return SVN_NO_ERROR;
+}
+
+
+/* Implements svn_test_driver_t. */
+static svn_error_t *
+svndiff_chunking_test(apr_pool_t *pool)
+{
+  enum { DATA_SIZE = 300 * 1024 };
+  static const apr_size_t chunk_sizes[] = { 1, 7, 4096, 100000, DATA_SIZE };
+
+  svn_stringbuf_t *source = svn_stringbuf_create_ensure(DATA_SIZE, pool);
+  svn_stringbuf_t *target = svn_stringbuf_create_ensure(DATA_SIZE, pool);
+  apr_uint32_t seed = 4711;
+  apr_size_t i, k;
+  int version;
+
+  for (i = 0; i < DATA_SIZE; ++i)
+    svn_stringbuf_appendbyte(source, (char)('a' + svn_test_rand(&seed) % 8));
+  for (i = 0; i < DATA_SIZE; ++i)
+    svn_stringbuf_appendbyte(target, svn_test_rand(&seed) % 16
+                                     ? source->data[i]
+                                     : (char)svn_test_rand(&seed));
+
+  for (version = 0; version <= 2; ++version)
+    {
+      apr_pool_t *iterpool = svn_pool_create(pool);
+      svn_stringbuf_t *svndiff;
+
+      SVN_ERR(encode_svndiff(&svndiff, source, target, version, 1,
+                             iterpool));
+
+      /* Windows may arrive in one piece or spread over many writes. */
+      for (k = 0; k < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]); ++k)
+        {
+          svn_stringbuf_t *result = svn_stringbuf_create_empty(iterpool);
+          svn_txdelta_window_handler_t handler;
+          void *handler_baton;
+          svn_stream_t *stream;
+
+          svn_txdelta_apply(svn_stream_from_stringbuf(source, iterpool),
+                            svn_stream_from_stringbuf(result, iterpool),
+                            NULL, NULL, iterpool, &handler, &handler_baton);
+          stream = svn_txdelta_parse_svndiff(handler, handler_baton, TRUE,
+                                             iterpool);
+          for (i = 0; i < svndiff->len; i += chunk_sizes[k])
+            {
+              apr_size_t len = MIN(chunk_sizes[k], svndiff->len - i);
+              SVN_ERR(svn_stream_write(stream, svndiff->data + i, &len));
+            }
+          SVN_ERR(svn_stream_close(stream));
+
+          if (! svn_stringbuf_compare(result, target))
+            return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                     "svndiff%d parsed in chunks of %"
+                                     APR_SIZE_T_FMT " bytes does not "
+                                     "reproduce the target",
+                                     version, chunk_sizes[k]);
+        }
+
+      svn_pool_destroy(iterpool);
+    }
+
+  return SVN_NO_ERROR;
+}
+
+
 /* Change to 1 to enable the unit test for the delta combiner's range index: */
 #if 0
 #include "range-index-test.h"
@@ -515,8 +965,20 @@ struct svn_test_descriptor_t test_funcs[] =
     SVN_TEST_NULL,
     SVN_TEST_PASS2(random_test,
                    "random delta test"),
+    SVN_TEST_PASS2(random_versions_test,
+                   "random delta test with all svndiff versions"),
     SVN_TEST_PASS2(random_combine_test,
                    "random combine delta test"),
+    SVN_TEST_PASS2(xdelta_kernels_test,
+                   "compare xdelta kernels"),
+    SVN_TEST_PASS2(large_window_test,
+                   "delta with windows larger than the default"),
+    SVN_TEST_PASS2(concurrent_encoder_test,
+                   "compress svndiff windows on multiple threads"),
+    SVN_TEST_PASS2(concurrent_small_deltas_test,
+                   "concurrent svndiff encoder with small deltas"),
+    SVN_TEST_PASS2(svndiff_chunking_test,
+                   "parse svndiff data written in arbitrary chunks"),
 #ifdef SVN_RANGE_INDEX_TEST_H
     SVN_TEST_PASS2(random_range_index_test,
                    "random range index test"),
@@ -0,0 +1,230 @@
+/* xdelta-bench.c -- measure the throughput of the xdelta kernels
+ *
+ * ====================================================================
+ *    Licensed to the Apache Software Foundation (ASF) under one
+ *    or more contributor license agreements.  See the NOTICE file
+ *    distributed with this work for additional information
+ *    regarding copyright ownership.  The ASF licenses this file
+ *    to you under the Apache License, Version 2.0 (the
+ *    "License"); you may not use this file except in compliance
+ *    with the License.  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing,
+ *    software distributed under the License is distributed on an
+ *    "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *    KIND, either express or implied.  See the License for the
+ *    specific language governing permissions and limitations
+ *    under the License.
+ * ====================================================================
+ */
+
+#define APR_WANT_STDIO
+#include <apr_want.h>
+
+#include <apr_general.h>
+#include <apr_time.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "svn_delta.h"
+#include "svn_error.h"
+#include "svn_io.h"
+#include "svn_pools.h"
+#include "svn_sorts.h"
+
+#include "../../libsvn_delta/delta.h"
+
+/* Number of times each input gets deltified per kernel. */
+#define DEFAULT_ITERATIONS 20
+
+/* Size of the generated source and target data. */
+#define GENERATED_SIZE (4 * 1024 * 1024)
+
+struct kernel_t
+{
+  svn_txdelta__xdelta_kernel_t kernel;
+  const char *name;
+};
+
+static const struct kernel_t kernels[] =
+  {
+    { svn_txdelta__xdelta_kernel_scalar, "scalar" },
+    { svn_txdelta__xdelta_kernel_sse2,   "sse2"   },
+    { svn_txdelta__xdelta_kernel_avx2,   "avx2"   }
+  };
+
+/* A simple, portable pseudo-random number generator. */
+static apr_uint32_t
+next_random(apr_uint32_t *seed)
+{
+  *seed = *seed * 1103515245 + 12345;
+  return *seed >> 8;
+}
+
+/* Fill *SOURCE and *TARGET with similar data of about GENERATED_SIZE
+   bytes each, resembling successive versions of a frequently edited
+   binary file.  Allocate them in POOL. */
+static void
+generate_data(svn_stringbuf_t **source,
+              svn_stringbuf_t **target,
+              apr_pool_t *pool)
+{
+  apr_uint32_t seed = 42;
+  apr_size_t i;
+
+  *source = svn_stringbuf_create_ensure(GENERATED_SIZE, pool);
+  *target = svn_stringbuf_create_ensure(GENERATED_SIZE, pool);
+
+  /* Low-entropy data with plenty of repetitions. */
+  for (i = 0; i < GENERATED_SIZE; ++i)
+    svn_stringbuf_appendbyte(*source,
+                             (char)("abcdefgh\n\0\1\2"[next_random(&seed)
+                                                       % 12]));
+
+  /* Copy it with small insertions, deletions and modifications. */
+  for (i = 0; i < (*source)->len; )
+    {
+      apr_size_t len = 100 + next_random(&seed) % 4000;
+
+      if (len > (*source)->len - i)
+        len = (*source)->len - i;
+
+      svn_stringbuf_appendbytes(*target, (*source)->data + i, len);
+      i += len;
+
+      switch (next_random(&seed) % 3)
+        {
+          case 0:
+            svn_stringbuf_appendcstr(*target, "inserted text");
+            break;
+          case 1:
+            i += next_random(&seed) % 50;
+            break;
+          default:
+            if ((*target)->len)
+              (*target)->data[(*target)->len - 1] ^= 0x5a;
+            break;
+        }
+    }
+}
+
+/* Deltify TARGET against SOURCE window by window, ITERATIONS times,
+   using POOL for temporary allocations.  Return the time it took. */
+static apr_interval_time_t
+run_xdelta(const svn_stringbuf_t *source,
+           const svn_stringbuf_t *target,
+           int iterations,
+           apr_pool_t *pool)
+{
+  apr_pool_t *iterpool = svn_pool_create(pool);
+  char *window = apr_palloc(pool, 2 * SVN_DELTA_WINDOW_SIZE);
+  apr_time_t start = apr_time_now();
+  int i;
+
+  for (i = 0; i < iterations; ++i)
+    {
+      apr_size_t offset;
+
+      for (offset = 0; offset < target->len; offset += SVN_DELTA_WINDOW_SIZE)
+        {
+          svn_txdelta__ops_baton_t build_baton = { 0 };
+          apr_size_t source_len = 0;
+          apr_size_t target_len = target->len - offset;
+
+          svn_pool_clear(iterpool);
+          build_baton.new_data = svn_stringbuf_create_empty(iterpool);
+
+          if (offset < source->len)
+            source_len = MIN(source->len - offset, SVN_DELTA_WINDOW_SIZE);
+          target_len = MIN(target_len, SVN_DELTA_WINDOW_SIZE);
+
+          /* The engine expects source and target to be contiguous. */
+          if (source_len)
+            memcpy(window, source->data + offset, source_len);
+          memcpy(window + source_len, target->data + offset, target_len);
+
+          if (source_len)
+            svn_txdelta__xdelta(&build_baton, window, source_len, target_len,
+                                iterpool);
+        }
+    }
+
+  svn_pool_destroy(iterpool);
+  return apr_time_now() - start;
+}
+
+int
+main(int argc, char **argv)
+{
+  svn_stringbuf_t *source, *target;
+  apr_interval_time_t scalar_time = 0;
+  int iterations = DEFAULT_ITERATIONS;
+  apr_pool_t *pool;
+  apr_size_t i;
+
+  if (argc > 2 && strcmp(argv[1], "-n") == 0)
+    {
+      iterations = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    }
+
+  if ((argc != 1 && argc != 3) || iterations < 1)
+    {
+      fprintf(stderr,
+              "Usage: xdelta-bench [-n <iterations>]\n"
+              "   or: xdelta-bench [-n <iterations>] <source> <target>\n");
+      exit(1);
+    }
+
+  apr_initialize();
+  pool = svn_pool_create(NULL);
+
+  if (argc == 3)
+    {
+      svn_error_t *err = svn_stringbuf_from_file2(&source, argv[1], pool);
+      if (!err)
+        err = svn_stringbuf_from_file2(&target, argv[2], pool);
+      if (err)
+        svn_handle_error2(err, stderr, TRUE, "xdelta-bench: ");
+    }
+  else
+    generate_data(&source, &target, pool);
+
+  printf("source: %" APR_SIZE_T_FMT " bytes, target: %" APR_SIZE_T_FMT
+         " bytes, %d iterations\n", source->len, target->len, iterations);
+
+  for (i = 0; i < sizeof(kernels) / sizeof(kernels[0]); ++i)
+    {
+      apr_interval_time_t duration;
+      double seconds, throughput;
+
+      if (! svn_txdelta__xdelta_use_kernel(kernels[i].kernel))
+        {
+          printf("%-8s not supported\n", kernels[i].name);
+          continue;
+        }
+
+      /* Warm up caches before measuring. */
+      run_xdelta(source, target, 1, pool);
+      duration = run_xdelta(source, target, iterations, pool);
+
+      if (kernels[i].kernel == svn_txdelta__xdelta_kernel_scalar)
+        scalar_time = duration;
+
+      seconds = (double)duration / APR_USEC_PER_SEC;
+      throughput = seconds > 0
+                 ? (double)target->len * iterations / seconds / (1024 * 1024)
+                 : 0.0;
+      printf("%-8s %8.3f s %10.1f MB/s %8.2fx\n",
+             kernels[i].name, seconds, throughput,
+             duration > 0 ? (double)scalar_time / duration : 0.0);
+    }
+
+  svn_txdelta__xdelta_use_kernel(svn_txdelta__xdelta_kernel_auto);
+  svn_pool_destroy(pool);
+  apr_terminate();
+  return 0;
+}
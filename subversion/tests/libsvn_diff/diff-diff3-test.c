@@ -28,6 +28,9 @@
 #include "svn_pools.h"
 #include "svn_utf.h"
 
+#include "private/svn_adler32.h"
+#include "../../libsvn_diff/diff.h"
+
 /* Used to terminate lines in large multi-line string literals. */
 #define NL APR_EOL_STR
 
@@ -2429,6 +2432,428 @@ test_wrap(apr_pool_t *pool)
   return SVN_NO_ERROR;
 }
 
+/* Test that svn_diff_algorithm_histogram lines up changes on rare lines,
+   and that merges based on it still come out right. */
+static svn_error_t *
+test_histogram(apr_pool_t *pool)
+{
+  svn_diff_file_options_t *diff_opts = svn_diff_file_options_create(pool);
+  apr_pool_t *subpool = svn_pool_create(pool);
+  int i;
+
+  diff_opts->algorithm = svn_diff_algorithm_histogram;
+
+  /* A minimal diff would keep the braces and move "Aa"; the histogram
+     diff keeps the unique line instead. */
+  SVN_ERR(two_way_diff("foo9", "bar9",
+                       "}\n"
+                       "}\n"
+                       "Aa\n",
+
+                       "Aa\n"
+                       "}\n"
+                       "}\n",
+
+                       "--- foo9"         NL
+                       "+++ bar9"         NL
+                       "@@ -1,3 +1,3 @@"  NL
+                       "-}\n"
+                       "-}\n"
+                       " Aa\n"
+                       "+}\n"
+                       "+}\n",
+                       diff_opts, pool));
+
+  SVN_ERR(three_way_merge("hist1", "hist2", "hist3",
+                          "Aa\n"
+                          "}\n"
+                          "Bb\n"
+                          "}\n"
+                          "Cc\n",
+
+                          "Aa\n"
+                          "}\n"
+                          "Bb\n"
+                          "Dd\n"
+                          "}\n"
+                          "Cc\n",
+
+                          "Xx\n"
+                          "Aa\n"
+                          "}\n"
+                          "Bb\n"
+                          "}\n"
+                          "Cc\n",
+
+                          "Xx\n"
+                          "Aa\n"
+                          "}\n"
+                          "Bb\n"
+                          "Dd\n"
+                          "}\n"
+                          "Cc\n",
+                          diff_opts,
+                          svn_diff_conflict_display_modified_latest,
+                          pool));
+
+  seed_val();
+
+  /* Random non-conflicting changes, as in random_three_way_merge(). */
+  for (i = 0; i < 5; ++i)
+    {
+      const char *filename1 = "hist-original";
+      const char *filename2 = "hist-modified1";
+      const char *filename3 = "hist-modified2";
+      const char *filename4 = "hist-combined";
+      svn_stringbuf_t *original, *modified1, *modified2, *combined;
+      int num_lines = 1000, num_src = 10, num_dst = 10;
+      svn_boolean_t *lines = apr_pcalloc(subpool, sizeof(*lines) * num_lines);
+      struct random_mod *src_lines = apr_palloc(subpool,
+                                                sizeof(*src_lines) * num_src);
+      struct random_mod *dst_lines = apr_palloc(subpool,
+                                                sizeof(*dst_lines) * num_dst);
+      struct random_mod *mrg_lines = apr_palloc(subpool,
+                                                (sizeof(*mrg_lines)
+                                                 * (num_src + num_dst)));
+
+      select_lines(src_lines, num_src, lines, num_lines);
+      select_lines(dst_lines, num_dst, lines, num_lines);
+      memcpy(mrg_lines, src_lines, sizeof(*mrg_lines) * num_src);
+      memcpy(mrg_lines + num_src, dst_lines, sizeof(*mrg_lines) * num_dst);
+
+      SVN_ERR(make_random_merge_file(filename1, num_lines, NULL, 0, subpool));
+      SVN_ERR(make_random_merge_file(filename2, num_lines, src_lines, num_src,
+                                     subpool));
+      SVN_ERR(make_random_merge_file(filename3, num_lines, dst_lines, num_dst,
+                                     subpool));
+      SVN_ERR(make_random_merge_file(filename4, num_lines, mrg_lines,
+                                     num_src + num_dst, subpool));
+
+      SVN_ERR(svn_stringbuf_from_file(&original, filename1, subpool));
+      SVN_ERR(svn_stringbuf_from_file(&modified1, filename2, subpool));
+      SVN_ERR(svn_stringbuf_from_file(&modified2, filename3, subpool));
+      SVN_ERR(svn_stringbuf_from_file(&combined, filename4, subpool));
+
+      SVN_ERR(three_way_merge(filename1, filename2, filename3,
+                              original->data, modified1->data,
+                              modified2->data, combined->data, diff_opts,
+                              svn_diff_conflict_display_modified_latest,
+                              subpool));
+
+      SVN_ERR(svn_io_remove_file(filename4, subpool));
+
+      svn_pool_clear(subpool);
+    }
+  svn_pool_destroy(subpool);
+
+  return SVN_NO_ERROR;
+}
+
+/* Write a unified diff of the files ORIGINAL and MODIFIED, made with
+   OPTIONS, to *OUTPUT. */
+static svn_error_t *
+unified_file_diff(svn_stringbuf_t **output,
+                  const char *original,
+                  const char *modified,
+                  const svn_diff_file_options_t *options,
+                  apr_pool_t *pool)
+{
+  svn_diff_t *diff;
+  svn_stream_t *ostream;
+
+  SVN_ERR(svn_diff_file_diff_2(&diff, original, modified, options, pool));
+
+  *output = svn_stringbuf_create_empty(pool);
+  ostream = svn_stream_from_stringbuf(*output, pool);
+  SVN_ERR(svn_diff_file_output_unified3(ostream, diff, original, modified,
+                                        original, modified,
+                                        SVN_APR_LOCALE_CHARSET, NULL, FALSE,
+                                        pool));
+  return svn_stream_close(ostream);
+}
+
+/* Test that diffing files through a small window gives the same result
+   as reading them whole, at least if all lines are distinct. */
+static svn_error_t *
+test_windowed_diff(apr_pool_t *pool)
+{
+  svn_diff_file_options_t *diff_opts = svn_diff_file_options_create(pool);
+  svn_diff_file_options_t *windowed_opts = svn_diff_file_options_create(pool);
+  apr_pool_t *subpool = svn_pool_create(pool);
+  const char *filename1 = "windowed-original";
+  const char *filename2 = "windowed-modified";
+  int i;
+
+  /* Any limit below the minimum window size will do. */
+  windowed_opts->memory_limit = 1;
+
+  seed_val();
+
+  for (i = 0; i < 5; ++i)
+    {
+      svn_stringbuf_t *expected, *actual;
+      svn_diff_t *diff;
+      int num_lines = 5000, num_mods = i * 20;
+      svn_boolean_t *lines = apr_pcalloc(subpool, sizeof(*lines) * num_lines);
+      struct random_mod *mod_lines = apr_palloc(subpool,
+                                                sizeof(*mod_lines)
+                                                * (num_mods + 1));
+
+      select_lines(mod_lines, num_mods, lines, num_lines);
+
+      SVN_ERR(make_random_merge_file(filename1, num_lines, NULL, 0, subpool));
+      SVN_ERR(make_random_merge_file(filename2, num_lines, mod_lines,
+                                     num_mods, subpool));
+
+      SVN_ERR(unified_file_diff(&expected, filename1, filename2, diff_opts,
+                                subpool));
+      SVN_ERR(unified_file_diff(&actual, filename1, filename2, windowed_opts,
+                                subpool));
+      if (strcmp(actual->data, expected->data) != 0)
+        return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                 "Windowed diff differs from full diff."
+                                 "\nEXPECTED:\n%s\nACTUAL:\n%s\n",
+                                 expected->data, actual->data);
+
+      SVN_ERR(svn_diff_file_diff_2(&diff, filename1, filename1,
+                                   windowed_opts, subpool));
+      SVN_TEST_ASSERT(! svn_diff_contains_diffs(diff));
+
+      svn_pool_clear(subpool);
+    }
+
+  SVN_ERR(svn_io_remove_file(filename1, pool));
+  SVN_ERR(svn_io_remove_file(filename2, pool));
+  svn_pool_destroy(subpool);
+
+  return SVN_NO_ERROR;
+}
+
+/* Test that the --memory-limit diff option sets the window size. */
+static svn_error_t *
+test_parse_memory_limit(apr_pool_t *pool)
+{
+  svn_diff_file_options_t *diff_opts = svn_diff_file_options_create(pool);
+
+  SVN_ERR(svn_diff_file_options_parse(diff_opts,
+                                      svn_cstring_split("-u --memory-limit 64",
+                                                        " ", TRUE, pool),
+                                      pool));
+  SVN_TEST_ASSERT(diff_opts->memory_limit == 64 * 1024 * 1024);
+
+  SVN_ERR(svn_diff_file_options_parse(diff_opts,
+                                      svn_cstring_split("--memory-limit=2",
+                                                        " ", TRUE, pool),
+                                      pool));
+  SVN_TEST_ASSERT(diff_opts->memory_limit == 2 * 1024 * 1024);
+
+  SVN_TEST_ASSERT_ERROR(svn_diff_file_options_parse
+                          (diff_opts,
+                           svn_cstring_split("--memory-limit 0",
+                                             " ", TRUE, pool),
+                           pool),
+                        SVN_ERR_INVALID_DIFF_OPTION);
+  SVN_TEST_ASSERT_ERROR(svn_diff_file_options_parse
+                          (diff_opts,
+                           svn_cstring_split("--memory-limit lots",
+                                             " ", TRUE, pool),
+                           pool),
+                        SVN_ERR_INVALID_DIFF_OPTION);
+  SVN_TEST_ASSERT_ERROR(svn_diff_file_options_parse
+                          (diff_opts,
+                           svn_cstring_split("--memory-limit",
+                                             " ", TRUE, pool),
+                           pool),
+                        SVN_ERR_INVALID_DIFF_OPTION);
+
+  return SVN_NO_ERROR;
+}
+
+/* Append NUM_LINES lines of random length and contents to BUF.  Each line
+   ends in a randomly chosen eol style. */
+static void
+append_mixed_eol_lines(svn_stringbuf_t *buf, int num_lines)
+{
+  static const char *const eols[] = { "\n", "\r\n", "\r" };
+  int i, j;
+
+  for (i = 0; i < num_lines; ++i)
+    {
+      int len = range_rand(0, 60);
+
+      for (j = 0; j < len; ++j)
+        svn_stringbuf_appendbyte(buf, (char)('a' + range_rand(0, 25)));
+      svn_stringbuf_appendcstr(buf, eols[range_rand(0, 2)]);
+    }
+}
+
+/* Write to *OUTPUT a unified diff of FILENAMES[0] and FILENAMES[1],
+   followed by the 3-way merge of FILENAMES[0..2] and the 4-way merge of
+   FILENAMES[0..3], all made with OPTIONS. */
+static svn_error_t *
+diff_and_merge_files(svn_stringbuf_t **output,
+                     const char *const *filenames,
+                     const svn_diff_file_options_t *options,
+                     apr_pool_t *pool)
+{
+  svn_diff_t *diff;
+  svn_stream_t *ostream;
+
+  *output = svn_stringbuf_create_empty(pool);
+  ostream = svn_stream_from_stringbuf(*output, pool);
+
+  SVN_ERR(svn_diff_file_diff_2(&diff, filenames[0], filenames[1],
+                               options, pool));
+  SVN_ERR(svn_diff_file_output_unified3(ostream, diff,
+                                        filenames[0], filenames[1],
+                                        filenames[0], filenames[1],
+                                        SVN_APR_LOCALE_CHARSET, NULL, FALSE,
+                                        pool));
+
+  SVN_ERR(svn_diff_file_diff3_2(&diff, filenames[0], filenames[1],
+                                filenames[2], options, pool));
+  SVN_ERR(svn_diff_file_output_merge2
+          (ostream, diff, filenames[0], filenames[1], filenames[2],
+           NULL, NULL, NULL, NULL,
+           svn_diff_conflict_display_modified_latest, pool));
+
+  SVN_ERR(svn_diff_file_diff4_2(&diff, filenames[0], filenames[1],
+                                filenames[2], filenames[3], options, pool));
+  SVN_ERR(svn_diff_file_output_merge2
+          (ostream, diff, filenames[0], filenames[1], filenames[2],
+           NULL, NULL, NULL, NULL,
+           svn_diff_conflict_display_modified_latest, pool));
+
+  return svn_stream_close(ostream);
+}
+
+/* Test that all prefix / suffix scanners find the same identical prefix
+   and suffix, counting the lines in them the same way. */
+static svn_error_t *
+test_scan_kernels(apr_pool_t *pool)
+{
+  static const svn_diff__scan_kernel_t kernels[] =
+    {
+      svn_diff__scan_kernel_sse2,
+      svn_diff__scan_kernel_avx2
+    };
+  static const char *const filenames[] =
+    {
+      "scan-original", "scan-modified", "scan-latest", "scan-ancestor"
+    };
+
+  svn_diff_file_options_t *options = svn_diff_file_options_create(pool);
+  apr_pool_t *subpool = svn_pool_create(pool);
+  svn_error_t *err = SVN_NO_ERROR;
+  apr_size_t k;
+  int i, j;
+
+  seed_val();
+
+  for (i = 0; i < 10 && !err; ++i)
+    {
+      svn_stringbuf_t *prefix = svn_stringbuf_create_empty(subpool);
+      svn_stringbuf_t *suffix = svn_stringbuf_create_empty(subpool);
+      svn_stringbuf_t *expected, *actual;
+
+      /* Up to about 200kB of common lines, so that the scans cross
+         chunk boundaries, around a few lines that differ. */
+      append_mixed_eol_lines(prefix, range_rand(0, 3500));
+      append_mixed_eol_lines(suffix, range_rand(0, 3500));
+
+      for (j = 0; j < 4 && !err; ++j)
+        {
+          svn_stringbuf_t *contents = svn_stringbuf_dup(prefix, subpool);
+
+          append_mixed_eol_lines(contents, range_rand(0, 3));
+          svn_stringbuf_appendstr(contents, suffix);
+          err = svn_io_file_create(filenames[j], contents->data, subpool);
+        }
+
+      /* All kernels must produce exactly what the portable code does. */
+      svn_diff__file_use_scan_kernel(svn_diff__scan_kernel_scalar);
+      if (!err)
+        err = diff_and_merge_files(&expected, filenames, options, subpool);
+
+      for (k = 0; k < sizeof(kernels) / sizeof(kernels[0]) && !err; k++)
+        {
+          if (! svn_diff__file_use_scan_kernel(kernels[k]))
+            continue;
+
+          err = diff_and_merge_files(&actual, filenames, options, subpool);
+          if (!err && ! svn_stringbuf_compare(expected, actual))
+            err = svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                    "Scan kernel %d differs from the "
+                                    "scalar one.\nEXPECTED:\n%s\n"
+                                    "ACTUAL:\n%s\n",
+                                    (int)kernels[k], expected->data,
+                                    actual->data);
+        }
+
+      svn_pool_clear(subpool);
+    }
+
+  svn_diff__file_use_scan_kernel(svn_diff__scan_kernel_auto);
+  for (j = 0; j < 4; ++j)
+    svn_error_clear(svn_io_remove_file2(filenames[j], TRUE, pool));
+  svn_pool_destroy(subpool);
+
+  return err;
+}
+
+/* Test that lines with equal hashes are told apart by their contents,
+   also when the token table has to grow.  Every line of the modified
+   file that differs from the original has the same Adler-32 hash as
+   the line it replaces. */
+static svn_error_t *
+test_token_hash_collisions(apr_pool_t *pool)
+{
+  svn_stringbuf_t *original = svn_stringbuf_create_empty(pool);
+  svn_stringbuf_t *modified = svn_stringbuf_create_empty(pool);
+  svn_stringbuf_t *expected = svn_stringbuf_create("--- hash1" NL
+                                                   "+++ hash2" NL, pool);
+  int num_lines = 3000;
+  int i, j;
+
+  /* Raising one byte by 1, the next one by -2 and the third by 1 keeps
+     both of Adler-32's sums unchanged. */
+  SVN_TEST_ASSERT(svn__adler32(0, "00000 aca\n", 10)
+                  == svn__adler32(0, "00000 bab\n", 10));
+
+  /* Far more distinct lines than fit into the initial table. */
+  for (i = 0; i < num_lines; ++i)
+    {
+      svn_stringbuf_appendcstr(original, apr_psprintf(pool, "%05d aca\n", i));
+      svn_stringbuf_appendcstr(modified,
+                               apr_psprintf(pool, i % 100 == 50
+                                                  ? "%05d bab\n"
+                                                  : "%05d aca\n", i));
+    }
+
+  /* One hunk with three lines of context around every change. */
+  for (i = 50; i < num_lines; i += 100)
+    {
+      svn_stringbuf_appendcstr(expected,
+                               apr_psprintf(pool, "@@ -%d,7 +%d,7 @@" NL,
+                                            i - 2, i - 2));
+      for (j = i - 3; j < i; ++j)
+        svn_stringbuf_appendcstr(expected,
+                                 apr_psprintf(pool, " %05d aca\n", j));
+      svn_stringbuf_appendcstr(expected,
+                               apr_psprintf(pool, "-%05d aca\n"
+                                                  "+%05d bab\n", i, i));
+      for (j = i + 1; j <= i + 3; ++j)
+        svn_stringbuf_appendcstr(expected,
+                                 apr_psprintf(pool, " %05d aca\n", j));
+    }
+
+  SVN_ERR(two_way_diff("hash1", "hash2",
+                       original->data, modified->data, expected->data,
+                       NULL, pool));
+
+  return SVN_NO_ERROR;
+}
+
 /* ========================================================================== */
 
 struct svn_test_descriptor_t test_funcs[] =
@@ -2460,5 +2885,15 @@ struct svn_test_descriptor_t test_funcs[] =
                    "4-way merge; see variance-adjusted-patching.html"),
     SVN_TEST_XFAIL2(test_wrap,
                    "difference at the start of a 128KB window"),
+    SVN_TEST_PASS2(test_histogram,
+                   "histogram diff and merge"),
+    SVN_TEST_PASS2(test_windowed_diff,
+                   "2-way diff through a bounded window"),
+    SVN_TEST_PASS2(test_parse_memory_limit,
+                   "parse the --memory-limit diff option"),
+    SVN_TEST_PASS2(test_scan_kernels,
+                   "identical prefix / suffix scanners"),
+    SVN_TEST_PASS2(test_token_hash_collisions,
+                   "diff lines with colliding hashes"),
     SVN_TEST_NULL
   };
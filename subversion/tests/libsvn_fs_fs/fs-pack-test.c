@@ -26,6 +26,7 @@
 
 #include "../svn_test.h"
 #include "../../libsvn_fs_fs/fs.h"
+#include "../../libsvn_fs_fs/fs_fs.h"
 
 #include "svn_pools.h"
 #include "svn_props.h"
@@ -99,6 +100,7 @@ struct pack_notify_baton
 {
   apr_int64_t expected_shard;
   svn_fs_pack_notify_action_t expected_action;
+  svn_boolean_t revprops_packed;
 };
 
 static svn_error_t *
@@ -116,6 +118,16 @@ pack_notify(void *baton,
   switch (action)
     {
       case svn_fs_pack_notify_start:
+        pnb->expected_action = pnb->revprops_packed
+                             ? svn_fs_pack_notify_start_revprop
+                             : svn_fs_pack_notify_end;
+        break;
+
+      case svn_fs_pack_notify_start_revprop:
+        pnb->expected_action = svn_fs_pack_notify_end_revprop;
+        break;
+
+      case svn_fs_pack_notify_end_revprop:
         pnb->expected_action = svn_fs_pack_notify_end;
         break;
 
@@ -132,17 +144,34 @@ pack_notify(void *baton,
   return SVN_NO_ERROR;
 }
 
-/* Create a packed filesystem in DIR.  Set the shard size to
-   SHARD_SIZE and create NUM_REVS number of revisions (in addition to
-   r0).  Use POOL for allocations.  After this function successfully
-   completes, the filesystem's youngest revision number will be the
-   same as NUM_REVS.  */
+/* Replace the fsfs.conf of the filesystem in DIR with one consisting of
+   just the option NAME = VALUE in SECTION.  Use POOL for allocations. */
 static svn_error_t *
-create_packed_filesystem(const char *dir,
-                         const svn_test_opts_t *opts,
-                         int num_revs,
-                         int shard_size,
-                         apr_pool_t *pool)
+write_fsfs_conf(const char *dir,
+                const char *section,
+                const char *name,
+                const char *value,
+                apr_pool_t *pool)
+{
+  const char *path = svn_dirent_join(dir, PATH_CONFIG, pool);
+
+  SVN_ERR(svn_io_remove_file2(path, TRUE, pool));
+  return svn_io_file_create(path,
+                            apr_psprintf(pool, "[%s]\n%s = %s\n",
+                                         section, name, value),
+                            pool);
+}
+
+/* Create a filesystem in DIR.  Set the shard size to SHARD_SIZE and
+   create NUM_REVS number of revisions (in addition to r0).  Use POOL
+   for allocations.  After this function successfully completes, the
+   filesystem's youngest revision number will be the same as NUM_REVS.  */
+static svn_error_t *
+create_non_packed_filesystem(const char *dir,
+                             const svn_test_opts_t *opts,
+                             int num_revs,
+                             int shard_size,
+                             apr_pool_t *pool)
 {
   svn_fs_t *fs;
   svn_fs_txn_t *txn;
@@ -150,7 +179,6 @@ create_packed_filesystem(const char *dir,
   const char *conflict;
   svn_revnum_t after_rev;
   apr_pool_t *subpool = svn_pool_create(pool);
-  struct pack_notify_baton pnb;
   apr_pool_t *iterpool;
   int version;
 
@@ -193,12 +221,45 @@ create_packed_filesystem(const char *dir,
   svn_pool_destroy(iterpool);
   svn_pool_destroy(subpool);
 
-  /* Now pack the FS */
+  return SVN_NO_ERROR;
+}
+
+/* Pack the filesystem in DIR, verifying the notifications sent while
+   doing so.  Use POOL for allocations. */
+static svn_error_t *
+pack_non_packed_filesystem(const char *dir,
+                           apr_pool_t *pool)
+{
+  struct pack_notify_baton pnb;
+  int version;
+
+  SVN_ERR(svn_io_read_version_file(&version,
+                                   svn_dirent_join(dir, "format", pool),
+                                   pool));
+
   pnb.expected_shard = 0;
   pnb.expected_action = svn_fs_pack_notify_start;
+  pnb.revprops_packed = version >= SVN_FS_FS__MIN_PACKED_REVPROP_FORMAT;
   return svn_fs_pack(dir, pack_notify, &pnb, NULL, NULL, pool);
 }
 
+/* Create a packed filesystem in DIR.  Set the shard size to
+   SHARD_SIZE and create NUM_REVS number of revisions (in addition to
+   r0).  Use POOL for allocations.  After this function successfully
+   completes, the filesystem's youngest revision number will be the
+   same as NUM_REVS.  */
+static svn_error_t *
+create_packed_filesystem(const char *dir,
+                         const svn_test_opts_t *opts,
+                         int num_revs,
+                         int shard_size,
+                         apr_pool_t *pool)
+{
+  SVN_ERR(create_non_packed_filesystem(dir, opts, num_revs, shard_size,
+                                       pool));
+  return pack_non_packed_filesystem(dir, pool);
+}
+
 
 /*** Tests ***/
 
@@ -453,6 +514,147 @@ get_set_revprop_packed_fs(const svn_test_opts_t *opts,
 #undef MAX_REV
 #undef SHARD_SIZE
 
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-get-set-packed-revprops"
+#define SHARD_SIZE 4
+#define MAX_REV 10
+static svn_error_t *
+get_set_packed_revprops(const svn_test_opts_t *opts,
+                        apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_string_t *prop_value;
+  svn_node_kind_t kind;
+  const char *path;
+  svn_revnum_t rev;
+  apr_pool_t *subpool;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  SVN_ERR(create_packed_filesystem(REPO_NAME, opts, MAX_REV, SHARD_SIZE,
+                                   pool));
+
+  /* The revprops of packed shards should live in revprop pack folders,
+     except for those of r0. */
+  path = svn_dirent_join_many(pool, REPO_NAME, PATH_REVPROPS_DIR, "1.pack",
+                              PATH_MANIFEST, NULL);
+  SVN_ERR(svn_io_check_path(path, &kind, pool));
+  if (kind != svn_node_file)
+    return svn_error_createf(SVN_ERR_FS_GENERAL, NULL,
+                             "Expected manifest file '%s' not found", path);
+
+  path = svn_dirent_join_many(pool, REPO_NAME, PATH_REVPROPS_DIR, "1", NULL);
+  SVN_ERR(svn_io_check_path(path, &kind, pool));
+  if (kind != svn_node_none)
+    return svn_error_createf(SVN_ERR_FS_GENERAL, NULL,
+                             "Unexpected directory '%s' found", path);
+
+  path = svn_dirent_join_many(pool, REPO_NAME, PATH_REVPROPS_DIR, "0", "0",
+                              NULL);
+  SVN_ERR(svn_io_check_path(path, &kind, pool));
+  if (kind != svn_node_file)
+    return svn_error_createf(SVN_ERR_FS_GENERAL, NULL,
+                             "Expected revprop file '%s' not found", path);
+
+  /* Read and modify the revprops of packed and non-packed revisions. */
+  subpool = svn_pool_create(pool);
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, subpool));
+  for (rev = 0; rev <= MAX_REV; rev++)
+    {
+      SVN_ERR(svn_fs_revision_prop(&prop_value, fs, rev,
+                                   SVN_PROP_REVISION_DATE, subpool));
+      SVN_TEST_ASSERT(rev == 0 || prop_value != NULL);
+      SVN_ERR(svn_fs_change_rev_prop(fs, rev, SVN_PROP_REVISION_AUTHOR,
+                                     svn_string_createf(subpool,
+                                                        "author-%ld", rev),
+                                     subpool));
+    }
+
+  /* Changes must be visible through the same FS object ... */
+  SVN_ERR(svn_fs_revision_prop(&prop_value, fs, 5, SVN_PROP_REVISION_AUTHOR,
+                               subpool));
+  SVN_TEST_STRING_ASSERT(prop_value->data, "author-5");
+  svn_pool_destroy(subpool);
+
+  /* ... as well as after re-opening the repository. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  for (rev = 0; rev <= MAX_REV; rev++)
+    {
+      SVN_ERR(svn_fs_revision_prop(&prop_value, fs, rev,
+                                   SVN_PROP_REVISION_AUTHOR, pool));
+      SVN_TEST_STRING_ASSERT(prop_value->data,
+                             apr_psprintf(pool, "author-%ld", rev));
+    }
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+#undef SHARD_SIZE
+
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-revprops-across-handles"
+#define SHARD_SIZE 4
+#define MAX_REV 10
+static svn_error_t *
+revprops_across_handles(const svn_test_opts_t *opts,
+                        apr_pool_t *pool)
+{
+  svn_fs_t *reader, *writer;
+  svn_string_t *prop_value;
+  svn_revnum_t revs[] = { 2, MAX_REV };
+  int i;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  SVN_ERR(create_packed_filesystem(REPO_NAME, opts, MAX_REV, SHARD_SIZE,
+                                   pool));
+  SVN_ERR(svn_fs_open(&reader, REPO_NAME, NULL, pool));
+  SVN_ERR(svn_fs_open(&writer, REPO_NAME, NULL, pool));
+
+  /* Test a packed as well as a non-packed revision. */
+  for (i = 0; i < sizeof(revs) / sizeof(revs[0]); i++)
+    {
+      /* Let READER cache the revprops ... */
+      SVN_ERR(svn_fs_revision_prop(&prop_value, reader, revs[i],
+                                   SVN_PROP_REVISION_AUTHOR, pool));
+      SVN_TEST_ASSERT(prop_value == NULL);
+
+      /* ... then change them through another handle, as another server
+         process would do.  READER must not return stale data. */
+      SVN_ERR(svn_fs_change_rev_prop(writer, revs[i],
+                                     SVN_PROP_REVISION_AUTHOR,
+                                     svn_string_create("writer", pool),
+                                     pool));
+      SVN_ERR(svn_fs_revision_prop(&prop_value, reader, revs[i],
+                                   SVN_PROP_REVISION_AUTHOR, pool));
+      SVN_TEST_ASSERT(prop_value != NULL);
+      SVN_TEST_STRING_ASSERT(prop_value->data, "writer");
+
+      /* Same the other way around. */
+      SVN_ERR(svn_fs_revision_prop(&prop_value, writer, revs[i],
+                                   SVN_PROP_REVISION_AUTHOR, pool));
+      SVN_ERR(svn_fs_change_rev_prop(reader, revs[i],
+                                     SVN_PROP_REVISION_AUTHOR,
+                                     svn_string_create("reader", pool),
+                                     pool));
+      SVN_ERR(svn_fs_revision_prop(&prop_value, writer, revs[i],
+                                   SVN_PROP_REVISION_AUTHOR, pool));
+      SVN_TEST_STRING_ASSERT(prop_value->data, "reader");
+    }
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+#undef SHARD_SIZE
+
 /* ------------------------------------------------------------------------ */
 /* Regression test for issue #3571 (fsfs 'svnadmin recover' expects
    youngest revprop to be outside revprops.db). */
@@ -516,6 +718,559 @@ recover_fully_packed(const svn_test_opts_t *opts,
 #undef MAX_REV
 #undef SHARD_SIZE
 
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-upgrade-pack-manifest"
+#define SHARD_SIZE 4
+#define MAX_REV 10
+static svn_error_t *
+upgrade_pack_manifest(const svn_test_opts_t *opts,
+                      apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_test_opts_t old_opts = *opts;
+  svn_stream_t *rstream;
+  svn_stringbuf_t *rstring;
+  apr_finfo_t finfo;
+  const char *path;
+  svn_revnum_t rev;
+  int version;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  /* Create a packed repository with text manifests and upgrade it. */
+  old_opts.server_minor_version = 7;
+  SVN_ERR(create_packed_filesystem(REPO_NAME, &old_opts, MAX_REV, SHARD_SIZE,
+                                   pool));
+  SVN_ERR(svn_fs_upgrade(REPO_NAME, pool));
+
+  SVN_ERR(svn_io_read_version_file(&version,
+                                   svn_dirent_join(REPO_NAME, "format", pool),
+                                   pool));
+  SVN_TEST_ASSERT(version == SVN_FS_FS__FORMAT_NUMBER);
+
+  /* Every manifest should now be a plain array of 8 byte offsets. */
+  path = svn_dirent_join_many(pool, REPO_NAME, PATH_REVS_DIR, "1.pack",
+                              PATH_MANIFEST, NULL);
+  SVN_ERR(svn_io_stat(&finfo, path, APR_FINFO_SIZE, pool));
+  SVN_TEST_ASSERT(finfo.size == SHARD_SIZE * 8);
+
+  /* Re-running the upgrade must not touch the converted manifests. */
+  SVN_ERR(svn_fs_upgrade(REPO_NAME, pool));
+  SVN_ERR(svn_io_stat(&finfo, path, APR_FINFO_SIZE, pool));
+  SVN_TEST_ASSERT(finfo.size == SHARD_SIZE * 8);
+
+  /* The contents must still be readable through a fresh FS object. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  for (rev = 2; rev <= MAX_REV; rev++)
+    {
+      svn_fs_root_t *rev_root;
+
+      SVN_ERR(svn_fs_revision_root(&rev_root, fs, rev, pool));
+      SVN_ERR(svn_fs_file_contents(&rstream, rev_root, "iota", pool));
+      SVN_ERR(svn_test__stream_to_string(&rstring, rstream, pool));
+      SVN_TEST_STRING_ASSERT(rstring->data, get_rev_contents(rev, pool));
+    }
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+#undef SHARD_SIZE
+
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-pack-concurrently"
+#define SHARD_SIZE 3
+#define MAX_REV 20
+static svn_error_t *
+pack_concurrently(const svn_test_opts_t *opts,
+                  apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_stream_t *stream;
+  svn_stringbuf_t *rstring;
+  svn_string_t *prop_value;
+  svn_node_kind_t kind;
+  svn_revnum_t rev;
+  apr_int64_t shard;
+  const char *path;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  SVN_ERR(create_non_packed_filesystem(REPO_NAME, opts, MAX_REV, SHARD_SIZE,
+                                       pool));
+
+  /* Pack 3 shards at a time.  The last batch will be incomplete. */
+  SVN_ERR(write_fsfs_conf(REPO_NAME, CONFIG_SECTION_PACKING,
+                          CONFIG_OPTION_PACK_THREADS, "3", pool));
+
+  SVN_ERR(pack_non_packed_filesystem(REPO_NAME, pool));
+
+  /* All shards must have been packed and removed. */
+  for (shard = 0; shard < (MAX_REV + 1) / SHARD_SIZE; shard++)
+    {
+      path = svn_dirent_join_many(pool, REPO_NAME, PATH_REVS_DIR,
+                                  apr_psprintf(pool, "%" APR_INT64_T_FMT,
+                                               shard),
+                                  NULL);
+      SVN_ERR(svn_io_check_path(path, &kind, pool));
+      if (kind != svn_node_none)
+        return svn_error_createf(SVN_ERR_FS_GENERAL, NULL,
+                                 "Unexpected directory '%s' found", path);
+    }
+
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  for (rev = 2; rev <= MAX_REV; rev++)
+    {
+      svn_fs_root_t *rev_root;
+
+      SVN_ERR(svn_fs_revision_root(&rev_root, fs, rev, pool));
+      SVN_ERR(svn_fs_file_contents(&stream, rev_root, "iota", pool));
+      SVN_ERR(svn_test__stream_to_string(&rstring, stream, pool));
+      SVN_TEST_STRING_ASSERT(rstring->data, get_rev_contents(rev, pool));
+
+      SVN_ERR(svn_fs_revision_prop(&prop_value, fs, rev,
+                                   SVN_PROP_REVISION_DATE, pool));
+      SVN_TEST_ASSERT(prop_value != NULL);
+    }
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+#undef SHARD_SIZE
+
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-pack-reordered"
+#define SHARD_SIZE 4
+#define MAX_REV 13
+static svn_error_t *
+pack_reordered(const svn_test_opts_t *opts,
+               apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_fs_txn_t *txn;
+  svn_fs_root_t *txn_root;
+  svn_stream_t *stream;
+  svn_stringbuf_t *rstring;
+  svn_node_kind_t kind;
+  svn_revnum_t rev, after_rev;
+  apr_int64_t shard;
+  const char *conflict;
+  const char *path;
+  apr_pool_t *iterpool;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  SVN_ERR(create_non_packed_filesystem(REPO_NAME, opts, MAX_REV, SHARD_SIZE,
+                                       pool));
+
+  SVN_ERR(write_fsfs_conf(REPO_NAME, CONFIG_SECTION_PACKING,
+                          CONFIG_OPTION_REORDER_ITEMS, "true", pool));
+
+  SVN_ERR(pack_non_packed_filesystem(REPO_NAME, pool));
+
+  /* Every pack file must come with an item index. */
+  for (shard = 0; shard < (MAX_REV + 1) / SHARD_SIZE; shard++)
+    {
+      path = svn_dirent_join_many(pool, REPO_NAME, PATH_REVS_DIR,
+                                  apr_psprintf(pool,
+                                               "%" APR_INT64_T_FMT ".pack",
+                                               shard),
+                                  PATH_ITEM_INDEX, NULL);
+      SVN_ERR(svn_io_check_path(path, &kind, pool));
+      if (kind != svn_node_file)
+        return svn_error_createf(SVN_ERR_FS_GENERAL, NULL,
+                                 "Expected item index '%s' not found", path);
+    }
+
+  /* Read nodes, representations and changed paths of all revisions. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  iterpool = svn_pool_create(pool);
+  for (rev = 1; rev <= MAX_REV; rev++)
+    {
+      svn_fs_root_t *rev_root;
+      apr_hash_t *entries;
+      apr_hash_t *changes;
+
+      svn_pool_clear(iterpool);
+      SVN_ERR(svn_fs_revision_root(&rev_root, fs, rev, iterpool));
+
+      SVN_ERR(svn_fs_dir_entries(&entries, rev_root, "A/D/G", iterpool));
+      SVN_TEST_ASSERT(apr_hash_count(entries) == 3);
+
+      SVN_ERR(svn_fs_file_contents(&stream, rev_root, "A/D/G/rho", iterpool));
+      SVN_ERR(svn_test__stream_to_string(&rstring, stream, iterpool));
+      SVN_TEST_STRING_ASSERT(rstring->data, "This is the file 'rho'.\n");
+
+      if (rev > 1)
+        {
+          SVN_ERR(svn_fs_file_contents(&stream, rev_root, "iota", iterpool));
+          SVN_ERR(svn_test__stream_to_string(&rstring, stream, iterpool));
+          SVN_TEST_STRING_ASSERT(rstring->data,
+                                 get_rev_contents(rev, iterpool));
+        }
+
+      SVN_ERR(svn_fs_paths_changed2(&changes, rev_root, iterpool));
+      SVN_TEST_ASSERT(apr_hash_count(changes) > 0);
+    }
+  svn_pool_destroy(iterpool);
+
+  /* Deltify against a reordered pack file. */
+  SVN_ERR(svn_fs_begin_txn(&txn, fs, MAX_REV, pool));
+  SVN_ERR(svn_fs_txn_root(&txn_root, txn, pool));
+  SVN_ERR(svn_test__set_file_contents(txn_root, "iota",
+                                      get_rev_contents(MAX_REV + 1, pool),
+                                      pool));
+  SVN_ERR(svn_fs_commit_txn(&conflict, &after_rev, txn, pool));
+  SVN_TEST_ASSERT(after_rev == MAX_REV + 1);
+
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  SVN_ERR(svn_fs_revision_root(&txn_root, fs, after_rev, pool));
+  SVN_ERR(svn_fs_file_contents(&stream, txn_root, "iota", pool));
+  SVN_ERR(svn_test__stream_to_string(&rstring, stream, pool));
+  SVN_TEST_STRING_ASSERT(rstring->data, get_rev_contents(after_rev, pool));
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+#undef SHARD_SIZE
+
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-max-delta-chain-length"
+#define MAX_CHAIN_LENGTH 3
+#define MAX_REV 40
+static svn_error_t *
+max_delta_chain_length(const svn_test_opts_t *opts,
+                       apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_fs_txn_t *txn;
+  svn_fs_root_t *root;
+  svn_stream_t *stream;
+  svn_stringbuf_t *rstring;
+  svn_fs_delta_chain_stats_t stats;
+  const char *conflict;
+  svn_revnum_t rev;
+  apr_pool_t *iterpool;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if (strcmp(opts->fs_type, "fsfs") != 0)
+    return SVN_NO_ERROR;
+
+  SVN_ERR(svn_test__create_fs(&fs, REPO_NAME, opts, pool));
+  SVN_ERR(write_fsfs_conf(REPO_NAME, CONFIG_SECTION_DELTIFICATION,
+                          CONFIG_OPTION_MAX_DELTA_CHAIN_LENGTH,
+                          apr_itoa(pool, MAX_CHAIN_LENGTH), pool));
+
+  /* Modify the same file over and over again. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  SVN_ERR(svn_fs_begin_txn(&txn, fs, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&root, txn, pool));
+  SVN_ERR(svn_test__create_greek_tree(root, pool));
+  SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, pool));
+
+  iterpool = svn_pool_create(pool);
+  while (rev < MAX_REV)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(svn_fs_begin_txn(&txn, fs, rev, iterpool));
+      SVN_ERR(svn_fs_txn_root(&root, txn, iterpool));
+      SVN_ERR(svn_test__set_file_contents(root, "iota",
+                                          get_rev_contents(rev + 1,
+                                                           iterpool),
+                                          iterpool));
+      SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, iterpool));
+      SVN_TEST_ASSERT(SVN_IS_VALID_REVNUM(rev));
+    }
+
+  /* No version of iota may require more than MAX_CHAIN_LENGTH
+     representations to be combined. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  for (rev = 2; rev <= MAX_REV; rev++)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(svn_fs_revision_root(&root, fs, rev, iterpool));
+      SVN_ERR(svn_fs_file_contents(&stream, root, "iota", iterpool));
+      SVN_ERR(svn_test__stream_to_string(&rstring, stream, iterpool));
+      SVN_TEST_STRING_ASSERT(rstring->data, get_rev_contents(rev, iterpool));
+    }
+  svn_pool_destroy(iterpool);
+
+  SVN_ERR(svn_fs_get_delta_chain_stats(&stats, fs, pool));
+  SVN_TEST_ASSERT(stats.read_count > 0);
+  SVN_TEST_ASSERT(stats.total_length >= stats.read_count);
+  SVN_TEST_ASSERT(stats.max_length > 1);
+  SVN_TEST_ASSERT(stats.max_length <= MAX_CHAIN_LENGTH);
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+#undef MAX_CHAIN_LENGTH
+
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-delta-window-size"
+#define CONTENTS_SIZE (400 * 1024)
+static svn_error_t *
+delta_window_size(const svn_test_opts_t *opts,
+                  apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_fs_txn_t *txn;
+  svn_fs_root_t *root, *base_root;
+  svn_stream_t *stream;
+  svn_stringbuf_t *contents, *moved, *rstring;
+  svn_txdelta_stream_t *delta_stream;
+  svn_txdelta_window_t *window;
+  apr_size_t target_len = 0;
+  const svn_io_dirent2_t *dirent;
+  const char *conflict;
+  svn_revnum_t rev;
+  apr_uint32_t seed = 815;
+  apr_size_t i;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  /* Use windows that cover the whole file. */
+  SVN_ERR(svn_test__create_fs(&fs, REPO_NAME, opts, pool));
+  SVN_ERR(write_fsfs_conf(REPO_NAME, CONFIG_SECTION_DELTIFICATION,
+                          CONFIG_OPTION_DELTA_WINDOW_SIZE, "1024", pool));
+
+  /* Poorly compressible contents without NULs. */
+  contents = svn_stringbuf_create_ensure(CONTENTS_SIZE, pool);
+  for (i = 0; i < CONTENTS_SIZE; ++i)
+    svn_stringbuf_appendbyte(contents,
+                             (char)(svn_test_rand(&seed) % 255 + 1));
+
+  /* The next version swaps both halves of the file. */
+  moved = svn_stringbuf_create_ensure(CONTENTS_SIZE, pool);
+  svn_stringbuf_appendbytes(moved, contents->data + CONTENTS_SIZE / 2,
+                            CONTENTS_SIZE / 2);
+  svn_stringbuf_appendbytes(moved, contents->data, CONTENTS_SIZE / 2);
+
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  SVN_ERR(svn_fs_begin_txn(&txn, fs, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&root, txn, pool));
+  SVN_ERR(svn_fs_make_file(root, "big", pool));
+  SVN_ERR(svn_test__set_file_contents(root, "big", contents->data, pool));
+  SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, pool));
+
+  SVN_ERR(svn_fs_begin_txn(&txn, fs, rev, pool));
+  SVN_ERR(svn_fs_txn_root(&root, txn, pool));
+  SVN_ERR(svn_test__set_file_contents(root, "big", moved->data, pool));
+  SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, pool));
+
+  /* With default windows, r2 would contain most of the file again. */
+  SVN_ERR(svn_io_stat_dirent(&dirent,
+                             svn_dirent_join_many(pool, REPO_NAME,
+                                                  PATH_REVS_DIR, "0", "2",
+                                                  NULL),
+                             FALSE, pool, pool));
+  SVN_TEST_ASSERT(dirent->filesize < CONTENTS_SIZE / 10);
+
+  /* Both versions must read back correctly. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  SVN_ERR(svn_fs_revision_root(&root, fs, 1, pool));
+  SVN_ERR(svn_fs_file_contents(&stream, root, "big", pool));
+  SVN_ERR(svn_test__stream_to_string(&rstring, stream, pool));
+  SVN_TEST_ASSERT(svn_stringbuf_compare(rstring, contents));
+
+  SVN_ERR(svn_fs_revision_root(&root, fs, 2, pool));
+  SVN_ERR(svn_fs_file_contents(&stream, root, "big", pool));
+  SVN_ERR(svn_test__stream_to_string(&rstring, stream, pool));
+  SVN_TEST_ASSERT(svn_stringbuf_compare(rstring, moved));
+
+  /* Deltas handed out to clients and dump files must not contain the
+     stored large windows, which pre-1.8 readers reject. */
+  SVN_ERR(svn_fs_revision_root(&base_root, fs, 1, pool));
+  SVN_ERR(svn_fs_get_file_delta_stream(&delta_stream, base_root, "big",
+                                       root, "big", pool));
+  do
+    {
+      SVN_ERR(svn_txdelta_next_window(&window, delta_stream, pool));
+      if (window)
+        {
+          SVN_TEST_ASSERT(window->sview_len <= SVN_DELTA_DEFAULT_WINDOW_SIZE);
+          SVN_TEST_ASSERT(window->tview_len <= SVN_DELTA_DEFAULT_WINDOW_SIZE);
+          target_len += window->tview_len;
+        }
+    }
+  while (window);
+  SVN_TEST_ASSERT(target_len == CONTENTS_SIZE);
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef CONTENTS_SIZE
+
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-lz4-compression"
+#define MAX_REV 10
+/* Return well compressible contents of "iota" in revision REV. */
+static const char *
+get_large_rev_contents(svn_revnum_t rev, apr_pool_t *pool)
+{
+  svn_stringbuf_t *contents = svn_stringbuf_create_empty(pool);
+  int i;
+
+  for (i = 0; i < 1000; ++i)
+    svn_stringbuf_appendcstr(contents, get_rev_contents(i % rev, pool));
+
+  return contents->data;
+}
+
+static svn_error_t *
+lz4_compression(const svn_test_opts_t *opts,
+                apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_fs_txn_t *txn;
+  svn_fs_root_t *root;
+  svn_stream_t *stream;
+  svn_stringbuf_t *rstring;
+  const char *conflict;
+  svn_revnum_t rev;
+  apr_size_t i;
+  svn_boolean_t found_svndiff2 = FALSE;
+  apr_pool_t *iterpool;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  SVN_ERR(svn_test__create_fs(&fs, REPO_NAME, opts, pool));
+  SVN_ERR(write_fsfs_conf(REPO_NAME, CONFIG_SECTION_DELTIFICATION,
+                          CONFIG_OPTION_COMPRESSION, "lz4", pool));
+
+  /* Commit compressible contents that change a little in every rev. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  SVN_ERR(svn_fs_begin_txn(&txn, fs, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&root, txn, pool));
+  SVN_ERR(svn_test__create_greek_tree(root, pool));
+  SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, pool));
+
+  iterpool = svn_pool_create(pool);
+  while (rev < MAX_REV)
+    {
+      const char *path;
+
+      svn_pool_clear(iterpool);
+      SVN_ERR(svn_fs_begin_txn(&txn, fs, rev, iterpool));
+      SVN_ERR(svn_fs_txn_root(&root, txn, iterpool));
+      SVN_ERR(svn_test__set_file_contents(root, "iota",
+                                          get_large_rev_contents(rev + 1,
+                                                                 iterpool),
+                                          iterpool));
+      SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, iterpool));
+      SVN_TEST_ASSERT(SVN_IS_VALID_REVNUM(rev));
+
+      /* Look for svndiff2 data in the new revision. */
+      path = svn_dirent_join_many(iterpool, REPO_NAME, PATH_REVS_DIR, "0",
+                                  apr_psprintf(iterpool, "%ld", rev), NULL);
+      SVN_ERR(svn_stringbuf_from_file2(&rstring, path, iterpool));
+      for (i = 0; i + 4 <= rstring->len; ++i)
+        if (memcmp(rstring->data + i, "SVN\2", 4) == 0)
+          found_svndiff2 = TRUE;
+    }
+
+  SVN_TEST_ASSERT(found_svndiff2);
+
+  /* All versions must read back correctly. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  for (rev = 2; rev <= MAX_REV; rev++)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(svn_fs_revision_root(&root, fs, rev, iterpool));
+      SVN_ERR(svn_fs_file_contents(&stream, root, "iota", iterpool));
+      SVN_ERR(svn_test__stream_to_string(&rstring, stream, iterpool));
+      SVN_TEST_STRING_ASSERT(rstring->data,
+                             get_large_rev_contents(rev, iterpool));
+    }
+  svn_pool_destroy(iterpool);
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+
+/* ------------------------------------------------------------------------ */
+#define REPO_NAME "test-repo-compression-threads"
+#define MAX_REV 5
+static svn_error_t *
+compression_threads(const svn_test_opts_t *opts,
+                    apr_pool_t *pool)
+{
+  svn_fs_t *fs;
+  svn_fs_txn_t *txn;
+  svn_fs_root_t *root;
+  svn_stream_t *stream;
+  svn_stringbuf_t *rstring;
+  const char *conflict;
+  svn_revnum_t rev;
+  apr_pool_t *iterpool;
+
+  /* Bail (with success) on known-untestable scenarios */
+  if ((strcmp(opts->fs_type, "fsfs") != 0)
+      || (opts->server_minor_version && (opts->server_minor_version < 8)))
+    return SVN_NO_ERROR;
+
+  SVN_ERR(svn_test__create_fs(&fs, REPO_NAME, opts, pool));
+  SVN_ERR(write_fsfs_conf(REPO_NAME, CONFIG_SECTION_DELTIFICATION,
+                          CONFIG_OPTION_COMPRESSION_THREADS, "4", pool));
+
+  /* Commit contents spanning many delta windows. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  SVN_ERR(svn_fs_begin_txn(&txn, fs, 0, pool));
+  SVN_ERR(svn_fs_txn_root(&root, txn, pool));
+  SVN_ERR(svn_test__create_greek_tree(root, pool));
+  SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, pool));
+
+  iterpool = svn_pool_create(pool);
+  while (rev < MAX_REV)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(svn_fs_begin_txn(&txn, fs, rev, iterpool));
+      SVN_ERR(svn_fs_txn_root(&root, txn, iterpool));
+      SVN_ERR(svn_test__set_file_contents(root, "iota",
+                                          get_large_rev_contents(rev + 1,
+                                                                 iterpool),
+                                          iterpool));
+      SVN_ERR(svn_fs_commit_txn(&conflict, &rev, txn, iterpool));
+      SVN_TEST_ASSERT(SVN_IS_VALID_REVNUM(rev));
+    }
+
+  /* All versions must read back correctly. */
+  SVN_ERR(svn_fs_open(&fs, REPO_NAME, NULL, pool));
+  for (rev = 2; rev <= MAX_REV; rev++)
+    {
+      svn_pool_clear(iterpool);
+      SVN_ERR(svn_fs_revision_root(&root, fs, rev, iterpool));
+      SVN_ERR(svn_fs_file_contents(&stream, root, "iota", iterpool));
+      SVN_ERR(svn_test__stream_to_string(&rstring, stream, iterpool));
+      SVN_TEST_STRING_ASSERT(rstring->data,
+                             get_large_rev_contents(rev, iterpool));
+    }
+  svn_pool_destroy(iterpool);
+
+  return SVN_NO_ERROR;
+}
+#undef REPO_NAME
+#undef MAX_REV
+
 /* ------------------------------------------------------------------------ */
 
 /* The test table.  */
@@ -535,5 +1290,23 @@ struct svn_test_descriptor_t test_funcs[] =
                        "get/set revprop while packing FSFS filesystem"),
     SVN_TEST_OPTS_PASS(recover_fully_packed,
                        "recover a fully packed filesystem"),
+    SVN_TEST_OPTS_PASS(get_set_packed_revprops,
+                       "get/set revprops of packed revisions"),
+    SVN_TEST_OPTS_PASS(revprops_across_handles,
+                       "see revprop changes made by other handles"),
+    SVN_TEST_OPTS_PASS(upgrade_pack_manifest,
+                       "upgrade text pack manifests to binary"),
+    SVN_TEST_OPTS_PASS(pack_concurrently,
+                       "pack several shards concurrently"),
+    SVN_TEST_OPTS_PASS(pack_reordered,
+                       "pack with items reordered by path"),
+    SVN_TEST_OPTS_PASS(max_delta_chain_length,
+                       "limit the length of delta chains"),
+    SVN_TEST_OPTS_PASS(delta_window_size,
+                       "store deltas with large windows"),
+    SVN_TEST_OPTS_PASS(lz4_compression,
+                       "store deltas compressed with LZ4"),
+    SVN_TEST_OPTS_PASS(compression_threads,
+                       "compress deltas on multiple threads"),
     SVN_TEST_NULL
   };
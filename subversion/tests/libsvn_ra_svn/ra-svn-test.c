@@ -0,0 +1,264 @@
+/*
+ * ra-svn-test.c :  tests for the ra_svn protocol implementation
+ *
+ * ====================================================================
+ *    Licensed to the Apache Software Foundation (ASF) under one
+ *    or more contributor license agreements.  See the NOTICE file
+ *    distributed with this work for additional information
+ *    regarding copyright ownership.  The ASF licenses this file
+ *    to you under the Apache License, Version 2.0 (the
+ *    "License"); you may not use this file except in compliance
+ *    with the License.  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing,
+ *    software distributed under the License is distributed on an
+ *    "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ *    KIND, either express or implied.  See the License for the
+ *    specific language governing permissions and limitations
+ *    under the License.
+ * ====================================================================
+ */
+
+
+
+#include <apr_general.h>
+#include <apr_pools.h>
+#include <apr_file_io.h>
+#include <apr_thread_proc.h>
+
+#include "svn_error.h"
+#include "svn_pools.h"
+#include "svn_delta.h"
+#include "svn_ra_svn.h"
+
+#include "../svn_test.h"
+
+/*-------------------------------------------------------------------*/
+
+/** Helper routines. **/
+
+/* Set *CLIENT and *SERVER to two ra_svn connections that are connected
+   to each other through pipes.  *SERVER gets allocated in SERVER_POOL,
+   everything else in POOL.  Both will compress svndiff data at
+   COMPRESSION_LEVEL and claim that the other side supports svndiff1. */
+static svn_error_t *
+make_connection_pair(svn_ra_svn_conn_t **client,
+                     svn_ra_svn_conn_t **server,
+                     int compression_level,
+                     apr_pool_t *server_pool,
+                     apr_pool_t *pool)
+{
+  apr_file_t *to_server_r, *to_server_w, *to_client_r, *to_client_w;
+  apr_array_header_t *caps;
+  svn_ra_svn_item_t *item;
+  apr_status_t status;
+
+  status = apr_file_pipe_create(&to_server_r, &to_server_w, pool);
+  if (! status)
+    status = apr_file_pipe_create(&to_client_r, &to_client_w, pool);
+  if (status)
+    return svn_error_wrap_apr(status, "Can't create pipe");
+
+  *client = svn_ra_svn_create_conn2(NULL, to_client_r, to_server_w,
+                                    compression_level, pool);
+  *server = svn_ra_svn_create_conn2(NULL, to_server_r, to_client_w,
+                                    compression_level, server_pool);
+
+  caps = apr_array_make(pool, 1, sizeof(svn_ra_svn_item_t));
+  item = apr_array_push(caps);
+  item->kind = SVN_RA_SVN_WORD;
+  item->u.word = SVN_RA_SVN_CAP_SVNDIFF1;
+  SVN_ERR(svn_ra_svn_set_capabilities(*client, caps));
+  SVN_ERR(svn_ra_svn_set_capabilities(*server, caps));
+
+  return SVN_NO_ERROR;
+}
+
+/* Baton for the editor receiving the file contents. */
+typedef struct receiver_baton_t
+{
+  svn_stringbuf_t *contents;
+  apr_pool_t *pool;
+} receiver_baton_t;
+
+/* Implements svn_delta_editor_t.open_root */
+static svn_error_t *
+receiver_open_root(void *edit_baton,
+                   svn_revnum_t base_revision,
+                   apr_pool_t *dir_pool,
+                   void **root_baton)
+{
+  *root_baton = edit_baton;
+  return SVN_NO_ERROR;
+}
+
+/* Implements svn_delta_editor_t.add_file */
+static svn_error_t *
+receiver_add_file(const char *path,
+                  void *parent_baton,
+                  const char *copyfrom_path,
+                  svn_revnum_t copyfrom_revision,
+                  apr_pool_t *file_pool,
+                  void **file_baton)
+{
+  *file_baton = parent_baton;
+  return SVN_NO_ERROR;
+}
+
+/* Implements svn_delta_editor_t.apply_textdelta */
+static svn_error_t *
+receiver_apply_textdelta(void *file_baton,
+                         const char *base_checksum,
+                         apr_pool_t *pool,
+                         svn_txdelta_window_handler_t *handler,
+                         void **handler_baton)
+{
+  receiver_baton_t *rb = file_baton;
+
+  svn_txdelta_apply(svn_stream_empty(pool),
+                    svn_stream_from_stringbuf(rb->contents, rb->pool),
+                    NULL, NULL, pool, handler, handler_baton);
+  return SVN_NO_ERROR;
+}
+
+#if APR_HAS_THREADS
+/* "Arguments" passed to the thread running serve_editor_drive(). */
+typedef struct server_baton_t
+{
+  svn_ra_svn_conn_t *conn;
+
+  /* Receives the file contents. */
+  receiver_baton_t rb;
+
+  /* Root pool owned by the thread. */
+  apr_pool_t *pool;
+
+  /* The thread's results. */
+  svn_boolean_t aborted;
+  svn_error_t *err;
+} server_baton_t;
+
+/* Thread function receiving an editor drive on the connection given in
+   the server_baton_t DATA while the main thread is still sending it.
+   Otherwise, the pipes would have to buffer the whole drive. */
+static void * APR_THREAD_FUNC
+serve_editor_drive(apr_thread_t *tid, void *data)
+{
+  server_baton_t *sb = data;
+  svn_delta_editor_t *receiver = svn_delta_default_editor(sb->pool);
+
+  receiver->open_root = receiver_open_root;
+  receiver->add_file = receiver_add_file;
+  receiver->apply_textdelta = receiver_apply_textdelta;
+
+  sb->rb.contents = svn_stringbuf_create_empty(sb->pool);
+  sb->rb.pool = sb->pool;
+  sb->err = svn_ra_svn_drive_editor2(sb->conn, sb->pool, receiver, &sb->rb,
+                                     &sb->aborted, FALSE);
+  if (! sb->err)
+    sb->err = svn_ra_svn_flush(sb->conn, sb->pool);
+
+  return NULL;
+}
+#endif
+
+
+/*-------------------------------------------------------------------*/
+
+/** The tests **/
+
+static svn_error_t *
+compressed_stream_editor_drive(apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+  svn_ra_svn_conn_t *client;
+  const svn_delta_editor_t *editor;
+  server_baton_t *sb;
+  apr_pool_t *server_pool = svn_pool_create_ex(NULL, NULL);
+  apr_thread_t *thread;
+  apr_status_t status, retval;
+  void *edit_baton, *root_baton, *file_baton;
+  svn_txdelta_window_handler_t handler;
+  void *handler_baton;
+  svn_stringbuf_t *contents = svn_stringbuf_create_empty(pool);
+  svn_error_t *err;
+  int i;
+
+  /* The server side lives in its own root pool, owned by its thread. */
+  sb = apr_pcalloc(server_pool, sizeof(*sb));
+  sb->pool = server_pool;
+  SVN_ERR(make_connection_pair(&client, &sb->conn, 5, server_pool, pool));
+
+  /* Without stream compression, deltas get compressed themselves. */
+  SVN_TEST_ASSERT(svn_ra_svn__svndiff_version(client) == 1);
+  SVN_TEST_ASSERT(svn_ra_svn__svndiff_version(sb->conn) == 1);
+
+  /* Nothing has been sent yet, so both sides may switch right away. */
+  SVN_ERR(svn_ra_svn__enable_stream_compression(client, pool));
+  SVN_ERR(svn_ra_svn__enable_stream_compression(sb->conn, server_pool));
+
+  /* Don't compress the same data twice. */
+  SVN_TEST_ASSERT(svn_ra_svn__svndiff_version(client) == 0);
+  SVN_TEST_ASSERT(svn_ra_svn__svndiff_version(sb->conn) == 0);
+
+  /* Contents spanning several svndiff windows. */
+  for (i = 0; contents->len < 300 * 1024; ++i)
+    svn_stringbuf_appendcstr(contents,
+                             apr_psprintf(pool, "line %d\n", i % 1000));
+
+  status = apr_thread_create(&thread, NULL, serve_editor_drive, sb,
+                             server_pool);
+  if (status)
+    return svn_error_wrap_apr(status, "Can't create thread");
+
+  /* Send a file through the editor. */
+  svn_ra_svn_get_editor(&editor, &edit_baton, client, pool, NULL, NULL);
+  err = editor->open_root(edit_baton, SVN_INVALID_REVNUM, pool, &root_baton);
+  if (! err)
+    err = editor->add_file("file", root_baton, NULL, SVN_INVALID_REVNUM,
+                           pool, &file_baton);
+  if (! err)
+    err = editor->apply_textdelta(file_baton, NULL, pool,
+                                  &handler, &handler_baton);
+  if (! err)
+    err = svn_txdelta_send_stream(svn_stream_from_stringbuf(contents, pool),
+                                  handler, handler_baton, NULL, pool);
+  if (! err)
+    err = editor->close_file(file_baton, NULL, pool);
+  if (! err)
+    err = editor->close_directory(root_baton, pool);
+  if (! err)
+    err = editor->close_edit(edit_baton, pool);
+
+  /* The server may still be waiting for the rest of the drive.  It will
+     fail once POOL closes the pipes, so leave its pool to the thread. */
+  if (err)
+    return svn_error_trace(err);
+
+  apr_thread_join(&retval, thread);
+  err = sb->err;
+  if (! err && (sb->aborted || ! svn_stringbuf_compare(sb->rb.contents,
+                                                         contents)))
+    err = svn_error_create(SVN_ERR_TEST_FAILED, NULL,
+                           "file contents not received intact");
+
+  svn_pool_destroy(server_pool);
+  return svn_error_trace(err);
+#else
+  return svn_error_create(SVN_ERR_TEST_SKIPPED, NULL,
+                          "no thread support");
+#endif
+}
+
+
+/* The test table.  */
+
+struct svn_test_descriptor_t test_funcs[] =
+  {
+    SVN_TEST_NULL,
+    SVN_TEST_PASS2(compressed_stream_editor_drive,
+                   "drive an editor over a compressed connection"),
+    SVN_TEST_NULL
+  };
@@ -35,6 +35,8 @@
 #include "svn_config.h"
 #include "svn_props.h"
 
+#include "private/svn_repos_private.h"
+
 #include "../svn_test_fs.h"
 
 #include "dir-delta-editor.h"
@@ -1328,6 +1330,213 @@ authz(apr_pool_t *pool)
 }
 
 
+/* Check that USER has exactly the EXPECTED access to PATH in AUTHZ. */
+static svn_error_t *
+authz_check_expected(svn_authz_t *authz,
+                     const char *path,
+                     const char *user,
+                     svn_repos_authz_access_t required,
+                     svn_boolean_t expected,
+                     apr_pool_t *pool)
+{
+  svn_boolean_t access_granted;
+
+  SVN_ERR(svn_repos_authz_check_access(authz, "greek", path, user,
+                                       required, &access_granted, pool));
+  if (access_granted != expected)
+    return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                             "Authz incorrectly %s %s%s access "
+                             "to %s for user %s",
+                             access_granted ? "grants" : "denies",
+                             required & svn_authz_recursive
+                               ? "recursive " : "",
+                             required & svn_authz_write ? "write" : "read",
+                             path ? path : "any path",
+                             user ? user : "-");
+
+  return SVN_NO_ERROR;
+}
+
+/* Test that authz files are shared by svn_repos__authz_read_cached()
+   until they change, and that lookups are counted. */
+static svn_error_t *
+authz_cached(apr_pool_t *pool)
+{
+  const char *authz_file_path;
+  svn_authz_t *first, *second, *changed;
+  svn_repos__authz_stats_t stats;
+  apr_pool_t *first_pool = svn_pool_create(pool);
+  apr_pool_t *second_pool = svn_pool_create(pool);
+  const char *contents =
+    "[aliases]"                                                              NL
+    "sage = socrates"                                                        NL
+    ""                                                                       NL
+    "[groups]"                                                               NL
+    "Teachers = &sage"                                                       NL
+    "Everyone = @teachers, plato"                                            NL
+    ""                                                                       NL
+    "[/]"                                                                    NL
+    "@everyone = r"                                                          NL
+    ""                                                                       NL
+    "[greek:/A]"                                                             NL
+    "&SAGE = rw"                                                             NL
+    ""                                                                       NL
+    "[/A/B/secret]"                                                          NL
+    "~@TEACHERS ="                                                           NL;
+
+  SVN_ERR(svn_io_write_unique(&authz_file_path, NULL,
+                              contents, strlen(contents),
+                              svn_io_file_del_on_pool_cleanup, pool));
+
+  /* Reading the same file twice gives the same rules. */
+  SVN_ERR(svn_repos__authz_read_cached(&first, authz_file_path, TRUE,
+                                       first_pool));
+  SVN_ERR(svn_repos__authz_read_cached(&second, authz_file_path, TRUE,
+                                       second_pool));
+  SVN_TEST_ASSERT(first == second);
+
+  /* Group and alias membership, resolved through nested groups and
+     regardless of the case of their names. */
+  SVN_ERR(authz_check_expected(first, "/iota", "plato", svn_authz_read,
+                               TRUE, pool));
+  SVN_ERR(authz_check_expected(first, "/iota", "socrates", svn_authz_read,
+                               TRUE, pool));
+  SVN_ERR(authz_check_expected(first, "/iota", "aristotle", svn_authz_read,
+                               FALSE, pool));
+  SVN_ERR(authz_check_expected(first, "/A/mu", "socrates", svn_authz_write,
+                               TRUE, pool));
+  SVN_ERR(authz_check_expected(first, "/A/mu", "plato", svn_authz_write,
+                               FALSE, pool));
+  SVN_ERR(authz_check_expected(first, "/A/B/secret/x", "plato",
+                               svn_authz_read, FALSE, pool));
+  SVN_ERR(authz_check_expected(first, "/A/B", "socrates",
+                               svn_authz_read | svn_authz_recursive,
+                               TRUE, pool));
+  SVN_ERR(authz_check_expected(first, "/A", "plato",
+                               svn_authz_read | svn_authz_recursive,
+                               FALSE, pool));
+  SVN_ERR(authz_check_expected(first, NULL, "socrates", svn_authz_write,
+                               TRUE, pool));
+  SVN_ERR(authz_check_expected(first, NULL, "plato", svn_authz_write,
+                               FALSE, pool));
+
+  svn_repos__authz_get_stats(&stats, first);
+  SVN_TEST_ASSERT(stats.lookups == 10);
+  SVN_TEST_ASSERT(stats.recursive_lookups == 2);
+  SVN_TEST_ASSERT(stats.repos_lookups == 2);
+  SVN_TEST_ASSERT(stats.sections_checked >= stats.lookups);
+  SVN_TEST_ASSERT(stats.cache_hits == 1);
+
+  /* Changing the file makes the next reader see the new rules, while
+     the old ones remain valid for the pools still using them. */
+  svn_pool_destroy(second_pool);
+  SVN_ERR(svn_io_remove_file2(authz_file_path, FALSE, pool));
+  SVN_ERR(svn_io_file_create(authz_file_path,
+                             "[/]"                                           NL
+                             "* = rw"                                        NL,
+                             pool));
+
+  SVN_ERR(svn_repos__authz_read_cached(&changed, authz_file_path, TRUE,
+                                       pool));
+  SVN_TEST_ASSERT(changed != first);
+  SVN_ERR(authz_check_expected(changed, "/iota", "aristotle",
+                               svn_authz_write, TRUE, pool));
+  SVN_ERR(authz_check_expected(first, "/iota", "aristotle",
+                               svn_authz_read, FALSE, pool));
+
+  svn_pool_destroy(first_pool);
+  return SVN_NO_ERROR;
+}
+
+/* Test that batched authz lookups agree with single ones. */
+static svn_error_t *
+authz_check_many(apr_pool_t *pool)
+{
+  svn_authz_t *authz_cfg;
+  svn_repos__authz_stats_t stats;
+  apr_array_header_t *paths = apr_array_make(pool, 16, sizeof(const char *));
+  svn_boolean_t *granted;
+  const char *users[] = { NULL, "plato", "socrates" };
+  svn_repos_authz_access_t required[] = {
+    svn_authz_read,
+    svn_authz_write,
+    svn_authz_read | svn_authz_recursive
+  };
+  apr_size_t i, j;
+  int k;
+  const char *contents =
+    "[groups]"                                                               NL
+    "philosophers = plato, socrates"                                         NL
+    ""                                                                       NL
+    "[/]"                                                                    NL
+    "* = r"                                                                  NL
+    ""                                                                       NL
+    "[greek:/A]"                                                             NL
+    "@philosophers = rw"                                                     NL
+    ""                                                                       NL
+    "[/A/B]"                                                                 NL
+    "plato ="                                                                NL
+    ""                                                                       NL
+    "[greek:/A/B/E/alpha]"                                                   NL
+    "plato = r"                                                              NL
+    ""                                                                       NL
+    "[/A/D/G]"                                                               NL
+    "* ="                                                                    NL
+    "socrates = rw"                                                          NL;
+
+  /* Sorted the way the log code sorts them, but also including paths
+     that share no prefix with their predecessor, non-canonical ones and
+     paths below the deepest rules. */
+  APR_ARRAY_PUSH(paths, const char *) = "/";
+  APR_ARRAY_PUSH(paths, const char *) = "/A";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/B";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/B/E";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/B/E/alpha";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/B/E/beta";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/B/lambda";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/BB";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/D/G/pi";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/D/gamma";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/B/E/alpha/";
+  APR_ARRAY_PUSH(paths, const char *) = "/iota";
+  APR_ARRAY_PUSH(paths, const char *) = "/A/D/G";
+
+  SVN_ERR(authz_get_handle(&authz_cfg, contents, pool));
+  granted = apr_palloc(pool, paths->nelts * sizeof(*granted));
+
+  for (i = 0; i < sizeof(users) / sizeof(users[0]); i++)
+    for (j = 0; j < sizeof(required) / sizeof(required[0]); j++)
+      {
+        SVN_ERR(svn_repos__authz_check_access_many(granted, authz_cfg,
+                                                   "greek", paths, users[i],
+                                                   required[j], pool));
+
+        for (k = 0; k < paths->nelts; k++)
+          {
+            const char *path = APR_ARRAY_IDX(paths, k, const char *);
+            svn_boolean_t expected;
+
+            SVN_ERR(svn_repos_authz_check_access(authz_cfg, "greek", path,
+                                                 users[i], required[j],
+                                                 &expected, pool));
+            if (granted[k] != expected)
+              return svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                       "Batched lookup %s access %d to "
+                                       "'%s' for user %s",
+                                       granted[k] ? "grants" : "denies",
+                                       required[j], path,
+                                       users[i] ? users[i] : "-");
+          }
+      }
+
+  svn_repos__authz_get_stats(&stats, authz_cfg);
+  SVN_TEST_ASSERT(stats.batched_lookups == 9 * paths->nelts);
+  SVN_TEST_ASSERT(stats.lookups == 18 * paths->nelts);
+
+  return SVN_NO_ERROR;
+}
+
+
 
 /* Callback for the commit editor tests that relays requests to
    authz. */
@@ -2580,6 +2789,10 @@ struct svn_test_descriptor_t test_funcs[] =
                        "test removal of defunct locks"),
     SVN_TEST_PASS2(authz,
                    "test authz access control"),
+    SVN_TEST_PASS2(authz_cached,
+                   "test sharing and reloading of authz files"),
+    SVN_TEST_PASS2(authz_check_many,
+                   "test batched authz lookups"),
     SVN_TEST_OPTS_PASS(commit_editor_authz,
                        "test authz in the commit editor"),
     SVN_TEST_OPTS_PASS(commit_continue_txn,
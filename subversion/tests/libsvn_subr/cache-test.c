@@ -26,8 +26,10 @@
 #include <apr_general.h>
 #include <apr_lib.h>
 #include <apr_time.h>
+#include <apr_thread_proc.h>
 
 #include "svn_pools.h"
+#include "svn_io.h"
 
 #include "private/svn_cache.h"
 #include "svn_private_config.h"
@@ -199,6 +201,240 @@ test_membuffer_cache_basic(apr_pool_t *pool)
   return basic_cache_test(cache, FALSE, pool);
 }
 
+static svn_error_t *
+test_membuffer_cache_shared(apr_pool_t *pool)
+{
+  svn_cache__t *cache;
+  svn_membuffer_t *membuffer;
+  svn_error_t *err;
+
+  err = svn_cache__membuffer_cache_create_shared(&membuffer, 10*1024, 1,
+                                                 pool);
+  if (err)
+    return svn_error_create(SVN_ERR_TEST_SKIPPED, err,
+                            "shared memory not supported");
+
+  /* A no-op in the creating process but must not fail. */
+  SVN_ERR(svn_cache__membuffer_cache_child_init(membuffer, pool));
+
+  SVN_ERR(svn_cache__create_membuffer_cache(&cache,
+                                            membuffer,
+                                            serialize_revnum,
+                                            deserialize_revnum,
+                                            APR_HASH_KEY_STRING,
+                                            "cache:",
+                                            TRUE,
+                                            pool));
+
+  return basic_cache_test(cache, FALSE, pool);
+}
+
+/* Implements svn_cache__validate_func_t.  Accept VALIDATION only if it
+ * matches the C string given as BATON. */
+static svn_error_t *
+validate_snapshot(svn_boolean_t *valid,
+                  void *baton,
+                  const svn_string_t *validation,
+                  apr_pool_t *scratch_pool)
+{
+  *valid = strcmp(validation->data, baton) == 0;
+  return SVN_NO_ERROR;
+}
+
+static svn_error_t *
+test_membuffer_cache_snapshot(apr_pool_t *pool)
+{
+  const char *path = "cache-test-snapshot";
+  svn_cache__t *cache;
+  svn_membuffer_t *membuffer;
+  svn_boolean_t loaded, found;
+  svn_revnum_t twenty = 20, *answer;
+
+  SVN_ERR(svn_cache__membuffer_cache_create(&membuffer, 10*1024, 1,
+                                            TRUE, pool));
+  SVN_ERR(svn_cache__create_membuffer_cache(&cache, membuffer,
+                                            serialize_revnum,
+                                            deserialize_revnum,
+                                            APR_HASH_KEY_STRING,
+                                            "cache:", FALSE, pool));
+  SVN_ERR(svn_cache__set(cache, "twenty", &twenty, pool));
+  SVN_ERR(svn_cache__membuffer_cache_save(membuffer, path,
+                                          svn_string_create("r20", pool),
+                                          pool));
+
+  /* A fresh cache of the same size must accept the snapshot ... */
+  SVN_ERR(svn_cache__membuffer_cache_create(&membuffer, 10*1024, 1,
+                                            TRUE, pool));
+  SVN_ERR(svn_cache__membuffer_cache_load(&loaded, membuffer, path,
+                                          validate_snapshot, "r20", pool));
+  if (! loaded)
+    return svn_error_create(SVN_ERR_TEST_FAILED, NULL,
+                            "valid cache snapshot not loaded");
+
+  SVN_ERR(svn_cache__create_membuffer_cache(&cache, membuffer,
+                                            serialize_revnum,
+                                            deserialize_revnum,
+                                            APR_HASH_KEY_STRING,
+                                            "cache:", FALSE, pool));
+  SVN_ERR(svn_cache__get((void **) &answer, &found, cache, "twenty", pool));
+  if (! found || *answer != 20)
+    return svn_error_create(SVN_ERR_TEST_FAILED, NULL,
+                            "entry for 'twenty' not restored from snapshot");
+
+  /* ... unless the validation fails. */
+  SVN_ERR(svn_cache__membuffer_cache_create(&membuffer, 10*1024, 1,
+                                            TRUE, pool));
+  SVN_ERR(svn_cache__membuffer_cache_load(&loaded, membuffer, path,
+                                          validate_snapshot, "r21", pool));
+  if (loaded)
+    return svn_error_create(SVN_ERR_TEST_FAILED, NULL,
+                            "outdated cache snapshot got loaded");
+
+  /* Missing snapshots are no error. */
+  SVN_ERR(svn_io_remove_file2(path, FALSE, pool));
+  SVN_ERR(svn_cache__membuffer_cache_load(&loaded, membuffer, path,
+                                          NULL, NULL, pool));
+  SVN_TEST_ASSERT(! loaded);
+
+  return SVN_NO_ERROR;
+}
+
+#if APR_HAS_THREADS
+/* Number of keys written by concurrent_cache_writer(). */
+#define CONCURRENT_KEY_COUNT 2000
+
+/* Number of threads running concurrent_cache_reader(). */
+#define CONCURRENT_READER_COUNT 4
+
+/* "Arguments" passed to the threads of test_membuffer_cache_concurrent. */
+typedef struct concurrent_baton_t
+{
+  svn_cache__t *cache;
+
+  /* Root pool owned by the thread. */
+  apr_pool_t *pool;
+
+  /* The thread's result. */
+  svn_error_t *err;
+} concurrent_baton_t;
+
+/* Thread function setting "key-<i>" to <i> in the cache given in the
+ * concurrent_baton_t DATA, for ascending <i>. */
+static void * APR_THREAD_FUNC
+concurrent_cache_writer(apr_thread_t *tid, void *data)
+{
+  concurrent_baton_t *baton = data;
+  apr_pool_t *iterpool = svn_pool_create(baton->pool);
+  svn_revnum_t i;
+
+  for (i = 0; i < CONCURRENT_KEY_COUNT && !baton->err; ++i)
+    {
+      svn_pool_clear(iterpool);
+      baton->err = svn_cache__set(baton->cache,
+                                  apr_psprintf(iterpool, "key-%ld", i),
+                                  &i, iterpool);
+    }
+
+  svn_pool_destroy(iterpool);
+  return NULL;
+}
+
+/* Thread function looking up the keys written by concurrent_cache_writer
+ * in the cache given in the concurrent_baton_t DATA.  Whatever gets found
+ * must match its key. */
+static void * APR_THREAD_FUNC
+concurrent_cache_reader(apr_thread_t *tid, void *data)
+{
+  concurrent_baton_t *baton = data;
+  apr_pool_t *iterpool = svn_pool_create(baton->pool);
+  svn_revnum_t i, *answer;
+  svn_boolean_t found;
+  int pass;
+
+  for (pass = 0; pass < 10 && !baton->err; ++pass)
+    for (i = 0; i < CONCURRENT_KEY_COUNT && !baton->err; ++i)
+      {
+        svn_pool_clear(iterpool);
+        baton->err = svn_cache__get((void **) &answer, &found, baton->cache,
+                                    apr_psprintf(iterpool, "key-%ld", i),
+                                    iterpool);
+        if (!baton->err && found && *answer != i)
+          baton->err = svn_error_createf(SVN_ERR_TEST_FAILED, NULL,
+                                         "expected %ld but found '%ld'",
+                                         i, *answer);
+      }
+
+  svn_pool_destroy(iterpool);
+  return NULL;
+}
+#endif
+
+static svn_error_t *
+test_membuffer_cache_concurrent(apr_pool_t *pool)
+{
+#if APR_HAS_THREADS
+  svn_cache__t *cache;
+  svn_membuffer_t *membuffer;
+  concurrent_baton_t batons[CONCURRENT_READER_COUNT + 1];
+  apr_thread_t *threads[CONCURRENT_READER_COUNT + 1];
+  svn_error_t *err = SVN_NO_ERROR;
+  svn_revnum_t *answer;
+  svn_boolean_t found;
+  int i;
+
+  /* A single segment makes all threads contend for the same lock. */
+  SVN_ERR(svn_cache__membuffer_cache_create(&membuffer, 1024*1024, 1,
+                                            TRUE, pool));
+  SVN_ERR(svn_cache__create_membuffer_cache(&cache, membuffer,
+                                            serialize_revnum,
+                                            deserialize_revnum,
+                                            APR_HASH_KEY_STRING,
+                                            "cache:", TRUE, pool));
+
+  /* Thread 0 writes, all others read. */
+  for (i = 0; i <= CONCURRENT_READER_COUNT; ++i)
+    {
+      apr_status_t status;
+
+      batons[i].cache = cache;
+      batons[i].pool = svn_pool_create_ex(NULL, NULL);
+      batons[i].err = SVN_NO_ERROR;
+
+      status = apr_thread_create(&threads[i], NULL,
+                                 i ? concurrent_cache_reader
+                                   : concurrent_cache_writer,
+                                 &batons[i], pool);
+      if (status)
+        return svn_error_wrap_apr(status, "Can't create thread");
+    }
+
+  for (i = 0; i <= CONCURRENT_READER_COUNT; ++i)
+    {
+      apr_status_t retval;
+
+      apr_thread_join(&retval, threads[i]);
+      svn_pool_destroy(batons[i].pool);
+      err = svn_error_compose_create(err, batons[i].err);
+    }
+  SVN_ERR(err);
+
+  /* The last write must be visible now. */
+  SVN_ERR(svn_cache__get((void **) &answer, &found, cache,
+                         apr_psprintf(pool, "key-%d",
+                                      CONCURRENT_KEY_COUNT - 1),
+                         pool));
+  if (! found || *answer != CONCURRENT_KEY_COUNT - 1)
+    return svn_error_create(SVN_ERR_TEST_FAILED, NULL,
+                            "last entry written by the writer thread "
+                            "not found");
+
+  return SVN_NO_ERROR;
+#else
+  return svn_error_create(SVN_ERR_TEST_SKIPPED, NULL,
+                          "no thread support");
+#endif
+}
+
 
 static svn_error_t *
 test_memcache_long_key(const svn_test_opts_t *opts,
@@ -269,5 +505,11 @@ struct svn_test_descriptor_t test_funcs[] =
                        "memcache svn_cache with very long keys"),
     SVN_TEST_PASS2(test_membuffer_cache_basic,
                    "basic membuffer svn_cache test"),
+    SVN_TEST_PASS2(test_membuffer_cache_shared,
+                   "membuffer svn_cache in shared memory"),
+    SVN_TEST_PASS2(test_membuffer_cache_snapshot,
+                   "save and restore membuffer svn_cache contents"),
+    SVN_TEST_PASS2(test_membuffer_cache_concurrent,
+                   "membuffer svn_cache with concurrent readers"),
     SVN_TEST_NULL
   };